@@ -18,7 +18,10 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
+#include <libgen.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
 
 #include <sepol/policydb/policydb.h>
 #include <sepol/policydb/services.h>
@@ -38,9 +41,10 @@ extern int optind;
 
 static sidtab_t sidtab;
 
-extern int mlspol;
+extern PARSER_TLS int mlspol;
 
 static int handle_unknown = SEPOL_DENY_UNKNOWN;
+static unsigned int binary = 0;
 static char *txtfile = "policy.conf";
 static char *binfile = "policy";
 
@@ -159,13 +163,158 @@ static void usage(char *progname)
 	exit(1);
 }
 
+static int build_module(char *file, char *outfile, char *progname)
+{
+	policydb_t modpolicydb;
+
+	printf("%s:  loading policy configuration from %s\n", progname, file);
+
+	/* Set policydb and sidtab used by libsepol service functions
+	   to my structures, so that I can directly populate and
+	   manipulate them. */
+	sepol_set_policydb(&modpolicydb);
+	sepol_set_sidtab(&sidtab);
+
+	if (binary) {
+		if (read_binary_policy(&modpolicydb, file, progname) == -1) {
+			exit(1);
+		}
+	} else {
+		if (policydb_init(&modpolicydb)) {
+			fprintf(stderr, "%s: out of memory!\n", progname);
+			return -1;
+		}
+
+		modpolicydb.policy_type = policy_type;
+		modpolicydb.mls = mlspol;
+		modpolicydb.handle_unknown = handle_unknown;
+
+		if (read_source_policy(&modpolicydb, file, progname) == -1) {
+			exit(1);
+		}
+
+		if (hierarchy_check_constraints(NULL, &modpolicydb)) {
+			return -1;
+		}
+	}
+
+	if (modpolicydb.policy_type == POLICY_BASE) {
+		/* Verify that we can successfully expand the base module. */
+		policydb_t kernpolicydb;
+
+		if (policydb_init(&kernpolicydb)) {
+			fprintf(stderr, "%s:  policydb_init failed\n", progname);
+			exit(1);
+		}
+		if (link_modules(NULL, &modpolicydb, NULL, 0, 0)) {
+			fprintf(stderr, "%s:  link modules failed\n", progname);
+			exit(1);
+		}
+		if (expand_module(NULL, &modpolicydb, &kernpolicydb, 0, 1)) {
+			fprintf(stderr, "%s:  expand module failed\n", progname);
+			exit(1);
+		}
+		policydb_destroy(&kernpolicydb);
+	}
+
+	if (policydb_load_isids(&modpolicydb, &sidtab))
+		exit(1);
+
+	sepol_sidtab_destroy(&sidtab);
+
+	printf("%s:  policy configuration loaded\n", progname);
+
+	if (outfile &&
+	    write_binary_policy(&modpolicydb, outfile, progname) == -1) {
+		exit(1);
+	}
+	policydb_destroy(&modpolicydb);
+
+	return 0;
+}
+
+/* DIR/NAME.mod for an INPUT of .../NAME.te */
+static char *module_outfile(const char *outdir, const char *file)
+{
+	char *copy, *name, *dot, *outfile;
+	size_t len;
+
+	copy = strdup(file);
+	if (!copy)
+		return NULL;
+	name = basename(copy);
+	dot = strrchr(name, '.');
+	if (dot && dot != name)
+		*dot = '\0';
+	len = strlen(outdir) + strlen(name) + sizeof("/.mod");
+	outfile = malloc(len);
+	if (outfile)
+		snprintf(outfile, len, "%s/%s.mod", outdir, name);
+	free(copy);
+	return outfile;
+}
+
+/*
+ * Build each of the files in its own child process, with up to 'jobs'
+ * of them running at once.  The parser keeps its state in globals, so
+ * processes rather than threads give the parallelism; the options are
+ * parsed once and inherited by every child.
+ */
+static int build_modules(char **files, int nfiles, char *outdir, long jobs,
+			 char *progname)
+{
+	char *outfile = NULL;
+	int i, running = 0, failed = 0, status;
+	pid_t pid;
+
+	for (i = 0; i < nfiles || running; ) {
+		if (i < nfiles && running < jobs) {
+			if (outdir) {
+				outfile = module_outfile(outdir, files[i]);
+				if (!outfile) {
+					fprintf(stderr, "%s:  out of memory!\n", progname);
+					return 1;
+				}
+			}
+			fflush(NULL);
+			pid = fork();
+			if (pid < 0) {
+				fprintf(stderr, "%s:  fork failed:  %s\n",
+					progname, strerror(errno));
+				free(outfile);
+				return 1;
+			}
+			if (pid == 0)
+				exit(build_module(files[i], outfile, progname) ? 1 : 0);
+			free(outfile);
+			outfile = NULL;
+			running++;
+			i++;
+			continue;
+		}
+		if (wait(&status) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed++;
+	}
+
+	if (failed)
+		fprintf(stderr, "%s:  %d of %d modules failed\n", progname,
+			failed, nfiles);
+	return failed ? 1 : 0;
+}
+
 int main(int argc, char **argv)
 {
-	char *file = txtfile, *outfile = NULL;
-	unsigned int binary = 0;
+	char *file = txtfile, *outfile = NULL, *outdir = NULL;
 	int ch;
 	int show_version = 0;
-	policydb_t modpolicydb;
+	long jobs = 1;
+	char *end;
 	struct option long_options[] = {
 		{"help", no_argument, NULL, 'h'},
 		{"output", required_argument, NULL, 'o'},
@@ -173,10 +322,12 @@ int main(int argc, char **argv)
 		{"version", no_argument, NULL, 'V'},
 		{"handle-unknown", required_argument, NULL, 'U'},
 		{"mls", no_argument, NULL, 'M'},
+		{"directory", required_argument, NULL, 'd'},
+		{"jobs", required_argument, NULL, 'j'},
 		{NULL, 0, NULL, 0}
 	};
 
-	while ((ch = getopt_long(argc, argv, "ho:bVU:mM", long_options, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "ho:bVU:mMd:j:", long_options, NULL)) != -1) {
 		switch (ch) {
 		case 'h':
 			usage(argv[0]);
@@ -212,6 +363,15 @@ int main(int argc, char **argv)
 		case 'M':
 			mlspol = 1;
 			break;
+		case 'd':
+			outdir = optarg;
+			break;
+		case 'j':
+			errno = 0;
+			jobs = strtol(optarg, &end, 10);
+			if (errno || *end || jobs < 1)
+				usage(argv[0]);
+			break;
 		default:
 			usage(argv[0]);
 		}
@@ -233,75 +393,21 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (optind != argc) {
-		file = argv[optind++];
-		if (optind != argc)
+	if (outdir || optind + 1 < argc) {
+		if (optind == argc)
 			usage(argv[0]);
-	}
-	printf("%s:  loading policy configuration from %s\n", argv[0], file);
-
-	/* Set policydb and sidtab used by libsepol service functions
-	   to my structures, so that I can directly populate and
-	   manipulate them. */
-	sepol_set_policydb(&modpolicydb);
-	sepol_set_sidtab(&sidtab);
-
-	if (binary) {
-		if (read_binary_policy(&modpolicydb, file, argv[0]) == -1) {
-			exit(1);
-		}
-	} else {
-		if (policydb_init(&modpolicydb)) {
-			fprintf(stderr, "%s: out of memory!\n", argv[0]);
-			return -1;
-		}
-
-		modpolicydb.policy_type = policy_type;
-		modpolicydb.mls = mlspol;
-		modpolicydb.handle_unknown = handle_unknown;
-
-		if (read_source_policy(&modpolicydb, file, argv[0]) == -1) {
-			exit(1);
-		}
-
-		if (hierarchy_check_constraints(NULL, &modpolicydb)) {
-			return -1;
-		}
-	}
-
-	if (modpolicydb.policy_type == POLICY_BASE) {
-		/* Verify that we can successfully expand the base module. */
-		policydb_t kernpolicydb;
-
-		if (policydb_init(&kernpolicydb)) {
-			fprintf(stderr, "%s:  policydb_init failed\n", argv[0]);
-			exit(1);
-		}
-		if (link_modules(NULL, &modpolicydb, NULL, 0, 0)) {
-			fprintf(stderr, "%s:  link modules failed\n", argv[0]);
-			exit(1);
-		}
-		if (expand_module(NULL, &modpolicydb, &kernpolicydb, 0, 1)) {
-			fprintf(stderr, "%s:  expand module failed\n", argv[0]);
+		if (outfile) {
+			fprintf(stderr, "%s:  -o cannot be used with -d or several inputs.\n", argv[0]);
 			exit(1);
 		}
-		policydb_destroy(&kernpolicydb);
+		return build_modules(argv + optind, argc - optind, outdir,
+				     jobs, argv[0]);
 	}
 
-	if (policydb_load_isids(&modpolicydb, &sidtab))
-		exit(1);
-
-	sepol_sidtab_destroy(&sidtab);
-
-	printf("%s:  policy configuration loaded\n", argv[0]);
-
-	if (outfile &&
-	    write_binary_policy(&modpolicydb, outfile, argv[0]) == -1) {
-		exit(1);
-	}
-	policydb_destroy(&modpolicydb);
+	if (optind != argc)
+		file = argv[optind];
 
-	return 0;
+	return build_module(file, outfile, argv[0]);
 }
 
 /* FLASK */
@@ -92,8 +92,8 @@ extern int optind;
 static policydb_t policydb;
 static sidtab_t sidtab;
 
-extern policydb_t *policydbp;
-extern int mlspol;
+extern PARSER_TLS policydb_t *policydbp;
+extern PARSER_TLS int mlspol;
 
 static int handle_unknown = SEPOL_DENY_UNKNOWN;
 static char *txtfile = "policy.conf";
@@ -20,6 +20,7 @@
 
 #include "queue.h"
 #include "module_compiler.h"
+#include "parse_util.h"
 
 union stack_item_u {
 	avrule_block_t *avrule;
@@ -34,11 +35,13 @@ typedef struct scope_stack {
 	avrule_t *last_avrule;
 	int in_else;		/* if in an avrule block, within ELSE branch */
 	int require_given;	/* 1 if this block had at least one require */
+	hashtab_t cond_table;	/* index of decl->cond_list by expression,
+				 * built by get_current_cond_list() */
 	struct scope_stack *parent, *child;
 } scope_stack_t;
 
-extern policydb_t *policydbp;
-extern queue_t id_queue;
+extern PARSER_TLS policydb_t *policydbp;
+extern PARSER_TLS queue_t id_queue;
 extern int yyerror(char *msg);
 extern void yyerror2(char *fmt, ...);
 
@@ -46,9 +49,14 @@ static int push_stack(int stack_type, ...);
 static void pop_stack(void);
 
 /* keep track of the last item added to the stack */
-static scope_stack_t *stack_top = NULL;
-static avrule_block_t *last_block;
-static uint32_t next_decl_id = 1;
+static PARSER_TLS scope_stack_t *stack_top = NULL;
+static PARSER_TLS avrule_block_t *last_block;
+static PARSER_TLS uint32_t next_decl_id = 1;
+
+/* stack_decls[id] is set while the declaration with that decl_id is on
+ * the scope stack, so that scope checks need not walk the stack. */
+static PARSER_TLS char *stack_decls;
+static PARSER_TLS uint32_t stack_decls_len;
 
 int define_policy(int pass, int module_header_given)
 {
@@ -1222,26 +1230,42 @@ int require_cat(int pass)
 	}
 }
 
-static int is_scope_in_stack(scope_datum_t * scope, scope_stack_t * stack)
+/* Mark or unmark a declaration as being on the scope stack. */
+static int set_stack_decl(avrule_decl_t * decl, char on)
 {
-	int i;
-	if (stack == NULL) {
-		return 0;	/* no matching scope found */
+	uint32_t id = decl->decl_id, len;
+	char *decls;
+
+	if (id >= stack_decls_len) {
+		if (!on)
+			return 0;
+		len = stack_decls_len ? stack_decls_len : 64;
+		while (len <= id)
+			len *= 2;
+		decls = realloc(stack_decls, len);
+		if (decls == NULL)
+			return -1;
+		memset(decls + stack_decls_len, 0, len - stack_decls_len);
+		stack_decls = decls;
+		stack_decls_len = len;
 	}
-	if (stack->type == 1) {
-		avrule_decl_t *decl = stack->decl;
-		for (i = 0; i < scope->decl_ids_len; i++) {
-			if (scope->decl_ids[i] == decl->decl_id) {
-				return 1;
-			}
+	stack_decls[id] = on;
+	return 0;
+}
+
+static int is_scope_in_stack(scope_datum_t * scope)
+{
+	uint32_t i;
+
+	/* conditionals can't declare or require symbols, so only the
+	 * declarations on the stack count */
+	for (i = 0; i < scope->decl_ids_len; i++) {
+		if (scope->decl_ids[i] < stack_decls_len &&
+		    stack_decls[scope->decl_ids[i]]) {
+			return 1;
 		}
-	} else {
-		/* note that conditionals can't declare or require
-		 * symbols, so skip this level */
 	}
-
-	/* not within scope of this stack, so try its parent */
-	return is_scope_in_stack(scope, stack->parent);
+	return 0;		/* no matching scope found */
 }
 
 int is_id_in_scope(uint32_t symbol_type, hashtab_key_t id)
@@ -1252,7 +1276,7 @@ int is_id_in_scope(uint32_t symbol_type, hashtab_key_t id)
 	if (scope == NULL) {
 		return 1;	/* id is not known, so return success */
 	}
-	return is_scope_in_stack(scope, stack_top);
+	return is_scope_in_stack(scope);
 }
 
 static int is_perm_in_scope_index(uint32_t perm_value, uint32_t class_value,
@@ -1314,7 +1338,13 @@ cond_list_t *get_current_cond_list(cond_list_t * cond)
 	/* FIX ME: do something different here if in a nested
 	 * conditional? */
 	avrule_decl_t *decl = stack_top->decl;
-	return get_decl_cond_list(policydbp, decl, cond);
+	if (stack_top->cond_table == NULL) {
+		stack_top->cond_table = cond_node_table_create(decl->cond_list);
+		if (stack_top->cond_table == NULL)
+			return NULL;
+	}
+	return cond_node_table_search(policydbp, stack_top->cond_table,
+				      &decl->cond_list, cond);
 }
 
 /* Append the new conditional node to the existing ones.  During
@@ -1471,8 +1501,15 @@ int begin_optional_else(int pass)
 		assert(decl != NULL &&
 		       decl->next == NULL && decl->decl_id == next_decl_id);
 	}
+	if (set_stack_decl(decl, 1)) {
+		yyerror("Out of memory!");
+		return -1;
+	}
+	set_stack_decl(stack_top->decl, 0);
 	stack_top->in_else = 1;
 	stack_top->decl = decl;
+	hashtab_destroy(stack_top->cond_table);
+	stack_top->cond_table = NULL;
 	stack_top->last_avrule = NULL;
 	stack_top->require_given = 0;
 	next_decl_id++;
@@ -1571,6 +1608,11 @@ static int push_stack(int stack_type, ...)
 	case 1:{
 			s->u.avrule = va_arg(ap, avrule_block_t *);
 			s->decl = va_arg(ap, avrule_decl_t *);
+			if (set_stack_decl(s->decl, 1)) {
+				va_end(ap);
+				free(s);
+				return -1;
+			}
 			break;
 		}
 	case 2:{
@@ -1598,6 +1640,10 @@ static void pop_stack(void)
 	if (parent != NULL) {
 		parent->child = NULL;
 	}
+	if (stack_top->type == 1) {
+		set_stack_decl(stack_top->decl, 0);
+	}
+	hashtab_destroy(stack_top->cond_table);
 	free(stack_top);
 	stack_top = parent;
 }
@@ -22,21 +22,26 @@
 #include "queue.h"
 
 /* these are defined in policy_parse.y and are needed for read_source_policy */
-extern FILE *yyin;
 extern void init_parser(int);
 extern int yyparse(void);
-extern void yyrestart(FILE *);
-extern queue_t id_queue;
-extern unsigned int policydb_errors;
-extern unsigned long policydb_lineno;
-extern policydb_t *policydbp;
-extern int mlspol;
+extern PARSER_TLS queue_t id_queue;
+extern PARSER_TLS unsigned int policydb_errors;
+extern PARSER_TLS unsigned long policydb_lineno;
+extern PARSER_TLS policydb_t *policydbp;
+extern PARSER_TLS int mlspol;
 extern void set_source_file(const char *name);
+extern void scan_start(FILE *f);
+extern void scan_end(void);
+extern int replay_tokens(void);
+extern void free_tokens(void);
 
 int read_source_policy(policydb_t * p, const char *file, const char *progname)
 {
-	yyin = fopen(file, "r");
-	if (!yyin) {
+	FILE *f;
+	int rc = -1;
+
+	f = fopen(file, "r");
+	if (!f) {
 		fprintf(stderr, "%s:  unable to open %s\n", progname, file);
 		return -1;
 	}
@@ -44,35 +49,42 @@ int read_source_policy(policydb_t * p, const char *file, const char *progname)
 
 	if ((id_queue = queue_create()) == NULL) {
 		fprintf(stderr, "%s: out of memory!\n", progname);
+		fclose(f);
 		return -1;
 	}
 
 	policydbp = p;
 	mlspol = p->mls;
 
+	scan_start(f);
 	init_parser(1);
 	if (yyparse() || policydb_errors) {
 		fprintf(stderr,
 			"%s:  error(s) encountered while parsing configuration\n",
 			progname);
-		return -1;
+		goto out;
 	}
-	rewind(yyin);
+	/* The second pass replays the tokens of the first one. */
 	init_parser(2);
 	set_source_file(file);
-	yyrestart(yyin);
+	if (replay_tokens()) {
+		scan_end();
+		rewind(f);
+		scan_start(f);
+	}
 	if (yyparse() || policydb_errors) {
 		fprintf(stderr,
 			"%s:  error(s) encountered while parsing configuration\n",
 			progname);
-		return -1;
+		goto out;
 	}
+	rc = 0;
+      out:
+	scan_end();
+	free_tokens();
 	queue_destroy(id_queue);
+	id_queue = NULL;
+	fclose(f);
 
-	if (policydb_errors)
-		return -1;
-
-	fclose(yyin);
-
-	return 0;
+	return rc;
 }
@@ -25,6 +25,10 @@
 
 #include <sepol/policydb/policydb.h>
 
+/* The parser keeps its state per thread, so that several threads may
+ * each read a source policy at the same time. */
+#define PARSER_TLS __thread
+
 /* Read a source policy and populate the policydb passed in. The
  * policydb must already have been created and configured (e.g.,
  * expected policy type set. The string progname is used for
@@ -51,23 +51,24 @@
 #include "checkpolicy.h"
 #include "module_compiler.h"
 #include "policy_define.h"
+#include "parse_util.h"
 
-policydb_t *policydbp;
-queue_t id_queue = 0;
-unsigned int pass;
+PARSER_TLS policydb_t *policydbp;
+PARSER_TLS queue_t id_queue = 0;
+PARSER_TLS unsigned int pass;
 char *curfile = 0;
-int mlspol = 0;
+PARSER_TLS int mlspol = 0;
 
-extern unsigned long policydb_lineno;
-extern unsigned long source_lineno;
-extern unsigned int policydb_errors;
-extern char source_file[PATH_MAX];
+extern PARSER_TLS unsigned long policydb_lineno;
+extern PARSER_TLS unsigned long source_lineno;
+extern PARSER_TLS unsigned int policydb_errors;
+extern PARSER_TLS char source_file[PATH_MAX];
 
 extern int yywarn(char *msg);
 extern int yyerror(char *msg);
 
 #define ERRORMSG_LEN 255
-static char errormsg[ERRORMSG_LEN + 1] = {0};
+static PARSER_TLS char errormsg[ERRORMSG_LEN + 1] = {0};
 
 static int id_has_dot(char *id);
 static int parse_security_context(context_struct_t *c);
@@ -111,12 +112,11 @@ int insert_id(char *id, int push)
 	char *newid = 0;
 	int error;
 
-	newid = (char *)malloc(strlen(id) + 1);
+	newid = strdup(id);
 	if (!newid) {
 		yyerror("out of memory");
 		return -1;
 	}
-	strcpy(newid, id);
 	if (push)
 		error = queue_push(id_queue, (queue_element_t) newid);
 	else
@@ -1448,7 +1448,102 @@ struct val_to_name {
 /* Adds a type, given by its textual name, to a typeset.  If *add is
    0, then add the type to the negative set; otherwise if *add is 1
    then add it to the positive side. */
-static int set_types(type_set_t * set, char *id, int *add, char starallowed)
+/*
+ * Collects bit numbers so that an ebitmap is built in one pass once all
+ * of them are known, instead of walking the node list on every
+ * ebitmap_set_bit() of a long identifier list.
+ */
+typedef struct ebitmap_builder {
+	uint32_t *bits;
+	uint32_t nbits;
+	uint32_t size;
+} ebitmap_builder_t;
+
+static void ebitmap_builder_init(ebitmap_builder_t * b)
+{
+	memset(b, 0, sizeof(*b));
+}
+
+static void ebitmap_builder_destroy(ebitmap_builder_t * b)
+{
+	free(b->bits);
+	ebitmap_builder_init(b);
+}
+
+static int ebitmap_builder_add(ebitmap_builder_t * b, uint32_t bit)
+{
+	uint32_t *bits;
+	uint32_t size;
+
+	if (b->nbits == b->size) {
+		size = b->size ? b->size * 2 : 64;
+		bits = realloc(b->bits, size * sizeof(*bits));
+		if (!bits)
+			return -1;
+		b->bits = bits;
+		b->size = size;
+	}
+	b->bits[b->nbits++] = bit;
+	return 0;
+}
+
+static int uint32_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Set the collected bits in e and destroy the builder. */
+static int ebitmap_builder_finish(ebitmap_builder_t * b, ebitmap_t * e)
+{
+	ebitmap_t new;
+	ebitmap_node_t *n, **tail;
+	uint32_t i, startbit;
+	int rc = 0;
+
+	if (!b->nbits)
+		goto out;
+
+	qsort(b->bits, b->nbits, sizeof(*b->bits), uint32_cmp);
+	ebitmap_init(&new);
+	tail = &new.node;
+	n = NULL;
+	for (i = 0; i < b->nbits; i++) {
+		startbit = b->bits[i] - (b->bits[i] % MAPSIZE);
+		if (!n || n->startbit != startbit) {
+			n = calloc(1, sizeof(*n));
+			if (!n) {
+				ebitmap_destroy(&new);
+				rc = -1;
+				goto out;
+			}
+			n->startbit = startbit;
+			*tail = n;
+			tail = &n->next;
+		}
+		n->map |= MAPBIT << (b->bits[i] - startbit);
+	}
+	new.highbit = n->startbit + MAPSIZE;
+
+	if (!e->node) {
+		*e = new;
+	} else {
+		rc = ebitmap_union(e, &new);
+		ebitmap_destroy(&new);
+	}
+      out:
+	ebitmap_builder_destroy(b);
+	return rc;
+}
+
+typedef struct type_set_builder {
+	ebitmap_builder_t types;
+	ebitmap_builder_t negset;
+} type_set_builder_t;
+
+static int set_types(type_set_t * set, type_set_builder_t * b, char *id,
+		     int *add, char starallowed)
 {
 	type_datum_t *t;
 
@@ -1495,10 +1590,10 @@ static int set_types(type_set_t * set, char *id, int *add, char starallowed)
 	}
 
 	if (*add == 0) {
-		if (ebitmap_set_bit(&set->negset, t->s.value - 1, TRUE))
+		if (ebitmap_builder_add(&b->negset, t->s.value - 1))
 			goto oom;
 	} else {
-		if (ebitmap_set_bit(&set->types, t->s.value - 1, TRUE))
+		if (ebitmap_builder_add(&b->types, t->s.value - 1))
 			goto oom;
 	}
 	free(id);
@@ -1510,6 +1605,45 @@ static int set_types(type_set_t * set, char *id, int *add, char starallowed)
 	return -1;
 }
 
+static int type_set_builder_finish(type_set_builder_t * b, type_set_t * set)
+{
+	int rc;
+
+	rc = ebitmap_builder_finish(&b->types, &set->types);
+	if (ebitmap_builder_finish(&b->negset, &set->negset))
+		rc = -1;
+	if (rc)
+		yyerror("Out of memory");
+	return rc;
+}
+
+/*
+ * Read the type identifiers up to the next separator into set.  If self
+ * is not NULL, "self" is accepted and sets *self.
+ */
+static int read_types(type_set_t * set, char starallowed, int *self)
+{
+	type_set_builder_t b;
+	char *id;
+	int add = 1;
+
+	ebitmap_builder_init(&b.types);
+	ebitmap_builder_init(&b.negset);
+	while ((id = queue_remove(id_queue))) {
+		if (self && strcmp(id, "self") == 0) {
+			free(id);
+			*self = 1;
+			continue;
+		}
+		if (set_types(set, &b, id, &add, starallowed)) {
+			ebitmap_builder_destroy(&b.types);
+			ebitmap_builder_destroy(&b.negset);
+			return -1;
+		}
+	}
+	return type_set_builder_finish(&b, set);
+}
+
 int define_compute_type_helper(int which, avrule_t ** rule)
 {
 	char *id;
@@ -1518,7 +1652,7 @@ int define_compute_type_helper(int which, avrule_t ** rule)
 	ebitmap_node_t *node;
 	avrule_t *avrule;
 	class_perm_node_t *perm;
-	int i, add = 1;
+	int i;
 
 	avrule = malloc(sizeof(avrule_t));
 	if (!avrule) {
@@ -1535,15 +1669,10 @@ int define_compute_type_helper(int which, avrule_t ** rule)
 		return -1;
 	}
 
-	while ((id = queue_remove(id_queue))) {
-		if (set_types(&avrule->stypes, id, &add, 0))
-			goto bad;
-	}
-	add = 1;
-	while ((id = queue_remove(id_queue))) {
-		if (set_types(&avrule->ttypes, id, &add, 0))
-			goto bad;
-	}
+	if (read_types(&avrule->stypes, 0, NULL))
+		goto bad;
+	if (read_types(&avrule->ttypes, 0, NULL))
+		goto bad;
 
 	ebitmap_init(&tclasses);
 	if (read_classes(&tclasses))
@@ -1735,7 +1864,7 @@ int define_te_avtab_helper(int which, avrule_t ** rule)
 	ebitmap_node_t *node;
 	avrule_t *avrule;
 	unsigned int i;
-	int add = 1, ret = 0;
+	int self = 0, ret = 0;
 	int suppress = 0;
 
 	avrule = (avrule_t *) malloc(sizeof(avrule_t));
@@ -1755,28 +1884,18 @@ int define_te_avtab_helper(int which, avrule_t ** rule)
 	}
 
 
-	while ((id = queue_remove(id_queue))) {
-		if (set_types
-		    (&avrule->stypes, id, &add,
-		     which == AVRULE_NEVERALLOW ? 1 : 0)) {
-			ret = -1;
-			goto out;
-		}
+	if (read_types(&avrule->stypes, which == AVRULE_NEVERALLOW ? 1 : 0,
+		       NULL)) {
+		ret = -1;
+		goto out;
 	}
-	add = 1;
-	while ((id = queue_remove(id_queue))) {
-		if (strcmp(id, "self") == 0) {
-			free(id);
-			avrule->flags |= RULE_SELF;
-			continue;
-		}
-		if (set_types
-		    (&avrule->ttypes, id, &add,
-		     which == AVRULE_NEVERALLOW ? 1 : 0)) {
-			ret = -1;
-			goto out;
-		}
+	if (read_types(&avrule->ttypes, which == AVRULE_NEVERALLOW ? 1 : 0,
+		       &self)) {
+		ret = -1;
+		goto out;
 	}
+	if (self)
+		avrule->flags |= RULE_SELF;
 
 	ebitmap_init(&tclasses);
 	ret = read_classes(&tclasses);
@@ -1918,7 +2037,6 @@ int define_role_types(void)
 {
 	role_datum_t *role;
 	char *id;
-	int add = 1;
 
 	if (pass == 1) {
 		while ((id = queue_remove(id_queue)))
@@ -1945,10 +2063,8 @@ int define_role_types(void)
 		return -1;
 	}
 
-	while ((id = queue_remove(id_queue))) {
-		if (set_types(&role->types, id, &add, 0))
-			return -1;
-	}
+	if (read_types(&role->types, 0, NULL))
+		return -1;
 
 	return 0;
 }
@@ -2299,7 +2415,7 @@ static char *role_val_to_name(unsigned int val)
 	return NULL;
 }
 
-static int set_roles(role_set_t * set, char *id)
+static int set_roles(ebitmap_builder_t * b, char *id)
 {
 	role_datum_t *r;
 
@@ -2326,7 +2442,7 @@ static int set_roles(role_set_t * set, char *id)
 		return -1;
 	}
 
-	if (ebitmap_set_bit(&set->roles, r->s.value - 1, TRUE)) {
+	if (ebitmap_builder_add(b, r->s.value - 1)) {
 		yyerror("out of memory");
 		free(id);
 		return -1;
@@ -2335,6 +2451,26 @@ static int set_roles(role_set_t * set, char *id)
 	return 0;
 }
 
+/* Read the role identifiers up to the next separator into set. */
+static int read_roles(role_set_t * set)
+{
+	ebitmap_builder_t b;
+	char *id;
+
+	ebitmap_builder_init(&b);
+	while ((id = queue_remove(id_queue))) {
+		if (set_roles(&b, id)) {
+			ebitmap_builder_destroy(&b);
+			return -1;
+		}
+	}
+	if (ebitmap_builder_finish(&b, &set->roles)) {
+		yyerror("out of memory");
+		return -1;
+	}
+	return 0;
+}
+
 int define_role_trans(int class_specified)
 {
 	char *id;
@@ -2347,7 +2483,6 @@ int define_role_trans(int class_specified)
 	struct role_trans *tr = NULL;
 	struct role_trans_rule *rule = NULL;
 	unsigned int i, j, k;
-	int add = 1;
 
 	if (pass == 1) {
 		while ((id = queue_remove(id_queue)))
@@ -2368,15 +2503,10 @@ int define_role_trans(int class_specified)
 	ebitmap_init(&e_types);
 	ebitmap_init(&e_classes);
 
-	while ((id = queue_remove(id_queue))) {
-		if (set_roles(&roles, id))
-			return -1;
-	}
-	add = 1;
-	while ((id = queue_remove(id_queue))) {
-		if (set_types(&types, id, &add, 0))
-			return -1;
-	}
+	if (read_roles(&roles))
+		return -1;
+	if (read_types(&types, 0, NULL))
+		return -1;
 
 	if (class_specified) {
 		if (read_classes(&e_classes))
@@ -2506,18 +2636,14 @@ int define_role_allow(void)
 	}
 	role_allow_rule_init(ra);
 
-	while ((id = queue_remove(id_queue))) {
-		if (set_roles(&ra->roles, id)) {
-			free(ra);
-			return -1;
-		}
+	if (read_roles(&ra->roles)) {
+		free(ra);
+		return -1;
 	}
 
-	while ((id = queue_remove(id_queue))) {
-		if (set_roles(&ra->new_roles, id)) {
-			free(ra);
-			return -1;
-		}
+	if (read_roles(&ra->new_roles)) {
+		free(ra);
+		return -1;
 	}
 
 	append_role_allow(ra);
@@ -2543,7 +2669,6 @@ int define_filename_trans(void)
 	type_datum_t *typdatum;
 	uint32_t otype;
 	unsigned int c, s, t;
-	int add;
 
 	if (pass == 1) {
 		/* stype */
@@ -2564,20 +2689,13 @@ int define_filename_trans(void)
 		return 0;
 	}
 
-
-	add = 1;
 	type_set_init(&stypes);
-	while ((id = queue_remove(id_queue))) {
-		if (set_types(&stypes, id, &add, 0))
-			goto bad;
-	}
+	if (read_types(&stypes, 0, NULL))
+		goto bad;
 
-	add =1;
 	type_set_init(&ttypes);
-	while ((id = queue_remove(id_queue))) {
-		if (set_types(&ttypes, id, &add, 0))
-			goto bad;
-	}
+	if (read_types(&ttypes, 0, NULL))
+		goto bad;
 
 	ebitmap_init(&e_tclasses);
 	if (read_classes(&e_tclasses))
@@ -2990,6 +3108,8 @@ uintptr_t define_cexpr(uint32_t expr_type, uintptr_t arg1, uintptr_t arg2)
 	user_datum_t *user;
 	role_datum_t *role;
 	ebitmap_t negset;
+	ebitmap_builder_t names;
+	type_set_builder_t types;
 	char *id;
 	uint32_t val;
 	int add = 1;
@@ -3062,13 +3182,15 @@ uintptr_t define_cexpr(uint32_t expr_type, uintptr_t arg1, uintptr_t arg2)
 		expr->attr = arg1;
 		expr->op = arg2;
 		ebitmap_init(&negset);
+		ebitmap_builder_init(&names);
+		ebitmap_builder_init(&types.types);
+		ebitmap_builder_init(&types.negset);
 		while ((id = (char *)queue_remove(id_queue))) {
 			if (expr->attr & CEXPR_USER) {
 				if (!is_id_in_scope(SYM_USERS, id)) {
 					yyerror2("user %s is not within scope",
 						 id);
-					constraint_expr_destroy(expr);
-					return 0;
+					goto bad_names;
 				}
 				user =
 				    (user_datum_t *) hashtab_search(policydbp->
@@ -3078,16 +3200,14 @@ uintptr_t define_cexpr(uint32_t expr_type, uintptr_t arg1, uintptr_t arg2)
 								    id);
 				if (!user) {
 					yyerror2("unknown user %s", id);
-					constraint_expr_destroy(expr);
-					return 0;
+					goto bad_names;
 				}
 				val = user->s.value;
 			} else if (expr->attr & CEXPR_ROLE) {
 				if (!is_id_in_scope(SYM_ROLES, id)) {
 					yyerror2("role %s is not within scope",
 						 id);
-					constraint_expr_destroy(expr);
-					return 0;
+					goto bad_names;
 				}
 				role =
 				    (role_datum_t *) hashtab_search(policydbp->
@@ -3097,29 +3217,31 @@ uintptr_t define_cexpr(uint32_t expr_type, uintptr_t arg1, uintptr_t arg2)
 								    id);
 				if (!role) {
 					yyerror2("unknown role %s", id);
-					constraint_expr_destroy(expr);
-					return 0;
+					goto bad_names;
 				}
 				val = role->s.value;
 			} else if (expr->attr & CEXPR_TYPE) {
-				if (set_types(expr->type_names, id, &add, 0)) {
-					constraint_expr_destroy(expr);
-					return 0;
-				}
+				if (set_types(expr->type_names, &types, id,
+					      &add, 0))
+					goto bad_names;
 				continue;
 			} else {
 				yyerror("invalid constraint expression");
-				constraint_expr_destroy(expr);
-				return 0;
+				goto bad_names;
 			}
-			if (ebitmap_set_bit(&expr->names, val - 1, TRUE)) {
+			if (ebitmap_builder_add(&names, val - 1)) {
 				yyerror("out of memory");
-				ebitmap_destroy(&expr->names);
-				constraint_expr_destroy(expr);
-				return 0;
+				goto bad_names;
 			}
 			free(id);
 		}
+		if (ebitmap_builder_finish(&names, &expr->names)) {
+			yyerror("out of memory");
+			goto bad_names;
+		}
+		if ((expr->attr & CEXPR_TYPE) &&
+		    type_set_builder_finish(&types, expr->type_names))
+			goto bad_names;
 		ebitmap_destroy(&negset);
 		return (uintptr_t) expr;
 	default:
@@ -3129,6 +3251,13 @@ uintptr_t define_cexpr(uint32_t expr_type, uintptr_t arg1, uintptr_t arg2)
 	yyerror("invalid constraint expression");
 	constraint_expr_destroy(expr);
 	return 0;
+
+      bad_names:
+	ebitmap_builder_destroy(&names);
+	ebitmap_builder_destroy(&types.types);
+	ebitmap_builder_destroy(&types.negset);
+	constraint_expr_destroy(expr);
+	return 0;
 }
 
 int define_conditional(cond_expr_t * expr, avrule_t * t, avrule_t * f)
@@ -4629,7 +4758,7 @@ int define_range_trans(int class_specified)
 	level_datum_t *levdatum = 0;
 	class_datum_t *cladatum;
 	range_trans_rule_t *rule;
-	int l, add = 1;
+	int l;
 
 	if (!mlspol) {
 		yyerror("range_transition rule in non-MLS configuration");
@@ -4665,15 +4794,10 @@ int define_range_trans(int class_specified)
 	}
 	range_trans_rule_init(rule);
 
-	while ((id = queue_remove(id_queue))) {
-		if (set_types(&rule->stypes, id, &add, 0))
-			goto out;
-	}
-	add = 1;
-	while ((id = queue_remove(id_queue))) {
-		if (set_types(&rule->ttypes, id, &add, 0))
-			goto out;
-	}
+	if (read_types(&rule->stypes, 0, NULL))
+		goto out;
+	if (read_types(&rule->ttypes, 0, NULL))
+		goto out;
 
 	if (class_specified) {
 		if (read_classes(&rule->tclasses))
@@ -52,12 +52,14 @@
 #include "checkpolicy.h"
 #include "module_compiler.h"
 #include "policy_define.h"
+#include "parse_util.h"
 
-extern policydb_t *policydbp;
-extern unsigned int pass;
+extern PARSER_TLS policydb_t *policydbp;
+extern PARSER_TLS unsigned int pass;
 
-extern char yytext[];
-extern int yylex(void);
+extern PARSER_TLS char policy_text[];
+union YYSTYPE;
+extern int yylex(union YYSTYPE *lvalp);
 extern int yywarn(char *msg);
 extern int yyerror(char *msg);
 
@@ -72,6 +74,8 @@ typedef int (* require_func_t)();
         require_func_t require_func;
 }
 
+%define api.pure
+
 %type <ptr> cond_expr cond_expr_prim cond_pol_list cond_else
 %type <ptr> cond_allow_def cond_auditallow_def cond_auditdeny_def cond_dontaudit_def
 %type <ptr> cond_transition_def cond_te_avtab_def cond_rule_def
@@ -727,7 +731,7 @@ genfs_context_def	: GENFSCON filesystem path '-' identifier security_context_def
 			{if (define_genfs_context(0)) return -1;}
 			;
 ipv4_addr_def		: IPV4_ADDR
-			{ if (insert_id(yytext,0)) return -1; }
+			{ if (insert_id(policy_text,0)) return -1; }
 			;
 security_context_def	: identifier ':' identifier ':' identifier opt_mls_range_def
 	                ;
@@ -783,7 +787,7 @@ identifier_list_push	: identifier_push
 			| identifier_list_push identifier_push
 			;
 identifier_push		: IDENTIFIER
-			{ if (insert_id(yytext, 1)) return -1; }
+			{ if (insert_id(policy_text, 1)) return -1; }
 			;
 identifier_list		: identifier
 			| identifier_list identifier
@@ -795,24 +799,24 @@ nested_id_list          : nested_id_element | nested_id_list nested_id_element
 nested_id_element       : identifier | '-' { if (insert_id("-", 0)) return -1; } identifier | nested_id_set
                         ;
 identifier		: IDENTIFIER
-			{ if (insert_id(yytext,0)) return -1; }
+			{ if (insert_id(policy_text,0)) return -1; }
 			;
 filesystem		: FILESYSTEM
-                        { if (insert_id(yytext,0)) return -1; }
+                        { if (insert_id(policy_text,0)) return -1; }
                         | IDENTIFIER
-			{ if (insert_id(yytext,0)) return -1; }
+			{ if (insert_id(policy_text,0)) return -1; }
                         ;
 path     		: PATH
-			{ if (insert_id(yytext,0)) return -1; }
+			{ if (insert_id(policy_text,0)) return -1; }
 			;
 filename		: FILENAME
-			{ yytext[strlen(yytext) - 1] = '\0'; if (insert_id(yytext + 1,0)) return -1; }
+			{ policy_text[strlen(policy_text) - 1] = '\0'; if (insert_id(policy_text + 1,0)) return -1; }
 			;
 number			: NUMBER 
-			{ $$ = strtoul(yytext,NULL,0); }
+			{ $$ = strtoul(policy_text,NULL,0); }
 			;
 ipv6_addr		: IPV6_ADDR
-			{ if (insert_id(yytext,0)) return -1; }
+			{ if (insert_id(policy_text,0)) return -1; }
 			;
 policycap_def		: POLICYCAP identifier ';'
 			{if (define_polcap()) return -1;}
@@ -831,9 +835,9 @@ module_def              : MODULE identifier version_identifier ';'
                         { if (define_policy(pass, 1) == -1) return -1; }
                         ;
 version_identifier      : VERSION_IDENTIFIER
-                        { if (insert_id(yytext,0)) return -1; }
+                        { if (insert_id(policy_text,0)) return -1; }
 			| number
-                        { if (insert_id(yytext,0)) return -1; }
+                        { if (insert_id(policy_text,0)) return -1; }
                         | ipv4_addr_def /* version can look like ipv4 address */
                         ;
 avrules_block           : avrule_decls avrule_user_defs
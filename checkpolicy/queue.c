@@ -10,6 +10,10 @@
 #include <stdlib.h>
 #include "queue.h"
 
+#define QUEUE_INITIAL_SIZE 64
+
+#define queue_slot(q, i) ((q)->elements[((q)->first + (i)) & ((q)->size - 1)])
+
 queue_t queue_create(void)
 {
 	queue_t q;
@@ -18,77 +22,78 @@ queue_t queue_create(void)
 	if (q == NULL)
 		return NULL;
 
-	q->head = q->tail = NULL;
+	q->elements = NULL;
+	q->size = q->first = q->count = 0;
 
 	return q;
 }
 
-int queue_insert(queue_t q, queue_element_t e)
+/* Make room for one more element, unwrapping the ring into a new array. */
+static int queue_grow(queue_t q)
 {
-	queue_node_ptr_t newnode;
+	queue_element_t *elements;
+	unsigned int size, i;
 
-	if (!q)
+	if (q->count < q->size)
+		return 0;
+
+	size = q->size ? q->size * 2 : QUEUE_INITIAL_SIZE;
+	elements = (queue_element_t *) malloc(size * sizeof(queue_element_t));
+	if (elements == NULL)
 		return -1;
 
-	newnode = (queue_node_ptr_t) malloc(sizeof(struct queue_node));
-	if (newnode == NULL)
+	for (i = 0; i < q->count; i++)
+		elements[i] = queue_slot(q, i);
+	free(q->elements);
+	q->elements = elements;
+	q->size = size;
+	q->first = 0;
+
+	return 0;
+}
+
+int queue_insert(queue_t q, queue_element_t e)
+{
+	if (!q)
 		return -1;
 
-	newnode->element = e;
-	newnode->next = NULL;
+	if (queue_grow(q))
+		return -1;
 
-	if (q->head == NULL) {
-		q->head = q->tail = newnode;
-	} else {
-		q->tail->next = newnode;
-		q->tail = newnode;
-	}
+	queue_slot(q, q->count) = e;
+	q->count++;
 
 	return 0;
 }
 
 int queue_push(queue_t q, queue_element_t e)
 {
-	queue_node_ptr_t newnode;
-
 	if (!q)
 		return -1;
 
-	newnode = (queue_node_ptr_t) malloc(sizeof(struct queue_node));
-	if (newnode == NULL)
+	if (queue_grow(q))
 		return -1;
 
-	newnode->element = e;
-	newnode->next = NULL;
-
-	if (q->head == NULL) {
-		q->head = q->tail = newnode;
-	} else {
-		newnode->next = q->head;
-		q->head = newnode;
-	}
+	q->first = (q->first - 1) & (q->size - 1);
+	q->elements[q->first] = e;
+	q->count++;
 
 	return 0;
 }
 
 queue_element_t queue_remove(queue_t q)
 {
-	queue_node_ptr_t node;
 	queue_element_t e;
 
 	if (!q)
 		return NULL;
 
-	if (q->head == NULL)
+	if (q->count == 0)
 		return NULL;
 
-	node = q->head;
-	q->head = q->head->next;
-	if (q->head == NULL)
-		q->tail = NULL;
-
-	e = node->element;
-	free(node);
+	e = q->elements[q->first];
+	q->first = (q->first + 1) & (q->size - 1);
+	q->count--;
 
 	return e;
 }
@@ -98,43 +103,33 @@ queue_element_t queue_head(queue_t q)
 	if (!q)
 		return NULL;
 
-	if (q->head == NULL)
+	if (q->count == 0)
 		return NULL;
 
-	return q->head->element;
+	return q->elements[q->first];
 }
 
 void queue_destroy(queue_t q)
 {
-	queue_node_ptr_t p, temp;
-
 	if (!q)
 		return;
 
-	p = q->head;
-	while (p != NULL) {
-		temp = p;
-		p = p->next;
-		free(temp);
-	}
-
+	free(q->elements);
 	free(q);
 }
 
 int queue_map(queue_t q, int (*f) (queue_element_t, void *), void *vp)
 {
-	queue_node_ptr_t p;
+	unsigned int i;
 	int ret;
 
 	if (!q)
 		return 0;
 
-	p = q->head;
-	while (p != NULL) {
-		ret = f(p->element, vp);
+	for (i = 0; i < q->count; i++) {
+		ret = f(queue_slot(q, i), vp);
 		if (ret)
 			return ret;
-		p = p->next;
 	}
 	return 0;
 }
@@ -143,36 +138,26 @@ void queue_map_remove_on_error(queue_t q,
 			       int (*f) (queue_element_t, void *),
 			       void (*g) (queue_element_t, void *), void *vp)
 {
-	queue_node_ptr_t p, last, temp;
+	queue_element_t e;
+	unsigned int i, kept;
 	int ret;
 
 	if (!q)
 		return;
 
-	last = NULL;
-	p = q->head;
-	while (p != NULL) {
-		ret = f(p->element, vp);
+	/* Slide the elements that are kept down over the removed ones. */
+	kept = 0;
+	for (i = 0; i < q->count; i++) {
+		e = queue_slot(q, i);
+		ret = f(e, vp);
 		if (ret) {
-			if (last) {
-				last->next = p->next;
-				if (last->next == NULL)
-					q->tail = last;
-			} else {
-				q->head = p->next;
-				if (q->head == NULL)
-					q->tail = NULL;
-			}
-
-			temp = p;
-			p = p->next;
-			g(temp->element, vp);
-			free(temp);
+			g(e, vp);
 		} else {
-			last = p;
-			p = p->next;
+			queue_slot(q, kept) = e;
+			kept++;
 		}
 	}
+	q->count = kept;
 
 	return;
 }
@@ -4,7 +4,7 @@
 /* FLASK */
 
 /* 
- * A double-ended queue is a singly linked list of 
+ * A double-ended queue is a ring buffer of 
  * elements of arbitrary type that may be accessed
  * at either end.
  */
@@ -14,16 +14,11 @@
 
 typedef void *queue_element_t;
 
-typedef struct queue_node *queue_node_ptr_t;
-
-typedef struct queue_node {
-	queue_element_t element;
-	queue_node_ptr_t next;
-} queue_node_t;
-
 typedef struct queue_info {
-	queue_node_ptr_t head;
-	queue_node_ptr_t tail;
+	queue_element_t *elements;
+	unsigned int size;	/* a power of two */
+	unsigned int first;	/* index of the head */
+	unsigned int count;
 } queue_info_t;
 
 typedef queue_info_t *queue_t;
@@ -39,7 +39,8 @@ static policydb_t policydb;
 
 void usage(char *progname)
 {
-	printf("usage:  %s binary_pol_file\n\n", progname);
+	printf("usage:  %s [-q] binary_pol_file\n\n", progname);
+	printf("  -q  answer the queries read from stdin, one per line\n\n");
 	exit(1);
 }
 
@@ -369,6 +370,288 @@ static void display_filename_trans(policydb_t *p, FILE *fp)
 	}
 }
 
+
+/*
+ * Indexed access rule queries.  The unconditional and the conditional
+ * avtabs are expanded once, and the entries are grouped by source type,
+ * target type and class, so that a query only looks at the rules of the
+ * most selective of its types or class.  Changing a boolean drops the
+ * index, since the enabled state of the conditional rules is copied.
+ */
+struct av_entry {
+	avtab_ptr_t node;
+	uint32_t what;		/* RENDER_UNCONDITIONAL or RENDER_CONDITIONAL */
+};
+
+struct av_group {
+	uint32_t *start;	/* entries of value v are order[start[v-1]..start[v]) */
+	uint32_t *order;
+};
+
+static struct av_index {
+	int built;
+	avtab_t te, cond;
+	struct av_entry *entries;
+	uint32_t nentries;
+	struct av_group by_source, by_target, by_class;
+} av_index;
+
+static void av_group_destroy(struct av_group *g)
+{
+	free(g->start);
+	free(g->order);
+	g->start = g->order = NULL;
+}
+
+static void av_index_destroy(void)
+{
+	if (!av_index.built)
+		return;
+	av_group_destroy(&av_index.by_source);
+	av_group_destroy(&av_index.by_target);
+	av_group_destroy(&av_index.by_class);
+	free(av_index.entries);
+	avtab_destroy(&av_index.te);
+	avtab_destroy(&av_index.cond);
+	memset(&av_index, 0, sizeof(av_index));
+}
+
+static uint32_t av_key_value(avtab_key_t * key, int field)
+{
+	switch (field) {
+	case 0:
+		return key->source_type;
+	case 1:
+		return key->target_type;
+	default:
+		return key->target_class;
+	}
+}
+
+/* Group the entries by one key field with a counting sort. */
+static int av_group_build(struct av_group *g, uint32_t nvalues, int field)
+{
+	uint32_t i, v, *next;
+
+	g->start = calloc(nvalues + 1, sizeof(uint32_t));
+	g->order = malloc((av_index.nentries + 1) * sizeof(uint32_t));
+	next = malloc((nvalues + 1) * sizeof(uint32_t));
+	if (!g->start || !g->order || !next) {
+		free(next);
+		return -1;
+	}
+	for (i = 0; i < av_index.nentries; i++) {
+		v = av_key_value(&av_index.entries[i].node->key, field);
+		if (v >= 1 && v <= nvalues)
+			g->start[v]++;
+	}
+	for (v = 1; v <= nvalues; v++)
+		g->start[v] += g->start[v - 1];
+	memcpy(next, g->start, (nvalues + 1) * sizeof(uint32_t));
+	for (i = 0; i < av_index.nentries; i++) {
+		v = av_key_value(&av_index.entries[i].node->key, field);
+		if (v >= 1 && v <= nvalues)
+			g->order[next[v - 1]++] = i;
+	}
+	free(next);
+	return 0;
+}
+
+static void av_index_add(avtab_t * a, uint32_t what)
+{
+	unsigned int i;
+	avtab_ptr_t cur;
+
+	for (i = 0; i < a->nslot; i++) {
+		for (cur = a->htable[i]; cur; cur = cur->next) {
+			av_index.entries[av_index.nentries].node = cur;
+			av_index.entries[av_index.nentries].what = what;
+			av_index.nentries++;
+		}
+	}
+}
+
+static int av_index_build(policydb_t * p)
+{
+	if (av_index.built)
+		return 0;
+	av_index.built = 1;
+	if (avtab_init(&av_index.te) || avtab_init(&av_index.cond))
+		goto oom;
+	if (expand_avtab(p, &p->te_avtab, &av_index.te) ||
+	    expand_avtab(p, &p->te_cond_avtab, &av_index.cond))
+		goto oom;
+	av_index.entries = malloc((av_index.te.nel + av_index.cond.nel + 1) *
+				  sizeof(struct av_entry));
+	if (!av_index.entries)
+		goto oom;
+	av_index_add(&av_index.te, RENDER_UNCONDITIONAL);
+	av_index_add(&av_index.cond, RENDER_CONDITIONAL);
+	if (av_group_build(&av_index.by_source, p->p_types.nprim, 0) ||
+	    av_group_build(&av_index.by_target, p->p_types.nprim, 1) ||
+	    av_group_build(&av_index.by_class, p->p_classes.nprim, 2))
+		goto oom;
+	return 0;
+      oom:
+	fprintf(stderr, "out of memory\n");
+	av_index_destroy();
+	return -1;
+}
+
+/* The types a query name stands for; "*" sets *any instead. */
+static int query_types(policydb_t * p, const char *name, ebitmap_t * types,
+		       int *any)
+{
+	type_datum_t *t;
+
+	*any = strcmp(name, "*") == 0;
+	if (*any)
+		return 0;
+	t = hashtab_search(p->p_types.table, (hashtab_key_t) name);
+	if (!t) {
+		fprintf(stderr, "unknown type %s\n", name);
+		return -1;
+	}
+	if (t->flavor == TYPE_ATTRIB)
+		return ebitmap_cpy(types, &p->attr_type_map[t->s.value - 1]);
+	return ebitmap_set_bit(types, t->s.value - 1, 1);
+}
+
+static int query_perm(class_datum_t * cladatum, const char *name,
+		      uint32_t * perms)
+{
+	perm_datum_t *perm;
+
+	perm = hashtab_search(cladatum->permissions.table, (hashtab_key_t) name);
+	if (!perm && cladatum->comdatum)
+		perm = hashtab_search(cladatum->comdatum->permissions.table,
+				      (hashtab_key_t) name);
+	if (!perm) {
+		fprintf(stderr, "unknown permission %s\n", name);
+		return -1;
+	}
+	*perms |= 1U << (perm->s.value - 1);
+	return 0;
+}
+
+struct av_query {
+	ebitmap_t stypes, ttypes;
+	int sany, tany;
+	uint32_t tclass;
+	uint32_t perms;
+};
+
+/* Print the rules among entries order[first..last) that match. */
+static uint32_t query_range(struct av_query *q, struct av_group *g,
+			    uint32_t first, uint32_t last, policydb_t * p,
+			    FILE * fp)
+{
+	struct av_entry *e;
+	avtab_key_t *key;
+	uint32_t j, matched = 0;
+
+	for (j = first; j < last; j++) {
+		e = &av_index.entries[g ? g->order[j] : j];
+		key = &e->node->key;
+		if (!q->sany &&
+		    !ebitmap_get_bit(&q->stypes, key->source_type - 1))
+			continue;
+		if (!q->tany &&
+		    !ebitmap_get_bit(&q->ttypes, key->target_type - 1))
+			continue;
+		if (q->tclass && key->target_class != q->tclass)
+			continue;
+		if (q->perms && (!(key->specified & AVTAB_ALLOWED) ||
+				 !(e->node->datum.data & q->perms)))
+			continue;
+		render_av_rule(key, &e->node->datum, e->what, p, fp);
+		matched++;
+	}
+	return matched;
+}
+
+/*
+ * Answer "source target class [perm...]", where source, target and
+ * class may be "*", by printing the matching rules.  Permissions only
+ * match allow rules granting one of them.
+ */
+int query_avtab(policydb_t * p, char *line, FILE * fp)
+{
+	char *source, *target, *class, *perm, *save;
+	class_datum_t *cladatum = NULL;
+	struct av_query q;
+	struct av_group *g;
+	ebitmap_t *walk = NULL;
+	ebitmap_node_t *node;
+	uint32_t matched = 0;
+	unsigned int v;
+	int rc = -1;
+
+	memset(&q, 0, sizeof(q));
+	ebitmap_init(&q.stypes);
+	ebitmap_init(&q.ttypes);
+	source = strtok_r(line, " \t\n", &save);
+	target = strtok_r(NULL, " \t\n", &save);
+	class = strtok_r(NULL, " \t\n", &save);
+	if (!source || !target || !class) {
+		fprintf(stderr, "query: source target class [perm...]\n");
+		return -1;
+	}
+	if (query_types(p, source, &q.stypes, &q.sany) ||
+	    query_types(p, target, &q.ttypes, &q.tany))
+		goto out;
+	if (strcmp(class, "*") != 0) {
+		cladatum = hashtab_search(p->p_classes.table, class);
+		if (!cladatum) {
+			fprintf(stderr, "unknown class %s\n", class);
+			goto out;
+		}
+		q.tclass = cladatum->s.value;
+	}
+	while ((perm = strtok_r(NULL, " \t\n", &save))) {
+		if (!cladatum) {
+			fprintf(stderr, "permissions need a class\n");
+			goto out;
+		}
+		if (query_perm(cladatum, perm, &q.perms))
+			goto out;
+	}
+	if (av_index_build(p))
+		goto out;
+
+	/* Look only at the buckets of the named source or target types,
+	 * or of the class, and filter on the rest. */
+	if (!q.sany) {
+		g = &av_index.by_source;
+		walk = &q.stypes;
+	} else if (!q.tany) {
+		g = &av_index.by_target;
+		walk = &q.ttypes;
+	} else if (q.tclass) {
+		g = &av_index.by_class;
+	} else {
+		g = NULL;
+	}
+
+	if (walk) {
+		ebitmap_for_each_positive_bit(walk, node, v) {
+			matched += query_range(&q, g, g->start[v],
+					       g->start[v + 1], p, fp);
+		}
+	} else if (g) {
+		matched = query_range(&q, g, g->start[q.tclass - 1],
+				      g->start[q.tclass], p, fp);
+	} else {
+		matched = query_range(&q, NULL, 0, av_index.nentries, p, fp);
+	}
+	fprintf(fp, "%u rules\n", matched);
+	rc = 0;
+      out:
+	ebitmap_destroy(&q.stypes);
+	ebitmap_destroy(&q.ttypes);
+	return rc;
+}
+
 int menu()
 {
 	printf("\nSelect a command:\n");
@@ -380,6 +663,7 @@ int menu()
 	printf("6)  display conditional expressions\n");
 	printf("7)  change a boolean value\n");
 	printf("8)  display role transitions\n");
+	printf("a)  query access rules (source target class [perm...])\n");
 	printf("\n");
 	printf("c)  display policy capabilities\n");
 	printf("p)  display the list of permissive types\n");
@@ -402,31 +686,40 @@ int main(int argc, char **argv)
 	char *name;
 	int state;
 	struct policy_file pf;
-
-	if (argc != 2)
+	char *file, *line = NULL;
+	size_t size = 0;
+	int batch = 0;
+
+	if (argc == 3 && strcmp(argv[1], "-q") == 0) {
+		batch = 1;
+		file = argv[2];
+	} else if (argc == 2) {
+		file = argv[1];
+	} else
 		usage(argv[0]);
 
-	fd = open(argv[1], O_RDONLY);
+	fd = open(file, O_RDONLY);
 	if (fd < 0) {
 		fprintf(stderr, "Can't open '%s':  %s\n",
-			argv[1], strerror(errno));
+			file, strerror(errno));
 		exit(1);
 	}
 	if (fstat(fd, &sb) < 0) {
 		fprintf(stderr, "Can't stat '%s':  %s\n",
-			argv[1], strerror(errno));
+			file, strerror(errno));
 		exit(1);
 	}
 	map =
 	    mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
 	if (map == MAP_FAILED) {
 		fprintf(stderr, "Can't map '%s':  %s\n",
-			argv[1], strerror(errno));
+			file, strerror(errno));
 		exit(1);
 	}
 
 	/* read the binary policy */
-	fprintf(out_fp, "Reading policy...\n");
+	if (!batch)
+		fprintf(out_fp, "Reading policy...\n");
 	policy_file_init(&pf);
 	pf.type = PF_USE_MEMORY;
 	pf.data = map;
@@ -443,9 +736,23 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	fprintf(stdout, "binary policy file loaded\n\n");
 	close(fd);
 
+	if (batch) {
+		/* one query per line; the answers end with a count line */
+		while (getline(&line, &size, stdin) > 0) {
+			if (line[0] == '#' || line[strspn(line, " \t\n")] == 0)
+				continue;
+			query_avtab(&policydb, line, out_fp);
+		}
+		free(line);
+		av_index_destroy();
+		policydb_destroy(&policydb);
+		exit(0);
+	}
+
+	fprintf(stdout, "binary policy file loaded\n\n");
+
 	menu();
 	for (;;) {
 		printf("\nCommand (\'m\' for menu):  ");
@@ -496,11 +803,17 @@ int main(int argc, char **argv)
 				state = 0;
 
 			change_bool(name, state, &policydb, out_fp);
+			av_index_destroy();
 			free(name);
 			break;
 		case '8':
 			display_role_trans(&policydb, out_fp);
 			break;
+		case 'a':
+			printf("query? ");
+			if (fgets(ans, sizeof(ans), stdin))
+				query_avtab(&policydb, ans, out_fp);
+			break;
 		case 'c':
 			display_policycaps(&policydb, out_fp);
 			break;
@@ -530,6 +843,7 @@ int main(int argc, char **argv)
 			display_filename_trans(&policydb, out_fp);
 			break;
 		case 'q':
+			av_index_destroy();
 			policydb_destroy(&policydb);
 			exit(0);
 			break;
@@ -54,6 +54,18 @@ int avc_sid_to_context_raw(security_id_t sid, char ** ctx);
 int avc_context_to_sid(const char * ctx, security_id_t * sid);
 int avc_context_to_sid_raw(const char * ctx, security_id_t * sid);
 
+/**
+ * avc_context_len_to_sid_raw - get SID for a context of known length.
+ * @ctx: input security context, not necessarily NUL-terminated
+ * @len: length of @ctx in bytes; @ctx ends at a NUL within it
+ * @sid: pointer to SID reference
+ *
+ * Same as avc_context_to_sid_raw(), for callers that already know
+ * the length of @ctx, such as a context received from a peer.
+ */
+int avc_context_len_to_sid_raw(const char * ctx, size_t len,
+			       security_id_t * sid);
+
 /**
  * sidget - increment SID reference counter.
  * @sid: SID reference
@@ -75,6 +87,9 @@ int sidget(security_id_t sid);
  * new reference count.  When the reference count reaches
  * zero, the SID is invalid, and avc_context_to_sid() must
  * be called to obtain a new SID for the security context.
+ * Unreferenced SIDs are freed, along with the AVC entries
+ * that refer to them, by avc_cleanup() or automatically
+ * once enough of them have accumulated.
  */
 int sidput(security_id_t sid);
 
@@ -168,6 +183,22 @@ struct avc_lock_callback {
 #define AVC_OPT_UNUSED		0
 /* override kernel enforcing mode (boolean value) */
 #define AVC_OPT_SETENFORCE	1
+/* initial number of cache hash buckets (decimal string) */
+#define AVC_OPT_CACHE_SLOTS	2
+/* initial maximum number of cache entries (decimal string) */
+#define AVC_OPT_CACHE_MAXNODES	3
+/* repopulate the cache after a policy reload (boolean value) */
+#define AVC_OPT_PREFETCH	4
+/* keep a small per-thread cache of granted decisions (boolean value) */
+#define AVC_OPT_THREAD_CACHE	5
+/* format and log audit messages in a background thread (boolean value) */
+#define AVC_OPT_ASYNC_AUDIT	6
+/* share kernel decisions with other processes through the cache file
+ * named by the value */
+#define AVC_OPT_SHARED_CACHE	7
+/* time and count each decision by class and source type in the file
+ * named by the value, laid out as in <selinux/avc_stats.h> */
+#define AVC_OPT_STATS_EXPORT	8
 
 /*
  * AVC operations
@@ -225,6 +256,26 @@ void avc_cleanup(void);
  */
 int avc_reset(void);
 
+struct avc_prefetch_req {
+	security_id_t ssid;
+	security_id_t tsid;
+	security_class_t tclass;
+};
+
+/**
+ * avc_prefetch - Populate the cache ahead of use.
+ * @reqs: array of (@ssid, @tsid, @tclass) triples
+ * @nreqs: number of elements in @reqs
+ *
+ * Query the security server for all of @reqs in one batch and
+ * insert the resulting decisions into the cache, skipping triples
+ * that are already cached or that the security server rejects.
+ * With %AVC_OPT_PREFETCH set, this is done automatically with the
+ * previously cached triples whenever a policy reload flushes the
+ * cache.  Return %0 on success, -%1 with @errno set on error.
+ */
+int avc_prefetch(const struct avc_prefetch_req *reqs, unsigned nreqs);
+
 /**
  * avc_destroy - Free all AVC structures.
  *
@@ -308,6 +359,20 @@ void avc_audit(security_id_t ssid, security_id_t tsid,
 	       security_class_t tclass, access_vector_t requested,
 	       struct av_decision *avd, int result, void *auditdata);
 
+/**
+ * selinux_check_access_sid - Check permissions resolved in a handle.
+ * @ssid: source security identifier
+ * @tsid: target security identifier
+ * @h: class and permissions from selinux_access_handle_create()
+ * @auditdata: auxiliary audit data
+ *
+ * Same as selinux_check_access_handle(), for contexts already
+ * converted to SIDs, e.g. once per peer rather than per message.
+ */
+int selinux_check_access_sid(security_id_t ssid, security_id_t tsid,
+			     const selinux_access_handle_t *h,
+			     void *auditdata);
+
 /**
  * avc_compute_create - Compute SID for labeling a new object.
  * @ssid: source security identifier
@@ -326,6 +391,22 @@ int avc_compute_create(security_id_t ssid,
 		       security_id_t tsid,
 		       security_class_t tclass, security_id_t * newsid);
 
+/**
+ * avc_compute_create_name - Compute SID for labeling a new named object.
+ * @ssid: source security identifier
+ * @tsid: target security identifier
+ * @tclass: target security class
+ * @objname: name of the new object, or NULL
+ * @newsid: pointer to SID reference
+ *
+ * Like avc_compute_create(), but also applies the type transitions
+ * specific to the object's name.
+ */
+int avc_compute_create_name(security_id_t ssid,
+			    security_id_t tsid,
+			    security_class_t tclass,
+			    const char *objname, security_id_t * newsid);
+
 /**
  * avc_compute_member - Compute SID for polyinstantation.
  * @ssid: source security identifier
@@ -413,6 +494,41 @@ struct avc_cache_stats {
  */
 void avc_cache_stats(struct avc_cache_stats *stats);
 
+/*
+ * The counters of struct avc_cache_stats followed by figures it has no
+ * room for.  Fields are only ever added at the end, and callers pass
+ * the size of the structure they were built with.
+ */
+struct avc_cache_stats_ext {
+	unsigned entry_lookups;
+	unsigned entry_hits;
+	unsigned entry_misses;
+	unsigned entry_discards;
+	unsigned cav_lookups;
+	unsigned cav_hits;
+	unsigned cav_probes;
+	unsigned cav_misses;
+	unsigned cav_evictions;
+	unsigned cache_slots;
+	unsigned cache_nodes;
+	unsigned active_nodes;
+	unsigned active_nodes_max;
+};
+
+/**
+ * avc_cache_stats_ext - get cache statistics and sizes.
+ * @stats: reference to statistics structure
+ * @size: size of @stats, normally sizeof(struct avc_cache_stats_ext)
+ *
+ * Fill the first @size bytes of @stats with what avc_cache_stats()
+ * returns followed by the number of evictions and the current size of
+ * the cache.  Fields this
+ * version of the library does not know are zeroed.  Return %0 on
+ * success, -%1 with @errno set to %EINVAL if @size is too small to
+ * hold the counters of struct avc_cache_stats.
+ */
+int avc_cache_stats_ext(struct avc_cache_stats_ext *stats, size_t size);
+
 /**
  * avc_av_stats - log av table statistics.
  *
@@ -0,0 +1,59 @@
+/*
+ * Layout of the statistics file an AVC opened with AVC_OPT_STATS_EXPORT
+ * keeps up to date, for tools such as avcstat(8) that map or read it.
+ */
+#ifndef _SELINUX_AVC_STATS_H_
+#define _SELINUX_AVC_STATS_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AVC_STATS_MAGIC		0x53545641	/* "AVTS" */
+#define AVC_STATS_VERSION	1
+#define AVC_STATS_CLASSES	64
+#define AVC_STATS_TYPES		64
+#define AVC_STATS_NAMELEN	48
+#define AVC_STATS_BUCKETS	20
+
+/*
+ * Counters of avc_has_perm_noaudit() calls.  A hit is a decision found
+ * in the cache, a miss one that had to be computed.  latency[i] counts
+ * calls that took less than 64 << i nanoseconds, and at least 32 << i
+ * for i > 0; the last bucket also counts everything slower.
+ */
+struct avc_stats_counts {
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t latency_ns;	/* sum over all lookups */
+	uint64_t latency[AVC_STATS_BUCKETS];
+};
+
+/*
+ * A class, keyed by its security_class_t value, or a source type.  A
+ * slot is in use once its id is non-zero; its name may be filled in
+ * just after.  The last slot of each table collects what did not fit.
+ */
+struct avc_stats_entry {
+	uint32_t id;
+	char name[AVC_STATS_NAMELEN];
+	struct avc_stats_counts counts;
+};
+
+struct avc_stats_export {
+	uint32_t magic;		/* set once the rest is laid out */
+	uint32_t version;
+	uint32_t size;		/* sizeof(struct avc_stats_export) */
+	uint32_t pid;		/* process that writes the file */
+	struct avc_stats_counts total;
+	struct avc_stats_entry classes[AVC_STATS_CLASSES];
+	struct avc_stats_entry types[AVC_STATS_TYPES];
+};
+
+#ifdef __cplusplus
+}
+#endif
+#endif				/* _SELINUX_AVC_STATS_H_ */
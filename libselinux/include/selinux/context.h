@@ -1,6 +1,8 @@
 #ifndef _SELINUX_CONTEXT_H_
 #define _SELINUX_CONTEXT_H_
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -44,6 +46,40 @@ extern "C" {
 	extern int context_role_set(context_t, const char *);
 	extern int context_user_set(context_t, const char *);
 
+/*
+ * A view of a context string: each component is a span of the string
+ * it was parsed from, so no memory is allocated.  range.ptr is NULL if
+ * the context has no MLS range.  Spans may be pointed elsewhere before
+ * the view is formatted, to change a component.
+ */
+
+	typedef struct {
+		const char *ptr;
+		size_t len;
+	} context_span_t;
+
+	typedef struct {
+		context_span_t user;
+		context_span_t role;
+		context_span_t type;
+		context_span_t range;
+	} context_view_t;
+
+/* Parse str into view, with the checks of context_new.
+   Returns -1 with errno set to EINVAL if str is not a context. */
+
+	extern int context_view_parse(const char *str, context_view_t *view);
+
+/* Write the context described by view into buf, as snprintf does.
+   Returns the length of the context, excluding the NUL. */
+
+	extern int context_view_format(char *buf, size_t size,
+				       const context_view_t *view);
+
+/* Return nonzero if the span holds exactly the string str */
+
+	extern int context_span_eq(const context_span_t *span, const char *str);
+
 #ifdef __cplusplus
 }
 #endif
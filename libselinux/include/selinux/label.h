@@ -107,6 +107,34 @@ int selabel_lookup_raw(struct selabel_handle *handle, char **con,
  */
 void selabel_stats(struct selabel_handle *handle);
 
+/**
+ * selabel_reload - Bring a labeling handle up to date with its files.
+ * @handle: specifies backend instance to reload
+ *
+ * Read again the specification files of @handle that changed since it
+ * was opened or last reloaded, keeping what was read from the others.
+ * The handle is switched over once the new contents are complete, and
+ * is left as it was on error.  Calls on a handle shared by threads
+ * must still be serialized by the caller.  Return %1 if anything
+ * changed, %0 if nothing did, -%1 with @errno set on failure, or with
+ * @errno set to %ENOTSUP if the backend cannot reload.
+ */
+int selabel_reload(struct selabel_handle *handle);
+
+/**
+ * selabel_file_compile - Compile a file contexts configuration.
+ * @path: file contexts configuration to compile
+ * @bin_path: where to write the result, or NULL for @path with ".bin" appended
+ * @nthreads: number of threads compiling regexes, or zero for one per CPU
+ *
+ * Write the compiled form of @path that the file contexts backend loads
+ * instead of the text, as sefcontext_compile does.  The file is replaced
+ * atomically, and is the same whatever @nthreads is.  Return %0 on
+ * success, -%1 with @errno set on failure.
+ */
+int selabel_file_compile(const char *path, const char *bin_path,
+			 unsigned int nthreads);
+
 /*
  * Type codes used by specific backends
  */
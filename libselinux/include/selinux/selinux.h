@@ -113,6 +113,21 @@ extern int lsetfilecon_raw(const char *path, const char * con);
 extern int fsetfilecon(int fd, const char * con);
 extern int fsetfilecon_raw(int fd, const char * con);
 
+/* Get or set the contexts of n names relative to the directory dirfd
+   (or AT_FDCWD).  flags may be AT_SYMLINK_NOFOLLOW to act on symbolic
+   links themselves.  A name that fails has its context left NULL (get)
+   or unchanged (set) and makes the call return -1 with errno set, but
+   the remaining names are still processed.  Caller must free each
+   returned context via freecon. */
+extern int getfileconat_batch(int dirfd, const char *const *names, size_t n,
+			      int flags, char **cons);
+extern int getfileconat_batch_raw(int dirfd, const char *const *names,
+				  size_t n, int flags, char **cons);
+extern int setfileconat_batch(int dirfd, const char *const *names,
+			      const char *const *cons, size_t n, int flags);
+extern int setfileconat_batch_raw(int dirfd, const char *const *names,
+				  const char *const *cons, size_t n, int flags);
+
 /* Wrappers for the socket API */
 
 /* Get context of peer socket, and set *con to refer to it.
@@ -203,6 +218,20 @@ extern int security_compute_av_flags_raw(const char * scon,
 					 access_vector_t requested,
 					 struct av_decision *avd);
 
+/* Compute several access decisions at once.  A query that fails has
+   its decision cleared and makes the call return -1 with errno set,
+   but the remaining queries are still computed. */
+struct security_av_query {
+	const char *scon;
+	const char *tcon;
+	security_class_t tclass;
+	access_vector_t requested;
+};
+
+extern int security_compute_av_flags_batch_raw(const struct security_av_query *queries,
+					       size_t nqueries,
+					       struct av_decision *avds);
+
 /* Compute a labeling decision and set *newcon to refer to it.
    Caller must free via freecon. */
 extern int security_compute_create(const char * scon,
@@ -316,6 +345,14 @@ extern int security_load_booleans(char *path);
 extern int security_check_context(const char * con);
 extern int security_check_context_raw(const char * con);
 
+/* Check the validity of n contexts.  errs[i] is set to 0 if cons[i]
+   is valid and to an errno value otherwise.  Returns 0 if all of them
+   are valid, or -1 with errno set to the last failure. */
+extern int security_check_context_batch(const char *const *cons, size_t n,
+					int *errs);
+extern int security_check_context_batch_raw(const char *const *cons,
+					    size_t n, int *errs);
+
 /* Canonicalize a security context. */
 extern int security_canonicalize_context(const char * con,
 					 char ** canoncon);
@@ -346,6 +383,17 @@ extern int security_get_boolean_pending(const char *name);
 /* Get the active value for the boolean */
 extern int security_get_boolean_active(const char *name);
 
+/* Get the active and, if pending is not NULL, the pending values of
+   n booleans.  A boolean that can not be read has -1 stored and makes
+   the call return -1 with errno set, but the others are still read. */
+extern int security_get_boolean_values(const char *const *names, size_t n,
+				       int *active, int *pending);
+
+/* Get the names and active values of all booleans, sorted by name.
+   Free the array with security_free_boolean_snapshot. */
+extern int security_get_boolean_snapshot(SELboolean ** bools, size_t * len);
+extern void security_free_boolean_snapshot(SELboolean * bools, size_t len);
+
 /* Set the pending value for the boolean */
 extern int security_set_boolean(const char *name, int value);
 
@@ -575,6 +623,23 @@ extern const char *selinux_path(void);
  */
 extern int selinux_check_access(const char * scon, const char * tcon, const char *tclass, const char *perm, void *auditdata);
 
+/* A class and permissions resolved once, to check the same access for
+   many pairs of contexts without looking up the names again.
+   selinux_access_handle_create returns NULL if out of memory; names
+   the policy does not define are handled when checking, as
+   selinux_check_access does.  See also selinux_check_access_sid in
+   <selinux/avc.h>. */
+typedef struct selinux_access_handle selinux_access_handle_t;
+extern selinux_access_handle_t *selinux_access_handle_create(const char *tclass,
+							     const char *const *perms,
+							     size_t nperms);
+extern void selinux_access_handle_free(selinux_access_handle_t *h);
+
+/* Same as selinux_check_access, for all the permissions in h. */
+extern int selinux_check_access_handle(const char * scon, const char * tcon,
+				       const selinux_access_handle_t *h,
+				       void *auditdata);
+
 /* Check a permission in the passwd class.
    Return 0 if granted or -1 otherwise. */
 extern int selinux_check_passwd_access(access_vector_t requested);
@@ -32,6 +32,8 @@
 struct boolean_t {
 	char *name;
 	int active;
+	sepol_bool_key_t *key;
+	sepol_bool_t *boolean;
 };
 
 static struct boolean_t **boollist = NULL;
@@ -50,13 +52,31 @@ static struct avc_t *avc = NULL;
 
 static sidtab_t sidtab;
 
+/* Context string -> SID, and (ssid, tsid, tclass, av) -> result of
+   analyze, both kept until finish.  The policy only changes while a
+   boolean is being tried, so a decision stays valid. */
+static PyObject *sid_cache = NULL;
+static PyObject *decision_cache = NULL;
+
 static int load_booleans(const sepol_bool_t * boolean,
 			 void *arg __attribute__ ((__unused__)))
 {
-	boollist[boolcnt] = malloc(sizeof(struct boolean_t));
-	boollist[boolcnt]->name = strdup(sepol_bool_get_name(boolean));
-	boollist[boolcnt]->active = sepol_bool_get_value(boolean);
-	boolcnt++;
+	struct boolean_t *b = calloc(1, sizeof(struct boolean_t));
+	if (!b)
+		return -1;
+	b->name = strdup(sepol_bool_get_name(boolean));
+	b->active = sepol_bool_get_value(boolean);
+	/* Kept for check_booleans, so that trying a boolean does not
+	   have to look it up again for every denial. */
+	if (!b->name ||
+	    sepol_bool_key_create(avc->handle, b->name, &b->key) < 0 ||
+	    sepol_bool_clone(avc->handle, boolean, &b->boolean) < 0) {
+		sepol_bool_key_free(b->key);
+		free(b->name);
+		free(b);
+		return -1;
+	}
+	boollist[boolcnt++] = b;
 	return 0;
 }
 
@@ -67,8 +87,6 @@ static int check_booleans(struct boolean_t **bools)
 	unsigned int reason;
 	int rc;
 	int i;
-	sepol_bool_key_t *key = NULL;
-	sepol_bool_t *boolean = NULL;
 	int fcnt = 0;
 	int *foundlist = calloc(boolcnt, sizeof(int));
 	if (!foundlist) {
@@ -76,82 +94,51 @@ static int check_booleans(struct boolean_t **bools)
 		return fcnt;
 	}
 	for (i = 0; i < boolcnt; i++) {
-		char *name = boollist[i]->name;
-		int active = boollist[i]->active;
-		rc = sepol_bool_key_create(avc->handle, name, &key);
-		if (rc < 0) {
-			PyErr_SetString( PyExc_RuntimeError, 
-					 "Could not create boolean key.\n");
-			break;
-		}
-		rc = sepol_bool_query(avc->handle,
-				      avc->policydb,
-				      key, &boolean);
+		struct boolean_t *b = boollist[i];
 
+		/* Setting a boolean only re-evaluates the conditionals
+		   that use it. */
+		sepol_bool_set_value(b->boolean, !b->active);
+		rc = sepol_bool_set(avc->handle, avc->policydb,
+				    b->key, b->boolean);
 		if (rc < 0) {
 			snprintf(errormsg, sizeof(errormsg), 
-				 "Could not find boolean %s.\n", name);
+				 "Could not set boolean data %s.\n", b->name);
 			PyErr_SetString( PyExc_RuntimeError, errormsg);
 			break;
 		}
 
-		sepol_bool_set_value(boolean, !active);
+		/* Reproduce the computation. */
+		rc = sepol_compute_av_reason(avc->ssid, avc->tsid, avc->tclass,
+					     avc->av, &avd, &reason);
 
-		rc = sepol_bool_set(avc->handle,
-				    avc->policydb,
-				    key, boolean);
-		if (rc < 0) {
+		sepol_bool_set_value(b->boolean, b->active);
+		if (sepol_bool_set(avc->handle, avc->policydb,
+				   b->key, b->boolean) < 0) {
 			snprintf(errormsg, sizeof(errormsg), 
-				 "Could not set boolean data %s.\n", name);
+				 "Could not set boolean data %s.\n", b->name);
 			PyErr_SetString( PyExc_RuntimeError, errormsg);
 			break;
 		}
 
-		/* Reproduce the computation. */
-		rc = sepol_compute_av_reason(avc->ssid, avc->tsid, avc->tclass,
-					     avc->av, &avd, &reason);
 		if (rc < 0) {
 			snprintf(errormsg, sizeof(errormsg), 
 				 "Error during access vector computation, skipping...");
 			PyErr_SetString( PyExc_RuntimeError, errormsg);
-
-			sepol_bool_free(boolean);
 			break;
-		} else {
-			if (!reason) {
-				foundlist[fcnt] = i;
-				fcnt++;
-			}
-			sepol_bool_set_value(boolean, active);
-			rc = sepol_bool_set(avc->handle,
-					    avc->policydb, key,
-					    boolean);
-			if (rc < 0) {
-				snprintf(errormsg, sizeof(errormsg), 
-					 "Could not set boolean data %s.\n",
-					 name);
-			
-				PyErr_SetString( PyExc_RuntimeError, errormsg);
-				break;
-			}
 		}
-		sepol_bool_free(boolean);
-		sepol_bool_key_free(key);
-		key = NULL;
-		boolean = NULL;
+		if (!reason) {
+			foundlist[fcnt] = i;
+			fcnt++;
+		}
 	}
-	if (key)
-		sepol_bool_key_free(key);
-
-	if (boolean)
-		sepol_bool_free(boolean);
 
 	if (fcnt > 0) {
 		*bools = calloc(sizeof(struct boolean_t), fcnt + 1);
 		struct boolean_t *b = *bools;
 		for (i = 0; i < fcnt; i++) {
 			int ctr = foundlist[i];
-			b[i].name = strdup(boollist[ctr]->name);
+			b[i].name = boollist[ctr]->name;
 			b[i].active = !boollist[ctr]->active;
 		}
 	}
@@ -168,10 +155,14 @@ static PyObject *finish(PyObject *self __attribute__((unused)), PyObject *args)
 			Py_RETURN_NONE;
 
 		for (i = 0; i < boolcnt; i++) {
+			sepol_bool_key_free(boollist[i]->key);
+			sepol_bool_free(boollist[i]->boolean);
 			free(boollist[i]->name);
 			free(boollist[i]);
 		}
 		free(boollist);
+		Py_CLEAR(sid_cache);
+		Py_CLEAR(decision_cache);
 		sepol_sidtab_shutdown(&sidtab);
 		sepol_sidtab_destroy(&sidtab);
 		sepol_policydb_free(avc->policydb);
@@ -265,8 +256,16 @@ static int __policy_init(const char *init_path)
 		return 1;
 	}
 
-	sepol_bool_iterate(avc->handle, avc->policydb,
-			   load_booleans, (void *)NULL);
+	if (sepol_bool_iterate(avc->handle, avc->policydb,
+			       load_booleans, (void *)NULL) < 0) {
+		PyErr_SetString( PyExc_MemoryError, "Out of memory\n");
+		return 1;
+	}
+
+	sid_cache = PyDict_New();
+	decision_cache = PyDict_New();
+	if (!sid_cache || !decision_cache)
+		return 1;
 
 	/* Initialize the sidtab for subsequent use by sepol_context_to_sid
 	   and sepol_compute_av_reason. */
@@ -298,71 +297,32 @@ static PyObject *init(PyObject *self __attribute__((unused)), PyObject *args) {
 		return Py_BuildValue("iO", (X), Py_None);	\
 	}
 
-static PyObject *analyze(PyObject *self __attribute__((unused)) , PyObject *args) {
+static int context_to_sid(char *con, sepol_security_id_t *sid)
+{
+	PyObject *v = PyDict_GetItemString(sid_cache, con);
+
+	if (v) {
+		*sid = (sepol_security_id_t) PyLong_AsUnsignedLong(v);
+		return 0;
+	}
+	if (sepol_context_to_sid(con, strlen(con) + 1, sid) < 0)
+		return -1;
+	v = PyLong_FromUnsignedLong(*sid);
+	if (!v || PyDict_SetItemString(sid_cache, con, v) < 0)
+		PyErr_Clear();
+	Py_XDECREF(v);
+	return 0;
+}
+
+static PyObject *compute(sepol_security_id_t ssid, sepol_security_id_t tsid,
+			 sepol_security_class_t tclass,
+			 sepol_access_vector_t av)
+{
 	char *reason_buf = NULL;
-	char * scon;
-	char * tcon;
-	char *tclassstr; 
-	PyObject *listObj;
-	PyObject *strObj;
-	int numlines;
 	struct boolean_t *bools;
 	unsigned int reason;
-	sepol_security_id_t ssid, tsid;
-	sepol_security_class_t tclass;
-	sepol_access_vector_t perm, av;
 	struct sepol_av_decision avd;
 	int rc;
-	int i=0;
-
-	if (!PyArg_ParseTuple(args,(char *)"sssO!:audit2why",&scon,&tcon,&tclassstr,&PyList_Type, &listObj)) 
-		return NULL;
-  
-	/* get the number of lines passed to us */
-	numlines = PyList_Size(listObj);
-
-	/* should raise an error here. */
-	if (numlines < 0)	return NULL; /* Not a list */
-
-	if (!avc)
-		RETURN(NOPOLICY)
-
-	rc = sepol_context_to_sid(scon, strlen(scon) + 1, &ssid);
-	if (rc < 0)
-		RETURN(BADSCON)
-
-	rc = sepol_context_to_sid(tcon, strlen(tcon) + 1, &tsid);
-	if (rc < 0)
-		RETURN(BADTCON)
-
-	tclass = string_to_security_class(tclassstr);
-	if (!tclass)
-		RETURN(BADTCLASS)
-
-	/* Convert the permission list to an AV. */
-	av = 0;
-
-	/* iterate over items of the list, grabbing strings, and parsing
-	   for numbers */
-	for (i=0; i<numlines; i++){
-		char *permstr;
-
-		/* grab the string object from the next element of the list */
-		strObj = PyList_GetItem(listObj, i); /* Can't fail */
-		
-		/* make it a string */
-#if PY_MAJOR_VERSION >= 3
-		permstr = _PyUnicode_AsString( strObj );
-#else
-		permstr = PyString_AsString( strObj );
-#endif
-		
-		perm = string_to_av_perm(tclass, permstr);
-		if (!perm)
-			RETURN(BADPERM)
-
-		av |= perm;
-	}
 
 	/* Reproduce the computation. */
 	rc = sepol_compute_av_reason_buffer(ssid, tsid, tclass, av, &avd, &reason, &reason_buf, 0);
@@ -420,11 +380,160 @@ static PyObject *analyze(PyObject *self __attribute__((unused)) , PyObject *args
         RETURN(BADCOMPUTE)
 }
 
+/* Copies a cached result, so that callers do not share its boolean list. */
+static PyObject *cached_result(PyObject *result)
+{
+	PyObject *data = PyTuple_GET_ITEM(result, 1);
+
+	if (!PyList_Check(data)) {
+		Py_INCREF(result);
+		return result;
+	}
+	return Py_BuildValue("ON", PyTuple_GET_ITEM(result, 0),
+			     PyList_GetSlice(data, 0, PyList_GET_SIZE(data)));
+}
+
+static PyObject *analyze_one(char *scon, char *tcon,
+			     char *tclassstr, PyObject *listObj)
+{
+	PyObject *strObj;
+	PyObject *key;
+	PyObject *result;
+	int numlines;
+	sepol_security_id_t ssid, tsid;
+	sepol_security_class_t tclass;
+	sepol_access_vector_t perm, av;
+	int i=0;
+
+	/* get the number of lines passed to us */
+	numlines = PyList_Size(listObj);
+
+	/* should raise an error here. */
+	if (numlines < 0)	return NULL; /* Not a list */
+
+	if (!avc)
+		RETURN(NOPOLICY)
+
+	if (context_to_sid(scon, &ssid) < 0)
+		RETURN(BADSCON)
+
+	if (context_to_sid(tcon, &tsid) < 0)
+		RETURN(BADTCON)
+
+	tclass = string_to_security_class(tclassstr);
+	if (!tclass)
+		RETURN(BADTCLASS)
+
+	/* Convert the permission list to an AV. */
+	av = 0;
+
+	/* iterate over items of the list, grabbing strings, and parsing
+	   for numbers */
+	for (i=0; i<numlines; i++){
+		char *permstr;
+
+		/* grab the string object from the next element of the list */
+		strObj = PyList_GetItem(listObj, i); /* Can't fail */
+		
+		/* make it a string */
+#if PY_MAJOR_VERSION >= 3
+		permstr = _PyUnicode_AsString( strObj );
+#else
+		permstr = PyString_AsString( strObj );
+#endif
+		
+		perm = string_to_av_perm(tclass, permstr);
+		if (!perm)
+			RETURN(BADPERM)
+
+		av |= perm;
+	}
+
+	/* Identical denials are common in an audit log; answer them
+	   from the cache. */
+	key = Py_BuildValue("(IIII)", ssid, tsid, tclass, av);
+	if (!key)
+		return NULL;
+	result = PyDict_GetItem(decision_cache, key);
+	if (result) {
+		Py_DECREF(key);
+		return cached_result(result);
+	}
+
+	result = compute(ssid, tsid, tclass, av);
+	if (result && !PyErr_Occurred() &&
+	    PyDict_SetItem(decision_cache, key, result) < 0) {
+		Py_DECREF(result);
+		result = NULL;
+	}
+	Py_DECREF(key);
+	return result;
+}
+
+static PyObject *analyze(PyObject *self __attribute__((unused)) , PyObject *args) {
+	char * scon;
+	char * tcon;
+	char *tclassstr; 
+	PyObject *listObj;
+
+	if (!PyArg_ParseTuple(args,(char *)"sssO!:audit2why",&scon,&tcon,&tclassstr,&PyList_Type, &listObj)) 
+		return NULL;
+
+	return analyze_one(scon, tcon, tclassstr, listObj);
+}
+
+/* Takes a list of (scon, tcon, tclass, [perm...]) tuples and returns the
+   list of results that analyze would return for each of them. */
+static PyObject *analyze_batch(PyObject *self __attribute__((unused)), PyObject *args) {
+	char *scon;
+	char *tcon;
+	char *tclassstr;
+	PyObject *listObj;
+	PyObject *permObj;
+	PyObject *item;
+	PyObject *result;
+	PyObject *results;
+	Py_ssize_t i, n;
+
+	if (!PyArg_ParseTuple(args,(char *)"O!:analyze_batch",&PyList_Type, &listObj))
+		return NULL;
+
+	n = PyList_Size(listObj);
+	results = PyList_New(n);
+	if (!results)
+		return NULL;
+
+	for (i = 0; i < n; i++) {
+		item = PyList_GetItem(listObj, i);
+		if (!PyTuple_Check(item)) {
+			PyErr_SetString(PyExc_TypeError,
+					"analyze_batch expects a list of tuples");
+			Py_DECREF(results);
+			return NULL;
+		}
+		if (!PyArg_ParseTuple(item, (char *)"sssO!:analyze_batch",
+				      &scon, &tcon, &tclassstr,
+				      &PyList_Type, &permObj)) {
+			Py_DECREF(results);
+			return NULL;
+		}
+		result = analyze_one(scon, tcon, tclassstr, permObj);
+		if (!result) {
+			Py_DECREF(results);
+			return NULL;
+		}
+		PyList_SET_ITEM(results, i, result);
+	}
+	return results;
+}
+
 static PyMethodDef audit2whyMethods[] = {
     {"init",  init, METH_VARARGS,
      "Initialize policy database."},
     {"analyze",  analyze, METH_VARARGS,
      "Analyze AVC."},
+    {"analyze_batch",  analyze_batch, METH_VARARGS,
+     "Analyze a list of AVCs."},
     {"finish",  finish, METH_VARARGS,
      "Finish using policy, free memory."},
     {NULL, NULL, 0, NULL}        /* Sentinel */
@@ -10,31 +10,98 @@
 #include <selinux/avc.h>
 #include "selinux_internal.h"
 #include <assert.h>
+#include <semaphore.h>
 #include "avc_sidtab.h"
+#include "avc_shared.h"
+#include "avc_stats.h"
 #include "avc_internal.h"
+#include "selinux_trace.h"
 
 #define AVC_CACHE_SLOTS		512
 #define AVC_CACHE_MAXNODES	410
+#define AVC_CACHE_MAXSLOTS	65536
+/* the cache grows when more than 1/AVC_CACHE_MISS_RATIO lookups miss */
+#define AVC_CACHE_MISS_RATIO	4
+#define AVC_FRONT_BITS		6
+#define AVC_FRONT_SLOTS		(1 << AVC_FRONT_BITS)
 
 struct avc_entry {
 	security_id_t ssid;
 	security_id_t tsid;
 	security_class_t tclass;
 	struct av_decision avd;
-	security_id_t	create_sid;
 	int used;		/* used recently */
 };
 
 struct avc_node {
 	struct avc_entry ae;
 	struct avc_node *next;
+	struct avc_node *clock_prev;	/* ring of active nodes */
+	struct avc_node *clock_next;
+};
+
+struct avc_slots {
+	struct avc_slots *retired;	/* previous, smaller table */
+	uint32_t nslots;
+	struct avc_node *slots[];
 };
 
 struct avc_cache {
-	struct avc_node *slots[AVC_CACHE_SLOTS];
-	uint32_t lru_hint;	/* LRU hint for reclaim scan */
+	struct avc_slots *table;
+	struct avc_node *clock_hand;	/* next reclaim candidate */
 	uint32_t active_nodes;
+	uint32_t active_nodes_max;	/* high-water mark */
+	uint32_t max_nodes;
 	uint32_t latest_notif;	/* latest revocation notification */
+	uint32_t sequence;	/* seqlock for lockless readers */
+	uint32_t generation;	/* bumped when cached decisions change */
+	uint32_t window_lookups;	/* lookups since the last resize check */
+	uint32_t window_misses;
+};
+
+/*
+ * Per-thread state, kept only with AVC_OPT_THREAD_CACHE: statistics
+ * counters, summed up by avc_cache_stats(), and a direct-mapped front
+ * cache of fully granted decisions that is flushed whenever
+ * avc_cache.generation moves.
+ */
+struct avc_front_entry {
+	security_id_t ssid;
+	security_id_t tsid;
+	security_class_t tclass;
+	struct av_decision avd;
+};
+
+struct avc_thread_state {
+	struct avc_thread_state *next;	/* list of registered states */
+	struct avc_thread_state **pprev;
+	uint32_t generation;
+	struct avc_cache_stats_ext stats;	/* counters only */
+	struct avc_front_entry front[AVC_FRONT_SLOTS];
+};
+
+/*
+ * Results of avc_compute_create(), avc_compute_create_name() and
+ * avc_compute_member(), keyed by (ssid, tsid, tclass), the kind of
+ * computation and, for a named type transition, the object name.  Like
+ * the AVC nodes, entries do not hold references on their SIDs:
+ * avc_evict_sids() drops those whose SIDs are about to be freed.  The
+ * table is flushed by avc_reset(), and when it fills up.
+ */
+#define AVC_XCACHE_SLOTS	512
+#define AVC_XCACHE_MAXNODES	4096
+
+#define AVC_XCACHE_CREATE	0
+#define AVC_XCACHE_MEMBER	1
+
+struct avc_xnode {
+	security_id_t ssid;
+	security_id_t tsid;
+	security_class_t tclass;
+	int kind;
+	char *name;		/* NULL unless a named transition */
+	security_id_t newsid;
+	struct avc_xnode *next;
 };
 
 struct avc_callback_node {
@@ -51,20 +118,189 @@ struct avc_callback_node {
 };
 
 static void *avc_netlink_thread = NULL;
+static int avc_status_page = 0;
 static void *avc_lock = NULL;
 static void *avc_log_lock = NULL;
 static struct avc_node *avc_node_freelist = NULL;
 static struct avc_cache avc_cache;
 static char *avc_audit_buf = NULL;
-static struct avc_cache_stats cache_stats;
+static struct avc_cache_stats_ext cache_stats;
+static struct avc_thread_state *avc_thread_states = NULL;
+static __thread struct avc_thread_state *avc_thread_state;
+static pthread_once_t avc_thread_once = PTHREAD_ONCE_INIT;
+static pthread_key_t avc_thread_key;
+static int avc_thread_key_initialized = 0;
 static struct avc_callback_node *avc_callbacks = NULL;
 static struct sidtab avc_sidtab;
+static struct avc_xnode *avc_xcache[AVC_XCACHE_SLOTS];
+static uint32_t avc_xcache_nodes = 0;
+
+static unsigned avc_cache_slots_opt = 0;
+static unsigned avc_cache_maxnodes_opt = 0;
+static int avc_prefetch_on_reset = 0;
+static int avc_thread_cache = 0;
+static int avc_audit_async_opt = 0;
+static const char *avc_shared_path = NULL;
+static const char *avc_stats_path = NULL;
+static int avc_audit_running = 0;
+
+static void avc_audit_start(void);
+static void avc_audit_stop(void);
 
 static inline int avc_hash(security_id_t ssid,
-			   security_id_t tsid, security_class_t tclass)
+			   security_id_t tsid, security_class_t tclass,
+			   uint32_t nslots)
 {
 	return ((uintptr_t) ssid ^ ((uintptr_t) tsid << 2) ^ tclass)
-	    & (AVC_CACHE_SLOTS - 1);
+	    & (nslots - 1);
+}
+
+/*
+ * Cache hits are served without taking avc_lock.  Anyone holding
+ * avc_lock who changes the hash chains or the contents of a node
+ * brackets the change with avc_write_begin()/avc_write_end(), which
+ * leave avc_cache.sequence odd while the update is in progress.
+ * Readers sample the sequence before and after copying out an entry
+ * and fall back to the locked path if it moved.  Nodes are recycled
+ * through the freelist but never freed before avc_destroy(), so a
+ * reader racing with a writer can only see stale data, never freed
+ * memory.  For the same reason a slot table replaced by
+ * avc_grow_cache() is only retired, and freed by avc_destroy().
+ */
+static inline void avc_write_begin(void)
+{
+	avc_cache.sequence++;
+	__sync_synchronize();
+}
+
+static inline void avc_write_end(void)
+{
+	__sync_synchronize();
+	avc_cache.sequence++;
+}
+
+static inline uint32_t avc_read_begin(void)
+{
+	uint32_t seqno = *(volatile uint32_t *)&avc_cache.sequence;
+
+	__sync_synchronize();
+	return seqno;
+}
+
+static inline int avc_read_retry(uint32_t seqno)
+{
+	__sync_synchronize();
+	return *(volatile uint32_t *)&avc_cache.sequence != seqno;
+}
+
+static inline void avc_bump_generation(void)
+{
+	*(volatile uint32_t *)&avc_cache.generation = avc_cache.generation + 1;
+}
+
+static inline struct avc_cache_stats_ext *avc_stats(void)
+{
+	return avc_thread_state && avc_thread_state->pprev ?
+	    &avc_thread_state->stats : &cache_stats;
+}
+
+static void avc_add_stats(struct avc_cache_stats_ext *dst,
+			  const struct avc_cache_stats_ext *src)
+{
+	dst->entry_lookups += src->entry_lookups;
+	dst->entry_hits += src->entry_hits;
+	dst->entry_misses += src->entry_misses;
+	dst->entry_discards += src->entry_discards;
+	dst->cav_lookups += src->cav_lookups;
+	dst->cav_hits += src->cav_hits;
+	dst->cav_probes += src->cav_probes;
+	dst->cav_misses += src->cav_misses;
+	dst->cav_evictions += src->cav_evictions;
+}
+
+static void avc_thread_destructor(void *ptr)
+{
+	struct avc_thread_state *t = ptr;
+
+	if (t->pprev) {
+		avc_get_lock(avc_lock);
+		avc_add_stats(&cache_stats, &t->stats);
+		if (t->next)
+			t->next->pprev = t->pprev;
+		*t->pprev = t->next;
+		avc_release_lock(avc_lock);
+	}
+	avc_free(t);
+}
+
+void __attribute__((destructor)) avc_thread_key_destructor(void);
+
+void hidden __attribute__((destructor)) avc_thread_key_destructor(void)
+{
+	if (avc_thread_key_initialized)
+		__selinux_key_delete(avc_thread_key);
+}
+
+static void avc_init_thread_key(void)
+{
+	if (__selinux_key_create(&avc_thread_key, avc_thread_destructor) == 0)
+		avc_thread_key_initialized = 1;
+}
+
+/*
+ * Return the calling thread's state, registering it with the AVC on
+ * first use.  Must be called without avc_lock held.  A NULL return
+ * just means that the shared counters and no front cache are used, as
+ * they always are unless AVC_OPT_THREAD_CACHE was given.
+ */
+static struct avc_thread_state *avc_get_thread_state(void)
+{
+	struct avc_thread_state *t = avc_thread_state;
+
+	if (!avc_thread_cache)
+		return NULL;
+	if (t && t->pprev)
+		return t;
+
+	if (!t) {
+		__selinux_once(avc_thread_once, avc_init_thread_key);
+		if (!avc_thread_key_initialized)
+			return NULL;
+		t = avc_malloc(sizeof(*t));
+		if (!t)
+			return NULL;
+		__selinux_setspecific(avc_thread_key, t);
+		avc_thread_state = t;
+	}
+
+	/* new thread, or a state left over from before avc_destroy() */
+	memset(t, 0, sizeof(*t));
+	avc_get_lock(avc_lock);
+	t->generation = avc_cache.generation;
+	t->next = avc_thread_states;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = &avc_thread_states;
+	avc_thread_states = t;
+	avc_release_lock(avc_lock);
+	return t;
+}
+
+static inline struct avc_front_entry *avc_front_slot(struct avc_thread_state *t,
+						     security_id_t ssid,
+						     security_id_t tsid,
+						     security_class_t tclass)
+{
+	uint32_t generation = *(volatile uint32_t *)&avc_cache.generation;
+
+	if (t->generation != generation) {
+		memset(t->front, 0, sizeof(t->front));
+		t->generation = generation;
+	}
+	/* SIDs are heap pointers: mix the high bits into the index */
+	return &t->front[(uint32_t)(((uintptr_t) ssid ^
+				     ((uintptr_t) tsid << 5) ^ tclass) *
+				    2654435761U) >> (32 - AVC_FRONT_BITS)];
 }
 
 int avc_context_to_sid_raw(const char * ctx, security_id_t * sid)
@@ -79,6 +315,19 @@ int avc_context_to_sid_raw(const char * ctx, security_id_t * sid)
 	return rc;
 }
 
+int avc_context_len_to_sid_raw(const char * ctx, size_t len,
+			       security_id_t * sid)
+{
+	int rc;
+	/* avc_init needs to be called before this function */
+	assert(avc_running);
+
+	avc_get_lock(avc_lock);
+	rc = sidtab_context_len_to_sid(&avc_sidtab, ctx, len, sid);
+	avc_release_lock(avc_lock);
+	return rc;
+}
+
 int avc_context_to_sid(const char * ctx, security_id_t * sid)
 {
 	int ret;
@@ -120,14 +369,40 @@ int avc_sid_to_context(security_id_t sid, char ** ctx)
 	return ret;
 }
 
-int sidget(security_id_t sid __attribute__((unused)))
+int sidget(security_id_t sid)
 {
-	return 1;
+	int rc = 0;
+
+	if (!sid)
+		return 0;
+
+	avc_get_lock(avc_lock);
+	if (sid->refcnt)
+		rc = sidtab_sid_get(&avc_sidtab, sid);
+	avc_release_lock(avc_lock);
+	return rc;
 }
 
-int sidput(security_id_t sid __attribute__((unused)))
+static void avc_evict_sids(void);
+
+int sidput(security_id_t sid)
 {
-	return 1;
+	int rc;
+
+	if (!sid)
+		return 0;
+
+	avc_get_lock(avc_lock);
+	rc = sidtab_sid_put(&avc_sidtab, sid);
+	/* collect once unreferenced SIDs make up half of the table */
+	if (avc_sidtab.nunref >= SIDTAB_HASH_BUCKETS &&
+	    avc_sidtab.nunref >= avc_sidtab.nel / 2) {
+		avc_write_begin();
+		avc_evict_sids();
+		avc_write_end();
+	}
+	avc_release_lock(avc_lock);
+	return rc;
 }
 
 int avc_get_initial_sid(const char * name, security_id_t * sid)
@@ -145,9 +420,34 @@ int avc_get_initial_sid(const char * name, security_id_t * sid)
 	return rc;
 }
 
+static int avc_parse_size_opt(const char *value, unsigned *size)
+{
+	char *end;
+	unsigned long val;
+
+	if (!value)
+		goto err;
+	errno = 0;
+	val = strtoul(value, &end, 10);
+	if (errno || end == value || *end || !val || val > UINT32_MAX)
+		goto err;
+	*size = val;
+	return 0;
+      err:
+	errno = EINVAL;
+	return -1;
+}
+
 int avc_open(struct selinux_opt *opts, unsigned nopts)
 {
 	avc_setenforce = 0;
+	avc_cache_slots_opt = 0;
+	avc_cache_maxnodes_opt = 0;
+	avc_prefetch_on_reset = 0;
+	avc_thread_cache = 0;
+	avc_audit_async_opt = 0;
+	avc_shared_path = NULL;
+	avc_stats_path = NULL;
 
 	while (nopts--)
 		switch(opts[nopts].type) {
@@ -155,11 +455,48 @@ int avc_open(struct selinux_opt *opts, unsigned nopts)
 			avc_setenforce = 1;
 			avc_enforcing = !!opts[nopts].value;
 			break;
+		case AVC_OPT_CACHE_SLOTS:
+			if (avc_parse_size_opt(opts[nopts].value,
+					       &avc_cache_slots_opt))
+				return -1;
+			break;
+		case AVC_OPT_CACHE_MAXNODES:
+			if (avc_parse_size_opt(opts[nopts].value,
+					       &avc_cache_maxnodes_opt))
+				return -1;
+			break;
+		case AVC_OPT_PREFETCH:
+			avc_prefetch_on_reset = !!opts[nopts].value;
+			break;
+		case AVC_OPT_THREAD_CACHE:
+			avc_thread_cache = !!opts[nopts].value;
+			break;
+		case AVC_OPT_ASYNC_AUDIT:
+			avc_audit_async_opt = !!opts[nopts].value;
+			break;
+		case AVC_OPT_SHARED_CACHE:
+			avc_shared_path = opts[nopts].value;
+			break;
+		case AVC_OPT_STATS_EXPORT:
+			avc_stats_path = opts[nopts].value;
+			break;
 		}
 
 	return avc_init("avc", NULL, NULL, NULL, NULL);
 }
 
+static struct avc_slots *avc_alloc_slots(uint32_t nslots)
+{
+	struct avc_slots *table;
+
+	table = avc_malloc(sizeof(*table) + nslots * sizeof(table->slots[0]));
+	if (!table)
+		return NULL;
+	memset(table, 0, sizeof(*table) + nslots * sizeof(table->slots[0]));
+	table->nslots = nslots;
+	return table;
+}
+
 int avc_init(const char *prefix,
 	     const struct avc_memory_callback *mem_cb,
 	     const struct avc_log_callback *log_cb,
@@ -167,7 +504,8 @@ int avc_init(const char *prefix,
 	     const struct avc_lock_callback *lock_cb)
 {
 	struct avc_node *new;
-	int i, rc = 0;
+	uint32_t i, nslots;
+	int rc = 0;
 
 	if (avc_running)
 		return 0;
@@ -182,11 +520,31 @@ int avc_init(const char *prefix,
 
 	memset(&cache_stats, 0, sizeof(cache_stats));
 
-	for (i = 0; i < AVC_CACHE_SLOTS; i++)
-		avc_cache.slots[i] = 0;
-	avc_cache.lru_hint = 0;
+	/* the slot count must be a power of two for avc_hash() */
+	nslots = AVC_CACHE_SLOTS;
+	if (avc_cache_slots_opt) {
+		nslots = 1;
+		while (nslots < avc_cache_slots_opt &&
+		       nslots < AVC_CACHE_MAXSLOTS)
+			nslots <<= 1;
+	}
+	avc_cache.table = avc_alloc_slots(nslots);
+	if (!avc_cache.table) {
+		avc_log(SELINUX_ERROR,
+			"%s:  unable to allocate AVC hash table\n",
+			avc_prefix);
+		rc = -1;
+		goto out;
+	}
+	avc_cache.clock_hand = NULL;
 	avc_cache.active_nodes = 0;
+	avc_cache.active_nodes_max = 0;
+	avc_cache.max_nodes = avc_cache_maxnodes_opt ?
+	    avc_cache_maxnodes_opt : AVC_CACHE_MAXNODES;
 	avc_cache.latest_notif = 0;
+	avc_cache.generation = 0;
+	avc_cache.window_lookups = 0;
+	avc_cache.window_misses = 0;
 
 	rc = sidtab_init(&avc_sidtab);
 	if (rc) {
@@ -205,12 +563,13 @@ int avc_init(const char *prefix,
 		goto out;
 	}
 
-	for (i = 0; i < AVC_CACHE_MAXNODES; i++) {
+	for (i = 0; i < avc_cache.max_nodes; i++) {
 		new = avc_malloc(sizeof(*new));
 		if (!new) {
 			avc_log(SELINUX_WARNING,
-				"%s:  warning: only got %d av entries\n",
+				"%s:  warning: only got %u av entries\n",
 				avc_prefix, i);
+			avc_cache.max_nodes = i;
 			break;
 		}
 		memset(new, 0, sizeof(*new));
@@ -218,6 +577,12 @@ int avc_init(const char *prefix,
 		avc_node_freelist = new;
 	}
 
+	if (avc_stats_path && avc_stats_open(avc_stats_path) < 0) {
+		avc_log(SELINUX_WARNING,
+			"%s:  can't export statistics to %s: %s\n",
+			avc_prefix, avc_stats_path, strerror(errno));
+	}
+
 	if (!avc_setenforce) {
 		rc = security_getenforce();
 		if (rc < 0) {
@@ -230,6 +595,24 @@ int avc_init(const char *prefix,
 		avc_enforcing = rc;
 	}
 
+	/*
+	 * Prefer the kernel status page: noticing a setenforce or policy
+	 * load is then a memory read in avc_has_perm_noaudit() rather
+	 * than a netlink receive or a separate listening thread.
+	 */
+	if (selinux_status_open(0) == 0) {
+		avc_status_page = 1;
+		avc_running = 1;
+		rc = 0;
+		/* the shared cache is only valid with the status page */
+		if (avc_shared_path && avc_shared_open(avc_shared_path) < 0) {
+			avc_log(SELINUX_WARNING,
+				"%s:  can't use shared cache %s: %s\n",
+				avc_prefix, avc_shared_path, strerror(errno));
+		}
+		goto out;
+	}
+
 	rc = avc_netlink_open(0);
 	if (rc < 0) {
 		avc_log(SELINUX_ERROR,
@@ -243,12 +626,58 @@ int avc_init(const char *prefix,
 	}
 	avc_running = 1;
       out:
+	if (avc_running && avc_audit_async_opt)
+		avc_audit_start();
 	return rc;
 }
 
+/* The counters summed over all threads, and the cache size, in 'ext'. */
+static void avc_sum_stats(struct avc_cache_stats_ext *ext)
+{
+	struct avc_thread_state *t;
+
+	avc_get_lock(avc_lock);
+	memcpy(ext, &cache_stats, sizeof(*ext));
+	for (t = avc_thread_states; t; t = t->next)
+		avc_add_stats(ext, &t->stats);
+	ext->cache_slots = avc_cache.table ? avc_cache.table->nslots : 0;
+	ext->cache_nodes = avc_cache.max_nodes;
+	ext->active_nodes = avc_cache.active_nodes;
+	ext->active_nodes_max = avc_cache.active_nodes_max;
+	avc_release_lock(avc_lock);
+}
+
 void avc_cache_stats(struct avc_cache_stats *p)
 {
-	memcpy(p, &cache_stats, sizeof(cache_stats));
+	struct avc_cache_stats_ext ext;
+
+	avc_sum_stats(&ext);
+	p->entry_lookups = ext.entry_lookups;
+	p->entry_hits = ext.entry_hits;
+	p->entry_misses = ext.entry_misses;
+	p->entry_discards = ext.entry_discards;
+	p->cav_lookups = ext.cav_lookups;
+	p->cav_hits = ext.cav_hits;
+	p->cav_probes = ext.cav_probes;
+	p->cav_misses = ext.cav_misses;
+}
+
+int avc_cache_stats_ext(struct avc_cache_stats_ext *stats, size_t size)
+{
+	struct avc_cache_stats_ext ext;
+
+	if (size < sizeof(struct avc_cache_stats)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	avc_sum_stats(&ext);
+	if (size > sizeof(ext)) {
+		memset((char *)stats + sizeof(ext), 0, size - sizeof(ext));
+		size = sizeof(ext);
+	}
+	memcpy(stats, &ext, size);
+	return 0;
 }
 
 void avc_sid_stats(void)
@@ -265,15 +694,17 @@ void avc_sid_stats(void)
 
 void avc_av_stats(void)
 {
-	int i, chain_len, max_chain_len, slots_used;
+	uint32_t i, nslots;
+	int chain_len, max_chain_len, slots_used;
 	struct avc_node *node;
 
 	avc_get_lock(avc_lock);
 
 	slots_used = 0;
 	max_chain_len = 0;
-	for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-		node = avc_cache.slots[i];
+	nslots = avc_cache.table->nslots;
+	for (i = 0; i < nslots; i++) {
+		node = avc_cache.table->slots[i];
 		if (node) {
 			slots_used++;
 			chain_len = 0;
@@ -288,50 +719,191 @@ void avc_av_stats(void)
 
 	avc_release_lock(avc_lock);
 
-	avc_log(SELINUX_INFO, "%s:  %d AV entries and %d/%d buckets used, "
+	avc_log(SELINUX_INFO, "%s:  %u AV entries and %d/%u buckets used, "
 		"longest chain length %d\n", avc_prefix,
 		avc_cache.active_nodes,
-		slots_used, AVC_CACHE_SLOTS, max_chain_len);
+		slots_used, nslots, max_chain_len);
 }
 
 hidden_def(avc_av_stats)
 
+/*
+ * Active nodes are kept on a circular list scanned by a CLOCK hand.
+ * New nodes go in just behind the hand, so they are the last to be
+ * considered for reclaim.  Hits only set ae.used, which keeps the
+ * lockless read path free of list manipulation.
+ */
+static inline void avc_clock_insert(struct avc_node *node)
+{
+	struct avc_node *hand = avc_cache.clock_hand;
+
+	if (!hand) {
+		node->clock_prev = node->clock_next = node;
+		avc_cache.clock_hand = node;
+		return;
+	}
+	node->clock_next = hand;
+	node->clock_prev = hand->clock_prev;
+	hand->clock_prev->clock_next = node;
+	hand->clock_prev = node;
+}
+
+static inline void avc_clock_remove(struct avc_node *node)
+{
+	if (node->clock_next == node) {
+		avc_cache.clock_hand = NULL;
+	} else {
+		node->clock_prev->clock_next = node->clock_next;
+		node->clock_next->clock_prev = node->clock_prev;
+		if (avc_cache.clock_hand == node)
+			avc_cache.clock_hand = node->clock_next;
+	}
+	node->clock_prev = node->clock_next = NULL;
+}
+
 static inline struct avc_node *avc_reclaim_node(void)
 {
-	struct avc_node *prev, *cur;
-	int try;
-	uint32_t hvalue;
+	struct avc_node **pprev, *cur;
+	uint32_t scanned;
+	int hvalue;
+
+	/*
+	 * Give every node a second chance, but no more: after two
+	 * turns of the hand take whatever it points at, even if a
+	 * lockless reader keeps marking it used.
+	 */
+	for (scanned = 0; (cur = avc_cache.clock_hand); scanned++) {
+		avc_cache.clock_hand = cur->clock_next;
+		if (!cur->ae.used || scanned >= 2 * avc_cache.active_nodes)
+			break;
+		cur->ae.used = 0;
+	}
+
+	if (!cur) {
+		errno = ENOMEM;	/* this was a panic in the kernel... */
+		return NULL;
+	}
+
+	hvalue = avc_hash(cur->ae.ssid, cur->ae.tsid, cur->ae.tclass,
+			  avc_cache.table->nslots);
+	pprev = &avc_cache.table->slots[hvalue];
+	while (*pprev != cur)
+		pprev = &(*pprev)->next;
+	*pprev = cur->next;
+	avc_clock_remove(cur);
+
+	avc_cache_stats_incr(cav_evictions);
+	return cur;
+}
+
+static inline uint32_t avc_xcache_hash(security_id_t ssid,
+				       security_id_t tsid,
+				       security_class_t tclass, int kind,
+				       const char *name)
+{
+	uint32_t h = avc_hash(ssid, tsid, tclass, AVC_XCACHE_SLOTS) ^ kind;
+
+	if (name)
+		while (*name)
+			h = h * 31 + (unsigned char)*name++;
+	return h & (AVC_XCACHE_SLOTS - 1);
+}
+
+static inline void avc_xcache_free_node(struct avc_xnode *node)
+{
+	avc_free(node->name);
+	avc_free(node);
+	avc_xcache_nodes--;
+}
 
-	hvalue = avc_cache.lru_hint;
-	for (try = 0; try < 2; try++) {
-		do {
-			prev = NULL;
-			cur = avc_cache.slots[hvalue];
-			while (cur) {
-				if (!cur->ae.used)
-					goto found;
+/* Called with avc_lock held. */
+static void avc_xcache_flush(void)
+{
+	struct avc_xnode *node;
+	uint32_t i;
 
-				cur->ae.used = 0;
+	for (i = 0; i < AVC_XCACHE_SLOTS; i++) {
+		while ((node = avc_xcache[i])) {
+			avc_xcache[i] = node->next;
+			avc_xcache_free_node(node);
+		}
+	}
+}
 
-				prev = cur;
-				cur = cur->next;
+/* Drop the entries with a SID about to be freed.  Called with avc_lock
+ * held. */
+static void avc_xcache_evict_sids(void)
+{
+	struct avc_xnode **pprev, *node;
+	uint32_t i;
+
+	for (i = 0; i < AVC_XCACHE_SLOTS; i++) {
+		pprev = &avc_xcache[i];
+		while ((node = *pprev)) {
+			if (node->ssid->refcnt && node->tsid->refcnt &&
+			    node->newsid->refcnt) {
+				pprev = &node->next;
+				continue;
 			}
-			hvalue = (hvalue + 1) & (AVC_CACHE_SLOTS - 1);
-		} while (hvalue != avc_cache.lru_hint);
+			*pprev = node->next;
+			avc_xcache_free_node(node);
+		}
 	}
+}
 
-	errno = ENOMEM;		/* this was a panic in the kernel... */
+/* Called with avc_lock held. */
+static security_id_t avc_xcache_lookup(security_id_t ssid,
+				       security_id_t tsid,
+				       security_class_t tclass, int kind,
+				       const char *name)
+{
+	struct avc_xnode *node;
+
+	node = avc_xcache[avc_xcache_hash(ssid, tsid, tclass, kind, name)];
+	for (; node; node = node->next) {
+		if (node->ssid == ssid && node->tsid == tsid &&
+		    node->tclass == tclass && node->kind == kind &&
+		    (node->name == name ||
+		     (node->name && name && !strcmp(node->name, name))))
+			return node->newsid;
+	}
 	return NULL;
+}
 
-      found:
-	avc_cache.lru_hint = hvalue;
+/* Remember a result; it is only an optimization, so failing to
+ * allocate is ignored.  Called with avc_lock held. */
+static void avc_xcache_insert(security_id_t ssid, security_id_t tsid,
+			      security_class_t tclass, int kind,
+			      const char *name, security_id_t newsid)
+{
+	struct avc_xnode *node;
+	uint32_t h;
 
-	if (prev == NULL)
-		avc_cache.slots[hvalue] = cur->next;
-	else
-		prev->next = cur->next;
+	if (avc_xcache_nodes >= AVC_XCACHE_MAXNODES)
+		avc_xcache_flush();
 
-	return cur;
+	node = avc_malloc(sizeof(*node));
+	if (!node)
+		return;
+	node->name = NULL;
+	if (name) {
+		node->name = avc_malloc(strlen(name) + 1);
+		if (!node->name) {
+			avc_free(node);
+			return;
+		}
+		strcpy(node->name, name);
+	}
+	node->ssid = ssid;
+	node->tsid = tsid;
+	node->tclass = tclass;
+	node->kind = kind;
+	node->newsid = newsid;
+
+	h = avc_xcache_hash(ssid, tsid, tclass, kind, name);
+	node->next = avc_xcache[h];
+	avc_xcache[h] = node;
+	avc_xcache_nodes++;
 }
 
 static inline void avc_clear_avc_entry(struct avc_entry *ae)
@@ -339,6 +911,103 @@ static inline void avc_clear_avc_entry(struct avc_entry *ae)
 	memset(ae, 0, sizeof(*ae));
 }
 
+/**
+ * avc_grow_cache - Double the size of the AVC.
+ *
+ * Rehash all entries into a slot table twice as large and allow
+ * twice as many nodes.  The old slot table is retired rather than
+ * freed since lockless readers may still be walking it.  Called with
+ * avc_lock held inside a write section.
+ */
+static void avc_grow_cache(void)
+{
+	struct avc_slots *old = avc_cache.table, *new;
+	struct avc_node *node, *next;
+	uint32_t i;
+	int hvalue;
+
+	if (old->nslots >= AVC_CACHE_MAXSLOTS)
+		return;
+
+	new = avc_alloc_slots(old->nslots << 1);
+	if (!new)
+		return;
+
+	for (i = 0; i < old->nslots; i++) {
+		for (node = old->slots[i]; node; node = next) {
+			next = node->next;
+			hvalue = avc_hash(node->ae.ssid, node->ae.tsid,
+					  node->ae.tclass, new->nslots);
+			node->next = new->slots[hvalue];
+			new->slots[hvalue] = node;
+		}
+	}
+	new->retired = old;
+	avc_cache.table = new;
+	avc_cache.max_nodes <<= 1;
+
+	avc_log(SELINUX_INFO, "%s:  grew AV cache to %u entries and %u "
+		"buckets\n", avc_prefix, avc_cache.max_nodes, new->nslots);
+}
+
+/*
+ * Account a locked lookup and grow the cache once enough of them
+ * have been seen, if the last window had a high miss rate while the
+ * cache was full.
+ */
+static inline void avc_check_resize(int miss)
+{
+	avc_cache.window_lookups++;
+	if (miss)
+		avc_cache.window_misses++;
+
+	if (avc_cache.window_lookups < avc_cache.max_nodes)
+		return;
+
+	if (avc_cache.active_nodes >= avc_cache.max_nodes &&
+	    avc_cache.window_misses * AVC_CACHE_MISS_RATIO >
+	    avc_cache.window_lookups)
+		avc_grow_cache();
+
+	avc_cache.window_lookups = 0;
+	avc_cache.window_misses = 0;
+}
+
+/*
+ * Drop the AVC entries that refer to SIDs whose reference count has
+ * reached zero, then free those SIDs.  The entries have to go first:
+ * a freed SID's address may be handed out again for another context.
+ * Called with avc_lock held inside a write section.
+ */
+static void avc_evict_sids(void)
+{
+	struct avc_node **pprev, *node;
+	uint32_t i;
+
+	if (!avc_sidtab.nunref)
+		return;
+
+	for (i = 0; i < avc_cache.table->nslots; i++) {
+		pprev = &avc_cache.table->slots[i];
+		while ((node = *pprev)) {
+			if (node->ae.ssid->refcnt && node->ae.tsid->refcnt) {
+				pprev = &node->next;
+				continue;
+			}
+			*pprev = node->next;
+			avc_clock_remove(node);
+			avc_clear_avc_entry(&node->ae);
+			node->next = avc_node_freelist;
+			avc_node_freelist = node;
+			avc_cache.active_nodes--;
+		}
+	}
+	avc_xcache_evict_sids();
+	sidtab_evict_unreferenced(&avc_sidtab);
+	/* front caches compare SID pointers too */
+	avc_bump_generation();
+}
+
 static inline struct avc_node *avc_claim_node(security_id_t ssid,
 					      security_id_t tsid,
 					      security_class_t tclass)
@@ -347,26 +1016,38 @@ static inline struct avc_node *avc_claim_node(security_id_t ssid,
 	int hvalue;
 
 	if (!avc_node_freelist)
-		avc_cleanup();
+		avc_evict_sids();
+
+	if (!avc_node_freelist &&
+	    avc_cache.active_nodes < avc_cache.max_nodes) {
+		new = avc_malloc(sizeof(*new));
+		if (new) {
+			memset(new, 0, sizeof(*new));
+			avc_node_freelist = new;
+		}
+	}
 
 	if (avc_node_freelist) {
 		new = avc_node_freelist;
 		avc_node_freelist = avc_node_freelist->next;
 		avc_cache.active_nodes++;
+		if (avc_cache.active_nodes > avc_cache.active_nodes_max)
+			avc_cache.active_nodes_max = avc_cache.active_nodes;
 	} else {
 		new = avc_reclaim_node();
 		if (!new)
 			goto out;
 	}
 
-	hvalue = avc_hash(ssid, tsid, tclass);
+	hvalue = avc_hash(ssid, tsid, tclass, avc_cache.table->nslots);
 	avc_clear_avc_entry(&new->ae);
 	new->ae.used = 1;
 	new->ae.ssid = ssid;
 	new->ae.tsid = tsid;
 	new->ae.tclass = tclass;
-	new->next = avc_cache.slots[hvalue];
-	avc_cache.slots[hvalue] = new;
+	new->next = avc_cache.table->slots[hvalue];
+	avc_cache.table->slots[hvalue] = new;
+	avc_clock_insert(new);
 
       out:
 	return new;
@@ -381,8 +1062,8 @@ static inline struct avc_node *avc_search_node(security_id_t ssid,
 	int hvalue;
 	int tprobes = 1;
 
-	hvalue = avc_hash(ssid, tsid, tclass);
-	cur = avc_cache.slots[hvalue];
+	hvalue = avc_hash(ssid, tsid, tclass, avc_cache.table->nslots);
+	cur = avc_cache.table->slots[hvalue];
 	while (cur != NULL &&
 	       (ssid != cur->ae.ssid ||
 		tclass != cur->ae.tclass || tsid != cur->ae.tsid)) {
@@ -434,6 +1115,7 @@ static int avc_lookup(security_id_t ssid, security_id_t tsid,
 		avc_cache_stats_incr(cav_hits);
 		avc_cache_stats_add(cav_probes, probes);
 		aeref->ae = &node->ae;
+		avc_check_resize(0);
 		goto out;
 	}
 
@@ -443,6 +1125,91 @@ static int avc_lookup(security_id_t ssid, security_id_t tsid,
 	return rc;
 }
 
+/**
+ * avc_lookup_lockless - Look up a fully granted AVC entry without locking.
+ * @ssid: source security identifier
+ * @tsid: target security identifier
+ * @tclass: target security class
+ * @requested: requested permissions, interpreted based on @tclass
+ * @aeref:  AVC entry reference
+ * @avd: access vector decisions, or %NULL
+ *
+ * Try @aeref and then the hash chain for an entry that has decided
+ * and allowed all of @requested, copying it out under the cache
+ * sequence counter.  On success update @aeref and @avd and return %0.
+ * Return -%1 if the caller has to take avc_lock and use the regular
+ * path, either because the entry is missing, does not grant @requested,
+ * or was changed while it was being read.  The statistics counters
+ * bumped here are not serialized and may undercount under contention.
+ */
+static int avc_lookup_lockless(security_id_t ssid, security_id_t tsid,
+			       security_class_t tclass,
+			       access_vector_t requested,
+			       struct avc_entry_ref *aeref,
+			       struct av_decision *avd)
+{
+	struct avc_entry *ae;
+	struct avc_slots *table;
+	struct avc_node *cur;
+	struct av_decision tavd;
+	uint32_t seqno;
+	int probes = 1, entry_hit = 1;
+
+	if (!requested)
+		return -1;
+
+	seqno = avc_read_begin();
+	if (seqno & 0x0001)
+		return -1;
+
+	ae = aeref->ae;
+	if (!ae || ae->ssid != ssid || ae->tsid != tsid ||
+	    ae->tclass != tclass) {
+		entry_hit = 0;
+		table = *(struct avc_slots * volatile *)&avc_cache.table;
+		cur = *(struct avc_node * volatile *)
+		    &table->slots[avc_hash(ssid, tsid, tclass, table->nslots)];
+		while (cur &&
+		       (cur->ae.ssid != ssid || cur->ae.tsid != tsid ||
+			cur->ae.tclass != tclass)) {
+			/* a chain garbled by a writer could loop */
+			if (++probes > (int)avc_cache.max_nodes)
+				return -1;
+			cur = *(struct avc_node * volatile *)&cur->next;
+		}
+		if (!cur)
+			return -1;
+		ae = &cur->ae;
+	}
+
+	memcpy(&tavd, &ae->avd, sizeof(tavd));
+	if (avc_read_retry(seqno))
+		return -1;
+
+	if ((tavd.decided & requested) != requested ||
+	    (tavd.allowed & requested) != requested)
+		return -1;
+
+	/* benign race: only a hint for avc_reclaim_node() */
+	if (!ae->used)
+		ae->used = 1;
+
+	avc_cache_stats_incr(entry_lookups);
+	if (entry_hit) {
+		avc_cache_stats_incr(entry_hits);
+	} else {
+		avc_cache_stats_incr(entry_misses);
+		avc_cache_stats_incr(cav_lookups);
+		avc_cache_stats_incr(cav_hits);
+		avc_cache_stats_add(cav_probes, probes);
+	}
+
+	aeref->ae = ae;
+	if (avd)
+		memcpy(avd, &tavd, sizeof(*avd));
+	return 0;
+}
+
 /**
  * avc_insert - Insert an AVC entry.
  * @ssid: source security identifier
@@ -478,20 +1245,26 @@ static int avc_insert(security_id_t ssid, security_id_t tsid,
 		goto out;
 	}
 
+	avc_write_begin();
+	avc_check_resize(1);
 	node = avc_claim_node(ssid, tsid, tclass);
-	if (!node) {
+	if (node) {
+		memcpy(&node->ae.avd, &ae->avd, sizeof(ae->avd));
+		aeref->ae = &node->ae;
+	} else
 		rc = -1;
-		goto out;
-	}
-
-	memcpy(&node->ae.avd, &ae->avd, sizeof(ae->avd));
-	aeref->ae = &node->ae;
+	avc_write_end();
       out:
 	return rc;
 }
 
 void avc_cleanup(void)
 {
+	avc_get_lock(avc_lock);
+	avc_write_begin();
+	avc_evict_sids();
+	avc_write_end();
+	avc_release_lock(avc_lock);
 }
 
 hidden_def(avc_cleanup)
@@ -499,32 +1272,43 @@ hidden_def(avc_cleanup)
 int avc_reset(void)
 {
 	struct avc_callback_node *c;
-	int i, ret, rc = 0, errsave = 0;
+	struct avc_thread_state *t;
+	int ret, rc = 0, errsave = 0;
 	struct avc_node *node, *tmp;
+	uint32_t i;
 	errno = 0;
 
 	if (!avc_running)
 		return 0;
 
 	avc_get_lock(avc_lock);
+	avc_write_begin();
 
-	for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-		node = avc_cache.slots[i];
+	for (i = 0; i < avc_cache.table->nslots; i++) {
+		node = avc_cache.table->slots[i];
 		while (node) {
 			tmp = node;
 			node = node->next;
 			avc_clear_avc_entry(&tmp->ae);
+			tmp->clock_prev = tmp->clock_next = NULL;
 			tmp->next = avc_node_freelist;
 			avc_node_freelist = tmp;
 			avc_cache.active_nodes--;
 		}
-		avc_cache.slots[i] = 0;
+		avc_cache.table->slots[i] = 0;
 	}
-	avc_cache.lru_hint = 0;
+	avc_cache.clock_hand = NULL;
+	avc_cache.window_lookups = 0;
+	avc_cache.window_misses = 0;
+	avc_xcache_flush();
 
-	avc_release_lock(avc_lock);
+	avc_write_end();
+	avc_bump_generation();
 
 	memset(&cache_stats, 0, sizeof(cache_stats));
+	for (t = avc_thread_states; t; t = t->next)
+		memset(&t->stats, 0, sizeof(t->stats));
+	avc_release_lock(avc_lock);
 
 	for (c = avc_callbacks; c; c = c->next) {
 		if (c->events & AVC_CALLBACK_RESET) {
@@ -541,33 +1325,143 @@ int avc_reset(void)
 
 hidden_def(avc_reset)
 
+int avc_prefetch(const struct avc_prefetch_req *reqs, unsigned nreqs)
+{
+	struct security_av_query *queries;
+	struct av_decision *avds;
+	struct avc_entry entry;
+	struct avc_entry_ref aeref;
+	unsigned i;
+	int rc = 0;
+
+	if (!avc_running || !nreqs)
+		return 0;
+
+	queries = avc_malloc(nreqs * sizeof(*queries));
+	avds = avc_malloc(nreqs * sizeof(*avds));
+	if (!queries || !avds) {
+		rc = -1;
+		goto out;
+	}
+
+	for (i = 0; i < nreqs; i++) {
+		queries[i].scon = reqs[i].ssid->ctx;
+		queries[i].tcon = reqs[i].tsid->ctx;
+		queries[i].tclass = reqs[i].tclass;
+		queries[i].requested = 0;
+	}
+
+	/* a failed query just leaves that entry out of the cache */
+	(void)security_compute_av_flags_batch_raw(queries, nreqs, avds);
+
+	avc_get_lock(avc_lock);
+	for (i = 0; i < nreqs; i++) {
+		if (!avds[i].decided)
+			continue;
+		if (avc_search_node(reqs[i].ssid, reqs[i].tsid,
+				    reqs[i].tclass, NULL))
+			continue;
+		memcpy(&entry.avd, &avds[i], sizeof(entry.avd));
+		avc_entry_ref_init(&aeref);
+		if (avc_insert(reqs[i].ssid, reqs[i].tsid, reqs[i].tclass,
+			       &entry, &aeref))
+			break;
+	}
+	avc_release_lock(avc_lock);
+
+      out:
+	avc_free(queries);
+	avc_free(avds);
+	return rc;
+}
+
+/*
+ * Record the (ssid, tsid, tclass) triples currently in the cache so
+ * that they can be handed to avc_prefetch() after a flush.
+ */
+static struct avc_prefetch_req *avc_snapshot(unsigned *nreqs)
+{
+	struct avc_prefetch_req *reqs;
+	struct avc_node *node;
+	unsigned n = 0;
+	uint32_t i;
+
+	*nreqs = 0;
+	avc_get_lock(avc_lock);
+	if (!avc_cache.active_nodes) {
+		avc_release_lock(avc_lock);
+		return NULL;
+	}
+	reqs = avc_malloc(avc_cache.active_nodes * sizeof(*reqs));
+	if (reqs) {
+		for (i = 0; i < avc_cache.table->nslots; i++) {
+			for (node = avc_cache.table->slots[i]; node;
+			     node = node->next) {
+				reqs[n].ssid = node->ae.ssid;
+				reqs[n].tsid = node->ae.tsid;
+				reqs[n].tclass = node->ae.tclass;
+				/* keep the SIDs alive until the prefetch */
+				sidtab_sid_get(&avc_sidtab, reqs[n].ssid);
+				sidtab_sid_get(&avc_sidtab, reqs[n].tsid);
+				n++;
+			}
+		}
+		*nreqs = n;
+	}
+	avc_release_lock(avc_lock);
+	return reqs;
+}
+
 void avc_destroy(void)
 {
 	struct avc_callback_node *c;
 	struct avc_node *node, *tmp;
-	int i;
+	struct avc_slots *table;
+	struct avc_thread_state *t;
+	uint32_t i;
 	/* avc_init needs to be called before this function */
 	assert(avc_running);
 
+	avc_audit_stop();
+
 	avc_get_lock(avc_lock);
 
-	if (avc_using_threads)
+	if (avc_status_page) {
+		avc_shared_close();
+		selinux_status_close();
+		avc_status_page = 0;
+	} else if (avc_using_threads)
 		avc_stop_thread(avc_netlink_thread);
 	avc_netlink_close();
 
-	for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-		node = avc_cache.slots[i];
+	avc_write_begin();
+	for (i = 0; i < avc_cache.table->nslots; i++) {
+		node = avc_cache.table->slots[i];
 		while (node) {
 			tmp = node;
 			node = node->next;
 			avc_free(tmp);
 		}
 	}
+	while (avc_cache.table) {
+		table = avc_cache.table;
+		avc_cache.table = table->retired;
+		avc_free(table);
+	}
+	/* thread states are freed by their owners on thread exit */
+	while (avc_thread_states) {
+		t = avc_thread_states;
+		avc_thread_states = t->next;
+		t->next = NULL;
+		t->pprev = NULL;
+	}
 	while (avc_node_freelist) {
 		tmp = avc_node_freelist;
 		avc_node_freelist = tmp->next;
 		avc_free(tmp);
 	}
+	avc_xcache_flush();
+	avc_write_end();
 	avc_release_lock(avc_lock);
 
 	while (avc_callbacks) {
@@ -575,10 +1469,18 @@ void avc_destroy(void)
 		avc_callbacks = c->next;
 		avc_free(c);
 	}
+	avc_stats_close();
 	sidtab_destroy(&avc_sidtab);
 	avc_free_lock(avc_lock);
 	avc_free_lock(avc_log_lock);
 	avc_free(avc_audit_buf);
+	avc_cache_slots_opt = 0;
+	avc_cache_maxnodes_opt = 0;
+	avc_prefetch_on_reset = 0;
+	avc_thread_cache = 0;
+	avc_audit_async_opt = 0;
+	avc_shared_path = NULL;
+	avc_stats_path = NULL;
 	avc_running = 0;
 }
 
@@ -641,35 +1543,36 @@ static inline int check_avc_ratelimit(void)
 
 /**
  * avc_dump_av - Display an access vector in human-readable form.
+ * @buf: buffer of %AVC_AUDIT_BUFSIZE bytes to append to
  * @tclass: target security class
  * @av: access vector
  */
-static void avc_dump_av(security_class_t tclass, access_vector_t av)
+static void avc_dump_av(char *buf, security_class_t tclass, access_vector_t av)
 {
 	const char *permstr;
 	access_vector_t bit = 1;
 
 	if (av == 0) {
-		log_append(avc_audit_buf, " null");
+		log_append(buf, " null");
 		return;
 	}
 
-	log_append(avc_audit_buf, " {");
+	log_append(buf, " {");
 
 	while (av) {
 		if (av & bit) {
 			permstr = security_av_perm_to_string(tclass, bit);
 			if (!permstr)
 				break;
-			log_append(avc_audit_buf, " %s", permstr);
+			log_append(buf, " %s", permstr);
 			av &= ~bit;
 		}
 		bit <<= 1;
 	}
 
 	if (av)
-		log_append(avc_audit_buf, " 0x%x", av);
-	log_append(avc_audit_buf, " }");
+		log_append(buf, " 0x%x", av);
+	log_append(buf, " }");
 }
 
 /**
@@ -691,6 +1594,203 @@ static void avc_dump_query(security_id_t ssid, security_id_t tsid,
 		   security_class_to_string(tclass));
 }
 
+/*
+ * Asynchronous auditing (AVC_OPT_ASYNC_AUDIT).  avc_audit() copies what
+ * the message needs into a slot of a bounded ring and returns; a thread
+ * started with the thread callbacks formats the messages and hands them
+ * to the log callback.  Slots are claimed without locks, each with a
+ * sequence number telling whether it is free for the producer at a
+ * position or filled for the consumer.  The supplementary audit callback still
+ * runs in avc_audit(), since its data pointer is only valid there.
+ * When the ring is full the message is dropped and counted, and the
+ * count is reported as suppressed messages.
+ */
+#define AVC_AUDIT_RING	256	/* power of two */
+
+struct avc_audit_rec {
+	uint32_t seq;
+	security_class_t tclass;
+	access_vector_t audited;
+	int denied;
+	uint16_t scon;		/* offsets in buf */
+	uint16_t tcon;
+	char buf[AVC_AUDIT_BUFSIZE];	/* suppl. info, scontext, tcontext */
+};
+
+static struct {
+	uint32_t head;		/* next position to fill */
+	uint32_t tail;		/* next position to log */
+	uint32_t lost;
+	int stop;
+	sem_t ready;
+	sem_t done;		/* posted once the queue is drained */
+	void *thread;
+	struct avc_audit_rec *recs;
+} avc_audit_ring;
+
+/* Copy str at *off in buf, truncated to what is left. */
+static uint16_t avc_audit_copy(char *buf, size_t *off, const char *str)
+{
+	uint16_t start = *off;
+	size_t len = strlen(str);
+
+	if (len >= AVC_AUDIT_BUFSIZE - *off)
+		len = AVC_AUDIT_BUFSIZE - *off - 1;
+	memcpy(buf + *off, str, len);
+	buf[*off + len] = '\0';
+	*off += len + 1;
+	if (*off > AVC_AUDIT_BUFSIZE - 1)
+		*off = AVC_AUDIT_BUFSIZE - 1;
+	return start;
+}
+
+static void avc_audit_enqueue(security_id_t ssid, security_id_t tsid,
+			      security_class_t tclass,
+			      access_vector_t audited, int denied, void *a)
+{
+	struct avc_audit_rec *rec;
+	uint32_t pos, seq;
+	size_t off;
+
+	pos = __atomic_load_n(&avc_audit_ring.head, __ATOMIC_RELAXED);
+	for (;;) {
+		rec = &avc_audit_ring.recs[pos & (AVC_AUDIT_RING - 1)];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&avc_audit_ring.head,
+							&pos, pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if ((int32_t)(seq - pos) < 0) {
+			/* full: the consumer has not freed this slot yet */
+			__atomic_add_fetch(&avc_audit_ring.lost, 1,
+					   __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n(&avc_audit_ring.head,
+					      __ATOMIC_RELAXED);
+		}
+	}
+
+	rec->tclass = tclass;
+	rec->audited = audited;
+	rec->denied = denied;
+	rec->buf[0] = '\0';
+	avc_suppl_audit(a, tclass, rec->buf, AVC_AUDIT_BUFSIZE / 2);
+	off = strlen(rec->buf) + 1;
+	/* the caller holds references on both SIDs */
+	rec->scon = avc_audit_copy(rec->buf, &off, ssid->ctx);
+	rec->tcon = avc_audit_copy(rec->buf, &off, tsid->ctx);
+
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+	sem_post(&avc_audit_ring.ready);
+}
+
+/* Log the next filled slot, if any.  Returns 0 if there was none. */
+static int avc_audit_dequeue(char *msg)
+{
+	struct avc_audit_rec *rec;
+	uint32_t pos = avc_audit_ring.tail, lost;
+
+	lost = __atomic_exchange_n(&avc_audit_ring.lost, 0, __ATOMIC_RELAXED);
+	if (lost) {
+		avc_log(SELINUX_WARNING, "%s:  %u messages suppressed.\n",
+			avc_prefix, lost);
+	}
+
+	rec = &avc_audit_ring.recs[pos & (AVC_AUDIT_RING - 1)];
+	if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return 0;
+
+	snprintf(msg, AVC_AUDIT_BUFSIZE, "%s:  %s ", avc_prefix,
+		 rec->denied ? "denied" : "granted");
+	avc_dump_av(msg, rec->tclass, rec->audited);
+	log_append(msg, " for %s scontext=%s tcontext=%s tclass=%s\n",
+		   rec->buf, rec->buf + rec->scon, rec->buf + rec->tcon,
+		   security_class_to_string(rec->tclass));
+
+	__atomic_store_n(&rec->seq, pos + AVC_AUDIT_RING, __ATOMIC_RELEASE);
+	avc_audit_ring.tail = pos + 1;
+
+	avc_log(SELINUX_AVC, "%s", msg);
+	return 1;
+}
+
+static void avc_audit_loop(void)
+{
+	char msg[AVC_AUDIT_BUFSIZE];
+
+	for (;;) {
+		while (sem_wait(&avc_audit_ring.ready) < 0 && errno == EINTR)
+			;
+		if (__atomic_load_n(&avc_audit_ring.stop, __ATOMIC_ACQUIRE))
+			break;
+		/* a slot claimed earlier may have been filled last */
+		while (avc_audit_dequeue(msg))
+			;
+	}
+	/* drain what is left */
+	while (avc_audit_dequeue(msg))
+		;
+	sem_post(&avc_audit_ring.done);
+}
+
+static void avc_audit_start(void)
+{
+	uint32_t i;
+
+	avc_audit_ring.recs = avc_malloc(AVC_AUDIT_RING *
+					 sizeof(*avc_audit_ring.recs));
+	if (!avc_audit_ring.recs)
+		goto fail;
+	for (i = 0; i < AVC_AUDIT_RING; i++)
+		avc_audit_ring.recs[i].seq = i;
+	avc_audit_ring.head = avc_audit_ring.tail = avc_audit_ring.lost = 0;
+	avc_audit_ring.stop = 0;
+	if (sem_init(&avc_audit_ring.ready, 0, 0) < 0)
+		goto fail_free;
+	if (sem_init(&avc_audit_ring.done, 0, 0) < 0)
+		goto fail_ready;
+	/* like the netlink thread, only with the thread callbacks */
+	avc_audit_ring.thread = avc_create_thread(&avc_audit_loop);
+	if (!avc_audit_ring.thread)
+		goto fail_done;
+	avc_audit_running = 1;
+	return;
+
+      fail_done:
+	sem_destroy(&avc_audit_ring.done);
+      fail_ready:
+	sem_destroy(&avc_audit_ring.ready);
+      fail_free:
+	avc_free(avc_audit_ring.recs);
+	avc_audit_ring.recs = NULL;
+      fail:
+	avc_log(SELINUX_WARNING,
+		"%s:  unable to start audit thread, auditing synchronously\n",
+		avc_prefix);
+}
+
+/* Called once no more avc_audit() calls can be made. */
+static void avc_audit_stop(void)
+{
+	if (!avc_audit_running)
+		return;
+	avc_audit_running = 0;
+	__atomic_store_n(&avc_audit_ring.stop, 1, __ATOMIC_RELEASE);
+	sem_post(&avc_audit_ring.ready);
+	/* let the queue drain before the thread is cancelled */
+	while (sem_wait(&avc_audit_ring.done) < 0 && errno == EINTR)
+		;
+	avc_stop_thread(avc_audit_ring.thread);
+	avc_audit_ring.thread = NULL;
+	sem_destroy(&avc_audit_ring.done);
+	sem_destroy(&avc_audit_ring.ready);
+	avc_free(avc_audit_ring.recs);
+	avc_audit_ring.recs = NULL;
+}
+
 void avc_audit(security_id_t ssid, security_id_t tsid,
 	       security_class_t tclass, access_vector_t requested,
 	       struct av_decision *avd, int result, void *a)
@@ -710,11 +1810,17 @@ void avc_audit(security_id_t ssid, security_id_t tsid,
 	if (!check_avc_ratelimit())
 		return;
 #endif
+	if (avc_audit_running) {
+		avc_audit_enqueue(ssid, tsid, tclass, audited,
+				  denied || !requested, a);
+		return;
+	}
+
 	/* prevent overlapping buffer writes */
 	avc_get_lock(avc_log_lock);
 	snprintf(avc_audit_buf, AVC_AUDIT_BUFSIZE,
 		 "%s:  %s ", avc_prefix, (denied || !requested) ? "denied" : "granted");
-	avc_dump_av(tclass, audited);
+	avc_dump_av(avc_audit_buf, tclass, audited);
 	log_append(avc_audit_buf, " for ");
 
 	/* get any extra information printed by the callback */
@@ -741,22 +1847,28 @@ static void avd_init(struct av_decision *avd)
 	avd->flags = 0;
 }
 
-int avc_has_perm_noaudit(security_id_t ssid,
-			 security_id_t tsid,
-			 security_class_t tclass,
-			 access_vector_t requested,
-			 struct avc_entry_ref *aeref, struct av_decision *avd)
+/* avc_has_perm_noaudit(), telling whether the decision was cached */
+static int avc_decide(security_id_t ssid, security_id_t tsid,
+		      security_class_t tclass, access_vector_t requested,
+		      struct avc_entry_ref *aeref, struct av_decision *avd,
+		      int *miss)
 {
 	struct avc_entry *ae;
 	int rc = 0;
 	struct avc_entry entry;
 	access_vector_t denied;
 	struct avc_entry_ref ref;
+	struct avc_thread_state *t;
+	struct avc_front_entry *fe = NULL;
+	struct av_decision tavd;
+	uint32_t generation = 0;
 
 	if (avd)
 		avd_init(avd);
 
-	if (!avc_using_threads && !avc_app_main_loop) {
+	if (avc_status_page && !avc_app_main_loop) {
+		(void)selinux_status_updated();
+	} else if (!avc_using_threads && !avc_app_main_loop) {
 		(void)avc_netlink_check_nb();
 	}
 
@@ -765,6 +1877,41 @@ int avc_has_perm_noaudit(security_id_t ssid,
 		aeref = &ref;
 	}
 
+	t = avc_get_thread_state();
+	if (t && requested) {
+		fe = avc_front_slot(t, ssid, tsid, tclass);
+		generation = t->generation;
+		if (fe->ssid == ssid && fe->tsid == tsid &&
+		    fe->tclass == tclass &&
+		    (fe->avd.allowed & requested) == requested &&
+		    (fe->avd.decided & requested) == requested) {
+			avc_cache_stats_incr(entry_lookups);
+			avc_cache_stats_incr(entry_hits);
+			SELINUX_PROBE4(avc_hit, ssid->ctx, tsid->ctx, tclass,
+				       requested);
+			if (avd)
+				memcpy(avd, &fe->avd, sizeof(*avd));
+			return 0;
+		}
+	}
+
+	if (!avc_lookup_lockless(ssid, tsid, tclass, requested, aeref,
+				 &tavd)) {
+		/* only cache what was current when the lookup started */
+		if (fe && *(volatile uint32_t *)&avc_cache.generation ==
+		    generation) {
+			fe->ssid = ssid;
+			fe->tsid = tsid;
+			fe->tclass = tclass;
+			memcpy(&fe->avd, &tavd, sizeof(tavd));
+		}
+		SELINUX_PROBE4(avc_hit, ssid->ctx, tsid->ctx, tclass,
+			       requested);
+		if (avd)
+			memcpy(avd, &tavd, sizeof(*avd));
+		return 0;
+	}
+
 	avc_get_lock(avc_lock);
 	avc_cache_stats_incr(entry_lookups);
 	ae = aeref->ae;
@@ -774,6 +1921,8 @@ int avc_has_perm_noaudit(security_id_t ssid,
 		    ae->tclass == tclass &&
 		    ((ae->avd.decided & requested) == requested)) {
 			avc_cache_stats_incr(entry_hits);
+			SELINUX_PROBE4(avc_hit, ssid->ctx, tsid->ctx, tclass,
+				       requested);
 			ae->used = 1;
 		} else {
 			avc_cache_stats_incr(entry_discards);
@@ -783,8 +1932,11 @@ int avc_has_perm_noaudit(security_id_t ssid,
 
 	if (!ae) {
 		avc_cache_stats_incr(entry_misses);
+		*miss = 1;
 		rc = avc_lookup(ssid, tsid, tclass, requested, aeref);
 		if (rc) {
+			SELINUX_PROBE4(avc_miss, ssid->ctx, tsid->ctx, tclass,
+				       requested);
 			rc = security_compute_av_flags_raw(ssid->ctx, tsid->ctx,
 							   tclass, requested,
 							   &entry.avd);
@@ -808,9 +1960,11 @@ int avc_has_perm_noaudit(security_id_t ssid,
 
 	if (!requested || denied) {
 		if (!avc_enforcing ||
-		    (ae->avd.flags & SELINUX_AVD_FLAGS_PERMISSIVE))
+		    (ae->avd.flags & SELINUX_AVD_FLAGS_PERMISSIVE)) {
+			avc_write_begin();
 			ae->avd.allowed |= requested;
-		else {
+			avc_write_end();
+		} else {
 			errno = EACCES;
 			rc = -1;
 		}
@@ -821,6 +1975,25 @@ int avc_has_perm_noaudit(security_id_t ssid,
 	return rc;
 }
 
+int avc_has_perm_noaudit(security_id_t ssid,
+			 security_id_t tsid,
+			 security_class_t tclass,
+			 access_vector_t requested,
+			 struct avc_entry_ref *aeref, struct av_decision *avd)
+{
+	struct timespec start;
+	int rc, miss = 0;
+
+	if (!avc_stats_page)
+		return avc_decide(ssid, tsid, tclass, requested, aeref, avd,
+				  &miss);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rc = avc_decide(ssid, tsid, tclass, requested, aeref, avd, &miss);
+	avc_stats_record(ssid, tclass, miss, &start);
+	return rc;
+}
+
 hidden_def(avc_has_perm_noaudit)
 
 int avc_has_perm(security_id_t ssid, security_id_t tsid,
@@ -837,74 +2010,73 @@ int avc_has_perm(security_id_t ssid, security_id_t tsid,
 	return rc;
 }
 
-int avc_compute_create(security_id_t ssid,  security_id_t tsid,
-		       security_class_t tclass, security_id_t *newsid)
+static int avc_compute_transition(security_id_t ssid, security_id_t tsid,
+				  security_class_t tclass, int kind,
+				  const char *objname, security_id_t *newsid)
 {
-	int rc;
-	struct avc_entry_ref aeref;
-	struct avc_entry entry;
-	char * ctx;
+	int rc = 0;
+	char * ctx = NULL;
 
 	*newsid = NULL;
-	avc_entry_ref_init(&aeref);
+
+	/* pick up a policy reload before trusting the cache */
+	if (avc_status_page && !avc_app_main_loop) {
+		(void)selinux_status_updated();
+	} else if (!avc_using_threads && !avc_app_main_loop) {
+		(void)avc_netlink_check_nb();
+	}
 
 	avc_get_lock(avc_lock);
 
-	/* check for a cached entry */
-	rc = avc_lookup(ssid, tsid, tclass, 0, &aeref);
-	if (rc) {
-		/* need to make a cache entry for this tuple */
-		rc = security_compute_av_flags_raw(ssid->ctx, tsid->ctx,
-						   tclass, 0, &entry.avd);
-		if (rc)
-			goto out;
-		rc = avc_insert(ssid, tsid, tclass, &entry, &aeref);
-		if (rc)
-			goto out;
+	/* check for a saved value */
+	*newsid = avc_xcache_lookup(ssid, tsid, tclass, kind, objname);
+	if (*newsid) {
+		sidtab_sid_get(&avc_sidtab, *newsid);
+		goto out;
 	}
 
-	/* check for a saved compute_create value */
-	if (!aeref.ae->create_sid) {
-		/* need to query the kernel policy */
-		rc = security_compute_create_raw(ssid->ctx, tsid->ctx, tclass,
+	/* need to query the kernel policy */
+	if (kind == AVC_XCACHE_MEMBER)
+		rc = security_compute_member_raw(ssid->ctx, tsid->ctx, tclass,
 						 &ctx);
-		if (rc)
-			goto out;
-		rc = sidtab_context_to_sid(&avc_sidtab, ctx, newsid);
-		freecon(ctx);
-		if (rc)
-			goto out;
-
-		aeref.ae->create_sid = *newsid;
-	} else {
-		/* found saved value */
-		*newsid = aeref.ae->create_sid;
-	}
+	else
+		rc = security_compute_create_name_raw(ssid->ctx, tsid->ctx,
+						      tclass, objname, &ctx);
+	if (rc)
+		goto out;
+	rc = sidtab_context_to_sid(&avc_sidtab, ctx, newsid);
+	freecon(ctx);
+	if (rc)
+		goto out;
 
-	rc = 0;
+	avc_xcache_insert(ssid, tsid, tclass, kind, objname, *newsid);
 out:
 	avc_release_lock(avc_lock);
 	return rc;
 }
 
+int avc_compute_create(security_id_t ssid,  security_id_t tsid,
+		       security_class_t tclass, security_id_t *newsid)
+{
+	return avc_compute_transition(ssid, tsid, tclass, AVC_XCACHE_CREATE,
+				      NULL, newsid);
+}
+
+int avc_compute_create_name(security_id_t ssid,  security_id_t tsid,
+			    security_class_t tclass, const char *objname,
+			    security_id_t *newsid)
+{
+	return avc_compute_transition(ssid, tsid, tclass, AVC_XCACHE_CREATE,
+				      objname, newsid);
+}
+
 int avc_compute_member(security_id_t ssid,  security_id_t tsid,
 		       security_class_t tclass, security_id_t *newsid)
 {
-	int rc;
-	char * ctx = NULL;
-	*newsid = NULL;
 	/* avc_init needs to be called before this function */
 	assert(avc_running);
-	avc_get_lock(avc_lock);
-
-	rc = security_compute_member_raw(ssid->ctx, tsid->ctx, tclass, &ctx);
-	if (rc)
-		goto out;
-	rc = sidtab_context_to_sid(&avc_sidtab, ctx, newsid);
-	freecon(ctx);
-out:
-	avc_release_lock(avc_lock);
-	return rc;
+	return avc_compute_transition(ssid, tsid, tclass, AVC_XCACHE_MEMBER,
+				      NULL, newsid);
 }
 
 int avc_add_callback(int (*callback) (uint32_t event, security_id_t ssid,
@@ -973,14 +2145,16 @@ static int avc_update_cache(uint32_t event, security_id_t ssid,
 			    access_vector_t perms)
 {
 	struct avc_node *node;
-	int i;
+	uint32_t i;
 
 	avc_get_lock(avc_lock);
+	avc_write_begin();
 
 	if (ssid == SECSID_WILD || tsid == SECSID_WILD) {
 		/* apply to all matching nodes */
-		for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-			for (node = avc_cache.slots[i]; node; node = node->next) {
+		for (i = 0; i < avc_cache.table->nslots; i++) {
+			for (node = avc_cache.table->slots[i]; node;
+			     node = node->next) {
 				if (avc_sidcmp(ssid, node->ae.ssid) &&
 				    avc_sidcmp(tsid, node->ae.tsid) &&
 				    tclass == node->ae.tclass) {
@@ -996,6 +2170,8 @@ static int avc_update_cache(uint32_t event, security_id_t ssid,
 		}
 	}
 
+	avc_write_end();
+	avc_bump_generation();
 	avc_release_lock(avc_lock);
 
 	return 0;
@@ -1121,8 +2297,13 @@ int avc_ss_revoke(security_id_t ssid, security_id_t tsid,
  */
 int avc_ss_reset(uint32_t seqno)
 {
+	struct avc_prefetch_req *reqs = NULL;
+	unsigned i, nreqs = 0;
 	int rc;
 
+	if (avc_prefetch_on_reset)
+		reqs = avc_snapshot(&nreqs);
+
 	rc = avc_reset();
 
 	avc_get_lock(avc_lock);
@@ -1130,6 +2311,17 @@ int avc_ss_reset(uint32_t seqno)
 		avc_cache.latest_notif = seqno;
 	avc_release_lock(avc_lock);
 
+	if (reqs) {
+		avc_prefetch(reqs, nreqs);
+		avc_get_lock(avc_lock);
+		for (i = 0; i < nreqs; i++) {
+			sidtab_sid_put(&avc_sidtab, reqs[i].ssid);
+			sidtab_sid_put(&avc_sidtab, reqs[i].tsid);
+		}
+		avc_release_lock(avc_lock);
+		avc_free(reqs);
+	}
+
 	return rc;
 }
 
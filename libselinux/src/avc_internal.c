@@ -96,178 +96,236 @@ void avc_netlink_close(void)
 	fd = -1;
 }
 
-static int avc_netlink_receive(char *buf, unsigned buflen, int blocking)
+/*
+ * Messages are read in batches with recvmmsg(), and all that are pending
+ * are read before any is acted on, so that a burst of notices (a boolean
+ * commit sends one policyload per boolean) costs a single cache reset.
+ */
+#define AVC_NETLINK_BATCH	8
+#define AVC_NETLINK_BUFSIZE	1024
+
+struct avc_netlink_batch {
+	struct mmsghdr msgs[AVC_NETLINK_BATCH];
+	struct iovec iov[AVC_NETLINK_BATCH];
+	struct sockaddr_nl addr[AVC_NETLINK_BATCH];
+	char buf[AVC_NETLINK_BATCH][AVC_NETLINK_BUFSIZE]
+	    __attribute__ ((aligned));
+};
+
+/*
+ * Receive up to AVC_NETLINK_BATCH messages, waiting for the first one
+ * if 'blocking'.  Returns the number received, or -1 with errno set to
+ * EWOULDBLOCK if none is pending.
+ */
+static int avc_netlink_receive(struct avc_netlink_batch *b, int blocking)
 {
-	int rc;
+	int i, rc;
 	struct pollfd pfd = { fd, POLLIN | POLLPRI, 0 };
-	struct sockaddr_nl nladdr;
-	socklen_t nladdrlen = sizeof nladdr;
-	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
 
-	do {
-		rc = poll(&pfd, 1, (blocking ? -1 : 0));
-	} while (rc < 0 && errno == EINTR);
+	if (blocking) {
+		do {
+			rc = poll(&pfd, 1, -1);
+		} while (rc < 0 && errno == EINTR);
 
-	if (rc == 0 && !blocking) {
-		errno = EWOULDBLOCK;
-		return -1;
+		if (rc < 1) {
+			avc_log(SELINUX_ERROR, "%s:  netlink poll: error %d\n",
+				avc_prefix, errno);
+			return -1;
+		}
 	}
-	else if (rc < 1) {
-		avc_log(SELINUX_ERROR, "%s:  netlink poll: error %d\n",
-			avc_prefix, errno);
-		return rc;
+
+	memset(b->msgs, 0, sizeof(b->msgs));
+	for (i = 0; i < AVC_NETLINK_BATCH; i++) {
+		b->iov[i].iov_base = b->buf[i];
+		b->iov[i].iov_len = AVC_NETLINK_BUFSIZE;
+		b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+		b->msgs[i].msg_hdr.msg_name = &b->addr[i];
+		b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addr[i]);
 	}
 
-	rc = recvfrom(fd, buf, buflen, 0, (struct sockaddr *)&nladdr,
-		      &nladdrlen);
-	if (rc < 0)
-		return rc;
+	do {
+		rc = recvmmsg(fd, b->msgs, AVC_NETLINK_BATCH, MSG_DONTWAIT,
+			      NULL);
+	} while (rc < 0 && errno == EINTR);
+	if (rc < 0 && errno == EAGAIN)
+		errno = EWOULDBLOCK;
+	return rc;
+}
 
-	if (nladdrlen != sizeof nladdr) {
-		avc_log(SELINUX_WARNING,
-			"%s:  warning: netlink address truncated, len %d?\n",
-			avc_prefix, nladdrlen);
-		return -1;
-	}
+/*
+ * Fold the messages of a batch into 'n'.  Messages that fail the
+ * sanity checks are skipped.  Returns -1 on end of file, 1 if the
+ * kernel reported an error.
+ */
+static int avc_netlink_parse(struct avc_netlink_batch *b, int count,
+			     struct avc_notices *n)
+{
+	int i, rc = 0;
+
+	for (i = 0; i < count; i++) {
+		struct msghdr *hdr = &b->msgs[i].msg_hdr;
+		struct nlmsghdr *nlh = (struct nlmsghdr *)b->buf[i];
+		unsigned len = b->msgs[i].msg_len;
+
+		if (hdr->msg_namelen != sizeof(b->addr[i])) {
+			avc_log(SELINUX_WARNING,
+				"%s:  warning: netlink address truncated, len %d?\n",
+				avc_prefix, hdr->msg_namelen);
+			continue;
+		}
 
-	if (nladdr.nl_pid) {
-		avc_log(SELINUX_WARNING,
-			"%s:  warning: received spoofed netlink packet from: %d\n",
-			avc_prefix, nladdr.nl_pid);
-		return -1;
-	}
+		if (b->addr[i].nl_pid) {
+			avc_log(SELINUX_WARNING,
+				"%s:  warning: received spoofed netlink packet from: %d\n",
+				avc_prefix, b->addr[i].nl_pid);
+			continue;
+		}
 
-	if (rc == 0) {
-		avc_log(SELINUX_WARNING,
-			"%s:  warning: received EOF on netlink socket\n",
-			avc_prefix);
-		errno = EBADFD;
-		return -1;
-	}
+		if (len == 0) {
+			avc_log(SELINUX_WARNING,
+				"%s:  warning: received EOF on netlink socket\n",
+				avc_prefix);
+			errno = EBADFD;
+			return -1;
+		}
 
-	if (nlh->nlmsg_flags & MSG_TRUNC || nlh->nlmsg_len > (unsigned)rc) {
-		avc_log(SELINUX_WARNING,
-			"%s:  warning: incomplete netlink message\n",
-			avc_prefix);
-		return -1;
-	}
+		if (hdr->msg_flags & MSG_TRUNC || len < sizeof(*nlh) ||
+		    nlh->nlmsg_len > len) {
+			avc_log(SELINUX_WARNING,
+				"%s:  warning: incomplete netlink message\n",
+				avc_prefix);
+			continue;
+		}
 
-	return 0;
-}
+		switch (nlh->nlmsg_type) {
+		case NLMSG_ERROR:{
+			struct nlmsgerr *err = NLMSG_DATA(nlh);
 
-static int avc_netlink_process(char *buf)
-{
-	int rc;
-	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+			/* Netlink ack */
+			if (err->error == 0)
+				break;
+
+			errno = -err->error;
+			avc_log(SELINUX_ERROR,
+				"%s:  netlink error: %d\n", avc_prefix, errno);
+			rc = 1;
+			break;
+		}
 
-	switch (nlh->nlmsg_type) {
-	case NLMSG_ERROR:{
-		struct nlmsgerr *err = NLMSG_DATA(nlh);
+		case SELNL_MSG_SETENFORCE:{
+			struct selnl_msg_setenforce *msg = NLMSG_DATA(nlh);
+			n->setenforce = msg->val ? 1 : 0;
+			break;
+		}
 
-		/* Netlink ack */
-		if (err->error == 0)
+		case SELNL_MSG_POLICYLOAD:{
+			struct selnl_msg_policyload *msg = NLMSG_DATA(nlh);
+			n->policyload++;
+			n->seqno = msg->seqno;
 			break;
+		}
 
-		errno = -err->error;
-		avc_log(SELINUX_ERROR,
-			"%s:  netlink error: %d\n", avc_prefix, errno);
-		return -1;
+		default:
+			avc_log(SELINUX_WARNING,
+				"%s:  warning: unknown netlink message %d\n",
+				avc_prefix, nlh->nlmsg_type);
+		}
 	}
+	return rc;
+}
 
-	case SELNL_MSG_SETENFORCE:{
-		struct selnl_msg_setenforce *msg = NLMSG_DATA(nlh);
-		avc_log(SELINUX_INFO,
-			"%s:  received setenforce notice (enforcing=%d)\n",
-			avc_prefix, msg->val);
-		if (avc_setenforce)
-			break;
-		avc_enforcing = msg->val;
-		if (avc_enforcing && (rc = avc_ss_reset(0)) < 0) {
+/*
+ * Read every pending message into 'n', waiting for the first one if
+ * 'blocking'.  Returns 0 when the socket is drained, 1 if the kernel
+ * reported an error and -1 if the socket failed.
+ */
+static int avc_netlink_drain(int blocking, struct avc_notices *n)
+{
+	struct avc_netlink_batch batch;
+	int count, rc = 0;
+
+	while (1) {
+		count = avc_netlink_receive(&batch, blocking);
+		if (count < 0) {
+			if (errno == EWOULDBLOCK && !blocking)
+				return rc;
+			if (errno == EWOULDBLOCK)
+				continue;
 			avc_log(SELINUX_ERROR,
-				"%s:  cache reset returned %d (errno %d)\n",
-				avc_prefix, rc, errno);
-			return rc;
+				"%s:  netlink recvfrom: error %d\n",
+				avc_prefix, errno);
+			return -1;
 		}
-		rc = selinux_netlink_setenforce(msg->val);
-		if (rc < 0)
+		rc = avc_netlink_parse(&batch, count, n);
+		if (rc || count < AVC_NETLINK_BATCH)
 			return rc;
-		break;
+		blocking = 0;
 	}
+}
+
+int avc_process_notices(const struct avc_notices *n)
+{
+	int rc, reset = 0;
 
-	case SELNL_MSG_POLICYLOAD:{
-		struct selnl_msg_policyload *msg = NLMSG_DATA(nlh);
+	if (n->setenforce >= 0) {
+		avc_log(SELINUX_INFO,
+			"%s:  received setenforce notice (enforcing=%d)\n",
+			avc_prefix, n->setenforce);
+		if (!avc_setenforce && avc_running) {
+			avc_enforcing = n->setenforce;
+			reset = avc_enforcing;
+		}
+	}
+	if (n->policyload) {
 		avc_log(SELINUX_INFO,
 			"%s:  received policyload notice (seqno=%d)\n",
-			avc_prefix, msg->seqno);
-		rc = avc_ss_reset(msg->seqno);
+			avc_prefix, n->seqno);
+		reset = avc_running;
+	}
+
+	if (reset) {
+		rc = avc_ss_reset(n->policyload ? n->seqno : 0);
 		if (rc < 0) {
 			avc_log(SELINUX_ERROR,
 				"%s:  cache reset returned %d (errno %d)\n",
 				avc_prefix, rc, errno);
 			return rc;
 		}
-		rc = selinux_netlink_policyload(msg->seqno);
-		if (rc < 0)
-			return rc;
-		break;
 	}
 
-	default:
-		avc_log(SELINUX_WARNING,
-			"%s:  warning: unknown netlink message %d\n",
-			avc_prefix, nlh->nlmsg_type);
-	}
-	return 0;
+	rc = 0;
+	if (n->setenforce >= 0)
+		rc = selinux_netlink_setenforce(n->setenforce);
+	if (rc >= 0 && n->policyload)
+		rc = selinux_netlink_policyload(n->seqno);
+	return rc;
 }
 
 int avc_netlink_check_nb(void)
 {
+	struct avc_notices notices = AVC_NOTICES_INIT;
 	int rc;
-	char buf[1024] __attribute__ ((aligned));
-
-	while (1) {
-		errno = 0;
-		rc = avc_netlink_receive(buf, sizeof(buf), 0);
-		if (rc < 0) {
-			if (errno == EWOULDBLOCK)
-				return 0;
-			if (errno == 0 || errno == EINTR)
-				continue;
-			else {
-				avc_log(SELINUX_ERROR,
-					"%s:  netlink recvfrom: error %d\n",
-					avc_prefix, errno);
-				return rc;
-			}
-		}
 
-		(void)avc_netlink_process(buf);
-	}
-	return 0;
+	rc = avc_netlink_drain(0, &notices);
+	if (notices.setenforce >= 0 || notices.policyload)
+		(void)avc_process_notices(&notices);
+	return rc < 0 ? rc : 0;
 }
 
 /* run routine for the netlink listening thread */
 void avc_netlink_loop(void)
 {
 	int rc;
-	char buf[1024] __attribute__ ((aligned));
 
 	while (1) {
-		errno = 0;
-		rc = avc_netlink_receive(buf, sizeof(buf), 1);
-		if (rc < 0) {
-			if (errno == 0 || errno == EINTR)
-				continue;
-			else {
-				avc_log(SELINUX_ERROR,
-					"%s:  netlink recvfrom: error %d\n",
-					avc_prefix, errno);
-				break;
-			}
-		}
+		struct avc_notices notices = AVC_NOTICES_INIT;
 
-		rc = avc_netlink_process(buf);
-		if (rc < 0)
+		rc = avc_netlink_drain(1, &notices);
+		if ((notices.setenforce >= 0 || notices.policyload) &&
+		    avc_process_notices(&notices) < 0)
+			rc = -1;
+		if (rc)
 			break;
 	}
 
@@ -281,6 +339,10 @@ void avc_netlink_loop(void)
 
 int avc_netlink_acquire_fd(void)
 {
+    /* the AVC may be running off the status page without a socket */
+    if (fd < 0 && avc_netlink_open(0) < 0)
+	return -1;
+
     avc_app_main_loop = 1;
 
     return fd;
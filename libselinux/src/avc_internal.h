@@ -134,9 +134,9 @@ static inline void avc_free_lock(void *lock)
 #ifdef AVC_CACHE_STATS
 
 #define avc_cache_stats_incr(field) \
-  cache_stats.field ++;
+  avc_stats()->field ++;
 #define avc_cache_stats_add(field, num) \
-  cache_stats.field += num;
+  avc_stats()->field += num;
 
 #else
 
@@ -174,6 +174,21 @@ int avc_ss_set_auditdeny(security_id_t ssid, security_id_t tsid,
 /* netlink kernel message code */
 extern int avc_netlink_trouble hidden;
 
+/*
+ * Notices received together, folded so that the cache is reset once
+ * however many setenforce and policyload messages arrived.
+ */
+struct avc_notices {
+	int setenforce;		/* last enforcing value, -1 if none */
+	int policyload;		/* number of policyload notices */
+	uint32_t seqno;		/* seqno of the last of them */
+};
+
+#define AVC_NOTICES_INIT { -1, 0, 0 }
+
+/* handler shared by the netlink socket and the status page */
+int avc_process_notices(const struct avc_notices *n) hidden;
+
 hidden_proto(avc_av_stats)
     hidden_proto(avc_cleanup)
     hidden_proto(avc_reset)
@@ -0,0 +1,347 @@
+/*
+ * Access decisions shared between processes.
+ *
+ * The cache is a file mapped by every process that opened the AVC with
+ * AVC_OPT_SHARED_CACHE.  It holds kernel decisions keyed by the raw
+ * source and target contexts and the kernel class, each tagged with
+ * the policy sequence number the kernel returned with it.  An entry is
+ * used only while that number is still the one in the kernel status
+ * page, so a policy load or boolean change retires the whole cache
+ * without anyone having to clear it.
+ *
+ * Slots are guarded by sequence counters: a writer makes the counter
+ * odd with a compare-and-swap, fills the slot and makes it even again,
+ * and a reader retries nothing, treating a slot that changed under it
+ * as a miss.  Neither side takes a lock, so any number of processes
+ * may read while the broker fills the file.
+ *
+ * The decisions are only as good as the file, so it must belong to
+ * root and be writable by nobody else, and only one privileged process,
+ * the broker, writes it: the first root process to open it takes an
+ * exclusive lock on it and holds it as long as it has the file mapped.
+ * Every other process maps the file read-only.  The policy is expected
+ * to let only the broker's domain open the file for writing, which
+ * keeps out root processes in other domains.  Since a mapping of a file
+ * cut short faults on access, the size of the file is checked before
+ * each use of the mapping.
+ *
+ * The file may outlive a reboot, after which the policy sequence numbers
+ * start over and the old decisions would pass for current ones.  The
+ * header therefore records the boot it was laid out in, and a file from
+ * another boot is refused.  The broker lays the file out afresh whenever
+ * it takes it over, emptying every slot and bumping the generation.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <selinux/avc.h>
+#include "selinux_internal.h"
+#include "avc_shared.h"
+
+#define AVC_SHARED_MAGIC	0x53415643	/* "SAVC" */
+#define AVC_SHARED_VERSION	2
+#define AVC_SHARED_SLOTS	4096	/* power of two */
+#define AVC_SHARED_PROBE	4
+/* both contexts and their terminating NULs; longer pairs are not cached */
+#define AVC_SHARED_CTXLEN	472
+#define AVC_SHARED_BOOT_ID	"/proc/sys/kernel/random/boot_id"
+#define AVC_SHARED_BOOTLEN	40	/* a UUID and its NUL, padded */
+
+struct avc_shared_slot {
+	uint32_t seq;		/* odd while being written */
+	uint32_t hash;
+	uint32_t kclass;
+	uint32_t seqno;		/* policy the decision was computed for */
+	uint32_t allowed;
+	uint32_t decided;
+	uint32_t auditallow;
+	uint32_t auditdeny;
+	uint32_t flags;
+	uint16_t slen;		/* scontext length, including the NUL */
+	uint16_t len;		/* bytes used in ctx */
+	char ctx[AVC_SHARED_CTXLEN];
+};
+
+struct avc_shared_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t slotsize;
+	uint32_t generation;	/* bumped by each broker taking over */
+	char boot_id[AVC_SHARED_BOOTLEN];
+	struct avc_shared_slot slots[AVC_SHARED_SLOTS];
+};
+
+static struct avc_shared_hdr *avc_shared = NULL;
+static int avc_shared_fd = -1;
+static int avc_shared_writable = 0;
+
+static uint32_t avc_shared_hash(const char *scon, const char *tcon,
+				security_class_t kclass)
+{
+	uint32_t val = 2166136261U ^ kclass;
+
+	while (*scon) {
+		val ^= (unsigned char)*scon++;
+		val *= 16777619U;
+	}
+	val *= 16777619U;	/* separator */
+	while (*tcon) {
+		val ^= (unsigned char)*tcon++;
+		val *= 16777619U;
+	}
+	return val;
+}
+
+/* Only a file that nobody but root can change is trusted. */
+static int avc_shared_trusted(const struct stat *sb)
+{
+	if (!S_ISREG(sb->st_mode) || sb->st_uid != 0)
+		return 0;
+	return !(sb->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+/* Whether the file still covers the whole mapping. */
+static int avc_shared_mapped(void)
+{
+	struct stat sb;
+
+	if (fstat(avc_shared_fd, &sb) < 0)
+		return 0;
+	return sb.st_size >= (off_t) sizeof(struct avc_shared_hdr);
+}
+
+/* The identity of the running boot, as a NUL-terminated string. */
+static int avc_shared_boot(char *buf)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(AVC_SHARED_BOOT_ID, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	memset(buf, 0, AVC_SHARED_BOOTLEN);
+	n = read(fd, buf, AVC_SHARED_BOOTLEN - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+/*
+ * Lay the file out for this boot, with every slot empty.  Readers that
+ * already map it see the slots change under them and take them as
+ * misses; those opening it meanwhile see no magic and give up.
+ */
+static void avc_shared_layout(struct avc_shared_hdr *hdr, const char *boot)
+{
+	struct avc_shared_slot *slot;
+	uint32_t seq;
+	int i;
+
+	__atomic_store_n(&hdr->magic, 0, __ATOMIC_RELEASE);
+	for (i = 0; i < AVC_SHARED_SLOTS; i++) {
+		slot = &hdr->slots[i];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) | 1;
+		__atomic_store_n(&slot->seq, seq, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memset((char *)slot + sizeof(slot->seq), 0,
+		       sizeof(*slot) - sizeof(slot->seq));
+		__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+	}
+	hdr->version = AVC_SHARED_VERSION;
+	hdr->nslots = AVC_SHARED_SLOTS;
+	hdr->slotsize = sizeof(struct avc_shared_slot);
+	hdr->generation++;
+	memcpy(hdr->boot_id, boot, AVC_SHARED_BOOTLEN);
+	__atomic_store_n(&hdr->magic, AVC_SHARED_MAGIC, __ATOMIC_RELEASE);
+}
+
+int avc_shared_open(const char *path)
+{
+	char boot[AVC_SHARED_BOOTLEN];
+	struct avc_shared_hdr *hdr;
+	struct stat sb;
+	int fd = -1, prot = PROT_READ;
+
+	/* the broker keeps the lock until it closes the file */
+	avc_shared_writable = 0;
+	if (geteuid() == 0) {
+		fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0)
+			avc_shared_writable = 1;
+	}
+	if (!avc_shared_writable) {
+		if (fd >= 0)
+			close(fd);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+	}
+	if (fd < 0)
+		return -1;
+
+	if (avc_shared_boot(boot) < 0)
+		goto err;
+	if (fstat(fd, &sb) < 0)
+		goto err;
+	if (!avc_shared_trusted(&sb)) {
+		errno = EINVAL;
+		goto err;
+	}
+	if (avc_shared_writable) {
+		/* the broker sizes the file for the layout it writes */
+		if (sb.st_size != sizeof(struct avc_shared_hdr)) {
+			if (ftruncate(fd, sizeof(struct avc_shared_hdr)) < 0)
+				goto err;
+			sb.st_size = sizeof(struct avc_shared_hdr);
+		}
+		prot |= PROT_WRITE;
+	}
+	if (sb.st_size != sizeof(struct avc_shared_hdr)) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	hdr = mmap(NULL, sizeof(*hdr), prot, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		goto err;
+
+	if (avc_shared_writable)
+		avc_shared_layout(hdr, boot);
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != AVC_SHARED_MAGIC ||
+	    hdr->version != AVC_SHARED_VERSION ||
+	    hdr->nslots != AVC_SHARED_SLOTS ||
+	    hdr->slotsize != sizeof(struct avc_shared_slot) ||
+	    memcmp(hdr->boot_id, boot, AVC_SHARED_BOOTLEN)) {
+		munmap(hdr, sizeof(*hdr));
+		errno = EINVAL;
+		goto err;
+	}
+
+	avc_shared = hdr;
+	avc_shared_fd = fd;
+	return 0;
+
+      err:
+	close(fd);
+	avc_shared_writable = 0;
+	return -1;
+}
+
+void avc_shared_close(void)
+{
+	if (!avc_shared)
+		return;
+	munmap(avc_shared, sizeof(*avc_shared));
+	close(avc_shared_fd);
+	avc_shared = NULL;
+	avc_shared_fd = -1;
+	avc_shared_writable = 0;
+}
+
+int avc_shared_lookup(const char *scon, const char *tcon,
+		      security_class_t kclass, struct av_decision *avd)
+{
+	struct avc_shared_slot *slot;
+	size_t slen, tlen;
+	uint32_t hash, seq, seqno;
+	int policyload, i;
+
+	if (!avc_shared || !kclass)
+		return -1;
+	policyload = selinux_status_policyload();
+	if (policyload < 0)
+		return -1;
+
+	slen = strlen(scon) + 1;
+	tlen = strlen(tcon) + 1;
+	if (slen + tlen > AVC_SHARED_CTXLEN || !avc_shared_mapped())
+		return -1;
+	hash = avc_shared_hash(scon, tcon, kclass);
+
+	for (i = 0; i < AVC_SHARED_PROBE; i++) {
+		slot = &avc_shared->slots[(hash + i) & (AVC_SHARED_SLOTS - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		seqno = slot->seqno;
+		if (slot->hash != hash || slot->kclass != kclass ||
+		    seqno != (uint32_t)policyload ||
+		    slot->slen != slen || slot->len != slen + tlen ||
+		    memcmp(slot->ctx, scon, slen) ||
+		    memcmp(slot->ctx + slen, tcon, tlen))
+			continue;
+		avd->allowed = slot->allowed;
+		avd->decided = slot->decided;
+		avd->auditallow = slot->auditallow;
+		avd->auditdeny = slot->auditdeny;
+		avd->flags = slot->flags;
+		avd->seqno = seqno;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		return 0;
+	}
+	return -1;
+}
+
+void avc_shared_insert(const char *scon, const char *tcon,
+		       security_class_t kclass, const struct av_decision *avd)
+{
+	struct avc_shared_slot *slot, *victim = NULL;
+	size_t slen, tlen;
+	uint32_t hash, seq;
+	int policyload, i;
+
+	if (!avc_shared || !avc_shared_writable || !kclass)
+		return;
+	policyload = selinux_status_policyload();
+	if (policyload < 0 || avd->seqno != (uint32_t)policyload)
+		return;
+
+	slen = strlen(scon) + 1;
+	tlen = strlen(tcon) + 1;
+	if (slen + tlen > AVC_SHARED_CTXLEN || !avc_shared_mapped())
+		return;
+	hash = avc_shared_hash(scon, tcon, kclass);
+
+	/* prefer a slot left by an older policy */
+	for (i = 0; i < AVC_SHARED_PROBE; i++) {
+		slot = &avc_shared->slots[(hash + i) & (AVC_SHARED_SLOTS - 1)];
+		if (slot->seqno != (uint32_t)policyload) {
+			victim = slot;
+			break;
+		}
+	}
+	if (!victim)
+		victim = &avc_shared->slots[(hash + (hash >> 16) %
+					     AVC_SHARED_PROBE) &
+					    (AVC_SHARED_SLOTS - 1)];
+
+	seq = __atomic_load_n(&victim->seq, __ATOMIC_RELAXED);
+	if (seq & 1 ||
+	    !__atomic_compare_exchange_n(&victim->seq, &seq, seq + 1, 0,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;		/* another writer has it */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	victim->hash = hash;
+	victim->kclass = kclass;
+	victim->seqno = avd->seqno;
+	victim->allowed = avd->allowed;
+	victim->decided = avd->decided;
+	victim->auditallow = avd->auditallow;
+	victim->auditdeny = avd->auditdeny;
+	victim->flags = avd->flags;
+	victim->slen = slen;
+	victim->len = slen + tlen;
+	memcpy(victim->ctx, scon, slen);
+	memcpy(victim->ctx + slen, tcon, tlen);
+
+	__atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+}
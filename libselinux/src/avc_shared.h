@@ -0,0 +1,32 @@
+/*
+ * A decision cache shared between processes through a mapped file,
+ * selected with AVC_OPT_SHARED_CACHE.
+ */
+#ifndef _SELINUX_AVC_SHARED_H_
+#define _SELINUX_AVC_SHARED_H_
+
+#include <selinux/selinux.h>
+#include "dso.h"
+
+/*
+ * Map the cache file at 'path', which must belong to root and be
+ * writable by nobody else.  The first root process that opens it for
+ * writing becomes its only writer and lays it out if it is empty; all
+ * others map it read-only and only look decisions up.  Returns -1 if
+ * the file can not be used.
+ */
+int avc_shared_open(const char *path) hidden;
+void avc_shared_close(void) hidden;
+
+/*
+ * Kernel decisions, before any class mapping, keyed by raw contexts
+ * and kernel class.  An entry is only returned while the policy it was
+ * computed for is loaded.
+ */
+int avc_shared_lookup(const char *scon, const char *tcon,
+		      security_class_t kclass, struct av_decision *avd) hidden;
+void avc_shared_insert(const char *scon, const char *tcon,
+		       security_class_t kclass,
+		       const struct av_decision *avd) hidden;
+
+#endif				/* _SELINUX_AVC_SHARED_H_ */
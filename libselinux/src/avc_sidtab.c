@@ -13,102 +13,193 @@
 #include "avc_sidtab.h"
 #include "avc_internal.h"
 
-static inline unsigned sidtab_hash(const char * key)
+/*
+ * 32-bit FNV-1a.  The full value is kept in each node so that chain
+ * walks and rehashing do not need to look at the context strings.
+ */
+static inline uint32_t sidtab_hash(const char * key, size_t len)
 {
-	char *p, *keyp;
-	unsigned int size;
-	unsigned int val;
-
-	val = 0;
-	keyp = (char *)key;
-	size = strlen(keyp);
-	for (p = keyp; (unsigned int)(p - keyp) < size; p++)
-		val =
-		    (val << 4 | (val >> (8 * sizeof(unsigned int) - 4))) ^ (*p);
-	return val & (SIDTAB_SIZE - 1);
+	uint32_t val = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		val ^= (unsigned char)key[i];
+		val *= 16777619U;
+	}
+	return val;
 }
 
 int sidtab_init(struct sidtab *s)
 {
-	int i, rc = 0;
+	unsigned i;
+	int rc = 0;
 
 	s->htable = (struct sidtab_node **)avc_malloc
-	    (sizeof(struct sidtab_node *) * SIDTAB_SIZE);
+	    (sizeof(struct sidtab_node *) * SIDTAB_HASH_BUCKETS);
 
 	if (!s->htable) {
 		rc = -1;
 		goto out;
 	}
-	for (i = 0; i < SIDTAB_SIZE; i++)
+	for (i = 0; i < SIDTAB_HASH_BUCKETS; i++)
 		s->htable[i] = NULL;
 	s->nel = 0;
+	s->nbuckets = SIDTAB_HASH_BUCKETS;
+	s->nunref = 0;
+	s->ctx_bytes = 0;
       out:
 	return rc;
 }
 
-int sidtab_insert(struct sidtab *s, const char * ctx)
+/*
+ * Double the number of buckets.  Failure to allocate the new table
+ * is not an error; lookups just keep using longer chains.
+ */
+static void sidtab_grow(struct sidtab *s)
+{
+	struct sidtab_node **htable, *cur, *next;
+	unsigned i, nbuckets = s->nbuckets << 1;
+
+	htable = (struct sidtab_node **)avc_malloc
+	    (sizeof(struct sidtab_node *) * nbuckets);
+	if (!htable)
+		return;
+	for (i = 0; i < nbuckets; i++)
+		htable[i] = NULL;
+
+	for (i = 0; i < s->nbuckets; i++) {
+		for (cur = s->htable[i]; cur; cur = next) {
+			next = cur->next;
+			cur->next = htable[cur->hash & (nbuckets - 1)];
+			htable[cur->hash & (nbuckets - 1)] = cur;
+		}
+	}
+	avc_free(s->htable);
+	s->htable = htable;
+	s->nbuckets = nbuckets;
+}
+
+static struct sidtab_node *sidtab_insert(struct sidtab *s, const char * ctx,
+					 size_t len, uint32_t hash)
 {
-	int hvalue, rc = 0;
 	struct sidtab_node *newnode;
 	char * newctx;
 
 	newnode = (struct sidtab_node *)avc_malloc(sizeof(*newnode));
-	if (!newnode) {
-		rc = -1;
-		goto out;
-	}
-	newctx = (char *) strdup(ctx);
+	if (!newnode)
+		return NULL;
+	newctx = (char *) strndup(ctx, len);
 	if (!newctx) {
-		rc = -1;
 		avc_free(newnode);
-		goto out;
+		return NULL;
 	}
 
-	hvalue = sidtab_hash(newctx);
-	newnode->next = s->htable[hvalue];
+	if (s->nel >= s->nbuckets * SIDTAB_MAX_LOAD)
+		sidtab_grow(s);
+
+	newnode->hash = hash;
+	newnode->len = len;
+	newnode->stats_type = 0;
+	newnode->next = s->htable[hash & (s->nbuckets - 1)];
 	newnode->sid_s.ctx = newctx;
-	newnode->sid_s.refcnt = 1;	/* unused */
-	s->htable[hvalue] = newnode;
+	newnode->sid_s.refcnt = 1;
+	s->htable[hash & (s->nbuckets - 1)] = newnode;
 	s->nel++;
-      out:
-	return rc;
+	s->ctx_bytes += len + 1;
+	return newnode;
 }
 
 int
-sidtab_context_to_sid(struct sidtab *s,
-		      const char * ctx, security_id_t * sid)
+sidtab_context_len_to_sid(struct sidtab *s, const char * ctx, size_t len,
+			  security_id_t * sid)
 {
-	int hvalue, rc = 0;
 	struct sidtab_node *cur;
+	uint32_t hash;
 
 	*sid = NULL;
-	hvalue = sidtab_hash(ctx);
-
-      loop:
-	cur = s->htable[hvalue];
-	while (cur != NULL && strcmp(cur->sid_s.ctx, ctx))
+	/* the stored copy ends at the first NUL, as does a trailing one
+	   counted in len (SO_PEERSEC includes it) */
+	len = strnlen(ctx, len);
+	hash = sidtab_hash(ctx, len);
+
+	cur = s->htable[hash & (s->nbuckets - 1)];
+	while (cur != NULL &&
+	       (cur->hash != hash || cur->len != len ||
+		memcmp(cur->sid_s.ctx, ctx, len)))
 		cur = cur->next;
 
 	if (cur == NULL) {	/* need to make a new entry */
-		rc = sidtab_insert(s, ctx);
-		if (rc)
-			goto out;
-		goto loop;	/* find the newly inserted node */
-	}
+		cur = sidtab_insert(s, ctx, len, hash);
+		if (!cur)
+			return -1;
+	} else
+		sidtab_sid_get(s, &cur->sid_s);
 
 	*sid = &cur->sid_s;
-      out:
-	return rc;
+	return 0;
+}
+
+int
+sidtab_context_to_sid(struct sidtab *s,
+		      const char * ctx, security_id_t * sid)
+{
+	return sidtab_context_len_to_sid(s, ctx, strlen(ctx), sid);
+}
+
+int sidtab_sid_get(struct sidtab *s, security_id_t sid)
+{
+	if (sid->refcnt == SIDTAB_REFCNT_MAX)
+		return sid->refcnt;
+	if (sid->refcnt == 0)
+		s->nunref--;
+	return ++sid->refcnt;
+}
+
+int sidtab_sid_put(struct sidtab *s, security_id_t sid)
+{
+	if (sid->refcnt == 0 || sid->refcnt == SIDTAB_REFCNT_MAX)
+		return sid->refcnt;
+	if (--sid->refcnt == 0)
+		s->nunref++;
+	return sid->refcnt;
+}
+
+/*
+ * Free all entries whose reference count dropped to zero.  The caller
+ * must already have removed every other reference to them, e.g. the
+ * AVC entries for those SIDs.
+ */
+void sidtab_evict_unreferenced(struct sidtab *s)
+{
+	struct sidtab_node **pprev, *cur;
+	unsigned i;
+
+	for (i = 0; i < s->nbuckets && s->nunref; i++) {
+		pprev = &s->htable[i];
+		while ((cur = *pprev)) {
+			if (cur->sid_s.refcnt) {
+				pprev = &cur->next;
+				continue;
+			}
+			*pprev = cur->next;
+			s->ctx_bytes -= cur->len + 1;
+			s->nel--;
+			s->nunref--;
+			freecon(cur->sid_s.ctx);
+			avc_free(cur);
+		}
+	}
 }
 
 void sidtab_sid_stats(struct sidtab *h, char *buf, int buflen)
 {
-	int i, chain_len, slots_used, max_chain_len;
+	unsigned i;
+	int chain_len, slots_used, max_chain_len;
 	struct sidtab_node *cur;
 
 	slots_used = 0;
 	max_chain_len = 0;
-	for (i = 0; i < SIDTAB_SIZE; i++) {
+	for (i = 0; i < h->nbuckets; i++) {
 		cur = h->htable[i];
 		if (cur) {
 			slots_used++;
@@ -124,20 +215,22 @@ void sidtab_sid_stats(struct sidtab *h, char *buf, int buflen)
 	}
 
 	snprintf(buf, buflen,
-		 "%s:  %d SID entries and %d/%d buckets used, longest "
-		 "chain length %d\n", avc_prefix, h->nel, slots_used,
-		 SIDTAB_SIZE, max_chain_len);
+		 "%s:  %u SID entries (%u unreferenced) and %d/%u buckets "
+		 "used, longest chain length %d, %zu bytes\n", avc_prefix,
+		 h->nel, h->nunref, slots_used, h->nbuckets, max_chain_len,
+		 h->nel * sizeof(struct sidtab_node) + h->ctx_bytes +
+		 h->nbuckets * sizeof(struct sidtab_node *));
 }
 
 void sidtab_destroy(struct sidtab *s)
 {
-	int i;
+	unsigned i;
 	struct sidtab_node *cur, *temp;
 
 	if (!s)
 		return;
 
-	for (i = 0; i < SIDTAB_SIZE; i++) {
+	for (i = 0; i < s->nbuckets; i++) {
 		cur = s->htable[i];
 		while (cur != NULL) {
 			temp = cur;
@@ -5,6 +5,8 @@
 #ifndef _SELINUX_AVC_SIDTAB_H_
 #define _SELINUX_AVC_SIDTAB_H_
 
+#include <stdint.h>
+#include <limits.h>
 #include <selinux/selinux.h>
 #include <selinux/avc.h>
 #include "dso.h"
@@ -12,23 +14,37 @@
 struct sidtab_node {
 	struct security_id sid_s;
 	struct sidtab_node *next;
+	uint32_t hash;		/* full hash of the context */
+	size_t len;		/* context length, excluding the NUL */
+	int stats_type;		/* exported statistics slot + 1, or 0 */
 };
 
 #define SIDTAB_HASH_BITS 7
 #define SIDTAB_HASH_BUCKETS (1 << SIDTAB_HASH_BITS)
-#define SIDTAB_HASH_MASK (SIDTAB_HASH_BUCKETS-1)
-#define SIDTAB_SIZE SIDTAB_HASH_BUCKETS
+/* the table doubles once it holds more than this many entries per bucket */
+#define SIDTAB_MAX_LOAD 2
+
+/* references are not counted past this value; such SIDs are pinned */
+#define SIDTAB_REFCNT_MAX INT_MAX
 
 struct sidtab {
 	struct sidtab_node **htable;
 	unsigned nel;
+	unsigned nbuckets;	/* always a power of two */
+	unsigned nunref;	/* entries with a zero reference count */
+	size_t ctx_bytes;	/* memory used by the context strings */
 };
 
 int sidtab_init(struct sidtab *s) hidden;
-int sidtab_insert(struct sidtab *s, const char * ctx) hidden;
 
 int sidtab_context_to_sid(struct sidtab *s,
 			  const char * ctx, security_id_t * sid) hidden;
+int sidtab_context_len_to_sid(struct sidtab *s, const char * ctx,
+			      size_t len, security_id_t * sid) hidden;
+
+int sidtab_sid_get(struct sidtab *s, security_id_t sid) hidden;
+int sidtab_sid_put(struct sidtab *s, security_id_t sid) hidden;
+void sidtab_evict_unreferenced(struct sidtab *s) hidden;
 
 void sidtab_sid_stats(struct sidtab *s, char *buf, int buflen) hidden;
 void sidtab_destroy(struct sidtab *s) hidden;
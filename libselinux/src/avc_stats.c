@@ -0,0 +1,223 @@
+/*
+ * Exported AVC statistics.
+ *
+ * With AVC_OPT_STATS_EXPORT, avc_has_perm_noaudit() times each call and
+ * counts it, as a hit or a miss, in a file mapped shared so that tools
+ * like avcstat can watch a running process without its cooperation.
+ * Besides the totals, calls are broken down by class and by the type
+ * of the source context, each into a small table laid out as described
+ * in <selinux/avc_stats.h>.
+ *
+ * Counters are updated with relaxed atomic adds and may be read at any
+ * time.  Table slots are claimed under a mutex, with the id stored last
+ * so a reader that sees it also sees the name; a class is found again
+ * by its id without the mutex, and a source type is remembered in the
+ * SID table node of each context that has been looked up.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "selinux_internal.h"
+#include "avc_sidtab.h"
+#include "avc_stats.h"
+
+/* the last slot of each table collects what does not fit */
+#define AVC_STATS_OTHER		UINT32_MAX
+
+struct avc_stats_export *avc_stats_page = NULL;
+static pthread_mutex_t avc_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void avc_stats_name(struct avc_stats_entry *e, const char *name,
+			   size_t len)
+{
+	if (len >= AVC_STATS_NAMELEN)
+		len = AVC_STATS_NAMELEN - 1;
+	memcpy(e->name, name, len);
+	e->name[len] = '\0';
+}
+
+int avc_stats_open(const char *path)
+{
+	struct avc_stats_export *page;
+	struct stat sb;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &sb) < 0)
+		goto err;
+	if (!S_ISREG(sb.st_mode) || sb.st_uid != geteuid()) {
+		errno = EINVAL;
+		goto err;
+	}
+	/* start from zeroes, whatever the file held before */
+	if (ftruncate(fd, 0) < 0 || ftruncate(fd, sizeof(*page)) < 0)
+		goto err;
+
+	page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	if (page == MAP_FAILED)
+		goto err;
+	close(fd);
+
+	page->version = AVC_STATS_VERSION;
+	page->size = sizeof(*page);
+	page->pid = getpid();
+	page->classes[AVC_STATS_CLASSES - 1].id = AVC_STATS_OTHER;
+	avc_stats_name(&page->classes[AVC_STATS_CLASSES - 1], "(other)", 7);
+	page->types[AVC_STATS_TYPES - 1].id = AVC_STATS_OTHER;
+	avc_stats_name(&page->types[AVC_STATS_TYPES - 1], "(other)", 7);
+	__atomic_store_n(&page->magic, AVC_STATS_MAGIC, __ATOMIC_RELEASE);
+	avc_stats_page = page;
+	return 0;
+
+      err:
+	close(fd);
+	return -1;
+}
+
+void avc_stats_close(void)
+{
+	if (!avc_stats_page)
+		return;
+	munmap(avc_stats_page, sizeof(*avc_stats_page));
+	avc_stats_page = NULL;
+}
+
+static struct avc_stats_entry *avc_stats_class(security_class_t tclass)
+{
+	struct avc_stats_entry *e = NULL;
+	const char *name;
+	uint32_t id = (uint32_t)tclass + 1, cur;
+	unsigned i;
+
+	for (i = 0; i < AVC_STATS_CLASSES - 1; i++) {
+		e = &avc_stats_page->classes[(tclass + i) %
+					     (AVC_STATS_CLASSES - 1)];
+		cur = __atomic_load_n(&e->id, __ATOMIC_ACQUIRE);
+		if (cur == id)
+			return e;
+		if (!cur)
+			break;
+	}
+
+	/* claim the free slot, unless the class got one meanwhile */
+	pthread_mutex_lock(&avc_stats_mutex);
+	for (; i < AVC_STATS_CLASSES - 1; i++) {
+		e = &avc_stats_page->classes[(tclass + i) %
+					     (AVC_STATS_CLASSES - 1)];
+		if (e->id == id)
+			break;
+		if (e->id)
+			continue;
+		name = security_class_to_string(tclass);
+		if (!name)
+			name = "(unknown)";
+		avc_stats_name(e, name, strlen(name));
+		__atomic_store_n(&e->id, id, __ATOMIC_RELEASE);
+		break;
+	}
+	pthread_mutex_unlock(&avc_stats_mutex);
+	if (i == AVC_STATS_CLASSES - 1)
+		return &avc_stats_page->classes[AVC_STATS_CLASSES - 1];
+	return e;
+}
+
+/* The slot of the type of 'ctx', claiming one if need be. */
+static unsigned avc_stats_type_slot(const char *ctx)
+{
+	struct avc_stats_entry *e;
+	const char *type, *end;
+	uint32_t id = 2166136261U;
+	size_t len;
+	unsigned i, slot = AVC_STATS_TYPES - 1;
+
+	type = strchr(ctx, ':');
+	if (type)
+		type = strchr(type + 1, ':');
+	if (!type)
+		return slot;
+	type++;
+	end = strchrnul(type, ':');
+	len = end - type;
+	if (len >= AVC_STATS_NAMELEN)
+		len = AVC_STATS_NAMELEN - 1;
+	for (i = 0; i < len; i++) {
+		id ^= (unsigned char)type[i];
+		id *= 16777619U;
+	}
+	id |= 1;
+	if (id == AVC_STATS_OTHER)
+		id--;
+
+	pthread_mutex_lock(&avc_stats_mutex);
+	for (i = 0; i < AVC_STATS_TYPES - 1; i++) {
+		e = &avc_stats_page->types[(id + i) % (AVC_STATS_TYPES - 1)];
+		if (!e->id) {
+			avc_stats_name(e, type, len);
+			__atomic_store_n(&e->id, id, __ATOMIC_RELEASE);
+		} else if (e->id != id || strncmp(e->name, type, len) ||
+			   e->name[len])
+			continue;
+		slot = (id + i) % (AVC_STATS_TYPES - 1);
+		break;
+	}
+	pthread_mutex_unlock(&avc_stats_mutex);
+	return slot;
+}
+
+static struct avc_stats_entry *avc_stats_type(security_id_t ssid)
+{
+	struct sidtab_node *node = (struct sidtab_node *)ssid;
+	int slot;
+
+	slot = *(volatile int *)&node->stats_type;
+	if (!slot) {
+		slot = avc_stats_type_slot(ssid->ctx) + 1;
+		*(volatile int *)&node->stats_type = slot;
+	}
+	return &avc_stats_page->types[slot - 1];
+}
+
+static inline void avc_stats_count(struct avc_stats_counts *c, int miss,
+				   uint64_t ns, unsigned bucket)
+{
+	__atomic_fetch_add(&c->lookups, 1, __ATOMIC_RELAXED);
+	if (miss)
+		__atomic_fetch_add(&c->misses, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_fetch_add(&c->hits, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->latency_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->latency[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void avc_stats_record(security_id_t ssid, security_class_t tclass,
+		      int miss, const struct timespec *start)
+{
+	struct avc_stats_export *page = avc_stats_page;
+	struct timespec now;
+	uint64_t ns;
+	unsigned bucket = 0;
+
+	if (!page)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000ULL +
+	    now.tv_nsec - start->tv_nsec;
+	if (ns >= 64) {
+		bucket = 63 - __builtin_clzll(ns) - 5;
+		if (bucket >= AVC_STATS_BUCKETS)
+			bucket = AVC_STATS_BUCKETS - 1;
+	}
+
+	avc_stats_count(&page->total, miss, ns, bucket);
+	avc_stats_count(&avc_stats_class(tclass)->counts, miss, ns, bucket);
+	if (ssid)
+		avc_stats_count(&avc_stats_type(ssid)->counts, miss, ns,
+				bucket);
+}
@@ -0,0 +1,28 @@
+/*
+ * Per-class and per-source-type statistics published through a mapped
+ * file, selected with AVC_OPT_STATS_EXPORT.
+ */
+#ifndef _SELINUX_AVC_STATS_INTERNAL_H_
+#define _SELINUX_AVC_STATS_INTERNAL_H_
+
+#include <time.h>
+#include <selinux/avc.h>
+#include <selinux/avc_stats.h>
+#include "dso.h"
+
+/* NULL unless the statistics are exported */
+extern struct avc_stats_export *avc_stats_page hidden;
+
+/*
+ * Create or truncate the file at 'path' and map it.  The file must be
+ * a regular file owned by the calling user.  Returns -1 if it can not
+ * be used.
+ */
+int avc_stats_open(const char *path) hidden;
+void avc_stats_close(void) hidden;
+
+/* Count a lookup for 'ssid' and 'tclass' that started at 'start'. */
+void avc_stats_record(security_id_t ssid, security_class_t tclass,
+		      int miss, const struct timespec *start) hidden;
+
+#endif				/* _SELINUX_AVC_STATS_INTERNAL_H_ */
@@ -265,6 +265,256 @@ int security_get_boolean_active(const char *name)
 
 hidden_def(security_get_boolean_active)
 
+/*
+ * Reading many booleans.  selinuxfs has one file per boolean, so each
+ * one still costs an open and a read, but the directory is opened once
+ * and every file is opened relative to it, and the substitutions file
+ * is parsed at most once per call rather than once per missing name.
+ */
+struct bool_subs {
+	char **from;
+	char **to;
+	size_t n;
+	int loaded;
+};
+
+static void bool_subs_free(struct bool_subs *subs)
+{
+	size_t i;
+
+	for (i = 0; i < subs->n; i++) {
+		free(subs->from[i]);
+		free(subs->to[i]);
+	}
+	free(subs->from);
+	free(subs->to);
+}
+
+static void bool_subs_load(struct bool_subs *subs)
+{
+	char *line_buf = NULL, *src, *dst, *ptr, **tmp;
+	size_t line_len = 0, alloc = 0;
+	FILE *cfg;
+
+	subs->loaded = 1;
+	cfg = fopen(selinux_booleans_subs_path(), "r");
+	if (!cfg)
+		return;
+
+	__fsetlocking(cfg, FSETLOCKING_BYCALLER);
+	while (getline(&line_buf, &line_len, cfg) != -1) {
+		src = line_buf;
+		while (*src && isspace(*src))
+			src++;
+		if (!*src || src[0] == '#')
+			continue;
+		ptr = src;
+		while (*ptr && !isspace(*ptr))
+			ptr++;
+		if (!*ptr)
+			continue;
+		*ptr++ = '\0';
+		dst = ptr;
+		while (*dst && isspace(*dst))
+			dst++;
+		if (!*dst)
+			continue;
+		ptr = dst;
+		while (*ptr && !isspace(*ptr))
+			ptr++;
+		*ptr = '\0';
+
+		if (subs->n == alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			tmp = realloc(subs->from, alloc * sizeof(char *));
+			if (!tmp)
+				break;
+			subs->from = tmp;
+			tmp = realloc(subs->to, alloc * sizeof(char *));
+			if (!tmp)
+				break;
+			subs->to = tmp;
+		}
+		subs->from[subs->n] = strdup(src);
+		subs->to[subs->n] = strdup(dst);
+		if (!subs->from[subs->n] || !subs->to[subs->n]) {
+			free(subs->from[subs->n]);
+			free(subs->to[subs->n]);
+			break;
+		}
+		subs->n++;
+	}
+	free(line_buf);
+	fclose(cfg);
+}
+
+static int bool_openat(int dirfd, const char *name, struct bool_subs *subs,
+		       int flags)
+{
+	size_t i;
+	int fd;
+
+	fd = openat(dirfd, name, flags | O_CLOEXEC);
+	if (fd >= 0 || errno != ENOENT)
+		return fd;
+
+	if (!subs->loaded)
+		bool_subs_load(subs);
+	/* the first matching record wins, as in selinux_boolean_sub() */
+	for (i = 0; i < subs->n; i++)
+		if (!strcmp(subs->from[i], name))
+			return openat(dirfd, subs->to[i], flags | O_CLOEXEC);
+
+	errno = ENOENT;
+	return -1;
+}
+
+static int bool_dir_open(void)
+{
+	char path[PATH_MAX];
+
+	if (!selinux_mnt) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	snprintf(path, sizeof path, "%s%s", selinux_mnt, SELINUX_BOOL_DIR);
+	return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* Read the "active pending" pair of one boolean file. */
+static int read_bool_at(int dirfd, const char *name, struct bool_subs *subs,
+			int *active, int *pending)
+{
+	char buf[STRBUF_SIZE + 1];
+	int fd, len, errsave;
+
+	fd = bool_openat(dirfd, name, subs, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	len = read(fd, buf, STRBUF_SIZE);
+	errsave = errno;
+	close(fd);
+	errno = errsave;
+	if (len != STRBUF_SIZE)
+		return -1;
+
+	buf[STRBUF_SIZE] = '\0';
+	if (pending)
+		*pending = atoi(&buf[1]) ? 1 : 0;
+	buf[1] = '\0';
+	*active = atoi(buf) ? 1 : 0;
+	return 0;
+}
+
+static int write_bool_at(int dirfd, const char *name, struct bool_subs *subs,
+			 int value)
+{
+	int fd, ret, errsave;
+
+	fd = bool_openat(dirfd, name, subs, O_WRONLY);
+	if (fd < 0)
+		return -1;
+
+	ret = write(fd, value ? "1" : "0", 2);
+	errsave = errno;
+	close(fd);
+	errno = errsave;
+	return ret > 0 ? 0 : -1;
+}
+
+int security_get_boolean_values(const char *const *names, size_t n,
+				int *active, int *pending)
+{
+	struct bool_subs subs = { NULL, NULL, 0, 0 };
+	size_t i;
+	int dirfd, rc = 0, errsave = 0;
+
+	dirfd = bool_dir_open();
+	if (dirfd < 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (read_bool_at(dirfd, names[i], &subs, &active[i],
+				 pending ? &pending[i] : NULL) < 0) {
+			active[i] = -1;
+			if (pending)
+				pending[i] = -1;
+			errsave = errno;
+			rc = -1;
+		}
+	}
+
+	bool_subs_free(&subs);
+	close(dirfd);
+	if (rc < 0)
+		errno = errsave;
+	return rc;
+}
+
+int security_get_boolean_snapshot(SELboolean ** bools, size_t * len)
+{
+	struct bool_subs subs = { NULL, NULL, 0, 0 };
+	struct dirent **namelist;
+	SELboolean *list = NULL;
+	int dirfd, count, i, rc = -1;
+	size_t n = 0;
+
+	if (!bools || !len) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	dirfd = bool_dir_open();
+	if (dirfd < 0)
+		return -1;
+
+	/* scandir opens the directory by name again, but this keeps the
+	 * names sorted as security_get_boolean_names() returns them */
+	count = scandirat(dirfd, ".", &namelist, &filename_select, alphasort);
+	if (count < 0)
+		goto out_close;
+
+	list = calloc(count ? count : 1, sizeof(*list));
+	if (!list)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		if (read_bool_at(dirfd, namelist[i]->d_name, &subs,
+				 &list[n].value, NULL) < 0)
+			goto out;
+		list[n].name = strdup(namelist[i]->d_name);
+		if (!list[n].name)
+			goto out;
+		n++;
+	}
+
+	*bools = list;
+	*len = n;
+	list = NULL;
+	rc = 0;
+      out:
+	if (list)
+		security_free_boolean_snapshot(list, n);
+	for (i = 0; i < count; i++)
+		free(namelist[i]);
+	free(namelist);
+      out_close:
+	bool_subs_free(&subs);
+	close(dirfd);
+	return rc;
+}
+
+void security_free_boolean_snapshot(SELboolean * bools, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		free(bools[i].name);
+	free(bools);
+}
+
 int security_set_boolean(const char *name, int value)
 {
 	int fd, ret;
@@ -486,32 +736,77 @@ static int save_booleans(size_t boolcnt, SELboolean * boollist)
 	free(used);
 	return 0;
 }
-static void rollback(SELboolean * boollist, int end)
-{
-	int i;
-
-	for (i = 0; i < end; i++)
-		security_set_boolean(boollist[i].name,
-				     security_get_boolean_active(boollist[i].
-								 name));
-}
-
+/*
+ * The values are read first, so that only the booleans whose pending
+ * value differs are written.  A failure rolls back exactly those to
+ * their active values.  If the whole list already is in effect, the
+ * commit, which has the kernel re-evaluate every conditional rule, is
+ * skipped as well.
+ */
 int security_set_boolean_list(size_t boolcnt, SELboolean * boollist,
 			      int permanent)
 {
+	struct bool_subs subs = { NULL, NULL, 0, 0 };
+	int *active = NULL, *pending = NULL;
+	int dirfd, rc = -1, errsave, changed = 0;
+	size_t i, j;
 
-	size_t i;
 	for (i = 0; i < boolcnt; i++) {
-		if (security_set_boolean(boollist[i].name, boollist[i].value)) {
-			rollback(boollist, i);
+		if (boollist[i].value < 0 || boollist[i].value > 1) {
+			errno = EINVAL;
 			return -1;
 		}
 	}
 
-	/* OK, let's do the commit */
-	if (security_commit_booleans()) {
+	dirfd = bool_dir_open();
+	if (dirfd < 0)
 		return -1;
+
+	active = malloc((boolcnt ? boolcnt : 1) * sizeof(int));
+	pending = malloc((boolcnt ? boolcnt : 1) * sizeof(int));
+	if (!active || !pending)
+		goto out;
+
+	for (i = 0; i < boolcnt; i++)
+		if (read_bool_at(dirfd, boollist[i].name, &subs, &active[i],
+				 &pending[i]) < 0)
+			goto out;
+
+	for (i = 0; i < boolcnt; i++) {
+		if (active[i] != boollist[i].value)
+			changed = 1;
+		if (pending[i] == boollist[i].value)
+			continue;
+		if (write_bool_at(dirfd, boollist[i].name, &subs,
+				  boollist[i].value) < 0) {
+			errsave = errno;
+			for (j = 0; j < i; j++)
+				if (pending[j] != boollist[j].value)
+					write_bool_at(dirfd, boollist[j].name,
+						      &subs, active[j]);
+			errno = errsave;
+			goto out;
+		}
+		/* a later duplicate of the name sees the new value */
+		for (j = i + 1; j < boolcnt; j++)
+			if (!strcmp(boollist[j].name, boollist[i].name))
+				pending[j] = boollist[i].value;
 	}
+	rc = 0;
+
+      out:
+	errsave = errno;
+	free(active);
+	free(pending);
+	bool_subs_free(&subs);
+	close(dirfd);
+	errno = errsave;
+	if (rc < 0)
+		return -1;
+
+	/* OK, let's do the commit */
+	if (changed && security_commit_booleans())
+		return -1;
 
 	if (permanent)
 		return save_booleans(boolcnt, boollist);
@@ -15,6 +15,98 @@ static void avc_init_once(void)
 	avc_open(NULL, 0);
 }
 
+/*
+ * A class and set of permissions resolved once, for callers that check
+ * the same access for many pairs of contexts.  A name the policy does
+ * not define is remembered in unknown_errno, and handled at check time
+ * as selinux_check_access() would.
+ */
+struct selinux_access_handle {
+	security_class_t tclass;
+	access_vector_t av;
+	int unknown_errno;
+};
+
+selinux_access_handle_t *selinux_access_handle_create(const char *class,
+						      const char *const *perms,
+						      size_t nperms)
+{
+	selinux_access_handle_t *h;
+	access_vector_t av;
+	size_t i;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+
+	if (is_selinux_enabled() == 0)
+		return h;
+
+	h->tclass = string_to_security_class(class);
+	if (h->tclass == 0) {
+		h->unknown_errno = errno ? : EINVAL;
+		return h;
+	}
+
+	for (i = 0; i < nperms; i++) {
+		av = string_to_av_perm(h->tclass, perms[i]);
+		if (av == 0)
+			h->unknown_errno = errno ? : EINVAL;
+		h->av |= av;
+	}
+	return h;
+}
+
+void selinux_access_handle_free(selinux_access_handle_t *h)
+{
+	free(h);
+}
+
+int selinux_check_access_sid(security_id_t ssid, security_id_t tsid,
+			     const selinux_access_handle_t *h, void *aux)
+{
+	if (is_selinux_enabled() == 0)
+		return 0;
+
+	__selinux_once(once, avc_init_once);
+
+	if (h->unknown_errno) {
+		if (security_deny_unknown() == 0) {
+			/* the unknown permissions are allowed */
+			if (h->tclass == 0 || h->av == 0)
+				return 0;
+		} else {
+			errno = h->unknown_errno;
+			return -1;
+		}
+	}
+
+	return avc_has_perm(ssid, tsid, h->tclass, h->av, NULL, aux);
+}
+
+int selinux_check_access_handle(const char *scon, const char *tcon,
+				const selinux_access_handle_t *h, void *aux)
+{
+	int rc;
+	security_id_t scon_id;
+	security_id_t tcon_id;
+
+	if (is_selinux_enabled() == 0)
+		return 0;
+
+	__selinux_once(once, avc_init_once);
+
+	rc = avc_context_to_sid(scon, &scon_id);
+	if (rc < 0)
+		return rc;
+
+	rc = avc_context_to_sid(tcon, &tcon_id);
+	if (rc < 0)
+		return rc;
+
+	return selinux_check_access_sid(scon_id, tcon_id, h, aux);
+}
+
 int selinux_check_access(const char *scon, const char *tcon, const char *class, const char *perm, void *aux) {
 	int rc;
 	security_id_t scon_id;
@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 #include "selinux_internal.h"
 #include "policy.h"
 #include <limits.h>
@@ -33,6 +34,82 @@ int security_check_context_raw(const char * con)
 
 hidden_def(security_check_context_raw)
 
+static uint32_t context_hash(const char *con)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*con) {
+		hash ^= (unsigned char)*con++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * The context node is a transaction file that takes one write per
+ * open, so each distinct context still costs an open and a write.
+ * Policy files repeat the same few contexts many times over; those
+ * repeats are recognized and get the result of the first check.
+ */
+int security_check_context_batch_raw(const char *const *cons, size_t n,
+				     int *errs)
+{
+	char path[PATH_MAX];
+	size_t *seen = NULL, mask = 0, i, h, j;
+	int fd, rc = 0, errsave = 0;
+
+	if (!selinux_mnt) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	snprintf(path, sizeof path, "%s/context", selinux_mnt);
+
+	/* an open-addressed table of index + 1 of each distinct context;
+	 * without it every context is just checked */
+	if (n > 1) {
+		for (mask = 1; mask < 2 * n; mask <<= 1) ;
+		seen = calloc(mask, sizeof(*seen));
+		mask--;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (seen) {
+			for (h = context_hash(cons[i]) & mask; (j = seen[h]);
+			     h = (h + 1) & mask)
+				if (!strcmp(cons[j - 1], cons[i]))
+					break;
+			if (j) {
+				errs[i] = errs[j - 1];
+				goto next;
+			}
+			seen[h] = i + 1;
+		}
+
+		errs[i] = 0;
+		fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd < 0) {
+			errs[i] = errno;
+			goto next;
+		}
+		if (write(fd, cons[i], strlen(cons[i]) + 1) < 0)
+			errs[i] = errno;
+		close(fd);
+	      next:
+		if (errs[i]) {
+			errsave = errs[i];
+			rc = -1;
+		}
+	}
+
+	free(seen);
+	if (rc < 0)
+		errno = errsave;
+	return rc;
+}
+
+hidden_def(security_check_context_batch_raw)
+
 int security_check_context(const char * con)
 {
 	int ret;
@@ -49,3 +126,28 @@ int security_check_context(const char * con)
 }
 
 hidden_def(security_check_context)
+
+int security_check_context_batch(const char *const *cons, size_t n, int *errs)
+{
+	char **rcons;
+	size_t i;
+	int rc = -1, errsave;
+
+	rcons = calloc(n ? n : 1, sizeof(char *));
+	if (!rcons)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		if (selinux_trans_to_raw_context(cons[i], &rcons[i]))
+			goto out;
+
+	rc = security_check_context_batch_raw((const char *const *)rcons, n,
+					      errs);
+      out:
+	errsave = errno;
+	for (i = 0; i < n; i++)
+		freecon(rcons[i]);
+	free(rcons);
+	errno = errsave;
+	return rc;
+}
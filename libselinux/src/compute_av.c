@@ -9,6 +9,47 @@
 #include "selinux_internal.h"
 #include "policy.h"
 #include "mapping.h"
+#include "avc_shared.h"
+#include "selinux_trace.h"
+
+static int compute_av_query(char *buf, const char * scon,
+			    const char * tcon, security_class_t tclass,
+			    access_vector_t requested,
+			    struct av_decision *avd)
+{
+	int ret;
+
+#ifndef DISABLE_AVC
+	/* the kernel computes the whole vector, whatever is requested */
+	if (!avc_shared_lookup(scon, tcon, unmap_class(tclass), avd))
+		goto map;
+#endif
+
+	snprintf(buf, selinux_page_size, "%s %s %hu %x", scon, tcon,
+		 unmap_class(tclass), unmap_perm(tclass, requested));
+
+	if (selinux_transaction("access", buf) < 0)
+		return -1;
+
+	ret = sscanf(buf, "%x %x %x %x %u %x",
+		     &avd->allowed, &avd->decided,
+		     &avd->auditallow, &avd->auditdeny,
+		     &avd->seqno, &avd->flags);
+	if (ret < 5)
+		return -1;
+	else if (ret < 6)
+		avd->flags = 0;
+
+#ifndef DISABLE_AVC
+	avc_shared_insert(scon, tcon, unmap_class(tclass), avd);
+      map:
+#endif
+	/* If tclass invalid, kernel sets avd according to deny_unknown flag */
+	if (tclass != 0)
+		map_decision(tclass, avd);
+
+	return 0;
+}
 
 int security_compute_av_flags_raw(const char * scon,
 				  const char * tcon,
@@ -16,63 +57,60 @@ int security_compute_av_flags_raw(const char * scon,
 				  access_vector_t requested,
 				  struct av_decision *avd)
 {
-	char path[PATH_MAX];
 	char *buf;
-	size_t len;
-	int fd, ret;
+	int rc = -1;
+
+	SELINUX_PROBE4(compute_av_entry, scon, tcon, tclass, requested);
 
 	if (!selinux_mnt) {
 		errno = ENOENT;
-		return -1;
+		goto out;
 	}
 
-	snprintf(path, sizeof path, "%s/access", selinux_mnt);
-	fd = open(path, O_RDWR);
-	if (fd < 0)
-		return -1;
-
-	len = selinux_page_size;
-	buf = malloc(len);
-	if (!buf) {
-		ret = -1;
+	buf = selinux_transaction_buf();
+	if (!buf)
 		goto out;
-	}
 
-	snprintf(buf, len, "%s %s %hu %x", scon, tcon,
-		 unmap_class(tclass), unmap_perm(tclass, requested));
+	rc = compute_av_query(buf, scon, tcon, tclass, requested, avd);
+      out:
+	SELINUX_PROBE1(compute_av_return, rc);
+	return rc;
+}
 
-	ret = write(fd, buf, strlen(buf));
-	if (ret < 0)
-		goto out2;
+hidden_def(security_compute_av_flags_raw)
 
-	memset(buf, 0, len);
-	ret = read(fd, buf, len - 1);
-	if (ret < 0)
-		goto out2;
+int security_compute_av_flags_batch_raw(const struct security_av_query *queries,
+					size_t nqueries,
+					struct av_decision *avds)
+{
+	char *buf;
+	size_t i;
+	int rc = 0, errsave = 0;
 
-	ret = sscanf(buf, "%x %x %x %x %u %x",
-		     &avd->allowed, &avd->decided,
-		     &avd->auditallow, &avd->auditdeny,
-		     &avd->seqno, &avd->flags);
-	if (ret < 5) {
-		ret = -1;
-		goto out2;
-	} else if (ret < 6)
-		avd->flags = 0;
+	if (!selinux_mnt) {
+		errno = ENOENT;
+		return -1;
+	}
 
-	/* If tclass invalid, kernel sets avd according to deny_unknown flag */
-	if (tclass != 0)
-		map_decision(tclass, avd);
+	buf = selinux_transaction_buf();
+	if (!buf)
+		return -1;
 
-	ret = 0;
-      out2:
-	free(buf);
-      out:
-	close(fd);
-	return ret;
+	for (i = 0; i < nqueries; i++) {
+		if (compute_av_query(buf, queries[i].scon, queries[i].tcon,
+				     queries[i].tclass, queries[i].requested,
+				     &avds[i]) < 0) {
+			memset(&avds[i], 0, sizeof(avds[i]));
+			errsave = errno;
+			rc = -1;
+		}
+	}
+
+	errno = errsave;
+	return rc;
 }
 
-hidden_def(security_compute_av_flags_raw)
+hidden_def(security_compute_av_flags_batch_raw)
 
 int security_compute_av_raw(const char * scon,
 			    const char * tcon,
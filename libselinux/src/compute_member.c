@@ -15,49 +15,26 @@ int security_compute_member_raw(const char * scon,
 				security_class_t tclass,
 				char ** newcon)
 {
-	char path[PATH_MAX];
 	char *buf;
-	size_t size;
-	int fd, ret;
 
 	if (!selinux_mnt) {
 		errno = ENOENT;
 		return -1;
 	}
 
-	snprintf(path, sizeof path, "%s/member", selinux_mnt);
-	fd = open(path, O_RDWR);
-	if (fd < 0)
+	buf = selinux_transaction_buf();
+	if (!buf)
 		return -1;
+	snprintf(buf, selinux_page_size, "%s %s %hu", scon, tcon,
+		 unmap_class(tclass));
 
-	size = selinux_page_size;
-	buf = malloc(size);
-	if (!buf) {
-		ret = -1;
-		goto out;
-	}
-	snprintf(buf, size, "%s %s %hu", scon, tcon, unmap_class(tclass));
-
-	ret = write(fd, buf, strlen(buf));
-	if (ret < 0)
-		goto out2;
-
-	memset(buf, 0, size);
-	ret = read(fd, buf, size - 1);
-	if (ret < 0)
-		goto out2;
+	if (selinux_transaction("member", buf) < 0)
+		return -1;
 
 	*newcon = strdup(buf);
-	if (!(*newcon)) {
-		ret = -1;
-		goto out2;
-	}
-	ret = 0;
-      out2:
-	free(buf);
-      out:
-	close(fd);
-	return ret;
+	if (!(*newcon))
+		return -1;
+	return 0;
 }
 
 hidden_def(security_compute_member_raw)
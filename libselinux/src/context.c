@@ -15,29 +15,18 @@ typedef struct {
 } context_private_t;
 
 /*
- * Allocate a new context, initialized from str.  There must be 3 or
- * 4 colon-separated components and no whitespace in any component other
- * than the MLS component.
+ * Parse str into a view.  There must be 3 or 4 colon-separated
+ * components and no whitespace in any component other than the MLS
+ * component.
  */
-context_t context_new(const char *str)
+int context_view_parse(const char *str, context_view_t *view)
 {
-	int i, count;
-	errno = 0;
-	context_private_t *n =
-	    (context_private_t *) malloc(sizeof(context_private_t));
-	context_t result = (context_t) malloc(sizeof(context_s_t));
+	context_span_t *comp[4] = { &view->user, &view->role, &view->type,
+				    &view->range };
 	const char *p, *tok;
+	int i, count;
 
-	if (result)
-		result->ptr = n;
-	else
-		free(n);
-	if (n == 0 || result == 0) {
-		goto err;
-	}
-	n->current_str = n->component[0] = n->component[1] = n->component[2] =
-	    n->component[3] = 0;
-	for (i = count = 0, p = str; *p; p++) {
+	for (count = 0, p = str; *p; p++) {
 		switch (*p) {
 		case ':':
 			count++;
@@ -59,21 +48,87 @@ context_t context_new(const char *str)
 		goto err;
 	}
 
-	n->component[3] = 0;
+	for (i = 0; i < 4; i++) {
+		comp[i]->ptr = NULL;
+		comp[i]->len = 0;
+	}
 	for (i = 0, tok = str; *tok; i++) {
 		if (i < 3)
 			for (p = tok; *p && *p != ':'; p++) {	/* empty */
 		} else {
 			/* MLS range is one component */
-			for (p = tok; *p; p++) {	/* empty */
-			}
+			p = tok + strlen(tok);
 		}
-		n->component[i] = (char *)malloc(p - tok + 1);
+		comp[i]->ptr = tok;
+		comp[i]->len = p - tok;
+		tok = *p ? p + 1 : p;
+	}
+	return 0;
+      err:
+	errno = EINVAL;
+	return -1;
+}
+
+hidden_def(context_view_parse)
+
+int context_view_format(char *buf, size_t size, const context_view_t *view)
+{
+	if (!view->user.ptr || !view->role.ptr || !view->type.ptr) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!view->range.ptr)
+		return snprintf(buf, size, "%.*s:%.*s:%.*s",
+				(int)view->user.len, view->user.ptr,
+				(int)view->role.len, view->role.ptr,
+				(int)view->type.len, view->type.ptr);
+	return snprintf(buf, size, "%.*s:%.*s:%.*s:%.*s",
+			(int)view->user.len, view->user.ptr,
+			(int)view->role.len, view->role.ptr,
+			(int)view->type.len, view->type.ptr,
+			(int)view->range.len, view->range.ptr);
+}
+
+hidden_def(context_view_format)
+
+int context_span_eq(const context_span_t *span, const char *str)
+{
+	return span->ptr && !strncmp(span->ptr, str, span->len) &&
+	    !str[span->len];
+}
+
+hidden_def(context_span_eq)
+
+/*
+ * Allocate a new context, initialized from str.
+ */
+context_t context_new(const char *str)
+{
+	context_view_t view;
+	context_span_t *comp[4] = { &view.user, &view.role, &view.type,
+				    &view.range };
+	int i;
+	errno = 0;
+	context_private_t *n =
+	    (context_private_t *) malloc(sizeof(context_private_t));
+	context_t result = (context_t) malloc(sizeof(context_s_t));
+
+	if (result)
+		result->ptr = n;
+	else
+		free(n);
+	if (n == 0 || result == 0) {
+		goto err;
+	}
+	n->current_str = n->component[0] = n->component[1] = n->component[2] =
+	    n->component[3] = 0;
+	if (context_view_parse(str, &view) < 0)
+		goto err;
+
+	for (i = 0; i < 4 && comp[i]->ptr; i++) {	/* the type may be missing */
+		n->component[i] = strndup(comp[i]->ptr, comp[i]->len);
 		if (n->component[i] == 0)
 			goto err;
-		strncpy(n->component[i], tok, p - tok);
-		n->component[i][p - tok] = '\0';
-		tok = *p ? p + 1 : p;
 	}
 	return result;
       err:
@@ -12,3 +12,6 @@ hidden_proto(context_new)
     hidden_proto(context_user_get)
     hidden_proto(context_range_set)
     hidden_proto(context_range_get)
+    hidden_proto(context_view_parse)
+    hidden_proto(context_view_format)
+    hidden_proto(context_span_eq)
@@ -1,6 +1,21 @@
 function except() {
 case $1 in
     selinux_file_context_cmp) # ignore
+    ;;
+    matchpathcon|matchpathcon_init*|matchpathcon_index|\
+    *getfilecon*|*setfilecon*|*fileconat_batch*|getpeercon*|\
+    security_compute_*|selinux_check_access*) # may block, drop the GIL
+echo "
+%exception $1 {
+  Py_BEGIN_ALLOW_THREADS
+  \$action
+  Py_END_ALLOW_THREADS
+  if (result < 0) {
+     PyErr_SetFromErrno(PyExc_OSError);
+     return NULL;
+  }
+}
+"
     ;;
     *)
 echo "
@@ -0,0 +1,203 @@
+/*
+ * Get and set the contexts of many files in one directory.
+ *
+ * There are no *xattrat() system calls, so each name is reached
+ * through the /proc/self/fd link of the directory descriptor.  The
+ * kernel then resolves it relative to the already open directory
+ * instead of walking the caller's full path again, and a directory
+ * renamed while the batch runs cannot redirect it elsewhere.
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/xattr.h>
+#include "selinux_internal.h"
+#include "policy.h"
+
+static const char *at_path(char *buf, size_t size, int dirfd, const char *name)
+{
+	if (dirfd == AT_FDCWD || name[0] == '/')
+		return name;
+	if ((size_t)snprintf(buf, size, "/proc/self/fd/%d/%s", dirfd, name) >= size) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	return buf;
+}
+
+int getfileconat_batch_raw(int dirfd, const char *const *names, size_t n,
+			   int flags, char **cons)
+{
+	char path[PATH_MAX];
+	const char *p;
+	char *buf, *newbuf;
+	ssize_t size, ret;
+	size_t i;
+	int rc = 0, err = 0;
+
+	if (flags & ~AT_SYMLINK_NOFOLLOW) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size = INITCONTEXTLEN + 1;
+	buf = malloc(size);
+	if (!buf)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		cons[i] = NULL;
+		p = at_path(path, sizeof(path), dirfd, names[i]);
+		if (!p)
+			goto fail;
+
+		if (flags & AT_SYMLINK_NOFOLLOW)
+			ret = lgetxattr(p, XATTR_NAME_SELINUX, buf, size - 1);
+		else
+			ret = getxattr(p, XATTR_NAME_SELINUX, buf, size - 1);
+		if (ret < 0 && errno == ERANGE) {
+			/* grow the buffer for this and all later names */
+			if (flags & AT_SYMLINK_NOFOLLOW)
+				ret = lgetxattr(p, XATTR_NAME_SELINUX, NULL, 0);
+			else
+				ret = getxattr(p, XATTR_NAME_SELINUX, NULL, 0);
+			if (ret < 0)
+				goto fail;
+			newbuf = realloc(buf, ret + 1);
+			if (!newbuf)
+				goto fail;
+			buf = newbuf;
+			size = ret + 1;
+			if (flags & AT_SYMLINK_NOFOLLOW)
+				ret = lgetxattr(p, XATTR_NAME_SELINUX, buf, size - 1);
+			else
+				ret = getxattr(p, XATTR_NAME_SELINUX, buf, size - 1);
+		}
+		if (ret == 0) {
+			/* Re-map empty attribute values to errors. */
+			errno = ENOTSUP;
+			ret = -1;
+		}
+		if (ret < 0)
+			goto fail;
+
+		buf[ret] = '\0';
+		cons[i] = strdup(buf);
+		if (cons[i])
+			continue;
+	      fail:
+		err = errno;
+		rc = -1;
+	}
+
+	free(buf);
+	if (rc < 0)
+		errno = err;
+	return rc;
+}
+
+int getfileconat_batch(int dirfd, const char *const *names, size_t n,
+		       int flags, char **cons)
+{
+	char *rcon;
+	size_t i;
+	int rc, err = 0;
+
+	rc = getfileconat_batch_raw(dirfd, names, n, flags, cons);
+	if (rc < 0)
+		err = errno;
+
+	for (i = 0; i < n; i++) {
+		if (!cons[i])
+			continue;
+		rcon = cons[i];
+		if (selinux_raw_to_trans_context(rcon, &cons[i]) < 0) {
+			cons[i] = NULL;
+			err = errno;
+			rc = -1;
+		}
+		freecon(rcon);
+	}
+
+	if (rc < 0)
+		errno = err;
+	return rc;
+}
+
+int setfileconat_batch_raw(int dirfd, const char *const *names,
+			   const char *const *cons, size_t n, int flags)
+{
+	char path[PATH_MAX];
+	const char *p;
+	char *ccon;
+	size_t i;
+	int rc = 0, err = 0, ret;
+
+	if (flags & ~AT_SYMLINK_NOFOLLOW) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		p = at_path(path, sizeof(path), dirfd, names[i]);
+		if (!p)
+			goto fail;
+
+		if (flags & AT_SYMLINK_NOFOLLOW)
+			ret = lsetxattr(p, XATTR_NAME_SELINUX, cons[i],
+					strlen(cons[i]) + 1, 0);
+		else
+			ret = setxattr(p, XATTR_NAME_SELINUX, cons[i],
+				       strlen(cons[i]) + 1, 0);
+		if (ret < 0 && errno == ENOTSUP) {
+			/* not an error if it already has the context */
+			ccon = NULL;
+			if (flags & AT_SYMLINK_NOFOLLOW)
+				ret = lgetfilecon_raw(p, &ccon);
+			else
+				ret = getfilecon_raw(p, &ccon);
+			ret = (ret >= 0 && strcmp(cons[i], ccon) == 0) ? 0 : -1;
+			freecon(ccon);
+			errno = ENOTSUP;
+		}
+		if (ret == 0)
+			continue;
+	      fail:
+		err = errno;
+		rc = -1;
+	}
+
+	if (rc < 0)
+		errno = err;
+	return rc;
+}
+
+int setfileconat_batch(int dirfd, const char *const *names,
+		       const char *const *cons, size_t n, int flags)
+{
+	char **rcons;
+	size_t i;
+	int rc = -1, err;
+
+	rcons = calloc(n ? n : 1, sizeof(char *));
+	if (!rcons)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		if (selinux_trans_to_raw_context(cons[i], &rcons[i]) < 0)
+			goto out;
+
+	rc = setfileconat_batch_raw(dirfd, names, (const char *const *)rcons,
+				    n, flags);
+      out:
+	err = errno;
+	for (i = 0; i < n; i++)
+		freecon(rcons[i]);
+	free(rcons);
+	errno = err;
+	return rc;
+}
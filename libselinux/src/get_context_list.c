@@ -6,6 +6,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <pwd.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <selinux/avc.h>
 #include "selinux_internal.h"
 #include "context_internal.h"
 #include "get_context_list_internal.h"
@@ -17,8 +20,7 @@ int get_default_context_with_role(const char *user,
 {
 	char **conary;
 	char **ptr;
-	context_t con;
-	const char *role2;
+	context_view_t view;
 	int rc;
 
 	rc = get_ordered_context_list(user, fromcon, &conary);
@@ -26,15 +28,10 @@ int get_default_context_with_role(const char *user,
 		return -1;
 
 	for (ptr = conary; *ptr; ptr++) {
-		con = context_new(*ptr);
-		if (!con)
+		if (context_view_parse(*ptr, &view) < 0)
 			continue;
-		role2 = context_role_get(con);
-		if (role2 && !strcmp(role, role2)) {
-			context_free(con);
+		if (context_span_eq(&view.role, role))
 			break;
-		}
-		context_free(con);
 	}
 
 	rc = -1;
@@ -117,9 +114,8 @@ int get_default_context(const char *user,
 static int find_partialcon(char ** list,
 			   unsigned int nreach, char *part)
 {
-	const char *conrole, *contype;
 	char *partrole, *parttype, *ptr;
-	context_t con;
+	context_view_t view;
 	unsigned int i;
 
 	partrole = part;
@@ -135,20 +131,11 @@ static int find_partialcon(char ** list,
 	*ptr = 0;
 
 	for (i = 0; i < nreach; i++) {
-		con = context_new(list[i]);
-		if (!con)
+		if (context_view_parse(list[i], &view) < 0 || !view.type.ptr)
 			return -1;
-		conrole = context_role_get(con);
-		contype = context_type_get(con);
-		if (!conrole || !contype) {
-			context_free(con);
-			return -1;
-		}
-		if (!strcmp(conrole, partrole) && !strcmp(contype, parttype)) {
-			context_free(con);
+		if (context_span_eq(&view.role, partrole) &&
+		    context_span_eq(&view.type, parttype))
 			return i;
-		}
-		context_free(con);
 	}
 
 	return -1;
@@ -165,25 +152,17 @@ static int get_context_order(FILE * fp,
 	size_t line_len = 0;
 	ssize_t len;
 	int found = 0;
-	const char *fromrole, *fromtype;
+	context_view_t from;
 	char *linerole, *linetype;
 	unsigned int i;
-	context_t con;
 	int rc;
 
 	errno = -EINVAL;
 
 	/* Extract the role and type of the fromcon for matching.
 	   User identity and MLS range can be variable. */
-	con = context_new(fromcon);
-	if (!con)
+	if (context_view_parse(fromcon, &from) < 0 || !from.type.ptr)
 		return -1;
-	fromrole = context_role_get(con);
-	fromtype = context_type_get(con);
-	if (!fromrole || !fromtype) {
-		context_free(con);
-		return -1;
-	}
 
 	while ((len = getline(&line, &line_len, fp)) > 0) {
 		if (line[len - 1] == '\n')
@@ -216,7 +195,8 @@ static int get_context_order(FILE * fp,
 		if (!(*start))
 			continue;
 		*start = 0;
-		if (!strcmp(fromrole, linerole) && !strcmp(fromtype, linetype)) {
+		if (context_span_eq(&from.role, linerole) &&
+		    context_span_eq(&from.type, linetype)) {
 			found = 1;
 			break;
 		}
@@ -263,7 +243,6 @@ static int get_context_order(FILE * fp,
 	rc = 0;
 
       out:
-	context_free(con);
 	free(line);
 	return rc;
 }
@@ -328,6 +307,204 @@ static int order_compare(const void *A, const void *B)
 	return strcmp(c1->con, c2->con);
 }
 
+/*
+ * Ordered context lists are remembered per process, so that a login
+ * service handing out the same user and starting context again skips
+ * security_compute_user() and the parsing of the context files.  An
+ * entry is only used while the policy load count from the status page
+ * and the identity of both context files are those it was computed
+ * under.
+ */
+#define CONTEXT_LIST_CACHE_SIZE 16
+
+struct context_file_stamp {
+	int present;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
+struct context_list_key {
+	const char *user;
+	const char *fromcon;
+	const char *user_path;
+	const char *default_path;
+	int policyload;
+	struct context_file_stamp user_file;
+	struct context_file_stamp default_file;
+};
+
+struct context_list_entry {
+	struct context_list_key key;
+	char *keybuf;		/* holds the strings of 'key' */
+	char **list;
+	unsigned int nlist;
+	unsigned long used;
+};
+
+static struct context_list_entry context_list_cache[CONTEXT_LIST_CACHE_SIZE];
+static unsigned long context_list_clock;
+static pthread_mutex_t context_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int context_file_stamp(const char *path, struct context_file_stamp *st)
+{
+	struct stat sb;
+
+	memset(st, 0, sizeof(*st));
+	if (stat(path, &sb) < 0)
+		return errno == ENOENT ? 0 : -1;
+	st->present = 1;
+	st->dev = sb.st_dev;
+	st->ino = sb.st_ino;
+	st->size = sb.st_size;
+	st->mtime = sb.st_mtim;
+	return 0;
+}
+
+static int context_file_stamp_eq(const struct context_file_stamp *a,
+				 const struct context_file_stamp *b)
+{
+	return a->present == b->present && a->dev == b->dev &&
+	    a->ino == b->ino && a->size == b->size &&
+	    a->mtime.tv_sec == b->mtime.tv_sec &&
+	    a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+/* Fill in the state the result depends on, or fail if it cannot be
+   pinned down and the result must not be cached. */
+static int context_list_key_init(struct context_list_key *key,
+				 const char *user, const char *fromcon,
+				 const char *user_path)
+{
+	key->user = user;
+	key->fromcon = fromcon;
+	key->user_path = user_path;
+	key->default_path = selinux_default_context_path();
+
+	/* fallback mode does not know the load count until a reload */
+	if (selinux_status_open(0) != 0)
+		return -1;
+	key->policyload = selinux_status_policyload();
+	if (key->policyload < 0)
+		return -1;
+
+	if (context_file_stamp(key->user_path, &key->user_file) < 0 ||
+	    context_file_stamp(key->default_path, &key->default_file) < 0)
+		return -1;
+	return 0;
+}
+
+static int context_list_key_eq(const struct context_list_key *a,
+			       const struct context_list_key *b)
+{
+	return a->policyload == b->policyload &&
+	    !strcmp(a->user, b->user) && !strcmp(a->fromcon, b->fromcon) &&
+	    !strcmp(a->user_path, b->user_path) &&
+	    !strcmp(a->default_path, b->default_path) &&
+	    context_file_stamp_eq(&a->user_file, &b->user_file) &&
+	    context_file_stamp_eq(&a->default_file, &b->default_file);
+}
+
+static char **context_list_dup(char **list, unsigned int n)
+{
+	char **dup;
+	unsigned int i;
+
+	dup = calloc(n + 1, sizeof(char *));
+	if (!dup)
+		return NULL;
+	for (i = 0; i < n; i++) {
+		dup[i] = strdup(list[i]);
+		if (!dup[i]) {
+			freeconary(dup);
+			return NULL;
+		}
+	}
+	return dup;
+}
+
+static void context_list_entry_clear(struct context_list_entry *ent)
+{
+	free(ent->keybuf);
+	if (ent->list)
+		freeconary(ent->list);
+	memset(ent, 0, sizeof(*ent));
+}
+
+/* Return a copy of the cached list for 'key' in *list and its length,
+   or 0 if there is none. */
+static int context_list_cache_lookup(const struct context_list_key *key,
+				     char ***list)
+{
+	struct context_list_entry *ent;
+	int rc = 0;
+	unsigned int i;
+
+	__selinux_mutex_lock(&context_list_lock);
+	for (i = 0; i < CONTEXT_LIST_CACHE_SIZE; i++) {
+		ent = &context_list_cache[i];
+		if (!ent->list || !context_list_key_eq(&ent->key, key))
+			continue;
+		*list = context_list_dup(ent->list, ent->nlist);
+		if (*list) {
+			ent->used = ++context_list_clock;
+			rc = ent->nlist;
+		}
+		break;
+	}
+	__selinux_mutex_unlock(&context_list_lock);
+	return rc;
+}
+
+/* Remember a copy of 'list' for 'key', replacing the least recently
+   used entry.  Failures only cost the caching. */
+static void context_list_cache_insert(const struct context_list_key *key,
+				      char **list, unsigned int n)
+{
+	struct context_list_entry *ent, *victim = NULL;
+	size_t ulen, flen, uplen, dplen;
+	char *buf;
+	unsigned int i;
+
+	ulen = strlen(key->user) + 1;
+	flen = strlen(key->fromcon) + 1;
+	uplen = strlen(key->user_path) + 1;
+	dplen = strlen(key->default_path) + 1;
+
+	__selinux_mutex_lock(&context_list_lock);
+	for (i = 0; i < CONTEXT_LIST_CACHE_SIZE; i++) {
+		ent = &context_list_cache[i];
+		if (ent->list && context_list_key_eq(&ent->key, key))
+			goto out;	/* another thread got here first */
+		if (!victim || ent->used < victim->used)
+			victim = ent;
+	}
+	context_list_entry_clear(victim);
+
+	buf = malloc(ulen + flen + uplen + dplen);
+	if (!buf)
+		goto out;
+	victim->list = context_list_dup(list, n);
+	if (!victim->list) {
+		free(buf);
+		goto out;
+	}
+	victim->keybuf = buf;
+	victim->nlist = n;
+	victim->key = *key;
+	victim->key.user = memcpy(buf, key->user, ulen);
+	buf += ulen;
+	victim->key.fromcon = memcpy(buf, key->fromcon, flen);
+	buf += flen;
+	victim->key.user_path = memcpy(buf, key->user_path, uplen);
+	buf += uplen;
+	victim->key.default_path = memcpy(buf, key->default_path, dplen);
+	victim->used = ++context_list_clock;
+      out:
+	__selinux_mutex_unlock(&context_list_lock);
+}
+
 int get_ordered_context_list_with_level(const char *user,
 					const char *level,
 					char * fromcon,
@@ -404,6 +581,8 @@ int get_ordered_context_list(const char *user,
 	char *fname = NULL;
 	size_t fname_len;
 	const char *user_contexts_path = selinux_user_contexts_path();
+	struct context_list_key key;
+	int cacheable = 0;
 
 	if (!fromcon) {
 		/* Get the current context and use it for the starting context */
@@ -413,6 +592,21 @@ int get_ordered_context_list(const char *user,
 		freefrom = 1;
 	}
 
+	fname_len = strlen(user_contexts_path) + strlen(user) + 2;
+	fname = malloc(fname_len);
+	if (!fname)
+		goto failsafe;
+	snprintf(fname, fname_len, "%s%s", user_contexts_path, user);
+
+	/* The state is read before the computation, so that a change
+	   during it leaves the entry stale rather than wrong. */
+	cacheable = context_list_key_init(&key, user, fromcon, fname) == 0;
+	if (cacheable) {
+		rc = context_list_cache_lookup(&key, &reachable);
+		if (rc > 0)
+			goto out;
+	}
+
 	/* Determine the set of reachable contexts for the user. */
 	rc = security_compute_user(fromcon, user, &reachable);
 	if (rc < 0)
@@ -432,11 +626,6 @@ int get_ordered_context_list(const char *user,
 
 	/* Determine the ordering to apply from the optional per-user config
 	   and from the global config. */
-	fname_len = strlen(user_contexts_path) + strlen(user) + 2;
-	fname = malloc(fname_len);
-	if (!fname)
-		goto failsafe;
-	snprintf(fname, fname_len, "%s%s", user_contexts_path, user);
 	fp = fopen(fname, "r");
 	if (fp) {
 		__fsetlocking(fp, FSETLOCKING_BYCALLER);
@@ -450,7 +639,6 @@ int get_ordered_context_list(const char *user,
 			/* Fall through, try global config */
 		}
 	}
-	free(fname);
 	fp = fopen(selinux_default_context_path(), "r");
 	if (fp) {
 		__fsetlocking(fp, FSETLOCKING_BYCALLER);
@@ -488,6 +676,8 @@ int get_ordered_context_list(const char *user,
 			free(reachable[i]);
 		reachable[nordered] = NULL;
 		rc = nordered;
+		if (cacheable)
+			context_list_cache_insert(&key, reachable, nordered);
 	}
 
       out:
@@ -497,6 +687,7 @@ int get_ordered_context_list(const char *user,
 		freeconary(reachable);
 
 	free(ordering);
+	free(fname);
 	if (freefrom)
 		freecon(fromcon);
 
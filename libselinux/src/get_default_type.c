@@ -1,71 +1,230 @@
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include "get_default_type_internal.h"
+#include "selinux_internal.h"
 #include <errno.h>
 
-static int find_default_type(FILE * fp, const char *role, char **type);
+/*
+ * The default_type file is parsed once into a table of role:type pairs,
+ * and parsed again only when the file changes, so that a process asking
+ * for the default type of several roles reads it once.
+ */
+struct default_type {
+	char *role;
+	char *type;
+	uint32_t hash;
+	struct default_type *next;	/* in the role hash chain */
+};
 
-int get_default_type(const char *role, char **type)
+static struct {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct default_type *entries;
+	size_t nentries;
+	struct default_type **buckets;
+	size_t mask;
+} default_type_cache;
+
+static pthread_mutex_t default_type_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t role_hash(const char *role)
 {
-	FILE *fp = NULL;
+	uint32_t hash = 2166136261U;
 
-	fp = fopen(selinux_default_type_path(), "r");
-	if (!fp)
-		return -1;
+	while (*role) {
+		hash ^= (unsigned char)*role++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
 
-	if (find_default_type(fp, role, type) < 0) {
-		fclose(fp);
+static void default_type_flush(void)
+{
+	size_t i;
+
+	for (i = 0; i < default_type_cache.nentries; i++)
+		free(default_type_cache.entries[i].role);
+	free(default_type_cache.entries);
+	free(default_type_cache.buckets);
+	free(default_type_cache.path);
+	memset(&default_type_cache, 0, sizeof(default_type_cache));
+}
+
+static int default_type_index(void)
+{
+	struct default_type *ent, **pp;
+	size_t i, nbuckets;
+
+	for (nbuckets = 16; nbuckets < default_type_cache.nentries;
+	     nbuckets <<= 1) ;
+	default_type_cache.buckets = calloc(nbuckets,
+					    sizeof(*default_type_cache.buckets));
+	if (!default_type_cache.buckets)
 		return -1;
-	}
+	default_type_cache.mask = nbuckets - 1;
 
-	fclose(fp);
+	for (i = 0; i < default_type_cache.nentries; i++) {
+		ent = &default_type_cache.entries[i];
+		ent->hash = role_hash(ent->role);
+		ent->next = NULL;
+		/* append, so the first entry for a role is found first */
+		for (pp = &default_type_cache.buckets[ent->hash &
+						      default_type_cache.mask];
+		     *pp; pp = &(*pp)->next) ;
+		*pp = ent;
+	}
 	return 0;
 }
 
-static int find_default_type(FILE * fp, const char *role, char **type)
+/* Split a "role:type" line in place.  Returns 0 if it is one. */
+static int parse_default_type(char *buf, char **role, char **type)
 {
-	char buf[250];
-	const char *ptr = "", *end;
-	char *t;
+	char *ptr, *sep;
 	size_t len;
-	int found = 0;
 
-	len = strlen(role);
-	while (!feof_unlocked(fp)) {
-		if (!fgets_unlocked(buf, sizeof buf, fp)) {
-			errno = EINVAL;
-			return -1;
-		}
-		if (buf[strlen(buf) - 1])
-			buf[strlen(buf) - 1] = 0;
+	len = strlen(buf);
+	if (len && buf[len - 1] == '\n')
+		buf[--len] = 0;
 
-		ptr = buf;
-		while (*ptr && isspace(*ptr))
-			ptr++;
-		if (!(*ptr))
+	ptr = buf;
+	while (*ptr && isspace(*ptr))
+		ptr++;
+	if (!(*ptr))
+		return -1;
+
+	sep = strchr(ptr, ':');
+	if (!sep)
+		return -1;
+	*sep = 0;
+	*role = ptr;
+	*type = sep + 1;
+	return 0;
+}
+
+/* Whether the cache was loaded from the file path and sb describe. */
+static int default_type_current(const char *path, const struct stat *sb)
+{
+	return default_type_cache.path &&
+	    !strcmp(default_type_cache.path, path) &&
+	    default_type_cache.dev == sb->st_dev &&
+	    default_type_cache.ino == sb->st_ino &&
+	    default_type_cache.size == sb->st_size &&
+	    default_type_cache.mtime.tv_sec == sb->st_mtim.tv_sec &&
+	    default_type_cache.mtime.tv_nsec == sb->st_mtim.tv_nsec;
+}
+
+/* Make the cache match the file at path.  Returns -1 if it can not be read. */
+static int default_type_load(const char *path)
+{
+	struct default_type *ent;
+	struct stat sb;
+	FILE *fp;
+	size_t size = 0, alloc = 0;
+	char *buffer = NULL, *role, *type;
+
+	/* an unchanged file is not even opened */
+	if (stat(path, &sb) == 0 && default_type_current(path, &sb))
+		return 0;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		default_type_flush();
+		return -1;
+	}
+	if (fstat(fileno(fp), &sb) < 0) {
+		fclose(fp);
+		default_type_flush();
+		return -1;
+	}
+	if (default_type_current(path, &sb)) {
+		fclose(fp);
+		return 0;
+	}
+
+	default_type_flush();
+	default_type_cache.path = strdup(path);
+	if (!default_type_cache.path)
+		goto err;
+
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+	while (getline(&buffer, &size, fp) > 0) {
+		if (parse_default_type(buffer, &role, &type) < 0)
 			continue;
+		if (default_type_cache.nentries == alloc) {
+			struct default_type *tmp;
 
-		if (!strncmp(role, ptr, len)) {
-			end = ptr + len;
-			if (*end == ':') {
-				found = 1;
-				ptr = ++end;
-				break;
-			}
+			alloc = alloc ? alloc * 2 : 16;
+			tmp = realloc(default_type_cache.entries,
+				      alloc * sizeof(*tmp));
+			if (!tmp)
+				goto err;
+			default_type_cache.entries = tmp;
 		}
+		ent = &default_type_cache.entries[default_type_cache.nentries];
+		/* role and type share one allocation */
+		ent->role = malloc(strlen(role) + strlen(type) + 2);
+		if (!ent->role)
+			goto err;
+		strcpy(ent->role, role);
+		ent->type = ent->role + strlen(role) + 1;
+		strcpy(ent->type, type);
+		default_type_cache.nentries++;
 	}
+	free(buffer);
+	buffer = NULL;
 
-	if (!found) {
-		errno = EINVAL;
+	if (default_type_index() < 0)
+		goto err;
+
+	default_type_cache.dev = sb.st_dev;
+	default_type_cache.ino = sb.st_ino;
+	default_type_cache.size = sb.st_size;
+	default_type_cache.mtime = sb.st_mtim;
+	fclose(fp);
+	return 0;
+
+      err:
+	free(buffer);
+	fclose(fp);
+	default_type_flush();
+	return -1;
+}
+
+int get_default_type(const char *role, char **type)
+{
+	struct default_type *ent = NULL;
+	uint32_t hash;
+	char *t = NULL;
+
+	__selinux_mutex_lock(&default_type_lock);
+	if (default_type_load(selinux_default_type_path()) < 0) {
+		__selinux_mutex_unlock(&default_type_lock);
 		return -1;
 	}
 
-	t = malloc(strlen(buf) - len);
+	hash = role_hash(role);
+	for (ent = default_type_cache.buckets[hash & default_type_cache.mask];
+	     ent; ent = ent->next)
+		if (ent->hash == hash && !strcmp(ent->role, role))
+			break;
+	if (ent)
+		t = strdup(ent->type);
+	__selinux_mutex_unlock(&default_type_lock);
+
+	if (!ent) {
+		errno = EINVAL;
+		return -1;
+	}
 	if (!t)
 		return -1;
-	strcpy(t, ptr);
 	*type = t;
 	return 0;
 }
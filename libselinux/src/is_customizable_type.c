@@ -1,93 +1,203 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-#include <pwd.h>
-#include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include "selinux_internal.h"
-#include "context_internal.h"
 
-static int get_customizable_type_list(char *** retlist)
+/*
+ * The customizable_types file is loaded into a hash set of type names,
+ * shared by all threads, and loaded again only when the file changes.
+ */
+struct customizable_type {
+	char *type;
+	size_t len;
+	uint32_t hash;
+	struct customizable_type *next;	/* in the type hash chain */
+};
+
+static struct {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct customizable_type *entries;
+	size_t nentries;
+	struct customizable_type **buckets;
+	size_t mask;
+} customizable_cache;
+
+static pthread_mutex_t customizable_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t type_hash(const char *type, size_t len)
 {
-	FILE *fp;
-	char *buf;
-	unsigned int ctr = 0, i;
-	char **list = NULL;
+	uint32_t hash = 2166136261U;
+
+	while (len--) {
+		hash ^= (unsigned char)*type++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void customizable_flush(void)
+{
+	size_t i;
 
-	fp = fopen(selinux_customizable_types_path(), "r");
-	if (!fp)
+	for (i = 0; i < customizable_cache.nentries; i++)
+		free(customizable_cache.entries[i].type);
+	free(customizable_cache.entries);
+	free(customizable_cache.buckets);
+	free(customizable_cache.path);
+	memset(&customizable_cache, 0, sizeof(customizable_cache));
+}
+
+static int customizable_index(void)
+{
+	struct customizable_type *ent;
+	size_t i, nbuckets, b;
+
+	for (nbuckets = 16; nbuckets < customizable_cache.nentries;
+	     nbuckets <<= 1) ;
+	customizable_cache.buckets = calloc(nbuckets,
+					    sizeof(*customizable_cache.buckets));
+	if (!customizable_cache.buckets)
 		return -1;
+	customizable_cache.mask = nbuckets - 1;
+
+	for (i = 0; i < customizable_cache.nentries; i++) {
+		ent = &customizable_cache.entries[i];
+		ent->hash = type_hash(ent->type, ent->len);
+		b = ent->hash & customizable_cache.mask;
+		ent->next = customizable_cache.buckets[b];
+		customizable_cache.buckets[b] = ent;
+	}
+	return 0;
+}
+
+/* Whether the cache was loaded from the file path and sb describe. */
+static int customizable_current(const char *path, const struct stat *sb)
+{
+	return customizable_cache.path &&
+	    !strcmp(customizable_cache.path, path) &&
+	    customizable_cache.dev == sb->st_dev &&
+	    customizable_cache.ino == sb->st_ino &&
+	    customizable_cache.size == sb->st_size &&
+	    customizable_cache.mtime.tv_sec == sb->st_mtim.tv_sec &&
+	    customizable_cache.mtime.tv_nsec == sb->st_mtim.tv_nsec;
+}
+
+/* Make the cache match the file at path.  Returns -1 if it can not be
+ * read or lists no type. */
+static int customizable_load(const char *path)
+{
+	struct customizable_type *ent;
+	struct stat sb;
+	FILE *fp;
+	size_t size = 0, alloc = 0;
+	ssize_t len;
+	char *buffer = NULL;
 
-	buf = malloc(selinux_page_size);
-	if (!buf) {
+	/* an unchanged file is not even opened */
+	if (stat(path, &sb) == 0 && customizable_current(path, &sb))
+		return customizable_cache.nentries ? 0 : -1;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		customizable_flush();
+		return -1;
+	}
+	if (fstat(fileno(fp), &sb) < 0) {
 		fclose(fp);
+		customizable_flush();
 		return -1;
 	}
-	while (fgets_unlocked(buf, selinux_page_size, fp) && ctr < UINT_MAX) {
-		ctr++;
+	if (customizable_current(path, &sb)) {
+		fclose(fp);
+		return customizable_cache.nentries ? 0 : -1;
 	}
-	rewind(fp);
-	if (ctr) {
-		list =
-		    (char **) calloc(sizeof(char *),
-						  ctr + 1);
-		if (list) {
-			i = 0;
-			while (fgets_unlocked(buf, selinux_page_size, fp)
-			       && i < ctr) {
-				buf[strlen(buf) - 1] = 0;
-				list[i] = (char *) strdup(buf);
-				if (!list[i]) {
-					unsigned int j;
-					for (j = 0; j < i; j++)
-						free(list[j]);
-					free(list);
-					list = NULL;
-					break;
-				}
-				i++;
-			}
+
+	customizable_flush();
+	customizable_cache.path = strdup(path);
+	if (!customizable_cache.path)
+		goto err;
+
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+	while ((len = getline(&buffer, &size, fp)) > 0) {
+		if (buffer[len - 1] == '\n')
+			buffer[--len] = 0;
+		if (customizable_cache.nentries == alloc) {
+			struct customizable_type *tmp;
+
+			alloc = alloc ? alloc * 2 : 16;
+			tmp = realloc(customizable_cache.entries,
+				      alloc * sizeof(*tmp));
+			if (!tmp)
+				goto err;
+			customizable_cache.entries = tmp;
 		}
+		ent = &customizable_cache.entries[customizable_cache.nentries];
+		ent->type = strdup(buffer);
+		if (!ent->type)
+			goto err;
+		ent->len = len;
+		customizable_cache.nentries++;
 	}
+	free(buffer);
+	buffer = NULL;
+
+	if (customizable_index() < 0)
+		goto err;
+
+	customizable_cache.dev = sb.st_dev;
+	customizable_cache.ino = sb.st_ino;
+	customizable_cache.size = sb.st_size;
+	customizable_cache.mtime = sb.st_mtim;
 	fclose(fp);
-	free(buf);
-	if (!list)
-		return -1;
-	*retlist = list;
-	return 0;
-}
+	return customizable_cache.nentries ? 0 : -1;
 
-static char **customizable_list = NULL;
+      err:
+	free(buffer);
+	fclose(fp);
+	customizable_flush();
+	return -1;
+}
 
 int is_context_customizable(const char * scontext)
 {
-	int i;
-	const char *type;
-	context_t c;
+	struct customizable_type *ent;
+	const char *type, *end;
+	size_t len;
+	uint32_t hash;
 
-	if (!customizable_list) {
-		if (get_customizable_type_list(&customizable_list) != 0)
-			return -1;
-	}
-
-	c = context_new(scontext);
-	if (!c)
-		return -1;
-
-	type = context_type_get(c);
+	/* the type is the third field of user:role:type[:range] */
+	type = strchr(scontext, ':');
+	if (type)
+		type = strchr(type + 1, ':');
 	if (!type) {
-		context_free(c);
+		errno = EINVAL;
 		return -1;
 	}
+	type++;
+	end = strchrnul(type, ':');
+	len = end - type;
+	hash = type_hash(type, len);
 
-	for (i = 0; customizable_list[i]; i++) {
-		if (strcmp(customizable_list[i], type) == 0) {
-			context_free(c);
-			return 1;
-		}
+	__selinux_mutex_lock(&customizable_lock);
+	if (customizable_load(selinux_customizable_types_path()) < 0) {
+		__selinux_mutex_unlock(&customizable_lock);
+		return -1;
 	}
-	context_free(c);
-	return 0;
+	for (ent = customizable_cache.buckets[hash & customizable_cache.mask];
+	     ent; ent = ent->next)
+		if (ent->hash == hash && ent->len == len &&
+		    !memcmp(ent->type, type, len))
+			break;
+	__selinux_mutex_unlock(&customizable_lock);
+
+	return ent != NULL;
 }
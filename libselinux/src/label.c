@@ -5,7 +5,11 @@
  */
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,6 +17,7 @@
 #include <selinux/selinux.h>
 #include "callbacks.h"
 #include "label_internal.h"
+#include "selinux_trace.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -40,28 +45,112 @@ static void selabel_subs_fini(struct selabel_sub *ptr)
 	}
 }
 
-static char *selabel_sub(struct selabel_sub *ptr, const char *src)
+static uint32_t selabel_sub_hash_step(uint32_t hash, char c)
 {
-	char *dst = NULL;
-	int len;
+	return (hash ^ (unsigned char)c) * 16777619U;
+}
 
-	while (ptr) {
-		if (strncmp(src, ptr->src, ptr->slen) == 0 ) {
-			if (src[ptr->slen] == '/' || 
-			    src[ptr->slen] == 0) {
-				if ((src[ptr->slen] == '/') &&
-				    (strcmp(ptr->dst, "/") == 0))
-					len = ptr->slen + 1;
-				else
-					len = ptr->slen;
-				if (asprintf(&dst, "%s%s", ptr->dst, &src[len]) < 0)
-					return NULL;
-				return dst;
-			}
+static uint32_t selabel_sub_hash(const char *str)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*str)
+		hash = selabel_sub_hash_step(hash, *str++);
+	return hash;
+}
+
+/* Index the list; on failure lookups just walk it. */
+static void selabel_subs_index(struct selabel_sub_table *t,
+			       struct selabel_sub *list)
+{
+	struct selabel_sub *ptr, *e;
+	uint32_t n = 0, nbuckets = 16;
+
+	for (ptr = list; ptr; ptr = ptr->next)
+		ptr->prio = n++;
+	if (!n)
+		return;
+	while (nbuckets < n * 2)
+		nbuckets <<= 1;
+	t->buckets = calloc(nbuckets, sizeof(*t->buckets));
+	if (!t->buckets)
+		return;
+	t->mask = nbuckets - 1;
+
+	for (ptr = list; ptr; ptr = ptr->next) {
+		ptr->hash = selabel_sub_hash(ptr->src);
+		/* an earlier entry for the same path always wins */
+		for (e = t->buckets[ptr->hash & t->mask]; e; e = e->hnext)
+			if (e->hash == ptr->hash && !strcmp(e->src, ptr->src))
+				break;
+		if (e)
+			continue;
+		ptr->hnext = t->buckets[ptr->hash & t->mask];
+		t->buckets[ptr->hash & t->mask] = ptr;
+	}
+}
+
+/* The first entry in the list whose src is src or a directory above it */
+static struct selabel_sub *selabel_sub_find(const struct selabel_sub_table *t,
+					    struct selabel_sub *ptr,
+					    const char *src)
+{
+	struct selabel_sub *best = NULL, *e;
+	uint32_t hash = 2166136261U;
+	int i;
+
+	if (!t->buckets) {
+		for (; ptr; ptr = ptr->next)
+			if (strncmp(src, ptr->src, ptr->slen) == 0 &&
+			    (src[ptr->slen] == '/' || src[ptr->slen] == 0))
+				return ptr;
+		return NULL;
+	}
+
+	for (i = 0;; i++) {
+		if (i > 0 && (src[i] == '/' || src[i] == 0)) {
+			for (e = t->buckets[hash & t->mask]; e; e = e->hnext)
+				if (e->hash == hash && e->slen == i &&
+				    !memcmp(e->src, src, i) &&
+				    (!best || e->prio < best->prio))
+					best = e;
 		}
-		ptr = ptr->next;
+		if (!src[i])
+			break;
+		hash = selabel_sub_hash_step(hash, src[i]);
 	}
-	return NULL;
+	return best;
+}
+
+/*
+ * Substitute src into buf if it fits, else into allocated memory.
+ * Returns NULL if no substitution applies.
+ */
+static char *selabel_sub(const struct selabel_sub_table *t,
+			 struct selabel_sub *list, const char *src,
+			 char *buf, size_t size)
+{
+	struct selabel_sub *ptr;
+	char *dst;
+	size_t dlen, rlen;
+	int len;
+
+	ptr = selabel_sub_find(t, list, src);
+	if (!ptr)
+		return NULL;
+
+	if ((src[ptr->slen] == '/') && (strcmp(ptr->dst, "/") == 0))
+		len = ptr->slen + 1;
+	else
+		len = ptr->slen;
+	dlen = strlen(ptr->dst);
+	rlen = strlen(&src[len]);
+	dst = dlen + rlen < size ? buf : malloc(dlen + rlen + 1);
+	if (!dst)
+		return NULL;
+	memcpy(dst, ptr->dst, dlen);
+	memcpy(dst + dlen, &src[len], rlen + 1);
+	return dst;
 }
 
 struct selabel_sub *selabel_subs_init(const char *path, struct selabel_sub *list)
@@ -124,6 +213,23 @@ err:
 	goto out;
 }
 
+void selabel_subs_replace(struct selabel_handle *rec,
+			  struct selabel_sub *dist_subs,
+			  struct selabel_sub *subs)
+{
+	selabel_subs_fini(rec->subs);
+	selabel_subs_fini(rec->dist_subs);
+	free(rec->subs_table.buckets);
+	free(rec->dist_subs_table.buckets);
+	memset(&rec->subs_table, 0, sizeof(rec->subs_table));
+	memset(&rec->dist_subs_table, 0, sizeof(rec->dist_subs_table));
+
+	rec->subs = subs;
+	rec->dist_subs = dist_subs;
+	selabel_subs_index(&rec->subs_table, rec->subs);
+	selabel_subs_index(&rec->dist_subs_table, rec->dist_subs);
+}
+
 /*
  * Validation functions
  */
@@ -182,8 +288,12 @@ struct selabel_handle *selabel_open(unsigned int backend,
 	if ((*initfuncs[backend])(rec, opts, nopts)) {
 		free(rec);
 		rec = NULL;
+		goto out;
 	}
 
+	selabel_subs_index(&rec->subs_table, rec->subs);
+	selabel_subs_index(&rec->dist_subs_table, rec->dist_subs);
+
 out:
 	return rec;
 }
@@ -193,6 +303,7 @@ selabel_lookup_common(struct selabel_handle *rec, int translating,
 		      const char *key, int type)
 {
 	struct selabel_lookup_rec *lr;
+	char buf[2][PATH_MAX];
 	char *ptr = NULL;
 	char *dptr = NULL;
 
@@ -201,22 +312,30 @@ selabel_lookup_common(struct selabel_handle *rec, int translating,
 		return NULL;
 	}
 
-	ptr = selabel_sub(rec->subs, key);
+	SELINUX_PROBE2(selabel_lookup_entry, key, type);
+
+	ptr = selabel_sub(&rec->subs_table, rec->subs, key,
+			  buf[0], sizeof(buf[0]));
 	if (ptr) {
-		dptr = selabel_sub(rec->dist_subs, ptr);
+		dptr = selabel_sub(&rec->dist_subs_table, rec->dist_subs, ptr,
+				   buf[1], sizeof(buf[1]));
 		if (dptr) {
-			free(ptr);
+			if (ptr != buf[0])
+				free(ptr);
 			ptr = dptr;
 		}
 	} else {
-		ptr = selabel_sub(rec->dist_subs, key);
+		ptr = selabel_sub(&rec->dist_subs_table, rec->dist_subs, key,
+				  buf[1], sizeof(buf[1]));
 	}
 	if (ptr) {
 		lr = rec->func_lookup(rec, ptr, type); 
-		free(ptr);
+		if (ptr != buf[0] && ptr != buf[1])
+			free(ptr);
 	} else {
 		lr = rec->func_lookup(rec, key, type); 
 	}
+	SELINUX_PROBE2(selabel_lookup_return, key, lr ? lr->ctx_raw : NULL);
 	if (!lr)
 		return NULL;
 
@@ -256,10 +375,218 @@ int selabel_lookup_raw(struct selabel_handle *rec, char **con,
 	return *con ? 0 : -1;
 }
 
+/*
+ * Spec lookup index
+ */
+
+/* FNV-1a, seeded with the type */
+static unsigned int index_hash(const char *key, int type)
+{
+	unsigned int hash = 2166136261U ^ (unsigned int)type;
+
+	for (; *key; key++) {
+		hash ^= (unsigned char)*key;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+int selabel_index_init(struct selabel_index *ix, unsigned int nspec)
+{
+	unsigned int nbuckets = 16;
+
+	memset(ix, 0, sizeof(*ix));
+	while (nbuckets < nspec && nbuckets < (1U << 31))
+		nbuckets <<= 1;
+
+	ix->key = calloc(nspec ? nspec : 1, sizeof(*ix->key));
+	ix->type = calloc(nspec ? nspec : 1, sizeof(*ix->type));
+	ix->hash = calloc(nspec ? nspec : 1, sizeof(*ix->hash));
+	ix->next = calloc(nspec ? nspec : 1, sizeof(*ix->next));
+	ix->pattern = calloc(nspec ? nspec : 1, sizeof(*ix->pattern));
+	ix->head = calloc(nbuckets, sizeof(*ix->head));
+	if (!ix->key || !ix->type || !ix->hash || !ix->next ||
+	    !ix->pattern || !ix->head) {
+		selabel_index_destroy(ix);
+		return -1;
+	}
+	ix->nspec = nspec;
+	ix->mask = nbuckets - 1;
+	return 0;
+}
+
+void selabel_index_add(struct selabel_index *ix, unsigned int i,
+		       const char *key, int type, int literal)
+{
+	unsigned int *link;
+
+	ix->key[i] = key;
+	ix->type[i] = type;
+	if (!literal) {
+		ix->pattern[ix->npattern++] = i;
+		return;
+	}
+
+	/* append, so each chain stays in file order */
+	ix->hash[i] = index_hash(key, type);
+	for (link = &ix->head[ix->hash[i] & ix->mask]; *link;
+	     link = &ix->next[*link - 1])
+		;
+	*link = i + 1;
+}
+
+int selabel_index_lookup(const struct selabel_index *ix, const char *key,
+			 int type, int (*match) (const char *pattern,
+						 const char *key))
+{
+	unsigned int hash = index_hash(key, type), n, i;
+	int found = -1;
+
+	if (!ix->head)
+		return -1;
+
+	for (n = ix->head[hash & ix->mask]; n; n = ix->next[n - 1]) {
+		i = n - 1;
+		if (ix->hash[i] == hash && ix->type[i] == type &&
+		    !strcmp(ix->key[i], key)) {
+			found = i;
+			break;
+		}
+	}
+
+	/* an earlier pattern still wins over the literal hit */
+	for (n = 0; n < ix->npattern; n++) {
+		i = ix->pattern[n];
+		if (found >= 0 && i > (unsigned int)found)
+			break;
+		if (ix->type[i] == type && match(ix->key[i], key))
+			return i;
+	}
+	return found;
+}
+
+void selabel_index_destroy(struct selabel_index *ix)
+{
+	free(ix->key);
+	free(ix->type);
+	free(ix->hash);
+	free(ix->head);
+	free(ix->next);
+	free(ix->pattern);
+	memset(ix, 0, sizeof(*ix));
+}
+
+/*
+ * Compiled specification files
+ */
+
+int selabel_compiled_open(struct selabel_compiled *c, const char *path,
+			  const struct stat *sb, unsigned int backend)
+{
+	char bin_path[PATH_MAX + 1];
+	struct stat bin_sb;
+	uint32_t *hdr;
+	void *addr;
+	int fd;
+
+	memset(c, 0, sizeof(*c));
+	if (snprintf(bin_path, sizeof(bin_path), "%s.bin", path) >=
+	    (int)sizeof(bin_path))
+		return 0;
+
+	fd = open(bin_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &bin_sb) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	/* if the compiled file is older than the text, ignore it */
+	if (bin_sb.st_mtime < sb->st_mtime ||
+	    (bin_sb.st_mtime == sb->st_mtime &&
+	     bin_sb.st_mtim.tv_nsec < sb->st_mtim.tv_nsec) ||
+	    bin_sb.st_size < (off_t)(4 * sizeof(uint32_t))) {
+		close(fd);
+		return 0;
+	}
+
+	addr = mmap(NULL, bin_sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return -1;
+
+	hdr = addr;
+	if (hdr[0] != SELINUX_MAGIC_COMPILED_SPECS ||
+	    hdr[1] != SELINUX_COMPILED_SPECS_VERSION || hdr[2] != backend) {
+		selinux_log(SELINUX_WARNING,
+			    "%s:  not a compiled file for this backend, ignored\n",
+			    bin_path);
+		munmap(addr, bin_sb.st_size);
+		return 0;
+	}
+
+	c->addr = addr;
+	c->len = bin_sb.st_size;
+	c->nspec = hdr[3];
+	c->off = 4 * sizeof(uint32_t);
+	return 1;
+}
+
+static const char *compiled_string(struct selabel_compiled *c)
+{
+	const char *str;
+	uint32_t len;
+
+	if (c->len - c->off < sizeof(uint32_t))
+		return NULL;
+	memcpy(&len, c->addr + c->off, sizeof(uint32_t));
+	c->off += sizeof(uint32_t);
+	if (!len || c->len - c->off < len)
+		return NULL;
+	str = c->addr + c->off;
+	if (str[len - 1] != '\0')
+		return NULL;
+	c->off += len;
+	return str;
+}
+
+int selabel_compiled_spec(struct selabel_compiled *c, int *type,
+			  const char **key, const char **ctx)
+{
+	uint32_t val;
+
+	if (c->len - c->off < sizeof(uint32_t))
+		goto bad;
+	memcpy(&val, c->addr + c->off, sizeof(uint32_t));
+	c->off += sizeof(uint32_t);
+	*type = val;
+
+	*key = compiled_string(c);
+	if (!*key)
+		goto bad;
+	*ctx = compiled_string(c);
+	if (!*ctx)
+		goto bad;
+	return 0;
+bad:
+	errno = EINVAL;
+	return -1;
+}
+
+void selabel_compiled_close(struct selabel_compiled *c)
+{
+	if (c->addr)
+		munmap(c->addr, c->len);
+	memset(c, 0, sizeof(*c));
+}
+
 void selabel_close(struct selabel_handle *rec)
 {
 	selabel_subs_fini(rec->subs);
 	selabel_subs_fini(rec->dist_subs);
+	free(rec->subs_table.buckets);
+	free(rec->dist_subs_table.buckets);
 	rec->func_close(rec);
 	free(rec->spec_file);
 	free(rec);
@@ -269,3 +596,12 @@ void selabel_stats(struct selabel_handle *rec)
 {
 	rec->func_stats(rec);
 }
+
+int selabel_reload(struct selabel_handle *rec)
+{
+	if (!rec->func_reload) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	return rec->func_reload(rec);
+}
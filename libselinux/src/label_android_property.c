@@ -17,6 +17,9 @@
 typedef struct spec {
 	struct selabel_lookup_rec lr;	/* holds contexts for lookup result */
 	char *property_key;	/* property key string */
+	size_t len;		/* length of property_key */
+	unsigned int hash;	/* hash of property_key */
+	unsigned int next;	/* next spec in hash bucket + 1 */
 } spec_t;
 
 /* Our stored configuration */
@@ -27,8 +30,22 @@ struct saved_data {
 	 */
 	spec_t *spec_arr;
 	unsigned int nspec;	/* total number of specifications */
+
+	/*
+	 * Non-wildcard keys are hashed, and the distinct key lengths
+	 * kept in ascending order, so a lookup hashes the prefixes of
+	 * the key of just those lengths and keeps the longest hit.
+	 */
+	unsigned int *buckets;	/* first spec + 1 */
+	unsigned int mask;
+	size_t *lengths;
+	unsigned int nlengths;
+	int wildcard;		/* first "*" spec, or -1 */
 };
 
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME 16777619U
+
 static int cmp(const void *A, const void *B)
 {
 	const struct spec *sp1 = A, *sp2 = B;
@@ -130,6 +147,54 @@ static int process_line(struct selabel_handle *rec,
 	return 0;
 }
 
+static int cmp_len(const void *A, const void *B)
+{
+	size_t L1 = *(const size_t *)A, L2 = *(const size_t *)B;
+
+	return (L1 > L2) - (L1 < L2);
+}
+
+static int build_index(struct saved_data *data)
+{
+	unsigned int i, n, nbuckets = 16;
+	const char *p;
+	spec_t *spec;
+
+	while (nbuckets < data->nspec && nbuckets < (1U << 31))
+		nbuckets <<= 1;
+	data->buckets = calloc(nbuckets, sizeof(*data->buckets));
+	data->lengths = malloc(data->nspec * sizeof(*data->lengths));
+	if (!data->buckets || !data->lengths)
+		return -1;
+	data->mask = nbuckets - 1;
+	data->wildcard = -1;
+
+	/* walk backwards so that each chain is in array order */
+	for (i = data->nspec; i-- > 0; ) {
+		spec = &data->spec_arr[i];
+		if (spec->property_key[0] == '*') {
+			data->wildcard = i;
+			continue;
+		}
+		spec->len = strlen(spec->property_key);
+		spec->hash = FNV_OFFSET;
+		for (p = spec->property_key; *p; p++) {
+			spec->hash ^= (unsigned char)*p;
+			spec->hash *= FNV_PRIME;
+		}
+		spec->next = data->buckets[spec->hash & data->mask];
+		data->buckets[spec->hash & data->mask] = i + 1;
+		data->lengths[data->nlengths++] = spec->len;
+	}
+
+	qsort(data->lengths, data->nlengths, sizeof(*data->lengths), cmp_len);
+	for (i = n = 0; i < data->nlengths; i++)
+		if (!n || data->lengths[n - 1] != data->lengths[i])
+			data->lengths[n++] = data->lengths[i];
+	data->nlengths = n;
+	return 0;
+}
+
 static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 		unsigned n)
 {
@@ -208,6 +273,9 @@ static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 
 	qsort(data->spec_arr, data->nspec, sizeof(struct spec), cmp);
 
+	if (build_index(data) < 0)
+		goto finish;
+
 	status = 0;
 finish:
 	fclose(fp);
@@ -232,6 +300,8 @@ static void closef(struct selabel_handle *rec)
 
 	if (data->spec_arr)
 		free(data->spec_arr);
+	free(data->buckets);
+	free(data->lengths);
 
 	free(data);
 }
@@ -242,7 +312,9 @@ static struct selabel_lookup_rec *lookup(struct selabel_handle *rec,
 {
 	struct saved_data *data = (struct saved_data *)rec->data;
 	spec_t *spec_arr = data->spec_arr;
-	unsigned int i;
+	unsigned int hash = FNV_OFFSET, l, n;
+	size_t len = 0;
+	int i = -1;
 	struct selabel_lookup_rec *ret = NULL;
 
 	if (!data->nspec) {
@@ -250,16 +322,28 @@ static struct selabel_lookup_rec *lookup(struct selabel_handle *rec,
 		goto finish;
 	}
 
-	for (i = 0; i < data->nspec; i++) {
-		if (strncmp(spec_arr[i].property_key, key,
-			    strlen(spec_arr[i].property_key)) == 0) {
-			break;
+	/* longest non-wildcard key that is a prefix of the key */
+	for (l = 0; l < data->nlengths; l++) {
+		for (; len < data->lengths[l] && key[len]; len++) {
+			hash ^= (unsigned char)key[len];
+			hash *= FNV_PRIME;
 		}
-		if (strncmp(spec_arr[i].property_key, "*", 1) == 0)
+		if (len < data->lengths[l])
 			break;
+		for (n = data->buckets[hash & data->mask]; n;
+		     n = spec_arr[n - 1].next) {
+			spec_t *spec = &spec_arr[n - 1];
+			if (spec->hash == hash && spec->len == len &&
+			    !memcmp(spec->property_key, key, len)) {
+				i = n - 1;
+				break;
+			}
+		}
 	}
 
-	if (i >= data->nspec) {
+	if (i < 0)
+		i = data->wildcard;
+	if (i < 0) {
 		/* No matching specification. */
 		errno = ENOENT;
 		goto finish;
@@ -81,9 +81,17 @@ typedef struct spec {
 typedef struct catalog {
 	unsigned int	nspec;	/* number of specs in use */
 	unsigned int	limit;	/* physical limitation of specs[] */
+	struct selabel_index index;	/* built once the file is read */
+	struct selabel_compiled compiled;	/* keys point into it */
 	spec_t		specs[0];
 } catalog_t;
 
+static int
+db_match(const char *pattern, const char *key)
+{
+	return !fnmatch(pattern, key, 0);
+}
+
 /*
  * Helper function to parse a line read from the specfile
  */
@@ -176,10 +184,13 @@ db_close(struct selabel_handle *rec)
 
 	for (i = 0; i < catalog->nspec; i++) {
 		spec = &catalog->specs[i];
-		free(spec->key);
+		if (!catalog->compiled.addr)
+			free(spec->key);
 		free(spec->lr.ctx_raw);
 		free(spec->lr.ctx_trans);
 	}
+	selabel_index_destroy(&catalog->index);
+	selabel_compiled_close(&catalog->compiled);
 	free(catalog);
 }
 
@@ -191,18 +202,14 @@ db_lookup(struct selabel_handle *rec, const char *key, int type)
 {
 	catalog_t      *catalog = (catalog_t *)rec->data;
 	spec_t	       *spec;
-	unsigned int	i;
+	int		i;
 
-	for (i = 0; i < catalog->nspec; i++) {
+	i = selabel_index_lookup(&catalog->index, key, type, db_match);
+	if (i >= 0) {
 		spec = &catalog->specs[i];
+		spec->matches++;
 
-		if (spec->type != type)
-			continue;
-		if (!fnmatch(spec->key, key, 0)) {
-			spec->matches++;
-
-			return &spec->lr;
-		}
+		return &spec->lr;
 	}
 
 	/* No found */
@@ -226,6 +233,42 @@ db_stats(struct selabel_handle *rec)
 		    catalog->nspec, total);
 }
 
+/*
+ * Load the entries from a compiled specfile
+ */
+static int
+db_load_compiled(catalog_t **p_catalog)
+{
+	catalog_t      *catalog = *p_catalog;
+	const char     *key, *context;
+	int		type;
+
+	if (catalog->compiled.nspec > catalog->limit) {
+		catalog = realloc(catalog, sizeof(catalog_t)
+				  + catalog->compiled.nspec * sizeof(spec_t));
+		if (!catalog)
+			return -1;
+		catalog->limit = catalog->compiled.nspec;
+		*p_catalog = catalog;
+	}
+
+	while (catalog->nspec < catalog->compiled.nspec) {
+		spec_t	       *spec = &catalog->specs[catalog->nspec];
+
+		if (selabel_compiled_spec(&catalog->compiled, &type,
+					  &key, &context) < 0)
+			return -1;
+		memset(spec, 0, sizeof(spec_t));
+		spec->type = type;
+		spec->key = (char *)key;
+		spec->lr.ctx_raw = strdup(context);
+		if (!spec->lr.ctx_raw)
+			return -1;
+		catalog->nspec++;
+	}
+	return 0;
+}
+
 /*
  * selabel_open() handler
  */
@@ -239,6 +282,8 @@ db_init(struct selinux_opt *opts, unsigned nopts, struct selabel_handle *rec)
 	size_t		line_len = 0;
 	unsigned int	line_num = 0;
 	unsigned int	i;
+	struct stat	sb;
+	int		rc;
 
 	/*
 	 * Initialize catalog data structure
@@ -248,6 +293,8 @@ db_init(struct selinux_opt *opts, unsigned nopts, struct selabel_handle *rec)
 		return NULL;
 	catalog->limit = 32;
 	catalog->nspec = 0;
+	memset(&catalog->index, 0, sizeof(catalog->index));
+	memset(&catalog->compiled, 0, sizeof(catalog->compiled));
 
 	/*
 	 * Process arguments
@@ -277,6 +324,20 @@ db_init(struct selinux_opt *opts, unsigned nopts, struct selabel_handle *rec)
 	}
 	rec->spec_file = strdup(path);
 
+	/*
+	 * Use the compiled specfile, if there is an up to date one
+	 */
+	rc = fstat(fileno(filp), &sb);
+	if (rc == 0)
+		rc = selabel_compiled_open(&catalog->compiled, path, &sb,
+					   SELABEL_CTX_DB);
+	if (rc != 0) {
+		fclose(filp);
+		if (rc < 0 || db_load_compiled(&catalog) < 0)
+			goto out_error;
+		goto out_index;
+	}
+
 	/*
 	 * Parse for each lines
 	 */
@@ -309,16 +370,32 @@ db_init(struct selinux_opt *opts, unsigned nopts, struct selabel_handle *rec)
 
 	fclose(filp);
 
+out_index:
+	/*
+	 * Index the entries; most object names carry no wildcards
+	 */
+	if (selabel_index_init(&catalog->index, catalog->nspec) < 0)
+		goto out_error;
+	for (i = 0; i < catalog->nspec; i++) {
+		spec_t	       *spec = &catalog->specs[i];
+
+		selabel_index_add(&catalog->index, i, spec->key, spec->type,
+				  !strpbrk(spec->key, "*?[\\"));
+	}
+
 	return catalog;
 
 out_error:
 	for (i = 0; i < catalog->nspec; i++) {
 		spec_t	       *spec = &catalog->specs[i];
 
-		free(spec->key);
+		if (!catalog->compiled.addr)
+			free(spec->key);
 		free(spec->lr.ctx_raw);
 		free(spec->lr.ctx_trans);
 	}
+	selabel_index_destroy(&catalog->index);
+	selabel_compiled_close(&catalog->compiled);
 	free(catalog);
 
 	return NULL;
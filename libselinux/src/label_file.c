@@ -54,16 +54,361 @@ static int find_stem_from_file(struct saved_data *data, const char **buf)
 
 	if (!stem_len)
 		return -1;
-	for (i = 0; i < data->num_stems; i++) {
-		if (stem_len == data->stem_arr[i].len
-		    && !strncmp(*buf, data->stem_arr[i].buf, stem_len)) {
-			*buf += stem_len;
-			return i;
+	i = find_stem(data, *buf, stem_len);
+	if (i >= 0)
+		*buf += stem_len;
+	return i;
+}
+
+/*
+ * Copy the literal leading part of a regex into buf, without escapes,
+ * and return its length up to and including the last '/'.  The prefix
+ * ends at the first character that may not match literally: a meta
+ * character, an escape class or a character made optional by the
+ * quantifier after it.  A top-level alternation means a match need not
+ * start with the prefix at all, so there is none.
+ */
+static unsigned int regex_dir_prefix(const char *regex, char *buf, size_t size)
+{
+	const char *p;
+	unsigned int len = 0, dirlen = 0;
+	int depth = 0, inclass = 0;
+	char c;
+
+	for (p = regex; *p; p++) {
+		if (*p == '\\') {
+			if (p[1])
+				p++;
+			continue;
+		}
+		if (inclass) {
+			if (*p == ']')
+				inclass = 0;
+			continue;
+		}
+		switch (*p) {
+		case '[':
+			inclass = 1;
+			if (p[1] == '^')
+				p++;
+			if (p[1] == ']')
+				p++;
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			depth--;
+			break;
+		case '|':
+			if (depth <= 0)
+				return 0;
+			break;
+		}
+	}
+
+	for (p = regex; *p && len < size; p++) {
+		c = *p;
+		if (c == '\\') {
+			if (!p[1] || isalnum((unsigned char)p[1]))
+				break;
+			c = *++p;
+		} else if (strchr(".^$?*+|[({", c)) {
+			break;
+		}
+		if (p[1] == '?' || p[1] == '*' || p[1] == '{')
+			break;
+		buf[len++] = c;
+		if (c == '/')
+			dirlen = len;
+	}
+	return dirlen;
+}
+
+static int prefix_name_cmp(const struct prefix_node *node, const char *name,
+			   unsigned int len)
+{
+	int rc;
+
+	rc = memcmp(node->name, name, node->name_len < len ? node->name_len : len);
+	if (rc)
+		return rc;
+	return (int)node->name_len - (int)len;
+}
+
+/*
+ * Find the child of node called name, or with create set, add it.
+ * Returns NULL if there is no such child or on allocation failure.
+ */
+static struct prefix_node *prefix_child(struct prefix_node *node,
+					const char *name, unsigned int len,
+					int create)
+{
+	struct prefix_node *children;
+	unsigned int lo = 0, hi = node->nchildren, mid;
+	int rc;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		rc = prefix_name_cmp(&node->children[mid], name, len);
+		if (rc == 0)
+			return &node->children[mid];
+		if (rc < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!create)
+		return NULL;
+
+	if (node->nchildren == node->alloc_children) {
+		node->alloc_children = node->alloc_children * 2 + 4;
+		children = realloc(node->children, node->alloc_children *
+				   sizeof(*children));
+		if (!children)
+			return NULL;
+		node->children = children;
+	}
+	memmove(&node->children[lo + 1], &node->children[lo],
+		(node->nchildren - lo) * sizeof(*node->children));
+	node->nchildren++;
+
+	children = &node->children[lo];
+	memset(children, 0, sizeof(*children));
+	children->name = strndup(name, len);
+	if (!children->name) {
+		node->nchildren--;
+		memmove(&node->children[lo], &node->children[lo + 1],
+			(node->nchildren - lo) * sizeof(*node->children));
+		return NULL;
+	}
+	children->name_len = len;
+	return children;
+}
+
+static int prefix_add_spec(struct prefix_node *node, unsigned int idx)
+{
+	unsigned int *specs;
+
+	if (node->nspecs == node->alloc_specs) {
+		node->alloc_specs = node->alloc_specs * 2 + 4;
+		specs = realloc(node->specs, node->alloc_specs * sizeof(*specs));
+		if (!specs)
+			return -1;
+		node->specs = specs;
+	}
+	node->specs[node->nspecs++] = idx;
+	return 0;
+}
+
+static void free_spec_groups(struct spec_group *groups, unsigned int ngroups)
+{
+	unsigned int i;
+
+	for (i = 0; i < ngroups; i++) {
+		if (groups[i].regex) {
+			pcre_free(groups[i].regex);
+			pcre_free_study(groups[i].sd);
+		}
+		free(groups[i].members);
+	}
+	free(groups);
+}
+
+static void free_prefix_node(struct prefix_node *node)
+{
+	unsigned int i;
+
+	for (i = 0; i < SPEC_GROUP_MODES; i++)
+		free_spec_groups(node->groups[i], node->ngroups[i]);
+	for (i = 0; i < node->nchildren; i++)
+		free_prefix_node(&node->children[i]);
+	free(node->children);
+	free(node->specs);
+	free(node->name);
+}
+
+/*
+ * Return a copy of the path matched by a regex without meta characters,
+ * or NULL with errno set to EINVAL if its escapes are not all plain
+ * quoted characters.
+ */
+static char *exact_path(const char *regex)
+{
+	char *path, *p;
+
+	if (strchr(regex, ')')) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	p = path = malloc(strlen(regex) + 1);
+	if (!path)
+		return NULL;
+	for (; *regex; regex++) {
+		if (*regex == '\\') {
+			regex++;
+			if (!*regex || isalnum((unsigned char)*regex)) {
+				free(path);
+				errno = EINVAL;
+				return NULL;
+			}
 		}
+		*p++ = *regex;
+	}
+	*p = '\0';
+	return path;
+}
+
+/*
+ * Hash the specs that match a single literal path.  lookup() finds the
+ * best of them with one probe, so they are left out of the prefix index.
+ */
+static int build_exact_index(struct saved_data *data)
+{
+	struct exact_entry *entry;
+	unsigned int i, n, nbuckets;
+	char *path;
+
+	for (i = 0, n = 0; i < data->nspec; i++)
+		if (!data->spec_arr[i].hasMetaChars)
+			n++;
+	if (!n)
+		return 0;
+
+	for (nbuckets = 16; nbuckets < n * 2; nbuckets <<= 1) ;
+
+	data->exact_arr = calloc(n, sizeof(*data->exact_arr));
+	data->exact_buckets = malloc(nbuckets * sizeof(*data->exact_buckets));
+	if (!data->exact_arr || !data->exact_buckets)
+		return -1;
+	memset(data->exact_buckets, -1, nbuckets * sizeof(*data->exact_buckets));
+	data->exact_mask = nbuckets - 1;
+
+	/* in ascending order, so pushing onto the buckets puts the last first */
+	for (i = 0; i < data->nspec; i++) {
+		if (data->spec_arr[i].hasMetaChars)
+			continue;
+		path = exact_path(data->spec_arr[i].regex_str);
+		if (!path) {
+			if (errno == ENOMEM)
+				return -1;
+			continue;
+		}
+		entry = &data->exact_arr[data->nexact];
+		entry->path = path;
+		entry->len = strlen(path);
+		entry->hash = path_hash(path, entry->len);
+		entry->spec = i;
+		entry->next = data->exact_buckets[entry->hash & data->exact_mask];
+		data->exact_buckets[entry->hash & data->exact_mask] = data->nexact++;
+		data->spec_arr[i].exact = 1;
+	}
+	return 0;
+}
+
+/* Return the highest spec matching exactly key and mode, or -1. */
+static int exact_lookup(struct saved_data *data, const char *key, mode_t mode)
+{
+	struct exact_entry *entry;
+	struct spec *spec;
+	size_t len;
+	unsigned int hash;
+	int e;
+
+	if (!data->nexact)
+		return -1;
+
+	len = strlen(key);
+	hash = path_hash(key, len);
+	for (e = data->exact_buckets[hash & data->exact_mask]; e >= 0;
+	     e = entry->next) {
+		entry = &data->exact_arr[e];
+		if (entry->hash != hash || entry->len != len ||
+		    memcmp(entry->path, key, len))
+			continue;
+		spec = &data->spec_arr[entry->spec];
+		if (!mode || !spec->mode || mode == spec->mode)
+			return entry->spec;
 	}
 	return -1;
 }
 
+/*
+ * Index every spec under the directory its regex literally starts with.
+ * Specs are added from the last to the first, so each node's list is in
+ * the order lookup() tries them.
+ */
+static int build_prefix_index(struct saved_data *data)
+{
+	char buf[PATH_MAX];
+	struct prefix_node *node;
+	unsigned int i, dirlen, start, end, depth;
+
+	data->prefix_root = calloc(1, sizeof(*data->prefix_root));
+	if (!data->prefix_root)
+		return -1;
+
+	for (i = data->nspec; i-- > 0; ) {
+		if (data->spec_arr[i].exact)
+			continue;
+		dirlen = regex_dir_prefix(data->spec_arr[i].regex_str, buf,
+					  sizeof(buf));
+		node = data->prefix_root;
+		for (start = 0, depth = 0;
+		     start < dirlen && depth < PREFIX_MAX_DEPTH;
+		     start = end + 1, depth++) {
+			end = start;
+			while (buf[end] != '/')
+				end++;
+			node = prefix_child(node, buf + start, end - start, 1);
+			if (!node)
+				return -1;
+		}
+		if (prefix_add_spec(node, i))
+			return -1;
+		if (data->spec_arr[i].mode)
+			node->spec_modes |= 1U << (data->spec_arr[i].mode >> 12);
+	}
+	return 0;
+}
+
+/*
+ * The group slot lookup() uses at node for files of type m.  Types that
+ * no spec at the node names all try the same specs.
+ */
+static inline unsigned int spec_group_slot(const struct prefix_node *node,
+					   unsigned int m)
+{
+	if (!m || node->spec_modes & (1U << m))
+		return m;
+	return node->spec_modes ? SPEC_GROUP_UNTYPED : 0;
+}
+
+/*
+ * Collect the index nodes for each directory on the way to key, skipping
+ * those without specs.  Returns the number of nodes stored in path.
+ */
+static unsigned int prefix_walk(struct prefix_node *node, const char *key,
+				struct prefix_node **path)
+{
+	const char *slash;
+	unsigned int depth = 0, n = 0;
+
+	while (node) {
+		if (node->nspecs)
+			path[n++] = node;
+		if (depth++ == PREFIX_MAX_DEPTH || !node->nchildren)
+			break;
+		slash = strchr(key, '/');
+		if (!slash)
+			break;
+		node = prefix_child(node, key, slash - key, 0);
+		key = slash + 1;
+	}
+	return n;
+}
+
 /*
  * Warn about duplicate specifications.
  */
@@ -150,19 +495,355 @@ static int compile_regex(struct saved_data *data, struct spec *spec, const char
 	return 0;
 }
 
+/* The part of a spec's regex that is matched after its stem. */
+static inline const char *spec_regex_tail(struct saved_data *data,
+					  struct spec *spec)
+{
+	if (spec->stem_id >= 0)
+		return spec->regex_str + data->stem_arr[spec->stem_id].len;
+	return spec->regex_str;
+}
+
+/* Backreferences would be renumbered by the enclosing alternation. */
+static int spec_groupable(struct spec *spec)
+{
+	const char *p;
+
+	for (p = spec->regex_str; *p; p++) {
+		if (*p == '\\') {
+			if (isdigit((unsigned char)p[1]))
+				return 0;
+			if (p[1])
+				p++;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Compile the members of group into ^(?:(?:re0)$(*MARK:0)|...).  On
+ * failure the caller falls back to trying each member on its own.
+ */
+static int compile_spec_group(struct saved_data *data, struct spec_group *group)
+{
+	const char *errbuf, *tail;
+	char *regex, *cp;
+	size_t len = 8;
+	unsigned int i;
+	int erroff;
+
+	for (i = 0; i < group->nmembers; i++)
+		len += strlen(spec_regex_tail(data, &data->spec_arr[group->members[i]])) + 32;
+
+	cp = regex = malloc(len);
+	if (!regex)
+		return -1;
+	cp = stpcpy(cp, "^(?:");
+	for (i = 0; i < group->nmembers; i++) {
+		tail = spec_regex_tail(data, &data->spec_arr[group->members[i]]);
+		cp += sprintf(cp, "%s(?:%s)$(*MARK:%u)", i ? "|" : "", tail, i);
+	}
+	strcpy(cp, ")");
+
+	group->regex = pcre_compile(regex, 0, &errbuf, &erroff, NULL);
+	free(regex);
+	if (!group->regex)
+		return -1;
+
+	group->sd = pcre_study(group->regex, 0, &errbuf);
+	if (group->sd)
+		group->lsd = *group->sd;
+	else
+		memset(&group->lsd, 0, sizeof(group->lsd));
+#ifdef PCRE_EXTRA_MARK
+	group->lsd.flags |= PCRE_EXTRA_MARK;
+#endif
+	return 0;
+}
+
+#ifdef SPEC_JIT_THRESHOLD
+/* Count a run of the spec's regex and JIT it once it is hot. */
+static inline void spec_exec_count(struct spec *spec)
+{
+	const char *errbuf;
+
+	if (++spec->execs == SPEC_JIT_THRESHOLD)
+		spec->jit_sd = pcre_study(spec->regex, PCRE_STUDY_JIT_COMPILE,
+					  &errbuf);
+}
+
+static inline void group_exec_count(struct spec_group *group)
+{
+	const char *errbuf;
+	pcre_extra *sd;
+
+	if (++group->execs != SPEC_JIT_THRESHOLD)
+		return;
+	sd = pcre_study(group->regex, PCRE_STUDY_JIT_COMPILE, &errbuf);
+	if (!sd)
+		return;
+	pcre_free_study(group->sd);
+	group->sd = sd;
+	group->lsd = *sd;
+#ifdef PCRE_EXTRA_MARK
+	group->lsd.flags |= PCRE_EXTRA_MARK;
+#endif
+}
+#else
+static inline void spec_exec_count(struct spec *spec)
+{
+	spec->execs++;
+}
+
+static inline void group_exec_count(struct spec_group *group)
+{
+	group->execs++;
+}
+#endif
+
+static int add_spec_group(struct spec_group **groups, unsigned int *ngroups,
+			  const unsigned int *members, unsigned int nmembers,
+			  int stem_id)
+{
+	struct spec_group *tmp, *group;
+
+	tmp = realloc(*groups, (*ngroups + 1) * sizeof(*tmp));
+	if (!tmp)
+		return -1;
+	*groups = tmp;
+
+	group = &tmp[*ngroups];
+	memset(group, 0, sizeof(*group));
+	group->members = malloc(nmembers * sizeof(*members));
+	if (!group->members)
+		return -1;
+	memcpy(group->members, members, nmembers * sizeof(*members));
+	group->nmembers = nmembers;
+	group->stem_id = stem_id;
+	(*ngroups)++;
+	return 0;
+}
+
+/* Close the run of specs collected so far into one or more groups. */
+static int flush_spec_run(struct saved_data *data, struct spec_group **groups,
+			  unsigned int *ngroups, const unsigned int *run,
+			  unsigned int nrun, int stem_id)
+{
+	unsigned int i;
+
+	if (nrun > 1) {
+		if (add_spec_group(groups, ngroups, run, nrun, stem_id))
+			return -1;
+		if (compile_spec_group(data, &(*groups)[*ngroups - 1]) == 0)
+			return 0;
+		/* one of the regexes is bad, keep them apart */
+		free((*groups)[--*ngroups].members);
+	}
+	for (i = 0; i < nrun; i++)
+		if (add_spec_group(groups, ngroups, &run[i], 1, stem_id))
+			return -1;
+	return 0;
+}
+
+/*
+ * Split the node's specs that apply to files of the given type into
+ * groups, merging neighbours with the same stem.
+ */
+static int build_spec_groups(struct saved_data *data, struct prefix_node *node,
+			     mode_t mode)
+{
+	unsigned int m = (mode & S_IFMT) >> 12;
+	unsigned int run[SPEC_GROUP_MAX];
+	unsigned int i, nrun = 0;
+	size_t runlen = 0, len;
+	struct spec_group *groups = calloc(1, sizeof(*groups));
+	unsigned int ngroups = 0;
+	struct spec *spec;
+	int stem_id = -1;
+
+	if (!groups)
+		return -1;
+
+	for (i = 0; i < node->nspecs; i++) {
+		spec = &data->spec_arr[node->specs[i]];
+		if (mode && spec->mode && spec->mode != mode)
+			continue;
+
+		len = strlen(spec_regex_tail(data, spec));
+		if (nrun && (spec->stem_id != stem_id || nrun == SPEC_GROUP_MAX ||
+			     runlen + len > SPEC_GROUP_MAX_REGEX ||
+			     !spec_groupable(spec))) {
+			if (flush_spec_run(data, &groups, &ngroups, run, nrun, stem_id))
+				goto err;
+			nrun = runlen = 0;
+		}
+		stem_id = spec->stem_id;
+		run[nrun++] = node->specs[i];
+		runlen += len;
+		if (!spec_groupable(spec)) {
+			if (flush_spec_run(data, &groups, &ngroups, run, nrun, stem_id))
+				goto err;
+			nrun = runlen = 0;
+		}
+	}
+	if (nrun && flush_spec_run(data, &groups, &ngroups, run, nrun, stem_id))
+		goto err;
+
+	node->groups[m] = groups;
+	node->ngroups[m] = ngroups;
+	return 0;
+err:
+	free_spec_groups(groups, ngroups);
+	return -1;
+}
+
+/*
+ * Try one group of a prefix index level on key.  Returns 1 when the
+ * rest of the level need not be tried, because the group matched or
+ * cannot beat the best match *best so far, 0 to go on, or -1 on error.
+ */
+static int try_group(struct saved_data *data, struct spec_group *group,
+		     const char *key, const char *buf, int file_stem,
+		     int *best)
+{
+	const char *subject = key;
+	unsigned char *mark = NULL;
+	struct spec *spec;
+	int cand = group->members[0], rc;
+
+	if (cand <= *best)
+		return 1;
+	if (group->stem_id != -1) {
+		if (group->stem_id != file_stem)
+			return 0;
+		subject = buf;
+	}
+
+	if (group->regex) {
+		group_exec_count(group);
+		group->lsd.mark = &mark;
+		rc = pcre_exec(group->regex, &group->lsd, subject,
+			       strlen(subject), 0, 0, NULL, 0);
+		if (rc == 0) {
+			if (!mark)
+				goto err;
+			cand = group->members[atoi((char *)mark)];
+		}
+	} else {
+		spec = &data->spec_arr[cand];
+		if (compile_regex(data, spec, NULL) < 0)
+			return -1;
+		spec_exec_count(spec);
+		rc = pcre_exec(spec->regex, get_pcre_extra(spec), subject,
+			       strlen(subject), 0, 0, NULL, 0);
+	}
+
+	if (rc == 0) {
+		*best = cand;
+		return 1;
+	}
+	if (rc == PCRE_ERROR_NOMATCH)
+		return 0;
+err:
+	errno = ENOENT;
+	return -1;
+}
+
+/*
+ * Copy key, whose first "//" is at slash, into the handle's key buffer
+ * with runs of slashes collapsed.  The buffer is kept for later keys.
+ */
+static const char *clean_key(struct saved_data *data, const char *key,
+			     const char *slash)
+{
+	size_t len = strlen(key) + 1;
+	const char *src;
+	char *dst;
+
+	if (len > data->key_alloc) {
+		dst = realloc(data->key_buf, len);
+		if (!dst)
+			return NULL;
+		data->key_buf = dst;
+		data->key_alloc = len;
+	}
+
+	memcpy(data->key_buf, key, slash - key + 1);
+	dst = data->key_buf + (slash - key + 1);
+	for (src = slash + 1; *src; src++) {
+		if (*src != '/' || dst[-1] != '/')
+			*dst++ = *src;
+	}
+	*dst = '\0';
+	return data->key_buf;
+}
+
+/* Return the memo for the directory of key, redoing it if that changed. */
+static struct dir_memo *dir_memo_get(struct saved_data *data, const char *key)
+{
+	struct dir_memo *memo = &data->memo;
+	const char *slash = strrchr(key, '/');
+	const char *buf;
+	size_t len = slash ? slash - key + 1 : 0;
+	char *dir;
+
+	if (memo->dir && memo->len == len && !memcmp(memo->dir, key, len))
+		return memo;
+
+	if (len + 1 > memo->alloc) {
+		dir = realloc(memo->dir, len + 1);
+		if (!dir)
+			return NULL;
+		memo->dir = dir;
+		memo->alloc = len + 1;
+	}
+	memcpy(memo->dir, key, len);
+	memo->dir[len] = '\0';
+	memo->len = len;
+
+	/* the stem ends at the second '/', which is within the directory
+	 * whenever the key has one */
+	buf = key;
+	memo->file_stem = find_stem_from_file(data, &buf);
+	memo->depth = prefix_walk(data->prefix_root, memo->dir, memo->path);
+	return memo;
+}
+
+#define FIELD_SPACE " \t\n\v\f\r"
+
+/*
+ * Split buf in place into at most max whitespace separated fields and
+ * return how many there are.  Anything after the last one is ignored.
+ */
+static int split_fields(char *buf, char **fields, int max)
+{
+	int n = 0;
+
+	buf += strspn(buf, FIELD_SPACE);
+	while (*buf && n < max) {
+		fields[n++] = buf;
+		buf += strcspn(buf, FIELD_SPACE);
+		if (*buf)
+			*buf++ = '\0';
+		buf += strspn(buf, FIELD_SPACE);
+	}
+	return n;
+}
+
 static int process_line(struct selabel_handle *rec,
 			const char *path, const char *prefix,
 			char *line_buf, unsigned lineno)
 {
 	int items, len, rc;
 	char *buf_p, *regex, *type, *context;
+	char *fields[3];
 	struct saved_data *data = (struct saved_data *)rec->data;
 	struct spec *spec_arr;
 	unsigned int nspec = data->nspec;
 	const char *errbuf = NULL;
 
 	len = strlen(line_buf);
-	if (line_buf[len - 1] == '\n')
+	if (len && line_buf[len - 1] == '\n')
 		line_buf[len - 1] = 0;
 	buf_p = line_buf;
 	while (isspace(*buf_p))
@@ -170,19 +851,26 @@ static int process_line(struct selabel_handle *rec,
 	/* Skip comment lines and empty lines. */
 	if (*buf_p == '#' || *buf_p == 0)
 		return 0;
-	items = sscanf(line_buf, "%as %as %as", &regex, &type, &context);
+	items = split_fields(buf_p, fields, 3);
 	if (items < 2) {
 		COMPAT_LOG(SELINUX_WARNING,
 			    "%s:  line %d is missing fields, skipping\n", path,
 			    lineno);
-		if (items == 1)
-			free(regex);
 		return 0;
 	} else if (items == 2) {
 		/* The type field is optional. */
+		fields[2] = fields[1];
+		fields[1] = NULL;
+	}
+
+	regex = strdup(fields[0]);
+	type = fields[1] ? strdup(fields[1]) : NULL;
+	context = strdup(fields[2]);
+	if (!regex || (fields[1] && !type) || !context) {
+		free(regex);
+		free(type);
 		free(context);
-		context = type;
-		type = 0;
+		return -1;
 	}
 
 	len = get_stem_from_spec(regex);
@@ -419,14 +1107,34 @@ err:
 	return rc;
 }
 
+/* Make sure spec_arr has room for n more specs. */
+static int reserve_specs(struct saved_data *data, unsigned int n)
+{
+	struct spec *specs;
+	size_t total_specs = data->nspec + n;
+
+	if (total_specs <= data->alloc_specs)
+		return 0;
+
+	specs = realloc(data->spec_arr, total_specs * sizeof(*specs));
+	if (!specs)
+		return -1;
+	memset(&specs[data->alloc_specs], 0,
+	       (total_specs - data->alloc_specs) * sizeof(*specs));
+
+	data->spec_arr = specs;
+	data->alloc_specs = total_specs;
+	return 0;
+}
+
 static int process_file(const char *path, const char *suffix, struct selabel_handle *rec, const char *prefix)
 {
 	FILE *fp;
 	struct stat sb;
-	unsigned int lineno;
-	size_t line_len;
-	char *line_buf = NULL;
-	int rc;
+	unsigned int lineno, nlines;
+	size_t size;
+	char *text = NULL, *line, *next, *end;
+	int rc = -1;
 	char stack_path[PATH_MAX + 1];
 
 	/* append the path suffix if we have one */
@@ -445,32 +1153,225 @@ static int process_file(const char *path, const char *suffix, struct selabel_han
 	__fsetlocking(fp, FSETLOCKING_BYCALLER);
 
 	if (fstat(fileno(fp), &sb) < 0)
-		return -1;
+		goto out;
 	if (!S_ISREG(sb.st_mode)) {
 		errno = EINVAL;
-		return -1;
+		goto out;
 	}
 
 	rc = load_mmap(rec, path, &sb);
 	if (rc == 0)
 		goto out;
 
+	/*
+	 * Read the whole file at once and make room for one spec per
+	 * line, rather than going through stdio and growing spec_arr
+	 * line by line.
+	 */
+	rc = -1;
+	text = malloc(sb.st_size + 1);
+	if (!text)
+		goto out;
+	size = fread(text, 1, sb.st_size, fp);
+	if (ferror(fp))
+		goto out;
+	end = text + size;
+	*end = '\0';
+
+	nlines = 1;
+	for (line = text; (line = memchr(line, '\n', end - line)); line++)
+		nlines++;
+	if (reserve_specs(rec->data, nlines))
+		goto out;
+
 	/*
 	 * The do detailed validation of the input and fill the spec array
 	 */
 	lineno = 0;
-	while (getline(&line_buf, &line_len, fp) > 0) {
-		rc = process_line(rec, path, prefix, line_buf, ++lineno);
+	for (line = text; line < end; line = next) {
+		next = memchr(line, '\n', end - line);
+		if (next)
+			*next++ = '\0';
+		else
+			next = end;
+		rc = process_line(rec, path, prefix, line, ++lineno);
 		if (rc)
-			return rc;
+			goto out;
 	}
+	rc = 0;
 out:
-	free(line_buf);
+	free(text);
 	fclose(fp);
 
+	return rc;
+}
+
+static const char *spec_file_suffix[SPEC_FILE_NUM] = {
+	NULL,
+	"homedirs",
+	"local",
+};
+
+static void get_stamp(const char *path, struct file_stamp *st)
+{
+	struct stat sb;
+
+	memset(st, 0, sizeof(*st));
+	if (stat(path, &sb) < 0)
+		return;
+	st->present = 1;
+	st->dev = sb.st_dev;
+	st->ino = sb.st_ino;
+	st->size = sb.st_size;
+	st->mtime = sb.st_mtim;
+}
+
+static int stamp_eq(const struct file_stamp *a, const struct file_stamp *b)
+{
+	return a->present == b->present && a->dev == b->dev &&
+	    a->ino == b->ino && a->size == b->size &&
+	    a->mtime.tv_sec == b->mtime.tv_sec &&
+	    a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+/* Note the state of the first nfiles files, text and ".bin", before
+   they are read, so that a change while reading shows up next time. */
+static void stamp_files(const char *path, int nfiles,
+			struct file_stamp stamps[SPEC_FILE_NUM][2])
+{
+	char buf[PATH_MAX + 1], bin[PATH_MAX + 1];
+	int f;
+
+	memset(stamps, 0, SPEC_FILE_NUM * sizeof(*stamps));
+	for (f = 0; f < nfiles; f++) {
+		if (spec_file_suffix[f])
+			snprintf(buf, sizeof(buf), "%s.%s", path,
+				 spec_file_suffix[f]);
+		else
+			snprintf(buf, sizeof(buf), "%s", path);
+		snprintf(bin, sizeof(bin), "%s.bin", buf);
+		get_stamp(buf, &stamps[f][0]);
+		get_stamp(bin, &stamps[f][1]);
+	}
+}
+
+/* Read specification file f, marking what it adds as coming from it. */
+static int load_file(struct selabel_handle *rec, int f)
+{
+	struct saved_data *data = (struct saved_data *)rec->data;
+	struct mmap_area *area, *last_area = data->mmap_areas;
+	unsigned int i, nspec = data->nspec;
+	int status;
+
+	status = process_file(rec->spec_file, spec_file_suffix[f], rec,
+			      data->prefix);
+	for (i = nspec; i < data->nspec; i++)
+		data->spec_arr[i].file = f;
+	for (area = data->mmap_areas; area != last_area; area = area->next)
+		area->file = f;
+
+	if (f == SPEC_FILE_BASE) {
+		if (!status && rec->validating)
+			status = nodups_specs(data, rec->spec_file);
+	} else if (status && errno == ENOENT) {
+		status = 0;
+	}
+	return status;
+}
+
+/*
+ * Take over the specs that 'old' read from file f, sharing their
+ * strings, regexes and mappings.  The stems of the base file keep
+ * their ids as it comes first; those of the other files are looked up
+ * again, as the files before them may have changed.
+ */
+static int keep_file(struct saved_data *data, struct saved_data *old, int f)
+{
+	struct mmap_area *area, *copy;
+	struct spec *spec;
+	unsigned int i, n = 0;
+	int id;
+
+	if (f == SPEC_FILE_BASE) {
+		for (id = 0; id < old->base_stems; id++) {
+			if (store_stem(data, old->stem_arr[id].buf,
+				       old->stem_arr[id].len) < 0)
+				return -1;
+			data->stem_arr[id].from_mmap =
+			    old->stem_arr[id].from_mmap;
+			data->base_stems = id + 1;
+		}
+	}
+
+	for (area = old->mmap_areas; area; area = area->next) {
+		if (area->file != f)
+			continue;
+		copy = malloc(sizeof(*copy));
+		if (!copy)
+			return -1;
+		*copy = *area;
+		copy->next = data->mmap_areas;
+		data->mmap_areas = copy;
+	}
+
+	for (i = 0; i < old->nspec; i++)
+		if (old->spec_arr[i].file == f)
+			n++;
+	if (reserve_specs(data, n))
+		return -1;
+
+	/*
+	 * 'old' is sorted with the regexes first, so this takes them
+	 * first, but sort_specs() puts everything back in file order.
+	 */
+	for (i = 0; i < old->nspec; i++) {
+		if (old->spec_arr[i].file != f)
+			continue;
+		spec = &data->spec_arr[data->nspec++];
+		*spec = old->spec_arr[i];
+		if (f != SPEC_FILE_BASE && spec->stem_id >= 0) {
+			spec->stem_id = find_stem_from_spec(data,
+							    spec->regex_str);
+			if (spec->stem_id < 0)
+				return -1;
+		}
+	}
 	return 0;
 }
 
+/*
+ * Fill rec->data from the specification files, taking those that
+ * keep[] marks as unchanged from 'old' rather than reading them again,
+ * and index the result.
+ */
+static int load_specs(struct selabel_handle *rec, struct saved_data *old,
+		      const char *keep)
+{
+	struct saved_data *data = (struct saved_data *)rec->data;
+	int f, status, nfiles = data->baseonly ? 1 : SPEC_FILE_NUM;
+
+	for (f = 0; f < nfiles; f++) {
+		if (keep && keep[f])
+			status = keep_file(data, old, f);
+		else
+			status = load_file(rec, f);
+		if (status)
+			return status;
+		if (f == SPEC_FILE_BASE)
+			data->base_stems = data->num_stems;
+	}
+
+	status = sort_specs(data);
+	if (status)
+		return status;
+
+	status = build_exact_index(data);
+	if (status)
+		return status;
+
+	return build_prefix_index(data);
+}
+
 static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 		unsigned n)
 {
@@ -496,44 +1397,37 @@ static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 
 	/* Process local and distribution substitution files */
 	if (!path) {
-		rec->dist_subs = selabel_subs_init(selinux_file_context_subs_dist_path(), rec->dist_subs);
-		rec->subs = selabel_subs_init(selinux_file_context_subs_path(), rec->subs);
+		data->subs_paths[0] = strdup(selinux_file_context_subs_dist_path());
+		data->subs_paths[1] = strdup(selinux_file_context_subs_path());
 		path = selinux_file_context_path();
 	} else {
 		snprintf(subs_file, sizeof(subs_file), "%s.subs_dist", path);
-		rec->dist_subs = selabel_subs_init(subs_file, rec->dist_subs);
+		data->subs_paths[0] = strdup(subs_file);
 		snprintf(subs_file, sizeof(subs_file), "%s.subs", path);
-		rec->subs = selabel_subs_init(subs_file, rec->subs);
+		data->subs_paths[1] = strdup(subs_file);
 	}
+	if (!data->subs_paths[0] || !data->subs_paths[1])
+		goto finish;
+	get_stamp(data->subs_paths[0], &data->subs_stamps[0]);
+	rec->dist_subs = selabel_subs_init(data->subs_paths[0], rec->dist_subs);
+	get_stamp(data->subs_paths[1], &data->subs_stamps[1]);
+	rec->subs = selabel_subs_init(data->subs_paths[1], rec->subs);
 
 	rec->spec_file = strdup(path);
-
-	/* 
-	 * The do detailed validation of the input and fill the spec array
-	 */
-	status = process_file(path, NULL, rec, prefix);
-	if (status)
+	if (!rec->spec_file)
 		goto finish;
-
-	if (rec->validating) {
-		status = nodups_specs(data, path);
-		if (status)
+	if (prefix) {
+		data->prefix = strdup(prefix);
+		if (!data->prefix)
 			goto finish;
 	}
+	data->baseonly = baseonly;
 
-	if (!baseonly) {
-		status = process_file(path, "homedirs", rec, prefix);
-		if (status && errno != ENOENT)
-			goto finish;
-
-		status = process_file(path, "local", rec, prefix);
-		if (status && errno != ENOENT)
-			goto finish;
-	}
-
-	status = sort_specs(data);
-
-	status = 0;
+	/* 
+	 * The do detailed validation of the input and fill the spec array
+	 */
+	stamp_files(path, baseonly ? 1 : SPEC_FILE_NUM, data->stamps);
+	status = load_specs(rec, NULL, NULL);
 finish:
 	if (status)
 		free(data->spec_arr);
@@ -543,32 +1437,46 @@ finish:
 /*
  * Backend interface routines
  */
-static void closef(struct selabel_handle *rec)
+static void free_spec(struct spec *spec)
+{
+	free(spec->lr.ctx_trans);
+	free(spec->lr.ctx_raw);
+	if (spec->jit_sd)
+		pcre_free_study(spec->jit_sd);
+	if (spec->from_mmap)
+		return;
+	free(spec->regex_str);
+	free(spec->type_str);
+	if (spec->regcomp) {
+		pcre_free(spec->regex);
+		pcre_free_study(spec->sd);
+	}
+}
+
+/*
+ * Free 'data' but for what it shares with the data it was built from
+ * or replaced by: the specs and mappings of the files keep[] marks,
+ * the stems of the base file if it is one of them, and the options.
+ */
+static void free_data(struct saved_data *data, const char *keep)
 {
-	struct saved_data *data = (struct saved_data *)rec->data;
 	struct mmap_area *area, *last_area;
-	struct spec *spec;
 	struct stem *stem;
 	unsigned int i;
 
 	for (i = 0; i < data->nspec; i++) {
-		spec = &data->spec_arr[i];
-		free(spec->lr.ctx_trans);
-		free(spec->lr.ctx_raw);
-		if (spec->from_mmap)
+		if (keep && keep[(int)data->spec_arr[i].file])
 			continue;
-		free(spec->regex_str);
-		free(spec->type_str);
-		if (spec->regcomp) {
-			pcre_free(spec->regex);
-			pcre_free_study(spec->sd);
-		}
+		free_spec(&data->spec_arr[i]);
 	}
 
 	for (i = 0; i < (unsigned int)data->num_stems; i++) {
 		stem = &data->stem_arr[i];
 		if (stem->from_mmap)
 			continue;
+		if (keep && keep[SPEC_FILE_BASE] &&
+		    (int)i < data->base_stems)
+			continue;
 		free(stem->buf);
 	}
 
@@ -576,29 +1484,115 @@ static void closef(struct selabel_handle *rec)
 		free(data->spec_arr);
 	if (data->stem_arr)
 		free(data->stem_arr);
+	free(data->stem_buckets);
+
+	if (data->prefix_root) {
+		free_prefix_node(data->prefix_root);
+		free(data->prefix_root);
+	}
+	free(data->memo.dir);
+	free(data->key_buf);
+
+	for (i = 0; i < data->nexact; i++)
+		free(data->exact_arr[i].path);
+	free(data->exact_arr);
+	free(data->exact_buckets);
 
 	area = data->mmap_areas;
 	while (area) {
-		munmap(area->addr, area->len);
+		if (!keep || !keep[area->file])
+			munmap(area->addr, area->len);
 		last_area = area;
 		area = area->next;
 		free(last_area);
 	}
+
+	if (!keep) {
+		free(data->prefix);
+		free(data->subs_paths[0]);
+		free(data->subs_paths[1]);
+	}
 	free(data);
 }
 
+static void closef(struct selabel_handle *rec)
+{
+	free_data((struct saved_data *)rec->data, NULL);
+}
+
+/*
+ * Build the specs again from the files that changed, reusing the rest,
+ * and only then put them in place of the old ones.  Substitutions are
+ * small and are just read again if either file changed.
+ */
+static int reload(struct selabel_handle *rec)
+{
+	struct saved_data *old = (struct saved_data *)rec->data, *data;
+	struct selabel_handle build;
+	struct file_stamp stamps[SPEC_FILE_NUM][2], subs_stamps[2];
+	char keep[SPEC_FILE_NUM];
+	int f, i, changed = 0, subs_changed = 0;
+
+	stamp_files(rec->spec_file, old->baseonly ? 1 : SPEC_FILE_NUM, stamps);
+	for (f = 0; f < SPEC_FILE_NUM; f++) {
+		keep[f] = stamp_eq(&stamps[f][0], &old->stamps[f][0]) &&
+		    stamp_eq(&stamps[f][1], &old->stamps[f][1]);
+		if (!keep[f])
+			changed = 1;
+	}
+	for (i = 0; i < 2; i++) {
+		get_stamp(old->subs_paths[i], &subs_stamps[i]);
+		if (!stamp_eq(&subs_stamps[i], &old->subs_stamps[i]))
+			subs_changed = 1;
+	}
+	if (!changed && !subs_changed)
+		return 0;
+
+	if (changed) {
+		data = calloc(1, sizeof(*data));
+		if (!data)
+			return -1;
+		data->prefix = old->prefix;
+		data->baseonly = old->baseonly;
+		memcpy(data->stamps, stamps, sizeof(stamps));
+		memcpy(data->subs_paths, old->subs_paths,
+		       sizeof(data->subs_paths));
+		memcpy(data->subs_stamps, old->subs_stamps,
+		       sizeof(data->subs_stamps));
+
+		/* lookups on rec never see the new data half built */
+		build = *rec;
+		build.data = data;
+		if (load_specs(&build, old, keep)) {
+			free_data(data, keep);
+			return -1;
+		}
+		rec->data = data;
+		free_data(old, keep);
+	}
+
+	if (subs_changed) {
+		data = (struct saved_data *)rec->data;
+		memcpy(data->subs_stamps, subs_stamps, sizeof(subs_stamps));
+		selabel_subs_replace(rec,
+				     selabel_subs_init(data->subs_paths[0], NULL),
+				     selabel_subs_init(data->subs_paths[1], NULL));
+	}
+	return 1;
+}
+
 static struct selabel_lookup_rec *lookup(struct selabel_handle *rec,
 					 const char *key, int type)
 {
 	struct saved_data *data = (struct saved_data *)rec->data;
 	struct spec *spec_arr = data->spec_arr;
+	struct dir_memo *memo;
+	unsigned int l, g, m, s;
 	int i, rc, file_stem;
 	mode_t mode = (mode_t)type;
 	const char *buf;
 	struct selabel_lookup_rec *ret = NULL;
-	char *clean_key = NULL;
-	const char *prev_slash, *next_slash;
-	unsigned int sofar = 0;
+	const char *next_slash;
 
 	if (!data->nspec) {
 		errno = ENOENT;
@@ -607,55 +1601,50 @@ static struct selabel_lookup_rec *lookup(struct selabel_handle *rec,
 
 	/* Remove duplicate slashes */
 	if ((next_slash = strstr(key, "//"))) {
-		clean_key = malloc(strlen(key) + 1);
-		if (!clean_key)
+		key = clean_key(data, key, next_slash);
+		if (!key)
 			goto finish;
-		prev_slash = key;
-		while (next_slash) {
-			memcpy(clean_key + sofar, prev_slash, next_slash - prev_slash);
-			sofar += next_slash - prev_slash;
-			prev_slash = next_slash + 1;
-			next_slash = strstr(prev_slash, "//");
-		}
-		strcpy(clean_key + sofar, prev_slash);
-		key = clean_key;
 	}
 
-	buf = key;
-	file_stem = find_stem_from_file(data, &buf);
 	mode &= S_IFMT;
 
-	/* 
-	 * Check for matching specifications in reverse order, so that
-	 * the last matching specification is used.
+	/*
+	 * The last matching specification is used.  A plain path beats any
+	 * regex unless the regex comes later; regexes can only match if
+	 * they are indexed under one of the key's directories.  In each of
+	 * those, the first group that matches gives the best candidate.
 	 */
-	for (i = data->nspec - 1; i >= 0; i--) {
-		struct spec *spec = &spec_arr[i];
-		/* if the spec in question matches no stem or has the same
-		 * stem as the file AND if the spec in question has no mode
-		 * specified or if the mode matches the file mode then we do
-		 * a regex check        */
-		if ((spec->stem_id == -1 || spec->stem_id == file_stem) &&
-		    (!mode || !spec->mode || mode == spec->mode)) {
-			if (compile_regex(data, spec, NULL) < 0)
-				goto finish;
-			if (spec->stem_id == -1)
-				rc = pcre_exec(spec->regex, get_pcre_extra(spec), key, strlen(key), 0, 0, NULL, 0);
-			else
-				rc = pcre_exec(spec->regex, get_pcre_extra(spec), buf, strlen(buf), 0, 0, NULL, 0);
+	i = exact_lookup(data, key, mode);
+	memo = dir_memo_get(data, key);
+	if (!memo)
+		goto finish;
+	file_stem = memo->file_stem;
+	buf = key;
+	if (file_stem != -1)
+		buf += data->stem_arr[file_stem].len;
 
-			if (rc == 0) {
-				spec->matches++;
-				break;
-			} else if (rc == PCRE_ERROR_NOMATCH)
-				continue;
+	m = mode >> 12;
+	for (l = 0; l < memo->depth; l++) {
+		struct prefix_node *node = memo->path[l];
 
-			errno = ENOENT;
-			/* else it's an error */
+		s = spec_group_slot(node, m);
+		if (!node->groups[s] &&
+		    build_spec_groups(data, node, s << 12) < 0)
 			goto finish;
+
+		for (g = 0; g < node->ngroups[s]; g++) {
+			rc = try_group(data, &node->groups[s][g], key, buf,
+				       file_stem, &i);
+			if (rc < 0)
+				goto finish;
+			if (rc)
+				break;
 		}
 	}
 
+	if (i >= 0)
+		spec_arr[i].matches++;
+
 	if (i < 0 || strcmp(spec_arr[i].lr.ctx_raw, "<<none>>") == 0) {
 		/* No matching specification. */
 		errno = ENOENT;
@@ -666,16 +1655,69 @@ static struct selabel_lookup_rec *lookup(struct selabel_handle *rec,
 	ret = &spec_arr[i].lr;
 
 finish:
-	free(clean_key);
 	return ret;
 }
 
+/* Credit every member of a merged group with the group's executions. */
+static void count_group_execs(const struct prefix_node *node,
+			      unsigned int *execs)
+{
+	const struct spec_group *group;
+	unsigned int i, m, g;
+
+	for (m = 0; m < SPEC_GROUP_MODES; m++) {
+		for (g = 0; g < node->ngroups[m]; g++) {
+			group = &node->groups[m][g];
+			if (!group->regex)
+				continue;
+			for (i = 0; i < group->nmembers; i++)
+				execs[group->members[i]] += group->execs;
+		}
+	}
+	for (i = 0; i < node->nchildren; i++)
+		count_group_execs(&node->children[i], execs);
+}
+
+/*
+ * Report how often each spec was tried against a key and how often it
+ * was the one used, so that expensive or useless entries stand out.
+ * Plain path entries are looked up by hash and never tried as regexes.
+ */
+static void profile_specs(struct saved_data *data)
+{
+	struct spec *spec_arr = data->spec_arr;
+	unsigned int i, *execs;
+
+	execs = calloc(data->nspec, sizeof(*execs));
+	if (!execs)
+		return;
+	if (data->prefix_root)
+		count_group_execs(data->prefix_root, execs);
+
+	for (i = 0; i < data->nspec; i++) {
+		execs[i] += spec_arr[i].execs;
+		if (!execs[i])
+			continue;
+		COMPAT_LOG(SELINUX_INFO,
+			   "(%s%s%s, %s)  %u matches in %u attempts (%u%%)\n",
+			   spec_arr[i].regex_str,
+			   spec_arr[i].type_str ? ", " : "",
+			   spec_arr[i].type_str ? spec_arr[i].type_str : "",
+			   spec_arr[i].lr.ctx_raw, spec_arr[i].matches,
+			   execs[i],
+			   (unsigned int)(100ULL * spec_arr[i].matches / execs[i]));
+	}
+	free(execs);
+}
+
 static void stats(struct selabel_handle *rec)
 {
 	struct saved_data *data = (struct saved_data *)rec->data;
 	unsigned int i, nspec = data->nspec;
 	struct spec *spec_arr = data->spec_arr;
 
+	profile_specs(data);
+
 	for (i = 0; i < nspec; i++) {
 		if (spec_arr[i].matches == 0) {
 			if (spec_arr[i].type_str) {
@@ -708,6 +1750,7 @@ int selabel_file_init(struct selabel_handle *rec, struct selinux_opt *opts,
 	rec->func_close = &closef;
 	rec->func_stats = &stats;
 	rec->func_lookup = &lookup;
+	rec->func_reload = &reload;
 
 	return init(rec, opts, nopts);
 }
@@ -13,22 +13,29 @@
 #define pcre_free_study  pcre_free
 #endif
 
-/* A file security context specification. */
+/*
+ * A file security context specification.  Matching a regex only reads
+ * the fields up to stem_id, so they come first and share a cache line;
+ * the rest is read once a spec has won, or while building the handle.
+ */
 struct spec {
-	struct selabel_lookup_rec lr;	/* holds contexts for lookup result */
-	char *regex_str;	/* regular expession string for diagnostics */
-	char *type_str;		/* type string for diagnostic messages */
 	pcre *regex;		/* compiled regular expression */
-	union {
-		pcre_extra *sd;	/* pointer to extra compiled stuff */
-		pcre_extra lsd;	/* used to hold the mmap'd version */
-	};
+	pcre_extra *sd;		/* pointer to extra compiled stuff */
+	pcre_extra *jit_sd;	/* JIT study of a hot regex, used instead */
+	unsigned int execs;	/* number of times the regex was run */
 	mode_t mode;		/* mode format value */
-	int matches;		/* number of matching pathnames */
 	int stem_id;		/* indicates which stem-compression item */
-	char hasMetaChars;	/* regular expression has meta-chars */
 	char regcomp;		/* regex_str has been compiled to regex */
 	char from_mmap;		/* this spec is from an mmap of the data */
+	char exact;		/* looked up through the exact path table */
+	char hasMetaChars;	/* regular expression has meta-chars */
+
+	struct selabel_lookup_rec lr;	/* holds contexts for lookup result */
+	char *regex_str;	/* regular expession string for diagnostics */
+	char *type_str;		/* type string for diagnostic messages */
+	int matches;		/* number of matching pathnames */
+	char file;		/* SPEC_FILE_* it was read from */
+	pcre_extra lsd;		/* used to hold the mmap'd version */
 };
 
 /* A regular expression stem */
@@ -36,15 +43,124 @@ struct stem {
 	char *buf;
 	int len;
 	char from_mmap;
+	unsigned int hash;
+	int next;		/* next stem in the bucket, or -1 */
+};
+
+/*
+ * A run of specs sharing a stem, compiled into one alternation so that
+ * a single pcre_exec() finds the first of them that matches.  Each
+ * alternative ends in (*MARK:n), n being its position in members.  A
+ * group of one spec has no regex of its own and uses the spec's.
+ */
+struct spec_group {
+	pcre *regex;
+	pcre_extra *sd;
+	pcre_extra lsd;		/* copy of *sd with the mark flag added */
+	unsigned int *members;	/* indexes into spec_arr, highest first */
+	unsigned int nmembers;
+	int stem_id;
+	unsigned int execs;	/* number of times the regex was run */
+};
+
+#ifdef PCRE_EXTRA_MARK
+#define SPEC_GROUP_MAX 64
+#else
+#define SPEC_GROUP_MAX 1
+#endif
+#define SPEC_GROUP_MAX_REGEX 16384
+
+/*
+ * JIT code cannot be kept in file_contexts.bin, so regexes are studied
+ * again with the JIT once they have been run this many times.
+ */
+#ifdef PCRE_STUDY_JIT_COMPILE
+#define SPEC_JIT_THRESHOLD 16
+#endif
+
+/*
+ * Specs are grouped per file type, (mode & S_IFMT) >> 12.  A node's
+ * types that none of its specs name share the slot S_IFMT >> 12, which
+ * no file type uses, holding only the specs without a type.
+ */
+#define SPEC_GROUP_MODES 16
+#define SPEC_GROUP_UNTYPED (S_IFMT >> 12)
+
+/*
+ * A directory in the prefix index built by selabel_open().  It records,
+ * highest index first, the specs whose regex starts with the literal
+ * path of this directory and goes no deeper.  The groups for a file
+ * type hold the same specs less those for other types, and are only
+ * compiled when a lookup first needs them.
+ */
+struct prefix_node {
+	char *name;			/* path component, without slashes */
+	unsigned int name_len;
+	struct prefix_node *children;	/* sorted by name */
+	unsigned int nchildren;
+	unsigned int alloc_children;
+	unsigned int *specs;		/* indexes into spec_arr */
+	unsigned int nspecs;
+	unsigned int alloc_specs;
+	unsigned int spec_modes;	/* bit per file type named by specs */
+	struct spec_group *groups[SPEC_GROUP_MODES];
+	unsigned int ngroups[SPEC_GROUP_MODES];
+};
+
+/* Deeper literal prefixes are indexed under their first components. */
+#define PREFIX_MAX_DEPTH 32
+
+/*
+ * The prefix index levels and stem lookup() found for the directory of
+ * the previous key.  Tree walks look up many names in the same
+ * directory in a row, and these only depend on the directory.
+ */
+struct dir_memo {
+	char *dir;			/* key up to and including its last '/' */
+	size_t len;
+	size_t alloc;
+	int file_stem;
+	unsigned int depth;
+	struct prefix_node *path[PREFIX_MAX_DEPTH + 1];
+};
+
+/* A spec without meta characters, hashed by the path it matches. */
+struct exact_entry {
+	char *path;		/* regex_str without escapes */
+	unsigned int len;
+	unsigned int hash;
+	unsigned int spec;	/* index into spec_arr */
+	int next;		/* next entry in the bucket, or -1 */
 };
 
 /* Where we map the file in during selabel_open() */
 struct mmap_area {
 	void *addr;
 	size_t len;
+	int file;		/* SPEC_FILE_* it was mapped for */
 	struct mmap_area *next;
 };
 
+/*
+ * The files a handle is built from, in the order they are read.  Each
+ * is loaded from its text or its ".bin", and selabel_reload() reads
+ * again only those whose text or ".bin" changed.
+ */
+enum {
+	SPEC_FILE_BASE,
+	SPEC_FILE_HOMEDIRS,
+	SPEC_FILE_LOCAL,
+	SPEC_FILE_NUM
+};
+
+struct file_stamp {
+	char present;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
 /* Our stored configuration */
 struct saved_data {
 	/*
@@ -61,11 +177,49 @@ struct saved_data {
 	struct stem *stem_arr;
 	int num_stems;
 	int alloc_stems;
+	int *stem_buckets;	/* first stem in each bucket, or -1 */
+	unsigned int stem_mask;
 	struct mmap_area *mmap_areas;
+
+	/*
+	 * Index of spec_arr by literal directory prefix, so that a lookup
+	 * only tries the specs that can match the directories of its key.
+	 */
+	struct prefix_node *prefix_root;
+
+	/*
+	 * Hash table of the specs that are plain paths.  Buckets hold the
+	 * index of their first entry, or -1; within a bucket entries are
+	 * ordered highest spec index first.
+	 */
+	struct exact_entry *exact_arr;
+	unsigned int nexact;
+	int *exact_buckets;
+	unsigned int exact_mask;
+
+	struct dir_memo memo;
+
+	/* lookup() copy of a key with duplicate slashes removed */
+	char *key_buf;
+	size_t key_alloc;
+
+	/*
+	 * What selabel_reload() needs to tell which files changed.  The
+	 * stems of the base file come first in stem_arr; those of the
+	 * others are looked up again when they are kept.
+	 */
+	char *prefix;
+	int baseonly;
+	int base_stems;
+	struct file_stamp stamps[SPEC_FILE_NUM][2];	/* text, .bin */
+	char *subs_paths[2];				/* dist, local */
+	struct file_stamp subs_stamps[2];
 };
 
 static inline pcre_extra *get_pcre_extra(struct spec *spec)
 {
+	if (spec->jit_sd)
+		return spec->jit_sd;
 	if (spec->from_mmap)
 		return &spec->lsd;
 	else
@@ -215,6 +369,18 @@ static inline int sort_specs(struct saved_data *data)
 	return 0;
 }
 
+/* FNV-1a */
+static inline unsigned int path_hash(const char *path, size_t len)
+{
+	unsigned int hash = 2166136261U;
+
+	while (len--) {
+		hash ^= (unsigned char)*path++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
 /* Return the length of the text that can be considered the stem, returns 0
  * if there is no identifiable stem */
 static inline int get_stem_from_spec(const char *const buf)
@@ -237,10 +403,17 @@ static inline int get_stem_from_spec(const char *const buf)
  */
 static inline int find_stem(struct saved_data *data, const char *buf, int stem_len)
 {
+	unsigned int hash;
 	int i;
 
-	for (i = 0; i < data->num_stems; i++) {
-		if (stem_len == data->stem_arr[i].len &&
+	if (!data->stem_buckets)
+		return -1;
+
+	hash = path_hash(buf, stem_len);
+	for (i = data->stem_buckets[hash & data->stem_mask]; i >= 0;
+	     i = data->stem_arr[i].next) {
+		if (data->stem_arr[i].hash == hash &&
+		    stem_len == data->stem_arr[i].len &&
 		    !strncmp(buf, data->stem_arr[i].buf, stem_len))
 			return i;
 	}
@@ -248,23 +421,56 @@ static inline int find_stem(struct saved_data *data, const char *buf, int stem_l
 	return -1;
 }
 
+/* Grow stem_arr, and its hash table to keep that at most half full. */
+static int grow_stems(struct saved_data *data)
+{
+	int alloc = data->alloc_stems * 2 + 16;
+	unsigned int nbuckets = 1;
+	struct stem *tmp_arr;
+	int *buckets;
+	int i;
+
+	tmp_arr = realloc(data->stem_arr, sizeof(*tmp_arr) * alloc);
+	if (!tmp_arr)
+		return -1;
+	data->stem_arr = tmp_arr;
+
+	while (nbuckets < (unsigned int)alloc * 2)
+		nbuckets <<= 1;
+	buckets = malloc(nbuckets * sizeof(*buckets));
+	if (!buckets)
+		return -1;
+	memset(buckets, -1, nbuckets * sizeof(*buckets));
+	for (i = 0; i < data->num_stems; i++) {
+		tmp_arr[i].next = buckets[tmp_arr[i].hash & (nbuckets - 1)];
+		buckets[tmp_arr[i].hash & (nbuckets - 1)] = i;
+	}
+
+	free(data->stem_buckets);
+	data->stem_buckets = buckets;
+	data->stem_mask = nbuckets - 1;
+	data->alloc_stems = alloc;
+	return 0;
+}
+
 /* returns the index of the new stored object */
 static inline int store_stem(struct saved_data *data, char *buf, int stem_len)
 {
 	int num = data->num_stems;
+	struct stem *stem;
+	unsigned int hash;
 
-	if (data->alloc_stems == num) {
-		struct stem *tmp_arr;
+	if (data->alloc_stems == num && grow_stems(data))
+		return -1;
 
-		data->alloc_stems = data->alloc_stems * 2 + 16;
-		tmp_arr = realloc(data->stem_arr,
-				  sizeof(*tmp_arr) * data->alloc_stems);
-		if (!tmp_arr)
-			return -1;
-		data->stem_arr = tmp_arr;
-	}
-	data->stem_arr[num].len = stem_len;
-	data->stem_arr[num].buf = buf;
+	hash = path_hash(buf, stem_len);
+	stem = &data->stem_arr[num];
+	stem->len = stem_len;
+	stem->buf = buf;
+	stem->from_mmap = 0;
+	stem->hash = hash;
+	stem->next = data->stem_buckets[hash & data->stem_mask];
+	data->stem_buckets[hash & data->stem_mask] = num;
 	data->num_stems++;
 
 	return num;
@@ -0,0 +1,503 @@
+/*
+ * Compile a file contexts configuration into the binary form that
+ * the file contexts backend maps in, file_contexts.bin.
+ *
+ * This used to be all of sefcontext_compile; it lives in the library
+ * so that libsemanage can compile the contexts files it installs
+ * without running a program for each of them.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pcre.h>
+
+#include <linux/limits.h>
+
+#include <selinux/label.h>
+#include "callbacks.h"
+#include "label_file.h"
+
+/* Upper bound on the threads compiling regexes. */
+#define COMPILE_MAX_THREADS 64
+
+static int process_file(struct saved_data *data, const char *filename)
+{
+	struct spec *spec;
+	unsigned int line_num;
+	char *line_buf = NULL;
+	size_t line_len = 0;
+	ssize_t len;
+	FILE *context_file;
+	int rc = -1;
+
+	context_file = fopen(filename, "r");
+	if (!context_file) {
+		selinux_log(SELINUX_ERROR, "Error opening %s: %s\n",
+			    filename, strerror(errno));
+		return -1;
+	}
+
+	line_num = 0;
+	while ((len = getline(&line_buf, &line_len, context_file)) != -1) {
+		char *context;
+		char *mode;
+		char *regex;
+		char *buf_p;
+		int items;
+
+		line_num++;
+		if (len > 0 && line_buf[len - 1] == '\n')
+			line_buf[len - 1] = 0;
+		buf_p = line_buf;
+		while (isspace(*buf_p))
+			buf_p++;
+		/* Skip comment lines and empty lines. */
+		if (*buf_p == '#' || *buf_p == 0)
+			continue;
+
+		items = sscanf(line_buf, "%ms %ms %ms", &regex, &mode, &context);
+		if (items < 2 || items > 3) {
+			selinux_log(SELINUX_WARNING,
+				    "%s: line %u is invalid, skipping: %s\n",
+				    filename, line_num, line_buf);
+			if (items > 0)
+				free(regex);
+			if (items > 1)
+				free(mode);
+			continue;
+		}
+
+		if (items == 2) {
+			context = mode;
+			mode = NULL;
+		}
+
+		if (grow_specs(data)) {
+			free(regex);
+			free(mode);
+			free(context);
+			goto out;
+		}
+
+		spec = &data->spec_arr[data->nspec];
+
+		spec->lr.ctx_raw = context;
+		spec->mode = string_to_mode(mode);
+		if (spec->mode == (mode_t)-1) {
+			selinux_log(SELINUX_WARNING,
+				    "%s: line %u has invalid file type %s\n",
+				    filename, line_num, mode);
+			spec->mode = 0;
+		}
+		free(mode);
+		spec->regex_str = regex;
+		spec->stem_id = find_stem_from_spec(data, regex);
+		spec_hasMetaChars(spec);
+
+		data->nspec++;
+	}
+
+	rc = 0;
+out:
+	free(line_buf);
+	fclose(context_file);
+	return rc;
+}
+
+/* What one thread compiles: every stride'th spec from first on. */
+struct compile_work {
+	pthread_t thread;
+	struct saved_data *data;
+	unsigned int first;
+	unsigned int stride;
+	/* the lowest failing spec, and why, if rc is -1 */
+	int rc;
+	unsigned int failed;
+	const char *err;
+	int erroff;
+};
+
+static void *compile_specs(void *arg)
+{
+	struct compile_work *work = arg;
+	struct saved_data *data = work->data;
+	char *anchored_regex = NULL;
+	size_t anchored_len = 0;
+	unsigned int i;
+
+	for (i = work->first; i < data->nspec; i += work->stride) {
+		struct spec *spec = &data->spec_arr[i];
+		const char *regex = spec->regex_str;
+		size_t regex_len;
+
+		/* skip past the fixed stem part */
+		if (spec->stem_id != -1)
+			regex += data->stem_arr[spec->stem_id].len;
+
+		regex_len = strlen(regex);
+		if (regex_len + 3 > anchored_len) {
+			char *tmp = realloc(anchored_regex, regex_len + 3);
+
+			if (!tmp) {
+				work->err = strerror(ENOMEM);
+				work->erroff = -1;
+				goto fail;
+			}
+			anchored_regex = tmp;
+			anchored_len = regex_len + 3;
+		}
+		anchored_regex[0] = '^';
+		memcpy(anchored_regex + 1, regex, regex_len);
+		anchored_regex[regex_len + 1] = '$';
+		anchored_regex[regex_len + 2] = '\0';
+
+		spec->regex = pcre_compile(anchored_regex, 0, &work->err,
+					   &work->erroff, NULL);
+		if (!spec->regex)
+			goto fail;
+
+		spec->sd = pcre_study(spec->regex, 0, &work->err);
+		if (!spec->sd) {
+			if (!work->err)
+				work->err = "no study data";
+			work->erroff = -1;
+			goto fail;
+		}
+		spec->regcomp = 1;
+	}
+
+	free(anchored_regex);
+	work->rc = 0;
+	return NULL;
+
+fail:
+	free(anchored_regex);
+	work->failed = i;
+	work->rc = -1;
+	return NULL;
+}
+
+/*
+ * Compile the regexes of all the specs, on up to nthreads threads.
+ * Which thread compiles a spec does not change the output, so the
+ * file written is the same however many there are.
+ */
+static int compile_regexes(struct saved_data *data, unsigned int nthreads)
+{
+	struct compile_work works[COMPILE_MAX_THREADS];
+	struct compile_work *failed = NULL;
+	unsigned int i, started;
+
+	if (nthreads == 0) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nthreads = ncpus > 0 ? ncpus : 1;
+	}
+	if (nthreads > COMPILE_MAX_THREADS)
+		nthreads = COMPILE_MAX_THREADS;
+	/* Threads are not worth starting for a handful of regexes. */
+	if (nthreads > data->nspec / 64)
+		nthreads = data->nspec / 64;
+	if (nthreads == 0)
+		nthreads = 1;
+
+	for (i = 0; i < nthreads; i++) {
+		works[i].data = data;
+		works[i].first = i;
+		works[i].stride = nthreads;
+	}
+
+	/* The calling thread takes the first share itself. */
+	for (started = 1; started < nthreads; started++) {
+		if (pthread_create(&works[started].thread, NULL,
+				   compile_specs, &works[started]))
+			break;
+	}
+	/* Any share that got no thread of its own is done here too. */
+	for (i = started; i < nthreads; i++)
+		compile_specs(&works[i]);
+	compile_specs(&works[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(works[i].thread, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		if (works[i].rc &&
+		    (!failed || works[i].failed < failed->failed))
+			failed = &works[i];
+	}
+	if (!failed)
+		return 0;
+
+	if (failed->erroff >= 0)
+		selinux_log(SELINUX_ERROR,
+			    "PCRE compilation failed for %s at offset %d: %s\n",
+			    data->spec_arr[failed->failed].regex_str,
+			    failed->erroff, failed->err);
+	else
+		selinux_log(SELINUX_ERROR, "PCRE study failed for %s: %s\n",
+			    data->spec_arr[failed->failed].regex_str,
+			    failed->err);
+	return -1;
+}
+
+/*
+ * File Format
+ *
+ * u32 - magic number
+ * u32 - version
+ * u32 - number of stems
+ * ** Stems
+ * 	u32  - length of stem EXCLUDING nul
+ * 	char - stem char array INCLUDING nul
+ * u32 - number of regexs
+ * ** Regexes
+ * 	u32  - length of upcoming context INCLUDING nul
+ * 	char - char array of the raw context
+ *	u32  - length of the upcoming regex_str
+ *	char - char array of the original regex string including the stem.
+ *	mode_t - mode bits
+ *	s32  - stemid associated with the regex
+ *	u32  - spec has meta characters
+ *	u32  - data length of the pcre regex
+ *	char - a bufer holding the raw pcre regex info
+ *	u32  - data length of the pcre regex study daya
+ *	char - a buffer holding the raw pcre regex study data
+ */
+static int write_binary_file(struct saved_data *data, FILE *bin_file)
+{
+	struct spec *specs = data->spec_arr;
+	size_t len;
+	uint32_t magic = SELINUX_MAGIC_COMPILED_FCONTEXT;
+	uint32_t section_len;
+	uint32_t i;
+
+	/* write some magic number */
+	len = fwrite(&magic, sizeof(uint32_t), 1, bin_file);
+	if (len != 1)
+		return -1;
+
+	/* write the version */
+	section_len = SELINUX_COMPILED_FCONTEXT_MAX_VERS;
+	len = fwrite(&section_len, sizeof(uint32_t), 1, bin_file);
+	if (len != 1)
+		return -1;
+
+	/* write the number of stems coming */
+	section_len = data->num_stems;
+	len = fwrite(&section_len, sizeof(uint32_t), 1, bin_file);
+	if (len != 1)
+		return -1;
+
+	for (i = 0; i < section_len; i++) {
+		char *stem = data->stem_arr[i].buf;
+		uint32_t stem_len = data->stem_arr[i].len;
+
+		/* write the strlen (aka no nul) */
+		len = fwrite(&stem_len, sizeof(uint32_t), 1, bin_file);
+		if (len != 1)
+			return -1;
+
+		/* include the nul in the file */
+		stem_len += 1;
+		len = fwrite(stem, sizeof(char), stem_len, bin_file);
+		if (len != stem_len)
+			return -1;
+	}
+
+	/* write the number of regexes coming */
+	section_len = data->nspec;
+	len = fwrite(&section_len, sizeof(uint32_t), 1, bin_file);
+	if (len != 1)
+		return -1;
+
+	for (i = 0; i < section_len; i++) {
+		char *context = specs[i].lr.ctx_raw;
+		char *regex_str = specs[i].regex_str;
+		mode_t mode = specs[i].mode;
+		int32_t stem_id = specs[i].stem_id;
+		pcre *re = specs[i].regex;
+		pcre_extra *sd = get_pcre_extra(&specs[i]);
+		uint32_t to_write;
+		size_t size;
+
+		/* length of the context string (including nul) */
+		to_write = strlen(context) + 1;
+		len = fwrite(&to_write, sizeof(uint32_t), 1, bin_file);
+		if (len != 1)
+			return -1;
+
+		/* original context strin (including nul) */
+		len = fwrite(context, sizeof(char), to_write, bin_file);
+		if (len != to_write)
+			return -1;
+
+		/* length of the original regex string (including nul) */
+		to_write = strlen(regex_str) + 1;
+		len = fwrite(&to_write, sizeof(uint32_t), 1, bin_file);
+		if (len != 1)
+			return -1;
+
+		/* original regex string */
+		len = fwrite(regex_str, sizeof(char), to_write, bin_file);
+		if (len != to_write)
+			return -1;
+
+		/* binary F_MODE bits */
+		len = fwrite(&mode, sizeof(mode), 1, bin_file);
+		if (len != 1)
+			return -1;
+
+		/* stem for this regex (could be -1) */
+		len = fwrite(&stem_id, sizeof(stem_id), 1, bin_file);
+		if (len != 1)
+			return -1;
+
+		/* does this spec have a metaChar? */
+		to_write = specs[i].hasMetaChars;
+		len = fwrite(&to_write, sizeof(to_write), 1, bin_file);
+		if (len != 1)
+			return -1;
+
+		/* determine the size of the pcre data in bytes */
+		if (pcre_fullinfo(re, NULL, PCRE_INFO_SIZE, &size) < 0)
+			return -1;
+
+		/* write the number of bytes in the pcre data */
+		to_write = size;
+		len = fwrite(&to_write, sizeof(uint32_t), 1, bin_file);
+		if (len != 1)
+			return -1;
+
+		/* write the actual pcre data as a char array */
+		len = fwrite(re, 1, to_write, bin_file);
+		if (len != to_write)
+			return -1;
+
+		/* determine the size of the pcre study info */
+		if (pcre_fullinfo(re, sd, PCRE_INFO_STUDYSIZE, &size) < 0)
+			return -1;
+
+		/* write the number of bytes in the pcre study data */
+		to_write = size;
+		len = fwrite(&to_write, sizeof(uint32_t), 1, bin_file);
+		if (len != 1)
+			return -1;
+
+		/* write the actual pcre study data as a char array */
+		len = fwrite(sd->study_data, 1, to_write, bin_file);
+		if (len != to_write)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void free_specs(struct saved_data *data)
+{
+	struct spec *specs = data->spec_arr;
+	unsigned int num_entries = data->nspec;
+	unsigned int i;
+
+	for (i = 0; i < num_entries; i++) {
+		free(specs[i].lr.ctx_raw);
+		free(specs[i].regex_str);
+		if (specs[i].regex)
+			pcre_free(specs[i].regex);
+		if (specs[i].sd)
+			pcre_free_study(specs[i].sd);
+	}
+	free(specs);
+
+	num_entries = data->num_stems;
+	for (i = 0; i < num_entries; i++)
+		free(data->stem_arr[i].buf);
+	free(data->stem_arr);
+	free(data->stem_buckets);
+
+	memset(data, 0, sizeof(*data));
+}
+
+int selabel_file_compile(const char *path, const char *bin_path,
+			 unsigned int nthreads)
+{
+	struct saved_data data;
+	char stack_path[PATH_MAX + 1];
+	char *tmp = NULL;
+	FILE *bin_file = NULL;
+	int fd = -1;
+	int rc = -1, saved_errno;
+
+	memset(&data, 0, sizeof(data));
+
+	if (!bin_path) {
+		rc = snprintf(stack_path, sizeof(stack_path), "%s.bin", path);
+		if (rc < 0 || (size_t)rc >= sizeof(stack_path)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		bin_path = stack_path;
+	}
+
+	rc = -1;
+	if (process_file(&data, path) < 0)
+		goto out;
+
+	if (compile_regexes(&data, nthreads) < 0)
+		goto out;
+
+	if (data.nspec && sort_specs(&data))
+		goto out;
+
+	if (asprintf(&tmp, "%sXXXXXX", bin_path) < 0) {
+		tmp = NULL;
+		goto out;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+
+	bin_file = fdopen(fd, "w");
+	if (!bin_file)
+		goto out;
+	fd = -1;
+
+	if (write_binary_file(&data, bin_file) < 0) {
+		selinux_log(SELINUX_ERROR, "Error writing %s: %s\n", tmp,
+			    strerror(errno));
+		goto out;
+	}
+
+	rc = fclose(bin_file);
+	bin_file = NULL;
+	if (rc) {
+		rc = -1;
+		goto out;
+	}
+
+	rc = rename(tmp, bin_path);
+	if (rc == 0) {
+		free(tmp);
+		tmp = NULL;
+	}
+
+out:
+	saved_errno = errno;
+	if (bin_file)
+		fclose(bin_file);
+	if (fd >= 0)
+		close(fd);
+	if (tmp) {
+		unlink(tmp);
+		free(tmp);
+	}
+	free_specs(&data);
+	errno = saved_errno;
+	return rc;
+}
@@ -10,6 +10,8 @@
 
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include <selinux/selinux.h>
 #include <selinux/label.h>
 #include "dso.h"
@@ -36,10 +38,28 @@ struct selabel_sub {
 	int slen;
 	char *dst;
 	struct selabel_sub *next;
+	/* index state, set by selabel_open */
+	uint32_t hash;		/* of src */
+	unsigned prio;		/* position in the list; lower wins */
+	struct selabel_sub *hnext;	/* in the hash chain */
+};
+
+/*
+ * Substitutions indexed by their source path, so that a lookup hashes
+ * each '/'-terminated prefix of the path once instead of comparing it
+ * against every entry.
+ */
+struct selabel_sub_table {
+	struct selabel_sub **buckets;	/* NULL: walk the list */
+	uint32_t mask;
 };
 
 extern struct selabel_sub *selabel_subs_init(const char *path,
 					     struct selabel_sub *list);
+/* Free the substitutions of rec and index these instead. */
+extern void selabel_subs_replace(struct selabel_handle *rec,
+				 struct selabel_sub *dist_subs,
+				 struct selabel_sub *subs) hidden;
 
 struct selabel_lookup_rec {
 	char * ctx_raw;
@@ -57,6 +77,8 @@ struct selabel_handle {
 						   const char *key, int type);
 	void (*func_close) (struct selabel_handle *h);
 	void (*func_stats) (struct selabel_handle *h);
+	/* optional; 1 if anything changed, 0 if not, -1 on error */
+	int (*func_reload) (struct selabel_handle *h);
 
 	/* supports backend-specific state information */
 	void *data;
@@ -70,8 +92,71 @@ struct selabel_handle {
 	/* substitution support */
 	struct selabel_sub *dist_subs;
 	struct selabel_sub *subs;
+	struct selabel_sub_table dist_subs_table;
+	struct selabel_sub_table subs_table;
 };
 
+/*
+ * Lookup index for the backends that try their specs in file order
+ * (media, X, db).  Specs with a literal key are hashed by type and key;
+ * the others are kept in order, and only those before the first literal
+ * hit need to be tried with the backend's match function.
+ */
+struct selabel_index {
+	unsigned int nspec;
+	unsigned int mask;
+	const char **key;
+	int *type;
+	unsigned int *hash;
+	unsigned int *head;		/* bucket -> first spec + 1 */
+	unsigned int *next;		/* spec -> next spec in bucket + 1 */
+	unsigned int *pattern;		/* non-literal specs, in order */
+	unsigned int npattern;
+};
+
+extern int selabel_index_init(struct selabel_index *ix,
+			      unsigned int nspec) hidden;
+/* specs must be added in file order */
+extern void selabel_index_add(struct selabel_index *ix, unsigned int i,
+			      const char *key, int type, int literal) hidden;
+/* returns the first matching spec, or -1 */
+extern int selabel_index_lookup(const struct selabel_index *ix,
+				const char *key, int type,
+				int (*match) (const char *pattern,
+					      const char *key)) hidden;
+extern void selabel_index_destroy(struct selabel_index *ix) hidden;
+
+/*
+ * Compiled specification files for the media, X and db backends,
+ * written by selabel_compile(8) next to the text file as "<path>.bin":
+ *
+ *	uint32_t magic, version, backend, nspec
+ *	nspec times:
+ *		uint32_t type
+ *		uint32_t key length (including the NUL), key
+ *		uint32_t context length (including the NUL), context
+ *
+ * The specs are in file order and the values in host byte order.
+ */
+#define SELINUX_MAGIC_COMPILED_SPECS	0xf97cff8b
+#define SELINUX_COMPILED_SPECS_VERSION	1
+
+struct selabel_compiled {
+	char *addr;
+	size_t len;
+	size_t off;
+	uint32_t nspec;
+};
+
+/* returns 1 if a current compiled file was mapped, 0 if there is none */
+extern int selabel_compiled_open(struct selabel_compiled *c, const char *path,
+				 const struct stat *sb,
+				 unsigned int backend) hidden;
+/* the key and context point into the mapping */
+extern int selabel_compiled_spec(struct selabel_compiled *c, int *type,
+				 const char **key, const char **ctx) hidden;
+extern void selabel_compiled_close(struct selabel_compiled *c) hidden;
+
 /*
  * Validation function
  */
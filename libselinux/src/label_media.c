@@ -28,8 +28,17 @@ typedef struct spec {
 struct saved_data {
 	unsigned int nspec;
 	spec_t *spec_arr;
+	struct selabel_index index;
+	struct selabel_compiled compiled;	/* keys point into it */
 };
 
+/* "*" is the only pattern a media key can be */
+static int match_any(const char *pattern __attribute__((unused)),
+		     const char *key __attribute__((unused)))
+{
+	return 1;
+}
+
 static int process_line(const char *path, char *line_buf, int pass,
 			unsigned lineno, struct selabel_handle *rec)
 {
@@ -67,6 +76,30 @@ static int process_line(const char *path, char *line_buf, int pass,
 	return 0;
 }
 
+static int load_compiled(struct saved_data *data)
+{
+	struct selabel_compiled *c = &data->compiled;
+	const char *key, *context;
+	int type;
+
+	data->spec_arr = calloc(c->nspec ? c->nspec : 1, sizeof(spec_t));
+	if (!data->spec_arr)
+		return -1;
+
+	while (data->nspec < c->nspec) {
+		spec_t *spec = &data->spec_arr[data->nspec];
+
+		if (selabel_compiled_spec(c, &type, &key, &context) < 0)
+			return -1;
+		spec->key = (char *)key;
+		spec->lr.ctx_raw = strdup(context);
+		if (!spec->lr.ctx_raw)
+			return -1;
+		data->nspec++;
+	}
+	return 0;
+}
+
 static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 		unsigned n)
 {
@@ -75,7 +108,7 @@ static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 	const char *path = NULL;
 	char *line_buf = NULL;
 	size_t line_len = 0;
-	int status = -1;
+	int status = -1, rc;
 	unsigned int lineno, pass, maxnspec;
 	struct stat sb;
 
@@ -102,6 +135,15 @@ static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 	}
 	rec->spec_file = strdup(path);
 
+	rc = selabel_compiled_open(&data->compiled, path, &sb, SELABEL_CTX_MEDIA);
+	if (rc < 0)
+		goto finish;
+	if (rc > 0) {
+		if (load_compiled(data) < 0)
+			goto finish;
+		goto index;
+	}
+
 	/* 
 	 * Perform two passes over the specification file.
 	 * The first pass counts the number of specifications and
@@ -136,6 +178,14 @@ static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 	}
 	free(line_buf);
 
+index:
+	if (selabel_index_init(&data->index, data->nspec) < 0)
+		goto finish;
+	for (lineno = 0; lineno < data->nspec; lineno++) {
+		const char *key = data->spec_arr[lineno].key;
+		selabel_index_add(&data->index, lineno, key, 0, strcmp(key, "*"));
+	}
+
 	status = 0;
 finish:
 	fclose(fp);
@@ -153,13 +203,16 @@ static void close(struct selabel_handle *rec)
 
 	for (i = 0; i < data->nspec; i++) {
 		spec = &spec_arr[i];
-		free(spec->key);
+		if (!data->compiled.addr)
+			free(spec->key);
 		free(spec->lr.ctx_raw);
 		free(spec->lr.ctx_trans);
 	}
 
 	if (spec_arr)
 	    free(spec_arr);
+	selabel_index_destroy(&data->index);
+	selabel_compiled_close(&data->compiled);
 
 	memset(data, 0, sizeof(*data));
 }
@@ -170,16 +223,10 @@ static struct selabel_lookup_rec *lookup(struct selabel_handle *rec,
 {
 	struct saved_data *data = (struct saved_data *)rec->data;
 	spec_t *spec_arr = data->spec_arr;
-	unsigned int i;
-
-	for (i = 0; i < data->nspec; i++) {
-		if (!strncmp(spec_arr[i].key, key, strlen(key) + 1))
-			break;
-		if (!strncmp(spec_arr[i].key, "*", 2))
-			break;
-	}
+	int i;
 
-	if (i >= data->nspec) {
+	i = selabel_index_lookup(&data->index, key, 0, match_any);
+	if (i < 0) {
 		/* No matching specification. */
 		errno = ENOENT;
 		return NULL;
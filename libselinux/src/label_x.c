@@ -30,8 +30,15 @@ typedef struct spec {
 struct saved_data {
 	unsigned int nspec;
 	spec_t *spec_arr;
+	struct selabel_index index;
+	struct selabel_compiled compiled;	/* keys point into it */
 };
 
+static int match_fn(const char *pattern, const char *key)
+{
+	return !fnmatch(pattern, key, 0);
+}
+
 static int process_line(const char *path, char *line_buf, int pass,
 			unsigned lineno, struct selabel_handle *rec)
 {
@@ -94,6 +101,31 @@ static int process_line(const char *path, char *line_buf, int pass,
 	return 0;
 }
 
+static int load_compiled(struct saved_data *data)
+{
+	struct selabel_compiled *c = &data->compiled;
+	const char *key, *context;
+	int type;
+
+	data->spec_arr = calloc(c->nspec ? c->nspec : 1, sizeof(spec_t));
+	if (!data->spec_arr)
+		return -1;
+
+	while (data->nspec < c->nspec) {
+		spec_t *spec = &data->spec_arr[data->nspec];
+
+		if (selabel_compiled_spec(c, &type, &key, &context) < 0)
+			return -1;
+		spec->key = (char *)key;
+		spec->type = type;
+		spec->lr.ctx_raw = strdup(context);
+		if (!spec->lr.ctx_raw)
+			return -1;
+		data->nspec++;
+	}
+	return 0;
+}
+
 static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 		unsigned n)
 {
@@ -102,7 +134,7 @@ static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 	const char *path = NULL;
 	char *line_buf = NULL;
 	size_t line_len = 0;
-	int status = -1;
+	int status = -1, rc;
 	unsigned int lineno, pass, maxnspec;
 	struct stat sb;
 
@@ -129,6 +161,15 @@ static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 	}
 	rec->spec_file = strdup(path);
 
+	rc = selabel_compiled_open(&data->compiled, path, &sb, SELABEL_CTX_X);
+	if (rc < 0)
+		goto finish;
+	if (rc > 0) {
+		if (load_compiled(data) < 0)
+			goto finish;
+		goto index;
+	}
+
 	/* 
 	 * Perform two passes over the specification file.
 	 * The first pass counts the number of specifications and
@@ -163,6 +204,15 @@ static int init(struct selabel_handle *rec, struct selinux_opt *opts,
 	}
 	free(line_buf);
 
+index:
+	if (selabel_index_init(&data->index, data->nspec) < 0)
+		goto finish;
+	for (lineno = 0; lineno < data->nspec; lineno++) {
+		spec_t *spec = &data->spec_arr[lineno];
+		selabel_index_add(&data->index, lineno, spec->key, spec->type,
+				  !strpbrk(spec->key, "*?[\\"));
+	}
+
 	status = 0;
 finish:
 	fclose(fp);
@@ -180,13 +230,16 @@ static void close(struct selabel_handle *rec)
 
 	for (i = 0; i < data->nspec; i++) {
 		spec = &spec_arr[i];
-		free(spec->key);
+		if (!data->compiled.addr)
+			free(spec->key);
 		free(spec->lr.ctx_raw);
 		free(spec->lr.ctx_trans);
 	}
 
 	if (spec_arr)
 	    free(spec_arr);
+	selabel_index_destroy(&data->index);
+	selabel_compiled_close(&data->compiled);
 
 	memset(data, 0, sizeof(*data));
 }
@@ -196,16 +249,10 @@ static struct selabel_lookup_rec *lookup(struct selabel_handle *rec,
 {
 	struct saved_data *data = (struct saved_data *)rec->data;
 	spec_t *spec_arr = data->spec_arr;
-	unsigned int i;
-
-	for (i = 0; i < data->nspec; i++) {
-		if (spec_arr[i].type != type)
-			continue;
-		if (!fnmatch(spec_arr[i].key, key, 0))
-			break;
-	}
+	int i;
 
-	if (i >= data->nspec) {
+	i = selabel_index_lookup(&data->index, key, type, match_fn);
+	if (i < 0) {
 		/* No matching specification. */
 		errno = ENOENT;
 		return NULL;
@@ -56,7 +56,7 @@ int selinux_mkload_policy(int preservebools)
 	struct utsname uts;
 	size_t size;
 	void *map, *data;
-	int fd, rc = -1, prot;
+	int fd, rc = -1, skipusers = 0;
 	sepol_policydb_t *policydb;
 	sepol_policy_file_t *pf;
 	int usesepol = 0;
@@ -70,9 +70,9 @@ int selinux_mkload_policy(int preservebools)
 	int (*policydb_read)(sepol_policydb_t *, sepol_policy_file_t *) = NULL;
 	int (*policydb_set_vers)(sepol_policydb_t *, unsigned int) = NULL;
 	int (*policydb_to_image)(sepol_handle_t *, sepol_policydb_t *, void **, size_t *) = NULL;
-	int (*genbools_array)(void *data, size_t len, char **names, int *values, int nel) = NULL;
-	int (*genusers)(void *data, size_t len, const char *usersdir, void **newdata, size_t * newlen) = NULL;
-	int (*genbools)(void *data, size_t len, char *boolpath) = NULL;
+	int (*policydb_genbools_array)(sepol_policydb_t *, char **names, int *values, int nel) = NULL;
+	int (*policydb_genusers)(sepol_policydb_t *, const char *usersdir) = NULL;
+	int (*policydb_genbools)(sepol_policydb_t *, const char *boolpath) = NULL;
 
 #ifdef SHARED
 	char *errormsg = NULL;
@@ -103,11 +103,11 @@ int selinux_mkload_policy(int preservebools)
 		DLERR();
 		policydb_to_image = dlsym(libsepolh, "sepol_policydb_to_image");
 		DLERR();
-		genbools_array = dlsym(libsepolh, "sepol_genbools_array");
+		policydb_genbools_array = dlsym(libsepolh, "sepol_policydb_genbools_array");
 		DLERR();
-		genusers = dlsym(libsepolh, "sepol_genusers");
+		policydb_genusers = dlsym(libsepolh, "sepol_policydb_genusers");
 		DLERR();
-		genbools = dlsym(libsepolh, "sepol_genbools");
+		policydb_genbools = dlsym(libsepolh, "sepol_policydb_genbools");
 		DLERR();
 
 #undef DLERR
@@ -124,9 +124,9 @@ int selinux_mkload_policy(int preservebools)
 	policydb_read = sepol_policydb_read;
 	policydb_set_vers = sepol_policydb_set_vers;
 	policydb_to_image = sepol_policydb_to_image;
-	genbools_array = sepol_genbools_array;
-	genusers = sepol_genusers;
-	genbools = sepol_genbools;
+	policydb_genbools_array = sepol_policydb_genbools_array;
+	policydb_genusers = sepol_policydb_genusers;
+	policydb_genbools = sepol_policydb_genbools;
 
 #endif
 
@@ -188,12 +188,9 @@ checkbool:
 		goto close;
 	}
 
-	prot = PROT_READ;
-	if (setlocaldefs || preservebools)
-		prot |= PROT_WRITE;
-
+	/* The mapping is only read: any changes go into a new image. */
 	size = sb.st_size;
-	data = map = mmap(NULL, size, prot, MAP_PRIVATE, fd, 0);
+	data = map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
 	if (map == MAP_FAILED) {
 		fprintf(stderr,
 			"SELinux:  Could not map policy file %s:  %s\n",
@@ -201,87 +198,98 @@ checkbool:
 		goto close;
 	}
 
-	if (vers > kernvers && usesepol) {
-		/* Need to downgrade to kernel-supported version. */
-		if (policy_file_create(&pf))
-			goto unmap;
-		if (policydb_create(&policydb)) {
-			policy_file_free(pf);
-			goto unmap;
-		}
-		policy_file_set_mem(pf, data, size);
-		if (policydb_read(policydb, pf)) {
-			policy_file_free(pf);
-			policydb_free(policydb);
-			goto unmap;
-		}
-		if (policydb_set_vers(policydb, kernvers) ||
-		    policydb_to_image(NULL, policydb, &data, &size)) {
-			/* Downgrade failed, keep searching. */
-			fprintf(stderr,
-				"SELinux:  Could not downgrade policy file %s, searching for an older version.\n",
-				path);
-			policy_file_free(pf);
-			policydb_free(policydb);
-			munmap(map, sb.st_size);
-			close(fd);
-			vers--;
-			goto search;
-		}
+	if (!usesepol || (vers <= kernvers && !setlocaldefs && !preservebools))
+		goto load;
+
+	/*
+	 * Downgrading to the kernel-supported version and applying the
+	 * local users and booleans all work on one policydb, read from
+	 * the mapping and written out to a new image once.
+	 */
+      transform:
+	rc = -1;
+	if (policy_file_create(&pf))
+		goto unmap;
+	if (policydb_create(&policydb)) {
 		policy_file_free(pf);
+		goto unmap;
+	}
+	policy_file_set_mem(pf, map, sb.st_size);
+	rc = policydb_read(policydb, pf);
+	policy_file_free(pf);
+	if (rc) {
+		rc = -1;
+		goto free_policydb;
+	}
+
+	if (vers > kernvers && policydb_set_vers(policydb, kernvers))
+		goto downgrade_failed;
+
+	if (setlocaldefs && !skipusers &&
+	    policydb_genusers(policydb, selinux_users_path()) < 0) {
+		/* Start over without the local users if they failed. */
 		policydb_free(policydb);
+		skipusers = 1;
+		goto transform;
 	}
 
-	if (usesepol) {
-		if (setlocaldefs) {
-			void *olddata = data;
-			size_t oldsize = size;
-			rc = genusers(olddata, oldsize, selinux_users_path(),
-				      &data, &size);
-			if (rc < 0) {
-				/* Fall back to the prior image if genusers failed. */
-				data = olddata;
-				size = oldsize;
-				rc = 0;
-			} else {
-				if (olddata != map)
-					free(olddata);
-			}
-		}
-		
 #ifndef DISABLE_BOOL
-		if (preservebools) {
-			int *values, len, i;
-			char **names;
-			rc = security_get_boolean_names(&names, &len);
-			if (!rc) {
-				values = malloc(sizeof(int) * len);
-				if (!values)
-					goto unmap;
-				for (i = 0; i < len; i++)
-					values[i] =
-						security_get_boolean_active(names[i]);
-				(void)genbools_array(data, size, names, values,
-						     len);
-				free(values);
-				for (i = 0; i < len; i++)
-					free(names[i]);
-				free(names);
+	if (preservebools) {
+		int *values, len, i;
+		char **names;
+		rc = security_get_boolean_names(&names, &len);
+		if (!rc) {
+			values = malloc(sizeof(int) * len);
+			if (!values) {
+				rc = -1;
+				goto free_policydb;
 			}
-		} else if (setlocaldefs) {
-			(void)genbools(data, size,
-				       (char *)selinux_booleans_path());
+			for (i = 0; i < len; i++)
+				values[i] =
+					security_get_boolean_active(names[i]);
+			(void)policydb_genbools_array(policydb, names, values,
+						      len);
+			free(values);
+			for (i = 0; i < len; i++)
+				free(names[i]);
+			free(names);
 		}
-#endif
+	} else if (setlocaldefs) {
+		(void)policydb_genbools(policydb, selinux_booleans_path());
 	}
+#endif
 
+	if (policydb_to_image(NULL, policydb, &data, &size)) {
+		if (vers > kernvers)
+			goto downgrade_failed;
+		rc = -1;
+		goto free_policydb;
+	}
+	policydb_free(policydb);
 
+      load:
 	rc = security_load_policy(data, size);
 	
 	if (rc)
 		fprintf(stderr,
 			"SELinux:  Could not load policy file %s:  %s\n",
 			path, strerror(errno));
+	goto unmap;
+
+      downgrade_failed:
+	/* Downgrade failed, keep searching. */
+	fprintf(stderr,
+		"SELinux:  Could not downgrade policy file %s, searching for an older version.\n",
+		path);
+	policydb_free(policydb);
+	munmap(map, sb.st_size);
+	close(fd);
+	vers--;
+	skipusers = 0;
+	goto search;
+
+      free_policydb:
+	policydb_free(policydb);
 
       unmap:
 	if (data != map)
@@ -14,15 +14,71 @@
  * Class and permission mappings
  */
 
+#define NBITS (sizeof(access_vector_t) * 8)
+#define NNIBBLES (NBITS / 4)
+
 struct selinux_mapping {
 	security_class_t value; /* real, kernel value */
 	unsigned num_perms;
-	access_vector_t perms[sizeof(access_vector_t) * 8];
+	access_vector_t perms[NBITS];
+	/* Translation tables indexed by each 4-bit nibble of a vector:
+	 * unmap: mapped perms -> kernel perms
+	 * map: kernel perms -> first mapped perm using each kernel bit
+	 * decide: kernel perms -> every mapped perm using each kernel bit */
+	access_vector_t unmap[NNIBBLES][16];
+	access_vector_t map[NNIBBLES][16];
+	access_vector_t decide[NNIBBLES][16];
 };
 
 static struct selinux_mapping *current_mapping = NULL;
 static security_class_t current_mapping_size = 0;
 
+/* kernel class value -> mapped class, 0 if not mapped */
+static security_class_t *kernel_mapping = NULL;
+static security_class_t kernel_mapping_size = 0;
+
+static void
+build_tables(struct selinux_mapping *m)
+{
+	access_vector_t first[NBITS], all[NBITS];
+	unsigned i, n, v, b;
+
+	for (b = 0; b < NBITS; b++)
+		first[b] = all[b] = 0;
+	for (i = 0; i < m->num_perms; i++)
+		for (b = 0; b < NBITS; b++)
+			if (m->perms[i] & (1U << b)) {
+				if (!first[b])
+					first[b] = 1U << i;
+				all[b] |= 1U << i;
+			}
+
+	for (n = 0; n < NNIBBLES; n++)
+		for (v = 0; v < 16; v++) {
+			m->unmap[n][v] = m->map[n][v] = m->decide[n][v] = 0;
+			for (b = 0; b < 4; b++) {
+				if (!(v & (1U << b)))
+					continue;
+				i = n * 4 + b;
+				if (i < m->num_perms)
+					m->unmap[n][v] |= m->perms[i];
+				m->map[n][v] |= first[i];
+				m->decide[n][v] |= all[i];
+			}
+		}
+}
+
+static inline access_vector_t
+translate(access_vector_t table[NNIBBLES][16], access_vector_t av)
+{
+	access_vector_t result = 0;
+	unsigned n;
+
+	for (n = 0; n < NNIBBLES; n++, av >>= 4)
+		result |= table[n][av & 0xf];
+	return result;
+}
+
 /*
  * Mapping setting function
  */
@@ -37,6 +93,9 @@ selinux_set_mapping(struct security_class_mapping *map)
 	free(current_mapping);
 	current_mapping = NULL;
 	current_mapping_size = 0;
+	free(kernel_mapping);
+	kernel_mapping = NULL;
+	kernel_mapping_size = 0;
 
 	if (avc_reset() < 0)
 		goto err;
@@ -56,6 +115,7 @@ selinux_set_mapping(struct security_class_mapping *map)
 		goto err;
 
 	/* Store the raw class and permission values */
+	kernel_mapping_size = 1;
 	j = 0;
 	while (map[j].name) {
 		struct security_class_mapping *p_in = map + (j++);
@@ -79,8 +139,18 @@ selinux_set_mapping(struct security_class_mapping *map)
 			k++;
 		}
 		p_out->num_perms = k;
+		build_tables(p_out);
+		if (p_out->value >= kernel_mapping_size)
+			kernel_mapping_size = p_out->value + 1;
 	}
 
+	kernel_mapping = calloc(kernel_mapping_size, sizeof(security_class_t));
+	if (!kernel_mapping)
+		goto err2;
+	/* the lowest mapped class wins if several share a kernel class */
+	for (j = i - 1; j > 0; j--)
+		kernel_mapping[current_mapping[j].value] = j;
+
 	/* Set the mapping size here so the above lookups are "raw" */
 	current_mapping_size = i;
 	return 0;
@@ -88,6 +158,9 @@ err2:
 	free(current_mapping);
 	current_mapping = NULL;
 	current_mapping_size = 0;
+	free(kernel_mapping);
+	kernel_mapping = NULL;
+	kernel_mapping_size = 0;
 err:
 	return -1;
 }
@@ -114,17 +187,8 @@ unmap_class(security_class_t tclass)
 access_vector_t
 unmap_perm(security_class_t tclass, access_vector_t tperm)
 {
-	if (tclass < current_mapping_size) {
-		unsigned i;
-		access_vector_t kperm = 0;
-
-		for (i=0; i<current_mapping[tclass].num_perms; i++)
-			if (tperm & (1<<i)) {
-				kperm |= current_mapping[tclass].perms[i];
-				tperm &= ~(1<<i);
-			}
-		return kperm;
-	}
+	if (tclass < current_mapping_size)
+		return translate(current_mapping[tclass].unmap, tperm);
 
 	/* If here no mapping set or the perm requested is not valid. */
 	if (current_mapping_size != 0) {
@@ -142,11 +206,10 @@ unmap_perm(security_class_t tclass, access_vector_t tperm)
 security_class_t
 map_class(security_class_t kclass)
 {
-	security_class_t i;
-
-	for (i=0; i<current_mapping_size; i++)
-		if (current_mapping[i].value == kclass)
-			return i;
+	if (current_mapping_size != 0 && kclass == 0)
+		return 0;
+	if (kclass < kernel_mapping_size && kernel_mapping[kclass])
+		return kernel_mapping[kclass];
 
 /* If here no mapping set or the class requested is not valid. */
 	if (current_mapping_size != 0) {
@@ -161,15 +224,9 @@ access_vector_t
 map_perm(security_class_t tclass, access_vector_t kperm)
 {
 	if (tclass < current_mapping_size) {
-		unsigned i;
-		access_vector_t tperm = 0;
-
-		for (i=0; i<current_mapping[tclass].num_perms; i++)
-			if (kperm & current_mapping[tclass].perms[i]) {
-				tperm |= 1<<i;
-				kperm &= ~current_mapping[tclass].perms[i];
-			}
+		access_vector_t tperm;
 
+		tperm = translate(current_mapping[tclass].map, kperm);
 		if (tperm == 0) {
 			errno = EINVAL;
 			return 0;
@@ -184,27 +241,11 @@ void
 map_decision(security_class_t tclass, struct av_decision *avd)
 {
 	if (tclass < current_mapping_size) {
-		unsigned i;
-		access_vector_t result;
-
-		for (i=0, result=0; i<current_mapping[tclass].num_perms; i++)
-			if (avd->allowed & current_mapping[tclass].perms[i])
-				result |= 1<<i;
-		avd->allowed = result;
-
-		for (i=0, result=0; i<current_mapping[tclass].num_perms; i++)
-			if (avd->decided & current_mapping[tclass].perms[i])
-				result |= 1<<i;
-		avd->decided = result;
-
-		for (i=0, result=0; i<current_mapping[tclass].num_perms; i++)
-			if (avd->auditallow & current_mapping[tclass].perms[i])
-				result |= 1<<i;
-		avd->auditallow = result;
-
-		for (i=0, result=0; i<current_mapping[tclass].num_perms; i++)
-			if (avd->auditdeny & current_mapping[tclass].perms[i])
-				result |= 1<<i;
-		avd->auditdeny = result;
+		struct selinux_mapping *m = &current_mapping[tclass];
+
+		avd->allowed = translate(m->decide, avd->allowed);
+		avd->decided = translate(m->decide, avd->decided);
+		avd->auditallow = translate(m->decide, avd->auditallow);
+		avd->auditdeny = translate(m->decide, avd->auditdeny);
 	}
 }
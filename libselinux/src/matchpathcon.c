@@ -2,12 +2,34 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include "selinux_internal.h"
 #include "label_internal.h"
 #include "callbacks.h"
 #include <limits.h>
 
-static __thread struct selabel_handle *hnd;
+/*
+ * Threads that initialize with the same options share one labeling
+ * handle instead of each loading and keeping its own copy of the file
+ * contexts configuration.  Lookups change state kept in the handle, so
+ * they are serialized by the handle's lock.
+ */
+struct shared_handle {
+	struct selabel_handle *hnd;
+	char *path;
+	char *subset;
+	int baseonly;
+	int validate;
+	unsigned int refcount;
+	pthread_mutex_t lock;
+	struct shared_handle *next;
+};
+
+static struct shared_handle *shared_handles;
+static pthread_mutex_t shared_handles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct shared_handle *hnd;
 
 /*
  * An array for mapping integers to contexts
@@ -145,13 +167,59 @@ typedef struct file_spec {
 /*
  * The hash table of associations, hashed by inode number.
  * Chaining is used for collisions, with elements ordered
- * by inode number in each bucket.  Each hash bucket has a dummy 
- * header.
+ * by inode number in each bucket.  The table starts small and
+ * doubles whenever it holds more elements than buckets, so a
+ * restorecon of a few files does not pay for a table sized for
+ * a full relabel, and a full relabel keeps its chains short.
+ */
+#define HASH_MIN_BITS 10
+#define HASH_MAX_BITS 24
+static file_spec_t **fl_head;
+static unsigned int fl_bits;
+static unsigned int fl_nel;
+
+static inline unsigned int fl_hash(ino_t ino, unsigned int bits)
+{
+	/* Fibonacci hashing spreads runs of sequential inode numbers */
+	return (unsigned int)(((uint64_t)ino * 0x9E3779B97F4A7C15ULL) >>
+			      (64 - bits));
+}
+
+static file_spec_t **fl_chain_pos(file_spec_t **heads, unsigned int bits,
+				  ino_t ino)
+{
+	file_spec_t **pos;
+
+	for (pos = &heads[fl_hash(ino, bits)]; *pos && ino < (*pos)->ino;
+	     pos = &(*pos)->next) ;
+	return pos;
+}
+
+/*
+ * Double the number of buckets.  Failure to grow is not an error,
+ * the chains just get longer.
  */
-#define HASH_BITS 16
-#define HASH_BUCKETS (1 << HASH_BITS)
-#define HASH_MASK (HASH_BUCKETS-1)
-static file_spec_t *fl_head;
+static void fl_grow(void)
+{
+	file_spec_t **heads, **pos, *fl, *next;
+	unsigned int bits = fl_bits + 1, h;
+
+	heads = calloc((size_t)1 << bits, sizeof(*heads));
+	if (!heads)
+		return;
+
+	for (h = 0; h < (1U << fl_bits); h++) {
+		for (fl = fl_head[h]; fl; fl = next) {
+			next = fl->next;
+			pos = fl_chain_pos(heads, bits, fl->ino);
+			fl->next = *pos;
+			*pos = fl;
+		}
+	}
+	free(fl_head);
+	fl_head = heads;
+	fl_bits = bits;
+}
 
 /*
  * Try to add an association between an inode and
@@ -162,51 +230,47 @@ static file_spec_t *fl_head;
  */
 int matchpathcon_filespec_add(ino_t ino, int specind, const char *file)
 {
-	file_spec_t *prevfl, *fl;
-	int h, ret;
+	file_spec_t **pos, *fl;
+	int ret;
 	struct stat sb;
 
 	if (!fl_head) {
-		fl_head = malloc(sizeof(file_spec_t) * HASH_BUCKETS);
+		fl_head = calloc(1U << HASH_MIN_BITS, sizeof(*fl_head));
 		if (!fl_head)
 			goto oom;
-		memset(fl_head, 0, sizeof(file_spec_t) * HASH_BUCKETS);
+		fl_bits = HASH_MIN_BITS;
+		fl_nel = 0;
 	}
 
-	h = (ino + (ino >> HASH_BITS)) & HASH_MASK;
-	for (prevfl = &fl_head[h], fl = fl_head[h].next; fl;
-	     prevfl = fl, fl = fl->next) {
-		if (ino == fl->ino) {
-			ret = lstat(fl->file, &sb);
-			if (ret < 0 || sb.st_ino != ino) {
-				fl->specind = specind;
-				free(fl->file);
-				fl->file = malloc(strlen(file) + 1);
-				if (!fl->file)
-					goto oom;
-				strcpy(fl->file, file);
-				return fl->specind;
-
-			}
-
-			if (!strcmp(con_array[fl->specind],
-				    con_array[specind]))
-				return fl->specind;
-
-			myprintf
-			    ("%s:  conflicting specifications for %s and %s, using %s.\n",
-			     __FUNCTION__, file, fl->file,
-			     con_array[fl->specind]);
+	pos = fl_chain_pos(fl_head, fl_bits, ino);
+	fl = *pos;
+	if (fl && ino == fl->ino) {
+		ret = lstat(fl->file, &sb);
+		if (ret < 0 || sb.st_ino != ino) {
+			fl->specind = specind;
 			free(fl->file);
 			fl->file = malloc(strlen(file) + 1);
 			if (!fl->file)
 				goto oom;
 			strcpy(fl->file, file);
 			return fl->specind;
+
 		}
 
-		if (ino > fl->ino)
-			break;
+		if (!strcmp(con_array[fl->specind],
+			    con_array[specind]))
+			return fl->specind;
+
+		myprintf
+		    ("%s:  conflicting specifications for %s and %s, using %s.\n",
+		     __FUNCTION__, file, fl->file,
+		     con_array[fl->specind]);
+		free(fl->file);
+		fl->file = malloc(strlen(file) + 1);
+		if (!fl->file)
+			goto oom;
+		strcpy(fl->file, file);
+		return fl->specind;
 	}
 
 	fl = malloc(sizeof(file_spec_t));
@@ -218,8 +282,10 @@ int matchpathcon_filespec_add(ino_t ino, int specind, const char *file)
 	if (!fl->file)
 		goto oom_freefl;
 	strcpy(fl->file, file);
-	fl->next = prevfl->next;
-	prevfl->next = fl;
+	fl->next = *pos;
+	*pos = fl;
+	if (++fl_nel > (1U << fl_bits) && fl_bits < HASH_MAX_BITS)
+		fl_grow();
 	return fl->specind;
       oom_freefl:
 	free(fl);
@@ -235,7 +301,8 @@ int matchpathcon_filespec_add(ino_t ino, int specind, const char *file)
 void matchpathcon_filespec_eval(void)
 {
 	file_spec_t *fl;
-	int h, used, nel, len, longest;
+	unsigned int h;
+	int used, nel, len, longest;
 
 	if (!fl_head)
 		return;
@@ -243,9 +310,9 @@ void matchpathcon_filespec_eval(void)
 	used = 0;
 	longest = 0;
 	nel = 0;
-	for (h = 0; h < HASH_BUCKETS; h++) {
+	for (h = 0; h < (1U << fl_bits); h++) {
 		len = 0;
-		for (fl = fl_head[h].next; fl; fl = fl->next) {
+		for (fl = fl_head[h]; fl; fl = fl->next) {
 			len++;
 		}
 		if (len)
@@ -256,8 +323,8 @@ void matchpathcon_filespec_eval(void)
 	}
 
 	myprintf
-	    ("%s:  hash table stats: %d elements, %d/%d buckets used, longest chain length %d\n",
-	     __FUNCTION__, nel, used, HASH_BUCKETS, longest);
+	    ("%s:  hash table stats: %d elements, %d/%u buckets used, longest chain length %d\n",
+	     __FUNCTION__, nel, used, 1U << fl_bits, longest);
 }
 
 /*
@@ -266,25 +333,26 @@ void matchpathcon_filespec_eval(void)
 void matchpathcon_filespec_destroy(void)
 {
 	file_spec_t *fl, *tmp;
-	int h;
+	unsigned int h;
 
 	free_array_elts();
 
 	if (!fl_head)
 		return;
 
-	for (h = 0; h < HASH_BUCKETS; h++) {
-		fl = fl_head[h].next;
+	for (h = 0; h < (1U << fl_bits); h++) {
+		fl = fl_head[h];
 		while (fl) {
 			tmp = fl;
 			fl = fl->next;
 			free(tmp->file);
 			free(tmp);
 		}
-		fl_head[h].next = NULL;
 	}
 	free(fl_head);
 	fl_head = NULL;
+	fl_bits = 0;
+	fl_nel = 0;
 }
 
 static void matchpathcon_thread_destructor(void __attribute__((unused)) *ptr)
@@ -306,6 +374,87 @@ static void matchpathcon_init_once(void)
 		destructor_key_initialized = 1;
 }
 
+static int same_option(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return !strcmp(a, b);
+}
+
+static void release_handle(struct shared_handle *sh)
+{
+	struct shared_handle **pp;
+
+	__selinux_mutex_lock(&shared_handles_lock);
+	if (--sh->refcount) {
+		__selinux_mutex_unlock(&shared_handles_lock);
+		return;
+	}
+	for (pp = &shared_handles; *pp != sh; pp = &(*pp)->next) ;
+	*pp = sh->next;
+	__selinux_mutex_unlock(&shared_handles_lock);
+
+	selabel_close(sh->hnd);
+	__selinux_mutex_destroy(&sh->lock);
+	free(sh->path);
+	free(sh->subset);
+	free(sh);
+}
+
+static struct shared_handle *acquire_handle(const char *path,
+					    const char *subset)
+{
+	struct shared_handle *sh;
+	int baseonly = !!options[SELABEL_OPT_BASEONLY].value;
+	int validate = !!options[SELABEL_OPT_VALIDATE].value;
+
+	__selinux_mutex_lock(&shared_handles_lock);
+	for (sh = shared_handles; sh; sh = sh->next) {
+		if (sh->baseonly == baseonly && sh->validate == validate &&
+		    same_option(sh->path, path) &&
+		    same_option(sh->subset, subset)) {
+			sh->refcount++;
+			goto out;
+		}
+	}
+
+	sh = calloc(1, sizeof(*sh));
+	if (!sh)
+		goto out;
+	if ((path && !(sh->path = strdup(path))) ||
+	    (subset && !(sh->subset = strdup(subset))))
+		goto err;
+	sh->hnd = selabel_open(SELABEL_CTX_FILE, options, SELABEL_NOPT);
+	if (!sh->hnd)
+		goto err;
+	sh->baseonly = baseonly;
+	sh->validate = validate;
+	sh->refcount = 1;
+	__selinux_mutex_init(&sh->lock);
+	sh->next = shared_handles;
+	shared_handles = sh;
+out:
+	__selinux_mutex_unlock(&shared_handles_lock);
+	return sh;
+err:
+	free(sh->path);
+	free(sh->subset);
+	free(sh);
+	sh = NULL;
+	goto out;
+}
+
+static int lookup_locked(char **con, const char *key, mode_t mode, int raw)
+{
+	int rc;
+
+	__selinux_mutex_lock(&hnd->lock);
+	rc = raw ? selabel_lookup_raw(hnd->hnd, con, key, mode) :
+		selabel_lookup(hnd->hnd, con, key, mode);
+	__selinux_mutex_unlock(&hnd->lock);
+	return rc;
+}
+
 int matchpathcon_init_prefix(const char *path, const char *subset)
 {
 	if (!mycanoncon)
@@ -319,7 +468,11 @@ int matchpathcon_init_prefix(const char *path, const char *subset)
 	options[SELABEL_OPT_PATH].type = SELABEL_OPT_PATH;
 	options[SELABEL_OPT_PATH].value = path;
 
-	hnd = selabel_open(SELABEL_CTX_FILE, options, SELABEL_NOPT);
+	if (hnd) {
+		release_handle(hnd);
+		hnd = NULL;
+	}
+	hnd = acquire_handle(path, subset);
 	return hnd ? 0 : -1;
 }
 
@@ -335,7 +488,7 @@ void matchpathcon_fini(void)
 	free_array_elts();
 
 	if (hnd) {
-		selabel_close(hnd);
+		release_handle(hnd);
 		hnd = NULL;
 	}
 }
@@ -422,9 +575,7 @@ int matchpathcon(const char *path, mode_t mode, char ** con)
 			path = p;
 	}
 
-	return notrans ?
-		selabel_lookup_raw(hnd, con, path, mode) :
-		selabel_lookup(hnd, con, path, mode);
+	return lookup_locked(con, path, mode, notrans);
 }
 
 int matchpathcon_index(const char *name, mode_t mode, char ** con)
@@ -439,7 +590,11 @@ int matchpathcon_index(const char *name, mode_t mode, char ** con)
 
 void matchpathcon_checkmatches(char *str __attribute__((unused)))
 {
-	selabel_stats(hnd);
+	if (!hnd)
+		return;
+	__selinux_mutex_lock(&hnd->lock);
+	selabel_stats(hnd->hnd);
+	__selinux_mutex_unlock(&hnd->lock);
 }
 
 /* Compare two contexts to see if their differences are "significant",
@@ -482,7 +637,7 @@ int selinux_file_context_verify(const char *path, mode_t mode)
 	if (!hnd && (matchpathcon_init_prefix(NULL, NULL) < 0))
 			return -1;
 
-	if (selabel_lookup_raw(hnd, &fcontext, path, mode) != 0) {
+	if (lookup_locked(&fcontext, path, mode, 1) != 0) {
 		if (errno != ENOENT)
 			rc = -1;
 		else
@@ -515,7 +670,7 @@ int selinux_lsetfilecon_default(const char *path)
 
 	/* If there's an error determining the context, or it has none, 
 	   return to allow default context */
-	if (selabel_lookup_raw(hnd, &scontext, path, st.st_mode)) {
+	if (lookup_locked(&scontext, path, st.st_mode, 1)) {
 		if (errno == ENOENT)
 			rc = 0;
 	} else {
@@ -1,4 +1,5 @@
 #include <sys/syscall.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <pthread.h>
@@ -19,6 +20,28 @@ static __thread char * prev_fscreate = UNSET;
 static __thread char * prev_keycreate = UNSET;
 static __thread char * prev_sockcreate = UNSET;
 
+/*
+ * The calling thread's own attribute files are kept open and reused
+ * with pread/pwrite at offset zero, which the kernel accepts on every
+ * open file.  The device and inode are checked on each use, so a
+ * descriptor that the application closed or reused is never written.
+ */
+#define ATTR_CURRENT	0
+#define ATTR_EXEC	1
+#define ATTR_FSCREATE	2
+#define ATTR_KEYCREATE	3
+#define ATTR_SOCKCREATE	4
+#define ATTR_PREV	5
+#define NATTRS		6
+
+struct attr_fd {
+	int fd;			/* descriptor + 1, 0 if none */
+	int writable;
+	dev_t dev;
+	ino_t ino;
+};
+static __thread struct attr_fd attr_fds[NATTRS];
+
 static pthread_once_t once = PTHREAD_ONCE_INIT;
 static pthread_key_t destructor_key;
 static int destructor_key_initialized = 0;
@@ -38,8 +61,25 @@ static pid_t gettid(void)
 	return syscall(__NR_gettid);
 }
 
+static void close_attr_fds(void)
+{
+	int i;
+
+	for (i = 0; i < NATTRS; i++) {
+		struct attr_fd *a = &attr_fds[i];
+		struct stat st;
+
+		/* only close what is still ours */
+		if (a->fd && fstat(a->fd - 1, &st) == 0 &&
+		    st.st_dev == a->dev && st.st_ino == a->ino)
+			close(a->fd - 1);
+		a->fd = 0;
+	}
+}
+
 static void procattr_thread_destructor(void __attribute__((unused)) *unused)
 {
+	close_attr_fds();
 	if (prev_current != UNSET)
 		free(prev_current);
 	if (prev_exec != UNSET)
@@ -84,6 +124,25 @@ static void init_procattr(void)
 	}
 }
 
+static int attr_index(const char *attr)
+{
+	switch (attr[0]) {
+	case 'c':
+		return ATTR_CURRENT;
+	case 'e':
+		return ATTR_EXEC;
+	case 'f':
+		return ATTR_FSCREATE;
+	case 'k':
+		return ATTR_KEYCREATE;
+	case 's':
+		return ATTR_SOCKCREATE;
+	case 'p':
+		return ATTR_PREV;
+	}
+	return -1;
+}
+
 static int openattr(pid_t pid, const char *attr, int flags)
 {
 	int fd, rc;
@@ -107,12 +166,52 @@ static int openattr(pid_t pid, const char *attr, int flags)
 	return fd;
 }
 
+/*
+ * Return a descriptor for the attribute, and set *cached if it belongs
+ * to the per-thread cache and must not be closed by the caller.
+ */
+static int getattrfd(pid_t pid, const char *attr, int flags, int *cached)
+{
+	struct attr_fd *a;
+	struct stat st;
+	int idx = attr_index(attr), fd;
+
+	*cached = 0;
+	if (pid > 0 || idx < 0)
+		return openattr(pid, attr, flags);
+
+	a = &attr_fds[idx];
+	if (a->fd) {
+		if (fstat(a->fd - 1, &st) == 0 &&
+		    st.st_dev == a->dev && st.st_ino == a->ino) {
+			if (a->writable || flags == O_RDONLY) {
+				*cached = 1;
+				return a->fd - 1;
+			}
+			close(a->fd - 1);
+		}
+		a->fd = 0;
+	}
+
+	fd = openattr(pid, attr, flags);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) == 0) {
+		a->fd = fd + 1;
+		a->writable = flags != O_RDONLY;
+		a->dev = st.st_dev;
+		a->ino = st.st_ino;
+		*cached = 1;
+	}
+	return fd;
+}
+
 static int getprocattrcon_raw(char ** context,
 			      pid_t pid, const char *attr)
 {
 	char *buf;
 	size_t size;
-	int fd;
+	int fd, cached;
 	ssize_t ret;
 	int errno_hold;
 	char * prev_context;
@@ -155,7 +254,7 @@ static int getprocattrcon_raw(char ** context,
 		return 0;
 	}
 
-	fd = openattr(pid, attr, O_RDONLY);
+	fd = getattrfd(pid, attr, O_RDONLY, &cached);
 	if (fd < 0)
 		return -1;
 
@@ -168,7 +267,7 @@ static int getprocattrcon_raw(char ** context,
 	memset(buf, 0, size);
 
 	do {
-		ret = read(fd, buf, size - 1);
+		ret = pread(fd, buf, size - 1, 0);
 	} while (ret < 0 && errno == EINTR);
 	if (ret < 0)
 		goto out2;
@@ -188,7 +287,8 @@ static int getprocattrcon_raw(char ** context,
 	free(buf);
       out:
 	errno_hold = errno;
-	close(fd);
+	if (!cached)
+		close(fd);
 	errno = errno_hold;
 	return ret;
 }
@@ -212,7 +312,7 @@ static int getprocattrcon(char ** context,
 static int setprocattrcon_raw(const char * context,
 			      pid_t pid, const char *attr)
 {
-	int fd;
+	int fd, cached;
 	ssize_t ret;
 	int errno_hold;
 	char **prev_context, *context2 = NULL;
@@ -250,7 +350,7 @@ static int setprocattrcon_raw(const char * context,
 	    && !strcmp(context, *prev_context))
 		return 0;
 
-	fd = openattr(pid, attr, O_RDWR);
+	fd = getattrfd(pid, attr, O_RDWR, &cached);
 	if (fd < 0)
 		return -1;
 	if (context) {
@@ -259,16 +359,17 @@ static int setprocattrcon_raw(const char * context,
 		if (!context2)
 			goto out;
 		do {
-			ret = write(fd, context2, strlen(context2) + 1);
+			ret = pwrite(fd, context2, strlen(context2) + 1, 0);
 		} while (ret < 0 && errno == EINTR);
 	} else {
 		do {
-			ret = write(fd, NULL, 0);	/* clear */
+			ret = pwrite(fd, NULL, 0, 0);	/* clear */
 		} while (ret < 0 && errno == EINTR);
 	}
 out:
 	errno_hold = errno;
-	close(fd);
+	if (!cached)
+		close(fd);
 	errno = errno_hold;
 	if (ret < 0) {
 		free(context2);
@@ -7,6 +7,9 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <pthread.h>
 #include <errno.h>
 #include "policy.h"
@@ -57,8 +60,10 @@
 static pthread_once_t once = PTHREAD_ONCE_INIT;
 static void init_selinux_config(void);
 
-/* New layout is relative to SELINUXDIR/policytype. */
+/* New layout is relative to SELINUXDIR/policytype.  All of the paths
+ * live in file_paths_buf, built in one go for a policy root. */
 static char *file_paths[NEL];
+static char *file_paths_buf;
 #define L1(l) L2(l)
 #define L2(l)str##l
 static const union file_path_suffixes_data {
@@ -84,45 +89,116 @@ static const uint16_t file_path_suffixes_idx[NEL] = {
 #undef L1
 #undef L2
 
+/*
+ * The config file is mapped and scanned in place.  Only the few lines
+ * that are used get copied, into a bounded buffer, since the mapping
+ * does not end with a NUL.
+ */
+struct config_map {
+	const char *data;
+	size_t size;
+	const char *pos;
+};
+
+static int config_map_open(struct config_map *m)
+{
+	struct stat sb;
+	void *data;
+	int fd;
+
+	memset(m, 0, sizeof(*m));
+	fd = open(SELINUXCONFIG, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &sb) < 0 || sb.st_size <= 0) {
+		close(fd);
+		return -1;
+	}
+	data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return -1;
+	m->data = m->pos = data;
+	m->size = sb.st_size;
+	return 0;
+}
+
+static void config_map_close(struct config_map *m)
+{
+	if (m->data)
+		munmap((void *)m->data, m->size);
+	m->data = NULL;
+}
+
+/* Return the next line without its newline and leading whitespace. */
+static const char *config_map_line(struct config_map *m, size_t *len)
+{
+	const char *end = m->data + m->size, *line, *nl;
+
+	while (m->pos < end) {
+		line = m->pos;
+		nl = memchr(line, '\n', end - line);
+		m->pos = nl ? nl + 1 : end;
+		if (!nl)
+			nl = end;
+		while (line < nl && isspace((unsigned char)*line))
+			line++;
+		if (line == nl || *line == '#')
+			continue;
+		*len = nl - line;
+		return line;
+	}
+	return NULL;
+}
+
+/* Copy the value after tag if the line starts with it. */
+static int config_value(const char *line, size_t len, const char *tag,
+			size_t taglen, int nocase, char *buf, size_t size)
+{
+	if (len < taglen ||
+	    (nocase ? strncasecmp(line, tag, taglen) : strncmp(line, tag, taglen)))
+		return 0;
+	len -= taglen;
+	if (len >= size)
+		len = size - 1;
+	memcpy(buf, line + taglen, len);
+	buf[len] = '\0';
+	return 1;
+}
+
 int selinux_getenforcemode(int *enforce)
 {
+	struct config_map m;
+	const char *line;
+	char value[sizeof("permissive")];
+	size_t len;
 	int ret = -1;
-	FILE *cfg = fopen(SELINUXCONFIG, "r");
-	if (cfg) {
-		char *buf;
-		int len = sizeof(SELINUXTAG) - 1;
-		buf = malloc(selinux_page_size);
-		if (!buf) {
-			fclose(cfg);
-			return -1;
-		}
-		while (fgets_unlocked(buf, selinux_page_size, cfg)) {
-			if (strncmp(buf, SELINUXTAG, len))
-				continue;
-			if (!strncasecmp
-			    (buf + len, "enforcing", sizeof("enforcing") - 1)) {
-				*enforce = 1;
-				ret = 0;
-				break;
-			} else
-			    if (!strncasecmp
-				(buf + len, "permissive",
-				 sizeof("permissive") - 1)) {
-				*enforce = 0;
-				ret = 0;
-				break;
-			} else
-			    if (!strncasecmp
-				(buf + len, "disabled",
-				 sizeof("disabled") - 1)) {
-				*enforce = -1;
-				ret = 0;
-				break;
-			}
+
+	if (config_map_open(&m) < 0)
+		return -1;
+
+	while ((line = config_map_line(&m, &len))) {
+		if (!config_value(line, len, SELINUXTAG,
+				  sizeof(SELINUXTAG) - 1, 0, value,
+				  sizeof(value)))
+			continue;
+		if (!strncasecmp(value, "enforcing", sizeof("enforcing") - 1)) {
+			*enforce = 1;
+			ret = 0;
+			break;
+		} else if (!strncasecmp(value, "permissive",
+					sizeof("permissive") - 1)) {
+			*enforce = 0;
+			ret = 0;
+			break;
+		} else if (!strncasecmp(value, "disabled",
+					sizeof("disabled") - 1)) {
+			*enforce = -1;
+			ret = 0;
+			break;
 		}
-		fclose(cfg);
-		free(buf);
 	}
+	config_map_close(&m);
 	return ret;
 }
 
@@ -151,35 +227,54 @@ static int setpolicytype(const char *type)
 static char *selinux_policyroot = NULL;
 static const char *selinux_rootpath = SELINUXDIR;
 
+/* Point file_paths at the configuration files under selinux_policyroot. */
+static int build_file_paths(void)
+{
+	const char *suffixes = (const char *)&file_path_suffixes_data, *suffix;
+	size_t rootlen = strlen(selinux_policyroot), total = 0, len;
+	char *p;
+	int i;
+
+	for (i = 0; i < NEL; i++)
+		total += rootlen + strlen(suffixes + file_path_suffixes_idx[i]) + 1;
+
+	file_paths_buf = p = malloc(total);
+	if (!p)
+		return -1;
+
+	for (i = 0; i < NEL; i++) {
+		suffix = suffixes + file_path_suffixes_idx[i];
+		len = strlen(suffix);
+		file_paths[i] = p;
+		memcpy(p, selinux_policyroot, rootlen);
+		memcpy(p + rootlen, suffix, len + 1);
+		p += rootlen + len + 1;
+	}
+	return 0;
+}
+
 static void init_selinux_config(void)
 {
-	int i, *intptr;
-	size_t line_len;
-	ssize_t len;
-	char *line_buf = NULL, *buf_p, *value, *type = NULL, *end;
-	FILE *fp;
+	int *intptr;
+	size_t len;
+	struct config_map m;
+	const char *line;
+	char value[PATH_MAX], *type = NULL, *end;
 
 	if (selinux_policyroot)
 		return;
 
-	fp = fopen(SELINUXCONFIG, "r");
-	if (fp) {
-		__fsetlocking(fp, FSETLOCKING_BYCALLER);
-		while ((len = getline(&line_buf, &line_len, fp)) > 0) {
-			if (line_buf[len - 1] == '\n')
-				line_buf[len - 1] = 0;
-			buf_p = line_buf;
-			while (isspace(*buf_p))
-				buf_p++;
-			if (*buf_p == '#' || *buf_p == 0)
-				continue;
-
-			if (!strncasecmp(buf_p, SELINUXTYPETAG,
-					 sizeof(SELINUXTYPETAG) - 1)) {
-				selinux_policytype = type =
-				    strdup(buf_p + sizeof(SELINUXTYPETAG) - 1);
-				if (!type)
+	if (config_map_open(&m) == 0) {
+		while ((line = config_map_line(&m, &len))) {
+			if (config_value(line, len, SELINUXTYPETAG,
+					 sizeof(SELINUXTYPETAG) - 1, 1,
+					 value, sizeof(value))) {
+				free(type);
+				selinux_policytype = type = strdup(value);
+				if (!type) {
+					config_map_close(&m);
 					return;
+				}
 				end = type + strlen(type) - 1;
 				while ((end > type) &&
 				       (isspace(*end) || iscntrl(*end))) {
@@ -187,13 +282,13 @@ static void init_selinux_config(void)
 					end--;
 				}
 				continue;
-			} else if (!strncmp(buf_p, SETLOCALDEFS,
-					    sizeof(SETLOCALDEFS) - 1)) {
-				value = buf_p + sizeof(SETLOCALDEFS) - 1;
+			} else if (config_value(line, len, SETLOCALDEFS,
+						sizeof(SETLOCALDEFS) - 1, 0,
+						value, sizeof(value))) {
 				intptr = &load_setlocaldefs;
-			} else if (!strncmp(buf_p, REQUIRESEUSERS,
-					    sizeof(REQUIRESEUSERS) - 1)) {
-				value = buf_p + sizeof(REQUIRESEUSERS) - 1;
+			} else if (config_value(line, len, REQUIRESEUSERS,
+						sizeof(REQUIRESEUSERS) - 1, 0,
+						value, sizeof(value))) {
 				intptr = &require_seusers;
 			} else {
 				continue;
@@ -207,8 +302,7 @@ static void init_selinux_config(void)
 				 (value, "false", sizeof("false") - 1))
 				*intptr = 0;
 		}
-		free(line_buf);
-		fclose(fp);
+		config_map_close(&m);
 	}
 
 	if (!type) {
@@ -220,13 +314,7 @@ static void init_selinux_config(void)
 	if (asprintf(&selinux_policyroot, "%s%s", SELINUXDIR, type) == -1)
 		return;
 
-	for (i = 0; i < NEL; i++)
-		if (asprintf(&file_paths[i], "%s%s",
-			     selinux_policyroot,
-			     file_path_suffixes_data.str +
-			     file_path_suffixes_idx[i])
-		    == -1)
-			return;
+	build_file_paths();
 }
 
 static void fini_selinux_policyroot(void) __attribute__ ((destructor));
@@ -236,10 +324,10 @@ static void fini_selinux_policyroot(void)
 	int i;
 	free(selinux_policyroot);
 	selinux_policyroot = NULL;
-	for (i = 0; i < NEL; i++) {
-		free(file_paths[i]);
+	free(file_paths_buf);
+	file_paths_buf = NULL;
+	for (i = 0; i < NEL; i++)
 		file_paths[i] = NULL;
-	}
 	free(selinux_policytype);
 	selinux_policytype = NULL;
 }
@@ -273,7 +361,6 @@ const char *selinux_policy_root(void)
 
 int selinux_set_policy_root(const char *path)
 {
-	int i;
 	char *policy_type = strrchr(path, '/');
 	if (!policy_type) {
 		errno = EINVAL;
@@ -291,15 +378,7 @@ int selinux_set_policy_root(const char *path)
 	if (setpolicytype(policy_type) != 0)
 		return -1;
 
-	for (i = 0; i < NEL; i++)
-		if (asprintf(&file_paths[i], "%s%s",
-			     selinux_policyroot,
-			     file_path_suffixes_data.str +
-			     file_path_suffixes_idx[i])
-		    == -1)
-			return -1;
-
-	return 0;
+	return build_file_paths();
 }
 
 const char *selinux_path(void)
@@ -15,12 +15,14 @@ hidden_proto(selinux_mkload_policy)
     hidden_proto(security_commit_booleans)
     hidden_proto(security_check_context)
     hidden_proto(security_check_context_raw)
+    hidden_proto(security_check_context_batch_raw)
     hidden_proto(security_canonicalize_context)
     hidden_proto(security_canonicalize_context_raw)
     hidden_proto(security_compute_av)
     hidden_proto(security_compute_av_raw)
     hidden_proto(security_compute_av_flags)
     hidden_proto(security_compute_av_flags_raw)
+    hidden_proto(security_compute_av_flags_batch_raw)
     hidden_proto(security_compute_user)
     hidden_proto(security_compute_user_raw)
     hidden_proto(security_compute_create)
@@ -105,11 +107,19 @@ extern int load_setlocaldefs hidden;
 extern int require_seusers hidden;
 extern int selinux_page_size hidden;
 
+/* Per-thread buffer and round trip for selinuxfs transaction files */
+extern char *selinux_transaction_buf(void) hidden;
+extern ssize_t selinux_transaction(const char *name, char *buf) hidden;
+
 /* Make pthread_once optional */
 #pragma weak pthread_once
 #pragma weak pthread_key_create
 #pragma weak pthread_key_delete
 #pragma weak pthread_setspecific
+#pragma weak pthread_mutex_init
+#pragma weak pthread_mutex_destroy
+#pragma weak pthread_mutex_lock
+#pragma weak pthread_mutex_unlock
 
 /* Call handler iff the first call.  */
 #define __selinux_once(ONCE_CONTROL, INIT_FUNCTION)	\
@@ -137,3 +147,28 @@ extern int selinux_page_size hidden;
 		if (pthread_setspecific != NULL)		\
 			pthread_setspecific(KEY, VALUE);	\
 	} while (0)
+
+/* Mutex macros, no-ops when the program is not threaded */
+#define __selinux_mutex_init(LOCK)				\
+	do {							\
+		if (pthread_mutex_init != NULL)			\
+			pthread_mutex_init(LOCK, NULL);		\
+	} while (0)
+
+#define __selinux_mutex_destroy(LOCK)				\
+	do {							\
+		if (pthread_mutex_destroy != NULL)		\
+			pthread_mutex_destroy(LOCK);		\
+	} while (0)
+
+#define __selinux_mutex_lock(LOCK)				\
+	do {							\
+		if (pthread_mutex_lock != NULL)			\
+			pthread_mutex_lock(LOCK);		\
+	} while (0)
+
+#define __selinux_mutex_unlock(LOCK)				\
+	do {							\
+		if (pthread_mutex_unlock != NULL)		\
+			pthread_mutex_unlock(LOCK);		\
+	} while (0)
@@ -0,0 +1,33 @@
+/*
+ * Static user-space tracepoints (USDT) for SystemTap and bpftrace,
+ * under the provider name "libselinux", e.g.
+ *
+ *	bpftrace -e 'usdt:/lib64/libselinux.so.1:libselinux:avc_miss { ... }'
+ *
+ * The probes are built in only when <sys/sdt.h> was found (the Makefile
+ * defines HAVE_SYS_SDT_H); an unattached probe is a single nop.  When
+ * they are left out the arguments are not evaluated.
+ */
+#ifndef _SELINUX_TRACE_H_
+#define _SELINUX_TRACE_H_
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define SELINUX_PROBE1(name, a) \
+	DTRACE_PROBE1(libselinux, name, a)
+#define SELINUX_PROBE2(name, a, b) \
+	DTRACE_PROBE2(libselinux, name, a, b)
+#define SELINUX_PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(libselinux, name, a, b, c, d)
+#else
+#define SELINUX_PROBE1(name, a) \
+	do { (void)sizeof(a); } while (0)
+#define SELINUX_PROBE2(name, a, b) \
+	do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define SELINUX_PROBE4(name, a, b, c, d) \
+	do { (void)sizeof(a); (void)sizeof(b); \
+	     (void)sizeof(c); (void)sizeof(d); } while (0)
+#endif
+
+#endif
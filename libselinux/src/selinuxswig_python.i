@@ -193,5 +193,199 @@ def install(src, dest):
 	free($1);
 }
 
+/* List-in/list-out forms of the per-file calls, so that Python code
+   labeling many files enters C and releases the GIL once per batch.
+   Entries that could not be looked up come back as None. */
+%{
+#include <fcntl.h>
+
+static void selinux_strv_free(char **v, Py_ssize_t n)
+{
+	Py_ssize_t i;
+
+	if (!v)
+		return;
+	for (i = 0; i < n; i++)
+		free(v[i]);
+	free(v);
+}
+
+/* Copies a sequence of str or bytes, since the GIL is dropped while
+   the copies are in use. */
+static char **selinux_seq_to_strv(PyObject *seq, Py_ssize_t *n)
+{
+	PyObject *fast, *o;
+	const char *s;
+	char **v;
+	Py_ssize_t i;
+
+	fast = PySequence_Fast(seq, "Expected a sequence");
+	if (!fast)
+		return NULL;
+	*n = PySequence_Fast_GET_SIZE(fast);
+	v = calloc(*n + 1, sizeof(char *));
+	if (!v) {
+		PyErr_NoMemory();
+		goto err;
+	}
+	for (i = 0; i < *n; i++) {
+		o = PySequence_Fast_GET_ITEM(fast, i);
+#if PY_MAJOR_VERSION >= 3
+		if (PyUnicode_Check(o))
+			s = PyUnicode_AsUTF8(o);
+		else
+#endif
+		if (PyBytes_Check(o))
+			s = PyBytes_AsString(o);
+		else {
+			PyErr_SetString(PyExc_TypeError,
+					"Sequence must contain only strings");
+			goto err;
+		}
+		if (!s)
+			goto err;
+		v[i] = strdup(s);
+		if (!v[i]) {
+			PyErr_NoMemory();
+			goto err;
+		}
+	}
+	Py_DECREF(fast);
+	return v;
+
+err:
+	selinux_strv_free(v, *n);
+	Py_DECREF(fast);
+	return NULL;
+}
+
+static PyObject *selinux_cons_to_list(char **cons, Py_ssize_t n)
+{
+	PyObject *list, *o;
+	Py_ssize_t i;
+
+	list = PyList_New(n);
+	if (!list)
+		return NULL;
+	for (i = 0; i < n; i++) {
+		if (cons[i]) {
+#if PY_MAJOR_VERSION >= 3
+			o = PyUnicode_FromString(cons[i]);
+#else
+			o = PyString_FromString(cons[i]);
+#endif
+			if (!o) {
+				Py_DECREF(list);
+				return NULL;
+			}
+		} else {
+			Py_INCREF(Py_None);
+			o = Py_None;
+		}
+		PyList_SET_ITEM(list, i, o);
+	}
+	return list;
+}
+
+static void selinux_cons_free(char **cons, Py_ssize_t n)
+{
+	Py_ssize_t i;
+
+	if (!cons)
+		return;
+	for (i = 0; i < n; i++)
+		freecon(cons[i]);
+	free(cons);
+}
+
+static PyObject *selinux_getfilecon_many(PyObject *paths, int flags)
+{
+	PyObject *list = NULL;
+	char **v, **cons;
+	Py_ssize_t n;
+
+	v = selinux_seq_to_strv(paths, &n);
+	if (!v)
+		return NULL;
+	cons = calloc(n + 1, sizeof(char *));
+	if (!cons) {
+		PyErr_NoMemory();
+		goto out;
+	}
+
+	/* failures leave their entry NULL */
+	Py_BEGIN_ALLOW_THREADS
+	getfileconat_batch(AT_FDCWD, (const char *const *)v, n, flags, cons);
+	Py_END_ALLOW_THREADS
+
+	list = selinux_cons_to_list(cons, n);
+out:
+	selinux_cons_free(cons, n);
+	selinux_strv_free(v, n);
+	return list;
+}
+%}
+
+%inline %{
+/* modes may be None to match every path with mode 0 */
+PyObject *matchpathcon_many(PyObject *paths, PyObject *modes)
+{
+	PyObject *fast = NULL, *list = NULL;
+	char **v, **cons = NULL;
+	mode_t *m = NULL;
+	Py_ssize_t i, n;
+	long mode;
+
+	v = selinux_seq_to_strv(paths, &n);
+	if (!v)
+		return NULL;
+	m = calloc(n + 1, sizeof(mode_t));
+	cons = calloc(n + 1, sizeof(char *));
+	if (!m || !cons) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	if (modes != Py_None) {
+		fast = PySequence_Fast(modes, "Expected a sequence");
+		if (!fast)
+			goto out;
+		if (PySequence_Fast_GET_SIZE(fast) != n) {
+			PyErr_SetString(PyExc_ValueError,
+					"paths and modes differ in length");
+			goto out;
+		}
+		for (i = 0; i < n; i++) {
+			mode = PyLong_AsLong(PySequence_Fast_GET_ITEM(fast, i));
+			if (mode == -1 && PyErr_Occurred())
+				goto out;
+			m[i] = mode;
+		}
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	for (i = 0; i < n; i++)
+		matchpathcon(v[i], m[i], &cons[i]);
+	Py_END_ALLOW_THREADS
+
+	list = selinux_cons_to_list(cons, n);
+out:
+	Py_XDECREF(fast);
+	selinux_cons_free(cons, n);
+	free(m);
+	selinux_strv_free(v, n);
+	return list;
+}
+
+PyObject *getfilecon_many(PyObject *paths)
+{
+	return selinux_getfilecon_many(paths, 0);
+}
+
+PyObject *lgetfilecon_many(PyObject *paths)
+{
+	return selinux_getfilecon_many(paths, AT_SYMLINK_NOFOLLOW);
+}
+%}
+
 %include "selinuxswig_python_exception.i"
 %include "selinuxswig.i"
@@ -39,6 +39,8 @@ struct selinux_status_t
 static struct selinux_status_t *selinux_status = NULL;
 static int			selinux_status_fd;
 static uint32_t			last_seqno;
+static uint32_t			last_enforcing;
+static uint32_t			last_policyload;
 
 static uint32_t			fallback_sequence;
 static int			fallback_enforcing;
@@ -84,10 +86,16 @@ static inline uint32_t read_sequence(struct selinux_status_t *status)
  * Because `selinux_status->sequence' shall be always incremented on
  * both of setenforce/policyreload events, so differences from the last
  * value informs us something has been happened.
+ * When the page is mapped, the changes are also passed on to the
+ * userspace AVC and the setenforce/policyload callbacks, just as the
+ * netlink socket would have delivered them.
  */
 int selinux_status_updated(void)
 {
 	uint32_t	curr_seqno;
+	uint32_t	enforcing;
+	uint32_t	policyload;
+	struct avc_notices notices = AVC_NOTICES_INIT;
 	int		result = 0;
 
 	if (selinux_status == NULL) {
@@ -116,6 +124,25 @@ int selinux_status_updated(void)
 
 	if (last_seqno != curr_seqno)
 	{
+		if (selinux_status != MAP_FAILED) {
+			do {
+				curr_seqno = read_sequence(selinux_status);
+				enforcing = selinux_status->enforcing;
+				policyload = selinux_status->policyload;
+			} while (curr_seqno != read_sequence(selinux_status));
+
+			if (last_enforcing != enforcing) {
+				last_enforcing = enforcing;
+				notices.setenforce = enforcing ? 1 : 0;
+			}
+			if (last_policyload != policyload) {
+				last_policyload = policyload;
+				notices.policyload = 1;
+				notices.seqno = policyload;
+			}
+			if (notices.setenforce >= 0 || notices.policyload)
+				avc_process_notices(&notices);
+		}
 		last_seqno = curr_seqno;
 		result = 1;
 	}
@@ -250,7 +277,8 @@ static int fallback_cb_policyload(int policyload)
  * Since Linux 2.6.37 or later supports this feature, we may run
  * fallback routine using a netlink socket on older kernels, if
  * the supplied `fallback' is not zero.
- * It returns 0 on success, or -1 on error.
+ * It returns 0 on success, or -1 on error.  Opening it again while it
+ * is already open is harmless and reports the existing mode.
  */
 int selinux_status_open(int fallback)
 {
@@ -258,6 +286,9 @@ int selinux_status_open(int fallback)
 	char	path[PATH_MAX];
 	long	pagesize;
 
+	if (selinux_status != NULL)
+		return (selinux_status == MAP_FAILED) ? 1 : 0;
+
 	if (!selinux_mnt) {
 		errno = ENOENT;
 		return -1;
@@ -279,6 +310,8 @@ int selinux_status_open(int fallback)
 	}
 	selinux_status_fd = fd;
 	last_seqno = (uint32_t)(-1);
+	last_enforcing = selinux_status->enforcing;
+	last_policyload = selinux_status->policyload;
 
 	return 0;
 
@@ -9,6 +9,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <errno.h>
 #include <stdlib.h>
@@ -21,17 +23,26 @@
 #include "dso.h"
 #include "selinux_internal.h"
 #include "setrans_internal.h"
+#include "selinux_trace.h"
 
 #ifndef DISABLE_SETRANS
 static int mls_enabled = -1;
 
-// Simple cache
-static __thread char * prev_t2r_trans = NULL;
-static __thread char * prev_t2r_raw = NULL;
-static __thread char * prev_r2t_trans = NULL;
-static __thread char * prev_r2t_raw = NULL;
-static __thread char *prev_r2c_trans = NULL;
-static __thread char * prev_r2c_raw = NULL;
+/*
+ * Per-thread caches of recent translations, most recently used first.
+ * Programs such as ls -Z go back and forth between a handful of
+ * contexts, so remembering only the last one misses most of the time.
+ */
+#define SETRANS_CACHE_SIZE 16
+
+struct setrans_cache {
+	char *from[SETRANS_CACHE_SIZE];
+	char *to[SETRANS_CACHE_SIZE];
+};
+
+static __thread struct setrans_cache t2r_cache;
+static __thread struct setrans_cache r2t_cache;
+static __thread struct setrans_cache r2c_cache;
 
 static pthread_once_t once = PTHREAD_ONCE_INIT;
 static pthread_key_t destructor_key;
@@ -172,89 +183,260 @@ receive_response(int fd, uint32_t function, char **outdata, int32_t * ret_val)
 	return 0;
 }
 
-static int raw_to_trans_context(const char *raw, char **transp)
+/*
+ * mcstransd serves any number of requests on a connection, so each
+ * thread keeps its connection open instead of connecting per request.
+ * A child of fork() shares its parent's socket and has to reconnect.
+ */
+static __thread int setransd_fd = -1;
+static __thread pid_t setransd_pid;
+
+static void setransd_close(void)
 {
-	int ret;
-	int32_t ret_val;
-	int fd;
+	if (setransd_fd >= 0)
+		close(setransd_fd);
+	setransd_fd = -1;
+}
 
-	*transp = NULL;
+/* Returns: the response's return value, or <0 if mcstransd cannot be asked */
+static int setransd_request(uint32_t function, const char *data,
+			    char **outdata)
+{
+	int32_t ret_val = -1;
+	int tries;
+
+	SELINUX_PROBE2(setrans_request, function, data);
+
+	for (tries = 0; tries < 2; tries++) {
+		if (setransd_fd < 0 || setransd_pid != getpid()) {
+			setransd_close();
+			setransd_fd = setransd_open();
+			if (setransd_fd < 0) {
+				ret_val = -1;
+				break;
+			}
+			setransd_pid = getpid();
+		}
 
-	fd = setransd_open();
-	if (fd < 0)
-		return fd;
+		if (send_request(setransd_fd, function, data, NULL) == 0 &&
+		    receive_response(setransd_fd, function, outdata,
+				     &ret_val) == 0)
+			break;
+		ret_val = -1;
 
-	ret = send_request(fd, RAW_TO_TRANS_CONTEXT, raw, NULL);
-	if (ret)
-		goto out;
+		/* mcstransd may have been restarted; retry once on a new
+		 * connection */
+		setransd_close();
+	}
 
-	ret = receive_response(fd, RAW_TO_TRANS_CONTEXT, transp, &ret_val);
-	if (ret)
-		goto out;
+	SELINUX_PROBE2(setrans_response, function, ret_val);
+	return ret_val;
+}
 
-	ret = ret_val;
-      out:
-	close(fd);
-	return ret;
+static int raw_to_trans_context(const char *raw, char **transp)
+{
+	*transp = NULL;
+	return setransd_request(RAW_TO_TRANS_CONTEXT, raw, transp);
 }
 
 static int trans_to_raw_context(const char *trans, char **rawp)
 {
-	int ret;
-	int32_t ret_val;
-	int fd;
-
 	*rawp = NULL;
+	return setransd_request(TRANS_TO_RAW_CONTEXT, trans, rawp);
+}
 
-	fd = setransd_open();
-	if (fd < 0)
-		return fd;
-	ret = send_request(fd, TRANS_TO_RAW_CONTEXT, trans, NULL);
-	if (ret)
-		goto out;
+static int raw_context_to_color(const char *raw, char **colors)
+{
+	return setransd_request(RAW_CONTEXT_TO_COLOR, raw, colors);
+}
 
-	ret = receive_response(fd, TRANS_TO_RAW_CONTEXT, rawp, &ret_val);
-	if (ret)
-		goto out;
+/* Per-thread mapping of the table exported by mcstransd */
+static __thread struct setrans_table *setrans_table;
 
-	ret = ret_val;
-      out:
-	close(fd);
-	return ret;
+static void table_unmap(void)
+{
+	if (setrans_table)
+		munmap(setrans_table, SETRANS_TABLE_SIZE);
+	setrans_table = NULL;
 }
 
-static int raw_context_to_color(const char *raw, char **colors)
+static int table_map(void)
 {
-	int ret;
-	int32_t ret_val;
+	struct stat sb;
+	void *map;
 	int fd;
 
-	fd = setransd_open();
+	fd = open(SETRANS_TABLE_FILE, O_RDONLY | O_CLOEXEC);
 	if (fd < 0)
-		return fd;
+		return -1;
+	if (fstat(fd, &sb) < 0 || sb.st_size < SETRANS_TABLE_SIZE) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, SETRANS_TABLE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
 
-	ret = send_request(fd, RAW_CONTEXT_TO_COLOR, raw, NULL);
-	if (ret)
-		goto out;
+	setrans_table = map;
+	if (setrans_table->magic != SETRANS_TABLE_MAGIC ||
+	    setrans_table->nslots != SETRANS_TABLE_SLOTS ||
+	    setrans_table->size != SETRANS_TABLE_SIZE) {
+		table_unmap();
+		return -1;
+	}
+	return 0;
+}
 
-	ret = receive_response(fd, RAW_CONTEXT_TO_COLOR, colors, &ret_val);
-	if (ret)
-		goto out;
+/* The MLS range is everything after the type. */
+static const char *context_range(const char *con)
+{
+	int i;
 
-	ret = ret_val;
-out:
-	close(fd);
-	return ret;
+	for (i = 0; i < 3; i++) {
+		con = strchr(con, ':');
+		if (!con)
+			return NULL;
+		con++;
+	}
+	return con;
+}
+
+/*
+ * Translate raw with the table exported by mcstransd.  Returns 0 and
+ * sets *transp if the range is in it, or -1 if mcstransd has to be asked.
+ */
+static int table_lookup(const char *raw, char **transp)
+{
+	const struct setrans_table *table;
+	const char *range, *key, *trans;
+	volatile const uint32_t *slots;
+	uint32_t hash = 2166136261U, off, i, n;
+	size_t len, avail, prefix;
+	const char *p;
+
+	range = context_range(raw);
+	if (!range)
+		return -1;
+
+	if (setrans_table && setrans_table->stale)
+		table_unmap();
+	if (!setrans_table && table_map() < 0)
+		return -1;
+	table = setrans_table;
+	slots = table->slots;
+
+	for (p = range; *p; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 16777619U;
+	}
+
+	for (n = 0, i = hash; n < SETRANS_TABLE_SLOTS; n++, i++) {
+		off = slots[i & (SETRANS_TABLE_SLOTS - 1)];
+		if (!off)
+			return -1;
+		/* read the strings only after the slot that points to them */
+		__sync_synchronize();
+		if (off < sizeof(*table) || off >= SETRANS_TABLE_SIZE)
+			return -1;
+
+		key = (const char *)table + off;
+		avail = SETRANS_TABLE_SIZE - off;
+		len = strnlen(key, avail);
+		if (len + 1 >= avail)
+			return -1;
+		if (strcmp(key, range))
+			continue;
+
+		trans = key + len + 1;
+		avail -= len + 1;
+		len = strnlen(trans, avail);
+		if (len == avail)
+			return -1;
+
+		prefix = range - raw;
+		*transp = malloc(prefix + len + 1);
+		if (!*transp)
+			return -1;
+		memcpy(*transp, raw, prefix);
+		memcpy(*transp + prefix, trans, len + 1);
+		return 0;
+	}
+	return -1;
+}
+
+/* Move entry i to the front of the cache. */
+static void cache_promote(struct setrans_cache *cache, unsigned int i)
+{
+	char *from = cache->from[i], *to = cache->to[i];
+
+	memmove(&cache->from[1], &cache->from[0], i * sizeof(cache->from[0]));
+	memmove(&cache->to[1], &cache->to[0], i * sizeof(cache->to[0]));
+	cache->from[0] = from;
+	cache->to[0] = to;
+}
+
+/*
+ * Look up from in the cache.  Sets *found and returns a copy of the
+ * translation, which is NULL if it is found but cannot be copied.
+ */
+static char *cache_lookup(struct setrans_cache *cache, const char *from,
+			  int *found)
+{
+	unsigned int i;
+
+	*found = 0;
+	for (i = 0; i < SETRANS_CACHE_SIZE && cache->from[i]; i++) {
+		if (strcmp(cache->from[i], from) == 0) {
+			*found = 1;
+			cache_promote(cache, i);
+			return strdup(cache->to[0]);
+		}
+	}
+	return NULL;
+}
+
+/* Remember a translation, dropping the least recently used one. */
+static void cache_insert(struct setrans_cache *cache, const char *from,
+			 const char *to)
+{
+	unsigned int last = SETRANS_CACHE_SIZE - 1;
+	char *from_copy, *to_copy;
+
+	from_copy = strdup(from);
+	to_copy = strdup(to);
+	if (!from_copy || !to_copy) {
+		free(from_copy);
+		free(to_copy);
+		return;
+	}
+
+	free(cache->from[last]);
+	free(cache->to[last]);
+	cache->from[last] = from_copy;
+	cache->to[last] = to_copy;
+	cache_promote(cache, last);
+}
+
+static void cache_free(struct setrans_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < SETRANS_CACHE_SIZE; i++) {
+		free(cache->from[i]);
+		free(cache->to[i]);
+		cache->from[i] = NULL;
+		cache->to[i] = NULL;
+	}
 }
 
 static void setrans_thread_destructor(void __attribute__((unused)) *unused)
 {
-	free(prev_t2r_trans);
-	free(prev_t2r_raw);
-	free(prev_r2t_trans);
-	free(prev_r2t_raw);
-	free(prev_r2c_trans);
-	free(prev_r2c_raw);
+	cache_free(&t2r_cache);
+	cache_free(&r2t_cache);
+	cache_free(&r2c_cache);
+	setransd_close();
+	table_unmap();
 }
 
 void __attribute__((destructor)) setrans_lib_destructor(void);
@@ -284,6 +466,8 @@ static void init_context_translations(void)
 int selinux_trans_to_raw_context(const char * trans,
 				 char ** rawp)
 {
+	int found;
+
 	if (!trans) {
 		*rawp = NULL;
 		return 0;
@@ -297,25 +481,12 @@ int selinux_trans_to_raw_context(const char * trans,
 		goto out;
 	}
 
-	if (prev_t2r_trans && strcmp(prev_t2r_trans, trans) == 0) {
-		*rawp = strdup(prev_t2r_raw);
-	} else {
-		free(prev_t2r_trans);
-		prev_t2r_trans = NULL;
-		free(prev_t2r_raw);
-		prev_t2r_raw = NULL;
+	*rawp = cache_lookup(&t2r_cache, trans, &found);
+	if (!found) {
 		if (trans_to_raw_context(trans, rawp))
 			*rawp = strdup(trans);
-		if (*rawp) {
-			prev_t2r_trans = strdup(trans);
-			if (!prev_t2r_trans)
-				goto out;
-			prev_t2r_raw = strdup(*rawp);
-			if (!prev_t2r_raw) {
-				free(prev_t2r_trans);
-				prev_t2r_trans = NULL;
-			}
-		}
+		if (*rawp)
+			cache_insert(&t2r_cache, trans, *rawp);
 	}
       out:
 	return *rawp ? 0 : -1;
@@ -326,6 +497,8 @@ hidden_def(selinux_trans_to_raw_context)
 int selinux_raw_to_trans_context(const char * raw,
 				 char ** transp)
 {
+	int found;
+
 	if (!raw) {
 		*transp = NULL;
 		return 0;
@@ -339,25 +512,12 @@ int selinux_raw_to_trans_context(const char * raw,
 		goto out;
 	}
 
-	if (prev_r2t_raw && strcmp(prev_r2t_raw, raw) == 0) {
-		*transp = strdup(prev_r2t_trans);
-	} else {
-		free(prev_r2t_raw);
-		prev_r2t_raw = NULL;
-		free(prev_r2t_trans);
-		prev_r2t_trans = NULL;
-		if (raw_to_trans_context(raw, transp))
+	*transp = cache_lookup(&r2t_cache, raw, &found);
+	if (!found) {
+		if (table_lookup(raw, transp) && raw_to_trans_context(raw, transp))
 			*transp = strdup(raw);
-		if (*transp) {
-			prev_r2t_raw = strdup(raw);
-			if (!prev_r2t_raw)
-				goto out;
-			prev_r2t_trans = strdup(*transp);
-			if (!prev_r2t_trans) {
-				free(prev_r2t_raw);
-				prev_r2t_raw = NULL;
-			}
-		}
+		if (*transp)
+			cache_insert(&r2t_cache, raw, *transp);
 	}
       out:
 	return *transp ? 0 : -1;
@@ -367,6 +527,8 @@ hidden_def(selinux_raw_to_trans_context)
 
 int selinux_raw_context_to_color(const char * raw, char **transp)
 {
+	int found;
+
 	if (!raw) {
 		*transp = NULL;
 		return -1;
@@ -375,27 +537,13 @@ int selinux_raw_context_to_color(const char * raw, char **transp)
 	__selinux_once(once, init_context_translations);
 	init_thread_destructor();
 
-	if (prev_r2c_raw && strcmp(prev_r2c_raw, raw) == 0) {
-		*transp = strdup(prev_r2c_trans);
-	} else {
-		free(prev_r2c_raw);
-		prev_r2c_raw = NULL;
-		free(prev_r2c_trans);
-		prev_r2c_trans = NULL;
+	*transp = cache_lookup(&r2c_cache, raw, &found);
+	if (!found) {
 		if (raw_context_to_color(raw, transp))
 			return -1;
-		if (*transp) {
-			prev_r2c_raw = strdup(raw);
-			if (!prev_r2c_raw)
-				goto out;
-			prev_r2c_trans = strdup(*transp);
-			if (!prev_r2c_trans) {
-				free(prev_r2c_raw);
-				prev_r2c_raw = NULL;
-			}
-		}
+		if (*transp)
+			cache_insert(&r2c_cache, raw, *transp);
 	}
-      out:
 	return *transp ? 0 : -1;
 }
 
@@ -1,4 +1,5 @@
 /* Author: Trusted Computer Solutions, Inc. */
+#include <stdint.h>
 #include <selinux/selinux.h>
 
 #define SETRANS_UNIX_SOCKET SELINUX_TRANS_DIR "/.setrans-unix"
@@ -8,3 +9,25 @@
 #define RAW_CONTEXT_TO_COLOR		4
 #define MAX_DATA_BUF			8192
 
+/*
+ * mcstransd exports the raw to translated ranges it has answered in a
+ * table that clients map read-only, hashed by raw range.  A slot holds
+ * the offset of a "raw\0trans\0" pair, or 0 while empty.  Slots are only
+ * filled after the strings are written, and the table is replaced as a
+ * whole, with stale set in the old one, when the translations reload.
+ * The layout must match mcstransd.
+ */
+#define SETRANS_TABLE_FILE SELINUX_TRANS_DIR "/.setrans-table"
+#define SETRANS_TABLE_MAGIC		0xf97c5e71
+#define SETRANS_TABLE_SLOTS		8192
+#define SETRANS_TABLE_SIZE		(1024 * 1024)
+
+struct setrans_table {
+	uint32_t magic;
+	uint32_t stale;
+	uint32_t nslots;
+	uint32_t size;
+	uint32_t used;
+	uint32_t slots[SETRANS_TABLE_SLOTS];
+};
+
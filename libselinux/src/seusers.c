@@ -6,6 +6,8 @@
 #include <stdio_ext.h>
 #include <ctype.h>
 #include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include <selinux/selinux.h>
 #include <selinux/context.h>
 #include "selinux_internal.h"
@@ -166,94 +168,231 @@ static int check_group(const char *group, const char *name, const gid_t gid) {
 	return match;
 }
 
-int getseuserbyname(const char *name, char **r_seuser, char **r_level)
+/*
+ * The parsed seusers file.  Login services resolve a user per session,
+ * so the file is parsed once and reused for as long as its inode, size
+ * and modification time stay the same.  Exact user names are found
+ * through a hash table; group entries are kept in file order since the
+ * first one the user belongs to wins.
+ */
+struct seuser_entry {
+	char *name;
+	char *seuser;
+	char *level;
+	uint32_t hash;
+	struct seuser_entry *next;	/* in the name hash chain */
+};
+
+static struct {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	int mls_enabled;
+	struct seuser_entry *entries;
+	size_t nentries;
+	struct seuser_entry **buckets;
+	size_t mask;
+	struct seuser_entry **groups;
+	size_t ngroups;
+	struct seuser_entry *defaultent;
+} seusers_cache;
+
+static pthread_mutex_t seusers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t seuser_hash(const char *name)
 {
-	FILE *cfg = NULL;
-	size_t size = 0;
+	uint32_t hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void seusers_cache_flush(void)
+{
+	size_t i;
+
+	for (i = 0; i < seusers_cache.nentries; i++) {
+		free(seusers_cache.entries[i].name);
+		free(seusers_cache.entries[i].seuser);
+		free(seusers_cache.entries[i].level);
+	}
+	free(seusers_cache.entries);
+	free(seusers_cache.buckets);
+	free(seusers_cache.groups);
+	free(seusers_cache.path);
+	memset(&seusers_cache, 0, sizeof(seusers_cache));
+}
+
+static int seusers_cache_index(void)
+{
+	struct seuser_entry *ent, **pp;
+	size_t i, nbuckets;
+
+	for (nbuckets = 16; nbuckets < seusers_cache.nentries; nbuckets <<= 1) ;
+	seusers_cache.buckets = calloc(nbuckets, sizeof(*seusers_cache.buckets));
+	seusers_cache.groups = calloc(seusers_cache.nentries ? : 1,
+				      sizeof(*seusers_cache.groups));
+	if (!seusers_cache.buckets || !seusers_cache.groups)
+		return -1;
+	seusers_cache.mask = nbuckets - 1;
+
+	for (i = 0; i < seusers_cache.nentries; i++) {
+		ent = &seusers_cache.entries[i];
+		ent->hash = seuser_hash(ent->name);
+		ent->next = NULL;
+		/* append, so the first entry for a name is found first */
+		for (pp = &seusers_cache.buckets[ent->hash & seusers_cache.mask];
+		     *pp; pp = &(*pp)->next) ;
+		*pp = ent;
+
+		if (ent->name[0] == '%')
+			seusers_cache.groups[seusers_cache.ngroups++] = ent;
+		else if (!seusers_cache.defaultent &&
+			 !strcmp(ent->name, "__default__"))
+			seusers_cache.defaultent = ent;
+	}
+	return 0;
+}
+
+/* Make the cache match the file at path.  Returns -1 if it can not be read. */
+static int seusers_cache_load(const char *path, int mls_enabled)
+{
+	struct seuser_entry *ent;
+	struct stat sb;
+	FILE *cfg;
+	size_t size = 0, alloc = 0;
 	char *buffer = NULL;
-	int rc;
 	unsigned long lineno = 0;
-	int mls_enabled = is_selinux_mls_enabled();
+	int rc;
 
-	char *username = NULL;
-	char *seuser = NULL;
-	char *level = NULL;
-	char *groupseuser = NULL;
-	char *grouplevel = NULL;
-	char *defaultseuser = NULL;
-	char *defaultlevel = NULL;
+	cfg = fopen(path, "r");
+	if (!cfg) {
+		seusers_cache_flush();
+		return -1;
+	}
+	if (fstat(fileno(cfg), &sb) < 0) {
+		fclose(cfg);
+		seusers_cache_flush();
+		return -1;
+	}
 
-	gid_t gid = get_default_gid(name);
+	if (seusers_cache.path && !strcmp(seusers_cache.path, path) &&
+	    seusers_cache.mls_enabled == mls_enabled &&
+	    seusers_cache.dev == sb.st_dev && seusers_cache.ino == sb.st_ino &&
+	    seusers_cache.size == sb.st_size &&
+	    seusers_cache.mtime.tv_sec == sb.st_mtim.tv_sec &&
+	    seusers_cache.mtime.tv_nsec == sb.st_mtim.tv_nsec) {
+		fclose(cfg);
+		return 0;
+	}
 
-	cfg = fopen(selinux_usersconf_path(), "r");
-	if (!cfg)
-		goto nomatch;
+	seusers_cache_flush();
+	seusers_cache.path = strdup(path);
+	if (!seusers_cache.path)
+		goto err;
 
 	__fsetlocking(cfg, FSETLOCKING_BYCALLER);
 	while (getline(&buffer, &size, cfg) > 0) {
 		++lineno;
-		rc = process_seusers(buffer, &username, &seuser, &level,
-				     mls_enabled);
+		if (seusers_cache.nentries == alloc) {
+			struct seuser_entry *tmp;
+
+			alloc = alloc ? alloc * 2 : 32;
+			tmp = realloc(seusers_cache.entries, alloc * sizeof(*tmp));
+			if (!tmp)
+				goto err;
+			seusers_cache.entries = tmp;
+		}
+		ent = &seusers_cache.entries[seusers_cache.nentries];
+		rc = process_seusers(buffer, &ent->name, &ent->seuser,
+				     &ent->level, mls_enabled);
 		if (rc == -1)
 			continue;	/* comment, skip */
 		if (rc == -2) {
 			fprintf(stderr, "%s:  error on line %lu, skipping...\n",
-				selinux_usersconf_path(), lineno);
+				path, lineno);
 			continue;
 		}
+		seusers_cache.nentries++;
+	}
+	free(buffer);
+	buffer = NULL;
 
-		if (!strcmp(username, name))
-			break;
+	if (seusers_cache_index() < 0)
+		goto err;
 
-		if (username[0] == '%' && 
-		    !groupseuser && 
-		    check_group(&username[1], name, gid)) {
-				groupseuser = seuser;
-				grouplevel = level;
-		} else {
-			if (!defaultseuser && 
-			    !strcmp(username, "__default__")) {
-				defaultseuser = seuser;
-				defaultlevel = level;
-			} else {
-				free(seuser);
-				free(level);
-			}
-		}
-		free(username);
-		username = NULL;
-		seuser = NULL;
-	}
+	seusers_cache.mls_enabled = mls_enabled;
+	seusers_cache.dev = sb.st_dev;
+	seusers_cache.ino = sb.st_ino;
+	seusers_cache.size = sb.st_size;
+	seusers_cache.mtime = sb.st_mtim;
+	fclose(cfg);
+	return 0;
 
+      err:
 	free(buffer);
 	fclose(cfg);
+	seusers_cache_flush();
+	return -1;
+}
 
-	if (seuser) {
-		free(username);
-		free(defaultseuser);
-		free(defaultlevel);
-		free(groupseuser);
-		free(grouplevel);
-		*r_seuser = seuser;
-		*r_level = level;
-		return 0;
+static struct seuser_entry *seusers_cache_lookup(const char *name)
+{
+	struct seuser_entry *ent;
+	uint32_t hash;
+	gid_t gid;
+	size_t i;
+
+	if (!seusers_cache.buckets)
+		return NULL;
+
+	hash = seuser_hash(name);
+	for (ent = seusers_cache.buckets[hash & seusers_cache.mask]; ent;
+	     ent = ent->next)
+		if (ent->hash == hash && !strcmp(ent->name, name))
+			return ent;
+
+	if (seusers_cache.ngroups) {
+		gid = get_default_gid(name);
+		for (i = 0; i < seusers_cache.ngroups; i++) {
+			ent = seusers_cache.groups[i];
+			if (check_group(&ent->name[1], name, gid))
+				return ent;
+		}
 	}
 
-	if (groupseuser) {
-		free(defaultseuser);
-		free(defaultlevel);
-		*r_seuser = groupseuser;
-		*r_level = grouplevel;
-		return 0;
-	}
+	return seusers_cache.defaultent;
+}
 
-	if (defaultseuser) {
-		*r_seuser = defaultseuser;
-		*r_level = defaultlevel;
+int getseuserbyname(const char *name, char **r_seuser, char **r_level)
+{
+	struct seuser_entry *ent = NULL;
+	int mls_enabled = is_selinux_mls_enabled();
+	char *seuser, *level = NULL;
+
+	__selinux_mutex_lock(&seusers_lock);
+	if (seusers_cache_load(selinux_usersconf_path(), mls_enabled) == 0)
+		ent = seusers_cache_lookup(name);
+	if (ent) {
+		seuser = strdup(ent->seuser);
+		if (seuser && ent->level && !(level = strdup(ent->level))) {
+			free(seuser);
+			seuser = NULL;
+		}
+		__selinux_mutex_unlock(&seusers_lock);
+		if (!seuser)
+			return -1;
+		*r_seuser = seuser;
+		*r_level = level;
 		return 0;
 	}
+	__selinux_mutex_unlock(&seusers_lock);
 
-      nomatch:
 	if (require_seusers)
 		return -1;
 
@@ -174,33 +174,57 @@ static void init_obj_class_compat(void)
 
 struct discover_class_node {
 	char *name;
+	uint32_t hash;
 	security_class_t value;
 	char **perms;
+	uint32_t perm_hash[MAXVECTORS];
 
-	struct discover_class_node *next;
+	struct discover_class_node *next_name;
+	struct discover_class_node *next_value;
 };
 
-static struct discover_class_node *discover_class_cache = NULL;
+/*
+ * Discovered classes are hashed both by name and by value.  Nodes are
+ * only ever pushed onto the front of a chain, never removed, so the
+ * buckets need no resizing.
+ */
+#define CLASS_CACHE_BUCKETS 64
+
+static struct discover_class_node *class_by_name[CLASS_CACHE_BUCKETS];
+static struct discover_class_node *class_by_value[CLASS_CACHE_BUCKETS];
+
+/* FNV-1a */
+static uint32_t name_hash(const char *s)
+{
+	uint32_t hash = 2166136261U;
+
+	for (; *s; s++) {
+		hash ^= (unsigned char)*s;
+		hash *= 16777619U;
+	}
+	return hash;
+}
 
-static struct discover_class_node * get_class_cache_entry_name(const char *s)
+static struct discover_class_node * get_class_cache_entry_name(const char *s, uint32_t hash)
 {
-	struct discover_class_node *node = discover_class_cache;
+	struct discover_class_node *node = class_by_name[hash & (CLASS_CACHE_BUCKETS - 1)];
 
-	for (; node != NULL && strcmp(s,node->name) != 0; node = node->next);
+	for (; node != NULL && (hash != node->hash || strcmp(s,node->name) != 0);
+	     node = node->next_name);
 
 	return node;
 }
 
 static struct discover_class_node * get_class_cache_entry_value(security_class_t c)
 {
-	struct discover_class_node *node = discover_class_cache;
+	struct discover_class_node *node = class_by_value[c & (CLASS_CACHE_BUCKETS - 1)];
 
-	for (; node != NULL && c != node->value; node = node->next);
+	for (; node != NULL && c != node->value; node = node->next_value);
 
 	return node;
 }
 
-static struct discover_class_node * discover_class(const char *s)
+static struct discover_class_node * discover_class(const char *s, uint32_t hash)
 {
 	int fd, ret;
 	char path[PATH_MAX];
@@ -230,6 +254,8 @@ static struct discover_class_node * discover_class(const char *s)
 	node->name = strdup(s);
 	if (node->name == NULL)
 		goto err2;
+	node->hash = hash;
+	memset(node->perm_hash, 0, sizeof(node->perm_hash));
 
 	/* load up class index */
 	snprintf(path, sizeof path, "%s/class/%s/index", selinux_mnt,s);
@@ -288,13 +314,17 @@ static struct discover_class_node * discover_class(const char *s)
 		node->perms[value-1] = strdup(dentry->d_name);
 		if (node->perms[value-1] == NULL)
 			goto err4;
+		if (value <= MAXVECTORS)
+			node->perm_hash[value-1] = name_hash(dentry->d_name);
 
 		dentry = readdir(dir);
 	}
 	closedir(dir);
 
-	node->next = discover_class_cache;
-	discover_class_cache = node;
+	node->next_name = class_by_name[hash & (CLASS_CACHE_BUCKETS - 1)];
+	class_by_name[hash & (CLASS_CACHE_BUCKETS - 1)] = node;
+	node->next_value = class_by_value[node->value & (CLASS_CACHE_BUCKETS - 1)];
+	class_by_value[node->value & (CLASS_CACHE_BUCKETS - 1)] = node;
 
 	return node;
 
@@ -423,15 +453,17 @@ static const char *security_av_perm_to_string_compat(security_class_t tclass,
 security_class_t string_to_security_class(const char *s)
 {
 	struct discover_class_node *node;
+	uint32_t hash;
 
 	__selinux_once(once, init_obj_class_compat);
 
 	if (obj_class_compat)
 		return string_to_security_class_compat(s);
 
-	node = get_class_cache_entry_name(s);
+	hash = name_hash(s);
+	node = get_class_cache_entry_name(s, hash);
 	if (node == NULL) {
-		node = discover_class(s);
+		node = discover_class(s, hash);
 
 		if (node == NULL) {
 			errno = EINVAL;
@@ -475,9 +507,11 @@ access_vector_t string_to_av_perm(security_class_t tclass, const char *s)
 
 	node = get_class_cache_entry_value(kclass);
 	if (node != NULL) {
+		uint32_t hash = name_hash(s);
 		size_t i;
 		for (i=0; i<MAXVECTORS && node->perms[i] != NULL; i++)
-			if (strcmp(node->perms[i],s) == 0)
+			if (node->perm_hash[i] == hash &&
+			    strcmp(node->perms[i],s) == 0)
 				return map_perm(tclass, 1<<i);
 	}
 
@@ -0,0 +1,93 @@
+/*
+ * Helpers for the selinuxfs transaction files (access, create,
+ * member, relabel).
+ *
+ * The kernel only accepts one write per open of a transaction file,
+ * so the file itself has to be reopened for every query.  What can be
+ * kept is the page-sized request/response buffer, which is allocated
+ * once per thread and freed when the thread exits.
+ */
+#include <unistd.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include "selinux_internal.h"
+#include "policy.h"
+
+static __thread char *transaction_buf;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t destructor_key;
+static int destructor_key_initialized = 0;
+static __thread char destructor_initialized;
+
+static void transaction_thread_destructor(void __attribute__((unused)) *unused)
+{
+	free(transaction_buf);
+	transaction_buf = NULL;
+}
+
+void __attribute__((destructor)) transaction_destructor(void);
+
+void hidden __attribute__((destructor)) transaction_destructor(void)
+{
+	if (destructor_key_initialized)
+		__selinux_key_delete(destructor_key);
+}
+
+static void init_transaction(void)
+{
+	if (__selinux_key_create(&destructor_key,
+				 transaction_thread_destructor) == 0)
+		destructor_key_initialized = 1;
+}
+
+char *selinux_transaction_buf(void)
+{
+	if (transaction_buf)
+		return transaction_buf;
+
+	__selinux_once(once, init_transaction);
+	if (destructor_initialized == 0) {
+		__selinux_setspecific(destructor_key, (void *)1);
+		destructor_initialized = 1;
+	}
+
+	transaction_buf = malloc(selinux_page_size);
+	return transaction_buf;
+}
+
+ssize_t selinux_transaction(const char *name, char *buf)
+{
+	char path[PATH_MAX];
+	ssize_t ret;
+	int fd, errsave;
+
+	if (!selinux_mnt) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	snprintf(path, sizeof path, "%s/%s", selinux_mnt, name);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	ret = write(fd, buf, strlen(buf));
+	if (ret < 0)
+		goto out;
+
+	ret = read(fd, buf, selinux_page_size - 1);
+	if (ret < 0)
+		goto out;
+	buf[ret] = '\0';
+      out:
+	errsave = errno;
+	close(fd);
+	errno = errsave;
+	return ret;
+}
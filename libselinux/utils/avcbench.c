@@ -0,0 +1,237 @@
+/*
+ * avcbench - Measure userspace AVC throughput and latency.
+ *
+ * Runs avc_has_perm() in a loop from one or more threads and reports
+ * calls per second, a latency distribution and the AVC cache
+ * statistics.  With -r the cache is reset at a fixed interval so the
+ * cost of misses shows up in the tail.
+ */
+#include <unistd.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <selinux/selinux.h>
+#include <selinux/avc.h>
+
+/* latency histogram buckets are powers of two nanoseconds */
+#define NBUCKETS 40
+
+struct worker {
+	pthread_t thread;
+	unsigned long iterations;
+	unsigned long failures;
+	unsigned long hist[NBUCKETS];
+	uint64_t max_ns;
+};
+
+static security_id_t ssid, tsid;
+static security_class_t tclass;
+static access_vector_t perm;
+static unsigned long reset_interval;
+static int use_aeref = 1;
+
+static void *bench_alloc_lock(void)
+{
+	pthread_mutex_t *m = malloc(sizeof(*m));
+
+	if (m)
+		pthread_mutex_init(m, NULL);
+	return m;
+}
+
+static void bench_get_lock(void *lock)
+{
+	pthread_mutex_lock(lock);
+}
+
+static void bench_release_lock(void *lock)
+{
+	pthread_mutex_unlock(lock);
+}
+
+static void bench_free_lock(void *lock)
+{
+	pthread_mutex_destroy(lock);
+	free(lock);
+}
+
+static struct avc_lock_callback lock_cb = {
+	.func_alloc_lock = bench_alloc_lock,
+	.func_get_lock = bench_get_lock,
+	.func_release_lock = bench_release_lock,
+	.func_free_lock = bench_free_lock,
+};
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct avc_entry_ref aeref;
+	uint64_t start, elapsed;
+	unsigned long i;
+	int b;
+
+	avc_entry_ref_init(&aeref);
+	for (i = 0; i < w->iterations; i++) {
+		if (reset_interval && i % reset_interval == reset_interval - 1)
+			avc_reset();
+
+		start = now_ns();
+		if (avc_has_perm_noaudit(ssid, tsid, tclass, perm,
+					 use_aeref ? &aeref : NULL, NULL) < 0)
+			w->failures++;
+		elapsed = now_ns() - start;
+
+		for (b = 0; b < NBUCKETS - 1 && (elapsed >> b) > 1; b++) ;
+		w->hist[b]++;
+		if (elapsed > w->max_ns)
+			w->max_ns = elapsed;
+	}
+	return NULL;
+}
+
+/* upper bound of the bucket holding the given fraction of all calls */
+static uint64_t percentile(const unsigned long *hist, unsigned long total,
+			   double fraction)
+{
+	unsigned long seen = 0, want = (unsigned long)(total * fraction);
+	int b;
+
+	for (b = 0; b < NBUCKETS; b++) {
+		seen += hist[b];
+		if (seen > want)
+			break;
+	}
+	return 1ULL << (b < NBUCKETS ? b + 1 : NBUCKETS);
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage:  %s [-t threads] [-n iterations] [-r reset-interval] [-N] "
+		"scontext tcontext tclass perm\n", progname);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	struct avc_cache_stats_ext stats;
+	unsigned long hist[NBUCKETS], total = 0, failures = 0;
+	unsigned long iterations = 1000000;
+	uint64_t start, elapsed, max_ns = 0;
+	int nthreads = 1, opt, i, b;
+
+	while ((opt = getopt(argc, argv, "t:n:r:N")) > 0) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			if (nthreads < 1)
+				usage(argv[0]);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			reset_interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			use_aeref = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 4)
+		usage(argv[0]);
+
+	if (avc_init("avcbench", NULL, NULL, NULL, &lock_cb) < 0) {
+		fprintf(stderr, "%s:  avc_init failed:  %s\n", argv[0],
+			strerror(errno));
+		exit(2);
+	}
+
+	if (avc_context_to_sid(argv[optind], &ssid) < 0 ||
+	    avc_context_to_sid(argv[optind + 1], &tsid) < 0) {
+		fprintf(stderr, "%s:  invalid context:  %s\n", argv[0],
+			strerror(errno));
+		exit(3);
+	}
+
+	tclass = string_to_security_class(argv[optind + 2]);
+	if (!tclass) {
+		fprintf(stderr, "%s:  invalid class '%s'\n", argv[0],
+			argv[optind + 2]);
+		exit(3);
+	}
+	perm = string_to_av_perm(tclass, argv[optind + 3]);
+	if (!perm) {
+		fprintf(stderr, "%s:  invalid permission '%s'\n", argv[0],
+			argv[optind + 3]);
+		exit(3);
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers) {
+		fprintf(stderr, "%s:  out of memory\n", argv[0]);
+		exit(4);
+	}
+
+	start = now_ns();
+	for (i = 0; i < nthreads; i++) {
+		workers[i].iterations = iterations;
+		if (pthread_create(&workers[i].thread, NULL, run_worker,
+				   &workers[i])) {
+			fprintf(stderr, "%s:  pthread_create failed\n",
+				argv[0]);
+			exit(4);
+		}
+	}
+
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		for (b = 0; b < NBUCKETS; b++)
+			hist[b] += workers[i].hist[b];
+		total += workers[i].iterations;
+		failures += workers[i].failures;
+		if (workers[i].max_ns > max_ns)
+			max_ns = workers[i].max_ns;
+	}
+	elapsed = now_ns() - start;
+
+	printf("threads=%d calls=%lu denied=%lu seconds=%.3f "
+	       "calls/sec=%.0f\n", nthreads, total, failures,
+	       elapsed / 1e9, elapsed ? total * 1e9 / elapsed : 0);
+	printf("latency (ns): p50<=%llu p99<=%llu p99.9<=%llu max=%llu\n",
+	       (unsigned long long)percentile(hist, total, 0.50),
+	       (unsigned long long)percentile(hist, total, 0.99),
+	       (unsigned long long)percentile(hist, total, 0.999),
+	       (unsigned long long)max_ns);
+
+	/* avc_reset() clears the statistics, so with -r they only
+	 * cover the calls since the last reset */
+	avc_cache_stats_ext(&stats, sizeof(stats));
+	printf("lookups=%u hits=%u misses=%u discards=%u "
+	       "cav_lookups=%u cav_hits=%u cav_misses=%u "
+	       "cav_evictions=%u\n",
+	       stats.entry_lookups, stats.entry_hits, stats.entry_misses,
+	       stats.entry_discards, stats.cav_lookups, stats.cav_hits,
+	       stats.cav_misses, stats.cav_evictions);
+
+	free(workers);
+	avc_destroy();
+	exit(0);
+}
@@ -20,7 +20,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <linux/limits.h>
+#include <selinux/avc_stats.h>
 
 #define DEF_STAT_FILE	"/avc/cache_stats"
 #define DEF_BUF_SIZE	8192
@@ -62,7 +64,8 @@ static __attribute__((__format__(printf,1,2))) void die(const char *msg, ...)
 
 static void usage(void)
 {
-	printf("\nUsage: %s [-c] [-f status_file] [interval]\n\n", progname);
+	printf("\nUsage: %s [-c] [-f status_file | -p export_file] [interval]\n\n",
+	       progname);
 	printf
 	    ("Display SELinux AVC statistics.  If the interval parameter is specified, the\n");
 	printf
@@ -71,8 +74,12 @@ static void usage(void)
 	    ("Relative values are displayed by default. Use the -c option to specify the\n");
 	printf
 	    ("display of cumulative values.  The -f option specifies the location of the\n");
-	printf("AVC statistics file, defaulting to \'%s%s\'.\n\n", selinux_mnt,
+	printf("AVC statistics file, defaulting to \'%s%s\'.\n", selinux_mnt,
 	       DEF_STAT_FILE);
+	printf
+	    ("The -p option displays the statistics a process exports through the\n");
+	printf
+	    ("AVC_OPT_STATS_EXPORT file named, by object class and by source type.\n\n");
 }
 
 static void set_window_rows(void)
@@ -92,10 +99,107 @@ static void sighandler(int num)
 		set_window_rows();
 }
 
+/* The lookup time under which 'pct' percent of the lookups completed. */
+static unsigned long long latency_pct(const struct avc_stats_counts *c,
+				      const struct avc_stats_counts *last,
+				      uint64_t lookups, unsigned pct)
+{
+	uint64_t n = 0;
+	unsigned b;
+
+	for (b = 0; b < AVC_STATS_BUCKETS - 1; b++) {
+		n += c->latency[b] - last->latency[b];
+		if (n * 100 >= lookups * pct)
+			break;
+	}
+	return 64ULL << b;
+}
+
+static void show_counts(const char *name, const struct avc_stats_counts *c,
+			const struct avc_stats_counts *last)
+{
+	uint64_t lookups = c->lookups - last->lookups;
+
+	if (!lookups)
+		return;
+	printf("%-24.24s %10llu %10llu %10llu %10llu %10llu\n", name,
+	       (unsigned long long)lookups,
+	       (unsigned long long)(c->hits - last->hits),
+	       (unsigned long long)(c->misses - last->misses),
+	       (unsigned long long)((c->latency_ns - last->latency_ns) /
+				    lookups),
+	       latency_pct(c, last, lookups, 99));
+}
+
+static void show_entries(const char *title,
+			 const struct avc_stats_entry *e,
+			 const struct avc_stats_entry *last, unsigned n)
+{
+	unsigned i;
+
+	printf("%-24s %10s %10s %10s %10s %10s\n", title, "lookups", "hits",
+	       "misses", "avg ns", "99% ns");
+	for (i = 0; i < n; i++)
+		if (e[i].id && e[i].name[0])
+			show_counts(e[i].name, &e[i].counts, &last[i].counts);
+}
+
+/* Display the statistics exported by a process through 'file'. */
+static int show_export(const char *file, int cumulative)
+{
+	static struct avc_stats_export cur, last;
+	const struct avc_stats_export *page;
+	struct stat sb;
+	int fd, i;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		die("open: \'%s\'", file);
+	if (fstat(fd, &sb) < 0)
+		die("stat: \'%s\'", file);
+	if (sb.st_size != sizeof(*page)) {
+		errno = 0;
+		die("unable to parse \'%s\': not an AVC statistics file", file);
+	}
+	page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED)
+		die("mmap: \'%s\'", file);
+	close(fd);
+	if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != AVC_STATS_MAGIC ||
+	    page->version != AVC_STATS_VERSION ||
+	    page->size != sizeof(*page)) {
+		errno = 0;
+		die("unable to parse \'%s\': not an AVC statistics file", file);
+	}
+
+	memset(&last, 0, sizeof(last));
+	for (i = 0;; i++) {
+		memcpy(&cur, page, sizeof(cur));
+		if (i)
+			putchar('\n');
+		printf("pid %u\n", cur.pid);
+		show_entries("class", cur.classes, last.classes,
+			     AVC_STATS_CLASSES);
+		show_entries("source type", cur.types, last.types,
+			     AVC_STATS_TYPES);
+		show_counts("total", &cur.total, &last.total);
+
+		if (!interval)
+			break;
+		if (!cumulative)
+			memcpy(&last, &cur, sizeof(last));
+		sleep(interval);
+	}
+
+	munmap((void *)page, sizeof(*page));
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	struct avc_cache_stats tot, rel, last;
 	int fd, i, cumulative = 0;
+	const char *exportfile = NULL;
 	struct sigaction sa;
 	char avcstatfile[PATH_MAX];
 	snprintf(avcstatfile, sizeof avcstatfile, "%s%s", selinux_mnt,
@@ -104,7 +208,7 @@ int main(int argc, char **argv)
 
 	memset(&last, 0, sizeof(last));
 
-	while ((i = getopt(argc, argv, "cf:h?-")) != -1) {
+	while ((i = getopt(argc, argv, "cf:p:h?-")) != -1) {
 		switch (i) {
 		case 'c':
 			cumulative = 1;
@@ -112,6 +216,9 @@ int main(int argc, char **argv)
 		case 'f':
 			strncpy(avcstatfile, optarg, sizeof avcstatfile);
 			break;
+		case 'p':
+			exportfile = optarg;
+			break;
 		case 'h':
 		case '-':
 			usage();
@@ -145,6 +252,9 @@ int main(int argc, char **argv)
 	if (i < 0)
 		die("sigaction");
 
+	if (exportfile)
+		return show_export(exportfile, cumulative);
+
 	set_window_rows();
 	fd = open(avcstatfile, O_RDONLY);
 	if (fd < 0)
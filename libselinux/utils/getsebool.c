@@ -14,7 +14,8 @@ static void usage(const char *progname)
 
 int main(int argc, char **argv)
 {
-	int i, get_all = 0, rc = 0, active, pending, len = 0, opt;
+	int i, get_all = 0, rc = 0, len = 0, opt;
+	int *active = NULL, *pending = NULL;
 	char **names;
 
 	while ((opt = getopt(argc, argv, "a")) > 0) {
@@ -70,23 +71,29 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* read all the values at once; a boolean that could not be read
+	 * is left at -1 */
+	active = malloc(sizeof(int) * len);
+	pending = malloc(sizeof(int) * len);
+	if (!active || !pending) {
+		fprintf(stderr, "%s:  out of memory\n", argv[0]);
+		rc = 2;
+		goto out;
+	}
+	security_get_boolean_values((const char *const *)names, len, active,
+				    pending);
+
 	for (i = 0; i < len; i++) {
-		active = security_get_boolean_active(names[i]);
-		if (active < 0) {
-			if (get_all && errno == EACCES) 
+		if (active[i] < 0) {
+			/* read it again for the reason */
+			if (security_get_boolean_active(names[i]) < 0 &&
+			    get_all && errno == EACCES)
 				continue;
 			fprintf(stderr, "Error getting active value for %s\n",
 				names[i]);
 			rc = -1;
 			goto out;
 		}
-		pending = security_get_boolean_pending(names[i]);
-		if (pending < 0) {
-			fprintf(stderr, "Error getting pending value for %s\n",
-				names[i]);
-			rc = -1;
-			goto out;
-		}
 		char *alt_name = selinux_boolean_sub(names[i]);
 		if (! alt_name) {
 			perror("Out of memory\n");
@@ -94,13 +101,13 @@ int main(int argc, char **argv)
 			goto out;
 		}
 
-		if (pending != active) {
+		if (pending[i] != active[i]) {
 			printf("%s --> %s pending: %s\n", alt_name,
-			       (active ? "on" : "off"),
-			       (pending ? "on" : "off"));
+			       (active[i] ? "on" : "off"),
+			       (pending[i] ? "on" : "off"));
 		} else {
 			printf("%s --> %s\n", alt_name,
-			       (active ? "on" : "off"));
+			       (active[i] ? "on" : "off"));
 		}
 		free(alt_name);
 	}
@@ -109,5 +116,7 @@ int main(int argc, char **argv)
 	for (i = 0; i < len; i++)
 		free(names[i]);
 	free(names);
+	free(active);
+	free(pending);
 	return rc;
 }
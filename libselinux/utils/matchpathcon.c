@@ -12,11 +12,15 @@
 #include <limits.h>
 #include <stdlib.h>
 
+/* record terminator for output, NUL with -0 */
+static char eol = '\n';
+
 static void usage(const char *progname)
 {
 	fprintf(stderr,
-		"usage:  %s [-N] [-n] [-f file_contexts] [ -P policy_root_path ] [-p prefix] [-Vq] path...\n",
-		progname);
+		"usage:  %s [-N] [-n] [-f file_contexts] [ -P policy_root_path ] [-p prefix] [-Vq] path...\n"
+		"        %s [-N] [-n] [-f file_contexts] [ -P policy_root_path ] [-p prefix] [-Vq] -i|-0\n",
+		progname, progname);
 	exit(1);
 }
 
@@ -34,9 +38,9 @@ static int printmatchpathcon(const char *path, int header, int mode)
 		}
 	}
 	if (header)
-		printf("%s\t%s\n", path, buf);
+		printf("%s\t%s%c", path, buf, eol);
 	else
-		printf("%s\n", buf);
+		printf("%s%c", buf, eol);
 
 	freecon(buf);
 	return 0;
@@ -65,6 +69,60 @@ static mode_t string_to_mode(char *s)
 	return -1;
 }
 
+static int process_path(char *path, int force_mode, int verify, int quiet,
+			int notrans, int header)
+{
+	int rc, mode = 0;
+	struct stat buf;
+	int len = strlen(path);
+	if (len > 1  && path[len - 1 ] == '/')
+		path[len - 1 ] = '\0';
+
+	if (lstat(path, &buf) == 0)
+		mode = buf.st_mode;
+	if (force_mode)
+		mode = force_mode;
+
+	if (!verify)
+		return printmatchpathcon(path, header, mode);
+
+	rc = selinux_file_context_verify(path, mode);
+
+	if (quiet) {
+		if (rc == 1)
+			return 0;
+		else
+			exit(1);
+	}
+
+	if (rc == -1) {
+		printf("%s error: %s%c", path, strerror(errno), eol);
+		exit(1);
+	} else if (rc == 1) {
+		printf("%s verified.%c", path, eol);
+	} else {
+		char * con;
+		if (notrans)
+			rc = lgetfilecon_raw(path, &con);
+		else
+			rc = lgetfilecon(path, &con);
+
+		if (rc >= 0) {
+			printf("%s has context %s, should be ",
+			       path, con);
+			printmatchpathcon(path, 0, mode);
+			freecon(con);
+		} else {
+			printf
+			    ("actual context unknown: %s, should be ",
+			     strerror(errno));
+			printmatchpathcon(path, 0, mode);
+		}
+		return 1;
+	}
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	int i, init = 0, force_mode = 0;
@@ -73,11 +131,12 @@ int main(int argc, char **argv)
 	int notrans = 0;
 	int error = 0;
 	int quiet = 0;
+	int from_stdin = 0;
 
 	if (argc < 2)
 		usage(argv[0]);
 
-	while ((opt = getopt(argc, argv, "m:Nnf:P:p:Vq")) > 0) {
+	while ((opt = getopt(argc, argv, "m:Nnf:P:p:Vqi0")) > 0) {
 		switch (opt) {
 		case 'n':
 			header = 0;
@@ -140,62 +199,39 @@ int main(int argc, char **argv)
 		case 'q':
 			quiet = 1;
 			break;
+		case '0':
+			eol = '\0';
+			/* fall through */
+		case 'i':
+			from_stdin = 1;
+			break;
 		default:
 			usage(argv[0]);
 		}
 	}
-	for (i = optind; i < argc; i++) {
-		int rc, mode = 0;
-		struct stat buf;
-		char *path = argv[i];
-		int len = strlen(path);
-		if (len > 1  && path[len - 1 ] == '/')
-			path[len - 1 ] = '\0';
-
-		if (lstat(path, &buf) == 0)
-			mode = buf.st_mode;
-		if (force_mode)
-			mode = force_mode;
-
-		if (verify) {
-			rc = selinux_file_context_verify(path, mode);
-
-			if (quiet) {
-				if (rc == 1)
-					continue;
-				else
-					exit(1);
-			}
+	if (from_stdin) {
+		char *line = NULL;
+		size_t size = 0;
+		ssize_t len;
 
-			if (rc == -1) {
-				printf("%s error: %s\n", path, strerror(errno));
-				exit(1);
-			} else if (rc == 1) {
-				printf("%s verified.\n", path);
-			} else {
-				char * con;
-				error = 1;
-				if (notrans)
-					rc = lgetfilecon_raw(path, &con);
-				else
-					rc = lgetfilecon(path, &con);
-
-				if (rc >= 0) {
-					printf("%s has context %s, should be ",
-					       path, con);
-					printmatchpathcon(path, 0, mode);
-					freecon(con);
-				} else {
-					printf
-					    ("actual context unknown: %s, should be ",
-					     strerror(errno));
-					printmatchpathcon(path, 0, mode);
-				}
-			}
-		} else {
-			error |= printmatchpathcon(path, header, mode);
+		if (optind != argc)
+			usage(argv[0]);
+		/* the file contexts stay loaded for every path read */
+		while ((len = getdelim(&line, &size, eol, stdin)) > 0) {
+			if (line[len - 1] == eol)
+				line[--len] = '\0';
+			if (!len)
+				continue;
+			error |= process_path(line, force_mode, verify, quiet,
+					      notrans, header);
+			/* answer each path before reading the next */
+			fflush(stdout);
 		}
+		free(line);
 	}
+	for (i = optind; i < argc; i++)
+		error |= process_path(argv[i], force_mode, verify, quiet,
+				      notrans, header);
 	matchpathcon_fini();
 	return error;
 }
@@ -0,0 +1,249 @@
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/limits.h>
+
+#include "../src/label_internal.h"
+
+#define FIELD_SPACE " \t\n\v\f\r"
+
+struct type_name {
+	const char *name;
+	int type;
+};
+
+static const struct type_name x_types[] = {
+	{ "property", SELABEL_X_PROP },
+	{ "extension", SELABEL_X_EXT },
+	{ "client", SELABEL_X_CLIENT },
+	{ "event", SELABEL_X_EVENT },
+	{ "selection", SELABEL_X_SELN },
+	{ "poly_property", SELABEL_X_POLYPROP },
+	{ "poly_selection", SELABEL_X_POLYSELN },
+	{ NULL, 0 }
+};
+
+static const struct type_name db_types[] = {
+	{ "db_database", SELABEL_DB_DATABASE },
+	{ "db_schema", SELABEL_DB_SCHEMA },
+	{ "db_table", SELABEL_DB_TABLE },
+	{ "db_column", SELABEL_DB_COLUMN },
+	{ "db_sequence", SELABEL_DB_SEQUENCE },
+	{ "db_view", SELABEL_DB_VIEW },
+	{ "db_procedure", SELABEL_DB_PROCEDURE },
+	{ "db_blob", SELABEL_DB_BLOB },
+	{ "db_tuple", SELABEL_DB_TUPLE },
+	{ "db_language", SELABEL_DB_LANGUAGE },
+	{ NULL, 0 }
+};
+
+struct spec {
+	uint32_t type;
+	char *key;
+	char *context;
+};
+
+static struct spec *specs;
+static uint32_t nspec, alloc_spec;
+
+static int type_from_name(const struct type_name *types, const char *name)
+{
+	for (; types->name; types++)
+		if (!strcmp(types->name, name))
+			return types->type;
+	return -1;
+}
+
+static int add_spec(int type, const char *key, const char *context)
+{
+	if (nspec == alloc_spec) {
+		uint32_t n = alloc_spec ? alloc_spec * 2 : 64;
+		struct spec *tmp = realloc(specs, n * sizeof(*specs));
+
+		if (!tmp)
+			return -1;
+		specs = tmp;
+		alloc_spec = n;
+	}
+	specs[nspec].type = type;
+	specs[nspec].key = strdup(key);
+	specs[nspec].context = strdup(context);
+	if (!specs[nspec].key || !specs[nspec].context)
+		return -1;
+	nspec++;
+	return 0;
+}
+
+/*
+ * Accept the same lines as the media, X and db backends do when they
+ * read the text file.
+ */
+static int process_file(unsigned int backend, const char *filename)
+{
+	char *line_buf = NULL, *fields[4], *p, *saveptr;
+	size_t line_len = 0;
+	unsigned int line_num = 0, nfields, want;
+	FILE *fp;
+	int type, rc = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "Error opening %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	want = backend == SELABEL_CTX_MEDIA ? 2 : 3;
+	while (getline(&line_buf, &line_len, fp) > 0) {
+		line_num++;
+
+		if (backend == SELABEL_CTX_DB) {
+			/* comments may follow an entry */
+			p = strchr(line_buf, '#');
+			if (p)
+				*p = '\0';
+		} else {
+			for (p = line_buf; isspace((unsigned char)*p); p++)
+				;
+			if (*p == '#')
+				continue;
+		}
+
+		nfields = 0;
+		for (p = strtok_r(line_buf, FIELD_SPACE, &saveptr);
+		     p && nfields < 4; p = strtok_r(NULL, FIELD_SPACE, &saveptr))
+			fields[nfields++] = p;
+		if (!nfields)
+			continue;
+		if (nfields < want ||
+		    (backend == SELABEL_CTX_DB && nfields != want)) {
+			fprintf(stderr, "%s:  line %u has invalid format, skipped\n",
+				filename, line_num);
+			continue;
+		}
+
+		if (backend == SELABEL_CTX_MEDIA) {
+			rc = add_spec(0, fields[0], fields[1]);
+		} else {
+			type = type_from_name(backend == SELABEL_CTX_X ?
+					      x_types : db_types, fields[0]);
+			if (type < 0) {
+				fprintf(stderr, "%s:  line %u has invalid object type %s\n",
+					filename, line_num, fields[0]);
+				continue;
+			}
+			rc = add_spec(type, fields[1], fields[2]);
+		}
+		if (rc < 0) {
+			fprintf(stderr, "%s:  out of memory\n", filename);
+			break;
+		}
+	}
+
+	free(line_buf);
+	fclose(fp);
+	return rc;
+}
+
+static int write_string(FILE *fp, const char *str)
+{
+	uint32_t len = strlen(str) + 1;
+
+	if (fwrite(&len, sizeof(len), 1, fp) != 1 ||
+	    fwrite(str, len, 1, fp) != 1)
+		return -1;
+	return 0;
+}
+
+static int write_binary_file(unsigned int backend, const char *filename)
+{
+	uint32_t hdr[4];
+	uint32_t i;
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		fprintf(stderr, "Error opening %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	hdr[0] = SELINUX_MAGIC_COMPILED_SPECS;
+	hdr[1] = SELINUX_COMPILED_SPECS_VERSION;
+	hdr[2] = backend;
+	hdr[3] = nspec;
+	if (fwrite(hdr, sizeof(hdr), 1, fp) != 1)
+		goto err;
+
+	for (i = 0; i < nspec; i++) {
+		if (fwrite(&specs[i].type, sizeof(uint32_t), 1, fp) != 1 ||
+		    write_string(fp, specs[i].key) < 0 ||
+		    write_string(fp, specs[i].context) < 0)
+			goto err;
+	}
+
+	if (fclose(fp) == 0)
+		return 0;
+	fp = NULL;
+err:
+	fprintf(stderr, "Error writing %s: %s\n", filename, strerror(errno));
+	if (fp)
+		fclose(fp);
+	return -1;
+}
+
+static __attribute__ ((__noreturn__)) void usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage:  %s -b media|x|db [-o output] inputfile\n", progname);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path, *out = NULL;
+	char stack_path[PATH_MAX + 1];
+	int backend = -1, opt, rc;
+
+	while ((opt = getopt(argc, argv, "b:o:")) > 0) {
+		switch (opt) {
+		case 'b':
+			if (!strcmp(optarg, "media"))
+				backend = SELABEL_CTX_MEDIA;
+			else if (!strcmp(optarg, "x"))
+				backend = SELABEL_CTX_X;
+			else if (!strcmp(optarg, "db"))
+				backend = SELABEL_CTX_DB;
+			else
+				usage(argv[0]);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (backend < 0 || argc - optind != 1)
+		usage(argv[0]);
+
+	path = argv[optind];
+	if (!out) {
+		rc = snprintf(stack_path, sizeof(stack_path), "%s.bin", path);
+		if (rc < 0 || rc >= (int)sizeof(stack_path)) {
+			fprintf(stderr, "%s:  path too long\n", path);
+			return EXIT_FAILURE;
+		}
+		out = stack_path;
+	}
+
+	if (process_file(backend, path) < 0)
+		return EXIT_FAILURE;
+	if (write_binary_file(backend, out) < 0)
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
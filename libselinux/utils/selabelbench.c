@@ -0,0 +1,364 @@
+/*
+ * selabelbench - Measure file_contexts lookup performance.
+ *
+ * Replays a list of paths through selabel_lookup_raw() and reports the
+ * time taken to load the specifications, lookups per second, regex
+ * executions per lookup and the memory used by the handle.  Each thread
+ * opens its own handle, as handles are not shared between threads.
+ *
+ * A corpus line is a file type letter as used by file_contexts (- for
+ * an unknown type, f, d, l, c, b, p or s) and a path.  With -g the tool
+ * writes such a corpus for a directory tree, without crossing mount
+ * points, instead.  No corpus is shipped, as one only means something
+ * for the system it was taken from; make one from the tree whose
+ * labeling is to be measured, e.g.
+ *
+ *	selabelbench -g / > paths
+ *	selabelbench -t 4 paths
+ */
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <selinux/selinux.h>
+#include <selinux/label.h>
+
+struct entry {
+	char *path;
+	mode_t mode;
+};
+
+struct worker {
+	pthread_t thread;
+	struct selabel_handle *hnd;
+	uint64_t load_ns;
+	unsigned long lookups;
+	unsigned long failures;
+};
+
+static struct entry *corpus;
+static size_t ncorpus;
+static const char *spec_path;
+static int baseonly;
+static unsigned long passes = 10;
+
+/* regex executions reported by selabel_stats() */
+static unsigned long long stat_execs;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int count_execs(int type, const char *fmt, ...)
+{
+	unsigned int execs;
+	const char *p;
+	char buf[PATH_MAX + 256];
+	va_list ap;
+
+	if (type != SELINUX_INFO)
+		return 0;
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	/* "(spec, context)  N matches in M attempts (P%)" */
+	p = strstr(buf, " matches in ");
+	if (p && sscanf(p, " matches in %u attempts", &execs) == 1)
+		stat_execs += execs;
+	return 0;
+}
+
+static int quiet_log(int type __attribute__ ((unused)),
+		     const char *fmt __attribute__ ((unused)), ...)
+{
+	return 0;
+}
+
+static mode_t letter_to_mode(char c)
+{
+	switch (c) {
+	case 'f':
+		return S_IFREG;
+	case 'd':
+		return S_IFDIR;
+	case 'l':
+		return S_IFLNK;
+	case 'c':
+		return S_IFCHR;
+	case 'b':
+		return S_IFBLK;
+	case 'p':
+		return S_IFIFO;
+	case 's':
+		return S_IFSOCK;
+	default:
+		return 0;
+	}
+}
+
+static char mode_to_letter(mode_t mode)
+{
+	switch (mode & S_IFMT) {
+	case S_IFREG:
+		return 'f';
+	case S_IFDIR:
+		return 'd';
+	case S_IFLNK:
+		return 'l';
+	case S_IFCHR:
+		return 'c';
+	case S_IFBLK:
+		return 'b';
+	case S_IFIFO:
+		return 'p';
+	case S_IFSOCK:
+		return 's';
+	default:
+		return '-';
+	}
+}
+
+static int print_entry(const char *path, const struct stat *sb,
+		       int flag __attribute__ ((unused)),
+		       struct FTW *ftw __attribute__ ((unused)))
+{
+	printf("%c %s\n", mode_to_letter(sb->st_mode), path);
+	return 0;
+}
+
+static int read_corpus(const char *file)
+{
+	FILE *fp;
+	char *line = NULL, *path;
+	size_t len = 0, alloc = 0;
+	ssize_t n;
+	struct entry *tmp;
+
+	fp = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	if (!fp)
+		return -1;
+	while ((n = getline(&line, &len, fp)) > 0) {
+		if (line[n - 1] == '\n')
+			line[--n] = '\0';
+		if (n < 3 || line[1] != ' ' || line[2] != '/')
+			continue;
+		path = strdup(line + 2);
+		if (!path)
+			goto err;
+		if (ncorpus == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			tmp = realloc(corpus, alloc * sizeof(*corpus));
+			if (!tmp) {
+				free(path);
+				goto err;
+			}
+			corpus = tmp;
+		}
+		corpus[ncorpus].path = path;
+		corpus[ncorpus].mode = letter_to_mode(line[0]);
+		ncorpus++;
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	return 0;
+err:
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	return -1;
+}
+
+static struct selabel_handle *open_handle(void)
+{
+	struct selinux_opt opts[] = {
+		{ SELABEL_OPT_PATH, spec_path },
+		{ SELABEL_OPT_BASEONLY, baseonly ? (char *)1 : NULL },
+	};
+
+	return selabel_open(SELABEL_CTX_FILE, opts, 2);
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long p;
+	uint64_t start;
+	size_t i;
+	char *con;
+
+	start = now_ns();
+	w->hnd = open_handle();
+	w->load_ns = now_ns() - start;
+	if (!w->hnd)
+		return NULL;
+
+	for (p = 0; p < passes; p++) {
+		for (i = 0; i < ncorpus; i++) {
+			if (selabel_lookup_raw(w->hnd, &con, corpus[i].path,
+					       corpus[i].mode) < 0) {
+				w->failures++;
+			} else {
+				freecon(con);
+			}
+			w->lookups++;
+		}
+	}
+	return NULL;
+}
+
+/* resident set size in kB */
+static long rss_kb(void)
+{
+	long pages = 0, rss = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%ld %ld", &pages, &rss) != 2)
+		rss = -1;
+	fclose(fp);
+	return rss < 0 ? -1 : rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage:  %s [-f file_contexts] [-b] [-t threads] [-n passes] corpus\n"
+		"        %s -g directory\n", progname, progname);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	struct selabel_handle *hnd;
+	union selinux_callback cb;
+	unsigned long lookups = 0, failures = 0;
+	uint64_t start, load_ns, elapsed;
+	long rss_before, rss_after;
+	int nthreads = 1, opt, i;
+
+	while ((opt = getopt(argc, argv, "f:bt:n:g:")) > 0) {
+		switch (opt) {
+		case 'f':
+			spec_path = optarg;
+			break;
+		case 'b':
+			baseonly = 1;
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			if (nthreads < 1)
+				usage(argv[0]);
+			break;
+		case 'n':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			if (nftw(optarg, print_entry, 64, FTW_PHYS | FTW_MOUNT)) {
+				fprintf(stderr, "%s:  cannot walk %s:  %s\n",
+					argv[0], optarg, strerror(errno));
+				exit(2);
+			}
+			exit(0);
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1)
+		usage(argv[0]);
+
+	if (read_corpus(argv[optind]) < 0 || !ncorpus) {
+		fprintf(stderr, "%s:  cannot read paths from %s:  %s\n",
+			argv[0], argv[optind],
+			errno ? strerror(errno) : "no entries");
+		exit(2);
+	}
+
+	cb.func_log = quiet_log;
+	selinux_set_callback(SELINUX_CB_LOG, cb);
+
+	/* load time and memory of one handle, and its regex executions */
+	rss_before = rss_kb();
+	start = now_ns();
+	hnd = open_handle();
+	load_ns = now_ns() - start;
+	rss_after = rss_kb();
+	if (!hnd) {
+		fprintf(stderr, "%s:  cannot load file contexts:  %s\n",
+			argv[0], strerror(errno));
+		exit(3);
+	}
+	for (i = 0; (size_t)i < ncorpus; i++) {
+		char *con;
+
+		if (selabel_lookup_raw(hnd, &con, corpus[i].path,
+				       corpus[i].mode) == 0)
+			freecon(con);
+	}
+	printf("specs loaded in %.3f ms, rss +%ld kB after load, "
+	       "+%ld kB after one pass\n", load_ns / 1e6,
+	       rss_after - rss_before, rss_kb() - rss_before);
+	cb.func_log = count_execs;
+	selinux_set_callback(SELINUX_CB_LOG, cb);
+	selabel_stats(hnd);
+	cb.func_log = quiet_log;
+	selinux_set_callback(SELINUX_CB_LOG, cb);
+	printf("paths=%zu regex execs/lookup=%.2f\n", ncorpus,
+	       (double)stat_execs / ncorpus);
+	selabel_close(hnd);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers) {
+		fprintf(stderr, "%s:  out of memory\n", argv[0]);
+		exit(4);
+	}
+
+	start = now_ns();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, run_worker,
+				   &workers[i])) {
+			fprintf(stderr, "%s:  pthread_create failed\n",
+				argv[0]);
+			exit(4);
+		}
+	}
+
+	load_ns = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (!workers[i].hnd) {
+			fprintf(stderr, "%s:  thread %d could not load file "
+				"contexts\n", argv[0], i);
+			exit(3);
+		}
+		lookups += workers[i].lookups;
+		failures += workers[i].failures;
+		if (workers[i].load_ns > load_ns)
+			load_ns = workers[i].load_ns;
+		selabel_close(workers[i].hnd);
+	}
+	elapsed = now_ns() - start;
+
+	printf("threads=%d lookups=%lu unlabeled=%lu seconds=%.3f "
+	       "lookups/sec=%.0f (slowest load %.3f ms)\n", nthreads,
+	       lookups, failures, elapsed / 1e9,
+	       elapsed ? lookups * 1e9 / elapsed : 0, load_ns / 1e6);
+
+	free(workers);
+	exit(0);
+}
@@ -13,6 +13,14 @@ extern int semanage_fcontext_modify_local(semanage_handle_t * handle,
 extern int semanage_fcontext_del_local(semanage_handle_t * handle,
 				       const semanage_fcontext_key_t * key);
 
+extern int semanage_fcontext_modify_local_many(semanage_handle_t * handle,
+					       semanage_fcontext_t * const *records,
+					       unsigned int count);
+
+extern int semanage_fcontext_del_local_many(semanage_handle_t * handle,
+					    semanage_fcontext_key_t * const *keys,
+					    unsigned int count);
+
 extern int semanage_fcontext_query_local(semanage_handle_t * handle,
 					 const semanage_fcontext_key_t * key,
 					 semanage_fcontext_t ** response);
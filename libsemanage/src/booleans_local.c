@@ -27,6 +27,24 @@ int semanage_bool_del_local(semanage_handle_t * handle,
 	return dbase_del(handle, dconfig, key);
 }
 
+int semanage_bool_modify_local_many(semanage_handle_t * handle,
+				    semanage_bool_t * const *records,
+				    unsigned int count)
+{
+
+	dbase_config_t *dconfig = semanage_bool_dbase_local(handle);
+	return dbase_modify_many(handle, dconfig, records, count);
+}
+
+int semanage_bool_del_local_many(semanage_handle_t * handle,
+				 semanage_bool_key_t * const *keys,
+				 unsigned int count)
+{
+
+	dbase_config_t *dconfig = semanage_bool_dbase_local(handle);
+	return dbase_del_many(handle, dconfig, keys, count);
+}
+
 int semanage_bool_query_local(semanage_handle_t * handle,
 			      const semanage_bool_key_t * key,
 			      semanage_bool_t ** response)
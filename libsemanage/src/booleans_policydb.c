@@ -38,6 +38,7 @@ typedef struct dbase_policydb dbase_t;
 record_policydb_table_t SEMANAGE_BOOL_POLICYDB_RTABLE = {
 	.add = NULL,
 	.modify = NULL,
+	.modify_many = NULL,
 /* FIXME: these casts depend on stucts in libsepol matching structs
  * in libsemanage. This is incredibly fragile - the casting gets
  * rid of warnings, but is not type safe.
@@ -57,9 +57,9 @@ static int parse_errors;
         char *s;
 }
 
-%token MODULE_STORE VERSION EXPAND_CHECK FILE_MODE SAVE_PREVIOUS SAVE_LINKED
+%token MODULE_STORE VERSION EXPAND_CHECK FILE_MODE SAVE_PREVIOUS SAVE_LINKED POLICY_INDEX
 %token LOAD_POLICY_START SETFILES_START SEFCONTEXT_COMPILE_START DISABLE_GENHOMEDIRCON HANDLE_UNKNOWN USEPASSWD IGNOREDIRS
-%token BZIP_BLOCKSIZE BZIP_SMALL
+%token BZIP_BLOCKSIZE BZIP_SMALL COMPRESSION COMMIT_PROFILE
 %token VERIFY_MOD_START VERIFY_LINKED_START VERIFY_KERNEL_START BLOCK_END
 %token PROG_PATH PROG_ARGS
 %token <s> ARG
@@ -82,12 +82,15 @@ single_opt:     module_store
         |       file_mode
         |       save_previous
         |       save_linked
+        |       policy_index
         |       disable_genhomedircon
         |       usepasswd
         |       ignoredirs
         |       handle_unknown
 	|	bzip_blocksize
 	|	bzip_small
+	|	compression
+	|	commit_profile
         ;
 
 module_store:   MODULE_STORE '=' ARG {
@@ -145,6 +148,17 @@ save_linked:    SAVE_LINKED '=' ARG {
                 }
         ;
 
+policy_index:   POLICY_INDEX '=' ARG {
+	                if (strcasecmp($3, "true") == 0)
+		                current_conf->policy_index = 1;
+			else if (strcasecmp($3, "false") == 0)
+				current_conf->policy_index = 0;
+			else {
+				yyerror("policy-index can only be 'true' or 'false'");
+			}
+                }
+        ;
+
 disable_genhomedircon: DISABLE_GENHOMEDIRCON '=' ARG {
 	if (strcasecmp($3, "false") == 0) {
 		current_conf->disable_genhomedircon = 0;
@@ -204,6 +218,28 @@ bzip_small:  BZIP_SMALL '=' ARG {
 	free($3);
 }
 
+compression:  COMPRESSION '=' ARG {
+	if (strcasecmp($3, "bzip2") == 0) {
+		current_conf->compression = SEMANAGE_COMPRESS_BZIP2;
+	} else if (strcasecmp($3, "zlib") == 0) {
+		current_conf->compression = SEMANAGE_COMPRESS_ZLIB;
+	} else {
+		yyerror("compression can only be 'bzip2' or 'zlib'");
+	}
+	free($3);
+}
+
+commit_profile:  COMMIT_PROFILE '=' ARG {
+	if (strcasecmp($3, "false") == 0) {
+		current_conf->commit_profile = 0;
+	} else if (strcasecmp($3, "true") == 0) {
+		current_conf->commit_profile = 1;
+	} else {
+		yyerror("commit-profile can only be 'true' or 'false'");
+	}
+	free($3);
+}
+
 command_block: 
                 command_start external_opts BLOCK_END  {
                         if (new_external->path == NULL) {
@@ -283,52 +319,18 @@ static int semanage_conf_init(semanage_conf_t * conf)
 	conf->file_mode = 0644;
 	conf->bzip_blocksize = 9;
 	conf->bzip_small = 0;
+	conf->compression = SEMANAGE_COMPRESS_BZIP2;
+	conf->commit_profile = 0;
 
 	conf->save_previous = 0;
 	conf->save_linked = 0;
+	conf->policy_index = 0;
 
-	if ((conf->load_policy =
-	     calloc(1, sizeof(*(current_conf->load_policy)))) == NULL) {
-		return -1;
-	}
-
-	if (access("/sbin/load_policy", X_OK) == 0) {
-		conf->load_policy->path = strdup("/sbin/load_policy");
-	} else {
-		conf->load_policy->path = strdup("/usr/sbin/load_policy");
-	}
-	if (conf->load_policy->path == NULL) {
-		return -1;
-	}
-	conf->load_policy->args = NULL;
-
-	if ((conf->setfiles =
-	     calloc(1, sizeof(*(current_conf->setfiles)))) == NULL) {
-		return -1;
-	}
-	if (access("/sbin/setfiles", X_OK) == 0) {
-		conf->setfiles->path = strdup("/sbin/setfiles");
-	} else {
-		conf->setfiles->path = strdup("/usr/sbin/setfiles");
-	}
-	if ((conf->setfiles->path == NULL) ||
-	    (conf->setfiles->args = strdup("-q -c $@ $<")) == NULL) {
-		return -1;
-	}
-
-	if ((conf->sefcontext_compile =
-	     calloc(1, sizeof(*(current_conf->sefcontext_compile)))) == NULL) {
-		return -1;
-	}
-	if (access("/sbin/sefcontext_compile", X_OK) == 0) {
-		conf->sefcontext_compile->path = strdup("/sbin/sefcontext_compile");
-	} else {
-		conf->sefcontext_compile->path = strdup("/usr/sbin/sefcontext_compile");
-	}
-	if ((conf->sefcontext_compile->path == NULL) ||
-	    (conf->sefcontext_compile->args = strdup("$@")) == NULL) {
-		return -1;
-	}
+	/* load_policy, setfiles and sefcontext_compile are run
+	 * in-process unless programs for them are configured */
+	conf->load_policy = NULL;
+	conf->setfiles = NULL;
+	conf->sefcontext_compile = NULL;
 
 	return 0;
 }
@@ -30,7 +30,7 @@ static int enter_ro(semanage_handle_t * handle, dbase_config_t * dconfig)
 	if (!handle->is_in_transaction &&
 	    handle->conf->store_type == SEMANAGE_CON_DIRECT) {
 
-		if (semanage_get_active_lock(handle) < 0) {
+		if (semanage_get_active_shared_lock(handle) < 0) {
 			ERR(handle, "could not get the active lock");
 			goto err;
 		}
@@ -93,6 +93,38 @@ int dbase_modify(semanage_handle_t * handle,
 	return STATUS_SUCCESS;
 }
 
+int dbase_modify_many(semanage_handle_t * handle,
+		      dbase_config_t * dconfig,
+		      record_t * const *records, unsigned int nrecords)
+{
+
+	record_table_t *rtable;
+	record_key_t *key = NULL;
+	unsigned int i;
+
+	if (enter_rw(handle, dconfig) < 0)
+		return STATUS_ERR;
+
+	if (dconfig->dtable->modify_many)
+		return dconfig->dtable->modify_many(handle, dconfig->dbase,
+						    (record_t **) records,
+						    nrecords);
+
+	rtable = dconfig->dtable->get_rtable(dconfig->dbase);
+	for (i = 0; i < nrecords; i++) {
+		if (rtable->key_extract(handle, records[i], &key) < 0)
+			return STATUS_ERR;
+		if (dconfig->dtable->modify(handle, dconfig->dbase,
+					    key, records[i]) < 0) {
+			rtable->key_free(key);
+			return STATUS_ERR;
+		}
+		rtable->key_free(key);
+	}
+
+	return STATUS_SUCCESS;
+}
+
 int dbase_set(semanage_handle_t * handle,
 	      dbase_config_t * dconfig,
 	      const record_key_t * key, const record_t * data)
@@ -120,6 +152,28 @@ int dbase_del(semanage_handle_t * handle,
 	return STATUS_SUCCESS;
 }
 
+int dbase_del_many(semanage_handle_t * handle,
+		   dbase_config_t * dconfig,
+		   record_key_t * const *keys, unsigned int nkeys)
+{
+
+	unsigned int i;
+
+	if (enter_rw(handle, dconfig) < 0)
+		return STATUS_ERR;
+
+	if (dconfig->dtable->del_many)
+		return dconfig->dtable->del_many(handle, dconfig->dbase,
+						 keys, nkeys);
+
+	for (i = 0; i < nkeys; i++) {
+		if (dconfig->dtable->del(handle, dconfig->dbase, keys[i]) < 0)
+			return STATUS_ERR;
+	}
+
+	return STATUS_SUCCESS;
+}
+
 int dbase_query(semanage_handle_t * handle,
 		dbase_config_t * dconfig,
 		const record_key_t * key, record_t ** response)
@@ -77,6 +77,13 @@ typedef struct dbase_table {
 		       dbase_t * dbase,
 		       const record_key_t * key, const record_t * data);
 
+	/* Modify or add several records, in order, as by modify
+	 * on each.  Optional: may be NULL if a database has no
+	 * cheaper way to do this than calling modify */
+	int (*modify_many) (struct semanage_handle * handle,
+			    dbase_t * dbase,
+			    record_t ** records, unsigned int nrecords);
+
 	/* Modify the specified record in the database
 	 * if it is present. Fail if it does not yet exist
 	 */
@@ -88,6 +95,12 @@ typedef struct dbase_table {
 	int (*del) (struct semanage_handle * handle,
 		    dbase_t * dbase, const record_key_t * key);
 
+	/* Delete several records, in order, as by del on each.
+	 * Optional, as modify_many */
+	int (*del_many) (struct semanage_handle * handle,
+			 dbase_t * dbase,
+			 record_key_t * const *keys, unsigned int nkeys);
+
 	/* Clear all records, and leave the database in
 	 * cached, modified state. This function does 
 	 * not require a call to cache() */
@@ -188,6 +201,10 @@ extern int dbase_modify(struct semanage_handle *handle,
 			dbase_config_t * dconfig,
 			const record_key_t * key, const record_t * data);
 
+extern int dbase_modify_many(struct semanage_handle *handle,
+			     dbase_config_t * dconfig,
+			     record_t * const *records, unsigned int nrecords);
+
 extern int dbase_set(struct semanage_handle *handle,
 		     dbase_config_t * dconfig,
 		     const record_key_t * key, const record_t * data);
@@ -195,6 +212,10 @@ extern int dbase_set(struct semanage_handle *handle,
 extern int dbase_del(struct semanage_handle *handle,
 		     dbase_config_t * dconfig, const record_key_t * key);
 
+extern int dbase_del_many(struct semanage_handle *handle,
+			  dbase_config_t * dconfig,
+			  record_key_t * const *keys, unsigned int nkeys);
+
 extern int dbase_query(struct semanage_handle *handle,
 		       dbase_config_t * dconfig,
 		       const record_key_t * key, record_t ** response);
@@ -159,8 +159,10 @@ dbase_table_t SEMANAGE_ACTIVEDB_DTABLE = {
 	.add = (void *)dbase_llist_add,
 	.set = (void *)dbase_llist_set,
 	.del = (void *)dbase_llist_del,
+	.del_many = (void *)dbase_llist_del_many,
 	.clear = (void *)dbase_llist_clear,
 	.modify = (void *)dbase_llist_modify,
+	.modify_many = (void *)dbase_llist_modify_many,
 	.query = (void *)dbase_llist_query,
 	.count = (void *)dbase_llist_count,
 
@@ -32,8 +32,95 @@ struct dbase_join {
 
 	/* JOIN extension */
 	record_join_table_t *rjtable;
+
+	/* Records changed through the join since it was cached or last
+	 * flushed, as they were last seen; flush pushes only these to the
+	 * backing databases, unless dirty_all asks for a full rewrite */
+	record_t **dirty;
+	unsigned int ndirty;
+	unsigned int dirty_alloc;
+	int dirty_all;
 };
 
+static void dbase_join_dirty_reset(dbase_join_t * dbase)
+{
+
+	record_table_t *rtable = dbase_llist_get_rtable(&dbase->llist);
+	unsigned int i;
+
+	for (i = 0; i < dbase->ndirty; i++)
+		rtable->free(dbase->dirty[i]);
+	free(dbase->dirty);
+	dbase->dirty = NULL;
+	dbase->ndirty = 0;
+	dbase->dirty_alloc = 0;
+	dbase->dirty_all = 0;
+}
+
+/* Remember that the record with the key of 'record' changed; takes
+ * ownership of 'record'.  Falls back to a full rewrite on failure. */
+static void dbase_join_dirty_add(dbase_join_t * dbase, record_t * record)
+{
+
+	record_table_t *rtable = dbase_llist_get_rtable(&dbase->llist);
+	record_t **tmp;
+	unsigned int alloc;
+
+	if (dbase->dirty_all || record == NULL)
+		goto full;
+
+	if (dbase->ndirty == dbase->dirty_alloc) {
+		alloc = dbase->dirty_alloc ? dbase->dirty_alloc * 2 : 16;
+		tmp = realloc(dbase->dirty, alloc * sizeof(*tmp));
+		if (tmp == NULL)
+			goto full;
+		dbase->dirty = tmp;
+		dbase->dirty_alloc = alloc;
+	}
+	dbase->dirty[dbase->ndirty++] = record;
+	return;
+
+      full:
+	rtable->free(record);
+	dbase_join_dirty_reset(dbase);
+	dbase->dirty_all = 1;
+}
+
+/* As dbase_join_dirty_add, for a record of the caller */
+static void dbase_join_dirty_note(semanage_handle_t * handle,
+				  dbase_join_t * dbase, const record_t * data)
+{
+
+	record_table_t *rtable = dbase_llist_get_rtable(&dbase->llist);
+	record_t *record = NULL;
+
+	if (!dbase->dirty_all && rtable->clone(handle, data, &record) < 0)
+		record = NULL;
+	dbase_join_dirty_add(dbase, record);
+}
+
+/* As dbase_join_dirty_add, for the record stored under 'key', if any */
+static void dbase_join_dirty_key(semanage_handle_t * handle,
+				 dbase_join_t * dbase,
+				 const record_key_t * key)
+{
+
+	record_t *record = NULL;
+	int exists;
+
+	if (dbase->dirty_all)
+		return;
+	if (dbase_llist_exists(handle, &dbase->llist, key, &exists) < 0) {
+		dbase_join_dirty_add(dbase, NULL);
+		return;
+	}
+	if (!exists)
+		return;
+	if (dbase_llist_query(handle, &dbase->llist, key, &record) < 0)
+		record = NULL;
+	dbase_join_dirty_add(dbase, record);
+}
+
 static int dbase_join_cache(semanage_handle_t * handle, dbase_join_t * dbase)
 {
 
@@ -57,6 +144,9 @@ static int dbase_join_cache(semanage_handle_t * handle, dbase_join_t * dbase)
 	if (!dbase_llist_needs_resync(handle, &dbase->llist))
 		return STATUS_SUCCESS;
 
+	/* Changes made to the dropped cache are lost with it */
+	dbase_join_dirty_reset(dbase);
+
 	/* Update cache serial */
 	dbase_llist_cache_init(&dbase->llist);
 	if (dbase_llist_set_serial(handle, &dbase->llist) < 0)
@@ -165,6 +255,75 @@ static int dbase_join_cache(semanage_handle_t * handle, dbase_join_t * dbase)
 	return STATUS_ERR;
 }
 
+/* Push the changes recorded in the dirty list to the backing
+ * databases: split each changed record and store the parts under its
+ * key, or delete the key from both if the record is gone */
+static int dbase_join_flush_dirty(semanage_handle_t * handle,
+				  dbase_join_t * dbase)
+{
+
+	/* Extract all the object tables information */
+	dbase_t *dbase1 = dbase->join1->dbase;
+	dbase_t *dbase2 = dbase->join2->dbase;
+	dbase_table_t *dtable1 = dbase->join1->dtable;
+	dbase_table_t *dtable2 = dbase->join2->dtable;
+	record_table_t *rtable = dbase_llist_get_rtable(&dbase->llist);
+	record_join_table_t *rjtable = dbase->rjtable;
+	record_table_t *rtable1 = dtable1->get_rtable(dbase1);
+	record_table_t *rtable2 = dtable2->get_rtable(dbase2);
+
+	record_key_t *rkey = NULL;
+	record_t *record = NULL;
+	record1_t *record1 = NULL;
+	record2_t *record2 = NULL;
+	unsigned int i;
+	int exists;
+
+	for (i = 0; i < dbase->ndirty; i++) {
+
+		if (rtable->key_extract(handle, dbase->dirty[i], &rkey) < 0)
+			goto err;
+
+		if (dbase_llist_exists(handle, &dbase->llist, rkey, &exists) < 0)
+			goto err;
+
+		if (!exists) {
+			if (dtable1->del(handle, dbase1, rkey) < 0)
+				goto err;
+			if (dtable2->del(handle, dbase2, rkey) < 0)
+				goto err;
+		} else {
+			if (dbase_llist_query(handle, &dbase->llist, rkey,
+					      &record) < 0)
+				goto err;
+			if (rjtable->split(handle, record, &record1, &record2) < 0)
+				goto err;
+			if (dtable1->modify(handle, dbase1, rkey, record1) < 0)
+				goto err;
+			if (dtable2->modify(handle, dbase2, rkey, record2) < 0)
+				goto err;
+		}
+
+		rtable->key_free(rkey);
+		rtable->free(record);
+		rtable1->free(record1);
+		rtable2->free(record2);
+		rkey = NULL;
+		record = NULL;
+		record1 = NULL;
+		record2 = NULL;
+	}
+
+	return STATUS_SUCCESS;
+
+      err:
+	rtable->key_free(rkey);
+	rtable->free(record);
+	rtable1->free(record1);
+	rtable2->free(record2);
+	return STATUS_ERR;
+}
+
 /* Flush database */
 static int dbase_join_flush(semanage_handle_t * handle, dbase_join_t * dbase)
 {
@@ -188,6 +347,13 @@ static int dbase_join_flush(semanage_handle_t * handle, dbase_join_t * dbase)
 	if (!dbase_llist_is_modified(&dbase->llist))
 		return STATUS_SUCCESS;
 
+	/* Only some records changed, and we know which */
+	if (!dbase->dirty_all) {
+		if (dbase_join_flush_dirty(handle, dbase) < 0)
+			goto err;
+		goto done;
+	}
+
 	/* Then clear all records from the cache.
 	 * This is *not* the same as dropping the cache - it's an explicit
 	 * request to delete all current records. We need to do 
@@ -221,9 +387,11 @@ static int dbase_join_flush(semanage_handle_t * handle, dbase_join_t * dbase)
 		record2 = NULL;
 	}
 
+      done:
 	/* Note that this function does not flush the child databases, it
 	 * leaves that decision up to higher-level code */
 
+	dbase_join_dirty_reset(dbase);
 	dbase_llist_set_modified(&dbase->llist, 0);
 	return STATUS_SUCCESS;
 
@@ -235,6 +403,100 @@ static int dbase_join_flush(semanage_handle_t * handle, dbase_join_t * dbase)
 	return STATUS_ERR;
 }
 
+/* Modification methods: the llist ones, noting what they change */
+static int dbase_join_add(semanage_handle_t * handle,
+			  dbase_join_t * dbase,
+			  const record_key_t * key, const record_t * data)
+{
+
+	if (dbase_llist_add(handle, &dbase->llist, key, data) < 0)
+		return STATUS_ERR;
+
+	/* The key may now be there twice, which the dirty list
+	 * cannot express */
+	dbase_join_dirty_add(dbase, NULL);
+	return STATUS_SUCCESS;
+}
+
+static int dbase_join_set(semanage_handle_t * handle,
+			  dbase_join_t * dbase,
+			  const record_key_t * key, const record_t * data)
+{
+
+	if (dbase_llist_set(handle, &dbase->llist, key, data) < 0)
+		return STATUS_ERR;
+
+	dbase_join_dirty_note(handle, dbase, data);
+	return STATUS_SUCCESS;
+}
+
+static int dbase_join_modify(semanage_handle_t * handle,
+			     dbase_join_t * dbase,
+			     const record_key_t * key, const record_t * data)
+{
+
+	if (dbase_llist_modify(handle, &dbase->llist, key, data) < 0)
+		return STATUS_ERR;
+
+	dbase_join_dirty_note(handle, dbase, data);
+	return STATUS_SUCCESS;
+}
+
+static int dbase_join_modify_many(semanage_handle_t * handle,
+				  dbase_join_t * dbase,
+				  record_t ** records, unsigned int nrecords)
+{
+
+	unsigned int i;
+
+	if (dbase_llist_modify_many(handle, &dbase->llist,
+				    records, nrecords) < 0)
+		return STATUS_ERR;
+
+	for (i = 0; i < nrecords; i++) {
+		if (records[i] != NULL)
+			dbase_join_dirty_note(handle, dbase, records[i]);
+	}
+	return STATUS_SUCCESS;
+}
+
+static int dbase_join_del(semanage_handle_t * handle,
+			  dbase_join_t * dbase, const record_key_t * key)
+{
+
+	dbase_join_dirty_key(handle, dbase, key);
+	return dbase_llist_del(handle, &dbase->llist, key);
+}
+
+static int dbase_join_del_many(semanage_handle_t * handle,
+			       dbase_join_t * dbase,
+			       record_key_t * const *keys, unsigned int nkeys)
+{
+
+	unsigned int i;
+
+	for (i = 0; i < nkeys; i++)
+		dbase_join_dirty_key(handle, dbase, keys[i]);
+	return dbase_llist_del_many(handle, &dbase->llist, keys, nkeys);
+}
+
+static int dbase_join_clear(semanage_handle_t * handle, dbase_join_t * dbase)
+{
+
+	if (dbase_llist_clear(handle, &dbase->llist) < 0)
+		return STATUS_ERR;
+
+	dbase_join_dirty_add(dbase, NULL);
+	return STATUS_SUCCESS;
+}
+
+static void dbase_join_drop_cache(dbase_join_t * dbase)
+{
+
+	dbase_join_dirty_reset(dbase);
+	dbase_llist_drop_cache(&dbase->llist);
+}
+
 int dbase_join_init(semanage_handle_t * handle,
 		    record_table_t * rtable,
 		    record_join_table_t * rjtable,
@@ -252,6 +514,10 @@ int dbase_join_init(semanage_handle_t * handle,
 	tmp_dbase->rjtable = rjtable;
 	tmp_dbase->join1 = join1;
 	tmp_dbase->join2 = join2;
+	tmp_dbase->dirty = NULL;
+	tmp_dbase->ndirty = 0;
+	tmp_dbase->dirty_alloc = 0;
+	tmp_dbase->dirty_all = 0;
 
 	*dbase = tmp_dbase;
 
@@ -267,7 +533,7 @@ int dbase_join_init(semanage_handle_t * handle,
 void dbase_join_release(dbase_join_t * dbase)
 {
 
-	dbase_llist_drop_cache(&dbase->llist);
+	dbase_join_drop_cache(dbase);
 	free(dbase);
 }
 
@@ -276,7 +542,7 @@ dbase_table_t SEMANAGE_JOIN_DTABLE = {
 
 	/* Cache/Transactions */
 	.cache = dbase_join_cache,
-	.drop_cache = (void *)dbase_llist_drop_cache,
+	.drop_cache = dbase_join_drop_cache,
 	.flush = dbase_join_flush,
 	.is_modified = (void *)dbase_llist_is_modified,
 
@@ -284,11 +550,13 @@ dbase_table_t SEMANAGE_JOIN_DTABLE = {
 	.iterate = (void *)dbase_llist_iterate,
 	.exists = (void *)dbase_llist_exists,
 	.list = (void *)dbase_llist_list,
-	.add = (void *)dbase_llist_add,
-	.set = (void *)dbase_llist_set,
-	.del = (void *)dbase_llist_del,
-	.clear = (void *)dbase_llist_clear,
-	.modify = (void *)dbase_llist_modify,
+	.add = dbase_join_add,
+	.set = dbase_join_set,
+	.del = dbase_join_del,
+	.del_many = dbase_join_del_many,
+	.clear = dbase_join_clear,
+	.modify = dbase_join_modify,
+	.modify_many = dbase_join_modify_many,
 	.query = (void *)dbase_llist_query,
 	.count = (void *)dbase_llist_count,
 
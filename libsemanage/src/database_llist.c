@@ -9,6 +9,7 @@ typedef struct dbase_llist dbase_t;
 #define DBASE_DEFINED
 
 #include <stdlib.h>
+#include <string.h>
 #include "debug.h"
 #include "handle.h"
 #include "database_llist.h"
@@ -33,6 +34,104 @@ int dbase_llist_needs_resync(semanage_handle_t * handle, dbase_llist_t * dbase)
 	return 0;
 }
 
+/* Order of entries in the lookup index: by key, and among
+ * entries with equal keys, the one nearest the head comes first,
+ * so that lookups find the same entry a scan of the list would. */
+static int dbase_llist_index_cmp(const void *p1, const void *p2, void *arg)
+{
+
+	const cache_entry_t *e1 = *(const cache_entry_t * const *)p1;
+	const cache_entry_t *e2 = *(const cache_entry_t * const *)p2;
+	dbase_llist_t *dbase = arg;
+	int rc;
+
+	rc = dbase->rtable->compare2(e1->data, e2->data);
+	if (rc != 0)
+		return rc;
+	return (e1->seq > e2->seq) ? -1 : (e1->seq < e2->seq);
+}
+
+static void dbase_llist_index_drop(dbase_llist_t * dbase)
+{
+
+	free(dbase->index);
+	dbase->index = NULL;
+	dbase->index_alloc = 0;
+}
+
+static int dbase_llist_index_build(dbase_llist_t * dbase)
+{
+
+	cache_entry_t *ptr;
+	unsigned int i = 0, alloc = dbase->cache_sz ? dbase->cache_sz : 1;
+
+	dbase->index = malloc(alloc * sizeof(*dbase->index));
+	if (dbase->index == NULL)
+		return STATUS_ERR;
+	dbase->index_alloc = alloc;
+
+	for (ptr = dbase->cache; ptr != NULL; ptr = ptr->next)
+		dbase->index[i++] = ptr;
+	qsort_r(dbase->index, dbase->cache_sz, sizeof(*dbase->index),
+		dbase_llist_index_cmp, dbase);
+	return STATUS_SUCCESS;
+}
+
+/* Returns the position of the first indexed entry matching key,
+ * or cache_sz if there is none */
+static unsigned int dbase_llist_index_search(dbase_llist_t * dbase,
+					     const record_key_t * key)
+{
+
+	unsigned int lo = 0, hi = dbase->cache_sz, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (dbase->rtable->compare(dbase->index[mid]->data, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < dbase->cache_sz &&
+	    !dbase->rtable->compare(dbase->index[lo]->data, key))
+		return lo;
+	return dbase->cache_sz;
+}
+
+/* Adds an entry that is about to become the new head */
+static void dbase_llist_index_insert(dbase_llist_t * dbase,
+				     cache_entry_t * entry)
+{
+
+	unsigned int lo = 0, hi = dbase->cache_sz, mid;
+	cache_entry_t **tmp;
+
+	if (dbase->index == NULL)
+		return;
+
+	if (dbase->cache_sz == dbase->index_alloc) {
+		tmp = realloc(dbase->index,
+			      2 * dbase->index_alloc * sizeof(*tmp));
+		if (tmp == NULL) {
+			dbase_llist_index_drop(dbase);
+			return;
+		}
+		dbase->index = tmp;
+		dbase->index_alloc *= 2;
+	}
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (dbase_llist_index_cmp(&dbase->index[mid], &entry, dbase) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	memmove(&dbase->index[lo + 1], &dbase->index[lo],
+		(dbase->cache_sz - lo) * sizeof(*dbase->index));
+	dbase->index[lo] = entry;
+}
+
 /* Helper for adding records to the cache */
 int dbase_llist_cache_prepend(semanage_handle_t * handle,
 			      dbase_llist_t * dbase, const record_t * data)
@@ -48,6 +147,8 @@ int dbase_llist_cache_prepend(semanage_handle_t * handle,
 
 	entry->prev = NULL;
 	entry->next = dbase->cache;
+	entry->seq = dbase->cache_seq++;
+	dbase_llist_index_insert(dbase, entry);
 
 	/* Link */
 	if (dbase->cache != NULL)
@@ -80,6 +181,7 @@ void dbase_llist_drop_cache(dbase_llist_t * dbase)
 		dbase->rtable->free(prev->data);
 		free(prev);
 	}
+	dbase_llist_index_drop(dbase);
 
 	dbase->cache_serial = -1;
 	dbase->modified = 0;
@@ -106,11 +208,21 @@ static int dbase_llist_cache_locate(semanage_handle_t * handle,
 {
 
 	cache_entry_t *ptr;
+	unsigned int i;
 
 	/* Implemented in parent */
 	if (dbase->dtable->cache(handle, dbase) < 0)
 		goto err;
 
+	if (dbase->index != NULL || dbase_llist_index_build(dbase) == 0) {
+		i = dbase_llist_index_search(dbase, key);
+		if (i == dbase->cache_sz)
+			return STATUS_NODATA;
+		*entry = dbase->index[i];
+		return STATUS_SUCCESS;
+	}
+
+	/* No memory for the index, fall back to a scan */
 	for (ptr = dbase->cache; ptr != NULL; ptr = ptr->next) {
 		if (!dbase->rtable->compare(ptr->data, key)) {
 			*entry = ptr;
@@ -125,6 +237,47 @@ static int dbase_llist_cache_locate(semanage_handle_t * handle,
 	return STATUS_ERR;
 }
 
+/* Helper for replacing the record held by a cache entry */
+static int dbase_llist_cache_replace(semanage_handle_t * handle,
+				     dbase_llist_t * dbase,
+				     cache_entry_t * entry,
+				     const record_t * data)
+{
+
+	record_t *tmp;
+
+	if (dbase->rtable->clone(handle, data, &tmp) < 0)
+		return STATUS_ERR;
+
+	/* A record stored under a different key moves in the index */
+	if (dbase->rtable->compare2(entry->data, tmp) != 0)
+		dbase_llist_index_drop(dbase);
+
+	dbase->rtable->free(entry->data);
+	entry->data = tmp;
+	return STATUS_SUCCESS;
+}
+
+/* Helper for removing an entry from the cache list; the lookup index
+ * and cache size are left to the caller */
+static void dbase_llist_cache_unlink(dbase_llist_t * dbase,
+				     cache_entry_t * ptr)
+{
+
+	if (ptr->prev != NULL)
+		ptr->prev->next = ptr->next;
+	else
+		dbase->cache = ptr->next;
+
+	if (ptr->next != NULL)
+		ptr->next->prev = ptr->prev;
+	else
+		dbase->cache_tail = ptr->prev;
+
+	dbase->rtable->free(ptr->data);
+	free(ptr);
+}
+
 int dbase_llist_exists(semanage_handle_t * handle,
 		       dbase_llist_t * dbase,
 		       const record_key_t * key, int *response)
@@ -178,8 +331,7 @@ int dbase_llist_set(semanage_handle_t * handle,
 		ERR(handle, "record not found in the database");
 		goto err;
 	} else {
-		dbase->rtable->free(entry->data);
-		if (dbase->rtable->clone(handle, data, &entry->data) < 0)
+		if (dbase_llist_cache_replace(handle, dbase, entry, data) < 0)
 			goto err;
 	}
 
@@ -206,8 +358,7 @@ int dbase_llist_modify(semanage_handle_t * handle,
 		if (dbase_llist_cache_prepend(handle, dbase, data) < 0)
 			goto err;
 	} else {
-		dbase->rtable->free(entry->data);
-		if (dbase->rtable->clone(handle, data, &entry->data) < 0)
+		if (dbase_llist_cache_replace(handle, dbase, entry, data) < 0)
 			goto err;
 	}
 
@@ -219,6 +370,122 @@ int dbase_llist_modify(semanage_handle_t * handle,
 	return STATUS_ERR;
 }
 
+/* Records of a dbase_llist_modify_many batch */
+typedef struct llist_batch {
+	dbase_llist_t *dbase;
+	record_t **records;
+} llist_batch_t;
+
+/* A key of the batch that is new to the database: where its first
+ * record is, and the record whose value it takes */
+typedef struct llist_added {
+	unsigned int first;
+	unsigned int last;
+} llist_added_t;
+
+/* Order of batch positions: by key, and in batch order among
+ * records with equal keys */
+static int dbase_llist_batch_cmp(const void *p1, const void *p2, void *arg)
+{
+
+	unsigned int i1 = *(const unsigned int *)p1;
+	unsigned int i2 = *(const unsigned int *)p2;
+	llist_batch_t *batch = arg;
+	int rc;
+
+	rc = batch->dbase->rtable->compare2(batch->records[i1],
+					    batch->records[i2]);
+	if (rc != 0)
+		return rc;
+	return (i1 > i2) - (i1 < i2);
+}
+
+static int dbase_llist_added_cmp(const void *p1, const void *p2)
+{
+
+	const llist_added_t *a1 = p1, *a2 = p2;
+
+	return (a1->first > a2->first) - (a1->first < a2->first);
+}
+
+/* Same result as dbase_llist_modify on each record in turn, but the
+ * batch is sorted once to find the records of each key, and the
+ * lookup index is rebuilt once instead of updated per new record:
+ * a key already present takes the last record given for it, and a
+ * new key is added where its first record was, with the value of its
+ * last.  NULL records are skipped. */
+int dbase_llist_modify_many(semanage_handle_t * handle,
+			    dbase_llist_t * dbase,
+			    record_t ** records, unsigned int nrecords)
+{
+
+	llist_batch_t batch = { dbase, records };
+	llist_added_t *added = NULL;
+	unsigned int *order = NULL;
+	unsigned int i, j, pos, n = 0, nadded = 0;
+	record_key_t *key = NULL;
+
+	if (dbase->dtable->cache(handle, dbase) < 0)
+		goto err;
+
+	order = malloc((nrecords ? nrecords : 1) * sizeof(*order));
+	added = malloc((nrecords ? nrecords : 1) * sizeof(*added));
+	if (order == NULL || added == NULL ||
+	    (dbase->index == NULL && dbase_llist_index_build(dbase) < 0))
+		goto omem;
+
+	for (i = 0; i < nrecords; i++)
+		if (records[i] != NULL)
+			order[n++] = i;
+	qsort_r(order, n, sizeof(*order), dbase_llist_batch_cmp, &batch);
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n &&
+		     !dbase->rtable->compare2(records[order[i]],
+					      records[order[j]]); j++) ;
+
+		if (dbase->rtable->key_extract(handle, records[order[j - 1]],
+					       &key) < 0)
+			goto err;
+		pos = dbase_llist_index_search(dbase, key);
+		dbase->rtable->key_free(key);
+
+		if (pos == dbase->cache_sz) {
+			added[nadded].first = order[i];
+			added[nadded].last = order[j - 1];
+			nadded++;
+		} else if (dbase_llist_cache_replace(handle, dbase,
+						     dbase->index[pos],
+						     records[order[j - 1]]) < 0)
+			goto err;
+	}
+
+	/* New records go to the head in batch order; the index is
+	 * rebuilt by the next lookup */
+	if (nadded > 0)
+		dbase_llist_index_drop(dbase);
+	qsort(added, nadded, sizeof(*added), dbase_llist_added_cmp);
+	for (i = 0; i < nadded; i++) {
+		if (dbase_llist_cache_prepend(handle, dbase,
+					      records[added[i].last]) < 0)
+			goto err;
+	}
+
+	free(order);
+	free(added);
+	dbase->modified = 1;
+	return STATUS_SUCCESS;
+
+      omem:
+	ERR(handle, "out of memory");
+
+      err:
+	ERR(handle, "could not modify record values");
+	free(order);
+	free(added);
+	return STATUS_ERR;
+}
+
 hidden int dbase_llist_count(semanage_handle_t * handle __attribute__ ((unused)),
 			     dbase_llist_t * dbase, unsigned int *response)
 {
@@ -280,33 +547,78 @@ int dbase_llist_del(semanage_handle_t * handle __attribute__ ((unused)),
 		    dbase_llist_t * dbase, const record_key_t * key)
 {
 
-	cache_entry_t *ptr, *prev = NULL;
-
-	for (ptr = dbase->cache; ptr != NULL; ptr = ptr->next) {
-		if (!dbase->rtable->compare(ptr->data, key)) {
-			if (prev != NULL)
-				prev->next = ptr->next;
-			else
-				dbase->cache = ptr->next;
-
-			if (ptr->next != NULL)
-				ptr->next->prev = ptr->prev;
-			else
-				dbase->cache_tail = ptr->prev;
+	cache_entry_t *ptr;
+	unsigned int i;
 
-			dbase->rtable->free(ptr->data);
-			dbase->cache_sz--;
-			free(ptr);
-			dbase->modified = 1;
+	if (dbase->index != NULL || dbase_llist_index_build(dbase) == 0) {
+		i = dbase_llist_index_search(dbase, key);
+		if (i == dbase->cache_sz)
+			return STATUS_SUCCESS;
+		ptr = dbase->index[i];
+		memmove(&dbase->index[i], &dbase->index[i + 1],
+			(dbase->cache_sz - i - 1) * sizeof(*dbase->index));
+	} else {
+		for (ptr = dbase->cache; ptr != NULL; ptr = ptr->next) {
+			if (!dbase->rtable->compare(ptr->data, key))
+				break;
+		}
+		if (ptr == NULL)
 			return STATUS_SUCCESS;
-		} else
-			prev = ptr;
 	}
+	dbase_llist_cache_unlink(dbase, ptr);
+	dbase->cache_sz--;
+	dbase->modified = 1;
 
 	handle = NULL;
 	return STATUS_SUCCESS;
 }
 
+/* Same result as dbase_llist_del on each key in turn.  The entries to
+ * go are marked in the lookup index, which is then compacted once. */
+int dbase_llist_del_many(semanage_handle_t * handle,
+			 dbase_llist_t * dbase,
+			 record_key_t * const *keys, unsigned int nkeys)
+{
+
+	unsigned char *gone = NULL;
+	unsigned int i, j, ngone = 0;
+
+	if ((dbase->index == NULL && dbase_llist_index_build(dbase) < 0) ||
+	    (gone = calloc(dbase->cache_sz ? dbase->cache_sz : 1, 1)) == NULL) {
+		/* No memory for the index, delete one at a time */
+		for (i = 0; i < nkeys; i++)
+			dbase_llist_del(handle, dbase, keys[i]);
+		return STATUS_SUCCESS;
+	}
+
+	/* A key given twice deletes the next entry with that key */
+	for (i = 0; i < nkeys; i++) {
+		j = dbase_llist_index_search(dbase, keys[i]);
+		while (j < dbase->cache_sz && gone[j] &&
+		       !dbase->rtable->compare(dbase->index[j]->data, keys[i]))
+			j++;
+		if (j < dbase->cache_sz && !gone[j] &&
+		    !dbase->rtable->compare(dbase->index[j]->data, keys[i])) {
+			gone[j] = 1;
+			ngone++;
+		}
+	}
+
+	if (ngone > 0) {
+		for (i = 0, j = 0; i < dbase->cache_sz; i++) {
+			if (gone[i])
+				dbase_llist_cache_unlink(dbase, dbase->index[i]);
+			else
+				dbase->index[j++] = dbase->index[i];
+		}
+		dbase->cache_sz = j;
+		dbase->modified = 1;
+	}
+
+	free(gone);
+	return STATUS_SUCCESS;
+}
+
 int dbase_llist_clear(semanage_handle_t * handle, dbase_llist_t * dbase)
 {
 
@@ -326,6 +638,7 @@ int dbase_llist_clear(semanage_handle_t * handle, dbase_llist_t * dbase)
 			free(prev);
 		}
 	}
+	dbase_llist_index_drop(dbase);
 
 	dbase->cache = NULL;
 	dbase->cache_tail = NULL;
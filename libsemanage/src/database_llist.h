@@ -11,6 +11,9 @@ typedef struct cache_entry {
 	record_t *data;
 	struct cache_entry *prev;
 	struct cache_entry *next;
+
+	/* Insertion order; later entries are closer to the head */
+	unsigned int seq;
 } cache_entry_t;
 
 /* LLIST dbase */
@@ -27,6 +30,13 @@ typedef struct dbase_llist {
 	unsigned int cache_sz;
 	int cache_serial;
 	int modified;
+
+	/* Lookup index: the cache entries sorted by key, with entries
+	 * of equal keys ordered head first.  Built on the first lookup,
+	 * and dropped (to be rebuilt later) if it cannot be updated. */
+	cache_entry_t **index;
+	unsigned int index_alloc;
+	unsigned int cache_seq;
 } dbase_llist_t;
 
 /* Helpers for internal use only */
@@ -39,6 +49,9 @@ static inline void dbase_llist_cache_init(dbase_llist_t * dbase)
 	dbase->cache_sz = 0;
 	dbase->cache_serial = -1;
 	dbase->modified = 0;
+	dbase->index = NULL;
+	dbase->index_alloc = 0;
+	dbase->cache_seq = 0;
 }
 
 static inline void dbase_llist_init(dbase_llist_t * dbase,
@@ -98,6 +111,10 @@ extern int dbase_llist_modify(semanage_handle_t * handle,
 			      dbase_llist_t * dbase,
 			      const record_key_t * key, const record_t * data);
 
+extern int dbase_llist_modify_many(semanage_handle_t * handle,
+				   dbase_llist_t * dbase,
+				   record_t ** records, unsigned int nrecords);
+
 extern int dbase_llist_count(semanage_handle_t * handle,
 			     dbase_llist_t * dbase, unsigned int *response);
 
@@ -113,6 +130,10 @@ extern int dbase_llist_iterate(semanage_handle_t * handle,
 extern int dbase_llist_del(semanage_handle_t * handle,
 			   dbase_llist_t * dbase, const record_key_t * key);
 
+extern int dbase_llist_del_many(semanage_handle_t * handle,
+				dbase_llist_t * dbase,
+				record_key_t * const *keys, unsigned int nkeys);
+
 extern int dbase_llist_clear(semanage_handle_t * handle, dbase_llist_t * dbase);
 
 extern int dbase_llist_list(semanage_handle_t * handle,
@@ -36,33 +36,46 @@ struct dbase_policydb {
 
 	sepol_policydb_t *policydb;
 
+	/* The read of the backing file policydb comes from */
+	dbase_policydb_file_t *file;
+
 	int cache_serial;
 	int modified;
 	int attached;
 };
 
-static void dbase_policydb_drop_cache(dbase_policydb_t * dbase)
+/* A policy file as read by dbase_policydb_cache().  All the policydb
+ * databases are backed by policy.kern, so rather than each reading
+ * the whole policy again, they share one read of it per commit
+ * serial.  The handle keeps the latest read, to be reused by the
+ * next database that caches. */
+struct dbase_policydb_file {
+	char *fname;
+	int serial;
+	sepol_policydb_t *policydb;
+	unsigned int refs;
+};
+
+static void dbase_policydb_file_put(dbase_policydb_file_t * file)
 {
 
-	if (dbase->cache_serial >= 0) {
-		sepol_policydb_free(dbase->policydb);
-		dbase->cache_serial = -1;
-		dbase->modified = 0;
-	}
+	if (--file->refs)
+		return;
+	sepol_policydb_free(file->policydb);
+	free(file->fname);
+	free(file);
 }
 
-static int dbase_policydb_set_serial(semanage_handle_t * handle,
-				     dbase_policydb_t * dbase)
+static void dbase_policydb_drop_cache(dbase_policydb_t * dbase)
 {
 
-	int cache_serial = handle->funcs->get_serial(handle);
-	if (cache_serial < 0) {
-		ERR(handle, "could not update cache serial");
-		return STATUS_ERR;
+	if (dbase->cache_serial >= 0) {
+		dbase_policydb_file_put(dbase->file);
+		dbase->file = NULL;
+		dbase->policydb = NULL;
+		dbase->cache_serial = -1;
+		dbase->modified = 0;
 	}
-
-	dbase->cache_serial = cache_serial;
-	return STATUS_SUCCESS;
 }
 
 static int dbase_policydb_needs_resync(semanage_handle_t * handle,
@@ -87,10 +100,11 @@ static int dbase_policydb_needs_resync(semanage_handle_t * handle,
 }
 
 static int construct_filename(semanage_handle_t * handle,
-			      dbase_policydb_t * dbase, char **filename)
+			      dbase_policydb_t * dbase, int sandbox,
+			      char **filename)
 {
 
-	const char *path = (handle->is_in_transaction) ?
+	const char *path = sandbox ?
 	    semanage_path(SEMANAGE_TMP, SEMANAGE_TOPLEVEL) :
 	    semanage_path(SEMANAGE_ACTIVE, SEMANAGE_TOPLEVEL);
 	size_t fname_length = strlen(path) + strlen(dbase->suffix) + 2;
@@ -113,7 +127,9 @@ static int dbase_policydb_cache(semanage_handle_t * handle,
 	FILE *fp = NULL;
 	sepol_policydb_t *policydb = NULL;
 	sepol_policy_file_t *pf = NULL;
+	dbase_policydb_file_t *file = handle->u.direct.policydb_file;
 	char *fname = NULL;
+	int cache_serial;
 
 	/* Check if cache is needed */
 	if (dbase->attached)
@@ -122,9 +138,27 @@ static int dbase_policydb_cache(semanage_handle_t * handle,
 	if (!dbase_policydb_needs_resync(handle, dbase))
 		return STATUS_SUCCESS;
 
-	if (construct_filename(handle, dbase, &fname) < 0)
+	cache_serial = handle->funcs->get_serial(handle);
+	if (cache_serial < 0) {
+		ERR(handle, "could not update cache serial");
+		goto err;
+	}
+
+	if (construct_filename(handle, dbase, handle->is_in_transaction,
+			       &fname) < 0)
 		goto err;
 
+	/* Another database read the same file since the last commit */
+	if (file && file->serial == cache_serial &&
+	    !strcmp(file->fname, fname)) {
+		file->refs++;
+		dbase->file = file;
+		dbase->policydb = file->policydb;
+		dbase->cache_serial = cache_serial;
+		free(fname);
+		return STATUS_SUCCESS;
+	}
+
 	if (sepol_policydb_create(&policydb) < 0) {
 		ERR(handle, "could not create policydb object");
 		goto err;
@@ -158,13 +192,25 @@ static int dbase_policydb_cache(semanage_handle_t * handle,
 		fp = NULL;
 	}
 
-	/* Update cache serial */
-	if (dbase_policydb_set_serial(handle, dbase) < 0)
+	file = malloc(sizeof(*file));
+	if (!file) {
+		ERR(handle, "out of memory");
 		goto err;
+	}
+	file->fname = fname;
+	file->serial = cache_serial;
+	file->policydb = policydb;
+	/* one for the database, one for the handle */
+	file->refs = 2;
+
+	if (handle->u.direct.policydb_file)
+		dbase_policydb_file_put(handle->u.direct.policydb_file);
+	handle->u.direct.policydb_file = file;
 
 	/* Update the database policydb */
+	dbase->file = file;
 	dbase->policydb = policydb;
-	free(fname);
+	dbase->cache_serial = cache_serial;
 	return STATUS_SUCCESS;
 
       err:
@@ -216,6 +262,7 @@ int dbase_policydb_init(semanage_handle_t * handle,
 	tmp_dbase->rtable = rtable;
 	tmp_dbase->rptable = rptable;
 	tmp_dbase->policydb = NULL;
+	tmp_dbase->file = NULL;
 	tmp_dbase->cache_serial = -1;
 	tmp_dbase->modified = 0;
 	tmp_dbase->attached = 0;
@@ -238,6 +285,47 @@ void dbase_policydb_release(dbase_policydb_t * dbase)
 	free(dbase);
 }
 
+/* Release the handle's read of the policy file */
+void dbase_policydb_release_file(semanage_handle_t * handle)
+{
+
+	if (handle->u.direct.policydb_file) {
+		dbase_policydb_file_put(handle->u.direct.policydb_file);
+		handle->u.direct.policydb_file = NULL;
+	}
+}
+
+/* Hand the policydb just committed as the given serial to the handle,
+ * as its read of the active policy file, so that the next queries
+ * need not read back what was written.  The handle takes over
+ * policydb on success. */
+int dbase_policydb_keep_file(semanage_handle_t * handle,
+			     dbase_policydb_t * dbase, int serial,
+			     sepol_policydb_t * policydb)
+{
+
+	dbase_policydb_file_t *file = malloc(sizeof(*file));
+
+	if (!file)
+		goto omem;
+
+	if (construct_filename(handle, dbase, 0, &file->fname) < 0) {
+		free(file);
+		return STATUS_ERR;
+	}
+	file->serial = serial;
+	file->policydb = policydb;
+	file->refs = 1;
+
+	dbase_policydb_release_file(handle);
+	handle->u.direct.policydb_file = file;
+	return STATUS_SUCCESS;
+
+      omem:
+	ERR(handle, "out of memory, could not keep the committed policy");
+	return STATUS_ERR;
+}
+
 /* Attach to a shared policydb.
  * This implies drop_cache(),
  * and prevents flush() and drop_cache()
@@ -310,6 +398,39 @@ static int dbase_policydb_modify(semanage_handle_t * handle,
 	return STATUS_ERR;
 }
 
+static int dbase_policydb_modify_many(semanage_handle_t * handle,
+				      dbase_policydb_t * dbase,
+				      record_t ** records,
+				      unsigned int nrecords)
+{
+
+	record_key_t *key = NULL;
+	unsigned int i;
+
+	if (dbase->rptable->modify_many) {
+		if (dbase->rptable->modify_many(handle->sepolh, dbase->policydb,
+						records, nrecords) < 0)
+			goto err;
+		dbase->modified = 1;
+		return STATUS_SUCCESS;
+	}
+
+	for (i = 0; i < nrecords; i++) {
+		if (dbase->rtable->key_extract(handle, records[i], &key) < 0)
+			goto err;
+		if (dbase_policydb_modify(handle, dbase, key, records[i]) < 0)
+			goto err;
+		dbase->rtable->key_free(key);
+		key = NULL;
+	}
+	return STATUS_SUCCESS;
+
+      err:
+	dbase->rtable->key_free(key);
+	ERR(handle, "could not modify record values");
+	return STATUS_ERR;
+}
+
 static int dbase_policydb_del(semanage_handle_t * handle
 				__attribute__ ((unused)),
 			      dbase_policydb_t * dbase
@@ -495,6 +616,7 @@ dbase_table_t SEMANAGE_POLICYDB_DTABLE = {
 	.del = dbase_policydb_del,
 	.clear = dbase_policydb_clear,
 	.modify = dbase_policydb_modify,
+	.modify_many = dbase_policydb_modify_many,
 	.query = dbase_policydb_query,
 	.count = dbase_policydb_count,
 
@@ -29,6 +29,9 @@
 struct dbase_policydb;
 typedef struct dbase_policydb dbase_policydb_t;
 
+struct dbase_policydb_file;
+typedef struct dbase_policydb_file dbase_policydb_file_t;
+
 typedef int (*record_policydb_table_add_t) (sepol_handle_t * h,
 					    sepol_policydb_t * p,
 					    const record_key_t * rkey,
@@ -39,6 +42,11 @@ typedef int (*record_policydb_table_modify_t) (sepol_handle_t * h,
 					       const record_key_t * rkey,
 					       const record_t * record);
 
+typedef int (*record_policydb_table_modify_many_t) (sepol_handle_t * h,
+						    sepol_policydb_t * p,
+						    record_t * const *records,
+						    unsigned int nrecords);
+
 typedef int (*record_policydb_table_set_t) (sepol_handle_t * h,
 					    sepol_policydb_t * p,
 					    const record_key_t * rkey,
@@ -71,6 +79,9 @@ typedef struct record_policydb_table {
 	/* Modify policy record, or add if 
 	 * the key isn't found */
 	record_policydb_table_modify_t modify;
+	/* Modify or add several policy records, in order;
+	 * may be NULL */
+	record_policydb_table_modify_many_t modify_many;
 	/* Set policy record */
 	record_policydb_table_set_t set;
 	/* Query policy record  - return the record
@@ -105,6 +116,15 @@ extern void dbase_policydb_detach(dbase_policydb_t * dbase);
 /* Release allocated resources */
 extern void dbase_policydb_release(dbase_policydb_t * dbase);
 
+/* Release the handle's shared read of the policy file */
+extern void dbase_policydb_release_file(semanage_handle_t * handle);
+
+/* Keep the policydb committed as serial as the handle's read
+ * of the active policy file.  Takes over policydb on success. */
+extern int dbase_policydb_keep_file(semanage_handle_t * handle,
+				    dbase_policydb_t * dbase, int serial,
+				    sepol_policydb_t * policydb);
+
 /* POLICYDB database - method table implementation */
 extern dbase_table_t SEMANAGE_POLICYDB_DTABLE;
 
@@ -34,6 +34,7 @@
 #include <sys/types.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
 
 #include "user_internal.h"
 #include "seuser_internal.h"
@@ -72,6 +73,7 @@ static int semanage_direct_remove(semanage_handle_t * sh, char *module_name);
 static int semanage_direct_list(semanage_handle_t * sh,
 				semanage_module_info_t ** modinfo,
 				int *num_modules);
+static int module_index_update(semanage_handle_t * sh);
 
 static struct semanage_policy_table direct_funcs = {
 	.get_serial = semanage_direct_get_serial,
@@ -133,6 +135,8 @@ int semanage_direct_connect(semanage_handle_t * sh)
 
 	sh->u.direct.translock_file_fd = -1;
 	sh->u.direct.activelock_file_fd = -1;
+	sh->u.direct.activelock_shared = 0;
+	sh->u.direct.policydb_file = NULL;
 
 	/* set up function pointers */
 	sh->funcs = &direct_funcs;
@@ -243,15 +247,15 @@ int semanage_direct_connect(semanage_handle_t * sh)
 	return STATUS_ERR;
 }
 
-static void semanage_direct_destroy(semanage_handle_t * sh
-					__attribute__ ((unused)))
+static void semanage_direct_destroy(semanage_handle_t * sh)
 {
-	/* do nothing */
-	sh = NULL;
+	semanage_modules_changed(sh);
 }
 
 static int semanage_direct_disconnect(semanage_handle_t * sh)
 {
+	semanage_modules_changed(sh);
+
 	/* destroy transaction */
 	if (sh->is_in_transaction) {
 		/* destroy sandbox */
@@ -285,6 +289,7 @@ static int semanage_direct_disconnect(semanage_handle_t * sh)
 	fcontext_file_dbase_release(semanage_fcontext_dbase_policy(sh));
 	seuser_file_dbase_release(semanage_seuser_dbase_policy(sh));
 	node_policydb_dbase_release(semanage_node_dbase_policy(sh));
+	dbase_policydb_release_file(sh);
 
 	/* Release object databases: active kernel policy */
 	bool_activedb_dbase_release(semanage_bool_dbase_active(sh));
@@ -301,6 +306,7 @@ static int semanage_direct_begintrans(semanage_handle_t * sh)
 	if (semanage_get_trans_lock(sh) < 0) {
 		return -1;
 	}
+	semanage_modules_changed(sh);
 	if ((semanage_make_sandbox(sh)) < 0) {
 		return -1;
 	}
@@ -402,11 +408,56 @@ static int parse_base_headers(semanage_handle_t * sh,
 
 #include <stdlib.h>
 #include <bzlib.h>
+#include <zlib.h>
 #include <string.h>
 #include <sys/sendfile.h>
 
+/* Compress data with zlib, in gzip format, into the open file f, which
+ * is closed.  Returns num_bytes, or -1 if the data could not be
+ * compressed. */
+static ssize_t gzip_data(FILE *f, char *data, size_t num_bytes)
+{
+	z_stream zs;
+	unsigned char out[1<<16];
+	int zerror;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		fclose(f);
+		return -1;
+	}
+
+	zs.next_in = (unsigned char *)data;
+	do {
+		/* avail_in is 32 bits wide, feed larger data in pieces */
+		if (zs.avail_in == 0 && num_bytes - zs.total_in > 0)
+			zs.avail_in = num_bytes - zs.total_in > UINT_MAX ?
+			    UINT_MAX : num_bytes - zs.total_in;
+		zs.next_out = out;
+		zs.avail_out = sizeof(out);
+		zerror = deflate(&zs, zs.total_in + zs.avail_in < num_bytes ?
+				 Z_NO_FLUSH : Z_FINISH);
+		if (zerror == Z_STREAM_ERROR ||
+		    fwrite(out, 1, sizeof(out) - zs.avail_out, f) !=
+		    sizeof(out) - zs.avail_out) {
+			deflateEnd(&zs);
+			fclose(f);
+			return -1;
+		}
+	} while (zerror != Z_STREAM_END);
+
+	deflateEnd(&zs);
+	if (fclose(f) != 0)
+		return -1;
+	return num_bytes;
+}
+
 /* bzip() a data to a file, returning the total number of compressed bytes
- * in the file.  Returns -1 if file could not be compressed. */
+ * in the file.  Returns -1 if file could not be compressed.  The data is
+ * compressed with zlib instead when the configuration asks for it.
+ * The file is written anew rather than in place, since module files in
+ * a sandbox are hard links to those of the active store. */
 static ssize_t bzip(semanage_handle_t *sh, const char *filename, char *data,
 			size_t num_bytes)
 {
@@ -417,6 +468,8 @@ static ssize_t bzip(semanage_handle_t *sh, const char *filename, char *data,
 	size_t len = 0;
 	FILE *f;
 
+	if (unlink(filename) < 0 && errno != ENOENT)
+		return -1;
 	if ((f = fopen(filename, "wb")) == NULL) {
 		return -1;
 	}
@@ -430,6 +483,9 @@ static ssize_t bzip(semanage_handle_t *sh, const char *filename, char *data,
 		return num_bytes;
 	}
 
+	if (sh->conf->compression == SEMANAGE_COMPRESS_ZLIB)
+		return gzip_data(f, data, num_bytes);
+
 	b = BZ2_bzWriteOpen( &bzerror, f, sh->conf->bzip_blocksize, 0, 0);
 	if (bzerror != BZ_OK) {
 		BZ2_bzWriteClose ( &bzerror, b, 1, 0, 0 );
@@ -460,9 +516,63 @@ static ssize_t bzip(semanage_handle_t *sh, const char *filename, char *data,
 
 #define BZ2_MAGICSTR "BZh"
 #define BZ2_MAGICLEN (sizeof(BZ2_MAGICSTR)-1)
+#define GZIP_MAGICSTR "\x1f\x8b"
+#define GZIP_MAGICLEN (sizeof(GZIP_MAGICSTR)-1)
+
+/* Decompress the gzip file f to '*data', returning the total number of
+ * uncompressed bytes.  Returns -1 if the file could not be decompressed. */
+static ssize_t gunzip(FILE *f, char **data)
+{
+	z_stream zs;
+	unsigned char in[1<<16];
+	size_t size = 1<<18, n;
+	char *uncompress, *tmp;
+	int zerror = Z_OK;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 16) != Z_OK)
+		return -1;
+	if ((uncompress = malloc(size)) == NULL) {
+		inflateEnd(&zs);
+		return -1;
+	}
+
+	while (zerror != Z_STREAM_END) {
+		if (zs.avail_in == 0) {
+			n = fread(in, 1, sizeof(in), f);
+			if (n == 0)
+				break;	/* truncated */
+			zs.next_in = in;
+			zs.avail_in = n;
+		}
+		if (zs.total_out == size) {
+			tmp = realloc(uncompress, size * 2);
+			if (tmp == NULL)
+				break;
+			uncompress = tmp;
+			size *= 2;
+		}
+		zs.next_out = (unsigned char *)uncompress + zs.total_out;
+		zs.avail_out = size - zs.total_out > UINT_MAX ?
+		    UINT_MAX : size - zs.total_out;
+		zerror = inflate(&zs, Z_NO_FLUSH);
+		if (zerror != Z_OK && zerror != Z_STREAM_END)
+			break;
+	}
+	inflateEnd(&zs);
+
+	if (zerror != Z_STREAM_END) {
+		free(uncompress);
+		return -1;
+	}
+	*data = uncompress;
+	return zs.total_out;
+}
 
 /* bunzip() a file to '*data', returning the total number of uncompressed bytes
- * in the file.  Returns -1 if file could not be decompressed. */
+ * in the file.  Returns -1 if file could not be decompressed.  Files
+ * compressed with zlib are recognized by their magic and decompressed as
+ * well, whatever the configured compression. */
 ssize_t bunzip(semanage_handle_t *sh, FILE *f, char **data)
 {
 	BZFILE* b;
@@ -472,6 +582,16 @@ ssize_t bunzip(semanage_handle_t *sh, FILE *f, char **data)
 	int     bzerror;
 	size_t  total=0;
 
+	bzerror = fread(buf, 1, GZIP_MAGICLEN, f);
+	rewind(f);
+	if (bzerror == GZIP_MAGICLEN &&
+	    memcmp(buf, GZIP_MAGICSTR, GZIP_MAGICLEN) == 0) {
+		ssize_t ret = gunzip(f, data);
+		if (ret < 0)
+			rewind(f);
+		return ret;
+	}
+
 	if (!sh->conf->bzip_blocksize) {
 		bzerror = fread(buf, 1, BZ2_MAGICLEN, f);
 		rewind(f);
@@ -553,6 +673,8 @@ static int dupfile( const char *dest, int src_fd) {
 
 	if (lseek(src_fd, 0, SEEK_SET)  == -1 ) return -1;
 
+	/* written anew, like bzip() */
+	if (unlink(dest) < 0 && errno != ENOENT) return -1;
 	if ((dest_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC,
 			   S_IRUSR | S_IWUSR)) == -1) {
 		return -1;
@@ -672,6 +794,82 @@ static int semanage_direct_update_seuser(semanage_handle_t * sh, sepol_module_pa
 	return retval;
 }
 
+/* Wall-clock time spent in each phase of a commit, collected only when
+ * commit-profile is set in semanage.conf.  Phases that are entered more
+ * than once accumulate into a single entry. */
+#define COMMIT_PROFILE_MAX 24
+
+struct commit_profile {
+	struct timespec start, last;
+	unsigned int nphases;
+	const char *phase[COMMIT_PROFILE_MAX];
+	double msecs[COMMIT_PROFILE_MAX];
+};
+
+static double timespec_msecs(const struct timespec *from,
+			     const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000.0 +
+	    (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+static void commit_profile_start(semanage_handle_t * sh,
+				 struct commit_profile *prof)
+{
+	prof->nphases = 0;
+	if (sh->conf->commit_profile) {
+		clock_gettime(CLOCK_MONOTONIC, &prof->start);
+		prof->last = prof->start;
+	}
+}
+
+/* Charge the time since the previous mark to 'phase'. */
+static void commit_profile_mark(semanage_handle_t * sh,
+				struct commit_profile *prof, const char *phase)
+{
+	struct timespec now;
+	unsigned int i;
+
+	if (!sh->conf->commit_profile)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < prof->nphases; i++)
+		if (prof->phase[i] == phase)
+			break;
+	if (i == prof->nphases) {
+		if (i == COMMIT_PROFILE_MAX)
+			return;
+		prof->phase[i] = phase;
+		prof->msecs[i] = 0;
+		prof->nphases++;
+	}
+	prof->msecs[i] += timespec_msecs(&prof->last, &now);
+	prof->last = now;
+}
+
+static void commit_profile_report(semanage_handle_t * sh,
+				  struct commit_profile *prof, int retval)
+{
+	struct timespec now;
+	double total;
+	unsigned int i;
+
+	if (!sh->conf->commit_profile)
+		return;
+
+	commit_profile_mark(sh, prof, "cleanup");
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	total = timespec_msecs(&prof->start, &now);
+
+	for (i = 0; i < prof->nphases; i++)
+		INFO(sh, "commit profile: %-16s %10.2f ms %5.1f%%",
+		     prof->phase[i], prof->msecs[i],
+		     total > 0 ? prof->msecs[i] * 100.0 / total : 0.0);
+	INFO(sh, "commit profile: %-16s %10.2f ms (%s)", "total", total,
+	     retval < 0 ? "failed" : "succeeded");
+}
+
 /********************* direct API functions ********************/
 
 /* Commits all changes in sandbox to the actual kernel policy.
@@ -684,8 +882,11 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 	size_t sorted_fc_buffer_len = 0, sorted_nc_buffer_len = 0;
 	const char *linked_filename = NULL, *ofilename = NULL, *path;
 	sepol_module_package_t *base = NULL;
-	int retval = -1, num_modfiles = 0, i;
+	int retval = -1, num_modfiles = 0, i, cached = 0;
 	sepol_policydb_t *out = NULL;
+	char *fingerprint = NULL;
+	semanage_verify_t *linked_verify = NULL, *kernel_verify = NULL;
+	struct commit_profile prof;
 
 	/* Declare some variables */
 	int modified = 0, fcontexts_modified, ports_modified,
@@ -707,6 +908,8 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 	dbase_config_t *pfcontexts = semanage_fcontext_dbase_policy(sh);
 	dbase_config_t *seusers = semanage_seuser_dbase_local(sh);
 
+	commit_profile_start(sh, &prof);
+
 	/* Create or remove the disable_dontaudit flag file. */
 	path = semanage_path(SEMANAGE_TMP, SEMANAGE_DISABLE_DONTAUDIT);
 	if (access(path, F_OK) == 0)
@@ -781,124 +984,163 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 	modified |= dontaudit_modified;
 	modified |= preserve_tunables_modified;
 
+	commit_profile_mark(sh, &prof, "flush");
+
 	/* If there were policy changes, or explicitly requested, rebuild the policy */
 	if (sh->do_rebuild || modified) {
 
 		/* =================== Module expansion =============== */
 
-		/* link all modules in the sandbox to the base module */
-		retval = semanage_get_modules_names(sh, &mod_filenames, &num_modfiles);
-		if (retval < 0)
-			goto cleanup;
-		retval = semanage_verify_modules(sh, mod_filenames, num_modfiles);
+		/* An explicit rebuild always relinks; otherwise reuse the
+		 * policy expanded by an earlier commit when neither the
+		 * modules nor the expansion settings have changed since.
+		 * The file contexts, seusers and users_extra in the
+		 * sandbox were produced from those same modules. */
+		retval = semanage_expanded_fingerprint(sh, &fingerprint);
 		if (retval < 0)
 			goto cleanup;
-		retval = semanage_link_sandbox(sh, &base);
-		if (retval < 0)
-			goto cleanup;
-
-		/* write the linked base if we want to save or we have a
-		 * verification program that wants it. */
-		linked_filename = semanage_path(SEMANAGE_TMP, SEMANAGE_LINKED);
-		if (linked_filename == NULL) {
-			retval = -1;
-			goto cleanup;
+		if (!sh->do_rebuild) {
+			retval = semanage_read_expanded(sh, fingerprint, &out);
+			if (retval < 0)
+				goto cleanup;
+			cached = retval;
 		}
-		if (sh->conf->save_linked || sh->conf->linked_prog) {
-			retval = semanage_write_module(sh, linked_filename, base);
+		commit_profile_mark(sh, &prof, "expanded cache");
+
+		if (!cached) {
+			/* link all modules in the sandbox to the base module */
+			retval = semanage_get_modules_names(sh, &mod_filenames, &num_modfiles);
 			if (retval < 0)
 				goto cleanup;
-			retval = semanage_verify_linked(sh);
+			retval = semanage_verify_modules(sh, mod_filenames, num_modfiles);
 			if (retval < 0)
 				goto cleanup;
-			/* remove the linked policy if we only wrote it for the
-			 * verification program. */
-			if (!sh->conf->save_linked) {
-				retval = unlink(linked_filename);
-				if (retval < 0) {
-					ERR(sh, "could not remove linked base %s",
-					    linked_filename);
+			retval = semanage_link_sandbox(sh, &base);
+			if (retval < 0)
+				goto cleanup;
+			commit_profile_mark(sh, &prof, "link");
+
+			/* write the linked base if we want to save or we have a
+			 * verification program that wants it. */
+			linked_filename = semanage_path(SEMANAGE_TMP, SEMANAGE_LINKED);
+			if (linked_filename == NULL) {
+				retval = -1;
+				goto cleanup;
+			}
+			if (sh->conf->save_linked || sh->conf->linked_prog) {
+				retval = semanage_write_module(sh, linked_filename, base);
+				if (retval < 0)
 					goto cleanup;
-				}
+				/* the verifiers run while the file contexts
+				 * are sorted and the policy is expanded */
+				retval = semanage_verify_linked_start(sh, &linked_verify);
+				if (retval < 0)
+					goto cleanup;
+			} else {
+				/* Try to delete the linked copy - this is needed if
+				 * the save_link option has changed to prevent the
+				 * old linked copy from being copied forever. No error
+				 * checking is done because this is likely to fail because
+				 * the file does not exist - which is not an error. */
+				unlink(linked_filename);
+				errno = 0;
 			}
-		} else {
-			/* Try to delete the linked copy - this is needed if
-			 * the save_link option has changed to prevent the
-			 * old linked copy from being copied forever. No error
-			 * checking is done because this is likely to fail because
-			 * the file does not exist - which is not an error. */
-			unlink(linked_filename);
-			errno = 0;
-		}
+			commit_profile_mark(sh, &prof, "write linked");
 
-		/* ==================== File-backed ================== */
+			/* ==================== File-backed ================== */
 
-		/* File Contexts */
-		/* Sort the file contexts. */
-		retval = semanage_fc_sort(sh, sepol_module_package_get_file_contexts(base),
-					  sepol_module_package_get_file_contexts_len(base),
-					  &sorted_fc_buffer, &sorted_fc_buffer_len);
-		if (retval < 0)
-			goto cleanup;
+			/* File Contexts */
+			/* Sort the file contexts. */
+			retval = semanage_fc_sort(sh, sepol_module_package_get_file_contexts(base),
+						  sepol_module_package_get_file_contexts_len(base),
+						  &sorted_fc_buffer, &sorted_fc_buffer_len);
+			if (retval < 0)
+				goto cleanup;
 
-		/* Write the contexts (including template contexts) to a single file.  
-		 * The buffer returned by the sort function has a trailing \0 character,
-		 * which we do NOT want to write out to disk, so we pass sorted_fc_buffer_len-1. */
-		ofilename = semanage_path(SEMANAGE_TMP, SEMANAGE_FC_TMPL);
-		if (ofilename == NULL) {
-			retval = -1;
-			goto cleanup;
-		}
-		retval = write_file(sh, ofilename, sorted_fc_buffer,
-				    sorted_fc_buffer_len - 1);
-		if (retval < 0)
-			goto cleanup;
+			/* Write the contexts (including template contexts) to a single file.  
+			 * The buffer returned by the sort function has a trailing \0 character,
+			 * which we do NOT want to write out to disk, so we pass sorted_fc_buffer_len-1. */
+			ofilename = semanage_path(SEMANAGE_TMP, SEMANAGE_FC_TMPL);
+			if (ofilename == NULL) {
+				retval = -1;
+				goto cleanup;
+			}
+			retval = write_file(sh, ofilename, sorted_fc_buffer,
+					    sorted_fc_buffer_len - 1);
+			if (retval < 0)
+				goto cleanup;
 
-		/* Split complete and template file contexts into their separate files. */
-		retval = semanage_split_fc(sh);
-		if (retval < 0)
-			goto cleanup;
+			/* Split complete and template file contexts into their separate files. */
+			retval = semanage_split_fc(sh);
+			if (retval < 0)
+				goto cleanup;
 
-		pfcontexts->dtable->drop_cache(pfcontexts->dbase);
+			pfcontexts->dtable->drop_cache(pfcontexts->dbase);
+			commit_profile_mark(sh, &prof, "file contexts");
 
-		retval = semanage_direct_update_seuser(sh, base );
-		if (retval < 0)
-			goto cleanup;
+			retval = semanage_direct_update_seuser(sh, base );
+			if (retval < 0)
+				goto cleanup;
 
-		retval = semanage_direct_update_user_extra(sh, base );
-		if (retval < 0)
-			goto cleanup;
+			retval = semanage_direct_update_user_extra(sh, base );
+			if (retval < 0)
+				goto cleanup;
+			commit_profile_mark(sh, &prof, "seusers");
 
-		/* Netfilter Contexts */
-		/* Sort the netfilter contexts. */
-		retval = semanage_nc_sort
-		    (sh, sepol_module_package_get_netfilter_contexts(base),
-		     sepol_module_package_get_netfilter_contexts_len(base),
-		     &sorted_nc_buffer, &sorted_nc_buffer_len);
+			/* Netfilter Contexts */
+			/* Sort the netfilter contexts. */
+			retval = semanage_nc_sort
+			    (sh, sepol_module_package_get_netfilter_contexts(base),
+			     sepol_module_package_get_netfilter_contexts_len(base),
+			     &sorted_nc_buffer, &sorted_nc_buffer_len);
 
-		if (retval < 0)
-			goto cleanup;
+			if (retval < 0)
+				goto cleanup;
 
-		/* Write the contexts to a single file.  The buffer returned by
-		 * the sort function has a trailing \0 character, which we do
-		 * NOT want to write out to disk, so we pass sorted_fc_buffer_len-1. */
-		ofilename = semanage_path(SEMANAGE_TMP, SEMANAGE_NC);
-		retval = write_file
-		    (sh, ofilename, sorted_nc_buffer, sorted_nc_buffer_len - 1);
+			/* Write the contexts to a single file.  The buffer returned by
+			 * the sort function has a trailing \0 character, which we do
+			 * NOT want to write out to disk, so we pass sorted_fc_buffer_len-1. */
+			ofilename = semanage_path(SEMANAGE_TMP, SEMANAGE_NC);
+			retval = write_file
+			    (sh, ofilename, sorted_nc_buffer, sorted_nc_buffer_len - 1);
 
-		if (retval < 0)
-			goto cleanup;
+			if (retval < 0)
+				goto cleanup;
+			commit_profile_mark(sh, &prof, "netfilter");
 
-		/* ==================== Policydb-backed ================ */
+			/* ==================== Policydb-backed ================ */
 
-		/* Create new policy object, then attach to policy databases
-		 * that work with a policydb */
-		retval = semanage_expand_sandbox(sh, base, &out);
-		if (retval < 0)
-			goto cleanup;
+			/* Create new policy object, then attach to policy databases
+			 * that work with a policydb */
+			retval = semanage_expand_sandbox(sh, base, &out);
+			if (retval < 0)
+				goto cleanup;
+			commit_profile_mark(sh, &prof, "expand");
 	
-		sepol_module_package_free(base);
-		base = NULL;
+			sepol_module_package_free(base);
+			base = NULL;
+
+			retval = semanage_verify_finish(sh, linked_verify);
+			linked_verify = NULL;
+			if (retval < 0)
+				goto cleanup;
+			/* remove the linked policy if we only wrote it for the
+			 * verification program. */
+			if (sh->conf->linked_prog && !sh->conf->save_linked) {
+				retval = unlink(linked_filename);
+				if (retval < 0) {
+					ERR(sh, "could not remove linked base %s",
+					    linked_filename);
+					goto cleanup;
+				}
+			}
+			commit_profile_mark(sh, &prof, "verify linked");
+
+			retval = semanage_write_expanded(sh, fingerprint, out);
+			if (retval < 0)
+				goto cleanup;
+			commit_profile_mark(sh, &prof, "expanded cache");
+		}
 
 		dbase_policydb_attach((dbase_policydb_t *) pusers_base->dbase,
 				      out);
@@ -912,12 +1154,15 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 		retval = semanage_base_merge_components(sh);
 		if (retval < 0)
 			goto cleanup;
+		commit_profile_mark(sh, &prof, "merge");
 
 		retval = semanage_write_policydb(sh, out);
 		if (retval < 0)
 			goto cleanup;
+		commit_profile_mark(sh, &prof, "write policy");
 
-		retval = semanage_verify_kernel(sh);
+		/* collected before the sandbox is installed */
+		retval = semanage_verify_kernel_start(sh, &kernel_verify);
 		if (retval < 0)
 			goto cleanup;
 	} else {
@@ -928,6 +1173,7 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 		retval = semanage_read_policydb(sh, out);
 		if (retval < 0)
 			goto cleanup;
+		commit_profile_mark(sh, &prof, "read policy");
 		
 		if (seusers_modified || users_extra_modified) {
 			retval = semanage_link_base(sh, &base);
@@ -948,13 +1194,23 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 
 			sepol_module_package_free(base);
 			base = NULL;
+			commit_profile_mark(sh, &prof, "seusers");
 		}
 
 		retval = semanage_base_merge_components(sh);
 		if (retval < 0)
 		  goto cleanup;
+		commit_profile_mark(sh, &prof, "merge");
+
+	}
 
+	if (sh->do_rebuild || modified) {
+		retval = module_index_update(sh);
+		if (retval < 0)
+			goto cleanup;
+		commit_profile_mark(sh, &prof, "module index");
 	}
+
 	/* ======= Post-process: Validate non-policydb components ===== */
 
 	/* Validate local modifications to file contexts.
@@ -981,12 +1237,15 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 			goto cleanup;
 	}
 
+	commit_profile_mark(sh, &prof, "validate");
+
 	/* ================== Write non-policydb components ========= */
 
 	/* Commit changes to components */
 	retval = semanage_commit_components(sh);
 	if (retval < 0)
 		goto cleanup;
+	commit_profile_mark(sh, &prof, "components");
 
 	/* run genhomedircon if its enabled, this should be the last operation
 	 * which requires the out policydb */
@@ -1001,18 +1260,38 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 		WARN(sh, "WARNING: genhomedircon is disabled. \
                                See /etc/selinux/semanage.conf if you need to enable it.");
         }
+	commit_profile_mark(sh, &prof, "genhomedircon");
+
+	retval = semanage_verify_finish(sh, kernel_verify);
+	kernel_verify = NULL;
+	if (retval < 0)
+		goto cleanup;
+	commit_profile_mark(sh, &prof, "verify kernel");
 
 	/* free out, if we don't free it before calling semanage_install_sandbox 
-	 * then fork() may fail on low memory machines */
-	sepol_policydb_free(out);
-	out = NULL;
+	 * then fork() may fail on low memory machines.  When no programs
+	 * are run, out is kept for the handle's queries after the commit. */
+	if (sh->conf->load_policy || sh->conf->setfiles ||
+	    sh->conf->sefcontext_compile) {
+		sepol_policydb_free(out);
+		out = NULL;
+	}
 
 	if (sh->do_rebuild || modified || 
 	    seusers_modified || fcontexts_modified || users_extra_modified) {
 		retval = semanage_install_sandbox(sh);
+		if (retval > 0 && out &&
+		    dbase_policydb_keep_file(sh, (dbase_policydb_t *)
+					     pbools->dbase, retval, out) == 0)
+			out = NULL;
+		commit_profile_mark(sh, &prof, "install");
 	}
 
       cleanup:
+	/* a failed commit still waits for the verifiers it started */
+	semanage_verify_finish(sh, linked_verify);
+	semanage_verify_finish(sh, kernel_verify);
+
 	for (i = 0; mod_filenames != NULL && i < num_modfiles; i++) {
 		free(mod_filenames[i]);
 	}
@@ -1027,6 +1306,7 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 	}
 
 	free(mod_filenames);
+	free(fingerprint);
 	sepol_policydb_free(out);
 	semanage_release_trans_lock(sh);
 
@@ -1035,8 +1315,10 @@ static int semanage_direct_commit(semanage_handle_t * sh)
 
 	/* regardless if the commit was successful or not, remove the
 	   sandbox if it is still there */
+	semanage_modules_changed(sh);
 	semanage_remove_directory(semanage_path
 				  (SEMANAGE_TMP, SEMANAGE_TOPLEVEL));
+	commit_profile_report(sh, &prof, retval);
 	return retval;
 }
 
@@ -1057,6 +1339,7 @@ static int semanage_direct_install(semanage_handle_t * sh,
 					   &filename)) != 0) {
 		goto cleanup;
 	}
+	semanage_modules_changed(sh);
 	if (bzip(sh, filename, data, data_len) <= 0) {
 		ERR(sh, "Error while writing to %s.", filename);
 		retval = -3;
@@ -1183,6 +1466,7 @@ static int semanage_direct_upgrade(semanage_handle_t * sh,
 						 data, data_len, 
 						 &filename);
 	if (retval == 0) {
+		semanage_modules_changed(sh);
 		if (bzip(sh, filename, data, data_len) <= 0) {
 			ERR(sh, "Error while writing to %s.", filename);
 			retval = -3;
@@ -1306,71 +1590,302 @@ static int semanage_direct_install_base_file(semanage_handle_t * sh,
 	return retval;
 }
 
-static int get_module_name(semanage_handle_t * sh, char *modulefile, char **module_name) {
-	FILE *fp = NULL;
-	int retval = -1;
-	char *data = NULL;
-	char *version = NULL;
-	ssize_t size;
+/* The module index records, for each module file in the store, what
+ * sepol_module_package_info() found in it, so that listing modules or
+ * finding one by name does not decompress every module.  An entry is
+ * used only while its file has the size and modification time it had
+ * when it was read; other files are read as before.  Commits that
+ * change modules rewrite the index in the sandbox.
+ *
+ * Each line holds, separated by spaces: the base name of the file,
+ * its size, its modification time in seconds and nanoseconds, the
+ * FNV-1a hash of its contents, the package type, the module name and
+ * the module version.
+ */
+typedef struct module_index_entry {
+	char *file;
+	off_t size;
+	struct timespec mtime;
+	uint64_t hash;
 	int type;
+	char *name;
+	char *version;
+} module_index_entry_t;
+
+typedef struct module_index {
+	module_index_entry_t *entries;
+	int num;
+} module_index_t;
+
+static void module_index_entry_destroy(module_index_entry_t * e)
+{
+	free(e->file);
+	free(e->name);
+	free(e->version);
+}
+
+static void module_index_destroy(module_index_t * index)
+{
+	int i;
+
+	for (i = 0; i < index->num; i++)
+		module_index_entry_destroy(&index->entries[i]);
+	free(index->entries);
+	index->entries = NULL;
+	index->num = 0;
+}
+
+static const char *module_index_path(semanage_handle_t * sh)
+{
+	return semanage_path(sh->is_in_transaction ? SEMANAGE_TMP :
+			     SEMANAGE_ACTIVE, SEMANAGE_MODULES_INDEX);
+}
+
+/* Reads the index of the store the handle works on.  A missing or
+ * damaged index reads as empty.  Returns 0 on success, -1 if out of
+ * memory. */
+static int module_index_read(semanage_handle_t * sh, module_index_t * index)
+{
+	module_index_entry_t e, *entries;
+	long long size, sec;
+	unsigned long long hash;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int retval = 0, size_alloc = 0;
+
+	index->entries = NULL;
+	index->num = 0;
+	if ((fp = fopen(module_index_path(sh), "r")) == NULL) {
+		errno = 0;
+		return 0;
+	}
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+	while (getline(&line, &len, fp) > 0) {
+		memset(&e, 0, sizeof(e));
+		if (sscanf(line, "%ms %lld %lld %ld %llx %d %ms %ms",
+			   &e.file, &size, &sec, &e.mtime.tv_nsec, &hash,
+			   &e.type, &e.name, &e.version) != 8) {
+			module_index_entry_destroy(&e);
+			continue;
+		}
+		e.size = size;
+		e.mtime.tv_sec = sec;
+		e.hash = hash;
+		if (index->num == size_alloc) {
+			size_alloc = size_alloc ? size_alloc * 2 : 64;
+			entries = realloc(index->entries,
+					  size_alloc * sizeof(*entries));
+			if (entries == NULL) {
+				ERR(sh, "Out of memory!");
+				module_index_entry_destroy(&e);
+				module_index_destroy(index);
+				retval = -1;
+				break;
+			}
+			index->entries = entries;
+		}
+		index->entries[index->num++] = e;
+	}
+	free(line);
+	fclose(fp);
+	return retval;
+}
+
+/* Finds the entry for 'file' that still describes it.  Entries are
+ * kept in the order the module directory is scanned in, so entry
+ * 'hint' is tried first. */
+static module_index_entry_t *module_index_find(module_index_t * index,
+					       const char *file,
+					       const struct stat *sb, int hint)
+{
+	const char *base = strrchr(file, '/');
+	module_index_entry_t *e;
+	int i;
+
+	base = base ? base + 1 : file;
+	for (i = 0; i < index->num; i++) {
+		e = &index->entries[(hint + i) % index->num];
+		if (strcmp(e->file, base) != 0)
+			continue;
+		if (e->size == sb->st_size &&
+		    e->mtime.tv_sec == sb->st_mtim.tv_sec &&
+		    e->mtime.tv_nsec == sb->st_mtim.tv_nsec)
+			return e;
+		return NULL;
+	}
+	return NULL;
+}
+
+/* Fills 'e' for the module file 'file', from the index when it has a
+ * current entry and by reading the file otherwise; 'index' may be
+ * NULL.  Returns 0 on success, -1 if the file could not be read or is
+ * not a module package. */
+static int module_file_info(semanage_handle_t * sh, module_index_t * index,
+			    const char *file, int hint,
+			    module_index_entry_t * e)
+{
 	struct sepol_policy_file *pf = NULL;
+	module_index_entry_t *cached;
+	const char *base = strrchr(file, '/');
+	char buf[BUFSIZ], *data = NULL;
+	struct stat sb;
+	ssize_t size;
+	size_t n;
+	FILE *fp = NULL;
+	int retval = -1;
 
-	if (sepol_policy_file_create(&pf)) {
+	memset(e, 0, sizeof(*e));
+	if (stat(file, &sb) < 0)
+		return -1;
+	if (index && (cached = module_index_find(index, file, &sb, hint))) {
+		e->file = strdup(cached->file);
+		e->name = strdup(cached->name);
+		e->version = strdup(cached->version);
+		if (!e->file || !e->name || !e->version) {
+			ERR(sh, "Out of memory!");
+			goto cleanup;
+		}
+		e->size = cached->size;
+		e->mtime = cached->mtime;
+		e->hash = cached->hash;
+		e->type = cached->type;
+		return 0;
+	}
+
+	if ((e->file = strdup(base ? base + 1 : file)) == NULL) {
 		ERR(sh, "Out of memory!");
 		goto cleanup;
 	}
-	sepol_policy_file_set_handle(pf, sh->sepolh);
+	e->size = sb.st_size;
+	e->mtime = sb.st_mtim;
+	e->hash = FNV1A_64_INIT;
+
+	if ((fp = fopen(file, "rb")) == NULL)
+		goto cleanup;
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		e->hash = semanage_fnv1a(e->hash, buf, n);
+	if (ferror(fp))
+		goto cleanup;
+	rewind(fp);
 
-	if ((fp = fopen(modulefile, "rb")) == NULL) {
+	if (sepol_policy_file_create(&pf)) {
+		ERR(sh, "Out of memory!");
 		goto cleanup;
 	}
+	sepol_policy_file_set_handle(pf, sh->sepolh);
 	if ((size = bunzip(sh, fp, &data)) > 0) {
 		sepol_policy_file_set_mem(pf, data, size);
 	} else {
 		rewind(fp);
-		__fsetlocking(fp, FSETLOCKING_BYCALLER);
 		sepol_policy_file_set_fp(pf, fp);
 	}
-	retval = sepol_module_package_info(pf, &type, module_name, &version);
+	if (sepol_module_package_info(pf, &e->type, &e->name, &e->version))
+		goto cleanup;
+	retval = 0;
 
-cleanup:
+      cleanup:
 	sepol_policy_file_free(pf);
 	if (fp)
 		fclose(fp);
 	free(data);
-	free(version);
+	if (retval < 0)
+		module_index_entry_destroy(e);
+	return retval;
+}
+
+/* Rewrites the index of the sandbox for the modules it now holds.
+ * Returns 0 on success, -1 on error. */
+static int module_index_update(semanage_handle_t * sh)
+{
+	module_index_t index;
+	module_index_entry_t e;
+	char **module_filenames = NULL;
+	const char *path = semanage_path(SEMANAGE_TMP, SEMANAGE_MODULES_INDEX);
+	int i, num_mod_files = 0, retval = -1;
+	FILE *fp = NULL;
+
+	if (module_index_read(sh, &index) < 0)
+		return -1;
+	if (semanage_get_modules_names(sh, &module_filenames,
+				       &num_mod_files) == -1)
+		goto cleanup;
+	if ((fp = fopen(path, "w")) == NULL) {
+		ERR(sh, "Could not open %s for writing.", path);
+		goto cleanup;
+	}
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+	for (i = 0; i < num_mod_files; i++) {
+		if (module_file_info(sh, &index, module_filenames[i], i, &e) < 0)
+			continue;
+		/* the fields are separated by spaces; leave out a file
+		 * with names that cannot be written that way */
+		if (!strpbrk(e.file, " \t\n") && !strpbrk(e.name, " \t\n") &&
+		    !strpbrk(e.version, " \t\n"))
+			fprintf(fp, "%s %lld %lld %ld %016llx %d %s %s\n",
+				e.file, (long long)e.size,
+				(long long)e.mtime.tv_sec, e.mtime.tv_nsec,
+				(unsigned long long)e.hash, e.type, e.name,
+				e.version);
+		module_index_entry_destroy(&e);
+	}
+	if (ferror(fp)) {
+		ERR(sh, "Could not write %s.", path);
+		goto cleanup;
+	}
+	retval = 0;
+
+      cleanup:
+	if (fp && fclose(fp) != 0 && retval == 0) {
+		ERR(sh, "Could not write %s.", path);
+		retval = -1;
+	}
+	/* a partial index would only cost reads, but do not leave one */
+	if (retval < 0)
+		unlink(path);
+	for (i = 0; module_filenames != NULL && i < num_mod_files; i++) {
+		free(module_filenames[i]);
+	}
+	free(module_filenames);
+	module_index_destroy(&index);
 	return retval;
 }
 
 static int get_module_file_by_name(semanage_handle_t * sh, const char *module_name, char **module_file) {
 	int i, retval = -1;
 	char **module_filenames = NULL;
-	char *name = NULL;
+	module_index_t index;
+	module_index_entry_t e;
 	int num_mod_files;
+	if (module_index_read(sh, &index) < 0)
+		return -1;
 	if (semanage_get_modules_names(sh, &module_filenames, &num_mod_files) ==
 	    -1) {
+		module_index_destroy(&index);
 		return -1;
 	}
 	for (i = 0; i < num_mod_files; i++) {
-		int rc = get_module_name(sh, module_filenames[i], &name);
+		int rc = module_file_info(sh, &index, module_filenames[i], i, &e);
 		if (rc < 0) 
 			continue;
-		if (strcmp(module_name, name) == 0) {
+		rc = strcmp(module_name, e.name);
+		module_index_entry_destroy(&e);
+		if (rc == 0) {
 			*module_file = strdup(module_filenames[i]);
 			if (*module_file) 
 				retval = 0;
 			goto cleanup;
 		}
-		free(name); name = NULL;
 	}
 	ERR(sh, "Module %s was not found.", module_name);
 	retval = -2;		/* module not found */
       cleanup:
-	free(name);
 	for (i = 0; module_filenames != NULL && i < num_mod_files; i++) {
 		free(module_filenames[i]);
 	}
 	free(module_filenames);
+	module_index_destroy(&index);
 	return retval;
 }
 
@@ -1382,6 +1897,7 @@ static int semanage_direct_enable(semanage_handle_t * sh, char *module_name)
 	int retval = get_module_file_by_name(sh, module_name, &module_filename);
 	if (retval <  0)
 		return -1;		/* module not found */
+	semanage_modules_changed(sh);
 	retval = semanage_enable_module(module_filename);
 	if (retval < 0) {
 		ERR(sh, "Could not enable module file %s.",
@@ -1399,6 +1915,7 @@ static int semanage_direct_disable(semanage_handle_t * sh, char *module_name)
 	char *module_filename = NULL;
 	int retval = get_module_file_by_name(sh, module_name, &module_filename);	if (retval <  0)
 		return -1;		/* module not found */
+	semanage_modules_changed(sh);
 	retval = semanage_disable_module(module_filename);
 	if (retval < 0) {
 		ERR(sh, "Could not disable module file %s.",
@@ -1417,6 +1934,7 @@ static int semanage_direct_remove(semanage_handle_t * sh, char *module_name)
 	int retval = get_module_file_by_name(sh, module_name, &module_filename);
 	if (retval <  0)
 		return -1;		/* module not found */
+	semanage_modules_changed(sh);
 	(void) semanage_enable_module(module_filename); /* Don't care if this fails */
 	retval = unlink(module_filename);
 	if (retval < 0) {
@@ -1439,7 +1957,7 @@ static int semanage_direct_list(semanage_handle_t * sh,
 				semanage_module_info_t ** modinfo,
 				int *num_modules)
 {
-	struct sepol_policy_file *pf = NULL;
+	module_index_t index = { NULL, 0 };
 	int i, retval = -1;
 	char **module_filenames = NULL;
 	int num_mod_files;
@@ -1449,7 +1967,7 @@ static int semanage_direct_list(semanage_handle_t * sh,
 	/* get the read lock when reading from the active
 	   (non-transaction) directory */
 	if (!sh->is_in_transaction)
-		if (semanage_get_active_lock(sh) < 0)
+		if (semanage_get_active_shared_lock(sh) < 0)
 			return -1;
 
 	if (semanage_get_modules_names(sh, &module_filenames, &num_mod_files) ==
@@ -1461,11 +1979,8 @@ static int semanage_direct_list(semanage_handle_t * sh,
 		goto cleanup;
 	}
 
-	if (sepol_policy_file_create(&pf)) {
-		ERR(sh, "Out of memory!");
+	if (module_index_read(sh, &index) < 0)
 		goto cleanup;
-	}
-	sepol_policy_file_set_handle(pf, sh->sepolh);
 
 	if ((*modinfo = calloc(num_mod_files, sizeof(**modinfo))) == NULL) {
 		ERR(sh, "Out of memory!");
@@ -1473,49 +1988,27 @@ static int semanage_direct_list(semanage_handle_t * sh,
 	}
 
 	for (i = 0; i < num_mod_files; i++) {
-		FILE *fp;
-		char *name = NULL, *version = NULL;
-		int type;
-		if ((fp = fopen(module_filenames[i], "rb")) == NULL) {
-			/* could not open this module file, so don't
+		module_index_entry_t e;
+		if (module_file_info(sh, &index, module_filenames[i], i, &e) < 0) {
+			/* could not read this module file, so don't
 			 * report it */
 			continue;
 		}
-		ssize_t size;
-		char *data = NULL;
-		int enabled = semanage_module_enabled(module_filenames[i]);
-
-		if ((size = bunzip(sh, fp, &data)) > 0) {
-			sepol_policy_file_set_mem(pf, data, size);
-		} else {
-			rewind(fp);
-			__fsetlocking(fp, FSETLOCKING_BYCALLER);
-			sepol_policy_file_set_fp(pf, fp);
-		}
-		if (sepol_module_package_info(pf, &type, &name, &version)) {
-			fclose(fp);
-			free(data);
-			free(name);
-			free(version);
-			continue;
-		}
-		fclose(fp);
-		free(data);
-		if (type == SEPOL_POLICY_MOD) {
-			(*modinfo)[*num_modules].name = name;
-			(*modinfo)[*num_modules].version = version;
-			(*modinfo)[*num_modules].enabled = enabled;
+		if (e.type == SEPOL_POLICY_MOD) {
+			(*modinfo)[*num_modules].name = e.name;
+			(*modinfo)[*num_modules].version = e.version;
+			(*modinfo)[*num_modules].enabled =
+			    semanage_module_is_enabled(sh, module_filenames[i]);
 			(*num_modules)++;
-		} else {
-			/* file was not a module, so don't report it */
-			free(name);
-			free(version);
+			e.name = e.version = NULL;
 		}
+		/* otherwise the file was not a module, so don't report it */
+		module_index_entry_destroy(&e);
 	}
 	retval = semanage_direct_get_serial(sh);
 
       cleanup:
-	sepol_policy_file_free(pf);
+	module_index_destroy(&index);
 	for (i = 0; module_filenames != NULL && i < num_mod_files; i++) {
 		free(module_filenames[i]);
 	}
@@ -22,13 +22,21 @@
 
 /* Circular dependency */
 struct semanage_handle;
+struct dbase_policydb_file;
 
 /* Direct component of handle */
 struct semanage_direct_handle {
 
 	/* Locking */
 	int activelock_file_fd;
+	int activelock_shared;	/* activelock_file_fd is only LOCK_SH */
 	int translock_file_fd;
+
+	/* Last policy file read for the policydb databases */
+	struct dbase_policydb_file *policydb_file;
+
+	/* Module files of the sandbox, see semanage_modules_changed() */
+	struct semanage_module_list *modules;
 };
 
 int semanage_direct_connect(struct semanage_handle *sh);
@@ -6,6 +6,7 @@ typedef struct semanage_fcontext_key record_key_t;
 typedef struct semanage_fcontext record_t;
 #define DBASE_RECORD_DEFINED
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <sepol/policydb.h>
 #include <sepol/context.h>
@@ -14,6 +15,7 @@ typedef struct semanage_fcontext record_t;
 #include "debug.h"
 #include "handle.h"
 #include "database.h"
+#include "utilities.h"
 
 int semanage_fcontext_modify_local(semanage_handle_t * handle,
 				   const semanage_fcontext_key_t * key,
@@ -32,6 +34,24 @@ int semanage_fcontext_del_local(semanage_handle_t * handle,
 	return dbase_del(handle, dconfig, key);
 }
 
+int semanage_fcontext_modify_local_many(semanage_handle_t * handle,
+					semanage_fcontext_t * const *records,
+					unsigned int count)
+{
+
+	dbase_config_t *dconfig = semanage_fcontext_dbase_local(handle);
+	return dbase_modify_many(handle, dconfig, records, count);
+}
+
+int semanage_fcontext_del_local_many(semanage_handle_t * handle,
+				     semanage_fcontext_key_t * const *keys,
+				     unsigned int count)
+{
+
+	dbase_config_t *dconfig = semanage_fcontext_dbase_local(handle);
+	return dbase_del_many(handle, dconfig, keys, count);
+}
+
 int semanage_fcontext_query_local(semanage_handle_t * handle,
 				  const semanage_fcontext_key_t * key,
 				  semanage_fcontext_t ** response)
@@ -82,12 +102,16 @@ int semanage_fcontext_list_local(semanage_handle_t * handle,
 struct validate_handler_arg {
 	semanage_handle_t *handle;
 	const sepol_policydb_t *policydb;
+
+	/* contexts already found valid, as user:role:type:range */
+	semanage_strset_t *valid;
 };
 
 static int validate_handler(const semanage_fcontext_t * fcon, void *varg)
 {
 
-	char *str;
+	char *str, buf[1024];
+	int n = -1;
 
 	/* Unpack varg */
 	struct validate_handler_arg *arg = (struct validate_handler_arg *)varg;
@@ -100,11 +124,30 @@ static int validate_handler(const semanage_fcontext_t * fcon, void *varg)
 	const char *type_str = semanage_fcontext_get_type_str(type);
 	semanage_context_t *con = semanage_fcontext_get_con(fcon);
 
-	if (con
-	    && sepol_context_check(handle->sepolh, policydb,
-				   (sepol_context_t *) con) < 0)
+	if (!con)
+		return 0;
+
+	/* Local file contexts mostly share a few contexts */
+	if (arg->valid) {
+		n = snprintf(buf, sizeof(buf), "%s:%s:%s:%s",
+			     semanage_context_get_user(con),
+			     semanage_context_get_role(con),
+			     semanage_context_get_type(con),
+			     semanage_context_get_mls(con) ?
+			     semanage_context_get_mls(con) : "");
+		if (n >= 0 && (size_t)n < sizeof(buf) &&
+		    semanage_strset_contains(arg->valid, buf))
+			return 0;
+	}
+
+	if (sepol_context_check(handle->sepolh, policydb,
+				(sepol_context_t *) con) < 0)
 		goto invalid;
 
+	/* Without memory for the entry, the context is just checked again */
+	if (arg->valid && n >= 0 && (size_t)n < sizeof(buf))
+		semanage_strset_add(arg->valid, buf);
+
 	return 0;
 
       invalid:
@@ -123,7 +166,12 @@ int hidden semanage_fcontext_validate_local(semanage_handle_t * handle,
 {
 
 	struct validate_handler_arg arg;
+	int rc;
+
 	arg.handle = handle;
 	arg.policydb = policydb;
-	return semanage_fcontext_iterate_local(handle, validate_handler, &arg);
+	arg.valid = semanage_strset_create();
+	rc = semanage_fcontext_iterate_local(handle, validate_handler, &arg);
+	semanage_strset_destroy(arg.valid);
+	return rc;
 }
@@ -78,11 +78,20 @@
 #define TEMPLATE_SEUSER "system_u"
 #define TEMPLATE_LEVEL "s0"
 
+/* number of buckets in the table of checked contexts */
+#define CONTEXT_CHECK_BUCKETS 1024
+
 #define FALLBACK_USER "user_u"
 #define FALLBACK_USER_PREFIX "user"
 #define FALLBACK_USER_LEVEL "s0"
 #define DEFAULT_LOGIN "__default__"
 
+typedef struct context_check {
+	char *context;
+	int result;
+	struct context_check *next;
+} context_check_t;
+
 typedef struct {
 	const char *fcfilepath;
 	int usepasswd;
@@ -92,6 +101,8 @@ typedef struct {
 	char *fallback_user_level;
 	semanage_handle_t *h_semanage;
 	sepol_policydb_t *policydb;
+	/* results of check_line(), keyed by context string */
+	context_check_t **checked;
 } genhomedircon_settings_t;
 
 typedef struct user_entry {
@@ -109,8 +120,9 @@ typedef struct {
 } replacement_pair_t;
 
 typedef struct {
-	const char *dir;
-	int matched;
+	regex_t *re;
+	unsigned int nre;
+	unsigned int alloc;
 } fc_match_handle_t;
 
 typedef struct IgnoreDir {
@@ -217,13 +229,15 @@ static semanage_list_t *get_shell_list(void)
 	return list;
 }
 
-/* Helper function called via semanage_fcontext_iterate() */
-static int fcontext_matches(const semanage_fcontext_t *fcontext, void *varg)
+/* Helper function called via semanage_fcontext_iterate(), compiles
+ * the expression of each file context a home directory must not
+ * match */
+static int fcontext_compile(const semanage_fcontext_t *fcontext, void *varg)
 {
 	const char *oexpr = semanage_fcontext_get_expr(fcontext);
 	fc_match_handle_t *handp = varg;
 	struct Ustr *expr;
-	regex_t re;
+	regex_t *re;
 	int type, retval = -1;
 
 	/* Only match ALL or DIR */
@@ -231,6 +245,15 @@ static int fcontext_matches(const semanage_fcontext_t *fcontext, void *varg)
 	if (type != SEMANAGE_FCONTEXT_ALL && type != SEMANAGE_FCONTEXT_ALL)
 		return 0;
 
+	if (handp->nre == handp->alloc) {
+		unsigned int alloc = handp->alloc ? 2 * handp->alloc : 64;
+		re = realloc(handp->re, alloc * sizeof(*re));
+		if (!re)
+			return -1;
+		handp->re = re;
+		handp->alloc = alloc;
+	}
+
 	/* Convert oexpr into a Ustr and anchor it at the beginning */
 	expr = ustr_dup_cstr("^");
 	if (expr == USTR_NULL)
@@ -260,12 +283,9 @@ static int fcontext_matches(const semanage_fcontext_t *fcontext, void *varg)
 	if (!ustr_add_cstr(&expr, "/*$"))
 		goto done;
 
-	/* Check dir against expr */
-	if (regcomp(&re, ustr_cstr(expr), REG_EXTENDED) != 0)
+	if (regcomp(&handp->re[handp->nre], ustr_cstr(expr), REG_EXTENDED) != 0)
 		goto done;
-	if (regexec(&re, handp->dir, 0, NULL, 0) == 0)
-		handp->matched = 1;
-	regfree(&re);
+	handp->nre++;
 
 	retval = 0;
 
@@ -275,11 +295,35 @@ done:
 	return retval;
 }
 
+static void fcontext_match_free(fc_match_handle_t *handp)
+{
+	unsigned int i;
+
+	for (i = 0; i < handp->nre; i++)
+		regfree(&handp->re[i]);
+	free(handp->re);
+	handp->re = NULL;
+	handp->nre = handp->alloc = 0;
+}
+
+/* Check dir against the compiled file context expressions */
+static int fcontext_matches(const fc_match_handle_t *handp, const char *dir)
+{
+	unsigned int i;
+
+	for (i = 0; i < handp->nre; i++) {
+		if (regexec(&handp->re[i], dir, 0, NULL, 0) == 0)
+			return 1;
+	}
+	return 0;
+}
+
 static semanage_list_t *get_home_dirs(genhomedircon_settings_t * s)
 {
 	semanage_list_t *homedir_list = NULL;
 	semanage_list_t *shells = NULL;
-	fc_match_handle_t hand;
+	fc_match_handle_t hand = { NULL, 0, 0 };
+	int compiled = 0;
 	char *rbuf = NULL;
 	char *path = NULL;
 	long rbuflen;
@@ -383,16 +427,18 @@ static semanage_list_t *get_home_dirs(genhomedircon_settings_t * s)
 		if (!semanage_list_find(homedir_list, path)) {
 			/*
 			 * Now check for an existing file context that matches
-			 * so we don't label a non-homedir as a homedir.
+			 * so we don't label a non-homedir as a homedir.  The
+			 * expressions are compiled once, on first use.
 			 */
-			hand.dir = path;
-			hand.matched = 0;
-			if (semanage_fcontext_iterate(s->h_semanage,
-			    fcontext_matches, &hand) == STATUS_ERR)
-				goto fail;
+			if (!compiled) {
+				if (semanage_fcontext_iterate(s->h_semanage,
+				    fcontext_compile, &hand) == STATUS_ERR)
+					goto fail;
+				compiled = 1;
+			}
 
 			/* NOTE: old genhomedircon printed a warning on match */
-			if (hand.matched) {
+			if (fcontext_matches(&hand, path)) {
 				WARN(s->h_semanage, "%s homedir %s or its parent directory conflicts with a file context already specified in the policy.  This usually indicates an incorrectly defined system account.  If it is a system account please make sure its uid is less than %u or greater than %u or its login shell is /sbin/nologin.", pwbuf->pw_name, pwbuf->pw_dir, minuid, maxuid);
 			} else {
 				if (semanage_list_push(&homedir_list, path))
@@ -413,6 +459,7 @@ static semanage_list_t *get_home_dirs(genhomedircon_settings_t * s)
 
 	endpwent();
 	free(rbuf);
+	fcontext_match_free(&hand);
 	semanage_list_destroy(&shells);
 
 	return homedir_list;
@@ -420,6 +467,7 @@ static semanage_list_t *get_home_dirs(genhomedircon_settings_t * s)
       fail:
 	endpwent();
 	free(rbuf);
+	fcontext_match_free(&hand);
 	free(path);
 	semanage_list_destroy(&homedir_list);
 	semanage_list_destroy(&shells);
@@ -525,16 +573,55 @@ static const char * extract_context(Ustr *line)
 	return ustr_cstr(line) + ustr_len(line) - (len + off);
 }
 
+static unsigned int context_check_hash(const char *str)
+{
+	unsigned int h = 5381;
+
+	while (*str)
+		h = (h << 5) + h + (unsigned char)*str++;
+	return h % CONTEXT_CHECK_BUCKETS;
+}
+
+static void context_check_free(genhomedircon_settings_t * s)
+{
+	context_check_t *c, *next;
+	unsigned int i;
+
+	if (!s->checked)
+		return;
+	for (i = 0; i < CONTEXT_CHECK_BUCKETS; i++) {
+		for (c = s->checked[i]; c; c = next) {
+			next = c->next;
+			free(c->context);
+			free(c);
+		}
+	}
+	free(s->checked);
+	s->checked = NULL;
+}
+
 static int check_line(genhomedircon_settings_t * s, Ustr *line)
 {
 	sepol_context_t *ctx_record = NULL;
+	context_check_t *c;
 	const char *ctx_str;
+	unsigned int h = 0;
 	int result;
 
 	ctx_str = extract_context(line);
 	if (!ctx_str)
 		return STATUS_ERR;
 
+	/* The same few contexts come up for every user, so each is
+	 * only checked against the policy once */
+	if (s->checked) {
+		h = context_check_hash(ctx_str);
+		for (c = s->checked[h]; c; c = c->next) {
+			if (strcmp(c->context, ctx_str) == 0)
+				return c->result;
+		}
+	}
+
 	result = sepol_context_from_string(s->h_semanage->sepolh,
 					   ctx_str, &ctx_record);
 	if (result == STATUS_SUCCESS && ctx_record != NULL) {
@@ -545,6 +632,17 @@ static int check_line(genhomedircon_settings_t * s, Ustr *line)
 				       semanage_msg_relay_handler, s->h_semanage);
 		sepol_context_free(ctx_record);
 	}
+
+	/* Failing to remember the result only costs a recheck */
+	if (s->checked && (c = malloc(sizeof(*c))) != NULL) {
+		if ((c->context = strdup(ctx_str)) != NULL) {
+			c->result = result;
+			c->next = s->checked[h];
+			s->checked[h] = c;
+		} else {
+			free(c);
+		}
+	}
 	return result;
 }
 
@@ -1066,6 +1164,7 @@ int semanage_genhomedircon(semanage_handle_t * sh,
 	s.homedir_template_path =
 	    semanage_path(SEMANAGE_TMP, SEMANAGE_HOMEDIR_TMPL);
 	s.fcfilepath = semanage_path(SEMANAGE_TMP, SEMANAGE_FC_HOMEDIRS);
+	s.checked = NULL;
 
 	s.fallback_user = strdup(FALLBACK_USER);
 	s.fallback_user_prefix = strdup(FALLBACK_USER_PREFIX);
@@ -1080,6 +1179,7 @@ int semanage_genhomedircon(semanage_handle_t * sh,
 	s.usepasswd = usepasswd;
 	s.h_semanage = sh;
 	s.policydb = policydb;
+	s.checked = calloc(CONTEXT_CHECK_BUCKETS, sizeof(*s.checked));
 
 	if (!(out = fopen(s.fcfilepath, "w"))) {
 		/* couldn't open output file */
@@ -1097,6 +1197,7 @@ done:
 	free(s.fallback_user);
 	free(s.fallback_user_prefix);
 	free(s.fallback_user_level);
+	context_check_free(&s);
 	ignore_free();
 
 	return retval;
@@ -27,6 +27,24 @@ int semanage_iface_del_local(semanage_handle_t * handle,
 	return dbase_del(handle, dconfig, key);
 }
 
+int semanage_iface_modify_local_many(semanage_handle_t * handle,
+				     semanage_iface_t * const *records,
+				     unsigned int count)
+{
+
+	dbase_config_t *dconfig = semanage_iface_dbase_local(handle);
+	return dbase_modify_many(handle, dconfig, records, count);
+}
+
+int semanage_iface_del_local_many(semanage_handle_t * handle,
+				  semanage_iface_key_t * const *keys,
+				  unsigned int count)
+{
+
+	dbase_config_t *dconfig = semanage_iface_dbase_local(handle);
+	return dbase_del_many(handle, dconfig, keys, count);
+}
+
 int semanage_iface_query_local(semanage_handle_t * handle,
 			       const semanage_iface_key_t * key,
 			       semanage_iface_t ** response)
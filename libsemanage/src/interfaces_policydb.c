@@ -38,6 +38,7 @@ typedef struct dbase_policydb dbase_t;
 record_policydb_table_t SEMANAGE_IFACE_POLICYDB_RTABLE = {
 	.add = NULL,
 	.modify = (record_policydb_table_modify_t) sepol_iface_modify,
+	.modify_many = NULL,
 	.set = NULL,
 	.query = (record_policydb_table_query_t) sepol_iface_query,
 	.count = (record_policydb_table_count_t) sepol_iface_count,
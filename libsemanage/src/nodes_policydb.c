@@ -37,6 +37,8 @@ typedef struct dbase_policydb dbase_t;
 record_policydb_table_t SEMANAGE_NODE_POLICYDB_RTABLE = {
 	.add = NULL,
 	.modify = (record_policydb_table_modify_t) sepol_node_modify,
+	.modify_many =
+	    (record_policydb_table_modify_many_t) sepol_node_modify_many,
 	.set = NULL,
 	.query = (record_policydb_table_query_t) sepol_node_query,
 	.count = (record_policydb_table_count_t) sepol_node_count,
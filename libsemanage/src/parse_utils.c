@@ -27,6 +27,8 @@ int parse_init(semanage_handle_t * handle,
 	tmp_info->working_copy = NULL;
 	tmp_info->orig_line = NULL;
 	tmp_info->ptr = NULL;
+	tmp_info->orig_size = 0;
+	tmp_info->working_size = 0;
 	tmp_info->lineno = 0;
 	tmp_info->parse_arg = parse_arg;
 
@@ -39,6 +41,8 @@ void parse_release(parse_info_t * info)
 
 	parse_close(info);
 	parse_dispose_line(info);
+	free(info->orig_line);
+	free(info->working_copy);
 	free(info);
 }
 
@@ -67,15 +71,6 @@ void parse_close(parse_info_t * info)
 
 void parse_dispose_line(parse_info_t * info)
 {
-	if (info->orig_line) {
-		free(info->orig_line);
-		info->orig_line = NULL;
-	}
-
-	if (info->working_copy) {
-		free(info->working_copy);
-		info->working_copy = NULL;
-	}
 
 	info->ptr = NULL;
 }
@@ -83,10 +78,8 @@ void parse_dispose_line(parse_info_t * info)
 int parse_skip_space(semanage_handle_t * handle, parse_info_t * info)
 {
 
-	size_t buf_len = 0;
 	ssize_t len;
 	int lineno = info->lineno;
-	char *buffer = NULL;
 	char *ptr;
 
 	if (info->ptr) {
@@ -99,14 +92,18 @@ int parse_skip_space(semanage_handle_t * handle, parse_info_t * info)
 
 	parse_dispose_line(info);
 
+	/* The line buffer is reused from one line to the next */
 	while (info->file_stream &&
-	       ((len = getline(&buffer, &buf_len, info->file_stream)) > 0)) {
+	       ((len = getline(&info->working_copy, &info->working_size,
+			       info->file_stream)) > 0)) {
+
+		char *buffer = info->working_copy;
 
 		lineno++;
 
 		/* Eat newline, preceding whitespace */
 		if (buffer[len - 1] == '\n')
-			buffer[len - 1] = '\0';
+			buffer[--len] = '\0';
 
 		ptr = buffer;
 		while (*ptr && isspace(*ptr))
@@ -114,27 +111,26 @@ int parse_skip_space(semanage_handle_t * handle, parse_info_t * info)
 
 		/* Skip comments and blank lines */
 		if ((*ptr) && *ptr != '#') {
-			char *tmp = strdup(buffer);
-			if (!tmp)
-				goto omem;
+			if ((size_t)len + 1 > info->orig_size) {
+				char *tmp = realloc(info->orig_line, len + 1);
+				if (!tmp)
+					goto omem;
+				info->orig_line = tmp;
+				info->orig_size = len + 1;
+			}
+			memcpy(info->orig_line, buffer, len + 1);
 
 			info->lineno = lineno;
-			info->working_copy = buffer;
-			info->orig_line = tmp;
 			info->ptr = ptr;
 
 			return STATUS_SUCCESS;
 		}
 	}
 
-	free(buffer);
-	buffer = NULL;
-
 	return STATUS_SUCCESS;
 
       omem:
 	ERR(handle, "out of memory, could not allocate buffer");
-	free(buffer);
 	return STATUS_ERR;
 }
 
@@ -235,34 +231,44 @@ int parse_fetch_int(semanage_handle_t * handle,
 		    parse_info_t * info, int *num, char delim)
 {
 
-	char *str = NULL;
+	char *start = info->ptr;
 	char *test = NULL;
 	int value = 0;
 
-	if (parse_fetch_string(handle, info, &str, delim) < 0)
+	if (parse_assert_noeof(handle, info) < 0)
+		goto err;
+
+	/* Parsed in place: the token ends at whitespace or delim */
+	while (*(info->ptr) && !isspace(*(info->ptr)) &&
+	       (*(info->ptr) != delim))
+		info->ptr++;
+
+	if (info->ptr == start) {
+		ERR(handle, "expected non-empty string, but did not "
+		    "find one (%s: %u):\n%s", info->filename, info->lineno,
+		    info->orig_line);
 		goto err;
+	}
 
-	if (!isdigit((int)*str)) {
+	if (!isdigit((int)*start)) {
 		ERR(handle, "expected a numeric value: (%s: %u)\n%s",
 		    info->filename, info->lineno, info->orig_line);
 		goto err;
 	}
 
-	value = strtol(str, &test, 10);
-	if (*test != '\0') {
-		ERR(handle, "could not parse numeric value \"%s\": "
-		    "(%s: %u)\n%s", str, info->filename,
-		    info->lineno, info->orig_line);
+	value = strtol(start, &test, 10);
+	if (test != info->ptr) {
+		ERR(handle, "could not parse numeric value \"%.*s\": "
+		    "(%s: %u)\n%s", (int)(info->ptr - start), start,
+		    info->filename, info->lineno, info->orig_line);
 		goto err;
 	}
 
 	*num = value;
-	free(str);
 	return STATUS_SUCCESS;
 
       err:
 	ERR(handle, "could not fetch numeric value");
-	free(str);
 	return STATUS_ERR;
 }
 
@@ -296,7 +302,7 @@ int parse_fetch_string(semanage_handle_t * handle,
 		goto err;
 	}
 
-	strncpy(tmp_str, start, len);
+	memcpy(tmp_str, start, len);
 	*(tmp_str + len) = '\0';
 	*str = tmp_str;
 	return STATUS_SUCCESS;
@@ -11,6 +11,8 @@ typedef struct parse_info {
 	char *orig_line;	/* Original copy of the line being parsed */
 	char *working_copy;	/* Working copy of the line being parsed */
 	char *ptr;		/* Current parsing location */
+	size_t orig_size;	/* Allocated size of orig_line */
+	size_t working_size;	/* Allocated size of working_copy */
 
 	const char *filename;	/* Input stream file name */
 	FILE *file_stream;	/* Input stream handle */
@@ -32,7 +34,8 @@ extern int parse_open(semanage_handle_t * handle, parse_info_t * info);
 /* Close file */
 extern void parse_close(parse_info_t * info);
 
-/* Release resources for current line */
+/* Discard the rest of the current line; the line buffers
+ * are kept for the next line, and freed by parse_release */
 extern void parse_dispose_line(parse_info_t * info);
 
 /* Skip all whitespace and comments */
@@ -68,6 +68,11 @@ static int load_records(semanage_handle_t * handle,
 	dbase_table_t *dtable = dst->dtable;
 	record_table_t *rtable = dtable->get_rtable(dbase);
 
+	/* Nothing is obsoleted without MODE_SET, so
+	 * the records can be loaded in one go */
+	if (!(mode & MODE_SET) && mode & MODE_MODIFY && dtable->modify_many)
+		return dtable->modify_many(handle, dbase, records, nrecords);
+
 	for (i = 0; i < nrecords; i++) {
 
 		/* Possibly obsoleted */
@@ -29,6 +29,24 @@ int semanage_port_del_local(semanage_handle_t * handle,
 	return dbase_del(handle, dconfig, key);
 }
 
+int semanage_port_modify_local_many(semanage_handle_t * handle,
+				    semanage_port_t * const *records,
+				    unsigned int count)
+{
+
+	dbase_config_t *dconfig = semanage_port_dbase_local(handle);
+	return dbase_modify_many(handle, dconfig, records, count);
+}
+
+int semanage_port_del_local_many(semanage_handle_t * handle,
+				 semanage_port_key_t * const *keys,
+				 unsigned int count)
+{
+
+	dbase_config_t *dconfig = semanage_port_dbase_local(handle);
+	return dbase_del_many(handle, dconfig, keys, count);
+}
+
 int semanage_port_query_local(semanage_handle_t * handle,
 			      const semanage_port_key_t * key,
 			      semanage_port_t ** response)
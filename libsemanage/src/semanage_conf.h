@@ -29,6 +29,11 @@
  *  - external programs to execute whenever a policy is to be loaded
  */
 
+/* Algorithms for compressing the modules in the store.  Modules in
+ * either format are always read. */
+#define SEMANAGE_COMPRESS_BZIP2 0
+#define SEMANAGE_COMPRESS_ZLIB  1
+
 typedef struct semanage_conf {
 	enum semanage_connect_type store_type;
 	char *store_path;	/* used for both socket path and policy dir */
@@ -37,12 +42,15 @@ typedef struct semanage_conf {
 	int expand_check;
 	int save_previous;
 	int save_linked;
+	int policy_index;	/* write policy.index at commit */
 	int disable_genhomedircon;
 	int usepasswd;
 	int handle_unknown;
 	mode_t file_mode;
 	int bzip_blocksize;
 	int bzip_small;
+	int compression;	/* SEMANAGE_COMPRESS_BZIP2 or SEMANAGE_COMPRESS_ZLIB */
+	int commit_profile;	/* report the time spent in each commit phase */
 	char *ignoredirs;	/* ";" separated of list for genhomedircon to ignore */
 	struct external_prog *load_policy;
 	struct external_prog *setfiles;
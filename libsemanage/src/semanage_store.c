@@ -36,8 +36,12 @@ typedef struct dbase_policydb dbase_t;
 #include "handle.h"
 
 #include <selinux/selinux.h>
+#include <selinux/label.h>
 #include <sepol/policydb.h>
+#include <sepol/policy_index.h>
 #include <sepol/module.h>
+#include <sepol/context.h>
+#include <sepol/context_record.h>
 
 #include <assert.h>
 #include <ctype.h>
@@ -50,10 +54,16 @@ typedef struct dbase_policydb dbase_t;
 #include <string.h>
 #include <unistd.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 #include "debug.h"
 
@@ -118,36 +128,34 @@ static const char *semanage_sandbox_paths[SEMANAGE_STORE_NUM_PATHS] = {
 	"/file_contexts.homedirs",
 	"/disable_dontaudit",
 	"/preserve_tunables",
+	"/policy.expanded",
+	"/policy.expanded.inputs",
+	"/policy.index",
+	"/policy.loaded",
+	"/modules.index",
 };
 
-/* A node used in a linked list of file contexts; used for sorting.
+/* A file context line; used for sorting.  The strings point into
+ * the buffer being sorted and are not NUL terminated.
  */
 typedef struct semanage_file_context_node {
-	char *path;
-	char *file_type;
-	char *context;
+	const char *path;
+	const char *file_type;
+	const char *context;
 	int path_len;
 	int effective_len;
 	int type_len;
 	int context_len;
 	int meta;		/* position of first meta char in path, -1 if none */
-	struct semanage_file_context_node *next;
+	size_t order;		/* position in the input, keeps the sort stable */
 } semanage_file_context_node_t;
 
-/* A node used in a linked list of buckets that contain
- *  semanage_file_context_node lists.  Used for sorting.
- */
-typedef struct semanage_file_context_bucket {
-	semanage_file_context_node_t *data;
-	struct semanage_file_context_bucket *next;
-} semanage_file_context_bucket_t;
-
-/* A node used in a linked list of netfilter rules.
+/* A netfilter rule, pointing into the buffer being sorted.
  */
 typedef struct semanage_netfilter_context_node {
-	char *rule;
+	const char *rule;
 	size_t rule_len;
-	struct semanage_netfilter_context_node *next;
+	int priority;
 } semanage_netfilter_context_node_t;
 
 /* Initialize the paths to config file, lock files and store root.
@@ -466,22 +474,13 @@ int semanage_module_enabled(const char *file) {
 	return (access(path, F_OK ) != 0);
 }
 
-/* Callback used by scandir() to select module files. */
-static int semanage_modulename_select(const struct dirent *d)
-{
-	if (d->d_name[0] == '.'
-	    && (d->d_name[1] == '\0'
-		|| (d->d_name[1] == '.' && d->d_name[2] == '\0')))
-		return 0;
-
-	return (! is_disabled_file(d->d_name));
-}
-
 /* Copies a file from src to dst.  If dst already exists then
- * overwrite it.  Returns 0 on success, -1 on error. */
+ * overwrite it.  Where the filesystem supports it the copy is a
+ * copy-on-write clone of src, so that making a sandbox does not
+ * duplicate the module store.  Returns 0 on success, -1 on error. */
 static int semanage_copy_file(const char *src, const char *dst, mode_t mode)
 {
-	int in, out, retval = 0, amount_read, n, errsv = errno;
+	int in, out, retval = 0, amount_read, n, errsv = errno, cloned = 0;
 	char tmp[PATH_MAX];
 	char buf[4192];
 	mode_t mask;
@@ -506,7 +505,14 @@ static int semanage_copy_file(const char *src, const char *dst, mode_t mode)
 		goto out;
 	}
 	umask(mask);
-	while (retval == 0 && (amount_read = read(in, buf, sizeof(buf))) > 0) {
+	amount_read = 0;
+#ifdef FICLONE
+	/* Share the extents of src when the filesystem can, and only
+	 * copy the data otherwise. */
+	cloned = (ioctl(out, FICLONE, in) == 0);
+#endif
+	while (retval == 0 && !cloned &&
+	       (amount_read = read(in, buf, sizeof(buf))) > 0) {
 		if (write(out, buf, amount_read) < 0) {
 			errsv = errno;
 			retval = -1;
@@ -531,8 +537,11 @@ out:
 }
 
 /* Copies all of the files from src to dst, recursing into
- * subdirectories.  Returns 0 on success, -1 on error. */
-static int semanage_copy_dir(const char *src, const char *dst)
+ * subdirectories.  With link set files are hard linked instead where
+ * possible, so that src and dst share them; this is only safe where
+ * files are always replaced, never rewritten in place.  Returns 0 on
+ * success, -1 on error. */
+static int semanage_copy_dir(const char *src, const char *dst, int link_files)
 {
 	int i, len = 0, retval = -1;
 	struct stat sb;
@@ -551,11 +560,19 @@ static int semanage_copy_dir(const char *src, const char *dst)
 		}
 		snprintf(path2, sizeof(path2), "%s/%s", dst, names[i]->d_name);
 		if (S_ISDIR(sb.st_mode)) {
+			/* Module files are only ever written anew, see
+			 * bzip() in direct_api.c, so the sandbox and the
+			 * active and previous stores can share them. */
+			int link_dir = link_files ||
+			    !strcmp(names[i]->d_name,
+				    semanage_sandbox_paths[SEMANAGE_MODULES] + 1);
 			if (mkdir(path2, 0700) == -1 ||
-			    semanage_copy_dir(path, path2) == -1) {
+			    semanage_copy_dir(path, path2, link_dir) == -1) {
 				goto cleanup;
 			}
 		} else if (S_ISREG(sb.st_mode)) {
+			if (link_files && link(path, path2) == 0)
+				continue;
 			if (semanage_copy_file(path, path2, sb.st_mode) == -1) {
 				goto cleanup;
 			}
@@ -634,7 +651,7 @@ int semanage_make_sandbox(semanage_handle_t * sh)
 
 	if (mkdir(sandbox, S_IRWXU) == -1 ||
 	    semanage_copy_dir(semanage_path(SEMANAGE_ACTIVE, SEMANAGE_TOPLEVEL),
-			      sandbox) == -1) {
+			      sandbox, 0) == -1) {
 		ERR(sh, "Could not copy files to sandbox %s.", sandbox);
 		goto cleanup;
 	}
@@ -647,60 +664,173 @@ int semanage_make_sandbox(semanage_handle_t * sh)
 	return -1;
 }
 
-static int semanage_get_modules_names_filter(semanage_handle_t * sh, char ***filenames,
-				      int *len, int (*filter)(const struct dirent *))
+/* The module files of a modules directory, with whether each is
+ * enabled, that is has no .disabled marker next to it.  While a
+ * transaction lasts the listing of the sandbox is kept in the handle,
+ * so that the several scans of a commit read the directory once. */
+struct semanage_module_list {
+	char **names;		/* full paths, sorted with strcmp() */
+	char *enabled;
+	int num;
+};
+
+static int semanage_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void semanage_module_list_destroy(struct semanage_module_list *list)
+{
+	int i;
+
+	if (!list)
+		return;
+	for (i = 0; i < list->num; i++)
+		free(list->names[i]);
+	free(list->names);
+	free(list->enabled);
+	free(list);
+}
+
+/* Reads the module files of 'modules_path', and their markers, with a
+ * single directory scan.  Returns NULL on error. */
+static struct semanage_module_list *semanage_module_list_read(
+	semanage_handle_t * sh, const char *modules_path)
 {
-	const char *modules_path;
+	struct semanage_module_list *list;
 	struct dirent **namelist = NULL;
-	int num_files, i, retval = -1;
+	char **entries = NULL, marker[NAME_MAX + 1], *key = marker;
+	char path[PATH_MAX];
+	int num_entries, i, n;
 
-	if (sh->is_in_transaction) {
-		modules_path = semanage_path(SEMANAGE_TMP, SEMANAGE_MODULES);
-	} else {
-		modules_path = semanage_path(SEMANAGE_ACTIVE, SEMANAGE_MODULES);
+	if ((num_entries = scandir(modules_path, &namelist,
+				   semanage_filename_select, NULL)) == -1) {
+		ERR(sh, "Error while scanning directory %s.", modules_path);
+		return NULL;
 	}
+	list = calloc(1, sizeof(*list));
+	if (!list)
+		goto oom;
+	if (num_entries == 0)
+		goto out;
 
-	*filenames = NULL;
-	*len = 0;
-	if ((num_files = scandir(modules_path, &namelist,
-				 filter, alphasort)) == -1) {
-		ERR(sh, "Error while scanning directory %s.", modules_path);
-		goto cleanup;
+	list->names = calloc(num_entries, sizeof(*list->names));
+	list->enabled = calloc(num_entries, sizeof(*list->enabled));
+	entries = calloc(num_entries, sizeof(*entries));
+	if (!list->names || !list->enabled || !entries)
+		goto oom;
+	for (i = 0; i < num_entries; i++)
+		entries[i] = namelist[i]->d_name;
+	qsort(entries, num_entries, sizeof(*entries), semanage_name_cmp);
+
+	for (i = 0; i < num_entries; i++) {
+		if (is_disabled_file(entries[i]))
+			continue;
+		snprintf(path, PATH_MAX, "%s/%s", modules_path, entries[i]);
+		if ((list->names[list->num] = strdup(path)) == NULL)
+			goto oom;
+		n = snprintf(marker, sizeof(marker), "%s.%s", entries[i],
+			     DISABLESTR);
+		list->enabled[list->num] = n < 0 || n >= (int)sizeof(marker) ||
+		    !bsearch(&key, entries, num_entries, sizeof(*entries),
+			     semanage_name_cmp);
+		list->num++;
 	}
-	if (num_files == 0) {
-		retval = 0;
-		goto cleanup;
+
+      out:
+	free(entries);
+	for (i = 0; i < num_entries; i++)
+		free(namelist[i]);
+	free(namelist);
+	return list;
+
+      oom:
+	ERR(sh, "Out of memory!");
+	semanage_module_list_destroy(list);
+	list = NULL;
+	goto out;
+}
+
+/* Drops the listing of the sandbox's modules kept in the handle.  To
+ * be called whenever a module file or marker of the sandbox is
+ * written or removed, and when the sandbox goes away. */
+void semanage_modules_changed(semanage_handle_t * sh)
+{
+	semanage_module_list_destroy(sh->u.direct.modules);
+	sh->u.direct.modules = NULL;
+}
+
+/* The module listing of the store the handle works on: the cached one
+ * in a transaction, otherwise a fresh one that '*owned' tells the
+ * caller to destroy.  Returns NULL on error. */
+static struct semanage_module_list *semanage_module_list_get(
+	semanage_handle_t * sh, int *owned)
+{
+	struct semanage_module_list *list;
+
+	*owned = 0;
+	if (!sh->is_in_transaction) {
+		*owned = 1;
+		return semanage_module_list_read(sh,
+			semanage_path(SEMANAGE_ACTIVE, SEMANAGE_MODULES));
 	}
-	if ((*filenames =
-	     (char **)calloc(num_files, sizeof(**filenames))) == NULL) {
-		ERR(sh, "Out of memory!");
-		goto cleanup;
+	if (!sh->u.direct.modules) {
+		list = semanage_module_list_read(sh,
+			semanage_path(SEMANAGE_TMP, SEMANAGE_MODULES));
+		sh->u.direct.modules = list;
 	}
-	for (i = 0; i < num_files; i++) {
-		char *filename;
-		char path[PATH_MAX];
+	return sh->u.direct.modules;
+}
 
-		snprintf(path, PATH_MAX, "%s/%s", modules_path,
-			 namelist[i]->d_name);
-		if ((filename = strdup(path)) == NULL) {
-			int j;
+/* Copies the module files of 'list', only the enabled ones if
+ * 'enabled_only' is set, to a newly allocated '*filenames'. */
+static int semanage_module_list_copy(semanage_handle_t * sh,
+				     const struct semanage_module_list *list,
+				     int enabled_only, char ***filenames,
+				     int *len)
+{
+	int i, n = 0;
+
+	*filenames = NULL;
+	*len = 0;
+	if (list->num == 0)
+		return 0;
+	if ((*filenames = calloc(list->num, sizeof(**filenames))) == NULL) {
+		ERR(sh, "Out of memory!");
+		return -1;
+	}
+	for (i = 0; i < list->num; i++) {
+		if (enabled_only && !list->enabled[i])
+			continue;
+		if (((*filenames)[n] = strdup(list->names[i])) == NULL) {
 			ERR(sh, "Out of memory!");
-			for (j = 0; j < i; j++) {
-				free((*filenames)[j]);
-			}
+			while (n--)
+				free((*filenames)[n]);
 			free(*filenames);
 			*filenames = NULL;
-			goto cleanup;
+			return -1;
 		}
-		(*filenames)[i] = filename;
+		n++;
 	}
-	*len = num_files;
-	retval = 0;
-      cleanup:
-	for (i = 0; i < num_files; i++) {
-		free(namelist[i]);
-	}
-	free(namelist);
+	*len = n;
+	return 0;
+}
+
+static int semanage_get_modules_names_filter(semanage_handle_t * sh,
+					     char ***filenames, int *len,
+					     int enabled_only)
+{
+	struct semanage_module_list *list;
+	int owned, retval;
+
+	*filenames = NULL;
+	*len = 0;
+	if ((list = semanage_module_list_get(sh, &owned)) == NULL)
+		return -1;
+	retval = semanage_module_list_copy(sh, list, enabled_only,
+					   filenames, len);
+	if (owned)
+		semanage_module_list_destroy(list);
 	return retval;
 }
 
@@ -714,8 +844,7 @@ static int semanage_get_modules_names_filter(semanage_handle_t * sh, char ***fil
 int semanage_get_modules_names(semanage_handle_t * sh, char ***filenames,
 			       int *len)
 {
-	return semanage_get_modules_names_filter(sh, filenames,
-						 len, semanage_modulename_select);
+	return semanage_get_modules_names_filter(sh, filenames, len, 0);
 }
 
 /* Scans the modules directory for the current semanage handler.  This
@@ -728,25 +857,23 @@ int semanage_get_modules_names(semanage_handle_t * sh, char ***filenames,
 int semanage_get_active_modules_names(semanage_handle_t * sh, char ***filenames,
 			       int *len)
 {
+	return semanage_get_modules_names_filter(sh, filenames, len, 1);
+}
 
-	int rc = semanage_get_modules_names_filter(sh, filenames,
-						   len, semanage_modulename_select);
-	if ( rc != 0 ) return rc;
-
-	int i = 0, num_modules = *len;
-	char **names=*filenames;
+/* Like semanage_module_enabled(), but answered from the listing kept
+ * in the handle when there is one. */
+int semanage_module_is_enabled(semanage_handle_t * sh, const char *file)
+{
+	const struct semanage_module_list *list = sh->u.direct.modules;
+	char **found;
 
-	while ( i < num_modules ) {
-		if (! semanage_module_enabled(names[i])) {
-			free(names[i]);
-			names[i]=names[num_modules-1];
-			names[num_modules-1] = NULL;
-			num_modules--;
-		}
-		i++;
+	if (sh->is_in_transaction && list && list->num) {
+		found = bsearch(&file, list->names, list->num,
+				sizeof(*list->names), semanage_name_cmp);
+		if (found)
+			return list->enabled[found - list->names];
 	}
-	*len = num_modules;
-	return 0;
+	return semanage_module_enabled(file);
 }
 
 /******************* routines that run external programs *******************/
@@ -955,16 +1082,14 @@ static char **split_args(const char *arg0, char *arg_string,
 /* Take the arguments given in v->args and expand any $ macros within.
  * Split the arguments into different strings (argv).  Next fork and
  * execute the process.	 BE SURE THAT ALL FILE DESCRIPTORS ARE SET TO
- * CLOSE-ON-EXEC.  Take the return value of the child process and
- * return it, -1 on error.
+ * CLOSE-ON-EXEC.  Return the pid of the child, -1 on error.
  */
-static int semanage_exec_prog(semanage_handle_t * sh,
-			      external_prog_t * e, const char *new_name,
-			      const char *old_name)
+static pid_t semanage_spawn_prog(semanage_handle_t * sh,
+				 external_prog_t * e, const char *new_name,
+				 const char *old_name)
 {
 	char **argv;
 	pid_t forkval;
-	int status = 0;
 
 	argv = split_args(e->path, e->args, new_name, old_name);
 	if (argv == NULL) {
@@ -988,9 +1113,17 @@ static int semanage_exec_prog(semanage_handle_t * sh,
 		ERR(sh, "Error while forking process.");
 		return -1;
 	}
+	return forkval;
+}
+
+/* Wait for the child 'pid' running 'e' to finish.  Return its exit
+ * status, -1 on error. */
+static int semanage_wait_prog(semanage_handle_t * sh,
+			      external_prog_t * e, pid_t pid)
+{
+	int status = 0;
 
-	/* parent process.  wait for child to finish */
-	if (waitpid(forkval, &status, 0) == -1 || !WIFEXITED(status)) {
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status)) {
 		ERR(sh, "Child process %s did not exit cleanly.",
 		    e->path);
 		return -1;
@@ -998,6 +1131,21 @@ static int semanage_exec_prog(semanage_handle_t * sh,
 	return WEXITSTATUS(status);
 }
 
+/* Run 'e' as semanage_spawn_prog() does and return the exit status of
+ * the process, -1 on error.
+ */
+static int semanage_exec_prog(semanage_handle_t * sh,
+			      external_prog_t * e, const char *new_name,
+			      const char *old_name)
+{
+	pid_t pid;
+
+	pid = semanage_spawn_prog(sh, e, new_name, old_name);
+	if (pid < 0)
+		return -1;
+	return semanage_wait_prog(sh, e, pid);
+}
+
 /* reloads the policy pointed to by the handle, used locally by install 
  * and exported for user reload requests */
 int semanage_reload_policy(semanage_handle_t * sh)
@@ -1007,6 +1155,14 @@ int semanage_reload_policy(semanage_handle_t * sh)
 	if (!sh)
 		return -1;
 
+	/* Without a [load_policy] program in semanage.conf, do what
+	 * load_policy itself does, without forking it. */
+	if (sh->conf->load_policy == NULL) {
+		if ((r = selinux_mkload_policy(1)) < 0)
+			ERR(sh, "Could not load policy: %s.", strerror(errno));
+		return r;
+	}
+
 	if ((r = semanage_exec_prog(sh, sh->conf->load_policy, "", "")) != 0) {
 		ERR(sh, "load_policy returned error code %d.", r);
 	}
@@ -1081,6 +1237,16 @@ int semanage_split_fc(semanage_handle_t * sh)
 static int sefcontext_compile(semanage_handle_t * sh, const char *path) {
 
 	int r;
+
+	/* Without a [sefcontext_compile] program, compile in-process. */
+	if (sh->conf->sefcontext_compile == NULL) {
+		if (selabel_file_compile(path, NULL, 0) < 0) {
+			ERR(sh, "Could not compile %s: %s", path, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
 	if ((r = semanage_exec_prog(sh, sh->conf->sefcontext_compile, path, "")) != 0) {
 		ERR(sh, "sefcontext_compile returned error code %d. Compiling %s", r, path);
 		return -1;
@@ -1089,11 +1255,237 @@ static int sefcontext_compile(semanage_handle_t * sh, const char *path) {
 	return 0;
 }
 
+static int semanage_read_policydb_file(semanage_handle_t * sh,
+				       sepol_policydb_t * in,
+				       const char *kernel_filename);
+
+/* The libselinux validation callback takes no argument of its own,
+ * so semanage_check_fc() leaves what to check against here. */
+static semanage_handle_t *validate_sh;
+static sepol_policydb_t *validate_policydb;
+static int validate_errors;
+
+static int semanage_validate_context(char **ctx)
+{
+	sepol_context_t *ctx_record = NULL;
+	int rc = 0;
+
+	if (sepol_context_from_string(validate_sh->sepolh, *ctx,
+				      &ctx_record) < 0 ||
+	    sepol_context_check(validate_sh->sepolh, validate_policydb,
+				ctx_record) < 0) {
+		ERR(validate_sh, "invalid context %s", *ctx);
+		validate_errors++;
+		rc = -1;
+	}
+	sepol_context_free(ctx_record);
+	return rc;
+}
+
+/* Checks the file contexts in fc_path (and its .homedirs and .local
+ * companions) against the policy in policy_path, as setfiles -c
+ * does, without forking setfiles.  Returns 0 on success, -1 on
+ * error. */
+static int semanage_check_fc(semanage_handle_t * sh, const char *policy_path,
+			     const char *fc_path)
+{
+	struct selinux_opt opts[] = {
+		{SELABEL_OPT_VALIDATE, (char *)1},
+		{SELABEL_OPT_PATH, fc_path}
+	};
+	union selinux_callback old_cb, cb;
+	struct selabel_handle *hnd;
+	sepol_policydb_t *policydb = NULL;
+	int retval = -1;
+
+	if (sepol_policydb_create(&policydb) < 0) {
+		ERR(sh, "Out of memory!");
+		return -1;
+	}
+	if (semanage_read_policydb_file(sh, policydb, policy_path) < 0)
+		goto cleanup;
+
+	validate_sh = sh;
+	validate_policydb = policydb;
+	validate_errors = 0;
+
+	old_cb = selinux_get_callback(SELINUX_CB_VALIDATE);
+	cb.func_validate = semanage_validate_context;
+	selinux_set_callback(SELINUX_CB_VALIDATE, cb);
+	hnd = selabel_open(SELABEL_CTX_FILE, opts, 2);
+	selinux_set_callback(SELINUX_CB_VALIDATE, old_cb);
+
+	if (hnd == NULL) {
+		ERR(sh, "Could not load file contexts %s.", fc_path);
+		goto cleanup;
+	}
+	selabel_close(hnd);
+	if (validate_errors) {
+		ERR(sh, "%s has %d invalid contexts.", fc_path,
+		    validate_errors);
+		goto cleanup;
+	}
+	retval = 0;
+
+      cleanup:
+	validate_sh = NULL;
+	validate_policydb = NULL;
+	sepol_policydb_free(policydb);
+	return retval;
+}
+
+/********************* loaded policy stamp *********************/
+
+extern char *selinux_mnt;
+
+/* The start of the kernel status page (see selinux_status_open()). */
+struct semanage_kernel_status {
+	uint32_t version;
+	uint32_t sequence;	/* odd while the kernel updates the page */
+	uint32_t enforcing;
+	uint32_t policyload;	/* number of policy loads since boot */
+	uint32_t deny_unknown;
+};
+
+/* Reads the number of policy loads since boot from the kernel status
+ * page.  Returns 0 on success, -1 if it cannot be read. */
+static int semanage_policy_loads(uint32_t * loads)
+{
+	struct semanage_kernel_status st;
+	char path[PATH_MAX];
+	int fd, tries;
+
+	if (!selinux_mnt || is_selinux_enabled() <= 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/status", selinux_mnt);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	for (tries = 0; tries < 16; tries++) {
+		if (pread(fd, &st, sizeof(st), 0) != sizeof(st))
+			break;
+		if (!(st.sequence & 1))
+			break;
+	}
+	close(fd);
+	if (tries == 16 || st.sequence & 1)
+		return -1;
+	*loads = st.policyload;
+	return 0;
+}
+
+/* Describes the policy in 'filename' as loaded in the running kernel:
+ * a hash of the file, the boot id and the number of policy loads so
+ * far, which tells a later commit whether anything was loaded since.
+ * The result must be free()d.  Returns NULL if the file or the kernel
+ * state cannot be read.
+ */
+static char *semanage_policy_stamp(const char *filename, uint32_t loads)
+{
+	char boot_id[64], buf[BUFSIZ], *stamp;
+	uint64_t h = FNV1A_64_INIT;
+	size_t n;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/sys/kernel/random/boot_id", "r")) == NULL)
+		return NULL;
+	if (!fgets(boot_id, sizeof(boot_id), fp)) {
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	boot_id[strcspn(boot_id, "\n")] = '\0';
+
+	if ((fp = fopen(filename, "r")) == NULL)
+		return NULL;
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		h = semanage_fnv1a(h, buf, n);
+	if (ferror(fp)) {
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+
+	if (asprintf(&stamp, "%016llx %s %u\n", (unsigned long long)h,
+		     boot_id, loads) < 0)
+		return NULL;
+	return stamp;
+}
+
+/* Returns 1 if the last load recorded in the active store was of the
+ * same policy file and nothing was loaded since, 0 otherwise. */
+static int semanage_policy_is_loaded(const char *filename)
+{
+	const char *stamp_filename;
+	char buf[256], *stamp;
+	uint32_t loads;
+	size_t n;
+	FILE *fp;
+	int same;
+
+	if ((stamp_filename =
+	     semanage_path(SEMANAGE_ACTIVE, SEMANAGE_POLICY_LOADED)) == NULL ||
+	    (fp = fopen(stamp_filename, "r")) == NULL) {
+		errno = 0;
+		return 0;
+	}
+	n = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[n] = '\0';
+
+	if (semanage_policy_loads(&loads) < 0 ||
+	    (stamp = semanage_policy_stamp(filename, loads)) == NULL) {
+		errno = 0;
+		return 0;
+	}
+	same = strcmp(buf, stamp) == 0;
+	free(stamp);
+	return same;
+}
+
+/* Records that the policy in 'filename' was just loaded, if that was
+ * the only load since the kernel had done 'before' of them.  Without a
+ * stamp the next commit loads its policy, so failing here only costs
+ * that. */
+static void semanage_policy_record_loaded(semanage_handle_t * sh,
+					  const char *filename, int have_before,
+					  uint32_t before)
+{
+	const char *stamp_filename;
+	char *stamp = NULL;
+	uint32_t loads;
+	FILE *fp;
+
+	if ((stamp_filename =
+	     semanage_path(SEMANAGE_ACTIVE, SEMANAGE_POLICY_LOADED)) == NULL)
+		return;
+	unlink(stamp_filename);
+	if (!have_before || semanage_policy_loads(&loads) < 0 ||
+	    loads != before + 1 ||
+	    (stamp = semanage_policy_stamp(filename, loads)) == NULL) {
+		errno = 0;
+		return;
+	}
+	if ((fp = fopen(stamp_filename, "w")) != NULL) {
+		if (fputs(stamp, fp) == EOF)
+			unlink(stamp_filename);
+		if (fclose(fp) == EOF)
+			unlink(stamp_filename);
+	} else {
+		WARN(sh, "Could not record the loaded policy in %s.",
+		     stamp_filename);
+	}
+	free(stamp);
+	errno = 0;
+}
+
 /* Actually load the contents of the current active directory into the
  * kernel.  Return 0 on success, -3 on error. */
 static int semanage_install_active(semanage_handle_t * sh)
 {
-	int retval = -3, r, len;
+	int retval = -3, r, len, have_loads;
+	uint32_t loads = 0;
 	char *storepath = NULL;
 	struct stat astore, istore;
 	const char *active_kernel = semanage_path(SEMANAGE_ACTIVE, SEMANAGE_KERNEL);
@@ -1209,13 +1601,26 @@ static int semanage_install_active(semanage_handle_t * sh)
 		goto skip_reload;
 	}
 
+	/* Reloading a policy the kernel already has would only flush
+	 * every access vector cache, e.g. when a commit changed seusers
+	 * alone. */
+	if (semanage_policy_is_loaded(active_kernel)) {
+		INFO(sh, "Policy unchanged, not reloading.");
+		goto skip_reload;
+	}
+
+	have_loads = semanage_policy_loads(&loads) == 0;
 	if (semanage_reload_policy(sh)) {
 		goto cleanup;
 	}
+	semanage_policy_record_loaded(sh, active_kernel, have_loads, loads);
 
       skip_reload:
 
-	if (sh->do_check_contexts && (r =
+	if (sh->do_check_contexts && sh->conf->setfiles == NULL) {
+		if (semanage_check_fc(sh, store_pol, store_fc) != 0)
+			goto cleanup;
+	} else if (sh->do_check_contexts && (r =
 	     semanage_exec_prog(sh, sh->conf->setfiles, store_pol,
 				store_fc)) != 0) {
 		ERR(sh, "setfiles returned error code %d.", r);
@@ -1284,23 +1689,24 @@ static int semanage_commit_sandbox(semanage_handle_t * sh)
 
 	retval = commit_number;
 
-	if (semanage_get_active_lock(sh) < 0) {
-		return -1;
-	}
-	/* make the backup of the current active directory */
+	/* Only committers, which hold the transaction lock, touch the
+	 * backup, so it is removed before taking the active lock and
+	 * holding up readers. */
 	if (stat(backup, &buf) == 0) {
 		if (S_ISDIR(buf.st_mode) &&
 		    semanage_remove_directory(backup) != 0) {
 			ERR(sh, "Could not remove previous backup %s.", backup);
-			retval = -1;
-			goto cleanup;
+			return -1;
 		}
 	} else if (errno != ENOENT) {
 		ERR(sh, "Could not stat directory %s.", backup);
-		retval = -1;
-		goto cleanup;
+		return -1;
 	}
 
+	if (semanage_get_active_lock(sh) < 0) {
+		return -1;
+	}
+	/* make the backup of the current active directory */
 	if (rename(active, backup) == -1) {
 		ERR(sh, "Error while renaming %s to %s.", active, backup);
 		retval = -1;
@@ -1339,15 +1745,17 @@ static int semanage_commit_sandbox(semanage_handle_t * sh)
 		goto cleanup;
 	}
 
+	semanage_release_active_lock(sh);
+
 	if (!sh->conf->save_previous) {
 		int errsv = errno;
-		retval = semanage_remove_directory(backup);
-		if (retval < 0) {
+		if (semanage_remove_directory(backup) < 0) {
 			ERR(sh, "Could not delete previous directory %s.", backup);
-			goto cleanup;
+			return -1;
 		}
 		errno = errsv;
 	}
+	return retval;
 
       cleanup:
 	semanage_release_active_lock(sh);
@@ -1364,21 +1772,6 @@ int semanage_install_sandbox(semanage_handle_t * sh)
 {
 	int retval = -1, commit_num = -1;
 
-	if (sh->conf->load_policy == NULL) {
-		ERR(sh,
-		    "No load_policy program specified in configuration file.");
-		goto cleanup;
-	}
-	if (sh->conf->setfiles == NULL) {
-		ERR(sh, "No setfiles program specified in configuration file.");
-		goto cleanup;
-	}
-
-	if (sh->conf->sefcontext_compile == NULL) {
-		ERR(sh, "No sefcontext_compile program specified in configuration file.");
-		goto cleanup;
-	}
-
 	if ((commit_num = semanage_commit_sandbox(sh)) < 0) {
 		retval = commit_num;
 		goto cleanup;
@@ -1393,8 +1786,12 @@ int semanage_install_sandbox(semanage_handle_t * sh)
 
 /********************* functions that manipulate lock *********************/
 
+/* Takes lock_file with flock() operation LOCK_EX or LOCK_SH, waiting
+ * as long as the handle's timeout allows.  Returns the locked file
+ * descriptor, or -1 on error. */
 static int semanage_get_lock(semanage_handle_t * sh,
-			     const char *lock_name, const char *lock_file)
+			     const char *lock_name, const char *lock_file,
+			     int operation)
 {
 	int fd;
 	struct timeval origtime, curtime;
@@ -1426,7 +1823,7 @@ static int semanage_get_lock(semanage_handle_t * sh,
 	do {
 		curtime.tv_sec = 1;
 		curtime.tv_usec = 0;
-		if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+		if (flock(fd, operation | LOCK_NB) == 0) {
 			got_lock = 1;
 			break;
 		} else if (errno != EAGAIN) {
@@ -1471,7 +1868,7 @@ int semanage_get_trans_lock(semanage_handle_t * sh)
 		return 0;
 
 	sh->u.direct.translock_file_fd =
-	    semanage_get_lock(sh, "transaction lock", lock_file);
+	    semanage_get_lock(sh, "transaction lock", lock_file, LOCK_EX);
 	if (sh->u.direct.translock_file_fd >= 0) {
 		return 0;
 	} else {
@@ -1483,19 +1880,47 @@ int semanage_get_trans_lock(semanage_handle_t * sh)
  * the file containing the commit number.  This is very basic locking
  * of the module store and doesn't do anything if the module store is
  * being manipulated with a program not using this library (but the
- * policy should prevent that).	 Returns 0 on success, -1 if it could
- * not obtain a lock.
+ * policy should prevent that).	 This takes the lock exclusively, to
+ * replace the active store; readers take it shared with
+ * semanage_get_active_shared_lock().  Returns 0 on success, -1 if it
+ * could not obtain a lock.
  */
 int semanage_get_active_lock(semanage_handle_t * sh)
 {
 	const char *lock_file = semanage_files[SEMANAGE_READ_LOCK];
 
+	if (sh->u.direct.activelock_file_fd >= 0) {
+		if (!sh->u.direct.activelock_shared)
+			return 0;
+		semanage_release_active_lock(sh);
+	}
+
+	sh->u.direct.activelock_file_fd =
+	    semanage_get_lock(sh, "read lock", lock_file, LOCK_EX);
+	if (sh->u.direct.activelock_file_fd >= 0) {
+		sh->u.direct.activelock_shared = 0;
+		return 0;
+	} else {
+		return -1;
+	}
+}
+
+/* Takes the active store lock shared, so that any number of readers
+ * can hold it at once; only a commit replacing the active store
+ * waits for them.  An exclusive lock already held is kept.  Returns
+ * 0 on success, -1 if it could not obtain a lock.
+ */
+int semanage_get_active_shared_lock(semanage_handle_t * sh)
+{
+	const char *lock_file = semanage_files[SEMANAGE_READ_LOCK];
+
 	if (sh->u.direct.activelock_file_fd >= 0)
 		return 0;
 
 	sh->u.direct.activelock_file_fd =
-	    semanage_get_lock(sh, "read lock", lock_file);
+	    semanage_get_lock(sh, "read lock", lock_file, LOCK_SH);
 	if (sh->u.direct.activelock_file_fd >= 0) {
+		sh->u.direct.activelock_shared = 1;
 		return 0;
 	} else {
 		return -1;
@@ -1587,7 +2012,9 @@ int semanage_direct_get_serial(semanage_handle_t * sh)
  * '*package'.	Caller is responsible for destroying it afterwards via
  * sepol_module_package_destroy().  Returns 0 on success, -1 on error.
  */
-static int semanage_load_module(semanage_handle_t * sh, const char *filename,
+static int semanage_read_module(semanage_handle_t * sh,
+				sepol_handle_t * sepolh, int report,
+				const char *filename,
 				sepol_module_package_t ** package)
 {
 	int retval = 0;
@@ -1596,17 +2023,21 @@ static int semanage_load_module(semanage_handle_t * sh, const char *filename,
 
 	*package = NULL;
 	if (sepol_module_package_create(package) == -1) {
-		ERR(sh, "Out of memory!");
+		if (report)
+			ERR(sh, "Out of memory!");
 		return -1;
 	}
 
 	if (sepol_policy_file_create(&pf)) {
-		ERR(sh, "Out of memory!");
+		if (report)
+			ERR(sh, "Out of memory!");
 		goto cleanup;
 	}
 
 	if ((fp = fopen(filename, "rb")) == NULL) {
-		ERR(sh, "Could not open module file %s for reading.", filename);
+		if (report)
+			ERR(sh, "Could not open module file %s for reading.",
+			    filename);
 		goto cleanup;
 	}
 	ssize_t size;
@@ -1619,9 +2050,11 @@ static int semanage_load_module(semanage_handle_t * sh, const char *filename,
 		__fsetlocking(fp, FSETLOCKING_BYCALLER);
 		sepol_policy_file_set_fp(pf, fp);
 	}
-	sepol_policy_file_set_handle(pf, sh->sepolh);
+	sepol_policy_file_set_handle(pf, sepolh);
 	if (sepol_module_package_read(*package, pf, 0) == -1) {
-		ERR(sh, "Error while reading from module file %s.", filename);
+		if (report)
+			ERR(sh, "Error while reading from module file %s.",
+			    filename);
 		fclose(fp);
 		free(data);
 		goto cleanup;
@@ -1638,10 +2071,103 @@ static int semanage_load_module(semanage_handle_t * sh, const char *filename,
 	return -1;
 }
 
-/* Links all of the modules within the sandbox into the base module.
- * '*base' will point to the module package that contains everything
- * linked together (caller must call sepol_module_package_destroy() on
- * it afterwards).  '*mods' will be a list of module packages and
+static int semanage_load_module(semanage_handle_t * sh, const char *filename,
+				sepol_module_package_t ** package)
+{
+	return semanage_read_module(sh, sh->sepolh, 1, filename, package);
+}
+
+/* Upper bound on the threads semanage_load_modules() starts, and the
+ * number of modules that make starting another one worthwhile. */
+#define SEMANAGE_LOAD_MAX_THREADS 8
+#define SEMANAGE_MODULES_PER_THREAD 8
+
+struct semanage_load_work {
+	semanage_handle_t *sh;
+	char **filenames;
+	sepol_module_package_t **mods;
+	int num_modules;
+	int next;		/* next module to load, taken atomically */
+};
+
+static void *semanage_load_worker(void *arg)
+{
+	struct semanage_load_work *work = arg;
+	sepol_handle_t *sepolh;
+	int i;
+
+	/* Errors are reported when the main thread loads a failed
+	 * module again, so the worker's handle stays silent. */
+	sepolh = sepol_handle_create();
+	if (!sepolh)
+		return NULL;
+	sepol_msg_set_callback(sepolh, NULL, NULL);
+
+	while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) <
+	       work->num_modules) {
+		if (semanage_read_module(work->sh, sepolh, 0,
+					 work->filenames[i],
+					 &work->mods[i]) == -1)
+			work->mods[i] = NULL;
+	}
+
+	sepol_handle_destroy(sepolh);
+	return NULL;
+}
+
+/* Load 'filenames' into 'mods', spreading the work over several
+ * threads when there are enough modules.  Any module that could not
+ * be loaded by a thread is loaded again here, so that its error is
+ * reported through the semanage handle as usual.  Returns 0 on
+ * success, -1 on error. */
+static int semanage_load_modules(semanage_handle_t * sh, char **filenames,
+				 sepol_module_package_t ** mods,
+				 int num_modules)
+{
+	struct semanage_load_work work;
+	pthread_t threads[SEMANAGE_LOAD_MAX_THREADS];
+	long ncpus;
+	int i, nthreads = 0, started = 0;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > 1) {
+		nthreads = num_modules / SEMANAGE_MODULES_PER_THREAD;
+		if (nthreads > ncpus)
+			nthreads = ncpus;
+		if (nthreads > SEMANAGE_LOAD_MAX_THREADS)
+			nthreads = SEMANAGE_LOAD_MAX_THREADS;
+	}
+
+	if (nthreads > 1) {
+		work.sh = sh;
+		work.filenames = filenames;
+		work.mods = mods;
+		work.num_modules = num_modules;
+		work.next = 0;
+		for (started = 0; started < nthreads; started++) {
+			if (pthread_create(&threads[started], NULL,
+					   semanage_load_worker, &work))
+				break;
+		}
+		/* if no thread could be started everything is loaded
+		 * below; otherwise the started ones finish the work */
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < num_modules; i++) {
+		if (started && mods[i])
+			continue;
+		if (semanage_load_module(sh, filenames[i], mods + i) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/* Links all of the modules within the sandbox into the base module.
+ * '*base' will point to the module package that contains everything
+ * linked together (caller must call sepol_module_package_destroy() on
+ * it afterwards).  '*mods' will be a list of module packages and
  * '*num_modules' will be the number of elements within '*mods'
  * (caller must destroy each element as well as the pointer itself.)
  * Both '*base' and '*mods' will be set to NULL upon entering this
@@ -1679,11 +2205,9 @@ int semanage_link_sandbox(semanage_handle_t * sh,
 		num_modules = 0;
 		goto cleanup;
 	}
-	for (i = 0; i < num_modules; i++) {
-		if (semanage_load_module(sh, module_filenames[i], mods + i) ==
-		    -1) {
-			goto cleanup;
-		}
+	if (semanage_load_modules(sh, module_filenames, mods, num_modules) ==
+	    -1) {
+		goto cleanup;
 	}
 
 	if (sepol_link_packages(sh->sepolh, *base, mods, num_modules, 0) != 0) {
@@ -1779,21 +2303,15 @@ int semanage_expand_sandbox(semanage_handle_t * sh,
 	return STATUS_ERR;
 }
 
-/**
- * Read the policy from the sandbox (kernel)
- */
-int semanage_read_policydb(semanage_handle_t * sh, sepol_policydb_t * in)
+static int semanage_read_policydb_file(semanage_handle_t * sh,
+				       sepol_policydb_t * in,
+				       const char *kernel_filename)
 {
 
 	int retval = STATUS_ERR;
-	const char *kernel_filename = NULL;
 	struct sepol_policy_file *pf = NULL;
 	FILE *infile = NULL;
 
-	if ((kernel_filename =
-	     semanage_path(SEMANAGE_ACTIVE, SEMANAGE_KERNEL)) == NULL) {
-		goto cleanup;
-	}
 	if ((infile = fopen(kernel_filename, "r")) == NULL) {
 		ERR(sh, "Could not open kernel policy %s for reading.",
 		    kernel_filename);
@@ -1820,21 +2338,16 @@ int semanage_read_policydb(semanage_handle_t * sh, sepol_policydb_t * in)
 	sepol_policy_file_free(pf);
 	return retval;
 }
-/**
- * Writes the final policy to the sandbox (kernel)
- */
-int semanage_write_policydb(semanage_handle_t * sh, sepol_policydb_t * out)
+
+static int semanage_write_policydb_file(semanage_handle_t * sh,
+					sepol_policydb_t * out,
+					const char *kernel_filename)
 {
 
 	int retval = STATUS_ERR;
-	const char *kernel_filename = NULL;
 	struct sepol_policy_file *pf = NULL;
 	FILE *outfile = NULL;
 
-	if ((kernel_filename =
-	     semanage_path(SEMANAGE_TMP, SEMANAGE_KERNEL)) == NULL) {
-		goto cleanup;
-	}
 	if ((outfile = fopen(kernel_filename, "wb")) == NULL) {
 		ERR(sh, "Could not open kernel policy %s for writing.",
 		    kernel_filename);
@@ -1862,114 +2375,448 @@ int semanage_write_policydb(semanage_handle_t * sh, sepol_policydb_t * out)
 	return retval;
 }
 
-/* Execute the module verification programs for each source module.
- * Returns 0 if every verifier returned success, -1 on error.
+/**
+ * Read the policy from the sandbox (kernel)
  */
-int semanage_verify_modules(semanage_handle_t * sh,
-			    char **module_filenames, int num_modules)
+int semanage_read_policydb(semanage_handle_t * sh, sepol_policydb_t * in)
 {
-	int i, retval;
-	semanage_conf_t *conf = sh->conf;
-	if (conf->mod_prog == NULL) {
-		return 0;
+	const char *kernel_filename;
+
+	if ((kernel_filename =
+	     semanage_path(SEMANAGE_ACTIVE, SEMANAGE_KERNEL)) == NULL) {
+		return STATUS_ERR;
 	}
-	for (i = 0; i < num_modules; i++) {
-		char *module = module_filenames[i];
-		external_prog_t *e;
-		for (e = conf->mod_prog; e != NULL; e = e->next) {
-			if ((retval =
-			     semanage_exec_prog(sh, e, module, "$<")) != 0) {
-				return -1;
-			}
+	return semanage_read_policydb_file(sh, in, kernel_filename);
+}
+
+/**
+ * Writes the final policy to the sandbox (kernel)
+ */
+/**
+ * Writes the query index of the kernel policy next to it, or removes
+ * a stale one carried over from the active store if the index is not
+ * wanted.
+ */
+static int semanage_write_policy_index(semanage_handle_t * sh,
+				       sepol_policydb_t * out)
+{
+	const char *index_filename;
+	FILE *fp;
+	int retval;
+
+	if ((index_filename =
+	     semanage_path(SEMANAGE_TMP, SEMANAGE_POLICY_INDEX)) == NULL) {
+		return STATUS_ERR;
+	}
+	if (!sh->conf->policy_index) {
+		if (unlink(index_filename) < 0 && errno != ENOENT) {
+			ERR(sh, "Could not remove %s.", index_filename);
+			return STATUS_ERR;
 		}
+		return STATUS_SUCCESS;
 	}
-	return 0;
+
+	if ((fp = fopen(index_filename, "wb")) == NULL) {
+		ERR(sh, "Could not open policy index %s for writing.",
+		    index_filename);
+		return STATUS_ERR;
+	}
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+	retval = sepol_policy_index_write(sh->sepolh, out, fp);
+	if (fclose(fp) != 0)
+		retval = -1;
+	if (retval < 0) {
+		ERR(sh, "Error while writing policy index to %s.",
+		    index_filename);
+		unlink(index_filename);
+		return STATUS_ERR;
+	}
+	return STATUS_SUCCESS;
 }
 
-/* Execute the linker verification programs for the linked (but not
- * expanded) base.  Returns 0 if every verifier returned success, -1
- * on error.
+int semanage_write_policydb(semanage_handle_t * sh, sepol_policydb_t * out)
+{
+	const char *kernel_filename;
+
+	if ((kernel_filename =
+	     semanage_path(SEMANAGE_TMP, SEMANAGE_KERNEL)) == NULL) {
+		return STATUS_ERR;
+	}
+	if (semanage_write_policydb_file(sh, out, kernel_filename) < 0)
+		return STATUS_ERR;
+	return semanage_write_policy_index(sh, out);
+}
+
+/********************* expanded policy cache *********************/
+
+uint64_t semanage_fnv1a(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= FNV1A_64_PRIME;
+	}
+	return h;
+}
+
+/* Folds the base name and the contents of a module file into the
+ * running hash.  Returns 0 on success, -1 on error. */
+static int semanage_fingerprint_file(semanage_handle_t * sh,
+				     const char *filename, uint64_t * h)
+{
+	char buf[BUFSIZ];
+	const char *name = strrchr(filename, '/');
+	size_t n;
+	FILE *fp;
+	int retval = 0;
+
+	name = name ? name + 1 : filename;
+	*h = semanage_fnv1a(*h, name, strlen(name) + 1);
+
+	if ((fp = fopen(filename, "r")) == NULL) {
+		ERR(sh, "Could not open module file %s for reading.", filename);
+		return -1;
+	}
+	__fsetlocking(fp, FSETLOCKING_BYCALLER);
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		*h = semanage_fnv1a(*h, buf, n);
+	if (ferror(fp)) {
+		ERR(sh, "Could not read module file %s.", filename);
+		retval = -1;
+	}
+	fclose(fp);
+	return retval;
+}
+
+/* Computes a fingerprint of everything the expanded kernel policy
+ * is built from: the sandbox base module, the enabled modules, and
+ * the settings that influence linking and expansion.  The result is
+ * a hex string that the caller must free().  Returns 0 on success,
+ * -1 on error.
  */
-int semanage_verify_linked(semanage_handle_t * sh)
+int semanage_expanded_fingerprint(semanage_handle_t * sh, char **fingerprint)
 {
-	external_prog_t *e;
-	semanage_conf_t *conf = sh->conf;
-	const char *linked_filename =
-	    semanage_path(SEMANAGE_TMP, SEMANAGE_LINKED);
-	int retval = -1;
-	if (conf->linked_prog == NULL) {
-		return 0;
+	const char *base_filename;
+	char **module_filenames = NULL;
+	int num_modules = 0, i, retval = -1;
+	int settings[4];
+	uint64_t h = FNV1A_64_INIT;
+
+	*fingerprint = NULL;
+
+	settings[0] = sh->conf->policyvers;
+	settings[1] = sh->conf->handle_unknown;
+	settings[2] = sepol_get_disable_dontaudit(sh->sepolh);
+	settings[3] = sepol_get_preserve_tunables(sh->sepolh);
+	h = semanage_fnv1a(h, settings, sizeof(settings));
+
+	if ((base_filename =
+	     semanage_path(SEMANAGE_TMP, SEMANAGE_BASE)) == NULL ||
+	    semanage_fingerprint_file(sh, base_filename, &h) == -1) {
+		goto cleanup;
 	}
-	for (e = conf->linked_prog; e != NULL; e = e->next) {
-		if (semanage_exec_prog(sh, e, linked_filename, "$<") != 0) {
+	if (semanage_get_active_modules_names(sh, &module_filenames,
+					      &num_modules) == -1) {
+		goto cleanup;
+	}
+	for (i = 0; i < num_modules; i++) {
+		if (semanage_fingerprint_file(sh, module_filenames[i], &h) == -1)
 			goto cleanup;
-		}
+	}
+
+	if (asprintf(fingerprint, "%016llx", (unsigned long long)h) < 0) {
+		ERR(sh, "Out of memory!");
+		*fingerprint = NULL;
+		goto cleanup;
 	}
 	retval = 0;
+
       cleanup:
+	for (i = 0; module_filenames != NULL && i < num_modules; i++) {
+		free(module_filenames[i]);
+	}
+	free(module_filenames);
 	return retval;
 }
 
-/* Execute each of the kernel verification programs.  Returns 0 if
- * every verifier returned success, -1 on error.
+/* Loads the expanded policy saved by a previous commit if it was
+ * built from inputs with the given fingerprint.  Returns 1 and sets
+ * *policydb on a hit, 0 if there is no usable cached policy, and -1
+ * on error.
  */
-int semanage_verify_kernel(semanage_handle_t * sh)
+int semanage_read_expanded(semanage_handle_t * sh, const char *fingerprint,
+			   sepol_policydb_t ** policydb)
 {
-	int retval = -1;
-	const char *kernel_filename =
-	    semanage_path(SEMANAGE_TMP, SEMANAGE_KERNEL);
-	semanage_conf_t *conf = sh->conf;
-	external_prog_t *e;
-	if (conf->kernel_prog == NULL) {
+	const char *inputs_filename, *expanded_filename;
+	char buf[64];
+	size_t n;
+	FILE *fp;
+	sepol_policydb_t *in = NULL;
+
+	*policydb = NULL;
+
+	if ((inputs_filename =
+	     semanage_path(SEMANAGE_TMP, SEMANAGE_EXPANDED_INPUTS)) == NULL ||
+	    (expanded_filename =
+	     semanage_path(SEMANAGE_TMP, SEMANAGE_EXPANDED)) == NULL) {
+		return -1;
+	}
+
+	if ((fp = fopen(inputs_filename, "r")) == NULL) {
+		errno = 0;
 		return 0;
 	}
-	for (e = conf->kernel_prog; e != NULL; e = e->next) {
-		if (semanage_exec_prog(sh, e, kernel_filename, "$<") != 0) {
-			goto cleanup;
-		}
+	n = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[n] = '\0';
+	if (strcmp(buf, fingerprint) != 0 ||
+	    access(expanded_filename, R_OK) == -1) {
+		errno = 0;
+		return 0;
 	}
-	retval = 0;
-      cleanup:
-	return retval;
+
+	if (sepol_policydb_create(&in)) {
+		ERR(sh, "Out of memory!");
+		return -1;
+	}
+	if (semanage_read_policydb_file(sh, in, expanded_filename) < 0) {
+		sepol_policydb_free(in);
+		return -1;
+	}
+	*policydb = in;
+	return 1;
 }
 
-/********************* functions that sort file contexts *********************/
+/* Saves a freshly expanded policy, before any local modifications
+ * are merged into it, along with the fingerprint of its inputs so
+ * that later commits which leave the modules alone can skip linking
+ * and expansion.  Returns 0 on success, -1 on error.
+ */
+int semanage_write_expanded(semanage_handle_t * sh, const char *fingerprint,
+			    sepol_policydb_t * policydb)
+{
+	const char *inputs_filename, *expanded_filename;
+	FILE *fp;
+
+	if ((inputs_filename =
+	     semanage_path(SEMANAGE_TMP, SEMANAGE_EXPANDED_INPUTS)) == NULL ||
+	    (expanded_filename =
+	     semanage_path(SEMANAGE_TMP, SEMANAGE_EXPANDED)) == NULL) {
+		return -1;
+	}
+
+	/* Drop the old fingerprint first so that a failure below never
+	 * leaves it pointing at a policy built from other inputs. */
+	if (unlink(inputs_filename) == -1 && errno != ENOENT) {
+		ERR(sh, "Could not remove %s.", inputs_filename);
+		return -1;
+	}
+	errno = 0;
 
-/* Free the given node. */
-static void semanage_fc_node_destroy(semanage_file_context_node_t * x)
+	if (semanage_write_policydb_file(sh, policydb, expanded_filename) < 0)
+		return -1;
+
+	if ((fp = fopen(inputs_filename, "w")) == NULL) {
+		ERR(sh, "Could not open %s for writing.", inputs_filename);
+		return -1;
+	}
+	if (fputs(fingerprint, fp) == EOF) {
+		ERR(sh, "Could not write to %s.", inputs_filename);
+		fclose(fp);
+		return -1;
+	}
+	if (fclose(fp) != 0) {
+		ERR(sh, "Could not write to %s.", inputs_filename);
+		return -1;
+	}
+	return 0;
+}
+
+/* Verification programs running in the background.  At most 'max'
+ * run at once; when the pool is full the oldest is waited for before
+ * the next one starts. */
+struct semanage_verify {
+	pid_t *pids;
+	external_prog_t **progs;
+	int head, count, max;
+	int failed;
+};
+
+static semanage_verify_t *semanage_verify_create(semanage_handle_t * sh)
 {
-	free(x->path);
-	free(x->file_type);
-	free(x->context);
-	free(x);
+	semanage_verify_t *v;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	v = calloc(1, sizeof(*v));
+	if (v == NULL)
+		goto omem;
+	v->max = ncpus > 0 ? ncpus : 1;
+	v->pids = calloc(v->max, sizeof(*v->pids));
+	v->progs = calloc(v->max, sizeof(*v->progs));
+	if (v->pids == NULL || v->progs == NULL)
+		goto omem;
+	return v;
+
+      omem:
+	ERR(sh, "Out of memory!");
+	if (v) {
+		free(v->pids);
+		free(v->progs);
+		free(v);
+	}
+	return NULL;
 }
 
-/* Free the linked list of nodes starting at the given node. */
-static void semanage_fc_node_list_destroy(semanage_file_context_node_t * x)
+/* Wait for the oldest running verifier. */
+static void semanage_verify_reap(semanage_handle_t * sh, semanage_verify_t * v)
 {
-	semanage_file_context_node_t *temp;
+	if (semanage_wait_prog(sh, v->progs[v->head], v->pids[v->head]) != 0)
+		v->failed = 1;
+	v->head = (v->head + 1) % v->max;
+	v->count--;
+}
 
-	while (x) {
-		temp = x;
-		x = x->next;
-		semanage_fc_node_destroy(temp);
+/* Start verifier 'e' on 'filename', waiting for a free slot first.
+ * Returns 0 if it was started, -1 on error. */
+static int semanage_verify_run(semanage_handle_t * sh, semanage_verify_t * v,
+			       external_prog_t * e, const char *filename)
+{
+	pid_t pid;
+	int slot;
+
+	if (v->count == v->max)
+		semanage_verify_reap(sh, v);
+	pid = semanage_spawn_prog(sh, e, filename, "$<");
+	if (pid < 0) {
+		v->failed = 1;
+		return -1;
 	}
+	slot = (v->head + v->count) % v->max;
+	v->pids[slot] = pid;
+	v->progs[slot] = e;
+	v->count++;
+	return 0;
 }
 
-/* Free the linked list of buckets (and their node lists) 
- * starting at the given bucket. */
-static void semanage_fc_bucket_list_destroy(semanage_file_context_bucket_t * x)
+/* Start each program of 'progs' on 'filename'.  Returns 0 with *verify
+ * set, and NULL if there is nothing to run, or -1 on error, after the
+ * programs already started have finished. */
+static int semanage_verify_start(semanage_handle_t * sh,
+				 external_prog_t * progs, const char *filename,
+				 semanage_verify_t ** verify)
 {
-	semanage_file_context_bucket_t *temp;
+	semanage_verify_t *v;
+	external_prog_t *e;
 
-	while (x) {
-		temp = x;
-		x = x->next;
-		semanage_fc_node_list_destroy(temp->data);
-		free(temp);
+	*verify = NULL;
+	if (progs == NULL)
+		return 0;
+	if (filename == NULL || (v = semanage_verify_create(sh)) == NULL)
+		return -1;
+	for (e = progs; e != NULL; e = e->next) {
+		if (semanage_verify_run(sh, v, e, filename) < 0) {
+			semanage_verify_finish(sh, v);
+			return -1;
+		}
 	}
+	*verify = v;
+	return 0;
+}
+
+int semanage_verify_finish(semanage_handle_t * sh, semanage_verify_t * v)
+{
+	int failed;
+
+	if (v == NULL)
+		return 0;
+	while (v->count)
+		semanage_verify_reap(sh, v);
+	failed = v->failed;
+	free(v->pids);
+	free(v->progs);
+	free(v);
+	return failed ? -1 : 0;
 }
 
+/* Execute the module verification programs for each source module,
+ * several modules at a time.  Returns 0 if every verifier returned
+ * success, -1 on error.
+ */
+int semanage_verify_modules(semanage_handle_t * sh,
+			    char **module_filenames, int num_modules)
+{
+	semanage_conf_t *conf = sh->conf;
+	semanage_verify_t *v;
+	external_prog_t *e;
+	int i;
+
+	if (conf->mod_prog == NULL || num_modules == 0) {
+		return 0;
+	}
+	if ((v = semanage_verify_create(sh)) == NULL)
+		return -1;
+	/* stop starting new verifiers once one has failed */
+	for (i = 0; i < num_modules && !v->failed; i++) {
+		for (e = conf->mod_prog; e != NULL && !v->failed; e = e->next) {
+			if (semanage_verify_run(sh, v, e,
+						module_filenames[i]) < 0)
+				break;
+		}
+	}
+	return semanage_verify_finish(sh, v);
+}
+
+/* Start the linker verification programs for the linked (but not
+ * expanded) base; semanage_verify_finish() collects them.  Returns 0
+ * on success, -1 on error.
+ */
+int semanage_verify_linked_start(semanage_handle_t * sh,
+				 semanage_verify_t ** verify)
+{
+	return semanage_verify_start(sh, sh->conf->linked_prog,
+				     semanage_path(SEMANAGE_TMP,
+						   SEMANAGE_LINKED), verify);
+}
+
+/* Execute the linker verification programs for the linked (but not
+ * expanded) base.  Returns 0 if every verifier returned success, -1
+ * on error.
+ */
+int semanage_verify_linked(semanage_handle_t * sh)
+{
+	semanage_verify_t *v;
+
+	if (semanage_verify_linked_start(sh, &v) < 0)
+		return -1;
+	return semanage_verify_finish(sh, v);
+}
+
+/* Start each of the kernel verification programs; as for
+ * semanage_verify_linked_start(). */
+int semanage_verify_kernel_start(semanage_handle_t * sh,
+				 semanage_verify_t ** verify)
+{
+	return semanage_verify_start(sh, sh->conf->kernel_prog,
+				     semanage_path(SEMANAGE_TMP,
+						   SEMANAGE_KERNEL), verify);
+}
+
+/* Execute each of the kernel verification programs.  Returns 0 if
+ * every verifier returned success, -1 on error.
+ */
+int semanage_verify_kernel(semanage_handle_t * sh)
+{
+	semanage_verify_t *v;
+
+	if (semanage_verify_kernel_start(sh, &v) < 0)
+		return -1;
+	return semanage_verify_finish(sh, v);
+}
+
+/********************* functions that sort file contexts *********************/
+
 /* Compares two file contexts' regular expressions and returns:
  *    -1 if a is less specific than b
  *     0 if a and be are equally specific
@@ -1988,8 +2835,8 @@ static void semanage_fc_bucket_list_destroy(semanage_file_context_bucket_t * x)
  * now.  A proper comparison would determine which (if either)
  * regular expression is a subset of the other.
  */
-static int semanage_fc_compare(semanage_file_context_node_t * a,
-			       semanage_file_context_node_t * b)
+static int semanage_fc_compare(const semanage_file_context_node_t * a,
+			       const semanage_file_context_node_t * b)
 {
 	int a_has_meta = (a->meta >= 0);
 	int b_has_meta = (b->meta >= 0);
@@ -2027,95 +2874,17 @@ static int semanage_fc_compare(semanage_file_context_node_t * a,
 	return 0;
 }
 
-/* Merges two sorted file context linked lists into a single sorted one.
- * The left list is assumed to represent nodes that came first in the original ordering. 
- * The final sorted list is returned.
- */
-static semanage_file_context_node_t
-    * semanage_fc_merge(semanage_file_context_node_t * left,
-			semanage_file_context_node_t * right)
+/* qsort() comparator sorting file contexts from least specific to
+ * most specific.  Equally specific contexts keep their relative
+ * order from the input, as in a stable sort. */
+static int semanage_fc_qsort_compare(const void *p1, const void *p2)
 {
-	semanage_file_context_node_t *head;
-	semanage_file_context_node_t *current;
-	semanage_file_context_node_t *tail;
-
-	if (!left)
-		return right;
-
-	if (!right)
-		return left;
+	const semanage_file_context_node_t *a = p1, *b = p2;
+	int rc = semanage_fc_compare(a, b);
 
-	if (semanage_fc_compare(left, right) == 1) {
-		head = tail = right;
-		right = right->next;
-	} else {
-		head = tail = left;
-		left = left->next;
-	}
-
-	while (left && right) {
-		/* if left was more specific than right,
-		 * insert right before left.  Otherwise leave order alone. */
-		if (semanage_fc_compare(left, right) == 1) {
-			current = right;
-			right = right->next;
-		} else {
-			current = left;
-			left = left->next;
-		}
-
-		tail = tail->next = current;
-	}
-
-	tail->next = (left != NULL) ? left : right;
-
-	return head;
-}
-
-/* Sorts file contexts from least specific to most specific.
- * A bucket linked list is passed in.  Upon completion,
- * there is only one bucket (pointed to by master) that 
- * contains a linked list of all the file contexts in sorted order.
- * Explanation of the algorithm:
- *  This is a stable implementation of an iterative merge sort.
- *  Each bucket initially has a linked list of file contexts
- *   that are 1 node long.
- *  Each pass, buckets (and the nodes they contain) are merged 
- *   two at time.
- *  Buckets are merged until there is only one bucket left, 
- *   containing the list of file contexts, sorted.
- */
-static void semanage_fc_merge_sort(semanage_file_context_bucket_t * master)
-{
-	semanage_file_context_bucket_t *current;
-	semanage_file_context_bucket_t *temp;
-
-	/* Loop until master is the only bucket left.
-	 * When we stop master contains the sorted list. */
-	while (master->next) {
-		current = master;
-
-		/* Merge buckets two-by-two. 
-		 * If there is an odd number of buckets, the last 
-		 * bucket will be left alone, which corresponds 
-		 * to the operation of merging it with an empty bucket. */
-		while (current) {
-			if (current->next) {
-				current->data =
-				    semanage_fc_merge(current->data,
-						      current->next->data);
-				temp = current->next;
-				current->next = current->next->next;
-
-				/* Free the (now empty) second bucket.
-				 * (This does not touch the node list
-				 * in the bucket because it has been 
-				 * shifted over to the first bucket. */
-				free(temp);
-			}
-			current = current->next;
-		}
-	}
+	if (rc != 0)
+		return rc;
+	return (a->order > b->order) - (a->order < b->order);
 }
 
 /* Compute the location of the first regular expression 
@@ -2134,7 +2903,7 @@ static void semanage_fc_find_meta(semanage_file_context_node_t * fc_node)
 	/* Note: this while loop has been adapted from
 	 *  spec_hasMetaChars in matchpathcon.c from
 	 *  libselinux-1.22. */
-	while (fc_node->path[c] != '\0') {
+	while (c < fc_node->path_len) {
 		switch (fc_node->path[c]) {
 		case '.':
 		case '^':
@@ -2163,20 +2932,12 @@ static void semanage_fc_find_meta(semanage_file_context_node_t * fc_node)
 /* Replicates strchr, but limits search to buf_len characters. */
 static char *semanage_strnchr(const char *buf, size_t buf_len, char c)
 {
-	size_t idx = 0;
-
 	if (buf == NULL)
 		return NULL;
 	if (buf_len <= 0)
 		return NULL;
 
-	while (idx < buf_len) {
-		if (buf[idx] == c)
-			return (char *)buf + idx;
-		idx++;
-	}
-
-	return NULL;
+	return memchr(buf, c, buf_len);
 }
 
 /* Returns a pointer to the end of line character in the given buffer.
@@ -2212,17 +2973,14 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 		     char **sorted_buf, size_t * sorted_buf_len)
 {
 	size_t start, finish, regex_len, type_len, context_len;
-	size_t line_len, buf_remainder, i;
+	size_t line_len, buf_remainder, i, n, num_nodes, max_nodes;
 	ssize_t sanity_check;
 	const char *line_buf, *line_end;
 	char *sorted_buf_pos;
 	int escape_chars, just_saw_escape;
 
+	semanage_file_context_node_t *nodes;
 	semanage_file_context_node_t *temp;
-	semanage_file_context_node_t *head;
-	semanage_file_context_node_t *current;
-	semanage_file_context_bucket_t *master;
-	semanage_file_context_bucket_t *bcurrent;
 
 	i = 0;
 
@@ -2238,18 +2996,24 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 		return -1;
 	}
 
-	/* Initialize the head of the linked list 
-	 * that will contain a node for each file context line. */
-	head = current =
-	    (semanage_file_context_node_t *) calloc(1,
-						    sizeof
-						    (semanage_file_context_node_t));
-	if (!head) {
+	/* Every file context ends in one of the characters
+	 * semanage_get_line_end() looks for, so counting those
+	 * bounds the number of nodes needed. */
+	max_nodes = 1;
+	for (i = 0; i < buf_len; i++) {
+		if (buf[i] == '\n' || buf[i] == '\r' || buf[i] == (char)EOF)
+			max_nodes++;
+	}
+
+	nodes = calloc(max_nodes, sizeof(*nodes));
+	if (!nodes) {
 		ERR(sh, "Failure allocating memory.");
 		return -1;
 	}
+	num_nodes = 0;
 
-	/* Parse the char buffer into a semanage_file_context_node_t linked list. */
+	/* Parse the char buffer into an array of nodes,
+	 * one for each file context line. */
 	line_buf = buf;
 	buf_remainder = buf_len;
 	while ((line_end = semanage_get_line_end(line_buf, buf_remainder))) {
@@ -2257,9 +3021,9 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 		sanity_check = buf_remainder - line_len;
 		buf_remainder = buf_remainder - line_len;
 
-		if (sanity_check < 0) {
+		if (sanity_check < 0 || num_nodes == max_nodes) {
 			ERR(sh, "Failure parsing file context buffer.");
-			semanage_fc_node_list_destroy(head);
+			free(nodes);
 			return -1;
 		}
 
@@ -2286,17 +3050,8 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 			continue;
 		}
 
-		/* Allocate a new node. */
-		temp =
-		    (semanage_file_context_node_t *) calloc(1,
-							    sizeof
-							    (semanage_file_context_node_t));
-		if (!temp) {
-			ERR(sh, "Failure allocating memory.");
-			semanage_fc_node_list_destroy(head);
-			return -1;
-		}
-		temp->next = NULL;
+		/* Take the next free node. */
+		temp = &nodes[num_nodes];
 
 		/* Extract the regular expression from the line. */
 		escape_chars = 0;
@@ -2323,18 +3078,12 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 		if (regex_len == 0) {
 			ERR(sh,
 			    "WARNING: semanage_fc_sort: Regex of length 0.");
-			semanage_fc_node_destroy(temp);
 			line_buf = line_end + 1;
 			continue;
 		}
 
-		temp->path = (char *)strndup(&line_buf[start], regex_len);
-		if (!temp->path) {
-			ERR(sh, "Failure allocating memory.");
-			semanage_fc_node_destroy(temp);
-			semanage_fc_node_list_destroy(head);
-			return -1;
-		}
+		temp->path = &line_buf[start];
+		temp->path_len = regex_len;
 
 		/* Skip the whitespace after the regular expression. */
 		for (; i < line_len; i++) {
@@ -2343,8 +3092,8 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 		}
 		if (i == line_len) {
 			ERR(sh,
-			    "WARNING: semanage_fc_sort: Incomplete context. %s", temp->path);
-			semanage_fc_node_destroy(temp);
+			    "WARNING: semanage_fc_sort: Incomplete context. %.*s",
+			    temp->path_len, temp->path);
 			line_buf = line_end + 1;
 			continue;
 		}
@@ -2355,21 +3104,14 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 
 			if (i + type_len >= line_len) {
 				ERR(sh,
-				    "WARNING: semanage_fc_sort: Incomplete context. %s", temp->path);
-				semanage_fc_node_destroy(temp);
+				    "WARNING: semanage_fc_sort: Incomplete context. %.*s",
+				    temp->path_len, temp->path);
 				line_buf = line_end + 1;
 				continue;
 			}
 
 			/* Record the inode type. */
-			temp->file_type =
-			    (char *)strndup(&line_buf[i], type_len);
-			if (!temp->file_type) {
-				ERR(sh, "Failure allocating memory.");
-				semanage_fc_node_destroy(temp);
-				semanage_fc_node_list_destroy(head);
-				return -1;
-			}
+			temp->file_type = &line_buf[i];
 
 			i += type_len;
 
@@ -2380,13 +3122,14 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 			}
 			if (i == line_len) {
 				ERR(sh,
-				    "WARNING: semanage_fc_sort: Incomplete context. %s", temp->path);
-				semanage_fc_node_destroy(temp);
+				    "WARNING: semanage_fc_sort: Incomplete context. %.*s",
+				    temp->path_len, temp->path);
 				line_buf = line_end + 1;
 				continue;
 			}
 		} else {
 			type_len = 0;	/* inode type did not exist in the file context */
+			temp->file_type = NULL;
 		}
 
 		/* Extract the context from the line. */
@@ -2396,80 +3139,34 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 		finish = i;
 		context_len = finish - start;
 
-		temp->context = (char *)strndup(&line_buf[start], context_len);
-		if (!temp->context) {
-			ERR(sh, "Failure allocating memory.");
-			semanage_fc_node_destroy(temp);
-			semanage_fc_node_list_destroy(head);
-			return -1;
-		}
+		temp->context = &line_buf[start];
 
 		/* Initialize the data about the file context. */
-		temp->path_len = regex_len;
 		temp->effective_len = regex_len - escape_chars;
 		temp->type_len = type_len;
 		temp->context_len = context_len;
+		temp->order = num_nodes;
 		semanage_fc_find_meta(temp);
 
-		/* Add this node to the end of the linked list. */
-		current->next = temp;
-		current = current->next;
-
+		num_nodes++;
 		line_buf = line_end + 1;
 	}
 
-	/* Create the bucket linked list from the node linked list. */
-	current = head->next;
-	bcurrent = master = (semanage_file_context_bucket_t *)
-	    calloc(1, sizeof(semanage_file_context_bucket_t));
-	if (!master) {
-		ERR(sh, "Failure allocating memory.");
-		semanage_fc_node_list_destroy(head);
-		return -1;
-	}
-
-	/* Free the head node, as it is no longer used. */
-	semanage_fc_node_destroy(head);
-	head = NULL;
-
-	/* Place each node into a bucket. */
-	while (current) {
-		bcurrent->data = current;
-		current = current->next;
-
-		/* Detach the node in the bucket from the old list. */
-		bcurrent->data->next = NULL;
-
-		/* If we need another bucket, add one to the end. */
-		if (current) {
-			bcurrent->next = (semanage_file_context_bucket_t *)
-			    calloc(1, sizeof(semanage_file_context_bucket_t));
-			if (!(bcurrent->next)) {
-				ERR(sh, "Failure allocating memory.");
-				semanage_fc_bucket_list_destroy(master);
-				return -1;
-			}
-
-			bcurrent = bcurrent->next;
-		}
-	}
-
-	/* Sort the bucket list. */
-	semanage_fc_merge_sort(master);
+	/* Sort the nodes. */
+	qsort(nodes, num_nodes, sizeof(*nodes), semanage_fc_qsort_compare);
 
 	/* First, calculate how much space we'll need for 
 	 * the newly sorted block of data.  (We don't just
 	 * use buf_len for this because we have extracted
 	 * comments and whitespace.) */
 	i = 0;
-	current = master->data;
-	while (current) {
-		i += current->path_len + 1;	/* +1 for a tab */
-		if (current->file_type) {
-			i += current->type_len + 1;	/* +1 for a tab */
+	for (n = 0; n < num_nodes; n++) {
+		temp = &nodes[n];
+		i += temp->path_len + 1;	/* +1 for a tab */
+		if (temp->file_type) {
+			i += temp->type_len + 1;	/* +1 for a tab */
 		}
-		i += current->context_len + 1;	/* +1 for a newline */
-		current = current->next;
+		i += temp->context_len + 1;	/* +1 for a newline */
 	}
 	i = i + 1;		/* +1 for trailing \0 */
 
@@ -2477,38 +3174,37 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 	*sorted_buf = calloc(i, sizeof(char));
 	if (!*sorted_buf) {
 		ERR(sh, "Failure allocating memory.");
-		semanage_fc_bucket_list_destroy(master);
+		free(nodes);
 		return -1;
 	}
 	*sorted_buf_len = i;
 
-	/* Output the sorted semanage_file_context linked list to the char buffer. */
+	/* Output the sorted file contexts to the char buffer. */
 	sorted_buf_pos = *sorted_buf;
-	current = master->data;
-	while (current) {
+	for (n = 0; n < num_nodes; n++) {
+		temp = &nodes[n];
+
 		/* Output the path. */
-		i = current->path_len + 1;	/* +1 for tab */
-		snprintf(sorted_buf_pos, i + 1, "%s\t", current->path);
-		sorted_buf_pos = sorted_buf_pos + i;
+		memcpy(sorted_buf_pos, temp->path, temp->path_len);
+		sorted_buf_pos += temp->path_len;
+		*sorted_buf_pos++ = '\t';
 
 		/* Output the type, if there is one. */
-		if (current->file_type) {
-			i = strlen(current->file_type) + 1;	/* +1 for tab */
-			snprintf(sorted_buf_pos, i + 1, "%s\t",
-				 current->file_type);
-			sorted_buf_pos = sorted_buf_pos + i;
+		if (temp->file_type) {
+			memcpy(sorted_buf_pos, temp->file_type,
+			       temp->type_len);
+			sorted_buf_pos += temp->type_len;
+			*sorted_buf_pos++ = '\t';
 		}
 
 		/* Output the context. */
-		i = strlen(current->context) + 1;	/* +1 for newline */
-		snprintf(sorted_buf_pos, i + 1, "%s\n", current->context);
-		sorted_buf_pos = sorted_buf_pos + i;
-
-		current = current->next;
+		memcpy(sorted_buf_pos, temp->context, temp->context_len);
+		sorted_buf_pos += temp->context_len;
+		*sorted_buf_pos++ = '\n';
 	}
 
 	/* Clean up. */
-	semanage_fc_bucket_list_destroy(master);
+	free(nodes);
 
 	/* Sanity check. */
 	sorted_buf_pos++;
@@ -2526,21 +3222,6 @@ int semanage_fc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 #define NC_SORT_NAMES { "pre", "base", "module", "local", "post" }
 #define NC_SORT_NAMES_LEN { 3, 4, 6, 5, 4 }
 #define NC_SORT_NEL 5
-static void semanage_nc_destroy_ruletab(semanage_netfilter_context_node_t *
-					ruletab[NC_SORT_NEL][2])
-{
-	semanage_netfilter_context_node_t *curr, *next;
-	int i;
-
-	for (i = 0; i < NC_SORT_NEL; i++) {
-		for (curr = ruletab[i][0]; curr != NULL; curr = next) {
-			next = curr->next;
-			free(curr->rule);
-			free(curr);
-		}
-	}
-}
-
 /*  Entry function for sorting a set of netfilter context lines.
  *  Returns 0 on success, -1 on failure.
  *  Allocates a buffer pointed to by sorted_buf that contains the sorted lines.
@@ -2558,19 +3239,29 @@ int semanage_nc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 	size_t line_len, buf_remainder, i, offset;
 	const char *line_buf, *line_end;
 
-	/* ruletab bits */
-	/* keep track of the head (index 0) and tail (index 1) with this array */
-	semanage_netfilter_context_node_t *ruletab[NC_SORT_NEL][2];
-	semanage_netfilter_context_node_t *curr, *node;
+	/* the rules, in input order */
+	semanage_netfilter_context_node_t *rules, *node;
+	size_t num_rules, max_rules;
 	int priority;
 
-	/* sorted buffer bits */
-	char *sorted_buf_pos;
+	/* sorted buffer bits: where the next rule of each priority goes */
+	size_t pos[NC_SORT_NEL];
 	size_t count;
 
-	/* initialize ruletab */
-	memset(ruletab, 0,
-	       NC_SORT_NEL * 2 * sizeof(semanage_netfilter_context_node_t *));
+	/* Each rule ends at one of the characters semanage_get_line_end()
+	 * looks for, so counting those bounds the number of rules. */
+	max_rules = 1;
+	for (i = 0; i < buf_len; i++) {
+		if (buf[i] == '\n' || buf[i] == '\r' || buf[i] == (char)EOF)
+			max_rules++;
+	}
+	rules = malloc(max_rules * sizeof(*rules));
+	if (!rules) {
+		ERR(sh, "Failure allocating memory.");
+		return -1;
+	}
+	num_rules = 0;
+	memset(pos, 0, sizeof(pos));
 
 	/* while lines to be read */
 	line_buf = buf;
@@ -2617,7 +3308,7 @@ int semanage_nc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 
 		if (priority < 0) {
 			ERR(sh, "Netfilter context line missing priority.");
-			semanage_nc_destroy_ruletab(ruletab);
+			free(rules);
 			return -1;
 		}
 
@@ -2625,70 +3316,44 @@ int semanage_nc_sort(semanage_handle_t * sh, const char *buf, size_t buf_len,
 		for (; offset < line_len && isspace(line_buf[offset]);
 		     offset++) ;
 
-		/* load rule into node */
-		node = (semanage_netfilter_context_node_t *)
-		    malloc(sizeof(semanage_netfilter_context_node_t));
-		if (!node) {
-			ERR(sh, "Failure allocating memory.");
-			semanage_nc_destroy_ruletab(ruletab);
-			return -1;
-		}
-
-		node->rule =
-		    (char *)strndup(line_buf + offset, line_len - offset);
+		node = &rules[num_rules++];
+		node->rule = line_buf + offset;
 		node->rule_len = line_len - offset;
-		node->next = NULL;
-
-		if (!node->rule) {
-			ERR(sh, "Failure allocating memory.");
-			free(node);
-			semanage_nc_destroy_ruletab(ruletab);
-			return -1;
-		}
-
-		/* add node to rule table */
-		if (ruletab[priority][0] && ruletab[priority][1]) {
-			/* add to end of list, update tail pointer */
-			ruletab[priority][1]->next = node;
-			ruletab[priority][1] = node;
-		} else {
-			/* this list is empty, make head and tail point to the node */
-			ruletab[priority][0] = ruletab[priority][1] = node;
-		}
+		node->priority = priority;
+		pos[priority] += node->rule_len;
 
 		line_buf = line_end + 1;
 	}
 
-	/* First, calculate how much space we'll need for 
-	 * the newly sorted block of data.  (We don't just
-	 * use buf_len for this because we have extracted
-	 * comments and whitespace.)  Start at 1 for trailing \0 */
-	count = 1;
-	for (i = 0; i < NC_SORT_NEL; i++)
-		for (curr = ruletab[i][0]; curr != NULL; curr = curr->next)
-			count += curr->rule_len;
+	/* Turn the length of each priority's rules into the offset they
+	 * start at in the sorted buffer; all of the rules of one priority
+	 * go before those of the next, in input order.  Leave 1 for the
+	 * trailing \0 */
+	count = 0;
+	for (i = 0; i < NC_SORT_NEL; i++) {
+		size_t len = pos[i];
+		pos[i] = count;
+		count += len;
+	}
 
 	/* Allocate the buffer for the sorted list. */
-	*sorted_buf = calloc(count, sizeof(char));
+	*sorted_buf = malloc(count + 1);
 	if (!*sorted_buf) {
 		ERR(sh, "Failure allocating memory.");
-		semanage_nc_destroy_ruletab(ruletab);
+		free(rules);
 		return -1;
 	}
-	*sorted_buf_len = count;
+	*sorted_buf_len = count + 1;
 
 	/* write out rule buffer */
-	sorted_buf_pos = *sorted_buf;
-	for (i = 0; i < NC_SORT_NEL; i++) {
-		for (curr = ruletab[i][0]; curr != NULL; curr = curr->next) {
-			/* put rule into buffer */
-			snprintf(sorted_buf_pos, curr->rule_len + 1, "%s\n", curr->rule);	/* +1 for newline */
-			sorted_buf_pos = sorted_buf_pos + curr->rule_len;
-		}
+	for (i = 0; i < num_rules; i++) {
+		node = &rules[i];
+		memcpy(*sorted_buf + pos[node->priority], node->rule,
+		       node->rule_len);
+		pos[node->priority] += node->rule_len;
 	}
+	(*sorted_buf)[count] = '\0';
 
-	/* free ruletab */
-	semanage_nc_destroy_ruletab(ruletab);
-
+	free(rules);
 	return 0;
 }
@@ -24,6 +24,7 @@
 #ifndef SEMANAGE_MODULE_STORE_H
 #define SEMANAGE_MODULE_STORE_H
 
+#include <stdint.h>
 #include <sys/time.h>
 #include <sepol/module.h>
 #include "handle.h"
@@ -60,6 +61,11 @@ enum semanage_sandbox_defs {
 	SEMANAGE_FC_HOMEDIRS,
 	SEMANAGE_DISABLE_DONTAUDIT,
 	SEMANAGE_PRESERVE_TUNABLES,
+	SEMANAGE_EXPANDED,
+	SEMANAGE_EXPANDED_INPUTS,
+	SEMANAGE_POLICY_INDEX,
+	SEMANAGE_POLICY_LOADED,
+	SEMANAGE_MODULES_INDEX,
 	SEMANAGE_STORE_NUM_PATHS
 };
 
@@ -85,11 +91,14 @@ int semanage_get_modules_names(semanage_handle_t * sh,
 			       char ***filenames, int *len);
 
 int semanage_module_enabled(const char *file);
+int semanage_module_is_enabled(semanage_handle_t * sh, const char *file);
+void semanage_modules_changed(semanage_handle_t * sh);
 int semanage_enable_module(const char *file);
 int semanage_disable_module(const char *file);
 /* lock file routines */
 int semanage_get_trans_lock(semanage_handle_t * sh);
 int semanage_get_active_lock(semanage_handle_t * sh);
+int semanage_get_active_shared_lock(semanage_handle_t * sh);
 void semanage_release_trans_lock(semanage_handle_t * sh);
 void semanage_release_active_lock(semanage_handle_t * sh);
 int semanage_direct_get_serial(semanage_handle_t * sh);
@@ -110,6 +119,20 @@ int semanage_read_policydb(semanage_handle_t * sh,
 int semanage_write_policydb(semanage_handle_t * sh,
 			    sepol_policydb_t * policydb);
 
+#define FNV1A_64_INIT 0xcbf29ce484222325ULL
+#define FNV1A_64_PRIME 0x100000001b3ULL
+
+/* Folds 'len' bytes of 'data' into the FNV-1a hash 'h'. */
+uint64_t semanage_fnv1a(uint64_t h, const void *data, size_t len);
+
+int semanage_expanded_fingerprint(semanage_handle_t * sh, char **fingerprint);
+
+int semanage_read_expanded(semanage_handle_t * sh, const char *fingerprint,
+			   sepol_policydb_t ** policydb);
+
+int semanage_write_expanded(semanage_handle_t * sh, const char *fingerprint,
+			    sepol_policydb_t * policydb);
+
 int semanage_install_sandbox(semanage_handle_t * sh);
 
 int semanage_verify_modules(semanage_handle_t * sh,
@@ -117,6 +140,17 @@ int semanage_verify_modules(semanage_handle_t * sh,
 
 int semanage_verify_linked(semanage_handle_t * sh);
 int semanage_verify_kernel(semanage_handle_t * sh);
+
+/* Verification programs left running while the commit goes on.  The
+ * _start functions set *verify to NULL if no programs are configured;
+ * semanage_verify_finish() waits for the programs, frees 'verify' and
+ * returns -1 if any of them failed. */
+typedef struct semanage_verify semanage_verify_t;
+int semanage_verify_linked_start(semanage_handle_t * sh,
+				 semanage_verify_t ** verify);
+int semanage_verify_kernel_start(semanage_handle_t * sh,
+				 semanage_verify_t ** verify);
+int semanage_verify_finish(semanage_handle_t * sh, semanage_verify_t * verify);
 int semanage_split_fc(semanage_handle_t * sh);
 
 /* sort file context routines */
@@ -16,6 +16,8 @@ typedef struct semanage_seuser record_t;
 #include "database.h"
 #include "debug.h"
 #include "string.h"
+#include "utilities.h"
+#include <stdio.h>
 #include <stdlib.h>
 
 static char *semanage_user_roles(semanage_handle_t * handle, const char *sename) {
@@ -231,6 +233,9 @@ int semanage_seuser_list_local(semanage_handle_t * handle,
 struct validate_handler_arg {
 	semanage_handle_t *handle;
 	const sepol_policydb_t *policydb;
+
+	/* mappings already found valid, as "sename range" */
+	semanage_strset_t *valid;
 };
 
 static int validate_handler(const semanage_seuser_t * seuser, void *varg)
@@ -239,6 +244,8 @@ static int validate_handler(const semanage_seuser_t * seuser, void *varg)
 	semanage_user_t *user = NULL;
 	semanage_user_key_t *key = NULL;
 	int exists, mls_ok;
+	char buf[1024];
+	int n = -1;
 
 	/* Unpack varg */
 	struct validate_handler_arg *arg = (struct validate_handler_arg *)varg;
@@ -251,6 +258,15 @@ static int validate_handler(const semanage_seuser_t * seuser, void *varg)
 	const char *mls_range = semanage_seuser_get_mlsrange(seuser);
 	const char *user_mls_range;
 
+	/* Many Unix users map to the same SELinux user and range */
+	if (arg->valid) {
+		n = snprintf(buf, sizeof(buf), "%s %s", sename,
+			     mls_range ? mls_range : "");
+		if (n >= 0 && (size_t)n < sizeof(buf) &&
+		    semanage_strset_contains(arg->valid, buf))
+			return 0;
+	}
+
 	/* Make sure the (SElinux) user exists */
 	if (semanage_user_key_create(handle, sename, &key) < 0)
 		goto err;
@@ -288,6 +304,9 @@ static int validate_handler(const semanage_seuser_t * seuser, void *varg)
 		goto invalid;
 	}
 
+	if (arg->valid && n >= 0 && (size_t)n < sizeof(buf))
+		semanage_strset_add(arg->valid, buf);
+
 	semanage_user_key_free(key);
 	semanage_user_free(user);
 	return 0;
@@ -319,7 +338,12 @@ int hidden semanage_seuser_validate_local(semanage_handle_t * handle,
 {
 
 	struct validate_handler_arg arg;
+	int rc;
+
 	arg.handle = handle;
 	arg.policydb = policydb;
-	return semanage_seuser_iterate_local(handle, validate_handler, &arg);
+	arg.valid = semanage_strset_create();
+	rc = semanage_seuser_iterate_local(handle, validate_handler, &arg);
+	semanage_strset_destroy(arg.valid);
+	return rc;
 }
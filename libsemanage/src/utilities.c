@@ -306,3 +306,96 @@ semanage_list_t *semanage_slurp_file_filter(FILE * file,
 
 	return head.next;
 }
+
+struct semanage_strset {
+	char **slots;		/* NULL if the slot is free */
+	size_t size;		/* power of two */
+	size_t count;
+};
+
+static size_t semanage_strset_hash(const char *str)
+{
+	size_t h = 2166136261U;
+
+	for (; *str; str++) {
+		h ^= (unsigned char)*str;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+semanage_strset_t *semanage_strset_create(void)
+{
+	semanage_strset_t *set = malloc(sizeof(semanage_strset_t));
+
+	if (!set)
+		return NULL;
+	set->size = 64;
+	set->count = 0;
+	set->slots = calloc(set->size, sizeof(char *));
+	if (!set->slots) {
+		free(set);
+		return NULL;
+	}
+	return set;
+}
+
+void semanage_strset_destroy(semanage_strset_t * set)
+{
+	size_t i;
+
+	if (!set)
+		return;
+	for (i = 0; i < set->size; i++)
+		free(set->slots[i]);
+	free(set->slots);
+	free(set);
+}
+
+/* Returns the slot holding str, or the free slot where it would go. */
+static size_t semanage_strset_find(const semanage_strset_t * set,
+				   const char *str)
+{
+	size_t i = semanage_strset_hash(str) & (set->size - 1);
+
+	while (set->slots[i] && strcmp(set->slots[i], str))
+		i = (i + 1) & (set->size - 1);
+	return i;
+}
+
+int semanage_strset_contains(const semanage_strset_t * set, const char *str)
+{
+	return set->slots[semanage_strset_find(set, str)] != NULL;
+}
+
+int semanage_strset_add(semanage_strset_t * set, const char *str)
+{
+	char **slots, **old = set->slots;
+	size_t i, j, size = set->size;
+
+	if (semanage_strset_contains(set, str))
+		return 0;
+
+	/* keep the table at most half full */
+	if ((set->count + 1) * 2 > set->size) {
+		slots = calloc(size * 2, sizeof(char *));
+		if (!slots)
+			return -1;
+		set->slots = slots;
+		set->size = size * 2;
+		for (i = 0; i < size; i++) {
+			if (!old[i])
+				continue;
+			j = semanage_strset_find(set, old[i]);
+			set->slots[j] = old[i];
+		}
+		free(old);
+	}
+
+	i = semanage_strset_find(set, str);
+	set->slots[i] = strdup(str);
+	if (!set->slots[i])
+		return -1;
+	set->count++;
+	return 0;
+}
@@ -134,4 +134,17 @@ void semanage_keep_until_space(char *data);
 semanage_list_t *semanage_slurp_file_filter(FILE * file,
 					    int (*pred) (const char *))
     WARN_UNUSED;
+
+/* A set of strings, held in a hash table; used to remember which
+ * values have already been checked.  The set keeps its own copies. */
+typedef struct semanage_strset semanage_strset_t;
+
+semanage_strset_t *semanage_strset_create(void) WARN_UNUSED;
+void semanage_strset_destroy(semanage_strset_t * set);
+
+/* Returns 1 if str is in set, 0 otherwise. */
+int semanage_strset_contains(const semanage_strset_t * set, const char *str);
+
+/* Adds str to set. Returns 0 on success, -1 if out of memory. */
+int semanage_strset_add(semanage_strset_t * set, const char *str);
 #endif
@@ -42,6 +42,7 @@ void test_semanage_str_count(void);
 void test_semanage_rtrim(void);
 void test_semanage_findval(void);
 void test_slurp_file_filter(void);
+void test_semanage_strset(void);
 
 char fname[] = {
 	'T', 'E', 'S', 'T', '_', 'T', 'E', 'M', 'P', '_', 'X', 'X', 'X', 'X',
@@ -109,6 +110,10 @@ int semanage_utilities_add_tests(CU_pSuite suite)
 				test_slurp_file_filter)) {
 		goto err;
 	}
+	if (NULL == CU_add_test(suite, "semanage_strset",
+				test_semanage_strset)) {
+		goto err;
+	}
 	return 0;
       err:
 	CU_cleanup_registry();
@@ -283,3 +288,33 @@ void test_slurp_file_filter(void)
 
 	semanage_list_destroy(&data);
 }
+
+void test_semanage_strset(void)
+{
+	semanage_strset_t *set;
+	char str[32];
+	int i;
+
+	set = semanage_strset_create();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(set);
+
+	CU_ASSERT_FALSE(semanage_strset_contains(set, "foo"));
+	CU_ASSERT_EQUAL(semanage_strset_add(set, "foo"), 0);
+	CU_ASSERT_EQUAL(semanage_strset_add(set, "foo"), 0);
+	CU_ASSERT_TRUE(semanage_strset_contains(set, "foo"));
+	CU_ASSERT_FALSE(semanage_strset_contains(set, "fo"));
+
+	/* enough entries to grow the table a few times */
+	for (i = 0; i < 500; i++) {
+		snprintf(str, sizeof(str), "user_u:role_r:t%d_t:s0", i);
+		CU_ASSERT_EQUAL(semanage_strset_add(set, str), 0);
+	}
+	for (i = 0; i < 500; i++) {
+		snprintf(str, sizeof(str), "user_u:role_r:t%d_t:s0", i);
+		CU_ASSERT_TRUE(semanage_strset_contains(set, str));
+	}
+	CU_ASSERT_FALSE(semanage_strset_contains(set, "user_u:role_r:t500_t:s0"));
+	CU_ASSERT_TRUE(semanage_strset_contains(set, "foo"));
+
+	semanage_strset_destroy(set);
+}
@@ -26,6 +26,12 @@ extern int sepol_node_modify(sepol_handle_t * handle,
 			     const sepol_node_key_t * key,
 			     const sepol_node_t * data);
 
+/* Modify or add several nodes, in order; if one cannot be
+ * loaded, none are */
+extern int sepol_node_modify_many(sepol_handle_t * handle,
+				  sepol_policydb_t * policydb,
+				  sepol_node_t * const *nodes, unsigned int nnodes);
+
 /* Iterate the nodes 
  * The handler may return:
  * -1 to signal an error condition,
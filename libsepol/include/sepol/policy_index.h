@@ -0,0 +1,94 @@
+#ifndef _SEPOL_POLICY_INDEX_H_
+#define _SEPOL_POLICY_INDEX_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <sepol/handle.h>
+#include <sepol/policydb.h>
+
+/*
+ * A policy index is a compact, read-only summary of a kernel policy:
+ * the names of the types, attributes, classes, permissions and booleans,
+ * and the allow and type rules grouped by source type.  It is written
+ * once, e.g. when a policy store is committed, and mapped directly by
+ * tools that only need to look things up, so that they do not have to
+ * read and expand the whole binary policy.  Values are the policy's own
+ * (1-based) values.
+ */
+
+struct sepol_policy_index;
+typedef struct sepol_policy_index sepol_policy_index_t;
+
+/* Kinds of symbols held in an index. */
+#define SEPOL_INDEX_TYPE	0
+#define SEPOL_INDEX_CLASS	1
+#define SEPOL_INDEX_BOOL	2
+
+/* Values of 'specified' in a rule, as in the kernel policy. */
+#define SEPOL_INDEX_ALLOWED	0x0001
+#define SEPOL_INDEX_AUDITALLOW	0x0002
+#define SEPOL_INDEX_AUDITDENY	0x0004
+#define SEPOL_INDEX_TRANSITION	0x0010
+#define SEPOL_INDEX_MEMBER	0x0020
+#define SEPOL_INDEX_CHANGE	0x0040
+
+/* Values of 'flags' in a rule. */
+#define SEPOL_INDEX_COND	0x0001	/* rule is under a conditional */
+#define SEPOL_INDEX_ENABLED	0x0002	/* and was enabled when written */
+
+struct sepol_index_rule {
+	uint32_t source;
+	uint32_t target;
+	uint32_t tclass;
+	uint32_t specified;
+	uint32_t data;		/* permission mask or new type */
+	uint32_t flags;
+};
+
+/* Write an index of the kernel policy 'p' to 'fp'. */
+extern int sepol_policy_index_write(sepol_handle_t * handle,
+				    const sepol_policydb_t * p, FILE * fp);
+
+/* Map the index at 'path', and release it again. */
+extern int sepol_policy_index_open(const char *path,
+				   sepol_policy_index_t ** idx);
+extern void sepol_policy_index_close(sepol_policy_index_t * idx);
+
+/* Number of symbols of a kind; their values run from 1 to the count. */
+extern uint32_t sepol_policy_index_count(const sepol_policy_index_t * idx,
+					 int kind);
+
+/* Name of a value, or NULL if there is no such value. */
+extern const char *sepol_policy_index_name(const sepol_policy_index_t * idx,
+					   int kind, uint32_t value);
+
+/* Value of a name, or 0 if there is no such name. */
+extern uint32_t sepol_policy_index_value(const sepol_policy_index_t * idx,
+					 int kind, const char *name);
+
+/* Return 1 if type 'value' is an attribute. */
+extern int sepol_policy_index_is_attribute(const sepol_policy_index_t * idx,
+					   uint32_t value);
+
+/* Name of permission 'perm' (1-based bit) of class 'tclass', or NULL. */
+extern const char *sepol_policy_index_perm(const sepol_policy_index_t * idx,
+					   uint32_t tclass, uint32_t perm);
+
+/* Default state of boolean 'value', or -1 if there is no such boolean. */
+extern int sepol_policy_index_bool_state(const sepol_policy_index_t * idx,
+					 uint32_t value);
+
+/*
+ * Call 'fn' for each rule with the given source, target and class; a
+ * value of 0 matches anything.  Types and attributes are matched as
+ * written in the policy; attributes are not expanded.  Stops and
+ * returns the value of 'fn' if it is non-zero.
+ */
+extern int sepol_policy_index_rules(const sepol_policy_index_t * idx,
+				    uint32_t source, uint32_t target,
+				    uint32_t tclass,
+				    int (*fn) (const struct sepol_index_rule *
+					       rule, void *arg), void *arg);
+
+#endif
@@ -124,6 +124,17 @@ extern int sepol_policydb_to_image(sepol_handle_t * handle,
 				   sepol_policydb_t * p,
 				   void **newdata, size_t * newlen);
 
+/*
+ * Apply local users, the booleans file or a set of boolean values to a
+ * policydb, like sepol_genusers, sepol_genbools and sepol_genbools_array
+ * do to a binary image.  This lets several of them, and a version
+ * change, share one read and one write of the image.
+ */
+extern int sepol_policydb_genusers(sepol_policydb_t * p, const char *usersdir);
+extern int sepol_policydb_genbools(sepol_policydb_t * p, const char *booleans);
+extern int sepol_policydb_genbools_array(sepol_policydb_t * p, char **names,
+					 int *values, int nel);
+
 /* 
  * Check whether the policydb has MLS enabled.
  */
@@ -135,4 +146,31 @@ extern int sepol_policydb_mls_enabled(const sepol_policydb_t * p);
  */
 extern int sepol_policydb_compat_net(const sepol_policydb_t * p);
 
+/*
+ * Memory held by one component of a policydb.  Sizes are those of the
+ * structures and strings, without allocator overhead.  For the hash
+ * tables ("avtab", "cond_avtab" and "symtab", the latter summed over
+ * all global symbol tables), the slot fields describe their shape;
+ * they are 0 for the other components.
+ */
+typedef struct sepol_memstat {
+	const char *name;	/* component name */
+	size_t count;		/* number of objects */
+	size_t bytes;		/* bytes they use */
+	unsigned int slots;	/* hash slots */
+	unsigned int slots_used;	/* slots with at least one object */
+	unsigned int max_chain;	/* longest chain */
+} sepol_memstat_t;
+
+/*
+ * Account for the memory of a kernel policy, one entry per component:
+ * avtab, cond_avtab (with the conditional nodes), ebitmap, symtab (with
+ * the symbol datums), ocontext, constraint, filename_trans and strings
+ * (symbol and permission names).  The rules of a module policy are not
+ * included.  Up to 'n' entries are filled in.  Returns the number of
+ * components, which may be more than 'n'.
+ */
+extern int sepol_policydb_memstats(const sepol_policydb_t * p,
+				   sepol_memstat_t * stats, size_t n);
+
 #endif
@@ -77,11 +77,14 @@ struct avtab_node {
 				   not saved in binary policy */
 };
 
+struct avtab_chunk;
+
 typedef struct avtab {
 	avtab_ptr_t *htable;
+	struct avtab_chunk *chunks;	/* storage for the nodes */
 	uint32_t nel;		/* number of elements */
 	uint32_t nslot;         /* number of hash slots */
-	uint16_t mask;          /* mask to compute hash func */
+	uint32_t mask;          /* mask to compute hash func */
 } avtab_t;
 
 extern int avtab_init(avtab_t *);
@@ -92,10 +95,24 @@ extern avtab_datum_t *avtab_search(avtab_t * h, avtab_key_t * k);
 
 extern void avtab_destroy(avtab_t * h);
 
+/* Repack a table for lookups only; node pointers are not kept. */
+extern int avtab_freeze(avtab_t * h);
+
 extern int avtab_map(avtab_t * h,
 		     int (*apply) (avtab_key_t * k,
 				   avtab_datum_t * d, void *args), void *args);
 
+/* The shape of a table, as printed by avtab_hash_eval(). */
+typedef struct avtab_stats {
+	uint32_t nel;		/* number of elements */
+	uint32_t nslot;		/* number of hash slots */
+	uint32_t slots_used;	/* slots with at least one element */
+	uint32_t max_chain_len;	/* longest chain */
+	size_t bytes;		/* slots and node storage */
+} avtab_stats_t;
+
+extern void avtab_hash_stats(avtab_t * h, avtab_stats_t * st);
+
 extern void avtab_hash_eval(avtab_t * h, char *tag);
 
 struct policy_file;
@@ -117,10 +134,11 @@ extern avtab_ptr_t avtab_search_node(avtab_t * h, avtab_key_t * key);
 
 extern avtab_ptr_t avtab_search_node_next(avtab_ptr_t node, int specified);
 
-#define MAX_AVTAB_HASH_BITS 13
+#define MAX_AVTAB_HASH_BITS 20
 #define MAX_AVTAB_HASH_BUCKETS (1 << MAX_AVTAB_HASH_BITS)
 #define MAX_AVTAB_HASH_MASK (MAX_AVTAB_HASH_BUCKETS-1)
-#define MAX_AVTAB_SIZE MAX_AVTAB_HASH_BUCKETS
+/* initial size for tables whose final size is not known in advance */
+#define MAX_AVTAB_SIZE (1 << 13)
 
 #endif				/* _AVTAB_H_ */
 
@@ -94,6 +94,7 @@ extern int cond_evaluate_expr(policydb_t * p, cond_expr_t * expr);
 extern cond_expr_t *cond_copy_expr(cond_expr_t * expr);
 
 extern int cond_expr_equal(cond_node_t * a, cond_node_t * b);
+extern unsigned int cond_expr_hash(cond_node_t * node);
 extern int cond_normalize_expr(policydb_t * p, cond_node_t * cn);
 extern void cond_node_destroy(cond_node_t * node);
 extern void cond_expr_destroy(cond_expr_t * expr);
@@ -107,8 +108,15 @@ extern cond_node_t *cond_node_create(policydb_t * p, cond_node_t * node);
 extern cond_node_t *cond_node_search(policydb_t * p, cond_node_t * list,
 				     cond_node_t * cn);
 
+extern hashtab_t cond_node_table_create(cond_list_t * list);
+extern cond_node_t *cond_node_table_search(policydb_t * p, hashtab_t table,
+					   cond_list_t ** list,
+					   cond_node_t * cn);
+
 extern int evaluate_conds(policydb_t * p);
 
+extern int evaluate_conds_bool(policydb_t * p, uint32_t bool_value);
+
 extern avtab_datum_t *cond_av_list_search(avtab_key_t * key,
 					  cond_av_list_t * cond_list);
 
@@ -133,4 +141,9 @@ extern int cond_read_list(policydb_t * p, cond_list_t ** list, void *fp);
 extern void cond_compute_av(avtab_t * ctab, avtab_key_t * key,
 			    struct sepol_av_decision *avd);
 
+/* Build p->te_merged_avtab so that access vector lookups need a single
+ * probe; evaluate_conds() keeps it current from then on.  Rules must not
+ * be added to or removed from the policy afterwards. */
+extern int cond_merge_avtab(policydb_t * p);
+
 #endif				/* _CONDITIONAL_H_ */
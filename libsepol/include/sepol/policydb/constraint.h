@@ -61,9 +61,13 @@ typedef struct constraint_expr {
 	struct constraint_expr *next;	/* next expression */
 } constraint_expr_t;
 
+struct constraint_prog;
+
 typedef struct constraint_node {
 	sepol_access_vector_t permissions;	/* constrained permissions */
 	constraint_expr_t *expr;	/* constraint on permissions */
+	struct constraint_prog *prog;	/* compiled expr, built by the
+					 * security server on first use */
 	struct constraint_node *next;	/* next constraint */
 } constraint_node_t;
 
@@ -71,7 +71,45 @@ static inline int ebitmap_node_get_bit(ebitmap_node_t * n, unsigned int bit)
 }
 
 #define ebitmap_for_each_bit(e, n, bit) \
-	for (bit = ebitmap_start(e, &n); bit < ebitmap_length(e); bit = ebitmap_next(&n, bit)) \
+	for (bit = ebitmap_start(e, &n); (unsigned int)(bit) < ebitmap_length(e); bit = ebitmap_next(&n, bit)) \
+
+/*
+ * Like ebitmap_start() and ebitmap_next(), but only stopping at the
+ * bits that are set, found a word at a time.  Both return
+ * ebitmap_length(e) once no set bit is left.
+ */
+static inline unsigned int ebitmap_start_positive(const ebitmap_t * e,
+						  ebitmap_node_t ** n)
+{
+	for (*n = e->node; *n; *n = (*n)->next) {
+		if ((*n)->map)
+			return (*n)->startbit + __builtin_ctzll((*n)->map);
+	}
+	return ebitmap_length(e);
+}
+
+static inline unsigned int ebitmap_next_positive(const ebitmap_t * e,
+						 ebitmap_node_t ** n,
+						 unsigned int bit)
+{
+	unsigned int ofs = bit - (*n)->startbit + 1;
+	MAPTYPE map;
+
+	if (ofs < MAPSIZE) {
+		map = (*n)->map >> ofs;
+		if (map)
+			return bit + 1 + __builtin_ctzll(map);
+	}
+
+	for (*n = (*n)->next; *n; *n = (*n)->next) {
+		if ((*n)->map)
+			return (*n)->startbit + __builtin_ctzll((*n)->map);
+	}
+	return ebitmap_length(e);
+}
+
+#define ebitmap_for_each_positive_bit(e, n, bit) \
+	for (bit = ebitmap_start_positive(e, &n); (unsigned int)(bit) < ebitmap_length(e); bit = ebitmap_next_positive(e, &n, bit)) \
 
 extern int ebitmap_cmp(const ebitmap_t * e1, const ebitmap_t * e2);
 extern int ebitmap_or(ebitmap_t * dst, const ebitmap_t * e1, const ebitmap_t * e2);
@@ -84,8 +122,14 @@ extern unsigned int ebitmap_cardinality(ebitmap_t *e1);
 extern int ebitmap_hamming_distance(ebitmap_t * e1, ebitmap_t * e2);
 extern int ebitmap_cpy(ebitmap_t * dst, const ebitmap_t * src);
 extern int ebitmap_contains(const ebitmap_t * e1, const ebitmap_t * e2);
+extern int ebitmap_match_any(const ebitmap_t * e1, const ebitmap_t * e2);
 extern int ebitmap_get_bit(const ebitmap_t * e, unsigned int bit);
 extern int ebitmap_set_bit(ebitmap_t * e, unsigned int bit, int value);
+/* Build e in order a word at a time: startbit must be a multiple of
+   MAPSIZE above the node *tail last appended, or -EINVAL is returned,
+   and e must be empty while *tail is NULL. */
+extern int ebitmap_append(ebitmap_t * e, ebitmap_node_t ** tail,
+			  uint32_t startbit, MAPTYPE map);
 extern void ebitmap_destroy(ebitmap_t * e);
 extern int ebitmap_read(ebitmap_t * e, void *fp);
 
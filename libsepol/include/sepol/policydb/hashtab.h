@@ -43,6 +43,9 @@ typedef hashtab_val_t *hashtab_t;
 /*
    Creates a new hash table with the specified characteristics.
 
+   size is the initial number of slots.  The table doubles it as it
+   fills, so hash_value must reduce its result by the current h->size.
+
    Returns NULL if insufficent space is available or
    the new hash table otherwise.
  */
@@ -108,6 +111,8 @@ extern void hashtab_destroy(hashtab_t h);
 
    The order in which the function is applied to the entries
    is dependent upon the internal structure of the hash table.
+   The table grows as entries are inserted, so apply must not
+   insert into the table being walked.
 
    If apply returns a non-zero status, then hashtab_map will cease
    iterating through the hash table and will propagate the error
@@ -132,6 +137,17 @@ extern void hashtab_map_remove_on_error(hashtab_t h,
 							 void *args),
 					void *args);
 
+/* The shape of a hash table, as printed by hashtab_hash_eval(). */
+typedef struct hashtab_stats {
+	uint32_t nel;		/* number of elements */
+	unsigned int size;	/* number of slots */
+	unsigned int slots_used;	/* slots with at least one element */
+	unsigned int max_chain_len;	/* longest chain */
+	size_t bytes;		/* table, slots and nodes, not keys or datums */
+} hashtab_stats_t;
+
+extern void hashtab_hash_stats(hashtab_t h, hashtab_stats_t * st);
+
 extern void hashtab_hash_eval(hashtab_t h, char *tag);
 
 #endif
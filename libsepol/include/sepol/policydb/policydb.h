@@ -562,6 +562,27 @@ typedef struct policydb {
 	unsigned policyvers;
 
 	unsigned handle_unknown;
+
+	/* port and node key lookups, built on demand (see ocon_keys.c) */
+	struct ocon_keys *ocon_keys;
+
+	/* role, range and filename transition key lookups, built on
+	   demand (see trans_keys.c) */
+	struct trans_keys *trans_keys;
+
+	/* names of the global symbols, possibly shared with other
+	   policydbs (see strpool.c) */
+	struct strpool *strpool;
+
+	/* roles and users (value - 1) whose cache for context validity
+	   checks is current; the caches are built on demand */
+	ebitmap_t role_cached;
+	ebitmap_t user_cached;
+
+	/* te_avtab and the enabled rules of te_cond_avtab merged into one
+	   node per access vector key, built on request by
+	   cond_merge_avtab() and kept current by evaluate_conds() */
+	avtab_t *te_merged_avtab;
 } policydb_t;
 
 struct sepol_policydb {
@@ -646,6 +667,9 @@ typedef struct policy_file {
 #define PF_USE_MEMORY  0
 #define PF_USE_STDIO   1
 #define PF_LEN         2	/* total up length in len field */
+#define PF_USE_GROWBUF 3	/* write to data, reallocated as needed;
+				   len is the length written, size the
+				   allocated size */
 	unsigned type;
 	char *data;
 	size_t len;
@@ -26,6 +26,22 @@
 extern int sepol_set_policydb(policydb_t * p);
 extern int sepol_set_sidtab(sidtab_t * s);
 
+/* Service state handles.  Each handle has its own policydb and sidtab
+   pointers and its own internal caches and buffers.  Threads that use
+   different handles may call the service functions concurrently.
+   sepol_services_create() makes a handle for the given structures, or
+   for private ones when p or s is NULL.  sepol_services_use() selects
+   the handle the calling thread's service calls operate on, including
+   sepol_set_policydb() and sepol_set_sidtab(), and returns the
+   previously selected one.  NULL selects the default handle, which
+   is shared by all threads that have not selected another.  A handle
+   must not be used by two threads at once. */
+typedef struct sepol_services sepol_services_t;
+extern int sepol_services_create(policydb_t * p, sidtab_t * s,
+				 sepol_services_t ** svcp);
+extern void sepol_services_destroy(sepol_services_t * svc);
+extern sepol_services_t *sepol_services_use(sepol_services_t * svc);
+
 /* Modify a policydb for boolean settings. */
 int sepol_genbools_policydb(policydb_t * policydb, const char *booleans);
 
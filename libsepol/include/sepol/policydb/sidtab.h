@@ -6,6 +6,8 @@
 /*
  * A security identifier table (sidtab) is a hash table
  * of security context structures indexed by SID value.
+ * Each node is also chained on a second table indexed
+ * by a hash of its context, for context to SID lookups.
  */
 
 #ifndef _SEPOL_POLICYDB_SIDTAB_H_
@@ -16,7 +18,9 @@
 typedef struct sidtab_node {
 	sepol_security_id_t sid;	/* security identifier */
 	context_struct_t context;	/* security context structure */
+	uint32_t hash;			/* hash of context */
 	struct sidtab_node *next;
+	struct sidtab_node *cnext;	/* next node with the same context slot */
 } sidtab_node_t;
 
 typedef struct sidtab_node *sidtab_ptr_t;
@@ -25,10 +29,13 @@ typedef struct sidtab_node *sidtab_ptr_t;
 #define SIDTAB_HASH_BUCKETS (1 << SIDTAB_HASH_BITS)
 #define SIDTAB_HASH_MASK (SIDTAB_HASH_BUCKETS-1)
 
-#define SIDTAB_SIZE SIDTAB_HASH_BUCKETS
+#define SIDTAB_SIZE SIDTAB_HASH_BUCKETS	/* initial number of slots */
+#define SIDTAB_MAX_SIZE (1U << 24)
 
 typedef struct {
 	sidtab_ptr_t *htable;
+	sidtab_ptr_t *ctable;	/* the same nodes, hashed by context */
+	unsigned int nslot;	/* number of slots in each table */
 	unsigned int nel;	/* number of elements */
 	unsigned int next_sid;	/* next SID to allocate */
 	unsigned char shutdown;
@@ -55,6 +62,15 @@ extern void sepol_sidtab_map_remove_on_error(sidtab_t * s,
 							   context, void *args),
 					     void *args);
 
+extern int sepol_sidtab_convert(sidtab_t * s, sidtab_t * dst,
+				int (*convert) (sepol_security_id_t sid,
+						context_struct_t * context,
+						void *args),
+				void (*report) (sepol_security_id_t sid,
+						context_struct_t * context,
+						int status, void *args),
+				void *args);
+
 extern int sepol_sidtab_context_to_sid(sidtab_t * s,	/* IN */
 				       context_struct_t * context,	/* IN */
 				       sepol_security_id_t * sid);	/* OUT */
@@ -26,6 +26,12 @@ extern int sepol_port_modify(sepol_handle_t * handle,
 			     const sepol_port_key_t * key,
 			     const sepol_port_t * data);
 
+/* Modify or add several ports, in order; if one cannot be
+ * loaded, none are */
+extern int sepol_port_modify_many(sepol_handle_t * handle,
+				  sepol_policydb_t * policydb,
+				  sepol_port_t * const *ports, unsigned int nports);
+
 /* Iterate the ports 
  * The handler may return:
  * -1 to signal an error condition,
@@ -29,6 +29,13 @@ extern int sepol_user_modify(sepol_handle_t * handle,
 			     const sepol_user_key_t * key,
 			     const sepol_user_t * data);
 
+/* Modify or add several users, in order.  Stops at the first
+ * user that cannot be loaded; the users before it stay loaded */
+extern int sepol_user_modify_many(sepol_handle_t * handle,
+				  sepol_policydb_t * policydb,
+				  sepol_user_t * const *users,
+				  unsigned int nusers);
+
 /* Return the number of users */
 extern int sepol_user_count(sepol_handle_t * handle,
 			    const sepol_policydb_t * p, unsigned int *response);
@@ -20,6 +20,11 @@
  *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <sepol/policydb/avtab.h>
 #include <sepol/policydb/policydb.h>
 #include <sepol/policydb/expand.h>
@@ -27,11 +32,52 @@
 
 #include "debug.h"
 
-static int check_assertion_helper(sepol_handle_t * handle,
-				  policydb_t * p,
-				  avtab_t * te_avtab, avtab_t * te_cond_avtab,
+/*
+ * Neverallow rules are checked by up to ASSERTION_MAX_THREADS threads,
+ * one for every ASSERTION_RULES_PER_THREAD rules, which take rules in
+ * order from a shared counter.  Only the first violated rule in rule
+ * order is reported, so a thread stops once it gets past the earliest
+ * failure found so far.
+ *
+ * Whether a rule is violated is decided against the unexpanded allow
+ * rules, grouped by class, by intersecting the type sets of each rule
+ * with those of the neverallow.  The avtab is only expanded to type
+ * pairs to find the exact allow rule to report for a violation.
+ */
+#define ASSERTION_MAX_THREADS 8
+#define ASSERTION_RULES_PER_THREAD 16
+
+struct assertion_violation {
+	unsigned int stype, ttype;
+	class_perm_node_t *perm;
+	uint32_t data;		/* the allowed permissions it forbids */
+};
+
+struct assertion_entry {
+	uint32_t stype, ttype;
+	uint32_t data;
+};
+
+/* the allow rules of both avtabs, with those of class c at
+   entries[start[c - 1]] up to entries[start[c]] */
+struct assertion_index {
+	struct assertion_entry *entries;
+	uint32_t *start;
+};
+
+struct assertion_work {
+	policydb_t *p;
+	struct assertion_index index;
+	avrule_t **rules;
+	unsigned int nrules;
+	unsigned int next;	/* next rule to check */
+	unsigned int first_failed;	/* earliest violated rule, or nrules */
+};
+
+static int check_assertion_helper(avtab_t * te_avtab, avtab_t * te_cond_avtab,
 				  unsigned int stype, unsigned int ttype,
-				  avrule_t * avrule)
+				  avrule_t * avrule,
+				  struct assertion_violation *v)
 {
 	avtab_key_t avkey;
 	avtab_ptr_t node;
@@ -59,30 +105,231 @@ static int check_assertion_helper(sepol_handle_t * handle,
 	return 0;
 
       err:
+	v->stype = stype;
+	v->ttype = ttype;
+	v->perm = curperm;
+	v->data = node->datum.data & curperm->data;
+	return -1;
+}
+
+static int check_assertion(avtab_t * te_avtab, avtab_t * te_cond_avtab,
+			   avrule_t * a, struct assertion_violation *v)
+{
+	ebitmap_t *stypes = &a->stypes.types;
+	ebitmap_t *ttypes = &a->ttypes.types;
+	ebitmap_node_t *snode, *tnode;
+	unsigned int i, j;
+
+	ebitmap_for_each_positive_bit(stypes, snode, i) {
+		if (a->flags & RULE_SELF) {
+			if (check_assertion_helper
+			    (te_avtab, te_cond_avtab, i, i, a, v))
+				return -1;
+		}
+		ebitmap_for_each_positive_bit(ttypes, tnode, j) {
+			if (check_assertion_helper
+			    (te_avtab, te_cond_avtab, i, j, a, v))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static void report_assertion_failure(sepol_handle_t * handle, policydb_t * p,
+				     avrule_t * avrule,
+				     struct assertion_violation *v)
+{
 	if (avrule->source_filename) {
 		ERR(handle, "neverallow on line %lu of %s (or line %lu of policy.conf) violated by allow %s %s:%s {%s };",
 		    avrule->source_line, avrule->source_filename, avrule->line,
-		    p->p_type_val_to_name[stype],
-		    p->p_type_val_to_name[ttype],
-		    p->p_class_val_to_name[curperm->class - 1],
-		    sepol_av_to_string(p, curperm->class,
-				       node->datum.data & curperm->data));
+		    p->p_type_val_to_name[v->stype],
+		    p->p_type_val_to_name[v->ttype],
+		    p->p_class_val_to_name[v->perm->class - 1],
+		    sepol_av_to_string(p, v->perm->class, v->data));
 	} else if (avrule->line) {
 		ERR(handle, "neverallow on line %lu violated by allow %s %s:%s {%s };",
-		    avrule->line, p->p_type_val_to_name[stype],
-		    p->p_type_val_to_name[ttype],
-		    p->p_class_val_to_name[curperm->class - 1],
-		    sepol_av_to_string(p, curperm->class,
-				       node->datum.data & curperm->data));
+		    avrule->line, p->p_type_val_to_name[v->stype],
+		    p->p_type_val_to_name[v->ttype],
+		    p->p_class_val_to_name[v->perm->class - 1],
+		    sepol_av_to_string(p, v->perm->class, v->data));
 	} else {
 		ERR(handle, "neverallow violated by allow %s %s:%s {%s };",
-		    p->p_type_val_to_name[stype], 
-		    p->p_type_val_to_name[ttype],
-		    p->p_class_val_to_name[curperm->class - 1],
-		    sepol_av_to_string(p, curperm->class,
-				       node->datum.data & curperm->data));
+		    p->p_type_val_to_name[v->stype], 
+		    p->p_type_val_to_name[v->ttype],
+		    p->p_class_val_to_name[v->perm->class - 1],
+		    sepol_av_to_string(p, v->perm->class, v->data));
 	}
-	return -1;
+}
+
+static int assertion_index_count(avtab_key_t * k, avtab_datum_t * d
+				 __attribute__ ((unused)), void *args)
+{
+	struct assertion_index *index = args;
+
+	if (k->specified & AVTAB_ALLOWED)
+		index->start[k->target_class]++;
+	return 0;
+}
+
+static int assertion_index_fill(avtab_key_t * k, avtab_datum_t * d, void *args)
+{
+	struct assertion_index *index = args;
+	struct assertion_entry *e;
+
+	if (k->specified & AVTAB_ALLOWED) {
+		e = &index->entries[index->start[k->target_class - 1]++];
+		e->stype = k->source_type;
+		e->ttype = k->target_type;
+		e->data = d->data;
+	}
+	return 0;
+}
+
+static int assertion_index_build(policydb_t * p, struct assertion_index *index)
+{
+	uint32_t i, nclass = p->p_classes.nprim;
+
+	index->entries = NULL;
+	index->start = calloc(nclass + 1, sizeof(*index->start));
+	if (!index->start)
+		return -1;
+
+	avtab_map(&p->te_avtab, assertion_index_count, index);
+	avtab_map(&p->te_cond_avtab, assertion_index_count, index);
+	for (i = 1; i <= nclass; i++)
+		index->start[i] += index->start[i - 1];
+	index->entries = malloc((index->start[nclass] + 1) *
+				sizeof(*index->entries));
+	if (!index->entries) {
+		free(index->start);
+		index->start = NULL;
+		return -1;
+	}
+
+	/* filling class c moves start[c - 1] up to the end of class c,
+	   which is where start[c] was, so shift everything back after */
+	avtab_map(&p->te_avtab, assertion_index_fill, index);
+	avtab_map(&p->te_cond_avtab, assertion_index_fill, index);
+	for (i = nclass; i > 0; i--)
+		index->start[i] = index->start[i - 1];
+	index->start[0] = 0;
+	return 0;
+}
+
+static void assertion_index_destroy(struct assertion_index *index)
+{
+	free(index->entries);
+	free(index->start);
+}
+
+static inline int is_attr(policydb_t * p, uint32_t type)
+{
+	return p->type_val_to_struct[type - 1]->flavor == TYPE_ATTRIB;
+}
+
+/* Does the type or attribute with value type cover any type in set? */
+static int type_matches(policydb_t * p, uint32_t type, ebitmap_t * set)
+{
+	if (is_attr(p, type))
+		return ebitmap_match_any(&p->attr_type_map[type - 1], set);
+	return ebitmap_get_bit(set, type - 1);
+}
+
+/* Does a rule from stype to ttype cover some type in set with itself? */
+static int self_matches(policydb_t * p, uint32_t stype, uint32_t ttype,
+			ebitmap_t * set)
+{
+	ebitmap_node_t *node;
+	unsigned int i;
+
+	if (!is_attr(p, stype) && !is_attr(p, ttype))
+		return stype == ttype && ebitmap_get_bit(set, stype - 1);
+	if (!is_attr(p, stype))
+		return ebitmap_get_bit(set, stype - 1) &&
+		    ebitmap_get_bit(&p->attr_type_map[ttype - 1], stype - 1);
+	if (!is_attr(p, ttype))
+		return ebitmap_get_bit(set, ttype - 1) &&
+		    ebitmap_get_bit(&p->attr_type_map[stype - 1], ttype - 1);
+	ebitmap_for_each_positive_bit(&p->attr_type_map[stype - 1], node, i) {
+		if (ebitmap_get_bit(&p->attr_type_map[ttype - 1], i) &&
+		    ebitmap_get_bit(set, i))
+			return 1;
+	}
+	return 0;
+}
+
+static int assertion_violated(policydb_t * p, struct assertion_index *index,
+			      avrule_t * a)
+{
+	ebitmap_t *stypes = &a->stypes.types;
+	ebitmap_t *ttypes = &a->ttypes.types;
+	class_perm_node_t *curperm;
+	struct assertion_entry *e, *end;
+
+	for (curperm = a->perms; curperm != NULL; curperm = curperm->next) {
+		e = &index->entries[index->start[curperm->class - 1]];
+		end = &index->entries[index->start[curperm->class]];
+		for (; e != end; e++) {
+			if (!(e->data & curperm->data))
+				continue;
+			if (!type_matches(p, e->stype, stypes))
+				continue;
+			if (type_matches(p, e->ttype, ttypes))
+				return 1;
+			if ((a->flags & RULE_SELF) &&
+			    self_matches(p, e->stype, e->ttype, stypes))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static void *check_assertions_worker(void *arg)
+{
+	struct assertion_work *w = arg;
+	unsigned int n, failed;
+
+	for (;;) {
+		n = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED);
+		failed = __atomic_load_n(&w->first_failed, __ATOMIC_RELAXED);
+		if (n >= failed)
+			break;
+		if (!assertion_violated(w->p, &w->index, w->rules[n]))
+			continue;
+		while (n < failed &&
+		       !__atomic_compare_exchange_n(&w->first_failed, &failed,
+						    n, 0, __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED))
+			;
+	}
+	return NULL;
+}
+
+static int check_assertions_threaded(struct assertion_work *w)
+{
+	pthread_t threads[ASSERTION_MAX_THREADS];
+	unsigned int i, nthreads;
+	long ncpu;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = w->nrules / ASSERTION_RULES_PER_THREAD;
+	if (ncpu > 0 && nthreads > (unsigned long)ncpu)
+		nthreads = ncpu;
+	if (nthreads > ASSERTION_MAX_THREADS)
+		nthreads = ASSERTION_MAX_THREADS;
+
+	/* the calling thread always does its share */
+	for (i = 0; i + 1 < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, check_assertions_worker,
+				   w))
+			break;
+	}
+	nthreads = i;
+	check_assertions_worker(w);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	return w->first_failed < w->nrules ? -1 : 0;
 }
 
 int check_assertions(sepol_handle_t * handle, policydb_t * p,
@@ -90,70 +337,70 @@ int check_assertions(sepol_handle_t * handle, policydb_t * p,
 {
 	avrule_t *a;
 	avtab_t te_avtab, te_cond_avtab;
-	ebitmap_node_t *snode, *tnode;
-	unsigned int i, j;
+	struct assertion_work w;
+	struct assertion_violation v;
+	unsigned int n;
 	int rc;
 
 	if (!avrules) {
 		/* Since assertions are stored in avrules, if it is NULL
-		   there won't be any to check. This also prevents an invalid
-		   free if the avtabs are never initialized */
+		   there won't be any to check. */
 		return 0;
 	}
 
-	if (avrules) {
-		if (avtab_init(&te_avtab))
-			goto oom;
-		if (avtab_init(&te_cond_avtab)) {
-			avtab_destroy(&te_avtab);
-			goto oom;
-		}
-		if (expand_avtab(p, &p->te_avtab, &te_avtab) ||
-		    expand_avtab(p, &p->te_cond_avtab, &te_cond_avtab)) {
-			avtab_destroy(&te_avtab);
-			avtab_destroy(&te_cond_avtab);
-			goto oom;
-		}
+	memset(&w, 0, sizeof(w));
+	for (a = avrules; a != NULL; a = a->next) {
+		if (a->specified & AVRULE_NEVERALLOW)
+			w.nrules++;
 	}
-
+	if (!w.nrules)
+		return 0;
+	w.rules = malloc(w.nrules * sizeof(*w.rules));
+	if (!w.rules)
+		goto oom;
+	n = 0;
 	for (a = avrules; a != NULL; a = a->next) {
-		ebitmap_t *stypes = &a->stypes.types;
-		ebitmap_t *ttypes = &a->ttypes.types;
+		if (a->specified & AVRULE_NEVERALLOW)
+			w.rules[n++] = a;
+	}
 
-		if (!(a->specified & AVRULE_NEVERALLOW))
-			continue;
+	if (assertion_index_build(p, &w.index))
+		goto oom;
+	w.p = p;
+	w.first_failed = w.nrules;
 
-		ebitmap_for_each_bit(stypes, snode, i) {
-			if (!ebitmap_node_get_bit(snode, i))
-				continue;
-			if (a->flags & RULE_SELF) {
-				if (check_assertion_helper
-				    (handle, p, &te_avtab, &te_cond_avtab, i, i,
-				     a)) {
-					rc = -1;
-					goto out;
-				}
-			}
-			ebitmap_for_each_bit(ttypes, tnode, j) {
-				if (!ebitmap_node_get_bit(tnode, j))
-					continue;
-				if (check_assertion_helper
-				    (handle, p, &te_avtab, &te_cond_avtab, i, j,
-				     a)) {
-					rc = -1;
-					goto out;
-				}
-			}
-		}
-	}
+	rc = check_assertions_threaded(&w);
+	assertion_index_destroy(&w.index);
+	if (!rc)
+		goto out;
 
-	rc = 0;
-out:
+	/* find the allow rule that violates it to report it */
+	if (avtab_init(&te_avtab))
+		goto oom;
+	if (avtab_init(&te_cond_avtab)) {
+		avtab_destroy(&te_avtab);
+		goto oom;
+	}
+	if (expand_avtab(p, &p->te_avtab, &te_avtab) ||
+	    expand_avtab(p, &p->te_cond_avtab, &te_cond_avtab)) {
+		avtab_destroy(&te_avtab);
+		avtab_destroy(&te_cond_avtab);
+		goto oom;
+	}
+	a = w.rules[w.first_failed];
+	if (check_assertion(&te_avtab, &te_cond_avtab, a, &v))
+		report_assertion_failure(handle, p, a, &v);
+	else
+		ERR(handle, "neverallow on line %lu violated", a->line);
 	avtab_destroy(&te_avtab);
 	avtab_destroy(&te_cond_avtab);
+
+out:
+	free(w.rules);
 	return rc;
 
       oom:
+	free(w.rules);
 	ERR(handle, "Out of memory - unable to check neverallows");
 	return -1;
 }
@@ -49,18 +49,135 @@
 #include "debug.h"
 #include "private.h"
 
-static inline int avtab_hash(struct avtab_key *keyp, uint16_t mask)
+/*
+ * The old hash only shifted the source and target types into a few
+ * overlapping bit ranges, so large policies piled up in a small part
+ * of the table.  Mix all three key fields through MurmurHash3 steps.
+ */
+static inline uint32_t avtab_hash(struct avtab_key *keyp, uint32_t mask)
+{
+	static const uint32_t c1 = 0xcc9e2d51;
+	static const uint32_t c2 = 0x1b873593;
+	static const uint32_t r1 = 15;
+	static const uint32_t r2 = 13;
+	static const uint32_t m = 5;
+	static const uint32_t n = 0xe6546b64;
+	uint32_t hash = 0;
+
+#define mix(input) { \
+	uint32_t v = input; \
+	v *= c1; \
+	v = (v << r1) | (v >> (32 - r1)); \
+	v *= c2; \
+	hash ^= v; \
+	hash = (hash << r2) | (hash >> (32 - r2)); \
+	hash = hash * m + n; \
+}
+
+	mix(keyp->target_class);
+	mix(keyp->target_type);
+	mix(keyp->source_type);
+
+#undef mix
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+
+	return hash & mask;
+}
+
+/*
+ * Double the number of slots once the chains average more than two
+ * nodes.  Every old slot splits into the slots i and i + nslot of the
+ * new table, so appending each node to the tail of its new slot keeps
+ * the chains sorted and duplicate keys in insertion order.  Nodes are
+ * relinked, never moved, so pointers to them stay valid.  A failed
+ * allocation just leaves the table as it is.
+ */
+static void avtab_grow(avtab_t * h)
+{
+	uint32_t i, nslot = h->nslot << 1, mask = nslot - 1;
+	avtab_ptr_t *htable, *tail[2], cur, next;
+
+	if (h->nslot >= MAX_AVTAB_HASH_BUCKETS)
+		return;
+
+	htable = calloc(nslot, sizeof(avtab_ptr_t));
+	if (!htable)
+		return;
+
+	for (i = 0; i < h->nslot; i++) {
+		tail[0] = &htable[i];
+		tail[1] = &htable[i + h->nslot];
+		for (cur = h->htable[i]; cur; cur = next) {
+			next = cur->next;
+			cur->next = NULL;
+			if (avtab_hash(&cur->key, mask) == i) {
+				*tail[0] = cur;
+				tail[0] = &cur->next;
+			} else {
+				*tail[1] = cur;
+				tail[1] = &cur->next;
+			}
+		}
+	}
+
+	free(h->htable);
+	h->htable = htable;
+	h->nslot = nslot;
+	h->mask = mask;
+}
+
+/*
+ * Nodes are handed out from chunks owned by the table instead of being
+ * allocated one by one.  Chunks start small so that the many short
+ * lived tables built during expansion stay cheap, and grow with the
+ * table up to AVTAB_CHUNK_MAX nodes.  Nodes are never freed on their
+ * own; avtab_destroy() releases all chunks at once.
+ */
+#define AVTAB_CHUNK_MIN 16
+#define AVTAB_CHUNK_MAX 4096
+
+struct avtab_chunk {
+	struct avtab_chunk *next;
+	uint32_t size;		/* number of nodes in the chunk */
+	uint32_t used;		/* number of nodes handed out */
+	struct avtab_node nodes[];
+};
+
+static avtab_ptr_t avtab_alloc_node(avtab_t * h)
 {
-	return ((keyp->target_class + (keyp->target_type << 2) +
-		 (keyp->source_type << 9)) & mask);
+	struct avtab_chunk *chunk = h->chunks;
+	uint32_t size;
+
+	if (!chunk || chunk->used == chunk->size) {
+		size = h->nel;
+		if (size < AVTAB_CHUNK_MIN)
+			size = AVTAB_CHUNK_MIN;
+		if (size > AVTAB_CHUNK_MAX)
+			size = AVTAB_CHUNK_MAX;
+		chunk = malloc(sizeof(struct avtab_chunk) +
+			       size * sizeof(struct avtab_node));
+		if (!chunk)
+			return NULL;
+		chunk->size = size;
+		chunk->used = 0;
+		chunk->next = h->chunks;
+		h->chunks = chunk;
+	}
+
+	return &chunk->nodes[chunk->used++];
 }
 
 static avtab_ptr_t
-avtab_insert_node(avtab_t * h, int hvalue, avtab_ptr_t prev, avtab_key_t * key,
+avtab_insert_node(avtab_t * h, uint32_t hvalue, avtab_ptr_t prev, avtab_key_t * key,
 		  avtab_datum_t * datum)
 {
 	avtab_ptr_t newnode;
-	newnode = (avtab_ptr_t) malloc(sizeof(struct avtab_node));
+	newnode = avtab_alloc_node(h);
 	if (newnode == NULL)
 		return NULL;
 	memset(newnode, 0, sizeof(struct avtab_node));
@@ -75,12 +192,14 @@ avtab_insert_node(avtab_t * h, int hvalue, avtab_ptr_t prev, avtab_key_t * key,
 	}
 
 	h->nel++;
+	if (h->nel > 2 * h->nslot)
+		avtab_grow(h);
 	return newnode;
 }
 
 int avtab_insert(avtab_t * h, avtab_key_t * key, avtab_datum_t * datum)
 {
-	int hvalue;
+	uint32_t hvalue;
 	avtab_ptr_t prev, cur, newnode;
 	uint16_t specified =
 	    key->specified & ~(AVTAB_ENABLED | AVTAB_ENABLED_OLD);
@@ -121,7 +240,7 @@ int avtab_insert(avtab_t * h, avtab_key_t * key, avtab_datum_t * datum)
 avtab_ptr_t
 avtab_insert_nonunique(avtab_t * h, avtab_key_t * key, avtab_datum_t * datum)
 {
-	int hvalue;
+	uint32_t hvalue;
 	avtab_ptr_t prev, cur, newnode;
 	uint16_t specified =
 	    key->specified & ~(AVTAB_ENABLED | AVTAB_ENABLED_OLD);
@@ -153,7 +272,7 @@ avtab_insert_nonunique(avtab_t * h, avtab_key_t * key, avtab_datum_t * datum)
 
 avtab_datum_t *avtab_search(avtab_t * h, avtab_key_t * key)
 {
-	int hvalue;
+	uint32_t hvalue;
 	avtab_ptr_t cur;
 	uint16_t specified =
 	    key->specified & ~(AVTAB_ENABLED | AVTAB_ENABLED_OLD);
@@ -188,7 +307,7 @@ avtab_datum_t *avtab_search(avtab_t * h, avtab_key_t * key)
  */
 avtab_ptr_t avtab_search_node(avtab_t * h, avtab_key_t * key)
 {
-	int hvalue;
+	uint32_t hvalue;
 	avtab_ptr_t cur;
 	uint16_t specified =
 	    key->specified & ~(AVTAB_ENABLED | AVTAB_ENABLED_OLD);
@@ -245,23 +364,93 @@ avtab_ptr_t avtab_search_node_next(avtab_ptr_t node, int specified)
 	return NULL;
 }
 
+/*
+ * Repack a table that will only be searched from now on, such as the
+ * rules of a policy loaded to answer queries.  The nodes are copied
+ * into one array, each chain in consecutive nodes and in its sorted
+ * order, and the table gets about one slot per node, so a lookup reads
+ * a short run of adjacent memory and the per-chunk slack is released.
+ * The array becomes the only chunk, so the table can still be inserted
+ * into and destroyed as before.
+ *
+ * Nodes move, so pointers to them taken before are no longer valid;
+ * this must not be used on a table that others point into, such as a
+ * conditional avtab.  On failure the table is left as it was.
+ */
+int avtab_freeze(avtab_t * h)
+{
+	struct avtab_chunk *chunk, *old, *next;
+	avtab_ptr_t *htable, cur, node;
+	uint32_t i, n, nslot, mask, *start;
+
+	if (!h || !h->htable || !h->nel)
+		return 0;
+
+	/* never fewer slots, so each new chain comes from one old chain */
+	for (nslot = 1; nslot < h->nel && nslot < MAX_AVTAB_HASH_BUCKETS;
+	     nslot <<= 1) ;
+	if (nslot < h->nslot)
+		nslot = h->nslot;
+	mask = nslot - 1;
+
+	chunk = malloc(sizeof(struct avtab_chunk) +
+		       h->nel * sizeof(struct avtab_node));
+	htable = calloc(nslot, sizeof(avtab_ptr_t));
+	start = calloc(nslot + 1, sizeof(uint32_t));
+	if (!chunk || !htable || !start) {
+		free(chunk);
+		free(htable);
+		free(start);
+		return SEPOL_ENOMEM;
+	}
+	chunk->next = NULL;
+	chunk->size = h->nel;
+	chunk->used = h->nel;
+
+	/* count the nodes of every new slot, then place them in order */
+	for (i = 0; i < h->nslot; i++)
+		for (cur = h->htable[i]; cur; cur = cur->next)
+			start[avtab_hash(&cur->key, mask) + 1]++;
+	for (i = 0; i < nslot; i++)
+		start[i + 1] += start[i];
+	for (i = 0; i < h->nslot; i++) {
+		for (cur = h->htable[i]; cur; cur = cur->next) {
+			n = avtab_hash(&cur->key, mask);
+			node = &chunk->nodes[start[n]++];
+			*node = *cur;
+			node->next = NULL;
+			if (!htable[n])
+				htable[n] = node;
+			else
+				node[-1].next = node;
+		}
+	}
+	free(start);
+
+	for (old = h->chunks; old; old = next) {
+		next = old->next;
+		free(old);
+	}
+	free(h->htable);
+	h->chunks = chunk;
+	h->htable = htable;
+	h->nslot = nslot;
+	h->mask = mask;
+	return 0;
+}
+
 void avtab_destroy(avtab_t * h)
 {
-	unsigned int i;
-	avtab_ptr_t cur, temp;
+	struct avtab_chunk *chunk, *next;
 
 	if (!h || !h->htable)
 		return;
 
-	for (i = 0; i < h->nslot; i++) {
-		cur = h->htable[i];
-		while (cur != NULL) {
-			temp = cur;
-			cur = cur->next;
-			free(temp);
-		}
-		h->htable[i] = NULL;
+	for (chunk = h->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
 	}
+	h->chunks = NULL;
 	free(h->htable);
 	h->htable = NULL;
 	h->nslot = 0;
@@ -294,13 +483,14 @@ int avtab_map(avtab_t * h,
 int avtab_init(avtab_t * h)
 {
 	h->htable = NULL;
+	h->chunks = NULL;
 	h->nel = 0;
 	return 0;
 }
 
 int avtab_alloc(avtab_t *h, uint32_t nrules)
 {
-	uint16_t mask = 0;
+	uint32_t mask = 0;
 	uint32_t shift = 0;
 	uint32_t work = nrules;
 	uint32_t nslot = 0;
@@ -314,9 +504,9 @@ int avtab_alloc(avtab_t *h, uint32_t nrules)
 	}
 	if (shift > 2)
 		shift = shift - 2;
-	nslot = 1 << shift;
-	if (nslot > MAX_AVTAB_SIZE)
-		nslot = MAX_AVTAB_SIZE;
+	nslot = UINT32_C(1) << shift;
+	if (nslot > MAX_AVTAB_HASH_BUCKETS)
+		nslot = MAX_AVTAB_HASH_BUCKETS;
 	mask = nslot - 1;
 
 	h->htable = calloc(nslot, sizeof(avtab_ptr_t));
@@ -329,31 +519,44 @@ out:
 	return 0;
 }
 
-void avtab_hash_eval(avtab_t * h, char *tag)
+void avtab_hash_stats(avtab_t * h, avtab_stats_t * st)
 {
-	unsigned int i, chain_len, slots_used, max_chain_len;
+	struct avtab_chunk *chunk;
+	unsigned int i, chain_len;
 	avtab_ptr_t cur;
 
-	slots_used = 0;
-	max_chain_len = 0;
+	st->nel = h->nel;
+	st->nslot = h->nslot;
+	st->slots_used = 0;
+	st->max_chain_len = 0;
 	for (i = 0; i < h->nslot; i++) {
 		cur = h->htable[i];
 		if (cur) {
-			slots_used++;
+			st->slots_used++;
 			chain_len = 0;
 			while (cur) {
 				chain_len++;
 				cur = cur->next;
 			}
 
-			if (chain_len > max_chain_len)
-				max_chain_len = chain_len;
+			if (chain_len > st->max_chain_len)
+				st->max_chain_len = chain_len;
 		}
 	}
+	st->bytes = (size_t)h->nslot * sizeof(avtab_ptr_t);
+	for (chunk = h->chunks; chunk; chunk = chunk->next)
+		st->bytes += sizeof(struct avtab_chunk) +
+		    (size_t)chunk->size * sizeof(struct avtab_node);
+}
+
+void avtab_hash_eval(avtab_t * h, char *tag)
+{
+	avtab_stats_t st;
 
+	avtab_hash_stats(h, &st);
 	printf
 	    ("%s:  %d entries and %d/%d buckets used, longest chain length %d\n",
-	     tag, h->nel, slots_used, h->nslot, max_chain_len);
+	     tag, st.nel, st.slots_used, st.nslot, st.max_chain_len);
 }
 
 /* Ordering of datums in the original avtab format in the policy file. */
@@ -487,6 +690,86 @@ static int avtab_insertf(avtab_t * a, avtab_key_t * k, avtab_datum_t * d,
 	return avtab_insert(a, k, d);
 }
 
+/* Number of entries avtab_read_items() decodes per read. */
+#define AVTAB_READ_BATCH 1024
+
+/*
+ * Read nel entries of a table of version POLICYDB_VERSION_AVTAB or
+ * later into a.  Every such entry is four 16-bit words and one 32-bit
+ * datum, so the entries are read AVTAB_READ_BATCH at a time and
+ * decoded from the buffer rather than with two next_entry() calls per
+ * entry as avtab_read_item() does.
+ */
+static int avtab_read_items(avtab_t * a, struct policy_file *fp,
+			    uint32_t nel)
+{
+	const size_t entry_size = 4 * sizeof(uint16_t) + sizeof(uint32_t);
+	uint16_t spec_mask = 0, buf16[4];
+	uint32_t buf32, i, j, batch;
+	unsigned char *buf, *cur;
+	avtab_key_t key;
+	avtab_datum_t datum;
+	int rc = -1;
+
+	for (j = 0; j < ARRAY_SIZE(spec_order); j++)
+		spec_mask |= spec_order[j];
+
+	batch = nel < AVTAB_READ_BATCH ? nel : AVTAB_READ_BATCH;
+	buf = malloc(batch * entry_size);
+	if (!buf) {
+		ERR(fp->handle, "out of memory");
+		return -1;
+	}
+
+	memset(&datum, 0, sizeof(avtab_datum_t));
+	for (i = 0; i < nel; i += batch) {
+		if (batch > nel - i)
+			batch = nel - i;
+		if (next_entry(buf, fp, batch * entry_size) < 0) {
+			ERR(fp->handle, "truncated entry");
+			ERR(fp->handle, "failed on entry %d of %u", i, nel);
+			goto out;
+		}
+		for (j = 0, cur = buf; j < batch; j++, cur += entry_size) {
+			uint16_t spec;
+
+			memcpy(buf16, cur, sizeof(buf16));
+			memcpy(&buf32, cur + sizeof(buf16), sizeof(buf32));
+			key.source_type = le16_to_cpu(buf16[0]);
+			key.target_type = le16_to_cpu(buf16[1]);
+			key.target_class = le16_to_cpu(buf16[2]);
+			key.specified = le16_to_cpu(buf16[3]);
+
+			/* exactly one of the spec_order bits */
+			spec = key.specified & spec_mask;
+			if (!spec || (spec & (spec - 1))) {
+				ERR(fp->handle, "more than one specifier");
+				ERR(fp->handle, "failed on entry %d of %u",
+				    i + j, nel);
+				goto out;
+			}
+
+			datum.data = le32_to_cpu(buf32);
+			rc = avtab_insert(a, &key, &datum);
+			if (rc) {
+				if (rc == SEPOL_ENOMEM)
+					ERR(fp->handle, "out of memory");
+				if (rc == SEPOL_EEXIST)
+					ERR(fp->handle, "duplicate entry");
+				ERR(fp->handle, "failed on entry %d of %u",
+				    i + j, nel);
+				rc = -1;
+				goto out;
+			}
+		}
+	}
+	rc = 0;
+
+      out:
+	free(buf);
+	return rc;
+}
+
 int avtab_read(avtab_t * a, struct policy_file *fp, uint32_t vers)
 {
 	unsigned int i;
@@ -511,6 +794,12 @@ int avtab_read(avtab_t * a, struct policy_file *fp, uint32_t vers)
 		goto bad;
 	}
 
+	if (vers >= POLICYDB_VERSION_AVTAB) {
+		if (avtab_read_items(a, fp, nel))
+			goto bad;
+		return 0;
+	}
+
 	for (i = 0; i < nel; i++) {
 		rc = avtab_read_item(fp, vers, a, avtab_insertf, NULL);
 		if (rc) {
@@ -13,7 +13,8 @@
 
 static int bool_update(sepol_handle_t * handle,
 		       policydb_t * policydb,
-		       const sepol_bool_key_t * key, const sepol_bool_t * data)
+		       const sepol_bool_key_t * key, const sepol_bool_t * data,
+		       uint32_t * bool_value)
 {
 
 	const char *cname;
@@ -40,6 +41,7 @@ static int bool_update(sepol_handle_t * handle,
 
 	free(name);
 	datum->state = value;
+	*bool_value = datum->s.value;
 	return STATUS_SUCCESS;
 
       omem:
@@ -85,13 +87,15 @@ int sepol_bool_set(sepol_handle_t * handle,
 {
 
 	const char *name;
+	uint32_t bool_value;
 	sepol_bool_key_unpack(key, &name);
 
 	policydb_t *policydb = &p->p;
-	if (bool_update(handle, policydb, key, data) < 0)
+	if (bool_update(handle, policydb, key, data, &bool_value) < 0)
 		goto err;
 
-	if (evaluate_conds(policydb) < 0) {
+	/* Only the conditionals using this boolean can change state. */
+	if (evaluate_conds_bool(policydb, bool_value) < 0) {
 		ERR(handle, "error while re-evaluating conditionals");
 		goto err;
 	}
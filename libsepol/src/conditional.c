@@ -25,6 +25,14 @@
 #include <sepol/policydb/conditional.h>
 
 #include "private.h"
+#include "strpool.h"
+
+/*
+ * Bumped whenever evaluate_cond_node() switches rules on or off, so
+ * that results computed from the conditional avtab can be recognized
+ * as stale.
+ */
+unsigned int hidden cond_state_changes = 0;
 
 /* move all type rules to top of t/f lists to help kernel on evaluation */
 static void cond_optimize(cond_av_list_t ** l)
@@ -133,6 +141,30 @@ int cond_expr_equal(cond_node_t * a, cond_node_t * b)
 	return 1;
 }
 
+/*
+ * Hash a conditional expression such that expressions considered
+ * equal by cond_expr_equal() hash to the same value.
+ */
+unsigned int cond_expr_hash(cond_node_t * node)
+{
+	cond_expr_t *cur;
+	unsigned int i, hash = node->nbools;
+
+	if (node->nbools <= COND_MAX_BOOLS) {
+		/* the order of bool_ids does not matter to same_bools() */
+		for (i = 0; i < node->nbools; i++)
+			hash += node->bool_ids[i] * 0x9e3779b1U;
+		return hash ^ (node->expr_pre_comp * 0x85ebca77U);
+	}
+
+	for (cur = node->expr; cur != NULL; cur = cur->next) {
+		hash = hash * 31 + cur->expr_type;
+		if (cur->expr_type == COND_BOOL)
+			hash = hash * 31 + cur->bool;
+	}
+	return hash;
+}
+
 /* Create a new conditional node, optionally copying
  * the conditional expression from an existing node.
  * If node is NULL then a new node will be created
@@ -201,6 +233,68 @@ cond_node_t *cond_node_search(policydb_t * p, cond_node_t * list,
 	return result;
 }
 
+static unsigned int cond_node_table_hash(hashtab_t h, hashtab_key_t key)
+{
+	return cond_expr_hash((cond_node_t *) key) & (h->size - 1);
+}
+
+/*
+ * Equal expressions compare as 0 and all others as greater, so lookups
+ * walk the whole (short) chain instead of relying on an ordering that
+ * cond_expr_equal() does not provide.
+ */
+static int cond_node_table_cmp(hashtab_t h __attribute__ ((unused)),
+			       hashtab_key_t key1, hashtab_key_t key2)
+{
+	return !cond_expr_equal((cond_node_t *) key1, (cond_node_t *) key2);
+}
+
+/* Create a table indexing the nodes of list by expression, for use
+ * with cond_node_table_search().  Return NULL if out of memory. */
+hashtab_t cond_node_table_create(cond_list_t * list)
+{
+	hashtab_t table;
+	int rc;
+
+	table = hashtab_create(cond_node_table_hash, cond_node_table_cmp, 256);
+	if (!table)
+		return NULL;
+	/* the first match wins, as in cond_node_find() */
+	for (; list != NULL; list = list->next) {
+		rc = hashtab_insert(table, (hashtab_key_t) list, list);
+		if (rc && rc != SEPOL_EEXIST) {
+			hashtab_destroy(table);
+			return NULL;
+		}
+	}
+	return table;
+}
+
+/* Like cond_node_search(), but look up the node through a table
+ * created by cond_node_table_create() for *list, which is kept up to
+ * date when a new node is added to the head of *list. */
+cond_node_t *cond_node_table_search(policydb_t * p, hashtab_t table,
+				    cond_list_t ** list, cond_node_t * cn)
+{
+	cond_node_t *node;
+
+	node = hashtab_search(table, (hashtab_key_t) cn);
+	if (node)
+		return node;
+
+	node = cond_node_create(p, cn);
+	if (!node)
+		return NULL;
+	if (hashtab_insert(table, (hashtab_key_t) node, node)) {
+		cond_node_destroy(node);
+		free(node);
+		return NULL;
+	}
+	node->next = *list;
+	*list = node;
+	return node;
+}
+
 /*
  * cond_evaluate_expr evaluates a conditional expr
  * in reverse polish notation. It returns true (1), false (0),
@@ -298,6 +392,99 @@ cond_expr_t *cond_copy_expr(cond_expr_t * expr)
 	return NULL;
 }
 
+/*
+ * The merged access vector of one kind for a key: the unconditional
+ * rules and the enabled conditional ones.
+ */
+static uint32_t cond_merged_data(policydb_t * p, avtab_key_t * key)
+{
+	avtab_t *tabs[2] = { &p->te_avtab, &p->te_cond_avtab };
+	avtab_ptr_t node;
+	uint32_t data;
+	int i;
+
+	data = key->specified == AVTAB_AUDITDENY ? ~0U : 0;
+	for (i = 0; i < 2; i++) {
+		for (node = avtab_search_node(tabs[i], key); node != NULL;
+		     node = avtab_search_node_next(node, key->specified)) {
+			if (i && !(node->key.specified & AVTAB_ENABLED))
+				continue;
+			if (key->specified == AVTAB_AUDITDENY)
+				data &= node->datum.data;
+			else
+				data |= node->datum.data;
+		}
+	}
+	return data;
+}
+
+/* Recompute the merged entry for the key of a conditional rule. */
+static void cond_merged_update(policydb_t * p, avtab_key_t * k)
+{
+	avtab_key_t key = *k;
+	avtab_ptr_t node;
+
+	key.specified &= AVTAB_AV;
+	if (!key.specified)
+		return;
+	node = avtab_search_node(p->te_merged_avtab, &key);
+	if (node)
+		node->datum.data = cond_merged_data(p, &key);
+}
+
+static int cond_merge_key(avtab_key_t * k, avtab_datum_t * d
+			  __attribute__ ((unused)), void *args)
+{
+	policydb_t *p = args;
+	avtab_key_t key = *k;
+	avtab_datum_t datum;
+
+	key.specified &= AVTAB_AV;
+	if (!key.specified || avtab_search_node(p->te_merged_avtab, &key))
+		return 0;
+	datum.data = cond_merged_data(p, &key);
+	return avtab_insert(p->te_merged_avtab, &key, &datum);
+}
+
+/*
+ * Every key of a conditional rule gets an entry, enabled or not, so
+ * that switching rules on and off only rewrites access vectors.
+ */
+int cond_merge_avtab(policydb_t * p)
+{
+	avtab_t *merged;
+
+	if (p->te_merged_avtab)
+		return 0;
+	merged = malloc(sizeof(*merged));
+	if (!merged)
+		return -1;
+	if (avtab_init(merged) ||
+	    avtab_alloc(merged, p->te_avtab.nel + p->te_cond_avtab.nel))
+		goto err;
+	p->te_merged_avtab = merged;
+	if (avtab_map(&p->te_avtab, cond_merge_key, p) ||
+	    avtab_map(&p->te_cond_avtab, cond_merge_key, p))
+		goto err;
+	avtab_freeze(merged);
+	return 0;
+
+      err:
+	p->te_merged_avtab = NULL;
+	avtab_destroy(merged);
+	free(merged);
+	return -1;
+}
+
+static void cond_merged_destroy(policydb_t * p)
+{
+	if (!p->te_merged_avtab)
+		return;
+	avtab_destroy(p->te_merged_avtab);
+	free(p->te_merged_avtab);
+	p->te_merged_avtab = NULL;
+}
+
 /*
  * evaluate_cond_node evaluates the conditional stored in
  * a cond_node_t and if the result is different than the
@@ -313,6 +500,7 @@ static int evaluate_cond_node(policydb_t * p, cond_node_t * node)
 	new_state = cond_evaluate_expr(p, node->expr);
 	if (new_state != node->cur_state) {
 		node->cur_state = new_state;
+		__atomic_add_fetch(&cond_state_changes, 1, __ATOMIC_RELAXED);
 		if (new_state == -1)
 			printf
 			    ("expression result was undefined - disabling all rules.\n");
@@ -333,6 +521,13 @@ static int evaluate_cond_node(policydb_t * p, cond_node_t * node)
 				cur->node->key.specified |= AVTAB_ENABLED;
 			}
 		}
+
+		if (p->te_merged_avtab) {
+			for (cur = node->true_list; cur != NULL; cur = cur->next)
+				cond_merged_update(p, &cur->node->key);
+			for (cur = node->false_list; cur != NULL; cur = cur->next)
+				cond_merged_update(p, &cur->node->key);
+		}
 	}
 	return 0;
 }
@@ -453,6 +648,37 @@ int evaluate_conds(policydb_t * p)
 	return 0;
 }
 
+static int cond_expr_uses_bool(cond_expr_t * expr, uint32_t bool_value)
+{
+	for (; expr != NULL; expr = expr->next) {
+		if (expr->expr_type == COND_BOOL && expr->bool == bool_value)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Re-evaluate only the conditionals whose expression refers to the
+ * boolean with the given value.  The other conditionals cannot have
+ * changed state, so this is equivalent to evaluate_conds() after a
+ * single boolean was changed, provided the conditionals were up to
+ * date beforehand.
+ */
+int evaluate_conds_bool(policydb_t * p, uint32_t bool_value)
+{
+	int ret;
+	cond_node_t *cur;
+
+	for (cur = p->cond_list; cur != NULL; cur = cur->next) {
+		if (!cond_expr_uses_bool(cur->expr, bool_value))
+			continue;
+		ret = evaluate_cond_node(p, cur);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 int cond_policydb_init(policydb_t * p)
 {
 	p->bool_val_to_struct = NULL;
@@ -518,6 +744,7 @@ void cond_policydb_destroy(policydb_t * p)
 		free(p->bool_val_to_struct);
 	avtab_destroy(&p->te_cond_avtab);
 	cond_list_destroy(p->cond_list);
+	cond_merged_destroy(p);
 }
 
 int cond_init_bool_indexes(policydb_t * p)
@@ -531,11 +758,10 @@ int cond_init_bool_indexes(policydb_t * p)
 	return 0;
 }
 
-int cond_destroy_bool(hashtab_key_t key, hashtab_datum_t datum, void *p
-		      __attribute__ ((unused)))
+/* 'pool' is the string pool the name may be from, or NULL. */
+int cond_destroy_bool(hashtab_key_t key, hashtab_datum_t datum, void *pool)
 {
-	if (key)
-		free(key);
+	strpool_free(pool, key);
 	free(datum);
 	return 0;
 }
@@ -569,6 +795,7 @@ int cond_read_bool(policydb_t * p,
 		   struct policy_file *fp)
 {
 	char *key = 0;
+	struct strpool *pool = symtab_pool(p, h);
 	cond_bool_datum_t *booldatum;
 	uint32_t buf[3], len;
 	int rc;
@@ -590,13 +817,9 @@ int cond_read_bool(policydb_t * p,
 
 	len = le32_to_cpu(buf[2]);
 
-	key = malloc(len + 1);
+	key = symtab_name_read(pool, fp, len);
 	if (!key)
 		goto err;
-	rc = next_entry(key, fp, len);
-	if (rc < 0)
-		goto err;
-	key[len] = 0;
 
 	if (p->policy_type != POLICY_KERN &&
 	    p->policyvers >= MOD_POLICYDB_VERSION_TUNABLE_SEP) {
@@ -611,7 +834,7 @@ int cond_read_bool(policydb_t * p,
 
 	return 0;
       err:
-	cond_destroy_bool(key, booldatum, 0);
+	cond_destroy_bool(key, booldatum, pool);
 	return -1;
 }
 
@@ -10,6 +10,7 @@
 #include "context.h"
 #include "handle.h"
 #include "mls.h"
+#include "private.h"
 
 /* ----- Compatibility ---- */
 int policydb_context_isvalid(const policydb_t * p, const context_struct_t * c)
@@ -36,11 +37,9 @@ int context_is_valid(const policydb_t * p, const context_struct_t * c)
 
 	role_datum_t *role;
 	user_datum_t *usrdatum;
-	ebitmap_t types, roles;
+	ebitmap_t *types, *roles;
 	int ret = 1;
 
-	ebitmap_init(&types);
-	ebitmap_init(&roles);
 	if (!c->role || c->role > p->p_roles.nprim)
 		return 0;
 
@@ -55,7 +54,10 @@ int context_is_valid(const policydb_t * p, const context_struct_t * c)
 		 * Role must be authorized for the type.
 		 */
 		role = p->role_val_to_struct[c->role - 1];
-		if (!ebitmap_get_bit(&role->cache, c->type - 1))
+		/* the caches are built on demand, so 'p' is only
+		   logically const */
+		types = policydb_role_types((policydb_t *) p, role);
+		if (!types || !ebitmap_get_bit(types, c->type - 1))
 			/* role may not be associated with type */
 			return 0;
 
@@ -66,7 +68,8 @@ int context_is_valid(const policydb_t * p, const context_struct_t * c)
 		if (!usrdatum)
 			return 0;
 
-		if (!ebitmap_get_bit(&usrdatum->cache, c->role - 1))
+		roles = policydb_user_roles((policydb_t *) p, usrdatum);
+		if (!roles || !ebitmap_get_bit(roles, c->role - 1))
 			/* user may not be associated with role */
 			return 0;
 	}
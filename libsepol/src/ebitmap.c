@@ -71,15 +71,62 @@ int ebitmap_union(ebitmap_t * dst, const ebitmap_t * e1)
 	return 0;
 }
 
+/*
+ * Append a node holding map at startbit to the bitmap being built in
+ * dst, whose last node is *tail.  Empty maps are skipped so the result
+ * never holds null nodes, just as if it had been built bit by bit.
+ * A startbit that is not aligned or does not lie above the last node
+ * is refused, as ebitmap_read() refuses it.
+ */
+int ebitmap_append(ebitmap_t * dst, ebitmap_node_t ** tail,
+		   uint32_t startbit, MAPTYPE map)
+{
+	ebitmap_node_t *new;
+
+	if ((startbit & (MAPSIZE - 1)) ||
+	    (*tail && startbit <= (*tail)->startbit))
+		return -EINVAL;
+	if (!map)
+		return 0;
+
+	new = (ebitmap_node_t *) malloc(sizeof(ebitmap_node_t));
+	if (!new)
+		return -ENOMEM;
+	new->startbit = startbit;
+	new->map = map;
+	new->next = NULL;
+	if (*tail)
+		(*tail)->next = new;
+	else
+		dst->node = new;
+	*tail = new;
+	dst->highbit = startbit + MAPSIZE;
+	return 0;
+}
+
 int ebitmap_and(ebitmap_t *dst, ebitmap_t *e1, ebitmap_t *e2)
 {
-	unsigned int i, length = min(ebitmap_length(e1), ebitmap_length(e2));
+	ebitmap_node_t *n1, *n2, *tail = NULL;
+	int rc;
+
 	ebitmap_init(dst);
-	for (i=0; i < length; i++) {
-		if (ebitmap_get_bit(e1, i) && ebitmap_get_bit(e2, i)) {
-			int rc = ebitmap_set_bit(dst, i, 1);
-			if (rc < 0)
+
+	n1 = e1->node;
+	n2 = e2->node;
+	while (n1 && n2) {
+		if (n1->startbit < n2->startbit) {
+			n1 = n1->next;
+		} else if (n2->startbit < n1->startbit) {
+			n2 = n2->next;
+		} else {
+			rc = ebitmap_append(dst, &tail, n1->startbit,
+					    n1->map & n2->map);
+			if (rc < 0) {
+				ebitmap_destroy(dst);
 				return rc;
+			}
+			n1 = n1->next;
+			n2 = n2->next;
 		}
 	}
 	return 0;
@@ -87,63 +134,126 @@ int ebitmap_and(ebitmap_t *dst, ebitmap_t *e1, ebitmap_t *e2)
 
 int ebitmap_xor(ebitmap_t *dst, ebitmap_t *e1, ebitmap_t *e2)
 {
-	unsigned int i, length = max(ebitmap_length(e1), ebitmap_length(e2));
+	ebitmap_node_t *n1, *n2, *tail = NULL;
+	uint32_t startbit;
+	MAPTYPE map;
+	int rc;
+
 	ebitmap_init(dst);
-	for (i=0; i < length; i++) {
-		int val = ebitmap_get_bit(e1, i) ^ ebitmap_get_bit(e2, i);
-		int rc = ebitmap_set_bit(dst, i, val);
-		if (rc < 0)
+
+	n1 = e1->node;
+	n2 = e2->node;
+	while (n1 || n2) {
+		if (n1 && n2 && n1->startbit == n2->startbit) {
+			startbit = n1->startbit;
+			map = n1->map ^ n2->map;
+			n1 = n1->next;
+			n2 = n2->next;
+		} else if (!n2 || (n1 && n1->startbit < n2->startbit)) {
+			startbit = n1->startbit;
+			map = n1->map;
+			n1 = n1->next;
+		} else {
+			startbit = n2->startbit;
+			map = n2->map;
+			n2 = n2->next;
+		}
+		rc = ebitmap_append(dst, &tail, startbit, map);
+		if (rc < 0) {
+			ebitmap_destroy(dst);
 			return rc;
+		}
 	}
 	return 0;
 }
 
+/* the bits of a map at startbit that lie below maxbit */
+static inline MAPTYPE ebitmap_map_below(uint32_t startbit, unsigned int maxbit)
+{
+	if (maxbit - startbit >= MAPSIZE)
+		return ~(MAPTYPE)0;
+	return (MAPBIT << (maxbit - startbit)) - 1;
+}
+
 int ebitmap_not(ebitmap_t *dst, ebitmap_t *e1, unsigned int maxbit)
 {
-	unsigned int i;
+	ebitmap_node_t *n = e1->node, *tail = NULL;
+	uint32_t startbit;
+	MAPTYPE map;
+	int rc;
+
 	ebitmap_init(dst);
-	for (i=0; i < maxbit; i++) {
-		int val = ebitmap_get_bit(e1, i);
-		int rc = ebitmap_set_bit(dst, i, !val);
-		if (rc < 0)
+
+	for (startbit = 0; startbit < maxbit; startbit += MAPSIZE) {
+		while (n && n->startbit < startbit)
+			n = n->next;
+		map = (n && n->startbit == startbit) ? ~n->map : ~(MAPTYPE)0;
+		map &= ebitmap_map_below(startbit, maxbit);
+		rc = ebitmap_append(dst, &tail, startbit, map);
+		if (rc < 0) {
+			ebitmap_destroy(dst);
 			return rc;
+		}
+		if (startbit + MAPSIZE < startbit)
+			break;
 	}
 	return 0;
 }
 
 int ebitmap_andnot(ebitmap_t *dst, ebitmap_t *e1, ebitmap_t *e2, unsigned int maxbit)
 {
-	ebitmap_t e3;
+	ebitmap_node_t *n1, *n2, *tail = NULL;
+	MAPTYPE map;
+	int rc;
+
 	ebitmap_init(dst);
-	int rc = ebitmap_not(&e3, e2, maxbit);
-	if (rc < 0)
-		return rc;
-	rc = ebitmap_and(dst, e1, &e3);
-	ebitmap_destroy(&e3);
-	if (rc < 0)
-		return rc;
+
+	n2 = e2->node;
+	for (n1 = e1->node; n1 && n1->startbit < maxbit; n1 = n1->next) {
+		while (n2 && n2->startbit < n1->startbit)
+			n2 = n2->next;
+		map = n1->map & ebitmap_map_below(n1->startbit, maxbit);
+		if (n2 && n2->startbit == n1->startbit)
+			map &= ~n2->map;
+		rc = ebitmap_append(dst, &tail, n1->startbit, map);
+		if (rc < 0) {
+			ebitmap_destroy(dst);
+			return rc;
+		}
+	}
 	return 0;
 }
 
 unsigned int ebitmap_cardinality(ebitmap_t *e1)
 {
-	unsigned int i, count = 0;
-	for (i=ebitmap_startbit(e1); i < ebitmap_length(e1); i++)
-		if (ebitmap_get_bit(e1, i))
-			count++;
+	ebitmap_node_t *n;
+	unsigned int count = 0;
+
+	for (n = e1->node; n; n = n->next)
+		count += __builtin_popcountll(n->map);
 	return count;
 }
 
 int ebitmap_hamming_distance(ebitmap_t * e1, ebitmap_t * e2)
 {
-	if (ebitmap_cmp(e1, e2))
-		return 0;
-	ebitmap_t tmp;
-	int rc = ebitmap_xor(&tmp, e1, e2);
-	if (rc < 0)
-		return -1;
-	int distance = ebitmap_cardinality(&tmp);
-	ebitmap_destroy(&tmp);
+	ebitmap_node_t *n1, *n2;
+	int distance = 0;
+
+	n1 = e1->node;
+	n2 = e2->node;
+	while (n1 || n2) {
+		if (n1 && n2 && n1->startbit == n2->startbit) {
+			distance += __builtin_popcountll(n1->map ^ n2->map);
+			n1 = n1->next;
+			n2 = n2->next;
+		} else if (!n2 || (n1 && n1->startbit < n2->startbit)) {
+			distance += __builtin_popcountll(n1->map);
+			n1 = n1->next;
+		} else {
+			distance += __builtin_popcountll(n2->map);
+			n2 = n2->next;
+		}
+	}
 	return distance;
 }
 
@@ -224,6 +334,27 @@ int ebitmap_contains(const ebitmap_t * e1, const ebitmap_t * e2)
 	return 1;
 }
 
+/* Return 1 if e1 and e2 have any bit set in common. */
+int ebitmap_match_any(const ebitmap_t * e1, const ebitmap_t * e2)
+{
+	ebitmap_node_t *n1 = e1->node;
+	ebitmap_node_t *n2 = e2->node;
+
+	while (n1 && n2) {
+		if (n1->startbit < n2->startbit) {
+			n1 = n1->next;
+		} else if (n2->startbit < n1->startbit) {
+			n2 = n2->next;
+		} else {
+			if (n1->map & n2->map)
+				return 1;
+			n1 = n1->next;
+			n2 = n2->next;
+		}
+	}
+	return 0;
+}
+
 int ebitmap_get_bit(const ebitmap_t * e, unsigned int bit)
 {
 	ebitmap_node_t *n;
@@ -339,12 +470,17 @@ void ebitmap_destroy(ebitmap_t * e)
 	return;
 }
 
+/* Node records are read this many at a time: a startbit and a map. */
+#define EBITMAP_READ_CHUNK 32
+#define EBITMAP_RECORD_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+
 int ebitmap_read(ebitmap_t * e, void *fp)
 {
 	int rc;
 	ebitmap_node_t *n, *l;
-	uint32_t buf[3], mapsize, count, i;
+	uint32_t buf[3], mapsize, count, i, j, chunk;
 	uint64_t map;
+	char records[EBITMAP_READ_CHUNK * EBITMAP_RECORD_SIZE], *r;
 
 	ebitmap_init(e);
 
@@ -372,60 +508,71 @@ int ebitmap_read(ebitmap_t * e, void *fp)
 		     e->highbit, MAPSIZE);
 		goto bad;
 	}
+	/* distinct, ascending start bits below the high bit */
+	if (count > e->highbit / MAPSIZE) {
+		printf
+		    ("security: ebitmap: %u maps do not fit below high bit %d\n",
+		     count, e->highbit);
+		goto bad;
+	}
 	l = NULL;
-	for (i = 0; i < count; i++) {
-		rc = next_entry(buf, fp, sizeof(uint32_t));
+	for (i = 0; i < count; i += chunk) {
+		chunk = count - i;
+		if (chunk > EBITMAP_READ_CHUNK)
+			chunk = EBITMAP_READ_CHUNK;
+		rc = next_entry(records, fp, chunk * EBITMAP_RECORD_SIZE);
 		if (rc < 0) {
 			printf("security: ebitmap: truncated map\n");
 			goto bad;
 		}
-		n = (ebitmap_node_t *) malloc(sizeof(ebitmap_node_t));
-		if (!n) {
-			printf("security: ebitmap: out of memory\n");
-			rc = -ENOMEM;
-			goto bad;
-		}
-		memset(n, 0, sizeof(ebitmap_node_t));
 
-		n->startbit = le32_to_cpu(buf[0]);
+		for (j = 0, r = records; j < chunk;
+		     j++, r += EBITMAP_RECORD_SIZE) {
+			n = (ebitmap_node_t *) malloc(sizeof(ebitmap_node_t));
+			if (!n) {
+				printf("security: ebitmap: out of memory\n");
+				rc = -ENOMEM;
+				goto bad;
+			}
+			memset(n, 0, sizeof(ebitmap_node_t));
 
-		if (n->startbit & (MAPSIZE - 1)) {
-			printf
-			    ("security: ebitmap start bit (%d) is not a multiple of the map size (%zu)\n",
-			     n->startbit, MAPSIZE);
-			goto bad_free;
-		}
-		if (n->startbit > (e->highbit - MAPSIZE)) {
-			printf
-			    ("security: ebitmap start bit (%d) is beyond the end of the bitmap (%zu)\n",
-			     n->startbit, (e->highbit - MAPSIZE));
-			goto bad_free;
-		}
-		rc = next_entry(&map, fp, sizeof(uint64_t));
-		if (rc < 0) {
-			printf("security: ebitmap: truncated map\n");
-			goto bad_free;
-		}
-		n->map = le64_to_cpu(map);
+			memcpy(&buf[0], r, sizeof(uint32_t));
+			n->startbit = le32_to_cpu(buf[0]);
 
-		if (!n->map) {
-			printf
-			    ("security: ebitmap: null map in ebitmap (startbit %d)\n",
-			     n->startbit);
-			goto bad_free;
-		}
-		if (l) {
-			if (n->startbit <= l->startbit) {
+			if (n->startbit & (MAPSIZE - 1)) {
+				printf
+				    ("security: ebitmap start bit (%d) is not a multiple of the map size (%zu)\n",
+				     n->startbit, MAPSIZE);
+				goto bad_free;
+			}
+			if (n->startbit > (e->highbit - MAPSIZE)) {
 				printf
-				    ("security: ebitmap: start bit %d comes after start bit %d\n",
-				     n->startbit, l->startbit);
+				    ("security: ebitmap start bit (%d) is beyond the end of the bitmap (%zu)\n",
+				     n->startbit, (e->highbit - MAPSIZE));
 				goto bad_free;
 			}
-			l->next = n;
-		} else
-			e->node = n;
+			memcpy(&map, r + sizeof(uint32_t), sizeof(uint64_t));
+			n->map = le64_to_cpu(map);
 
-		l = n;
+			if (!n->map) {
+				printf
+				    ("security: ebitmap: null map in ebitmap (startbit %d)\n",
+				     n->startbit);
+				goto bad_free;
+			}
+			if (l) {
+				if (n->startbit <= l->startbit) {
+					printf
+					    ("security: ebitmap: start bit %d comes after start bit %d\n",
+					     n->startbit, l->startbit);
+					goto bad_free;
+				}
+				l->next = n;
+			} else
+				e->node = n;
+
+			l = n;
+		}
 	}
 
       ok:
@@ -33,9 +33,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "debug.h"
 #include "private.h"
+#include "trans_keys.h"
+#include "strpool.h"
+#include "sepol_trace.h"
 
 typedef struct expand_state {
 	int verbose;
@@ -47,6 +52,8 @@ typedef struct expand_state {
 	policydb_t *out;
 	sepol_handle_t *handle;
 	int expand_neverallow;
+	/* index of out->cond_list by expression, see cond_node_copy() */
+	hashtab_t cond_table;
 } expand_state_t;
 
 static void expand_state_init(expand_state_t * state)
@@ -60,9 +67,7 @@ static int map_ebitmap(ebitmap_t * src, ebitmap_t * dst, uint32_t * map)
 	ebitmap_node_t *tnode;
 	ebitmap_init(dst);
 
-	ebitmap_for_each_bit(src, tnode, i) {
-		if (!ebitmap_node_get_bit(tnode, i))
-			continue;
+	ebitmap_for_each_positive_bit(src, tnode, i) {
 		if (!map[i])
 			continue;
 		if (ebitmap_set_bit(dst, map[i] - 1, 1))
@@ -96,7 +101,7 @@ static int type_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	if (state->verbose)
 		INFO(state->handle, "copying type or attribute %s", id);
 
-	new_id = strdup(id);
+	new_id = strpool_dup(state->out->strpool, id);
 	if (new_id == NULL) {
 		ERR(state->handle, "Out of memory!");
 		return -1;
@@ -105,7 +110,7 @@ static int type_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	new_type = (type_datum_t *) malloc(sizeof(type_datum_t));
 	if (!new_type) {
 		ERR(state->handle, "Out of memory!");
-		free(new_id);
+		strpool_free(state->out->strpool, new_id);
 		return SEPOL_ENOMEM;
 	}
 	memset(new_type, 0, sizeof(type_datum_t));
@@ -114,7 +119,7 @@ static int type_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	new_type->flags = type->flags;
 	new_type->s.value = ++state->out->p_types.nprim;
 	if (new_type->s.value > UINT16_MAX) {
-		free(new_id);
+		strpool_free(state->out->strpool, new_id);
 		free(new_type);
 		ERR(state->handle, "type space overflow");
 		return -1;
@@ -126,7 +131,7 @@ static int type_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 			     (hashtab_key_t) new_id,
 			     (hashtab_datum_t) new_type);
 	if (ret) {
-		free(new_id);
+		strpool_free(state->out->strpool, new_id);
 		free(new_type);
 		ERR(state->handle, "hashtab overflow");
 		return -1;
@@ -184,17 +189,23 @@ static int attr_convert_callback(hashtab_key_t key, hashtab_datum_t datum,
 	return 0;
 }
 
+/* Where perm_copy_callback() puts the permissions of a class or common */
+struct perm_copy_args {
+	symtab_t *s;
+	struct strpool *pool;
+};
+
 static int perm_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 			      void *data)
 {
 	int ret;
 	char *id, *new_id;
-	symtab_t *s;
+	struct perm_copy_args *args = data;
+	symtab_t *s = args->s;
 	perm_datum_t *perm, *new_perm;
 
 	id = key;
 	perm = (perm_datum_t *) datum;
-	s = (symtab_t *) data;
 
 	new_perm = (perm_datum_t *) malloc(sizeof(perm_datum_t));
 	if (!new_perm) {
@@ -202,7 +213,7 @@ static int perm_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	}
 	memset(new_perm, 0, sizeof(perm_datum_t));
 
-	new_id = strdup(id);
+	new_id = strpool_dup(args->pool, id);
 	if (!new_id) {
 		free(new_perm);
 		return -1;
@@ -213,7 +224,7 @@ static int perm_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 
 	ret = hashtab_insert(s->table, new_id, (hashtab_datum_t *) new_perm);
 	if (ret) {
-		free(new_id);
+		strpool_free(args->pool, new_id);
 		free(new_perm);
 		return -1;
 	}
@@ -227,6 +238,7 @@ static int common_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	int ret;
 	char *id, *new_id;
 	common_datum_t *common, *new_common;
+	struct perm_copy_args perm_args;
 	expand_state_t *state;
 
 	id = (char *)key;
@@ -248,7 +260,7 @@ static int common_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		return -1;
 	}
 
-	new_id = strdup(id);
+	new_id = strpool_dup(state->out->strpool, id);
 	if (!new_id) {
 		ERR(state->handle, "Out of memory!");
 		/* free memory created by symtab_init first, then free new_common */
@@ -266,13 +278,14 @@ static int common_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	if (ret) {
 		ERR(state->handle, "hashtab overflow");
 		free(new_common);
-		free(new_id);
+		strpool_free(state->out->strpool, new_id);
 		return -1;
 	}
 
+	perm_args.s = &new_common->permissions;
+	perm_args.pool = state->out->strpool;
 	if (hashtab_map
-	    (common->permissions.table, perm_copy_callback,
-	     &new_common->permissions)) {
+	    (common->permissions.table, perm_copy_callback, &perm_args)) {
 		ERR(state->handle, "Out of memory!");
 		return -1;
 	}
@@ -413,6 +426,7 @@ static int class_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	int ret;
 	char *id, *new_id;
 	class_datum_t *class, *new_class;
+	struct perm_copy_args perm_args;
 	expand_state_t *state;
 
 	id = (char *)key;
@@ -448,7 +462,7 @@ static int class_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		return ret;
 	}
 	
-	new_id = strdup(id);
+	new_id = strpool_dup(state->out->strpool, id);
 	if (!new_id) {
 		ERR(state->handle, "Out of memory!");
 		free(new_class);
@@ -461,13 +475,14 @@ static int class_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	if (ret) {
 		ERR(state->handle, "hashtab overflow");
 		free(new_class);
-		free(new_id);
+		strpool_free(state->out->strpool, new_id);
 		return -1;
 	}
 
+	perm_args.s = &new_class->permissions;
+	perm_args.pool = state->out->strpool;
 	if (hashtab_map
-	    (class->permissions.table, perm_copy_callback,
-	     &new_class->permissions)) {
+	    (class->permissions.table, perm_copy_callback, &perm_args)) {
 		ERR(state->handle, "hashtab overflow");
 		return -1;
 	}
@@ -656,7 +671,7 @@ static int alias_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	if (state->verbose)
 		INFO(state->handle, "copying alias %s", id);
 
-	new_id = strdup(id);
+	new_id = strpool_dup(state->out->strpool, id);
 	if (!new_id) {
 		ERR(state->handle, "Out of memory!");
 		return -1;
@@ -665,7 +680,7 @@ static int alias_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	new_alias = (type_datum_t *) malloc(sizeof(type_datum_t));
 	if (!new_alias) {
 		ERR(state->handle, "Out of memory!");
-		free(new_id);
+		strpool_free(state->out->strpool, new_id);
 		return SEPOL_ENOMEM;
 	}
 	memset(new_alias, 0, sizeof(type_datum_t));
@@ -685,7 +700,7 @@ static int alias_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	if (ret) {
 		ERR(state->handle, "hashtab overflow");
 		free(new_alias);
-		free(new_id);
+		strpool_free(state->out->strpool, new_id);
 		return -1;
 	}
 
@@ -829,7 +844,7 @@ static int role_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		}
 		memset(new_role, 0, sizeof(role_datum_t));
 
-		new_id = strdup(id);
+		new_id = strpool_dup(state->out->strpool, id);
 		if (!new_id) {
 			ERR(state->handle, "Out of memory!");
 			free(new_role);
@@ -847,7 +862,7 @@ static int role_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		if (ret) {
 			ERR(state->handle, "hashtab overflow");
 			free(new_role);
-			free(new_id);
+			strpool_free(state->out->strpool, new_id);
 			return -1;
 		}
 	}
@@ -985,7 +1000,7 @@ static int user_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		new_user->s.value = state->out->p_users.nprim;
 		state->usermap[user->s.value - 1] = new_user->s.value;
 
-		new_id = strdup(id);
+		new_id = strpool_dup(state->out->strpool, id);
 		if (!new_id) {
 			ERR(state->handle, "Out of memory!");
 			free(new_user);
@@ -998,7 +1013,7 @@ static int user_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 			ERR(state->handle, "hashtab overflow");
 			user_datum_destroy(new_user);
 			free(new_user);
-			free(new_id);
+			strpool_free(state->out->strpool, new_id);
 			return -1;
 		}
 
@@ -1094,7 +1109,7 @@ static int bool_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		return -1;
 	}
 
-	new_id = strdup(id);
+	new_id = strpool_dup(state->out->strpool, id);
 	if (!new_id) {
 		ERR(state->handle, "Out of memory!");
 		free(new_bool);
@@ -1110,7 +1125,7 @@ static int bool_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	if (ret) {
 		ERR(state->handle, "hashtab overflow");
 		free(new_bool);
-		free(new_id);
+		strpool_free(state->out->strpool, new_id);
 		return -1;
 	}
 
@@ -1145,7 +1160,7 @@ static int sens_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	if (!new_level->level)
 		goto out_of_mem;
 	mls_level_init(new_level->level);
-	new_id = strdup(id);
+	new_id = strpool_dup(state->out->strpool, id);
 	if (!new_id)
 		goto out_of_mem;
 
@@ -1170,7 +1185,7 @@ static int sens_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	}
 	level_datum_destroy(new_level);
 	free(new_level);
-	free(new_id);
+	strpool_free(state->out->strpool, new_id);
 	return -1;
 }
 
@@ -1193,7 +1208,7 @@ static int cats_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	if (!new_cat)
 		goto out_of_mem;
 	cat_datum_init(new_cat);
-	new_id = strdup(id);
+	new_id = strpool_dup(state->out->strpool, id);
 	if (!new_id)
 		goto out_of_mem;
 
@@ -1211,7 +1226,7 @@ static int cats_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	ERR(state->handle, "Out of memory!");
 	cat_datum_destroy(new_cat);
 	free(new_cat);
-	free(new_id);
+	strpool_free(state->out->strpool, new_id);
 	return -1;
 }
 
@@ -1241,12 +1256,8 @@ static int copy_role_allows(expand_state_t * state, role_allow_rule_t * rules)
 			return -1;
 		}
 
-		ebitmap_for_each_bit(&roles, snode, i) {
-			if (!ebitmap_node_get_bit(snode, i))
-				continue;
-			ebitmap_for_each_bit(&new_roles, tnode, j) {
-				if (!ebitmap_node_get_bit(tnode, j))
-					continue;
+		ebitmap_for_each_positive_bit(&roles, snode, i) {
+			ebitmap_for_each_positive_bit(&new_roles, tnode, j) {
 				/* check for duplicates */
 				cur_allow = state->out->role_allow;
 				while (cur_allow) {
@@ -1309,45 +1320,29 @@ static int copy_role_trans(expand_state_t * state, role_trans_rule_t * rules)
 			ERR(state->handle, "Out of memory!");
 			return -1;
 		}
-		ebitmap_for_each_bit(&roles, rnode, i) {
-			if (!ebitmap_node_get_bit(rnode, i))
-				continue;
-			ebitmap_for_each_bit(&types, tnode, j) {
-				if (!ebitmap_node_get_bit(tnode, j))
-					continue;
-				ebitmap_for_each_bit(&cur->classes, cnode, k) {
-					if (!ebitmap_node_get_bit(cnode, k))
-						continue;
+		ebitmap_for_each_positive_bit(&roles, rnode, i) {
+			ebitmap_for_each_positive_bit(&types, tnode, j) {
+				ebitmap_for_each_positive_bit(&cur->classes, cnode, k) {
+
+					unsigned int mapped_role;
+
+					mapped_role = state->rolemap[cur->new_role - 1];
 
-					cur_trans = state->out->role_tr;
-					while (cur_trans) {
-						unsigned int mapped_role;
-
-						mapped_role = state->rolemap[cur->new_role - 1];
-
-						if ((cur_trans->role ==
-								i + 1) &&
-						    (cur_trans->type ==
-								j + 1) &&
-						    (cur_trans->tclass ==
-								k + 1)) {
-							if (cur_trans->new_role == mapped_role) {
-								break;
-							} else {
-								ERR(state->handle,
-									"Conflicting role trans rule %s %s : %s { %s vs %s }",
-									state->out->p_role_val_to_name[i],
-									state->out->p_type_val_to_name[j],
-									state->out->p_class_val_to_name[k],
-									state->out->p_role_val_to_name[mapped_role - 1],
-									state->out->p_role_val_to_name[cur_trans->new_role - 1]);
-								return -1;
-							}
-						}
-						cur_trans = cur_trans->next;
+					cur_trans = trans_keys_find_role(state->out,
+									 i + 1, j + 1,
+									 k + 1);
+					if (cur_trans) {
+						if (cur_trans->new_role == mapped_role)
+							continue;
+						ERR(state->handle,
+							"Conflicting role trans rule %s %s : %s { %s vs %s }",
+							state->out->p_role_val_to_name[i],
+							state->out->p_type_val_to_name[j],
+							state->out->p_class_val_to_name[k],
+							state->out->p_role_val_to_name[mapped_role - 1],
+							state->out->p_role_val_to_name[cur_trans->new_role - 1]);
+						return -1;
 					}
-					if (cur_trans)
-						continue;
 
 					n = (role_trans_t *)
 						malloc(sizeof(role_trans_t));
@@ -1366,6 +1361,7 @@ static int copy_role_trans(expand_state_t * state, role_trans_rule_t * rules)
 						l->next = n;
 					else
 						state->out->role_tr = n;
+					trans_keys_add_role(state->out, n);
 
 					l = n;
 				}
@@ -1409,38 +1405,28 @@ static int expand_filename_trans(expand_state_t *state, filename_trans_rule_t *r
 
 		mapped_otype = state->typemap[cur_rule->otype - 1];
 
-		ebitmap_for_each_bit(&stypes, snode, i) {
-			if (!ebitmap_node_get_bit(snode, i))
-				continue;
-			ebitmap_for_each_bit(&ttypes, tnode, j) {
-				if (!ebitmap_node_get_bit(tnode, j))
-					continue;
+		ebitmap_for_each_positive_bit(&stypes, snode, i) {
+			ebitmap_for_each_positive_bit(&ttypes, tnode, j) {
+
+				cur_trans = trans_keys_find_filename(state->out,
+								     i + 1, j + 1,
+								     cur_rule->tclass,
+								     cur_rule->name);
+				if (cur_trans) {
+					/* duplicate rule, who cares */
+					if (cur_trans->otype == mapped_otype)
+						continue;
 
-				cur_trans = state->out->filename_trans;
-				while (cur_trans) {
-					if ((cur_trans->stype == i + 1) &&
-					    (cur_trans->ttype == j + 1) &&
-					    (cur_trans->tclass == cur_rule->tclass) &&
-					    (!strcmp(cur_trans->name, cur_rule->name))) {
-						/* duplicate rule, who cares */
-						if (cur_trans->otype == mapped_otype)
-							break;
-
-						ERR(state->handle, "Conflicting name-based type_transition %s %s:%s \"%s\":  %s vs %s",
-						    state->out->p_type_val_to_name[i],
-						    state->out->p_type_val_to_name[j],
-						    state->out->p_class_val_to_name[cur_trans->tclass - 1],
-						    cur_trans->name,
-						    state->out->p_type_val_to_name[cur_trans->otype - 1],
-						    state->out->p_type_val_to_name[mapped_otype - 1]);
+					ERR(state->handle, "Conflicting name-based type_transition %s %s:%s \"%s\":  %s vs %s",
+					    state->out->p_type_val_to_name[i],
+					    state->out->p_type_val_to_name[j],
+					    state->out->p_class_val_to_name[cur_trans->tclass - 1],
+					    cur_trans->name,
+					    state->out->p_type_val_to_name[cur_trans->otype - 1],
+					    state->out->p_type_val_to_name[mapped_otype - 1]);
 
-						return -1;
-					}
-					cur_trans = cur_trans->next;
+					return -1;
 				}
-				/* duplicate rule, who cares */
-				if (cur_trans)
-					continue;
 
 				new_trans = malloc(sizeof(*new_trans));
 				if (!new_trans) {
@@ -1460,6 +1446,7 @@ static int expand_filename_trans(expand_state_t *state, filename_trans_rule_t *r
 				new_trans->ttype = j + 1;
 				new_trans->tclass = cur_rule->tclass;
 				new_trans->otype = mapped_otype;
+				trans_keys_add_filename(state->out, new_trans);
 			}
 		}
 
@@ -1475,7 +1462,7 @@ static int exp_rangetr_helper(uint32_t stype, uint32_t ttype, uint32_t tclass,
 			      mls_semantic_range_t * trange,
 			      expand_state_t * state)
 {
-	range_trans_t *rt, *check_rt = state->out->range_tr;
+	range_trans_t *rt, *check_rt;
 	mls_range_t exp_range;
 	int rc = -1;
 
@@ -1484,29 +1471,19 @@ static int exp_rangetr_helper(uint32_t stype, uint32_t ttype, uint32_t tclass,
 		goto out;
 
 	/* check for duplicates/conflicts */
-	while (check_rt) {
-		if ((check_rt->source_type == stype) &&
-		    (check_rt->target_type == ttype) &&
-		    (check_rt->target_class == tclass)) {
-			if (mls_range_eq(&check_rt->target_range, &exp_range)) {
-				/* duplicate */
-				break;
-			} else {
-				/* conflict */
-				ERR(state->handle,
-				    "Conflicting range trans rule %s %s : %s",
-				    state->out->p_type_val_to_name[stype - 1],
-				    state->out->p_type_val_to_name[ttype - 1],
-				    state->out->p_class_val_to_name[tclass -
-								    1]);
-				goto out;
-			}
-		}
-		check_rt = check_rt->next;
-	}
+	check_rt = trans_keys_find_range(state->out, stype, ttype, tclass);
 	if (check_rt) {
-		/* this is a dup - skip */
-		rc = 0;
+		if (mls_range_eq(&check_rt->target_range, &exp_range)) {
+			/* this is a dup - skip */
+			rc = 0;
+		} else {
+			/* conflict */
+			ERR(state->handle,
+			    "Conflicting range trans rule %s %s : %s",
+			    state->out->p_type_val_to_name[stype - 1],
+			    state->out->p_type_val_to_name[ttype - 1],
+			    state->out->p_class_val_to_name[tclass - 1]);
+		}
 		goto out;
 	}
 
@@ -1526,6 +1503,7 @@ static int exp_rangetr_helper(uint32_t stype, uint32_t ttype, uint32_t tclass,
 		ERR(state->handle, "Out of memory!");
 		goto out;
 	}
+	trans_keys_add_range(state->out, rt);
 
 	rc = 0;
 
@@ -1564,17 +1542,11 @@ static int expand_range_trans(expand_state_t * state,
 		}
 
 		/* loop on source type */
-		ebitmap_for_each_bit(&stypes, snode, i) {
-			if (!ebitmap_node_get_bit(snode, i))
-				continue;
+		ebitmap_for_each_positive_bit(&stypes, snode, i) {
 			/* loop on target type */
-			ebitmap_for_each_bit(&ttypes, tnode, j) {
-				if (!ebitmap_node_get_bit(tnode, j))
-					continue;
+			ebitmap_for_each_positive_bit(&ttypes, tnode, j) {
 				/* loop on target class */
-				ebitmap_for_each_bit(&rule->tclasses, cnode, k) {
-					if (!ebitmap_node_get_bit(cnode, k))
-						continue;
+				ebitmap_for_each_positive_bit(&rule->tclasses, cnode, k) {
 
 					if (exp_rangetr_helper(i + 1,
 							       j + 1,
@@ -1598,14 +1570,15 @@ static int expand_range_trans(expand_state_t * state,
 
 /* Search for an AV tab node within a hash table with the given key.
  * If the node does not exist, create it and return it; otherwise
- * return the pre-existing one.
+ * return the pre-existing one.  If avtab is an overlay over base, a
+ * new node takes its initial datum from base.
 */
 static avtab_ptr_t find_avtab_node(sepol_handle_t * handle,
 				   avtab_t * avtab, avtab_key_t * key,
-				   cond_av_list_t ** cond)
+				   cond_av_list_t ** cond, avtab_t * base)
 {
 	avtab_ptr_t node;
-	avtab_datum_t avdatum;
+	avtab_datum_t avdatum, *basedatum;
 	cond_av_list_t *nl;
 
 	node = avtab_search_node(avtab, key);
@@ -1622,6 +1595,9 @@ static avtab_ptr_t find_avtab_node(sepol_handle_t * handle,
 
 	if (!node) {
 		memset(&avdatum, 0, sizeof avdatum);
+		/* a node that is new to an overlay starts from the base value */
+		if (base && (basedatum = avtab_search(base, key)))
+			avdatum = *basedatum;
 		/* this is used to get the node - insertion is actually unique */
 		node = avtab_insert_nonunique(avtab, key, &avdatum);
 		if (!node) {
@@ -1654,7 +1630,7 @@ static int expand_terule_helper(sepol_handle_t * handle,
 				uint32_t specified, cond_av_list_t ** cond,
 				cond_av_list_t ** other, uint32_t stype,
 				uint32_t ttype, class_perm_node_t * perms,
-				avtab_t * avtab, int enabled)
+				avtab_t * avtab, int enabled, avtab_t * base)
 {
 	avtab_key_t avkey;
 	avtab_datum_t *avdatump;
@@ -1687,6 +1663,8 @@ static int expand_terule_helper(sepol_handle_t * handle,
 		 * either in the global scope or in another
 		 * conditional AV tab */
 		node = avtab_search_node(&p->te_avtab, &avkey);
+		if (!node && base)
+			node = avtab_search_node(avtab, &avkey);
 		if (node) {
 			conflict = 1;
 		} else {
@@ -1732,7 +1710,7 @@ static int expand_terule_helper(sepol_handle_t * handle,
 			return EXPAND_RULE_CONFLICT;
 		}
 
-		node = find_avtab_node(handle, avtab, &avkey, cond);
+		node = find_avtab_node(handle, avtab, &avkey, cond, NULL);
 		if (!node)
 			return -1;
 		if (enabled) {
@@ -1763,7 +1741,7 @@ static int expand_avrule_helper(sepol_handle_t * handle,
 				cond_av_list_t ** cond,
 				uint32_t stype, uint32_t ttype,
 				class_perm_node_t * perms, avtab_t * avtab,
-				int enabled)
+				int enabled, avtab_t * base)
 {
 	avtab_key_t avkey;
 	avtab_datum_t *avdatump;
@@ -1794,7 +1772,7 @@ static int expand_avrule_helper(sepol_handle_t * handle,
 		avkey.target_class = cur->class;
 		avkey.specified = spec;
 
-		node = find_avtab_node(handle, avtab, &avkey, cond);
+		node = find_avtab_node(handle, avtab, &avkey, cond, base);
 		if (!node)
 			return EXPAND_RULE_ERROR;
 		if (enabled) {
@@ -1838,45 +1816,42 @@ static int expand_rule_helper(sepol_handle_t * handle,
 			      avrule_t * source_rule, avtab_t * dest_avtab,
 			      cond_av_list_t ** cond, cond_av_list_t ** other,
 			      int enabled,
-			      ebitmap_t * stypes, ebitmap_t * ttypes)
+			      ebitmap_t * stypes, ebitmap_t * ttypes,
+			      avtab_t * base)
 {
 	unsigned int i, j;
 	int retval;
 	ebitmap_node_t *snode, *tnode;
 
-	ebitmap_for_each_bit(stypes, snode, i) {
-		if (!ebitmap_node_get_bit(snode, i))
-			continue;
+	ebitmap_for_each_positive_bit(stypes, snode, i) {
 		if (source_rule->flags & RULE_SELF) {
 			if (source_rule->specified & AVRULE_AV) {
 				retval = expand_avrule_helper(handle, source_rule->specified,
 							      cond, i, i, source_rule->perms,
-							      dest_avtab, enabled);
+							      dest_avtab, enabled, base);
 				if (retval != EXPAND_RULE_SUCCESS)
 					return retval;
 			} else {
 				retval = expand_terule_helper(handle, p, typemap,
 							      source_rule->specified, cond,
 							      other, i, i, source_rule->perms,
-							      dest_avtab, enabled);
+							      dest_avtab, enabled, base);
 				if (retval != EXPAND_RULE_SUCCESS)
 					return retval;
 			}
 		}
-		ebitmap_for_each_bit(ttypes, tnode, j) {
-			if (!ebitmap_node_get_bit(tnode, j))
-				continue;
+		ebitmap_for_each_positive_bit(ttypes, tnode, j) {
 			if (source_rule->specified & AVRULE_AV) {
 				retval = expand_avrule_helper(handle, source_rule->specified,
 							      cond, i, j, source_rule->perms,
-							      dest_avtab, enabled);
+							      dest_avtab, enabled, base);
 				if (retval != EXPAND_RULE_SUCCESS)
 					return retval;
 			} else {
 				retval = expand_terule_helper(handle, p, typemap,
 							      source_rule->specified, cond,
 							      other, i, j, source_rule->perms,
-							      dest_avtab, enabled);
+							      dest_avtab, enabled, base);
 				if (retval != EXPAND_RULE_SUCCESS)
 					return retval;
 			}
@@ -1922,7 +1897,8 @@ static int convert_and_expand_rule(sepol_handle_t * handle,
 
 	retval = expand_rule_helper(handle, dest_pol, typemap,
 				    source_rule, dest_avtab,
-				    cond, other, enabled, &stypes, &ttypes);
+				    cond, other, enabled, &stypes, &ttypes,
+				    NULL);
 	ebitmap_destroy(&stypes);
 	ebitmap_destroy(&ttypes);
 	return retval;
@@ -2013,15 +1989,18 @@ static int cond_node_copy(expand_state_t * state, cond_node_t * cn)
 		return -1;
 	}
 
-	new_cond = cond_node_search(state->out, state->out->cond_list, tmp);
+	if (!state->cond_table)
+		state->cond_table = cond_node_table_create(state->out->cond_list);
+	new_cond = NULL;
+	if (state->cond_table)
+		new_cond = cond_node_table_search(state->out, state->cond_table,
+						  &state->out->cond_list, tmp);
+	cond_node_destroy(tmp);
+	free(tmp);
 	if (!new_cond) {
-		cond_node_destroy(tmp);
-		free(tmp);
 		ERR(state->handle, "Out of memory!");
 		return -1;
 	}
-	cond_node_destroy(tmp);
-	free(tmp);
 
 	if (cond_avrule_list_copy
 	    (state->out, cn->avtrue_list, &state->out->te_cond_avtab,
@@ -2269,9 +2248,7 @@ static int type_attr_map(hashtab_key_t key
 			ERR(state->handle, "Out of memory!");
 			return -1;
 		}
-		ebitmap_for_each_bit(&type->types, tnode, i) {
-			if (!ebitmap_node_get_bit(tnode, i))
-				continue;
+		ebitmap_for_each_positive_bit(&type->types, tnode, i) {
 			if (ebitmap_set_bit(&p->type_attr_map[i],
 					    type->s.value - 1, 1)) {
 				ERR(state->handle, "Out of memory!");
@@ -2332,7 +2309,8 @@ int expand_rule(sepol_handle_t * handle,
 		return -1;
 	retval = expand_rule_helper(handle, source_pol, NULL,
 				    source_rule, dest_avtab,
-				    cond, other, enabled, &stypes, &ttypes);
+				    cond, other, enabled, &stypes, &ttypes,
+				    NULL);
 	ebitmap_destroy(&stypes);
 	ebitmap_destroy(&ttypes);
 	return retval;
@@ -2421,49 +2399,52 @@ bad:
 	return -1;
 }
 
+/* The types of p that are not attributes, built a word at a time. */
+static int type_set_nonattr(policydb_t * p, ebitmap_t * e)
+{
+	ebitmap_node_t *tail = NULL;
+	type_datum_t *type;
+	MAPTYPE map = 0;
+	uint32_t i, nprim = p->p_types.nprim;
+
+	ebitmap_init(e);
+	for (i = 0; i < nprim; i++) {
+		type = p->type_val_to_struct[i];
+		if (!type || type->flavor != TYPE_ATTRIB)
+			map |= MAPBIT << (i & (MAPSIZE - 1));
+		if ((i & (MAPSIZE - 1)) == MAPSIZE - 1 || i == nprim - 1) {
+			if (ebitmap_append(e, &tail, i & ~(MAPSIZE - 1), map)) {
+				ebitmap_destroy(e);
+				return -1;
+			}
+			map = 0;
+		}
+	}
+	return 0;
+}
+
 /* Expand a type set into an ebitmap containing the types. This
  * handles the negset, attributes, and flags.
  * Attribute expansion depends on several factors:
  * - if alwaysexpand is 1, then they will be expanded,
- * - if the type set has a negset or flags, then they will be expanded,
+ * - if the type set has flags, then they will be expanded,
+ * - if the type set has a negset, then only the attributes that
+ *   share a type with the negset will be expanded,
  * - otherwise, they will not be expanded.
  */
 int type_set_expand(type_set_t * set, ebitmap_t * t, policydb_t * p,
 		    unsigned char alwaysexpand)
 {
 	unsigned int i;
-	ebitmap_t types, neg_types;
+	ebitmap_t types, neg_types, nonattr, comp;
 	ebitmap_node_t *tnode;
+	type_datum_t *type;
 
 	ebitmap_init(&types);
+	ebitmap_init(&nonattr);
 	ebitmap_init(t);
 
-	if (alwaysexpand || ebitmap_length(&set->negset) || set->flags) {
-		/* First go through the types and OR all the attributes to types */
-		ebitmap_for_each_bit(&set->types, tnode, i) {
-			if (ebitmap_node_get_bit(tnode, i)) {
-				if (p->type_val_to_struct[i]->flavor ==
-				    TYPE_ATTRIB) {
-					if (ebitmap_union
-					    (&types,
-					     &p->type_val_to_struct[i]->
-					     types)) {
-						return -1;
-					}
-				} else {
-					if (ebitmap_set_bit(&types, i, 1)) {
-						return -1;
-					}
-				}
-			}
-		}
-	} else {
-		/* No expansion of attributes, just copy the set as is. */
-		if (ebitmap_cpy(&types, &set->types))
-			return -1;
-	}
-
-	/* Now do the same thing for negset */
+	/* First expand the negset to types */
 	ebitmap_init(&neg_types);
 	ebitmap_for_each_bit(&set->negset, tnode, i) {
 		if (ebitmap_node_get_bit(tnode, i)) {
@@ -2482,50 +2463,68 @@ int type_set_expand(type_set_t * set, ebitmap_t * t, policydb_t * p,
 		}
 	}
 
-	if (set->flags & TYPE_STAR) {
-		/* set all types not in neg_types */
-		for (i = 0; i < p->p_types.nprim; i++) {
-			if (ebitmap_get_bit(&neg_types, i))
-				continue;
-			if (p->type_val_to_struct[i] &&
-			    p->type_val_to_struct[i]->flavor == TYPE_ATTRIB)
+	if (alwaysexpand || ebitmap_length(&set->negset) || set->flags) {
+		/* Now go through the types and OR all the attributes to
+		 * types, keeping those attributes that the negset leaves
+		 * whole if we are allowed to. */
+		ebitmap_for_each_bit(&set->types, tnode, i) {
+			if (!ebitmap_node_get_bit(tnode, i))
 				continue;
-			if (ebitmap_set_bit(t, i, 1))
-				return -1;
+			type = p->type_val_to_struct[i];
+			if (type->flavor == TYPE_ATTRIB &&
+			    (alwaysexpand || set->flags ||
+			     ebitmap_match_any(&type->types, &neg_types))) {
+				if (ebitmap_union(&types, &type->types))
+					return -1;
+			} else {
+				if (ebitmap_set_bit(&types, i, 1))
+					return -1;
+			}
 		}
-		goto out;
+	} else {
+		/* No expansion of attributes, just copy the set as is. */
+		if (ebitmap_cpy(&types, &set->types))
+			return -1;
 	}
 
-	ebitmap_for_each_bit(&types, tnode, i) {
-		if (ebitmap_node_get_bit(tnode, i)
-		    && (!ebitmap_get_bit(&neg_types, i)))
-			if (ebitmap_set_bit(t, i, 1))
-				return -1;
+	/*
+	 * The rest is set arithmetic, done a word at a time: setting bit
+	 * by bit walks t from its head for every type.
+	 */
+	if (set->flags & TYPE_STAR) {
+		/* set all types not in neg_types */
+		if (type_set_nonattr(p, &nonattr) ||
+		    ebitmap_andnot(t, &nonattr, &neg_types, p->p_types.nprim))
+			goto err;
+		goto out;
 	}
 
+	if (ebitmap_andnot(t, &types, &neg_types, ebitmap_length(&types)))
+		goto err;
+
 	if (set->flags & TYPE_COMP) {
-		for (i = 0; i < p->p_types.nprim; i++) {
-			if (p->type_val_to_struct[i] &&
-			    p->type_val_to_struct[i]->flavor == TYPE_ATTRIB) {
-				assert(!ebitmap_get_bit(t, i));
-				continue;
-			}
-			if (ebitmap_get_bit(t, i)) {
-				if (ebitmap_set_bit(t, i, 0))
-					return -1;
-			} else {
-				if (ebitmap_set_bit(t, i, 1))
-					return -1;
-			}
-		}
+		/* t holds no attributes, so this flips each type */
+		if (type_set_nonattr(p, &nonattr) ||
+		    ebitmap_andnot(&comp, &nonattr, t, p->p_types.nprim))
+			goto err;
+		ebitmap_destroy(t);
+		*t = comp;
 	}
 
       out:
 
 	ebitmap_destroy(&types);
 	ebitmap_destroy(&neg_types);
+	ebitmap_destroy(&nonattr);
 
 	return 0;
+
+      err:
+	ebitmap_destroy(t);
+	ebitmap_destroy(&types);
+	ebitmap_destroy(&neg_types);
+	ebitmap_destroy(&nonattr);
+	return -1;
 }
 
 static int copy_neverallow(policydb_t * dest_pol, uint32_t * typemap,
@@ -2618,6 +2617,186 @@ static int copy_neverallow(policydb_t * dest_pol, uint32_t * typemap,
 	return -1;
 }
 
+/*
+ * The unconditional AV rules of a block are expanded by up to
+ * EXPAND_MAX_THREADS threads, one for every EXPAND_RULES_PER_THREAD
+ * rules.  Each part owns the source types whose value is congruent to
+ * its number, and expands every rule in order into a private overlay
+ * over te_avtab, which is left untouched until all parts are done, so
+ * that each key sees the same sequence of updates and conflict checks
+ * as it would if expanded serially.  The overlays are then folded into
+ * te_avtab.  If any part fails, the block is expanded serially again
+ * to report the error exactly as before.
+ */
+#define EXPAND_MAX_THREADS 8
+#define EXPAND_RULES_PER_THREAD 64
+
+struct expand_avrule_work {
+	expand_state_t *state;
+	sepol_handle_t handle;	/* silent copy of the state's handle */
+	avrule_t **rules;
+	unsigned int nrules;
+	unsigned int nparts;
+	unsigned int next;	/* next part to be taken */
+	int failed;
+	avtab_t *parts;
+};
+
+static int expand_avrule_part(struct expand_avrule_work *w, unsigned int n)
+{
+	expand_state_t *state = w->state;
+	avtab_t *avtab = &w->parts[n];
+	ebitmap_t stypes, ttypes, owned;
+	ebitmap_node_t *snode;
+	unsigned char alwaysexpand;
+	unsigned int i, k;
+	int rc = EXPAND_RULE_SUCCESS;
+
+	for (k = 0; k < w->nrules && rc == EXPAND_RULE_SUCCESS; k++) {
+		avrule_t *rule = w->rules[k];
+
+		if (__atomic_load_n(&w->failed, __ATOMIC_RELAXED))
+			return -1;
+
+		ebitmap_init(&stypes);
+		ebitmap_init(&ttypes);
+		ebitmap_init(&owned);
+
+		alwaysexpand = ((rule->specified & AVRULE_TYPE) ||
+				(rule->flags & RULE_SELF));
+		if (expand_convert_type_set(state->out, state->typemap,
+					    &rule->stypes, &stypes,
+					    alwaysexpand) ||
+		    expand_convert_type_set(state->out, state->typemap,
+					    &rule->ttypes, &ttypes,
+					    alwaysexpand))
+			rc = EXPAND_RULE_ERROR;
+
+		ebitmap_for_each_positive_bit(&stypes, snode, i) {
+			if (rc != EXPAND_RULE_SUCCESS)
+				break;
+			if (i % w->nparts == n && ebitmap_set_bit(&owned, i, 1))
+				rc = EXPAND_RULE_ERROR;
+		}
+
+		if (rc == EXPAND_RULE_SUCCESS && ebitmap_length(&owned))
+			rc = expand_rule_helper(&w->handle, state->out,
+						state->typemap, rule, avtab,
+						NULL, NULL, 0, &owned, &ttypes,
+						&state->out->te_avtab);
+
+		ebitmap_destroy(&stypes);
+		ebitmap_destroy(&ttypes);
+		ebitmap_destroy(&owned);
+	}
+
+	return rc == EXPAND_RULE_SUCCESS ? 0 : -1;
+}
+
+static void *expand_avrule_worker(void *arg)
+{
+	struct expand_avrule_work *w = arg;
+	unsigned int n;
+
+	for (;;) {
+		n = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED);
+		if (n >= w->nparts)
+			break;
+		if (expand_avrule_part(w, n))
+			__atomic_store_n(&w->failed, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static int expand_avrule_merge(avtab_t * dest, avtab_t * part)
+{
+	avtab_ptr_t cur, node;
+	unsigned int i;
+
+	for (i = 0; i < part->nslot; i++) {
+		for (cur = part->htable[i]; cur; cur = cur->next) {
+			node = avtab_search_node(dest, &cur->key);
+			if (!node)
+				node = avtab_insert_nonunique(dest, &cur->key,
+							      &cur->datum);
+			if (!node)
+				return -1;
+			node->datum = cur->datum;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Expand the unconditional AV rules of a block on several threads.
+ * Returns 0 on success, 1 if the rules should be expanded serially
+ * instead, or -1 on error.
+ */
+static int expand_avrules_threaded(expand_state_t * state, avrule_t ** rules,
+				   unsigned int nrules)
+{
+	pthread_t threads[EXPAND_MAX_THREADS];
+	avtab_t parts[EXPAND_MAX_THREADS];
+	struct expand_avrule_work w;
+	unsigned int i, nthreads;
+	long ncpu;
+	int rc = 1;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = nrules / EXPAND_RULES_PER_THREAD;
+	if (ncpu > 0 && nthreads > (unsigned long)ncpu)
+		nthreads = ncpu;
+	if (nthreads > EXPAND_MAX_THREADS)
+		nthreads = EXPAND_MAX_THREADS;
+	if (nthreads < 2)
+		return 1;
+
+	memset(&w, 0, sizeof(w));
+	if (state->handle)
+		w.handle = *state->handle;
+	w.handle.msg_callback = NULL;
+	w.state = state;
+	w.rules = rules;
+	w.nrules = nrules;
+	w.nparts = nthreads;
+	w.parts = parts;
+
+	for (i = 0; i < w.nparts; i++) {
+		if (avtab_init(&parts[i]) ||
+		    avtab_alloc(&parts[i], MAX_AVTAB_SIZE)) {
+			w.nparts = i;
+			goto out;
+		}
+	}
+
+	/* the calling thread always does its share */
+	for (i = 0; i + 1 < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, expand_avrule_worker, &w))
+			break;
+	}
+	nthreads = i;
+	expand_avrule_worker(&w);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (w.failed)
+		goto out;
+
+	for (i = 0; i < w.nparts; i++) {
+		if (expand_avrule_merge(&state->out->te_avtab, &parts[i])) {
+			ERR(state->handle, "Out of memory!");
+			rc = -1;
+			goto out;
+		}
+	}
+	rc = 0;
+
+      out:
+	for (i = 0; i < w.nparts; i++)
+		avtab_destroy(&parts[i]);
+	return rc;
+}
+
 /* 
  * Expands the avrule blocks for a policy. RBAC rules are copied. Neverallow
  * rules are copied or expanded as per the settings in the state object; all
@@ -2628,7 +2807,9 @@ static int copy_and_expand_avrule_block(expand_state_t * state)
 {
 	avrule_block_t *curblock = state->base->global;
 	avrule_block_t *prevblock;
-	int retval = -1;
+	avrule_t **rules = NULL;
+	unsigned int i, nrules, rules_size = 0;
+	int rc, retval = -1;
 
 	if (avtab_alloc(&state->out->te_avtab, MAX_AVTAB_SIZE)) {
  		ERR(state->handle, "Out of Memory!");
@@ -2663,6 +2844,7 @@ static int copy_and_expand_avrule_block(expand_state_t * state)
 			goto cleanup;
 
 		/* copy rules */
+		nrules = 0;
 		cur_avrule = decl->avrules;
 		while (cur_avrule != NULL) {
 			if (!(state->expand_neverallow)
@@ -2676,18 +2858,38 @@ static int copy_and_expand_avrule_block(expand_state_t * state)
 				if (cur_avrule->specified & AVRULE_NEVERALLOW) {
 					state->out->unsupported_format = 1;
 				}
-				if (convert_and_expand_rule
-				    (state->handle, state->out, state->typemap,
-				     cur_avrule, &state->out->te_avtab, NULL,
-				     NULL, 0,
-				     state->expand_neverallow) !=
-				    EXPAND_RULE_SUCCESS) {
-					goto cleanup;
+				if (nrules == rules_size) {
+					avrule_t **new_rules;
+
+					rules_size = rules_size ? rules_size * 2 : 64;
+					new_rules = realloc(rules, rules_size *
+							    sizeof(*rules));
+					if (!new_rules) {
+						ERR(state->handle,
+						    "Out of memory!");
+						goto cleanup;
+					}
+					rules = new_rules;
 				}
+				rules[nrules++] = cur_avrule;
 			}
 			cur_avrule = cur_avrule->next;
 		}
 
+		rc = expand_avrules_threaded(state, rules, nrules);
+		if (rc < 0)
+			goto cleanup;
+		for (i = 0; rc > 0 && i < nrules; i++) {
+			if (convert_and_expand_rule
+			    (state->handle, state->out, state->typemap,
+			     rules[i], &state->out->te_avtab, NULL,
+			     NULL, 0,
+			     state->expand_neverallow) !=
+			    EXPAND_RULE_SUCCESS) {
+				goto cleanup;
+			}
+		}
+
 		/* copy conditional rules */
 		if (cond_node_copy(state, decl->cond_list))
 			goto cleanup;
@@ -2708,6 +2910,9 @@ static int copy_and_expand_avrule_block(expand_state_t * state)
 	retval = 0;
 
       cleanup:
+	free(rules);
+	hashtab_destroy(state->cond_table);
+	state->cond_table = NULL;
 	return retval;
 }
 
@@ -2852,6 +3057,8 @@ int expand_module(sepol_handle_t * handle,
 	expand_state_t state;
 	avrule_block_t *curblock;
 
+	SEPOL_PROBE1(expand_begin, verbose);
+
 	/* Append tunable's avtrue_list or avfalse_list to the avrules list
 	 * of its home decl depending on its state value, so that the effect
 	 * rules of a tunable would be added to te_avtab permanently. Whereas
@@ -2872,12 +3079,16 @@ int expand_module(sepol_handle_t * handle,
 
 	if (base->policy_type != POLICY_BASE) {
 		ERR(handle, "Target of expand was not a base policy.");
-		return -1;
+		goto cleanup;
 	}
 
 	state.out->policy_type = POLICY_KERN;
 	state.out->policyvers = POLICYDB_VERSION_MAX;
 
+	/* Share the names of base instead of copying them */
+	if (!out->strpool)
+		out->strpool = strpool_get(base->strpool);
+
 	/* Copy mls state from base to out */
 	out->mls = base->mls;
 	out->handle_unknown = base->handle_unknown;
@@ -2917,6 +3128,7 @@ int expand_module(sepol_handle_t * handle,
 	}
 
 	/* order is important - types must be first */
+	SEPOL_PROBE1(expand_phase, "symbols");
 
 	/* copy types */
 	if (hashtab_map(state.base->p_types.table, type_copy_callback, &state)) {
@@ -3000,6 +3212,7 @@ int expand_module(sepol_handle_t * handle,
 	}
 
 	/* loop through all decls and union attributes, roles, users */
+	SEPOL_PROBE1(expand_phase, "decls");
 	for (curblock = state.base->global; curblock != NULL;
 	     curblock = curblock->next) {
 		avrule_decl_t *decl = curblock->enabled;
@@ -3032,6 +3245,7 @@ int expand_module(sepol_handle_t * handle,
 		goto cleanup;
 	}
 
+	SEPOL_PROBE1(expand_phase, "avrules");
 	if (copy_and_expand_avrule_block(&state) < 0) {
 		ERR(handle, "Error during expand");
 		goto cleanup;
@@ -3043,11 +3257,13 @@ int expand_module(sepol_handle_t * handle,
 		goto cleanup;
 	}
 
+	SEPOL_PROBE1(expand_phase, "conditionals");
 	cond_optimize_lists(state.out->cond_list);
 	if (evaluate_conds(state.out))
 		goto cleanup;
 
 	/* copy ocontexts */
+	SEPOL_PROBE1(expand_phase, "ocontexts");
 	if (ocontext_copy(&state, out->target_platform))
 		goto cleanup;
 
@@ -3056,6 +3272,7 @@ int expand_module(sepol_handle_t * handle,
 		goto cleanup;
 
 	/* Build the type<->attribute maps and remove attributes. */
+	SEPOL_PROBE1(expand_phase, "attributes");
 	state.out->attr_type_map = malloc(state.out->p_types.nprim *
 					  sizeof(ebitmap_t));
 	state.out->type_attr_map = malloc(state.out->p_types.nprim *
@@ -3076,6 +3293,7 @@ int expand_module(sepol_handle_t * handle,
 	if (hashtab_map(state.out->p_types.table, type_attr_map, &state))
 		goto cleanup;
 	if (check) {
+		SEPOL_PROBE1(expand_phase, "check");
 		if (hierarchy_check_constraints(handle, state.out))
 			goto cleanup;
 
@@ -3092,6 +3310,7 @@ int expand_module(sepol_handle_t * handle,
 	free(state.boolmap);
 	free(state.rolemap);
 	free(state.usermap);
+	SEPOL_PROBE1(expand_end, retval);
 	return retval;
 }
 
@@ -3167,9 +3386,7 @@ static int expand_avtab_node(avtab_key_t * k, avtab_datum_t * d, void *args)
 	if (stype->flavor != TYPE_ATTRIB) {
 		/* Source is an individual type, target is an attribute. */
 		newkey.source_type = k->source_type;
-		ebitmap_for_each_bit(tattr, tnode, j) {
-			if (!ebitmap_node_get_bit(tnode, j))
-				continue;
+		ebitmap_for_each_positive_bit(tattr, tnode, j) {
 			newkey.target_type = j + 1;
 			rc = expand_avtab_insert(expa, &newkey, d);
 			if (rc)
@@ -3181,9 +3398,7 @@ static int expand_avtab_node(avtab_key_t * k, avtab_datum_t * d, void *args)
 	if (ttype->flavor != TYPE_ATTRIB) {
 		/* Target is an individual type, source is an attribute. */
 		newkey.target_type = k->target_type;
-		ebitmap_for_each_bit(sattr, snode, i) {
-			if (!ebitmap_node_get_bit(snode, i))
-				continue;
+		ebitmap_for_each_positive_bit(sattr, snode, i) {
 			newkey.source_type = i + 1;
 			rc = expand_avtab_insert(expa, &newkey, d);
 			if (rc)
@@ -3193,12 +3408,8 @@ static int expand_avtab_node(avtab_key_t * k, avtab_datum_t * d, void *args)
 	}
 
 	/* Both source and target type are attributes. */
-	ebitmap_for_each_bit(sattr, snode, i) {
-		if (!ebitmap_node_get_bit(snode, i))
-			continue;
-		ebitmap_for_each_bit(tattr, tnode, j) {
-			if (!ebitmap_node_get_bit(tnode, j))
-				continue;
+	ebitmap_for_each_positive_bit(sattr, snode, i) {
+		ebitmap_for_each_positive_bit(tattr, tnode, j) {
 			newkey.source_type = i + 1;
 			newkey.target_type = j + 1;
 			rc = expand_avtab_insert(expa, &newkey, d);
@@ -3297,9 +3508,7 @@ int expand_cond_av_node(policydb_t * p,
 	if (stype->flavor != TYPE_ATTRIB) {
 		/* Source is an individual type, target is an attribute. */
 		newkey.source_type = k->source_type;
-		ebitmap_for_each_bit(tattr, tnode, j) {
-			if (!ebitmap_node_get_bit(tnode, j))
-				continue;
+		ebitmap_for_each_positive_bit(tattr, tnode, j) {
 			newkey.target_type = j + 1;
 			rc = expand_cond_insert(newl, expa, &newkey, d);
 			if (rc)
@@ -3311,9 +3520,7 @@ int expand_cond_av_node(policydb_t * p,
 	if (ttype->flavor != TYPE_ATTRIB) {
 		/* Target is an individual type, source is an attribute. */
 		newkey.target_type = k->target_type;
-		ebitmap_for_each_bit(sattr, snode, i) {
-			if (!ebitmap_node_get_bit(snode, i))
-				continue;
+		ebitmap_for_each_positive_bit(sattr, snode, i) {
 			newkey.source_type = i + 1;
 			rc = expand_cond_insert(newl, expa, &newkey, d);
 			if (rc)
@@ -3323,12 +3530,8 @@ int expand_cond_av_node(policydb_t * p,
 	}
 
 	/* Both source and target type are attributes. */
-	ebitmap_for_each_bit(sattr, snode, i) {
-		if (!ebitmap_node_get_bit(snode, i))
-			continue;
-		ebitmap_for_each_bit(tattr, tnode, j) {
-			if (!ebitmap_node_get_bit(tnode, j))
-				continue;
+	ebitmap_for_each_positive_bit(sattr, snode, i) {
+		ebitmap_for_each_positive_bit(tattr, tnode, j) {
 			newkey.source_type = i + 1;
 			newkey.target_type = j + 1;
 			rc = expand_cond_insert(newl, expa, &newkey, d);
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
+#include <string.h>
 
 #include <sepol/policydb/policydb.h>
 #include <sepol/policydb/conditional.h>
@@ -146,12 +147,243 @@ static int load_booleans(struct policydb *policydb, const char *path,
 	return errors ? -1 : 0;
 }
 
+/*
+ * A kernel policy image keeps the state of each boolean in its entry in
+ * the symbol tables, and the state of each conditional and whether each
+ * of its rules is enabled in the conditional list.  Nothing else depends
+ * on the booleans, so rather than decoding the whole image and encoding
+ * it again, those fields are patched where they are, the same way
+ * evaluate_conds() would change them.  Only the symbol tables are read;
+ * the unconditional rules in between have a fixed size and are skipped.
+ */
+#define BOOL_IMAGE_RULE_SIZE (4 * sizeof(uint16_t) + sizeof(uint32_t))
+
+struct bool_image_cond {
+	char *state;		/* cur_state in the image */
+	cond_expr_t *expr;
+	char *lists[2];		/* true and false list, from their count */
+};
+
+struct bool_image {
+	policydb_t policydb;	/* the symbol tables only */
+	char *bools;		/* first entry of the boolean table */
+	char *end;
+	struct bool_image_cond *conds;
+	uint32_t nconds;
+};
+
+static int bool_image_get(char **pos, char *end, uint32_t * val)
+{
+	if ((size_t)(end - *pos) < sizeof(*val))
+		return -1;
+	memcpy(val, *pos, sizeof(*val));
+	*val = le32_to_cpu(*val);
+	*pos += sizeof(*val);
+	return 0;
+}
+
+static void bool_image_put(char *pos, uint32_t val)
+{
+	val = cpu_to_le32(val);
+	memcpy(pos, &val, sizeof(val));
+}
+
+/* Skip a list of nel rules, returning -1 if it overruns the image. */
+static int bool_image_skip_rules(char **pos, char *end)
+{
+	uint32_t nel;
+
+	if (bool_image_get(pos, end, &nel) ||
+	    (size_t)(end - *pos) / BOOL_IMAGE_RULE_SIZE < nel)
+		return -1;
+	*pos += nel * BOOL_IMAGE_RULE_SIZE;
+	return 0;
+}
+
+static int bool_image_read_expr(struct bool_image *img, char **pos,
+				struct bool_image_cond *cond)
+{
+	cond_expr_t *expr, **last = &cond->expr;
+	uint32_t i, len, type, val;
+
+	if (bool_image_get(pos, img->end, &len))
+		return -1;
+	for (i = 0; i < len; i++) {
+		if (bool_image_get(pos, img->end, &type) ||
+		    bool_image_get(pos, img->end, &val))
+			return -1;
+		if (!type || type > COND_LAST ||
+		    (type == COND_BOOL &&
+		     (!val || val > img->policydb.p_bools.nprim)))
+			return -1;
+		expr = calloc(1, sizeof(*expr));
+		if (!expr)
+			return -1;
+		expr->expr_type = type;
+		expr->bool = val;
+		*last = expr;
+		last = &expr->next;
+	}
+	return 0;
+}
+
+static void bool_image_destroy(struct bool_image *img)
+{
+	uint32_t i;
+
+	for (i = 0; i < img->nconds; i++)
+		cond_expr_destroy(img->conds[i].expr);
+	free(img->conds);
+	policydb_destroy(&img->policydb);
+}
+
+/*
+ * Read the symbol tables of the image and find the fields to patch.
+ * Returns -1 if the image cannot be patched in place, in which case
+ * it has to go through policydb_read() and policydb_write().
+ */
+static int bool_image_read(struct bool_image *img, void *data, size_t len)
+{
+	struct policy_file pf;
+	char *pos;
+	uint32_t i, j, n, val;
+
+	memset(img, 0, sizeof(*img));
+	if (policydb_init(&img->policydb))
+		return -1;
+
+	policy_file_init(&pf);
+	pf.type = PF_USE_MEMORY;
+	pf.data = data;
+	pf.len = len;
+	img->end = (char *)data + len;
+	if (policydb_read_symtabs(&img->policydb, &pf, &img->bools) ||
+	    !img->bools ||
+	    img->policydb.policyvers < POLICYDB_VERSION_AVTAB ||
+	    policydb_index_bools(&img->policydb))
+		goto err;
+
+	pos = pf.data;
+	if (bool_image_skip_rules(&pos, img->end) ||
+	    bool_image_get(&pos, img->end, &n))
+		goto err;
+	img->conds = calloc(n ? n : 1, sizeof(*img->conds));
+	if (!img->conds)
+		goto err;
+	for (i = 0; i < n; i++) {
+		img->nconds++;
+		img->conds[i].state = pos;
+		if (bool_image_get(&pos, img->end, &val) ||
+		    bool_image_read_expr(img, &pos, &img->conds[i]))
+			goto err;
+		for (j = 0; j < 2; j++) {
+			img->conds[i].lists[j] = pos;
+			if (bool_image_skip_rules(&pos, img->end))
+				goto err;
+		}
+	}
+
+	/* the entries of the boolean table, checked by the read */
+	pos = img->bools;
+	for (i = 0; i < img->policydb.p_bools.table->nel; i++) {
+		if (bool_image_get(&pos, img->end, &val) ||
+		    !val || val > img->policydb.p_bools.nprim)
+			goto err;
+		pos += sizeof(uint32_t);
+		if (bool_image_get(&pos, img->end, &val) ||
+		    (size_t)(img->end - pos) < val)
+			goto err;
+		pos += val;
+	}
+	return 0;
+
+      err:
+	bool_image_destroy(img);
+	return -1;
+}
+
+/* Turn the rules of one list of a conditional on or off. */
+static void bool_image_enable(char *list, int enable)
+{
+	uint32_t i, nel;
+	uint16_t spec;
+	char *pos;
+
+	memcpy(&nel, list, sizeof(nel));
+	nel = le32_to_cpu(nel);
+	for (i = 0; i < nel; i++) {
+		/* after source, target and class */
+		pos = list + sizeof(nel) + i * BOOL_IMAGE_RULE_SIZE +
+		    3 * sizeof(uint16_t);
+		memcpy(&spec, pos, sizeof(spec));
+		spec = le16_to_cpu(spec);
+		if (enable)
+			spec |= AVTAB_ENABLED;
+		else
+			spec &= ~AVTAB_ENABLED;
+		spec = cpu_to_le16(spec);
+		memcpy(pos, &spec, sizeof(spec));
+	}
+}
+
+/* Write the states of the booleans in img->policydb to the image.
+ * bool_image_read() has checked every field read here, so this only
+ * fails if the image changed since. */
+static int bool_image_write(struct bool_image *img)
+{
+	policydb_t *p = &img->policydb;
+	struct bool_image_cond *cond;
+	char *pos = img->bools;
+	uint32_t i, val, state;
+	int new_state;
+
+	for (i = 0; i < p->p_bools.table->nel; i++) {
+		if (bool_image_get(&pos, img->end, &val) ||
+		    !val || val > p->p_bools.nprim)
+			goto err;
+		bool_image_put(pos, p->bool_val_to_struct[val - 1]->state);
+		pos += sizeof(uint32_t);
+		if (bool_image_get(&pos, img->end, &val))
+			goto err;
+		pos += val;
+	}
+
+	for (i = 0; i < img->nconds; i++) {
+		cond = &img->conds[i];
+		new_state = cond_evaluate_expr(p, cond->expr);
+		pos = cond->state;
+		if (bool_image_get(&pos, img->end, &state))
+			goto err;
+		if (new_state == (int)state)
+			continue;
+		bool_image_put(cond->state, new_state);
+		bool_image_enable(cond->lists[0], new_state > 0);
+		bool_image_enable(cond->lists[1], new_state == 0);
+	}
+	return 0;
+
+      err:
+	ERR(NULL, "unable to write new binary policy image");
+	errno = EINVAL;
+	return -1;
+}
+
 int sepol_genbools(void *data, size_t len, char *booleans)
 {
 	struct policydb policydb;
+	struct bool_image img;
 	struct policy_file pf;
 	int rc, changes = 0;
 
+	if (bool_image_read(&img, data, len) == 0) {
+		if (load_booleans(&img.policydb, booleans, &changes) < 0) {
+			WARN(NULL, "error while reading %s", booleans);
+		}
+		rc = changes ? bool_image_write(&img) : 0;
+		bool_image_destroy(&img);
+		return rc;
+	}
+
 	if (policydb_init(&policydb))
 		goto err;
 	if (policydb_from_image(NULL, data, len, &policydb) < 0)
@@ -206,22 +438,15 @@ int hidden sepol_genbools_policydb(policydb_t * policydb, const char *booleans)
 
 /* -- End Deprecated -- */
 
-int sepol_genbools_array(void *data, size_t len, char **names, int *values,
-			 int nel)
+/* Set the named booleans, returning the number of errors. */
+static int set_booleans(policydb_t * policydb, char **names, int *values,
+			int nel)
 {
-	struct policydb policydb;
-	struct policy_file pf;
-	int rc, i, errors = 0;
+	int i, errors = 0;
 	struct cond_bool_datum *datum;
 
-	/* Create policy database from image */
-	if (policydb_init(&policydb))
-		goto err;
-	if (policydb_from_image(NULL, data, len, &policydb) < 0)
-		goto err;
-
 	for (i = 0; i < nel; i++) {
-		datum = hashtab_search(policydb.p_bools.table, names[i]);
+		datum = hashtab_search(policydb->p_bools.table, names[i]);
 		if (!datum) {
 			ERR(NULL, "boolean %s no longer in policy", names[i]);
 			errors++;
@@ -235,6 +460,37 @@ int sepol_genbools_array(void *data, size_t len, char **names, int *values,
 		}
 		datum->state = values[i];
 	}
+	return errors;
+}
+
+int sepol_genbools_array(void *data, size_t len, char **names, int *values,
+			 int nel)
+{
+	struct policydb policydb;
+	struct bool_image img;
+	struct policy_file pf;
+	int rc, errors;
+
+	if (bool_image_read(&img, data, len) == 0) {
+		errors = set_booleans(&img.policydb, names, values, nel);
+		rc = bool_image_write(&img);
+		bool_image_destroy(&img);
+		if (rc)
+			return -1;
+		if (errors) {
+			errno = EINVAL;
+			return -1;
+		}
+		return 0;
+	}
+
+	/* Create policy database from image */
+	if (policydb_init(&policydb))
+		goto err;
+	if (policydb_from_image(NULL, data, len, &policydb) < 0)
+		goto err;
+
+	errors = set_booleans(&policydb, names, values, nel);
 
 	if (evaluate_conds(&policydb) < 0) {
 		ERR(NULL, "error while re-evaluating conditionals");
@@ -266,3 +522,41 @@ int sepol_genbools_array(void *data, size_t len, char **names, int *values,
       err:
 	return -1;
 }
+
+/*
+ * The same as sepol_genbools and sepol_genbools_array, but on a
+ * policydb that the caller writes out once it has made all of its
+ * changes, instead of on an image that is parsed and rewritten.
+ */
+int sepol_policydb_genbools(sepol_policydb_t * p, const char *booleans)
+{
+	int changes = 0;
+
+	if (load_booleans(&p->p, booleans, &changes) < 0) {
+		WARN(NULL, "error while reading %s", booleans);
+	}
+
+	if (changes && evaluate_conds(&p->p) < 0) {
+		ERR(NULL, "error while re-evaluating conditionals");
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+int sepol_policydb_genbools_array(sepol_policydb_t * p, char **names,
+				  int *values, int nel)
+{
+	int errors = set_booleans(&p->p, names, values, nel);
+
+	if (evaluate_conds(&p->p) < 0) {
+		ERR(NULL, "error while re-evaluating conditionals");
+		errno = EINVAL;
+		return -1;
+	}
+	if (errors) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
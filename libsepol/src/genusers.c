@@ -341,3 +341,8 @@ int hidden sepol_genusers_policydb(policydb_t * policydb, const char *usersdir)
 }
 
 /* -- End Deprecated -- */
+
+int sepol_policydb_genusers(sepol_policydb_t * p, const char *usersdir)
+{
+	return sepol_genusers_policydb(&p->p, usersdir);
+}
@@ -32,6 +32,9 @@
 #include <string.h>
 #include <sepol/policydb/hashtab.h>
 
+/* tables stop growing once they have this many slots */
+#define HASHTAB_MAX_SIZE (1U << 24)
+
 hashtab_t hashtab_create(unsigned int (*hash_value) (hashtab_t h,
 						     const hashtab_key_t key),
 			 int (*keycmp) (hashtab_t h,
@@ -63,6 +66,42 @@ hashtab_t hashtab_create(unsigned int (*hash_value) (hashtab_t h,
 	return p;
 }
 
+/*
+ * Double the number of slots once there are more entries than slots,
+ * so the tables created with a guessed size keep short chains however
+ * large the policy gets.  The hash functions reduce their value by
+ * h->size, so the new size is set before the entries are rehashed.
+ * Chains stay sorted by keycmp and nodes are relinked, not copied.  A
+ * failed allocation simply leaves the table at its current size.
+ */
+static void hashtab_check_resize(hashtab_t h)
+{
+	unsigned int i, hvalue, old_size = h->size;
+	hashtab_ptr_t *old_htable = h->htable, *new_htable, *pos, cur, next;
+
+	if (h->nel <= old_size || old_size >= HASHTAB_MAX_SIZE)
+		return;
+
+	new_htable = calloc(old_size * 2, sizeof(hashtab_ptr_t));
+	if (!new_htable)
+		return;
+
+	h->size = old_size * 2;
+	h->htable = new_htable;
+	for (i = 0; i < old_size; i++) {
+		for (cur = old_htable[i]; cur; cur = next) {
+			next = cur->next;
+			hvalue = h->hash_value(h, cur->key);
+			pos = &new_htable[hvalue];
+			while (*pos && h->keycmp(h, cur->key, (*pos)->key) > 0)
+				pos = &(*pos)->next;
+			cur->next = *pos;
+			*pos = cur;
+		}
+	}
+	free(old_htable);
+}
+
 int hashtab_insert(hashtab_t h, hashtab_key_t key, hashtab_datum_t datum)
 {
 	int hvalue;
@@ -97,6 +136,7 @@ int hashtab_insert(hashtab_t h, hashtab_key_t key, hashtab_datum_t datum)
 	}
 
 	h->nel++;
+	hashtab_check_resize(h);
 	return SEPOL_OK;
 }
 
@@ -284,30 +324,39 @@ void hashtab_map_remove_on_error(hashtab_t h,
 	return;
 }
 
-void hashtab_hash_eval(hashtab_t h, char *tag)
+void hashtab_hash_stats(hashtab_t h, hashtab_stats_t * st)
 {
-	unsigned int i;
-	int chain_len, slots_used, max_chain_len;
+	unsigned int i, chain_len;
 	hashtab_ptr_t cur;
 
-	slots_used = 0;
-	max_chain_len = 0;
+	st->nel = h->nel;
+	st->size = h->size;
+	st->slots_used = 0;
+	st->max_chain_len = 0;
 	for (i = 0; i < h->size; i++) {
 		cur = h->htable[i];
 		if (cur) {
-			slots_used++;
+			st->slots_used++;
 			chain_len = 0;
 			while (cur) {
 				chain_len++;
 				cur = cur->next;
 			}
 
-			if (chain_len > max_chain_len)
-				max_chain_len = chain_len;
+			if (chain_len > st->max_chain_len)
+				st->max_chain_len = chain_len;
 		}
 	}
+	st->bytes = sizeof(hashtab_val_t) + h->size * sizeof(hashtab_ptr_t) +
+	    (size_t)h->nel * sizeof(hashtab_node_t);
+}
+
+void hashtab_hash_eval(hashtab_t h, char *tag)
+{
+	hashtab_stats_t st;
 
+	hashtab_hash_stats(h, &st);
 	printf
 	    ("%s:  %d entries and %d/%d buckets used, longest chain length %d\n",
-	     tag, h->nel, slots_used, h->size, max_chain_len);
+	     tag, st.nel, st.slots_used, st.size, st.max_chain_len);
 }
@@ -44,6 +44,10 @@ typedef struct hierarchy_args {
 	cond_av_list_t *opt_cond_list;
 	sepol_handle_t *handle;
 	int numerr;
+	/* parent type value of each type, or 0, filled in by
+	 * check_type_hierarchy_callback */
+	uint32_t *type_parents;
+	uint32_t ntype_parents;	/* number of types with a parent */
 } hierarchy_args_t;
 
 /*
@@ -145,6 +149,12 @@ static int check_type_hierarchy_callback(hashtab_key_t k, hashtab_datum_t d,
 		a->numerr++;
 		return -1;
 	}
+	/* aliases share the value of their primary type, which is
+	 * what the avtab refers to */
+	if (tp && a->p->type_val_to_struct[t->s.value - 1] == t) {
+		a->type_parents[t->s.value - 1] = tp->s.value;
+		a->ntype_parents++;
+	}
 	return 0;
 }
 
@@ -152,14 +162,16 @@ static int check_type_hierarchy_callback(hashtab_key_t k, hashtab_datum_t d,
  * hiearchy constraint via any relationship with other types in the avtab.
  * it should be called using avtab_map, returns 0 on success, 1 on violation and
  * -1 on error. opt_cond_list is an optional argument that tells this to check
- * a conditional list for the relationship as well as the unconditional avtab
+ * a conditional list for the relationship as well as the unconditional avtab.
+ * The parents are taken from type_parents, so check_type_hierarchy_callback
+ * must have been run over all types first.
  */
 static int check_avtab_hierarchy_callback(avtab_key_t * k, avtab_datum_t * d,
 					  void *args)
 {
 	avtab_key_t key;
 	hierarchy_args_t *a = (hierarchy_args_t *) args;
-	type_datum_t *s, *t1 = NULL, *t2 = NULL;
+	uint32_t t1, t2;
 	avtab_datum_t av;
 
 	if (!(k->specified & AVTAB_ALLOWED)) {
@@ -167,16 +179,23 @@ static int check_avtab_hierarchy_callback(avtab_key_t * k, avtab_datum_t * d,
 		return 0;
 	}
 
+	t1 = a->type_parents[k->source_type - 1];
+	t2 = a->type_parents[k->target_type - 1];
+
+	/*
+	 * Neither one of these types have parents and 
+	 * therefore the hierarchical constraint does not apply
+	 */
+	if (!t1 && !t2)
+		return 0;
+
 	/* search for parent first */
-	s = a->p->type_val_to_struct[k->source_type - 1];
-	if (find_parent_type(a, s, &t1) < 0)
-		return -1;
 	if (t1) {
 		/*
 		 * search for access allowed between type 1's
 		 * parent and type 2.
 		 */
-		key.source_type = t1->s.value;
+		key.source_type = t1;
 		key.target_type = k->target_type;
 		key.target_class = k->target_class;
 		key.specified = AVTAB_ALLOWED;
@@ -187,16 +206,13 @@ static int check_avtab_hierarchy_callback(avtab_key_t * k, avtab_datum_t * d,
 	}
 
 	/* next we try type 1 and type 2's parent */
-	s = a->p->type_val_to_struct[k->target_type - 1];
-	if (find_parent_type(a, s, &t2) < 0)
-		return -1;
 	if (t2) {
 		/*
 		 * search for access allowed between type 1 and
 		 * type 2's parent.
 		 */
 		key.source_type = k->source_type;
-		key.target_type = t2->s.value;
+		key.target_type = t2;
 		key.target_class = k->target_class;
 		key.specified = AVTAB_ALLOWED;
 		compute_avtab_datum(a, &key, &av);
@@ -210,8 +226,8 @@ static int check_avtab_hierarchy_callback(avtab_key_t * k, avtab_datum_t * d,
                  * search for access allowed between type 1's parent
                  * and type 2's parent.
                  */
-		key.source_type = t1->s.value;
-		key.target_type = t2->s.value;
+		key.source_type = t1;
+		key.target_type = t2;
 		key.target_class = k->target_class;
 		key.specified = AVTAB_ALLOWED;
 		compute_avtab_datum(a, &key, &av);
@@ -220,13 +236,6 @@ static int check_avtab_hierarchy_callback(avtab_key_t * k, avtab_datum_t * d,
 			return 0;
 	}
 
-	/*
-	 * Neither one of these types have parents and 
-	 * therefore the hierarchical constraint does not apply
-	 */
-	if (!t1 && !t2)
-		return 0;
-
 	/*
 	 * At this point there is a violation of the hierarchal
 	 * constraint, send error condition back
@@ -454,28 +463,36 @@ int hierarchy_check_constraints(sepol_handle_t * handle, policydb_t * p)
 
 	if (avtab_init(&expa))
 		goto oom;
-	if (expand_avtab(p, &p->te_avtab, &expa)) {
-		avtab_destroy(&expa);
-		goto oom;
-	}
 
 	args.p = p;
 	args.expa = &expa;
 	args.opt_cond_list = NULL;
 	args.handle = handle;
 	args.numerr = 0;
+	args.ntype_parents = 0;
+	args.type_parents = calloc(p->p_types.nprim, sizeof(uint32_t));
+	if (!args.type_parents && p->p_types.nprim)
+		goto oom;
 
 	if (hashtab_map(p->p_types.table, check_type_hierarchy_callback, &args))
 		goto bad;
 
-	if (pullup_unconditional_perms(p->cond_list, &args))
-		return -1;
+	/* Without any bounded types there is no access to check. */
+	if (args.ntype_parents) {
+		if (expand_avtab(p, &p->te_avtab, &expa)) {
+			ERR(handle, "Out of memory");
+			goto bad;
+		}
 
-	if (avtab_map(&expa, check_avtab_hierarchy_callback, &args))
-		goto bad;
+		if (pullup_unconditional_perms(p->cond_list, &args))
+			goto bad;
 
-	if (check_cond_avtab_hierarchy(p->cond_list, &args))
-		goto bad;
+		if (avtab_map(&expa, check_avtab_hierarchy_callback, &args))
+			goto bad;
+
+		if (check_cond_avtab_hierarchy(p->cond_list, &args))
+			goto bad;
+	}
 
 	if (hashtab_map(p->p_roles.table, check_role_hierarchy_callback, &args))
 		goto bad;
@@ -489,10 +506,12 @@ int hierarchy_check_constraints(sepol_handle_t * handle, policydb_t * p)
 		goto bad;
 	}
 
+	free(args.type_parents);
 	avtab_destroy(&expa);
 	return 0;
 
       bad:
+	free(args.type_parents);
 	avtab_destroy(&expa);
 	return -1;
 
@@ -34,6 +34,8 @@
 #include <assert.h>
 
 #include "debug.h"
+#include "strpool.h"
+#include "sepol_trace.h"
 
 #undef min
 #define min(a,b) (((a) < (b)) ? (a) : (b))
@@ -67,6 +69,8 @@ typedef struct link_state {
 	uint32_t symbol_num;
 	/* used to report the name of the module if dependancy error occurs */
 	policydb_t **decl_to_mod;
+	/* base scope of every symbol, by value, while enabling avrules */
+	scope_datum_t **scope_index[SYM_NUM];
 
 	/* error reporting fields */
 	sepol_handle_t *handle;
@@ -146,7 +150,7 @@ static int permission_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		 * to the object class. */
 		if (state->dest_class_req) {
 			/* If the class was required (not declared), insert the new permission */
-			new_id = strdup(perm_id);
+			new_id = strpool_dup(state->base->strpool, perm_id);
 			if (new_id == NULL) {
 				ERR(state->handle, "Memory error");
 				ret = SEPOL_ERR;
@@ -200,7 +204,7 @@ static int permission_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 
 	return 0;
       err:
-	free(new_id);
+	strpool_free(state->base->strpool, new_id);
 	free(new_perm);
 	return ret;
 }
@@ -296,7 +300,7 @@ static int class_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 				ret = SEPOL_ERR;
 				goto err;
 			}
-			new_id = strdup(id);
+			new_id = strpool_dup(state->base->strpool, id);
 			if (new_id == NULL) {
 				ERR(state->handle, "Memory error\n");
 				symtab_destroy(&new_class->permissions);
@@ -339,7 +343,7 @@ static int class_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 	return 0;
       err:
 	free(new_class);
-	free(new_id);
+	strpool_free(state->base->strpool, new_id);
 	return ret;
 }
 
@@ -376,7 +380,7 @@ static int role_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		if (state->verbose)
 			INFO(state->handle, "copying role %s", id);
 
-		if ((new_id = strdup(id)) == NULL) {
+		if ((new_id = strpool_dup(state->base->strpool, id)) == NULL) {
 			goto cleanup;
 		}
 
@@ -425,7 +429,7 @@ static int role_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
       cleanup:
 	ERR(state->handle, "Out of memory!");
 	role_datum_destroy(new_role);
-	free(new_id);
+	strpool_free(state->base->strpool, new_id);
 	free(new_role);
 	return -1;
 }
@@ -473,7 +477,7 @@ static int type_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		if (state->verbose)
 			INFO(state->handle, "copying type %s", id);
 
-		if ((new_id = strdup(id)) == NULL) {
+		if ((new_id = strpool_dup(state->base->strpool, id)) == NULL) {
 			goto cleanup;
 		}
 
@@ -523,7 +527,7 @@ static int type_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 
       cleanup:
 	ERR(state->handle, "Out of memory!");
-	free(new_id);
+	strpool_free(state->base->strpool, new_id);
 	free(new_type);
 	return -1;
 }
@@ -543,7 +547,7 @@ static int user_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		if (state->verbose)
 			INFO(state->handle, "copying user %s", id);
 
-		if ((new_id = strdup(id)) == NULL) {
+		if ((new_id = strpool_dup(state->base->strpool, id)) == NULL) {
 			goto cleanup;
 		}
 
@@ -590,7 +594,7 @@ static int user_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
       cleanup:
 	ERR(state->handle, "Out of memory!");
 	user_datum_destroy(new_user);
-	free(new_id);
+	strpool_free(state->base->strpool, new_id);
 	free(new_user);
 	return -1;
 }
@@ -611,7 +615,7 @@ static int bool_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		if (state->verbose)
 			INFO(state->handle, "copying boolean %s", id);
 
-		if ((new_id = strdup(id)) == NULL) {
+		if ((new_id = strpool_dup(state->base->strpool, id)) == NULL) {
 			goto cleanup;
 		}
 
@@ -659,7 +663,7 @@ static int bool_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 
       cleanup:
 	ERR(state->handle, "Out of memory!");
-	cond_destroy_bool(new_id, new_bool, NULL);
+	cond_destroy_bool(new_id, new_bool, state->base->strpool);
 	return -1;
 }
 
@@ -905,7 +909,7 @@ static int alias_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 		new_type->flags = target_type->flags;
 		new_type->flavor = TYPE_ALIAS;
 		new_type->s.value = state->base->p_types.nprim + 1;
-		if ((new_id = strdup(id)) == NULL) {
+		if ((new_id = strpool_dup(state->base->strpool, id)) == NULL) {
 			goto cleanup;
 		}
 		if (hashtab_insert
@@ -948,7 +952,7 @@ static int alias_copy_callback(hashtab_key_t key, hashtab_datum_t datum,
 
       cleanup:
 	ERR(state->handle, "Out of memory!");
-	free(new_id);
+	strpool_free(state->base->strpool, new_id);
 	free(new_type);
 	return -1;
 }
@@ -1973,25 +1977,76 @@ static int find_perm(hashtab_key_t key, hashtab_datum_t datum, void *varg)
 	return 0;
 }
 
+/* Index the base's scope tables by symbol value, so that requirements
+ * can be checked without looking up every symbol by name. */
+static int build_scope_index(link_state_t * state)
+{
+	policydb_t *pol = state->base;
+	unsigned int i, j;
+	char *id;
+
+	for (i = 0; i < SYM_NUM; i++) {
+		state->scope_index[i] = calloc(pol->symtab[i].nprim,
+					       sizeof(*state->scope_index[i]));
+		if (pol->symtab[i].nprim && state->scope_index[i] == NULL) {
+			ERR(state->handle, "Out of memory!");
+			return -1;
+		}
+		for (j = 0; j < pol->symtab[i].nprim; j++) {
+			id = pol->sym_val_to_name[i][j];
+			if (id != NULL)
+				state->scope_index[i][j] =
+				    hashtab_search(pol->scope[i].table, id);
+		}
+	}
+	return 0;
+}
+
+static void destroy_scope_index(link_state_t * state)
+{
+	unsigned int i;
+
+	for (i = 0; i < SYM_NUM; i++) {
+		free(state->scope_index[i]);
+		state->scope_index[i] = NULL;
+	}
+}
+
+/* Same as is_id_enabled(), for the symbol with the given value. */
+static int is_symbol_enabled(link_state_t * state, uint32_t symbol_num,
+			     uint32_t value)
+{
+	scope_datum_t *scope;
+	avrule_decl_t *decl;
+	uint32_t i;
+
+	if (value >= state->base->symtab[symbol_num].nprim)
+		return 0;
+	scope = state->scope_index[symbol_num][value];
+	if (scope == NULL || scope->scope != SCOPE_DECL)
+		return 0;
+	for (i = 0; i < scope->decl_ids_len; i++) {
+		decl = state->base->decl_val_to_struct[scope->decl_ids[i] - 1];
+		if (decl != NULL && decl->enabled)
+			return 1;
+	}
+	return 0;
+}
+
 /* Check if the requirements are met for a single declaration.  If all
  * are met return 1.  For the first requirement found to be missing,
  * if 'missing_sym_num' and 'missing_value' are both not NULL then
  * write to them the symbol number and value for the missing
  * declaration.  Then return 0 to indicate a missing declaration.
  * Note that if a declaration had no requirement at all (e.g., an ELSE
- * block) this returns 1. */
+ * block) this returns 1.  Must be called while the scope index is
+ * built. */
 static int is_decl_requires_met(link_state_t * state,
 				avrule_decl_t * decl,
 				struct missing_requirement *req)
 {
-	/* (This algorithm is very unoptimized.  It performs many
-	 * redundant checks.  A very obvious improvement is to cache
-	 * which symbols have been verified, so that they do not need
-	 * to be re-checked.) */
 	unsigned int i, j;
 	ebitmap_t *bitmap;
-	char *id, *perm_id;
-	policydb_t *pol = state->base;
 	ebitmap_node_t *node;
 
 	/* check that all symbols have been satisfied */
@@ -2002,14 +2057,9 @@ static int is_decl_requires_met(link_state_t * state,
 			continue;
 		}
 		bitmap = &decl->required.scope[i];
-		ebitmap_for_each_bit(bitmap, node, j) {
-			if (!ebitmap_node_get_bit(node, j)) {
-				continue;
-			}
-
+		ebitmap_for_each_positive_bit(bitmap, node, j) {
 			/* check base's scope table */
-			id = pol->sym_val_to_name[i][j];
-			if (!is_id_enabled(id, state->base, i)) {
+			if (!is_symbol_enabled(state, i, j)) {
 				/* this symbol was not found */
 				if (req != NULL) {
 					req->symbol_type = i;
@@ -2019,54 +2069,27 @@ static int is_decl_requires_met(link_state_t * state,
 			}
 		}
 	}
-	/* check that all classes and permissions have been satisfied */
+	/* check that all classes and permissions have been satisfied.
+	 * The linker added every required permission to its class in
+	 * the base, so a permission is there whenever its class is. */
 	for (i = 0; i < decl->required.class_perms_len; i++) {
-
 		bitmap = decl->required.class_perms_map + i;
-		ebitmap_for_each_bit(bitmap, node, j) {
-			struct find_perm_arg fparg;
-			class_datum_t *cladatum;
-			uint32_t perm_value = j + 1;
-			int rc;
-			scope_datum_t *scope;
-
-			if (!ebitmap_node_get_bit(node, j)) {
-				continue;
-			}
-			id = pol->p_class_val_to_name[i];
-			cladatum = pol->class_val_to_struct[i];
-
-			scope =
-			    hashtab_search(state->base->p_classes_scope.table,
-					   id);
-			if (scope == NULL) {
+		ebitmap_for_each_positive_bit(bitmap, node, j) {
+			if (state->scope_index[SYM_CLASSES][i] == NULL) {
 				ERR(state->handle,
 				    "Could not find scope information for class %s",
-				    id);
+				    state->base->p_class_val_to_name[i]);
 				return -1;
 			}
-
-			fparg.valuep = perm_value;
-			fparg.key = NULL;
-
-			(void)hashtab_map(cladatum->permissions.table, find_perm,
-				    &fparg);
-			if (fparg.key == NULL && cladatum->comdatum != NULL) {
-				rc = hashtab_map(cladatum->comdatum->permissions.table,
-						 find_perm, &fparg);
-				assert(rc == 1);
-			}
-			perm_id = fparg.key;
-
-			assert(perm_id != NULL);
-			if (!is_perm_enabled(id, perm_id, state->base)) {
+			if (!is_symbol_enabled(state, SYM_CLASSES, i)) {
 				if (req != NULL) {
 					req->symbol_type = SYM_CLASSES;
 					req->symbol_value = i + 1;
-					req->perm_value = perm_value;
+					req->perm_value = j + 1;
 				}
 				return 0;
 			}
+			break;
 		}
 	}
 
@@ -2175,33 +2198,231 @@ static void print_missing_requirements(link_state_t * state,
 	}
 }
 
-/* Enable all of the avrule_decl blocks for the policy. This simple
- * algorithm is the following:
+/* Which decls declare and which blocks require each symbol, so that disabling
+ * a decl only rechecks the blocks it may affect.  Lists are indexed by
+ * decl id - 1 and by symbol value respectively. */
+typedef struct symbol_ref {
+	uint32_t symbol_num;
+	uint32_t value;
+} symbol_ref_t;
+
+typedef struct requirement_index {
+	uint32_t num_decls;
+	uint32_t *declared_start;	/* symbols declared by each decl */
+	symbol_ref_t *declared;
+	uint32_t *required_start[SYM_NUM];	/* blocks requiring each symbol */
+	avrule_block_t **required[SYM_NUM];
+} requirement_index_t;
+
+static void requirement_index_destroy(requirement_index_t * idx)
+{
+	unsigned int i;
+
+	free(idx->declared_start);
+	free(idx->declared);
+	for (i = 0; i < SYM_NUM; i++) {
+		free(idx->required_start[i]);
+		free(idx->required[i]);
+	}
+}
+
+/* Call fn for every symbol a block's decl requires; classes stand for
+ * their required permissions. */
+static void for_each_requirement(policydb_t * pol, avrule_decl_t * decl,
+				 void (*fn) (requirement_index_t *, uint32_t,
+					     uint32_t, avrule_block_t *),
+				 requirement_index_t * idx,
+				 avrule_block_t * block)
+{
+	ebitmap_node_t *node;
+	unsigned int i, j;
+
+	for (i = 0; i < SYM_NUM; i++) {
+		if (i == SYM_CLASSES)
+			continue;
+		ebitmap_for_each_positive_bit(&decl->required.scope[i], node, j) {
+			if (j < pol->symtab[i].nprim)
+				fn(idx, i, j, block);
+		}
+	}
+	for (i = 0; i < decl->required.class_perms_len &&
+	     i < pol->p_classes.nprim; i++) {
+		ebitmap_for_each_positive_bit(&decl->required.class_perms_map[i],
+					      node, j) {
+			fn(idx, SYM_CLASSES, i, block);
+			break;
+		}
+	}
+}
+
+static void count_requirement(requirement_index_t * idx, uint32_t symbol_num,
+			      uint32_t value,
+			      avrule_block_t * block __attribute__ ((unused)))
+{
+	idx->required_start[symbol_num][value + 1]++;
+}
+
+static void add_requirement(requirement_index_t * idx, uint32_t symbol_num,
+			    uint32_t value, avrule_block_t * block)
+{
+	idx->required[symbol_num][idx->required_start[symbol_num][value]++] =
+	    block;
+}
+
+static int requirement_index_build(link_state_t * state, policydb_t * pol,
+				   requirement_index_t * idx)
+{
+	avrule_block_t *block;
+	avrule_decl_t *decl;
+	scope_datum_t *scope;
+	uint32_t i, j, k, n, id, *pos = NULL;
+
+	memset(idx, 0, sizeof(*idx));
+	for (block = pol->global; block != NULL; block = block->next)
+		for (decl = block->branch_list; decl != NULL; decl = decl->next)
+			if (decl->decl_id > idx->num_decls)
+				idx->num_decls = decl->decl_id;
+
+	/* symbols declared by each decl, from the scope tables */
+	idx->declared_start = calloc(idx->num_decls + 1, sizeof(uint32_t));
+	if (idx->declared_start == NULL)
+		goto oom;
+	for (n = 0; n < 2; n++) {
+		for (i = 0; i < SYM_NUM; i++) {
+			for (j = 0; j < pol->symtab[i].nprim; j++) {
+				scope = state->scope_index[i][j];
+				if (scope == NULL || scope->scope != SCOPE_DECL)
+					continue;
+				for (k = 0; k < scope->decl_ids_len; k++) {
+					id = scope->decl_ids[k];
+					if (id == 0 || id > idx->num_decls)
+						continue;
+					if (n == 0) {
+						idx->declared_start[id]++;
+						continue;
+					}
+					idx->declared[pos[id - 1]].symbol_num = i;
+					idx->declared[pos[id - 1]++].value = j;
+				}
+			}
+		}
+		if (n == 1)
+			break;
+		for (id = 0; id < idx->num_decls; id++)
+			idx->declared_start[id + 1] += idx->declared_start[id];
+		idx->declared = calloc(idx->declared_start[idx->num_decls] + 1,
+				       sizeof(*idx->declared));
+		pos = malloc((idx->num_decls + 1) * sizeof(*pos));
+		if (idx->declared == NULL || pos == NULL)
+			goto oom;
+		memcpy(pos, idx->declared_start,
+		       (idx->num_decls + 1) * sizeof(*pos));
+	}
+	free(pos);
+
+	/* blocks requiring each symbol */
+	for (i = 0; i < SYM_NUM; i++) {
+		idx->required_start[i] = calloc(pol->symtab[i].nprim + 2,
+						sizeof(uint32_t));
+		if (idx->required_start[i] == NULL)
+			goto oom;
+	}
+	for (block = pol->global; block != NULL; block = block->next)
+		for_each_requirement(pol, block->branch_list,
+				     count_requirement, idx, block);
+	for (i = 0; i < SYM_NUM; i++) {
+		for (j = 0; j < pol->symtab[i].nprim; j++)
+			idx->required_start[i][j + 1] +=
+			    idx->required_start[i][j];
+		idx->required[i] =
+		    calloc(idx->required_start[i][pol->symtab[i].nprim] + 1,
+			   sizeof(avrule_block_t *));
+		if (idx->required[i] == NULL)
+			goto oom;
+	}
+	/* fill in, which shifts every start to the next symbol's */
+	for (block = pol->global; block != NULL; block = block->next)
+		for_each_requirement(pol, block->branch_list,
+				     add_requirement, idx, block);
+	for (i = 0; i < SYM_NUM; i++) {
+		memmove(idx->required_start[i] + 1, idx->required_start[i],
+			pol->symtab[i].nprim * sizeof(uint32_t));
+		idx->required_start[i][0] = 0;
+	}
+	return 0;
+
+      oom:
+	free(pos);
+	ERR(state->handle, "Out of memory!");
+	return -1;
+}
+
+/* Check one block's requirements, disabling it if they are not met.
+ * Returns 1 if it was disabled, 0 if it is still enabled, or an error. */
+static int check_block_requirements(link_state_t * state,
+				    avrule_block_t * block)
+{
+	avrule_decl_t *decl = block->branch_list;
+	missing_requirement_t req;
+	int rc;
+
+	if (state->verbose) {
+		char *mod_name = decl->module_name ?
+		    decl->module_name : "BASE";
+		INFO(state->handle, "check module %s decl %d\n",
+		     mod_name, decl->decl_id);
+	}
+	rc = is_decl_requires_met(state, decl, &req);
+	if (rc < 0)
+		return SEPOL_ERR;
+	if (rc > 0)
+		return 0;
+
+	decl->enabled = 0;
+	block->enabled = NULL;
+	if (!(block->flags & AVRULE_OPTIONAL)) {
+		print_missing_requirements(state, block, &req);
+		return SEPOL_EREQ;
+	}
+	return 1;
+}
+
+/* Enable all of the avrule_decl blocks for the policy. The algorithm
+ * is the following:
  *
  * 1) Enable all of the non-else avrule_decls for all blocks.
  * 2) Iterate through the non-else decls looking for decls whose requirements
  *    are not met.
  *    2a) If the decl is non-optional, return immediately with an error.
- *    2b) If the decl is optional, disable the block and mark changed = 1
- * 3) If changed == 1 goto 2.
+ *    2b) If the decl is optional, disable the block and queue its decl.
+ * 3) For every queued decl, find the symbols that it was the last
+ *    enabled declaration of, and recheck the enabled blocks requiring
+ *    them as in 2), until the queue is empty.
  * 4) Iterate through all blocks looking for those that have no enabled
  *    decl. If the block has an else decl, enable.
  *
  * This will correctly handle all dependencies, including mutual and
- * cicular. The only downside is that it is slow.
+ * cicular, and checks each block once plus once for every symbol it
+ * loses.
  */
 static int enable_avrules(link_state_t * state, policydb_t * pol)
 {
-	int changed = 1;
-	avrule_block_t *block;
+	avrule_block_t *block, **queue = NULL;
 	avrule_decl_t *decl;
-	missing_requirement_t req;
+	requirement_index_t idx;
+	symbol_ref_t *sym;
+	uint32_t head = 0, tail = 0, i, k;
 	int ret = 0, rc;
 
 	if (state->verbose) {
 		INFO(state->handle, "Determining which avrules to enable.");
 	}
 
+	if (build_scope_index(state)) {
+		destroy_scope_index(state);
+		return SEPOL_ERR;
+	}
+
 	/* 1) enable all of the non-else blocks */
 	for (block = pol->global; block != NULL; block = block->next) {
 		block->enabled = block->branch_list;
@@ -2211,33 +2432,49 @@ static int enable_avrules(link_state_t * state, policydb_t * pol)
 			decl->enabled = 0;
 	}
 
-	/* 2) Iterate */
-	while (changed) {
-		changed = 0;
-		for (block = pol->global; block != NULL; block = block->next) {
-			if (block->enabled == NULL) {
+	if (requirement_index_build(state, pol, &idx)) {
+		ret = SEPOL_ERR;
+		goto out;
+	}
+	queue = calloc(idx.num_decls + 1, sizeof(*queue));
+	if (queue == NULL) {
+		ERR(state->handle, "Out of memory!");
+		ret = SEPOL_ERR;
+		goto out;
+	}
+
+	/* 2) check every block once */
+	for (block = pol->global; block != NULL; block = block->next) {
+		rc = check_block_requirements(state, block);
+		if (rc < 0) {
+			ret = rc;
+			goto out;
+		} else if (rc > 0) {
+			queue[tail++] = block;
+		}
+	}
+
+	/* 3) propagate */
+	while (head < tail) {
+		decl = queue[head++]->branch_list;
+		for (k = idx.declared_start[decl->decl_id - 1];
+		     k < idx.declared_start[decl->decl_id]; k++) {
+			sym = &idx.declared[k];
+			if (is_symbol_enabled(state, sym->symbol_num,
+					      sym->value))
 				continue;
-			}
-			decl = block->branch_list;
-			if (state->verbose) {
-				char *mod_name = decl->module_name ?
-				    decl->module_name : "BASE";
-				INFO(state->handle, "check module %s decl %d\n",
-				     mod_name, decl->decl_id);
-			}
-			rc = is_decl_requires_met(state, decl, &req);
-			if (rc < 0) {
-				ret = SEPOL_ERR;
-				goto out;
-			} else if (rc == 0) {
-				decl->enabled = 0;
-				block->enabled = NULL;
-				changed = 1;
-				if (!(block->flags & AVRULE_OPTIONAL)) {
-					print_missing_requirements(state, block,
-								   &req);
-					ret = SEPOL_EREQ;
+			for (i = idx.required_start[sym->symbol_num][sym->value];
+			     i < idx.required_start[sym->symbol_num][sym->value + 1];
+			     i++) {
+				block = idx.required[sym->symbol_num][i];
+				if (block->enabled == NULL)
+					continue;
+				rc = check_block_requirements(state, block);
+				if (rc < 0) {
+					ret = rc;
 					goto out;
+				} else if (rc > 0) {
+					queue[tail++] = block;
 				}
 			}
 		}
@@ -2265,6 +2502,9 @@ static int enable_avrules(link_state_t * state, policydb_t * pol)
 	if (state->verbose)
 		debug_requirements(state, pol);
 
+	free(queue);
+	requirement_index_destroy(&idx);
+	destroy_scope_index(state);
 	return ret;
 }
 
@@ -2520,10 +2760,34 @@ static int populate_roleattributes(link_state_t *state, policydb_t *pol)
 	return 0;
 }
 
+/* Returns 1 if a module with the given name has already been linked
+ * into the base, 0 otherwise. */
+static int is_module_linked(policydb_t * b, const char *name)
+{
+	avrule_block_t *block;
+	avrule_decl_t *decl;
+
+	for (block = b->global; block != NULL; block = block->next) {
+		for (decl = block->branch_list; decl != NULL; decl = decl->next) {
+			if (decl->module_name &&
+			    strcmp(decl->module_name, name) == 0)
+				return 1;
+		}
+	}
+	return 0;
+}
+
 /* Link a set of modules into a base module. This process is somewhat
  * similar to an actual compiler: it requires a set of order dependent
  * steps.  The base and every module must have been indexed prior to
  * calling this function.
+ *
+ * The base may itself be the result of an earlier link, so that new
+ * modules can be added to an already linked policy without relinking
+ * the modules it already contains.  Linking modules in several calls
+ * gives the same policy as linking them all in one call in the same
+ * order.  If linking fails the base is left in an undefined state and
+ * must be discarded.
  */
 int link_modules(sepol_handle_t * handle,
 		 policydb_t * b, policydb_t ** mods, int len, int verbose)
@@ -2538,9 +2802,11 @@ int link_modules(sepol_handle_t * handle,
 	state.verbose = verbose;
 	state.handle = handle;
 
+	SEPOL_PROBE1(link_begin, len);
+
 	if (b->policy_type != POLICY_BASE) {
 		ERR(state.handle, "Target of link was not a base policy.");
-		return -1;
+		goto cleanup;
 	}
 
 	/* first allocate some space to hold the maps from module
@@ -2549,7 +2815,7 @@ int link_modules(sepol_handle_t * handle,
 	if ((modules =
 	     (policy_module_t **) calloc(len, sizeof(*modules))) == NULL) {
 		ERR(state.handle, "Out of memory!");
-		return -1;
+		goto cleanup;
 	}
 	for (i = 0; i < len; i++) {
 		if (mods[i]->policy_type != POLICY_MOD) {
@@ -2568,6 +2834,13 @@ int link_modules(sepol_handle_t * handle,
 			goto cleanup;
 		}
 
+		if (mods[i]->name && is_module_linked(b, mods[i]->name)) {
+			ERR(state.handle,
+			    "Module %s has already been linked into the base.",
+			    mods[i]->name);
+			goto cleanup;
+		}
+
 		if ((modules[i] =
 		     (policy_module_t *) calloc(1,
 						sizeof(policy_module_t))) ==
@@ -2586,6 +2859,7 @@ int link_modules(sepol_handle_t * handle,
 	}
 
 	/* copy all types, declared and required */
+	SEPOL_PROBE1(link_phase, "types");
 	for (i = 0; i < len; i++) {
 		state.cur = modules[i];
 		state.cur_mod_name = modules[i]->policy->name;
@@ -2599,6 +2873,7 @@ int link_modules(sepol_handle_t * handle,
 	}
 
 	/* then copy everything else, including aliases, and fixup attributes */
+	SEPOL_PROBE1(link_phase, "identifiers");
 	for (i = 0; i < len; i++) {
 		state.cur = modules[i];
 		state.cur_mod_name = modules[i]->policy->name;
@@ -2616,6 +2891,7 @@ int link_modules(sepol_handle_t * handle,
 	}
 
 	/* copy and remap the module's data over to base */
+	SEPOL_PROBE1(link_phase, "modules");
 	for (i = 0; i < len; i++) {
 		state.cur = modules[i];
 		ret = copy_module(&state, modules[i]);
@@ -2635,6 +2911,7 @@ int link_modules(sepol_handle_t * handle,
 		goto cleanup;
 	}
 
+	SEPOL_PROBE1(link_phase, "avrules");
 	if (enable_avrules(&state, state.base)) {
 		retval = SEPOL_EREQ;
 		goto cleanup;
@@ -2663,5 +2940,6 @@ int link_modules(sepol_handle_t * handle,
 	}
 	free(modules);
 	free(state.decl_to_mod);
+	SEPOL_PROBE1(link_end, retval);
 	return retval;
 }
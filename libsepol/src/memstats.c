@@ -0,0 +1,363 @@
+/*
+ * Memory accounting for a policydb.
+ *
+ * Walks the structures of a kernel policy and adds up the objects of
+ * each component and the bytes of their structures and strings.  The
+ * figures leave out allocator overhead, so they are a floor on what
+ * the policy costs, but they move with every structure change.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+
+#include <sepol/policydb/policydb.h>
+#include <sepol/policydb/conditional.h>
+
+#include "policydb_internal.h"
+#include "strpool.h"
+
+enum {
+	MEM_AVTAB,
+	MEM_COND_AVTAB,
+	MEM_EBITMAP,
+	MEM_SYMTAB,
+	MEM_OCONTEXT,
+	MEM_CONSTRAINT,
+	MEM_FILENAME_TRANS,
+	MEM_STRINGS,
+	MEM_NUM
+};
+
+static const char *mem_names[MEM_NUM] = {
+	"avtab",
+	"cond_avtab",
+	"ebitmap",
+	"symtab",
+	"ocontext",
+	"constraint",
+	"filename_trans",
+	"strings",
+};
+
+struct memstats {
+	const policydb_t *p;
+	sepol_memstat_t st[MEM_NUM];
+};
+
+static void mem_add(struct memstats *m, int which, size_t count, size_t bytes)
+{
+	m->st[which].count += count;
+	m->st[which].bytes += bytes;
+}
+
+/* The nodes of 'e'; the ebitmap_t itself is part of its container. */
+static void ebitmap_account(struct memstats *m, const ebitmap_t * e)
+{
+	const ebitmap_node_t *n;
+
+	for (n = e->node; n; n = n->next)
+		mem_add(m, MEM_EBITMAP, 1, sizeof(*n));
+}
+
+static void type_set_account(struct memstats *m, const type_set_t * ts)
+{
+	ebitmap_account(m, &ts->types);
+	ebitmap_account(m, &ts->negset);
+}
+
+static void range_account(struct memstats *m, const mls_range_t * r)
+{
+	ebitmap_account(m, &r->level[0].cat);
+	ebitmap_account(m, &r->level[1].cat);
+}
+
+/* A symbol or permission name; pooled names are counted with the pool. */
+static void name_account(struct memstats *m, const char *name)
+{
+	if (name && !strpool_contains(m->p->strpool, name))
+		mem_add(m, MEM_STRINGS, 1, strlen(name) + 1);
+}
+
+static void avtab_account(struct memstats *m, int which, avtab_t * a)
+{
+	avtab_stats_t st;
+
+	avtab_hash_stats(a, &st);
+	mem_add(m, which, st.nel, st.bytes);
+	m->st[which].slots += st.nslot;
+	m->st[which].slots_used += st.slots_used;
+	if (st.max_chain_len > m->st[which].max_chain)
+		m->st[which].max_chain = st.max_chain_len;
+}
+
+static void hashtab_account(struct memstats *m, hashtab_t h)
+{
+	hashtab_stats_t st;
+
+	hashtab_hash_stats(h, &st);
+	mem_add(m, MEM_SYMTAB, 0, st.bytes);
+	m->st[MEM_SYMTAB].slots += st.size;
+	m->st[MEM_SYMTAB].slots_used += st.slots_used;
+	if (st.max_chain_len > m->st[MEM_SYMTAB].max_chain)
+		m->st[MEM_SYMTAB].max_chain = st.max_chain_len;
+}
+
+static void constraints_account(struct memstats *m,
+				const constraint_node_t * c)
+{
+	const constraint_expr_t *e;
+
+	for (; c; c = c->next) {
+		mem_add(m, MEM_CONSTRAINT, 1, sizeof(*c));
+		for (e = c->expr; e; e = e->next) {
+			mem_add(m, MEM_CONSTRAINT, 1, sizeof(*e));
+			ebitmap_account(m, &e->names);
+			if (e->type_names) {
+				mem_add(m, MEM_CONSTRAINT, 0,
+					sizeof(*e->type_names));
+				type_set_account(m, e->type_names);
+			}
+		}
+	}
+}
+
+static int perm_account(hashtab_key_t key, hashtab_datum_t datum
+			__attribute__ ((unused)), void *args)
+{
+	struct memstats *m = args;
+
+	mem_add(m, MEM_SYMTAB, 1, sizeof(perm_datum_t));
+	name_account(m, key);
+	return 0;
+}
+
+static void perms_account(struct memstats *m, const symtab_t * s)
+{
+	hashtab_account(m, s->table);
+	hashtab_map(s->table, perm_account, m);
+}
+
+static int common_account(hashtab_key_t key, hashtab_datum_t datum,
+			  void *args)
+{
+	struct memstats *m = args;
+	common_datum_t *comdatum = datum;
+
+	mem_add(m, MEM_SYMTAB, 1, sizeof(*comdatum));
+	name_account(m, key);
+	perms_account(m, &comdatum->permissions);
+	return 0;
+}
+
+static int class_account(hashtab_key_t key, hashtab_datum_t datum, void *args)
+{
+	struct memstats *m = args;
+	class_datum_t *cladatum = datum;
+
+	mem_add(m, MEM_SYMTAB, 1, sizeof(*cladatum));
+	name_account(m, key);
+	if (cladatum->comkey)
+		mem_add(m, MEM_STRINGS, 1, strlen(cladatum->comkey) + 1);
+	perms_account(m, &cladatum->permissions);
+	constraints_account(m, cladatum->constraints);
+	constraints_account(m, cladatum->validatetrans);
+	return 0;
+}
+
+static int role_account(hashtab_key_t key, hashtab_datum_t datum, void *args)
+{
+	struct memstats *m = args;
+	role_datum_t *role = datum;
+
+	mem_add(m, MEM_SYMTAB, 1, sizeof(*role));
+	name_account(m, key);
+	ebitmap_account(m, &role->dominates);
+	type_set_account(m, &role->types);
+	ebitmap_account(m, &role->cache);
+	ebitmap_account(m, &role->roles);
+	return 0;
+}
+
+static int type_account(hashtab_key_t key, hashtab_datum_t datum, void *args)
+{
+	struct memstats *m = args;
+	type_datum_t *type = datum;
+
+	mem_add(m, MEM_SYMTAB, 1, sizeof(*type));
+	name_account(m, key);
+	ebitmap_account(m, &type->types);
+	return 0;
+}
+
+static int user_account(hashtab_key_t key, hashtab_datum_t datum, void *args)
+{
+	struct memstats *m = args;
+	user_datum_t *user = datum;
+
+	mem_add(m, MEM_SYMTAB, 1, sizeof(*user));
+	name_account(m, key);
+	ebitmap_account(m, &user->roles.roles);
+	ebitmap_account(m, &user->cache);
+	range_account(m, &user->exp_range);
+	ebitmap_account(m, &user->exp_dfltlevel.cat);
+	return 0;
+}
+
+static int bool_account(hashtab_key_t key, hashtab_datum_t datum
+			__attribute__ ((unused)), void *args)
+{
+	struct memstats *m = args;
+
+	mem_add(m, MEM_SYMTAB, 1, sizeof(cond_bool_datum_t));
+	name_account(m, key);
+	return 0;
+}
+
+static int level_account(hashtab_key_t key, hashtab_datum_t datum, void *args)
+{
+	struct memstats *m = args;
+	level_datum_t *level = datum;
+
+	mem_add(m, MEM_SYMTAB, 1, sizeof(*level));
+	name_account(m, key);
+	if (level->level) {
+		mem_add(m, MEM_SYMTAB, 0, sizeof(*level->level));
+		ebitmap_account(m, &level->level->cat);
+	}
+	return 0;
+}
+
+static int cat_account(hashtab_key_t key, hashtab_datum_t datum
+		       __attribute__ ((unused)), void *args)
+{
+	struct memstats *m = args;
+
+	mem_add(m, MEM_SYMTAB, 1, sizeof(cat_datum_t));
+	name_account(m, key);
+	return 0;
+}
+
+static int (*symtab_account[SYM_NUM]) (hashtab_key_t key,
+				       hashtab_datum_t datum, void *args) = {
+	common_account,
+	class_account,
+	role_account,
+	type_account,
+	user_account,
+	bool_account,
+	level_account,
+	cat_account,
+};
+
+static void ocontext_account(struct memstats *m, const ocontext_t * c,
+			     int named)
+{
+	for (; c; c = c->next) {
+		mem_add(m, MEM_OCONTEXT, 1, sizeof(*c));
+		if (named && c->u.name)
+			mem_add(m, MEM_OCONTEXT, 0, strlen(c->u.name) + 1);
+		range_account(m, &c->context[0].range);
+		range_account(m, &c->context[1].range);
+	}
+}
+
+static int ocontext_named(const policydb_t * p, int i)
+{
+	if (p->target_platform == SEPOL_TARGET_XEN)
+		return i == OCON_XEN_ISID;
+	return i == OCON_ISID || i == OCON_FS || i == OCON_NETIF ||
+	    i == OCON_FSUSE;
+}
+
+static void cond_account(struct memstats *m, const cond_list_t * cond)
+{
+	const cond_expr_t *e;
+	const cond_av_list_t *l;
+
+	for (; cond; cond = cond->next) {
+		mem_add(m, MEM_COND_AVTAB, 0, sizeof(*cond));
+		for (e = cond->expr; e; e = e->next)
+			mem_add(m, MEM_COND_AVTAB, 0, sizeof(*e));
+		for (l = cond->true_list; l; l = l->next)
+			mem_add(m, MEM_COND_AVTAB, 0, sizeof(*l));
+		for (l = cond->false_list; l; l = l->next)
+			mem_add(m, MEM_COND_AVTAB, 0, sizeof(*l));
+	}
+}
+
+int sepol_policydb_memstats(const sepol_policydb_t * sp,
+			    sepol_memstat_t * stats, size_t n)
+{
+	/* the walk does not change the policy, but the table helpers
+	   are not declared const */
+	policydb_t *p = (policydb_t *) & sp->p;
+	struct memstats m;
+	const filename_trans_t *ft;
+	const range_trans_t *rt;
+	const genfs_t *genfs;
+	size_t count, bytes;
+	uint32_t i;
+
+	memset(&m, 0, sizeof(m));
+	m.p = p;
+	for (i = 0; i < MEM_NUM; i++)
+		m.st[i].name = mem_names[i];
+
+	avtab_account(&m, MEM_AVTAB, &p->te_avtab);
+	avtab_account(&m, MEM_COND_AVTAB, &p->te_cond_avtab);
+	if (p->te_merged_avtab)
+		avtab_account(&m, MEM_AVTAB, p->te_merged_avtab);
+	cond_account(&m, p->cond_list);
+
+	for (i = 0; i < SYM_NUM; i++) {
+		if (!p->symtab[i].table)
+			continue;
+		hashtab_account(&m, p->symtab[i].table);
+		hashtab_map(p->symtab[i].table, symtab_account[i], &m);
+	}
+	strpool_stats(p->strpool, &count, &bytes);
+	mem_add(&m, MEM_STRINGS, count, bytes);
+
+	for (i = 0; i < OCON_NUM; i++)
+		ocontext_account(&m, p->ocontexts[i], ocontext_named(p, i));
+	for (genfs = p->genfs; genfs; genfs = genfs->next) {
+		mem_add(&m, MEM_OCONTEXT, 0,
+			sizeof(*genfs) + strlen(genfs->fstype) + 1);
+		ocontext_account(&m, genfs->head, 1);
+	}
+
+	for (ft = p->filename_trans; ft; ft = ft->next)
+		mem_add(&m, MEM_FILENAME_TRANS, 1,
+			sizeof(*ft) + strlen(ft->name) + 1);
+
+	if (p->type_attr_map && p->attr_type_map) {
+		mem_add(&m, MEM_EBITMAP, 0,
+			2 * (size_t)p->p_types.nprim * sizeof(ebitmap_t));
+		for (i = 0; i < p->p_types.nprim; i++) {
+			ebitmap_account(&m, &p->type_attr_map[i]);
+			ebitmap_account(&m, &p->attr_type_map[i]);
+		}
+	}
+	for (rt = p->range_tr; rt; rt = rt->next)
+		range_account(&m, &rt->target_range);
+	ebitmap_account(&m, &p->policycaps);
+	ebitmap_account(&m, &p->permissive_map);
+
+	if (n > MEM_NUM)
+		n = MEM_NUM;
+	memcpy(stats, m.st, n * sizeof(*stats));
+	return MEM_NUM;
+}
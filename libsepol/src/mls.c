@@ -38,6 +38,7 @@
 #include "debug.h"
 #include "private.h"
 #include "mls.h"
+#include "trans_keys.h"
 
 int mls_to_string(sepol_handle_t * handle,
 		  const policydb_t * policydb,
@@ -615,14 +616,11 @@ int mls_compute_sid(policydb_t * policydb,
 	switch (specified) {
 	case AVTAB_TRANSITION:
 		/* Look for a range transition rule. */
-		for (rtr = policydb->range_tr; rtr; rtr = rtr->next) {
-			if (rtr->source_type == scontext->type &&
-			    rtr->target_type == tcontext->type &&
-			    rtr->target_class == tclass) {
-				/* Set the range from the rule */
-				return mls_range_set(newcontext,
-						     &rtr->target_range);
-			}
+		rtr = trans_keys_find_range(policydb, scontext->type,
+					    tcontext->type, tclass);
+		if (rtr) {
+			/* Set the range from the rule */
+			return mls_range_set(newcontext, &rtr->target_range);
 		}
 		/* Fallthrough */
 	case AVTAB_CHANGE:
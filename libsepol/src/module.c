@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <sys/stat.h>
 
 #define SEPOL_PACKAGE_SECTION_FC 0xf97cff90
 #define SEPOL_PACKAGE_SECTION_SEUSER 0x97cff91
@@ -44,6 +45,11 @@ static int policy_file_seek(struct policy_file *fp, size_t offset)
 			errno = EFAULT;
 			return -1;
 		}
+		/* Sections are usually read in order, so this is mostly
+		 * already the current position; seeking would throw away
+		 * the stdio buffer. */
+		if (ftell(fp->fp) == (long)offset)
+			return 0;
 		return fseek(fp->fp, (long)offset, SEEK_SET);
 	case PF_USE_MEMORY:
 		if (offset > fp->size) {
@@ -62,9 +68,15 @@ static int policy_file_seek(struct policy_file *fp, size_t offset)
 static int policy_file_length(struct policy_file *fp, size_t *out)
 {
 	long prev_offset, end_offset;
+	struct stat sb;
 	int rc;
 	switch (fp->type) {
 	case PF_USE_STDIO:
+		/* avoid seeking to the end and back for regular files */
+		if (fstat(fileno(fp->fp), &sb) == 0 && S_ISREG(sb.st_mode)) {
+			*out = sb.st_size;
+			break;
+		}
 		prev_offset = ftell(fp->fp);
 		if (prev_offset < 0)
 			return prev_offset;
@@ -342,26 +354,11 @@ int sepol_link_packages(sepol_handle_t * handle,
 }
 
 /* buf must be large enough - no checks are performed */
-#define _read_helper_bufsize BUFSIZ
 static int read_helper(char *buf, struct policy_file *file, uint32_t bytes)
 {
-	uint32_t offset, nel, read_len;
-	int rc;
-
-	offset = 0;
-	nel = bytes;
-
-	while (nel) {
-		if (nel < _read_helper_bufsize)
-			read_len = nel;
-		else
-			read_len = _read_helper_bufsize;
-		rc = next_entry(&buf[offset], file, read_len);
-		if (rc < 0)
-			return -1;
-		offset += read_len;
-		nel -= read_len;
-	}
+	/* a single read copies the section straight into buf */
+	if (bytes && next_entry(buf, file, bytes) < 0)
+		return -1;
 	return 0;
 }
 
@@ -649,17 +646,18 @@ int sepol_module_package_info(struct sepol_policy_file *spf, int *type,
 			      char **name, char **version)
 {
 	struct policy_file *file = &spf->pf;
-	sepol_module_package_t *mod = NULL;
+	sepol_module_package_t mod;
 	uint32_t buf[5], len, nsec;
 	size_t *offsets = NULL;
 	unsigned i, seen = 0;
 	char *id;
 	int rc;
 
-	if (sepol_module_package_create(&mod))
-		return -1;
+	/* Only the header is read, which does not need a policydb
+	 * to read into. */
+	memset(&mod, 0, sizeof(mod));
 
-	if (module_package_read_offsets(mod, file, &offsets, &nsec)) {
+	if (module_package_read_offsets(&mod, file, &offsets, &nsec)) {
 		goto cleanup;
 	}
 
@@ -840,12 +838,10 @@ int sepol_module_package_info(struct sepol_policy_file *spf, int *type,
 		goto cleanup;
 	}
 
-	sepol_module_package_free(mod);
 	free(offsets);
 	return 0;
 
       cleanup:
-	sepol_module_package_free(mod);
 	free(offsets);
 	return -1;
 }
@@ -878,21 +874,21 @@ int sepol_module_package_write(sepol_module_package_t * p,
 	uint32_t buf[5], offsets[5], len, nsec = 0;
 	int i;
 
+	policy_file_init(&polfile);
 	if (p->policy) {
-		/* compute policy length */
-		policy_file_init(&polfile);
-		polfile.type = PF_LEN;
+		/* write the policy once into memory to learn its length */
+		polfile.type = PF_USE_GROWBUF;
 		polfile.handle = file->handle;
 		if (policydb_write(&p->policy->p, &polfile))
-			return -1;
+			goto err;
 		len = polfile.len;
-		if (!polfile.len)
-			return -1;
+		if (!polfile.len || len != polfile.len)
+			goto err;
 		nsec++;
 
 	} else {
 		/* We don't support writing a package without a module at this point */
-		return -1;
+		goto err;
 	}
 
 	/* seusers and user_extra only supported in base at the moment */
@@ -900,7 +896,7 @@ int sepol_module_package_write(sepol_module_package_t * p,
 	    && (p->policy->p.policy_type != SEPOL_POLICY_BASE)) {
 		ERR(file->handle,
 		    "seuser and user_extra sections only supported in base");
-		return -1;
+		goto err;
 	}
 
 	if (p->file_contexts)
@@ -919,7 +915,7 @@ int sepol_module_package_write(sepol_module_package_t * p,
 	buf[1] = cpu_to_le32(p->version);
 	buf[2] = cpu_to_le32(nsec);
 	if (put_entry(buf, sizeof(uint32_t), 3, file) != 3)
-		return -1;
+		goto err;
 
 	/* calculate offsets */
 	offsets[0] = (nsec + 3) * sizeof(uint32_t);
@@ -952,44 +948,49 @@ int sepol_module_package_write(sepol_module_package_t * p,
 		i++;
 	}
 	if (put_entry(buf, sizeof(uint32_t), nsec, file) != nsec)
-		return -1;
+		goto err;
 
 	/* write sections */
 
-	if (policydb_write(&p->policy->p, file))
-		return -1;
+	if (write_helper(polfile.data, polfile.len, file))
+		goto err;
 
 	if (p->file_contexts) {
 		buf[0] = cpu_to_le32(SEPOL_PACKAGE_SECTION_FC);
 		if (put_entry(buf, sizeof(uint32_t), 1, file) != 1)
-			return -1;
+			goto err;
 		if (write_helper(p->file_contexts, p->file_contexts_len, file))
-			return -1;
+			goto err;
 	}
 	if (p->seusers) {
 		buf[0] = cpu_to_le32(SEPOL_PACKAGE_SECTION_SEUSER);
 		if (put_entry(buf, sizeof(uint32_t), 1, file) != 1)
-			return -1;
+			goto err;
 		if (write_helper(p->seusers, p->seusers_len, file))
-			return -1;
+			goto err;
 
 	}
 	if (p->user_extra) {
 		buf[0] = cpu_to_le32(SEPOL_PACKAGE_SECTION_USER_EXTRA);
 		if (put_entry(buf, sizeof(uint32_t), 1, file) != 1)
-			return -1;
+			goto err;
 		if (write_helper(p->user_extra, p->user_extra_len, file))
-			return -1;
+			goto err;
 	}
 	if (p->netfilter_contexts) {
 		buf[0] = cpu_to_le32(SEPOL_PACKAGE_SECTION_NETFILTER);
 		if (put_entry(buf, sizeof(uint32_t), 1, file) != 1)
-			return -1;
+			goto err;
 		if (write_helper
 		    (p->netfilter_contexts, p->netfilter_contexts_len, file))
-			return -1;
+			goto err;
 	}
+	free(polfile.data);
 	return 0;
+
+      err:
+	free(polfile.data);
+	return -1;
 }
 
 int sepol_link_modules(sepol_handle_t * handle,
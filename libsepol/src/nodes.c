@@ -1,6 +1,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "debug.h"
 #include "context.h"
@@ -8,6 +9,7 @@
 
 #include <sepol/policydb/policydb.h>
 #include "node_internal.h"
+#include "ocon_keys.h"
 
 /* Create a low level node structure from
  * a high level representation */
@@ -166,6 +168,25 @@ extern int sepol_node_count(sepol_handle_t * handle __attribute__ ((unused)),
 	return STATUS_SUCCESS;
 }
 
+/* Find the first node with the given address and mask; the key
+ * index is a cache, so it may be built even for a const policy. */
+static ocontext_t *node_find(const policydb_t * policydb, int proto,
+			     const char *addr, const char *mask)
+{
+
+	ocontext_t key;
+
+	memset(&key, 0, sizeof(key));
+	if (proto == SEPOL_PROTO_IP4) {
+		memcpy(&key.u.node.addr, addr, 4);
+		memcpy(&key.u.node.mask, mask, 4);
+		return ocon_keys_find((policydb_t *) policydb, OCON_NODE, &key);
+	}
+	memcpy(key.u.node6.addr, addr, 16);
+	memcpy(key.u.node6.mask, mask, 16);
+	return ocon_keys_find((policydb_t *) policydb, OCON_NODE6, &key);
+}
+
 /* Check if a node exists */
 int sepol_node_exists(sepol_handle_t * handle,
 		      const sepol_policydb_t * p,
@@ -173,51 +194,17 @@ int sepol_node_exists(sepol_handle_t * handle,
 {
 
 	const policydb_t *policydb = &p->p;
-	ocontext_t *c, *head;
 
 	int proto;
 	const char *addr, *mask;
 	sepol_node_key_unpack(key, &addr, &mask, &proto);
 
-	switch (proto) {
-
-	case SEPOL_PROTO_IP4:
-		{
-			head = policydb->ocontexts[OCON_NODE];
-			for (c = head; c; c = c->next) {
-				unsigned int *addr2 = &c->u.node.addr;
-				unsigned int *mask2 = &c->u.node.mask;
-
-				if (!memcmp(addr, addr2, 4) &&
-				    !memcmp(mask, mask2, 4)) {
-
-					*response = 1;
-					return STATUS_SUCCESS;
-				}
-			}
-			break;
-		}
-	case SEPOL_PROTO_IP6:
-		{
-			head = policydb->ocontexts[OCON_NODE6];
-			for (c = head; c; c = c->next) {
-				unsigned int *addr2 = c->u.node6.addr;
-				unsigned int *mask2 = c->u.node6.mask;
-
-				if (!memcmp(addr, addr2, 16) &&
-				    !memcmp(mask, mask2, 16)) {
-					*response = 1;
-					return STATUS_SUCCESS;
-				}
-			}
-			break;
-		}
-	default:
+	if (proto != SEPOL_PROTO_IP4 && proto != SEPOL_PROTO_IP6) {
 		ERR(handle, "unsupported protocol %u", proto);
 		goto err;
 	}
 
-	*response = 0;
+	*response = node_find(policydb, proto, addr, mask) != NULL;
 	return STATUS_SUCCESS;
 
       err:
@@ -233,55 +220,24 @@ int sepol_node_query(sepol_handle_t * handle,
 {
 
 	const policydb_t *policydb = &p->p;
-	ocontext_t *c, *head;
+	ocontext_t *c;
 
 	int proto;
 	const char *addr, *mask;
 	sepol_node_key_unpack(key, &addr, &mask, &proto);
 
-	switch (proto) {
-
-	case SEPOL_PROTO_IP4:
-		{
-			head = policydb->ocontexts[OCON_NODE];
-			for (c = head; c; c = c->next) {
-				unsigned int *addr2 = &c->u.node.addr;
-				unsigned int *mask2 = &c->u.node.mask;
-
-				if (!memcmp(addr, addr2, 4) &&
-				    !memcmp(mask, mask2, 4)) {
-
-					if (node_to_record(handle, policydb,
-							   c, SEPOL_PROTO_IP4,
-							   response) < 0)
-						goto err;
-					return STATUS_SUCCESS;
-				}
-			}
-			break;
-		}
-	case SEPOL_PROTO_IP6:
-		{
-			head = policydb->ocontexts[OCON_NODE6];
-			for (c = head; c; c = c->next) {
-				unsigned int *addr2 = c->u.node6.addr;
-				unsigned int *mask2 = c->u.node6.mask;
-
-				if (!memcmp(addr, addr2, 16) &&
-				    !memcmp(mask, mask2, 16)) {
-
-					if (node_to_record(handle, policydb,
-							   c, SEPOL_PROTO_IP6,
-							   response) < 0)
-						goto err;
-				}
-			}
-			break;
-		}
-	default:
+	if (proto != SEPOL_PROTO_IP4 && proto != SEPOL_PROTO_IP6) {
 		ERR(handle, "unsupported protocol %u", proto);
 		goto err;
 	}
+
+	c = node_find(policydb, proto, addr, mask);
+	if (c) {
+		if (node_to_record(handle, policydb, c, proto, response) < 0)
+			goto err;
+		return STATUS_SUCCESS;
+	}
+
 	*response = NULL;
 	return STATUS_SUCCESS;
 
@@ -314,15 +270,13 @@ int sepol_node_modify(sepol_handle_t * handle,
 	case SEPOL_PROTO_IP4:
 		{
 			/* Attach to context list */
-			node->next = policydb->ocontexts[OCON_NODE];
-			policydb->ocontexts[OCON_NODE] = node;
+			ocon_keys_prepend(policydb, OCON_NODE, node);
 			break;
 		}
 	case SEPOL_PROTO_IP6:
 		{
 			/* Attach to context list */
-			node->next = policydb->ocontexts[OCON_NODE6];
-			policydb->ocontexts[OCON_NODE6] = node;
+			ocon_keys_prepend(policydb, OCON_NODE6, node);
 			break;
 		}
 	default:
@@ -342,6 +296,54 @@ int sepol_node_modify(sepol_handle_t * handle,
 	return STATUS_ERR;
 }
 
+/* Load several nodes into policy, as by sepol_node_modify
+ * on each in turn; either all of them are loaded or none */
+int sepol_node_modify_many(sepol_handle_t * handle,
+			   sepol_policydb_t * p,
+			   sepol_node_t * const *nodes, unsigned int nnodes)
+{
+
+	policydb_t *policydb = &p->p;
+	ocontext_t **tmp;
+	unsigned int i, n = 0;
+
+	if (!nnodes)
+		return STATUS_SUCCESS;
+
+	tmp = calloc(nnodes, sizeof(ocontext_t *));
+	if (!tmp) {
+		ERR(handle, "out of memory");
+		goto err;
+	}
+
+	for (n = 0; n < nnodes; n++) {
+		if (node_from_record(handle, policydb, &tmp[n], nodes[n]) < 0)
+			goto err;
+	}
+
+	/* Attach to context lists */
+	for (i = 0; i < nnodes; i++) {
+		if (sepol_node_get_proto(nodes[i]) == SEPOL_PROTO_IP4)
+			ocon_keys_prepend(policydb, OCON_NODE, tmp[i]);
+		else
+			ocon_keys_prepend(policydb, OCON_NODE6, tmp[i]);
+	}
+
+	free(tmp);
+	return STATUS_SUCCESS;
+
+      err:
+	ERR(handle, "could not load %u nodes", nnodes);
+	if (tmp != NULL) {
+		for (i = 0; i < n; i++) {
+			context_destroy(&tmp[i]->context[0]);
+			free(tmp[i]);
+		}
+		free(tmp);
+	}
+	return STATUS_ERR;
+}
+
 int sepol_node_iterate(sepol_handle_t * handle,
 		       const sepol_policydb_t * p,
 		       int (*fn) (const sepol_node_t * node,
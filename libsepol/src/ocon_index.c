@@ -0,0 +1,513 @@
+/*
+ * Lookup tables for ocontexts, so that port, node, netif and fs
+ * labeling does not walk lists of thousands of entries.
+ *
+ * Ports: the ranges of each protocol are flattened into sorted,
+ * disjoint segments, each labeled by the first entry that covers it;
+ * a lookup is a binary search.
+ *
+ * Nodes: an entry matches when (address & mask) == addr, and the first
+ * matching entry wins, whatever its prefix length.  The entries are
+ * grouped by mask, with a hash table of addresses per mask holding the
+ * first entry for each; a lookup probes every mask and keeps the
+ * earliest entry found.  Policies use few distinct masks.
+ *
+ * Names: a hash table holding the first entry for each name.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ocon_index.h"
+
+struct port_seg {
+	uint32_t low;		/* first port of the segment */
+	ocontext_t *c;
+};
+
+struct port_table {
+	uint8_t protocol;
+	uint32_t nsegs;
+	struct port_seg *segs;
+};
+
+struct node_slot {
+	uint32_t addr[4];
+	uint32_t order;		/* position of the entry in its list */
+	ocontext_t *c;
+};
+
+struct node_group {
+	uint32_t mask[4];
+	uint32_t first;		/* lowest order in the group */
+	uint32_t size;		/* power of two */
+	struct node_slot *slots;
+};
+
+struct node_table {
+	uint32_t ngroups;
+	struct node_group *groups;	/* sorted by first */
+};
+
+struct name_slot {
+	const char *name;
+	ocontext_t *c;
+};
+
+struct name_table {
+	uint32_t size;
+	struct name_slot *slots;
+};
+
+struct ocon_index {
+	ocontext_t *heads[OCON_NUM];
+	uint32_t nports;
+	struct port_table *ports;
+	struct node_table node;
+	struct node_table node6;
+	struct name_table fs;
+	struct name_table netif;
+};
+
+static uint32_t table_size(uint32_t n)
+{
+	uint32_t size = 16;
+
+	while (size < n * 2)
+		size <<= 1;
+	return size;
+}
+
+/* Ports */
+
+static int bound_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint32_t bound_find(const uint32_t * bounds, uint32_t n, uint32_t v)
+{
+	uint32_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (bounds[mid] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Next segment at or after i that no entry has claimed yet. */
+static uint32_t seg_next(uint32_t * next, uint32_t i)
+{
+	uint32_t root = i, tmp;
+
+	while (next[root] != root)
+		root = next[root];
+	while (next[i] != root) {
+		tmp = next[i];
+		next[i] = root;
+		i = tmp;
+	}
+	return root;
+}
+
+static int port_table_build(struct port_table *t, const ocontext_t * head)
+{
+	const ocontext_t *c;
+	uint32_t *bounds = NULL, *next = NULL;
+	uint32_t n = 0, nb = 0, i, j, e;
+	int rc = -1;
+
+	for (c = head; c; c = c->next)
+		if (c->u.port.protocol == t->protocol)
+			n++;
+
+	bounds = malloc((2 * n + 1) * sizeof(uint32_t));
+	if (!bounds)
+		goto out;
+	bounds[nb++] = 0;
+	for (c = head; c; c = c->next) {
+		if (c->u.port.protocol != t->protocol)
+			continue;
+		bounds[nb++] = c->u.port.low_port;
+		bounds[nb++] = (uint32_t)c->u.port.high_port + 1;
+	}
+	qsort(bounds, nb, sizeof(uint32_t), bound_cmp);
+	for (i = 1, j = 1; i < nb; i++)
+		if (bounds[i] != bounds[j - 1])
+			bounds[j++] = bounds[i];
+	nb = j;
+
+	t->segs = calloc(nb, sizeof(struct port_seg));
+	next = malloc((nb + 1) * sizeof(uint32_t));
+	if (!t->segs || !next)
+		goto out;
+	for (i = 0; i <= nb; i++)
+		next[i] = i;
+	for (i = 0; i < nb; i++)
+		t->segs[i].low = bounds[i];
+
+	/* Each entry labels the segments of its range that no earlier
+	   entry has labeled. */
+	for (c = head; c; c = c->next) {
+		if (c->u.port.protocol != t->protocol ||
+		    c->u.port.low_port > c->u.port.high_port)
+			continue;
+		i = bound_find(bounds, nb, c->u.port.low_port);
+		e = bound_find(bounds, nb, (uint32_t)c->u.port.high_port + 1);
+		for (i = seg_next(next, i); i < e; i = seg_next(next, i)) {
+			t->segs[i].c = (ocontext_t *) c;
+			next[i] = i + 1;
+		}
+	}
+
+	/* Merge neighbours with the same label. */
+	for (i = 1, j = 1; i < nb; i++)
+		if (t->segs[i].c != t->segs[j - 1].c)
+			t->segs[j++] = t->segs[i];
+	t->nsegs = j;
+	rc = 0;
+      out:
+	free(bounds);
+	free(next);
+	return rc;
+}
+
+static int ports_build(struct ocon_index *idx, const ocontext_t * head)
+{
+	const ocontext_t *c;
+	uint32_t i;
+	int seen[256];
+
+	memset(seen, 0, sizeof(seen));
+	for (c = head; c; c = c->next) {
+		if (seen[c->u.port.protocol])
+			continue;
+		seen[c->u.port.protocol] = 1;
+		idx->nports++;
+	}
+	if (!idx->nports)
+		return 0;
+	idx->ports = calloc(idx->nports, sizeof(struct port_table));
+	if (!idx->ports)
+		return -1;
+
+	for (i = 0, c = head; c; c = c->next) {
+		if (seen[c->u.port.protocol] != 1)
+			continue;
+		seen[c->u.port.protocol] = 2;
+		idx->ports[i].protocol = c->u.port.protocol;
+		if (port_table_build(&idx->ports[i], head) < 0)
+			return -1;
+		i++;
+	}
+	return 0;
+}
+
+ocontext_t hidden *ocon_index_port(const struct ocon_index *idx,
+				   uint8_t protocol, uint16_t port)
+{
+	const struct port_table *t = NULL;
+	uint32_t i, lo, hi;
+
+	for (i = 0; i < idx->nports; i++) {
+		if (idx->ports[i].protocol == protocol) {
+			t = &idx->ports[i];
+			break;
+		}
+	}
+	if (!t || !t->nsegs)
+		return NULL;
+
+	/* Last segment starting at or before the port. */
+	lo = 0;
+	hi = t->nsegs;
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (t->segs[mid].low <= port)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return t->segs[lo].c;
+}
+
+/* Nodes */
+
+static uint32_t node_hash(const uint32_t * addr)
+{
+	uint32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		h ^= addr[i];
+		h *= 16777619U;
+	}
+	return h ^ (h >> 15);
+}
+
+static const struct node_slot *node_find(const struct node_group *g,
+					 const uint32_t * addr)
+{
+	uint32_t h = node_hash(addr) & (g->size - 1);
+
+	while (g->slots[h].c) {
+		if (memcmp(g->slots[h].addr, addr, sizeof(g->slots[h].addr)) == 0)
+			return &g->slots[h];
+		h = (h + 1) & (g->size - 1);
+	}
+	return NULL;
+}
+
+static void node_get(const ocontext_t * c, int v6, uint32_t * addr,
+		     uint32_t * mask)
+{
+	memset(addr, 0, 4 * sizeof(uint32_t));
+	memset(mask, 0, 4 * sizeof(uint32_t));
+	if (v6) {
+		memcpy(addr, c->u.node6.addr, 4 * sizeof(uint32_t));
+		memcpy(mask, c->u.node6.mask, 4 * sizeof(uint32_t));
+	} else {
+		addr[0] = c->u.node.addr;
+		mask[0] = c->u.node.mask;
+	}
+}
+
+static int node_build(struct node_table *t, const ocontext_t * head, int v6)
+{
+	const ocontext_t *c;
+	struct node_group *g;
+	uint32_t addr[4], mask[4], order, i, k, h;
+	uint32_t *counts;
+	int match;
+
+	/* Find the masks, in order of their first entry. */
+	for (c = head; c; c = c->next) {
+		node_get(c, v6, addr, mask);
+		for (i = 0; i < t->ngroups; i++)
+			if (!memcmp(t->groups[i].mask, mask, sizeof(mask)))
+				break;
+		if (i < t->ngroups)
+			continue;
+		g = realloc(t->groups, (t->ngroups + 1) * sizeof(*g));
+		if (!g)
+			return -1;
+		t->groups = g;
+		memset(&g[t->ngroups], 0, sizeof(*g));
+		memcpy(g[t->ngroups].mask, mask, sizeof(mask));
+		t->ngroups++;
+	}
+
+	counts = calloc(t->ngroups ? t->ngroups : 1, sizeof(uint32_t));
+	if (!counts)
+		return -1;
+	for (c = head; c; c = c->next) {
+		node_get(c, v6, addr, mask);
+		for (i = 0; memcmp(t->groups[i].mask, mask, sizeof(mask)); i++) ;
+		counts[i]++;
+	}
+	for (i = 0; i < t->ngroups; i++) {
+		t->groups[i].size = table_size(counts[i]);
+		t->groups[i].first = UINT32_MAX;
+		t->groups[i].slots = calloc(t->groups[i].size,
+					    sizeof(struct node_slot));
+		if (!t->groups[i].slots) {
+			free(counts);
+			return -1;
+		}
+	}
+	free(counts);
+
+	for (order = 0, c = head; c; c = c->next, order++) {
+		node_get(c, v6, addr, mask);
+		/* An address with bits outside its mask never matches. */
+		for (k = 0, match = 1; k < 4; k++)
+			if (addr[k] & ~mask[k])
+				match = 0;
+		if (!match)
+			continue;
+		for (i = 0; memcmp(t->groups[i].mask, mask, sizeof(mask)); i++) ;
+		g = &t->groups[i];
+		if (node_find(g, addr))
+			continue;	/* an earlier entry wins */
+		h = node_hash(addr) & (g->size - 1);
+		while (g->slots[h].c)
+			h = (h + 1) & (g->size - 1);
+		memcpy(g->slots[h].addr, addr, sizeof(addr));
+		g->slots[h].order = order;
+		g->slots[h].c = (ocontext_t *) c;
+		if (order < g->first)
+			g->first = order;
+	}
+
+	/* Probe the groups with the earliest entries first. */
+	for (i = 1; i < t->ngroups; i++) {
+		struct node_group tmp = t->groups[i];
+		for (k = i; k > 0 && t->groups[k - 1].first > tmp.first; k--)
+			t->groups[k] = t->groups[k - 1];
+		t->groups[k] = tmp;
+	}
+	return 0;
+}
+
+static ocontext_t *node_lookup(const struct node_table *t,
+			       const uint32_t * addr)
+{
+	const struct node_slot *s, *best = NULL;
+	uint32_t key[4];
+	uint32_t i;
+	int k;
+
+	for (i = 0; i < t->ngroups; i++) {
+		const struct node_group *g = &t->groups[i];
+		/* Groups are sorted by their earliest entry, so none of
+		   the remaining ones can have an earlier match. */
+		if (best && g->first > best->order)
+			break;
+		for (k = 0; k < 4; k++)
+			key[k] = addr[k] & g->mask[k];
+		s = node_find(g, key);
+		if (s && (!best || s->order < best->order))
+			best = s;
+	}
+	return best ? best->c : NULL;
+}
+
+ocontext_t hidden *ocon_index_node(const struct ocon_index *idx,
+				   uint32_t addr)
+{
+	uint32_t key[4] = { addr, 0, 0, 0 };
+
+	return node_lookup(&idx->node, key);
+}
+
+ocontext_t hidden *ocon_index_node6(const struct ocon_index *idx,
+				    const uint32_t * addr)
+{
+	return node_lookup(&idx->node6, addr);
+}
+
+static void node_destroy(struct node_table *t)
+{
+	uint32_t i;
+
+	for (i = 0; i < t->ngroups; i++)
+		free(t->groups[i].slots);
+	free(t->groups);
+}
+
+/* Names */
+
+static uint32_t name_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static int name_build(struct name_table *t, const ocontext_t * head)
+{
+	const ocontext_t *c;
+	uint32_t n = 0, h;
+
+	for (c = head; c; c = c->next)
+		n++;
+	t->size = table_size(n);
+	t->slots = calloc(t->size, sizeof(struct name_slot));
+	if (!t->slots)
+		return -1;
+
+	for (c = head; c; c = c->next) {
+		h = name_hash(c->u.name) & (t->size - 1);
+		while (t->slots[h].c && strcmp(t->slots[h].name, c->u.name))
+			h = (h + 1) & (t->size - 1);
+		if (t->slots[h].c)
+			continue;	/* an earlier entry wins */
+		t->slots[h].name = c->u.name;
+		t->slots[h].c = (ocontext_t *) c;
+	}
+	return 0;
+}
+
+ocontext_t hidden *ocon_index_name(const struct ocon_index *idx,
+				   int which, const char *name)
+{
+	const struct name_table *t;
+	uint32_t h;
+
+	t = which == OCON_FS ? &idx->fs : &idx->netif;
+	h = name_hash(name) & (t->size - 1);
+	while (t->slots[h].c) {
+		if (!strcmp(t->slots[h].name, name))
+			return t->slots[h].c;
+		h = (h + 1) & (t->size - 1);
+	}
+	return NULL;
+}
+
+/* The index */
+
+struct ocon_index hidden *ocon_index_create(const policydb_t * p)
+{
+	struct ocon_index *idx;
+
+	idx = calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+	memcpy(idx->heads, p->ocontexts, sizeof(idx->heads));
+
+	if (ports_build(idx, p->ocontexts[OCON_PORT]) < 0 ||
+	    node_build(&idx->node, p->ocontexts[OCON_NODE], 0) < 0 ||
+	    node_build(&idx->node6, p->ocontexts[OCON_NODE6], 1) < 0 ||
+	    name_build(&idx->fs, p->ocontexts[OCON_FS]) < 0 ||
+	    name_build(&idx->netif, p->ocontexts[OCON_NETIF]) < 0) {
+		ocon_index_destroy(idx);
+		return NULL;
+	}
+	return idx;
+}
+
+void hidden ocon_index_destroy(struct ocon_index *idx)
+{
+	uint32_t i;
+
+	if (!idx)
+		return;
+	for (i = 0; i < idx->nports; i++)
+		free(idx->ports[i].segs);
+	free(idx->ports);
+	node_destroy(&idx->node);
+	node_destroy(&idx->node6);
+	free(idx->fs.slots);
+	free(idx->netif.slots);
+	free(idx);
+}
+
+int hidden ocon_index_current(const struct ocon_index *idx,
+			      const policydb_t * p)
+{
+	return !memcmp(idx->heads, p->ocontexts, sizeof(idx->heads));
+}
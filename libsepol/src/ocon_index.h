@@ -0,0 +1,37 @@
+#ifndef _SEPOL_INTERNAL_OCON_INDEX_H_
+#define _SEPOL_INTERNAL_OCON_INDEX_H_
+
+#include <stdint.h>
+#include <sepol/policydb/policydb.h>
+#include "dso.h"
+
+/*
+ * Lookup tables for the port, node, netif and fs ocontexts of a kernel
+ * policy.  Every lookup returns the same entry as a walk of the list in
+ * declaration order would: the first one that matches.
+ */
+struct ocon_index;
+
+/* Build the tables for 'p'.  Returns NULL if out of memory. */
+extern struct ocon_index *ocon_index_create(const policydb_t * p);
+
+extern void ocon_index_destroy(struct ocon_index *idx);
+
+/* Return 1 if the ocontext lists of 'p' still start where they did. */
+extern int ocon_index_current(const struct ocon_index *idx,
+			      const policydb_t * p);
+
+extern ocontext_t *ocon_index_port(const struct ocon_index *idx,
+				   uint8_t protocol, uint16_t port);
+
+/* 'addr' is in network byte order, as in the policy. */
+extern ocontext_t *ocon_index_node(const struct ocon_index *idx,
+				   uint32_t addr);
+extern ocontext_t *ocon_index_node6(const struct ocon_index *idx,
+				    const uint32_t * addr);
+
+/* 'which' is OCON_FS or OCON_NETIF. */
+extern ocontext_t *ocon_index_name(const struct ocon_index *idx,
+				   int which, const char *name);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Exact-key tables for the port and node ocontexts of a policydb.
+ *
+ * Each table is an open-addressing hash of the first entry for every
+ * key in a list, and remembers the list head it was built for.  Entries
+ * prepended through ocon_keys_prepend() replace the slot of their key,
+ * since they now come first; a table whose list head moved some other
+ * way is rebuilt on the next lookup.  If a table cannot be built, the
+ * lookup walks the list instead.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ocon_keys.h"
+
+#define KEY_PORT	0
+#define KEY_NODE	1
+#define KEY_NODE6	2
+#define KEY_NUM		3
+
+struct key_table {
+	ocontext_t *head;	/* list head the table was built for */
+	uint32_t size;		/* power of two, 0 if not built */
+	uint32_t count;
+	ocontext_t **slots;
+};
+
+struct ocon_keys {
+	struct key_table t[KEY_NUM];
+};
+
+static int key_kind(int which)
+{
+	switch (which) {
+	case OCON_PORT:
+		return KEY_PORT;
+	case OCON_NODE:
+		return KEY_NODE;
+	default:
+		return KEY_NODE6;
+	}
+}
+
+static uint32_t key_hash(int kind, const ocontext_t * c)
+{
+	uint32_t v[8], h = 2166136261U;
+	int i, n;
+
+	switch (kind) {
+	case KEY_PORT:
+		v[0] = c->u.port.protocol;
+		v[1] = c->u.port.low_port;
+		v[2] = c->u.port.high_port;
+		n = 3;
+		break;
+	case KEY_NODE:
+		v[0] = c->u.node.addr;
+		v[1] = c->u.node.mask;
+		n = 2;
+		break;
+	default:
+		memcpy(v, c->u.node6.addr, 4 * sizeof(uint32_t));
+		memcpy(v + 4, c->u.node6.mask, 4 * sizeof(uint32_t));
+		n = 8;
+		break;
+	}
+	for (i = 0; i < n; i++) {
+		h ^= v[i];
+		h *= 16777619U;
+	}
+	return h ^ (h >> 15);
+}
+
+static int key_equal(int kind, const ocontext_t * a, const ocontext_t * b)
+{
+	switch (kind) {
+	case KEY_PORT:
+		return a->u.port.protocol == b->u.port.protocol &&
+		    a->u.port.low_port == b->u.port.low_port &&
+		    a->u.port.high_port == b->u.port.high_port;
+	case KEY_NODE:
+		return a->u.node.addr == b->u.node.addr &&
+		    a->u.node.mask == b->u.node.mask;
+	default:
+		return !memcmp(a->u.node6.addr, b->u.node6.addr,
+			       sizeof(a->u.node6.addr)) &&
+		    !memcmp(a->u.node6.mask, b->u.node6.mask,
+			    sizeof(a->u.node6.mask));
+	}
+}
+
+static void table_drop(struct key_table *t)
+{
+	free(t->slots);
+	t->slots = NULL;
+	t->size = 0;
+	t->count = 0;
+	t->head = NULL;
+}
+
+/* Place 'c' in its slot; an entry already there is replaced only
+ * if 'replace' is set.  The table must have a free slot. */
+static void table_put(struct key_table *t, int kind, ocontext_t * c,
+		      int replace)
+{
+	uint32_t h = key_hash(kind, c) & (t->size - 1);
+
+	while (t->slots[h]) {
+		if (key_equal(kind, t->slots[h], c)) {
+			if (replace)
+				t->slots[h] = c;
+			return;
+		}
+		h = (h + 1) & (t->size - 1);
+	}
+	t->slots[h] = c;
+	t->count++;
+}
+
+static int table_resize(struct key_table *t, int kind, uint32_t n)
+{
+	ocontext_t **old = t->slots;
+	uint32_t i, oldsize = t->size, size = 16;
+
+	while (size < n * 2)
+		size <<= 1;
+	t->slots = calloc(size, sizeof(ocontext_t *));
+	if (!t->slots) {
+		t->slots = old;
+		return -1;
+	}
+	t->size = size;
+	t->count = 0;
+	for (i = 0; i < oldsize; i++)
+		if (old[i])
+			table_put(t, kind, old[i], 0);
+	free(old);
+	return 0;
+}
+
+static int table_build(struct key_table *t, int kind, ocontext_t * head)
+{
+	ocontext_t *c;
+	uint32_t n = 0;
+
+	table_drop(t);
+	for (c = head; c; c = c->next)
+		n++;
+	if (table_resize(t, kind, n) < 0)
+		return -1;
+	for (c = head; c; c = c->next)
+		table_put(t, kind, c, 0);	/* an earlier entry wins */
+	t->head = head;
+	return 0;
+}
+
+ocontext_t hidden *ocon_keys_find(policydb_t * p, int which,
+				  const ocontext_t * key)
+{
+	struct key_table *t;
+	ocontext_t *c, *head = p->ocontexts[which];
+	int kind = key_kind(which);
+	uint32_t h;
+
+	if (!p->ocon_keys)
+		p->ocon_keys = calloc(1, sizeof(struct ocon_keys));
+	if (!p->ocon_keys)
+		goto walk;
+	t = &p->ocon_keys->t[kind];
+	if ((!t->size || t->head != head) && table_build(t, kind, head) < 0)
+		goto walk;
+
+	h = key_hash(kind, key) & (t->size - 1);
+	while (t->slots[h]) {
+		if (key_equal(kind, t->slots[h], key))
+			return t->slots[h];
+		h = (h + 1) & (t->size - 1);
+	}
+	return NULL;
+
+      walk:
+	for (c = head; c; c = c->next)
+		if (key_equal(kind, c, key))
+			return c;
+	return NULL;
+}
+
+void hidden ocon_keys_prepend(policydb_t * p, int which, ocontext_t * c)
+{
+	struct key_table *t;
+	int kind = key_kind(which);
+
+	c->next = p->ocontexts[which];
+	p->ocontexts[which] = c;
+
+	if (!p->ocon_keys)
+		return;
+	t = &p->ocon_keys->t[kind];
+	if (!t->size)
+		return;
+	if (t->head != c->next) {
+		/* Already stale; rebuilt when next used */
+		table_drop(t);
+		return;
+	}
+	if ((t->count + 1) * 2 > t->size &&
+	    table_resize(t, kind, t->count + 1) < 0) {
+		table_drop(t);
+		return;
+	}
+	table_put(t, kind, c, 1);
+	t->head = c;
+}
+
+void hidden ocon_keys_destroy(struct ocon_keys *keys)
+{
+	int i;
+
+	if (!keys)
+		return;
+	for (i = 0; i < KEY_NUM; i++)
+		free(keys->t[i].slots);
+	free(keys);
+}
@@ -0,0 +1,27 @@
+#ifndef _SEPOL_INTERNAL_OCON_KEYS_H_
+#define _SEPOL_INTERNAL_OCON_KEYS_H_
+
+#include <sepol/policydb/policydb.h>
+#include "dso.h"
+
+/*
+ * Exact-key lookups of port (protocol, low, high) and node (address,
+ * mask) ocontexts, as done by the record interfaces in ports.c and
+ * nodes.c.  The tables are built on first use and kept in the policydb;
+ * they follow entries added with ocon_keys_prepend(), and are rebuilt
+ * if the list is changed any other way.  Every lookup returns the first
+ * entry with the key, as a walk of the list would.
+ */
+struct ocon_keys;
+
+/* 'which' is OCON_PORT, OCON_NODE or OCON_NODE6.  Only the key fields
+ * of 'key' are used. */
+extern ocontext_t *ocon_keys_find(policydb_t * p, int which,
+				  const ocontext_t * key);
+
+/* Put 'c' at the head of the list 'which' of 'p'. */
+extern void ocon_keys_prepend(policydb_t * p, int which, ocontext_t * c);
+
+extern void ocon_keys_destroy(struct ocon_keys *keys);
+
+#endif
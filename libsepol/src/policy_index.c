@@ -0,0 +1,576 @@
+/*
+ * Policy index: a compact summary of a kernel policy that can be
+ * mapped and searched without reading the policy itself.
+ *
+ * The file is a header followed by arrays of 32-bit values in host
+ * byte order; a policy index is written and read on the same machine,
+ * and one of the wrong byte order is rejected by its magic number.
+ * All offsets are in bytes from the start of the file.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <sepol/policydb/policydb.h>
+#include <sepol/policydb/avtab.h>
+#include <sepol/policydb/conditional.h>
+#include <sepol/policy_index.h>
+
+#include "debug.h"
+
+#define INDEX_MAGIC	0x5e9011d8
+#define INDEX_VERSION	1
+#define INDEX_KINDS	3
+
+struct index_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;			/* of the whole file */
+	uint32_t count[INDEX_KINDS];	/* symbols of each kind */
+	uint32_t syms[INDEX_KINDS];	/* struct index_sym[count] */
+	uint32_t sorted[INDEX_KINDS];	/* values, sorted by name */
+	uint32_t nperms;
+	uint32_t perms;			/* name of each class permission */
+	uint32_t nrules;
+	uint32_t rules;			/* sorted by source, target, class */
+	uint32_t rule_start;		/* first rule of each source type */
+	uint32_t strings;
+	uint32_t strings_len;
+};
+
+/*
+ * For a type, 'data' is 1 for an attribute.  For a class, the names of
+ * its 'count' permissions start at perms['data'].  For a boolean, 'data'
+ * is its default state.
+ */
+struct index_sym {
+	uint32_t name;
+	uint32_t data;
+	uint32_t count;
+};
+
+struct sepol_policy_index {
+	const char *map;
+	size_t size;
+	const struct index_header *hdr;
+};
+
+/* Writing */
+
+struct index_buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static int buf_add(struct index_buf *b, const void *data, size_t len,
+		   uint32_t * off)
+{
+	char *tmp;
+	size_t size = b->size ? b->size : 4096;
+
+	while (size < b->len + len + 1)
+		size *= 2;
+	if (size != b->size) {
+		tmp = realloc(b->data, size);
+		if (!tmp)
+			return -1;
+		b->data = tmp;
+		b->size = size;
+	}
+	if (b->len + len > UINT32_MAX)
+		return -1;
+	if (len)
+		memcpy(b->data + b->len, data, len);
+	if (off)
+		*off = b->len;
+	b->len += len;
+	return 0;
+}
+
+static int add_string(struct index_buf *strings, const char *s, uint32_t * off)
+{
+	return buf_add(strings, s, strlen(s) + 1, off);
+}
+
+struct name_value {
+	const char *name;
+	uint32_t value;
+};
+
+static int name_value_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct name_value *)a)->name,
+		      ((const struct name_value *)b)->name);
+}
+
+/* Fill in the symbols of one kind and their values sorted by name. */
+static int add_symbols(struct index_buf *strings, char **names, uint32_t n,
+		       struct index_sym *syms, uint32_t * sorted)
+{
+	struct name_value *nv;
+	uint32_t i;
+
+	nv = calloc(n ? n : 1, sizeof(*nv));
+	if (!nv)
+		return -1;
+	for (i = 0; i < n; i++) {
+		nv[i].name = names[i] ? names[i] : "";
+		nv[i].value = i + 1;
+		if (add_string(strings, nv[i].name, &syms[i].name) < 0) {
+			free(nv);
+			return -1;
+		}
+	}
+	qsort(nv, n, sizeof(*nv), name_value_cmp);
+	for (i = 0; i < n; i++)
+		sorted[i] = nv[i].value;
+	free(nv);
+	return 0;
+}
+
+struct perm_args {
+	struct index_buf *strings;
+	uint32_t *names;
+	uint32_t nprim;
+};
+
+static int add_perm(hashtab_key_t key, hashtab_datum_t datum, void *data)
+{
+	struct perm_args *args = data;
+	perm_datum_t *perm = datum;
+
+	if (perm->s.value == 0 || perm->s.value > args->nprim)
+		return 0;
+	return add_string(args->strings, key,
+			  &args->names[perm->s.value - 1]);
+}
+
+struct rule_args {
+	struct sepol_index_rule *rules;
+	uint32_t nrules;
+	uint32_t flags;
+};
+
+static int add_rule(avtab_key_t * key, avtab_datum_t * datum, void *data)
+{
+	struct rule_args *args = data;
+	struct sepol_index_rule *r = &args->rules[args->nrules++];
+
+	r->source = key->source_type;
+	r->target = key->target_type;
+	r->tclass = key->target_class;
+	r->specified = key->specified & (AVTAB_AV | AVTAB_TYPE);
+	r->data = datum->data;
+	r->flags = args->flags;
+	if ((args->flags & SEPOL_INDEX_COND) && (key->specified & AVTAB_ENABLED))
+		r->flags |= SEPOL_INDEX_ENABLED;
+	return 0;
+}
+
+static int rule_cmp(const void *a, const void *b)
+{
+	const struct sepol_index_rule *x = a, *y = b;
+
+	if (x->source != y->source)
+		return x->source < y->source ? -1 : 1;
+	if (x->target != y->target)
+		return x->target < y->target ? -1 : 1;
+	if (x->tclass != y->tclass)
+		return x->tclass < y->tclass ? -1 : 1;
+	if (x->specified != y->specified)
+		return x->specified < y->specified ? -1 : 1;
+	return 0;
+}
+
+int sepol_policy_index_write(sepol_handle_t * handle,
+			     const sepol_policydb_t * sp, FILE * fp)
+{
+	const policydb_t *p = &sp->p;
+	struct index_header hdr;
+	struct index_sym *syms[INDEX_KINDS] = { NULL, NULL, NULL };
+	uint32_t *sorted[INDEX_KINDS] = { NULL, NULL, NULL };
+	uint32_t *perms = NULL, *rule_start = NULL;
+	struct index_buf strings = { NULL, 0, 0 }, out = { NULL, 0, 0 };
+	struct rule_args rargs = { NULL, 0, 0 };
+	struct perm_args pargs;
+	class_datum_t *cladatum;
+	uint32_t i, k, n;
+	int rc = -1;
+
+	if (p->policy_type != POLICY_KERN) {
+		ERR(handle, "policy index needs a kernel policy");
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = INDEX_MAGIC;
+	hdr.version = INDEX_VERSION;
+	hdr.count[SEPOL_INDEX_TYPE] = p->p_types.nprim;
+	hdr.count[SEPOL_INDEX_CLASS] = p->p_classes.nprim;
+	hdr.count[SEPOL_INDEX_BOOL] = p->p_bools.nprim;
+
+	for (k = 0; k < INDEX_KINDS; k++) {
+		n = hdr.count[k] ? hdr.count[k] : 1;
+		syms[k] = calloc(n, sizeof(struct index_sym));
+		sorted[k] = calloc(n, sizeof(uint32_t));
+		if (!syms[k] || !sorted[k])
+			goto oom;
+	}
+	/* Offset 0 is the empty name, for permissions without one. */
+	if (add_string(&strings, "", NULL) < 0)
+		goto oom;
+	if (add_symbols(&strings, p->p_type_val_to_name,
+			hdr.count[SEPOL_INDEX_TYPE], syms[SEPOL_INDEX_TYPE],
+			sorted[SEPOL_INDEX_TYPE]) < 0 ||
+	    add_symbols(&strings, p->p_class_val_to_name,
+			hdr.count[SEPOL_INDEX_CLASS], syms[SEPOL_INDEX_CLASS],
+			sorted[SEPOL_INDEX_CLASS]) < 0 ||
+	    add_symbols(&strings, p->p_bool_val_to_name,
+			hdr.count[SEPOL_INDEX_BOOL], syms[SEPOL_INDEX_BOOL],
+			sorted[SEPOL_INDEX_BOOL]) < 0)
+		goto oom;
+
+	for (i = 0; i < hdr.count[SEPOL_INDEX_TYPE]; i++)
+		syms[SEPOL_INDEX_TYPE][i].data =
+		    p->type_val_to_struct[i] &&
+		    p->type_val_to_struct[i]->flavor == TYPE_ATTRIB;
+	for (i = 0; i < hdr.count[SEPOL_INDEX_BOOL]; i++)
+		syms[SEPOL_INDEX_BOOL][i].data =
+		    p->bool_val_to_struct[i]->state;
+
+	/* Permission names, in bit order, class after class. */
+	for (i = 0; i < hdr.count[SEPOL_INDEX_CLASS]; i++)
+		hdr.nperms += p->class_val_to_struct[i]->permissions.nprim;
+	perms = calloc(hdr.nperms ? hdr.nperms : 1, sizeof(uint32_t));
+	if (!perms)
+		goto oom;
+	for (i = 0, n = 0; i < hdr.count[SEPOL_INDEX_CLASS]; i++) {
+		cladatum = p->class_val_to_struct[i];
+		syms[SEPOL_INDEX_CLASS][i].data = n;
+		syms[SEPOL_INDEX_CLASS][i].count = cladatum->permissions.nprim;
+		pargs.strings = &strings;
+		pargs.names = perms + n;
+		pargs.nprim = cladatum->permissions.nprim;
+		if (hashtab_map(cladatum->permissions.table, add_perm, &pargs))
+			goto oom;
+		if (cladatum->comdatum &&
+		    hashtab_map(cladatum->comdatum->permissions.table,
+				add_perm, &pargs))
+			goto oom;
+		n += cladatum->permissions.nprim;
+	}
+
+	/* Rules, grouped by source type. */
+	n = p->te_avtab.nel + p->te_cond_avtab.nel;
+	rargs.rules = calloc(n ? n : 1, sizeof(struct sepol_index_rule));
+	rule_start = calloc(hdr.count[SEPOL_INDEX_TYPE] + 2, sizeof(uint32_t));
+	if (!rargs.rules || !rule_start)
+		goto oom;
+	avtab_map((avtab_t *) & p->te_avtab, add_rule, &rargs);
+	rargs.flags = SEPOL_INDEX_COND;
+	avtab_map((avtab_t *) & p->te_cond_avtab, add_rule, &rargs);
+	qsort(rargs.rules, rargs.nrules, sizeof(struct sepol_index_rule),
+	      rule_cmp);
+	hdr.nrules = rargs.nrules;
+	for (i = 0; i < rargs.nrules; i++) {
+		if (rargs.rules[i].source > hdr.count[SEPOL_INDEX_TYPE]) {
+			ERR(handle, "rule with invalid source type %u",
+			    rargs.rules[i].source);
+			goto out;
+		}
+		rule_start[rargs.rules[i].source + 1]++;
+	}
+	for (i = 1; i < hdr.count[SEPOL_INDEX_TYPE] + 2; i++)
+		rule_start[i] += rule_start[i - 1];
+
+	/* Lay out the file: header, tables, then the strings. */
+	if (buf_add(&out, &hdr, sizeof(hdr), NULL) < 0)
+		goto oom;
+	for (k = 0; k < INDEX_KINDS; k++) {
+		if (buf_add(&out, syms[k],
+			    hdr.count[k] * sizeof(struct index_sym),
+			    &hdr.syms[k]) < 0 ||
+		    buf_add(&out, sorted[k], hdr.count[k] * sizeof(uint32_t),
+			    &hdr.sorted[k]) < 0)
+			goto oom;
+	}
+	if (buf_add(&out, perms, hdr.nperms * sizeof(uint32_t),
+		    &hdr.perms) < 0 ||
+	    buf_add(&out, rargs.rules,
+		    hdr.nrules * sizeof(struct sepol_index_rule),
+		    &hdr.rules) < 0 ||
+	    buf_add(&out, rule_start,
+		    (hdr.count[SEPOL_INDEX_TYPE] + 2) * sizeof(uint32_t),
+		    &hdr.rule_start) < 0 ||
+	    buf_add(&out, strings.data, strings.len, &hdr.strings) < 0)
+		goto oom;
+	hdr.strings_len = strings.len;
+	hdr.size = out.len;
+	memcpy(out.data, &hdr, sizeof(hdr));
+
+	if (fwrite(out.data, 1, out.len, fp) != out.len) {
+		ERR(handle, "could not write policy index: %s",
+		    strerror(errno));
+		goto out;
+	}
+	rc = 0;
+	goto out;
+
+      oom:
+	ERR(handle, "out of memory");
+      out:
+	for (k = 0; k < INDEX_KINDS; k++) {
+		free(syms[k]);
+		free(sorted[k]);
+	}
+	free(perms);
+	free(rargs.rules);
+	free(rule_start);
+	free(strings.data);
+	free(out.data);
+	return rc;
+}
+
+/* Reading */
+
+static int index_range_ok(const struct index_header *hdr, uint32_t off,
+			  uint32_t n, size_t elsize)
+{
+	if (off % sizeof(uint32_t) || off < sizeof(*hdr) || off > hdr->size)
+		return 0;
+	return (uint64_t)n * elsize <= hdr->size - off;
+}
+
+static int index_check(const struct index_header *hdr, size_t size)
+{
+	const uint32_t *rule_start;
+	uint32_t k, i, ntypes;
+
+	if (size < sizeof(*hdr) || hdr->magic != INDEX_MAGIC ||
+	    hdr->version != INDEX_VERSION || hdr->size != size)
+		return -1;
+	for (k = 0; k < INDEX_KINDS; k++) {
+		if (!index_range_ok(hdr, hdr->syms[k], hdr->count[k],
+				    sizeof(struct index_sym)) ||
+		    !index_range_ok(hdr, hdr->sorted[k], hdr->count[k],
+				    sizeof(uint32_t)))
+			return -1;
+	}
+	ntypes = hdr->count[SEPOL_INDEX_TYPE];
+	if (ntypes > UINT32_MAX - 2 ||
+	    !index_range_ok(hdr, hdr->perms, hdr->nperms, sizeof(uint32_t)) ||
+	    !index_range_ok(hdr, hdr->rules, hdr->nrules,
+			    sizeof(struct sepol_index_rule)) ||
+	    !index_range_ok(hdr, hdr->rule_start, ntypes + 2,
+			    sizeof(uint32_t)) ||
+	    hdr->strings < sizeof(*hdr) || hdr->strings > hdr->size ||
+	    hdr->strings_len == 0 ||
+	    hdr->strings_len > hdr->size - hdr->strings)
+		return -1;
+	if (((const char *)hdr)[hdr->strings + hdr->strings_len - 1] != '\0')
+		return -1;
+	rule_start = (const uint32_t *)((const char *)hdr + hdr->rule_start);
+	for (i = 1; i < ntypes + 2; i++)
+		if (rule_start[i] < rule_start[i - 1])
+			return -1;
+	if (rule_start[ntypes + 1] != hdr->nrules)
+		return -1;
+	return 0;
+}
+
+int sepol_policy_index_open(const char *path, sepol_policy_index_t ** idx)
+{
+	sepol_policy_index_t *tmp;
+	struct stat sb;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &sb) < 0) {
+		close(fd);
+		return -1;
+	}
+	if ((size_t)sb.st_size < sizeof(struct index_header)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	if (index_check(map, sb.st_size) < 0) {
+		munmap(map, sb.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	tmp = malloc(sizeof(*tmp));
+	if (!tmp) {
+		munmap(map, sb.st_size);
+		return -1;
+	}
+	tmp->map = map;
+	tmp->size = sb.st_size;
+	tmp->hdr = map;
+	*idx = tmp;
+	return 0;
+}
+
+void sepol_policy_index_close(sepol_policy_index_t * idx)
+{
+	if (!idx)
+		return;
+	munmap((void *)idx->map, idx->size);
+	free(idx);
+}
+
+static const char *index_string(const sepol_policy_index_t * idx,
+				uint32_t off)
+{
+	if (off >= idx->hdr->strings_len)
+		return NULL;
+	return idx->map + idx->hdr->strings + off;
+}
+
+static const struct index_sym *index_sym(const sepol_policy_index_t * idx,
+					 int kind, uint32_t value)
+{
+	if (kind < 0 || kind >= INDEX_KINDS || value == 0 ||
+	    value > idx->hdr->count[kind])
+		return NULL;
+	return (const struct index_sym *)(idx->map + idx->hdr->syms[kind]) +
+	    value - 1;
+}
+
+uint32_t sepol_policy_index_count(const sepol_policy_index_t * idx, int kind)
+{
+	if (kind < 0 || kind >= INDEX_KINDS)
+		return 0;
+	return idx->hdr->count[kind];
+}
+
+const char *sepol_policy_index_name(const sepol_policy_index_t * idx,
+				    int kind, uint32_t value)
+{
+	const struct index_sym *sym = index_sym(idx, kind, value);
+
+	return sym ? index_string(idx, sym->name) : NULL;
+}
+
+uint32_t sepol_policy_index_value(const sepol_policy_index_t * idx,
+				  int kind, const char *name)
+{
+	const uint32_t *sorted;
+	const char *s;
+	uint32_t lo, hi, mid;
+	int cmp;
+
+	if (kind < 0 || kind >= INDEX_KINDS)
+		return 0;
+	sorted = (const uint32_t *)(idx->map + idx->hdr->sorted[kind]);
+	lo = 0;
+	hi = idx->hdr->count[kind];
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		s = sepol_policy_index_name(idx, kind, sorted[mid]);
+		if (!s)
+			return 0;
+		cmp = strcmp(name, s);
+		if (cmp == 0)
+			return sorted[mid];
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return 0;
+}
+
+int sepol_policy_index_is_attribute(const sepol_policy_index_t * idx,
+				    uint32_t value)
+{
+	const struct index_sym *sym = index_sym(idx, SEPOL_INDEX_TYPE, value);
+
+	return sym ? sym->data == 1 : 0;
+}
+
+const char *sepol_policy_index_perm(const sepol_policy_index_t * idx,
+				    uint32_t tclass, uint32_t perm)
+{
+	const struct index_sym *sym = index_sym(idx, SEPOL_INDEX_CLASS, tclass);
+	const uint32_t *perms;
+	const char *s;
+
+	if (!sym || perm == 0 || perm > sym->count ||
+	    sym->data > idx->hdr->nperms ||
+	    sym->count > idx->hdr->nperms - sym->data)
+		return NULL;
+	perms = (const uint32_t *)(idx->map + idx->hdr->perms);
+	s = index_string(idx, perms[sym->data + perm - 1]);
+	return s && *s ? s : NULL;
+}
+
+int sepol_policy_index_bool_state(const sepol_policy_index_t * idx,
+				  uint32_t value)
+{
+	const struct index_sym *sym = index_sym(idx, SEPOL_INDEX_BOOL, value);
+
+	return sym ? (int)sym->data : -1;
+}
+
+int sepol_policy_index_rules(const sepol_policy_index_t * idx,
+			     uint32_t source, uint32_t target, uint32_t tclass,
+			     int (*fn) (const struct sepol_index_rule * rule,
+					void *arg), void *arg)
+{
+	const struct sepol_index_rule *rules;
+	const uint32_t *rule_start;
+	uint32_t i, end;
+	int rc;
+
+	rules = (const struct sepol_index_rule *)(idx->map + idx->hdr->rules);
+	rule_start = (const uint32_t *)(idx->map + idx->hdr->rule_start);
+	if (source) {
+		if (source > idx->hdr->count[SEPOL_INDEX_TYPE])
+			return 0;
+		i = rule_start[source];
+		end = rule_start[source + 1];
+	} else {
+		i = 0;
+		end = idx->hdr->nrules;
+	}
+
+	for (; i < end; i++) {
+		if (target && rules[i].target != target)
+			continue;
+		if (tclass && rules[i].tclass != tclass)
+			continue;
+		rc = fn(&rules[i], arg);
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
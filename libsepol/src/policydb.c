@@ -42,6 +42,8 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <sepol/policydb/policydb.h>
 #include <sepol/policydb/expand.h>
@@ -53,6 +55,9 @@
 #include "private.h"
 #include "debug.h"
 #include "mls.h"
+#include "ocon_keys.h"
+#include "trans_keys.h"
+#include "strpool.h"
 
 #define POLICYDB_TARGET_SZ   ARRAY_SIZE(policydb_target_strings)
 char *policydb_target_strings[] = { POLICYDB_STRING, POLICYDB_XEN_STRING };
@@ -795,6 +800,19 @@ int policydb_user_cache(hashtab_key_t key
 		return -1;
 	}
 
+	return 0;
+}
+
+static int policydb_user_mls_expand(hashtab_key_t key
+				    __attribute__ ((unused)),
+				    hashtab_datum_t datum, void *arg)
+{
+	policydb_t *p;
+	user_datum_t *user;
+
+	user = (user_datum_t *) datum;
+	p = (policydb_t *) arg;
+
 	/* we do not expand user's MLS info in kernel policies because the
 	 * semantic representation is not present and we do not expand user's
 	 * MLS info in module policies because all of the necessary mls
@@ -816,6 +834,53 @@ int policydb_user_cache(hashtab_key_t key
 	return 0;
 }
 
+/*
+ * The role and user caches are built one datum at a time, when a
+ * context naming it is first checked: most contexts checked while a
+ * policy is read are object_r ones, which need neither, and many
+ * readers never check any.  The role_cached and user_cached bitmaps of
+ * the policydb record which caches are current.  A policy installed for
+ * the security services has them all built by policydb_fill_caches()
+ * first, so that checks made through several services handles only
+ * read them.
+ */
+ebitmap_t hidden *policydb_role_types(policydb_t * p, role_datum_t * role)
+{
+	if (ebitmap_get_bit(&p->role_cached, role->s.value - 1))
+		return &role->cache;
+	if (policydb_role_cache(NULL, role, p) ||
+	    ebitmap_set_bit(&p->role_cached, role->s.value - 1, 1))
+		return NULL;
+	return &role->cache;
+}
+
+ebitmap_t hidden *policydb_user_roles(policydb_t * p, user_datum_t * user)
+{
+	if (ebitmap_get_bit(&p->user_cached, user->s.value - 1))
+		return &user->cache;
+	if (policydb_user_cache(NULL, user, p) ||
+	    ebitmap_set_bit(&p->user_cached, user->s.value - 1, 1))
+		return NULL;
+	return &user->cache;
+}
+
+int hidden policydb_fill_caches(policydb_t * p)
+{
+	uint32_t i;
+
+	for (i = 0; i < p->p_roles.nprim; i++) {
+		if (p->role_val_to_struct[i] &&
+		    !policydb_role_types(p, p->role_val_to_struct[i]))
+			return -1;
+	}
+	for (i = 0; i < p->p_users.nprim; i++) {
+		if (p->user_val_to_struct[i] &&
+		    !policydb_user_roles(p, p->user_val_to_struct[i]))
+			return -1;
+	}
+	return 0;
+}
+
 /*
  * The following *_index functions are used to
  * define the val_to_name and val_to_struct arrays
@@ -1085,11 +1150,11 @@ int policydb_index_others(sepol_handle_t * handle,
 		}
 	}
 
-	/* This pre-expands the roles and users for context validity checking */
-	if (hashtab_map(p->p_roles.table, policydb_role_cache, p))
-		return -1;
+	/* The role and user caches are built on demand from now on */
+	ebitmap_destroy(&p->role_cached);
+	ebitmap_destroy(&p->user_cached);
 
-	if (hashtab_map(p->p_users.table, policydb_user_cache, p))
+	if (hashtab_map(p->p_users.table, policydb_user_mls_expand, p))
 		return -1;
 
 	return 0;
@@ -1101,43 +1166,37 @@ int policydb_index_others(sepol_handle_t * handle,
  * symbol data in the policy database.
  */
 
-static int perm_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
-			__attribute__ ((unused)))
+static int perm_destroy(hashtab_key_t key, hashtab_datum_t datum, void *pool)
 {
-	if (key)
-		free(key);
+	strpool_free(pool, key);
 	free(datum);
 	return 0;
 }
 
-static int common_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
-			  __attribute__ ((unused)))
+static int common_destroy(hashtab_key_t key, hashtab_datum_t datum, void *pool)
 {
 	common_datum_t *comdatum;
 
-	if (key)
-		free(key);
+	strpool_free(pool, key);
 	comdatum = (common_datum_t *) datum;
-	(void)hashtab_map(comdatum->permissions.table, perm_destroy, 0);
+	(void)hashtab_map(comdatum->permissions.table, perm_destroy, pool);
 	hashtab_destroy(comdatum->permissions.table);
 	free(datum);
 	return 0;
 }
 
-static int class_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
-			 __attribute__ ((unused)))
+static int class_destroy(hashtab_key_t key, hashtab_datum_t datum, void *pool)
 {
 	class_datum_t *cladatum;
 	constraint_node_t *constraint, *ctemp;
 	constraint_expr_t *e, *etmp;
 
-	if (key)
-		free(key);
+	strpool_free(pool, key);
 	cladatum = (class_datum_t *) datum;
 	if (cladatum == NULL) {
 		return 0;
 	}
-	(void)hashtab_map(cladatum->permissions.table, perm_destroy, 0);
+	(void)hashtab_map(cladatum->permissions.table, perm_destroy, pool);
 	hashtab_destroy(cladatum->permissions.table);
 	constraint = cladatum->constraints;
 	while (constraint) {
@@ -1149,6 +1208,7 @@ static int class_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
 		}
 		ctemp = constraint;
 		constraint = constraint->next;
+		free(ctemp->prog);
 		free(ctemp);
 	}
 
@@ -1162,6 +1222,7 @@ static int class_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
 		}
 		ctemp = constraint;
 		constraint = constraint->next;
+		free(ctemp->prog);
 		free(ctemp);
 	}
 
@@ -1171,40 +1232,35 @@ static int class_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
 	return 0;
 }
 
-static int role_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
-			__attribute__ ((unused)))
+static int role_destroy(hashtab_key_t key, hashtab_datum_t datum, void *pool)
 {
-	free(key);
+	strpool_free(pool, key);
 	role_datum_destroy((role_datum_t *) datum);
 	free(datum);
 	return 0;
 }
 
-static int type_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
-			__attribute__ ((unused)))
+static int type_destroy(hashtab_key_t key, hashtab_datum_t datum, void *pool)
 {
-	free(key);
+	strpool_free(pool, key);
 	type_datum_destroy((type_datum_t *) datum);
 	free(datum);
 	return 0;
 }
 
-static int user_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
-			__attribute__ ((unused)))
+static int user_destroy(hashtab_key_t key, hashtab_datum_t datum, void *pool)
 {
-	free(key);
+	strpool_free(pool, key);
 	user_datum_destroy((user_datum_t *) datum);
 	free(datum);
 	return 0;
 }
 
-static int sens_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
-			__attribute__ ((unused)))
+static int sens_destroy(hashtab_key_t key, hashtab_datum_t datum, void *pool)
 {
 	level_datum_t *levdatum;
 
-	if (key)
-		free(key);
+	strpool_free(pool, key);
 	levdatum = (level_datum_t *) datum;
 	mls_level_destroy(levdatum->level);
 	free(levdatum->level);
@@ -1213,11 +1269,9 @@ static int sens_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
 	return 0;
 }
 
-static int cat_destroy(hashtab_key_t key, hashtab_datum_t datum, void *p
-		       __attribute__ ((unused)))
+static int cat_destroy(hashtab_key_t key, hashtab_datum_t datum, void *pool)
 {
-	if (key)
-		free(key);
+	strpool_free(pool, key);
 	cat_datum_destroy((cat_datum_t *) datum);
 	free(datum);
 	return 0;
@@ -1287,7 +1341,10 @@ void policydb_destroy(policydb_t * p)
 
 	ebitmap_destroy(&p->permissive_map);
 
-	symtabs_destroy(p->symtab);
+	for (i = 0; i < SYM_NUM; i++) {
+		(void)hashtab_map(p->symtab[i].table, destroy_f[i], p->strpool);
+		hashtab_destroy(p->symtab[i].table);
+	}
 
 	for (i = 0; i < SYM_NUM; i++) {
 		if (p->sym_val_to_name[i])
@@ -1318,6 +1375,8 @@ void policydb_destroy(policydb_t * p)
 		ocontext_selinux_free(p->ocontexts);
 	else if (p->target_platform == SEPOL_TARGET_XEN)
 		ocontext_xen_free(p->ocontexts);
+	ocon_keys_destroy(p->ocon_keys);
+	trans_keys_destroy(p->trans_keys);
 
 	g = p->genfs;
 	while (g) {
@@ -1388,6 +1447,13 @@ void policydb_destroy(policydb_t * p)
 		free(p->attr_type_map);
 	}
 
+	ebitmap_destroy(&p->role_cached);
+	ebitmap_destroy(&p->user_cached);
+
+	/* last, as the symbol tables above hold names from it */
+	strpool_put(p->strpool);
+	p->strpool = NULL;
+
 	return;
 }
 
@@ -1872,14 +1938,59 @@ static int context_read_and_validate(context_struct_t * c,
 	return 0;
 }
 
+/*
+ * Names in the global symbol tables of a policydb, and the permissions
+ * of their classes and commons, are kept in its string pool.  Those of
+ * the scoped declarations are malloc'ed, since symtabs_destroy() frees
+ * them without knowing the pool.
+ */
+struct strpool hidden *symtab_pool(policydb_t * p, hashtab_t h)
+{
+	unsigned int i;
+
+	for (i = 0; i < SYM_NUM; i++)
+		if (p->symtab[i].table == h)
+			return p->strpool;
+	return NULL;
+}
+
+char hidden *symtab_name_read(struct strpool *pool, struct policy_file *fp,
+			      size_t len)
+{
+	char sbuf[256], *buf = sbuf, *name;
+
+	if (!pool) {
+		name = malloc(len + 1);
+		if (!name)
+			return NULL;
+		if (next_entry(name, fp, len) < 0) {
+			free(name);
+			return NULL;
+		}
+		name[len] = '\0';
+		return name;
+	}
+
+	if (len > sizeof(sbuf)) {
+		buf = malloc(len);
+		if (!buf)
+			return NULL;
+	}
+	name = NULL;
+	if (next_entry(buf, fp, len) == 0)
+		name = strpool_intern(pool, buf, len);
+	if (buf != sbuf)
+		free(buf);
+	return name;
+}
+
 /*
  * The following *_read functions are used to
  * read the symbol data from a policy database
  * binary representation file.
  */
 
-static int perm_read(policydb_t * p
-		     __attribute__ ((unused)), hashtab_t h,
+static int perm_read(struct strpool *pool, hashtab_t h,
 		     struct policy_file *fp)
 {
 	char *key = 0;
@@ -1899,13 +2010,9 @@ static int perm_read(policydb_t * p
 	len = le32_to_cpu(buf[0]);
 	perdatum->s.value = le32_to_cpu(buf[1]);
 
-	key = malloc(len + 1);
+	key = symtab_name_read(pool, fp, len);
 	if (!key)
 		goto bad;
-	rc = next_entry(key, fp, len);
-	if (rc < 0)
-		goto bad;
-	key[len] = 0;
 
 	if (hashtab_insert(h, key, perdatum))
 		goto bad;
@@ -1913,13 +2020,14 @@ static int perm_read(policydb_t * p
 	return 0;
 
       bad:
-	perm_destroy(key, perdatum, NULL);
+	perm_destroy(key, perdatum, pool);
 	return -1;
 }
 
 static int common_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 {
 	char *key = 0;
+	struct strpool *pool = symtab_pool(p, h);
 	common_datum_t *comdatum;
 	uint32_t buf[4];
 	size_t len, nel;
@@ -1942,16 +2050,12 @@ static int common_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 	comdatum->permissions.nprim = le32_to_cpu(buf[2]);
 	nel = le32_to_cpu(buf[3]);
 
-	key = malloc(len + 1);
+	key = symtab_name_read(pool, fp, len);
 	if (!key)
 		goto bad;
-	rc = next_entry(key, fp, len);
-	if (rc < 0)
-		goto bad;
-	key[len] = 0;
 
 	for (i = 0; i < nel; i++) {
-		if (perm_read(p, comdatum->permissions.table, fp))
+		if (perm_read(pool, comdatum->permissions.table, fp))
 			goto bad;
 	}
 
@@ -1961,7 +2065,7 @@ static int common_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 	return 0;
 
       bad:
-	common_destroy(key, comdatum, NULL);
+	common_destroy(key, comdatum, pool);
 	return -1;
 }
 
@@ -2063,6 +2167,7 @@ static int read_cons_helper(policydb_t * p, constraint_node_t ** nodep,
 static int class_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 {
 	char *key = 0;
+	struct strpool *pool = symtab_pool(p, h);
 	class_datum_t *cladatum;
 	uint32_t buf[6];
 	size_t len, len2, ncons, nel;
@@ -2088,13 +2193,9 @@ static int class_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 
 	ncons = le32_to_cpu(buf[5]);
 
-	key = malloc(len + 1);
+	key = symtab_name_read(pool, fp, len);
 	if (!key)
 		goto bad;
-	rc = next_entry(key, fp, len);
-	if (rc < 0)
-		goto bad;
-	key[len] = 0;
 
 	if (len2) {
 		cladatum->comkey = malloc(len2 + 1);
@@ -2113,7 +2214,7 @@ static int class_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 		}
 	}
 	for (i = 0; i < nel; i++) {
-		if (perm_read(p, cladatum->permissions.table, fp))
+		if (perm_read(pool, cladatum->permissions.table, fp))
 			goto bad;
 	}
 
@@ -2161,15 +2262,14 @@ static int class_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 	return 0;
 
       bad:
-	class_destroy(key, cladatum, NULL);
+	class_destroy(key, cladatum, pool);
 	return -1;
 }
 
-static int role_read(policydb_t * p
-		     __attribute__ ((unused)), hashtab_t h,
-		     struct policy_file *fp)
+static int role_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 {
 	char *key = 0;
+	struct strpool *pool = symtab_pool(p, h);
 	role_datum_t *role;
 	uint32_t buf[3];
 	size_t len;
@@ -2191,13 +2291,9 @@ static int role_read(policydb_t * p
 	if (policydb_has_boundary_feature(p))
 		role->bounds = le32_to_cpu(buf[2]);
 
-	key = malloc(len + 1);
+	key = symtab_name_read(pool, fp, len);
 	if (!key)
 		goto bad;
-	rc = next_entry(key, fp, len);
-	if (rc < 0)
-		goto bad;
-	key[len] = 0;
 
 	if (ebitmap_read(&role->dominates, fp))
 		goto bad;
@@ -2226,10 +2322,10 @@ static int role_read(policydb_t * p
 		if (role->s.value != OBJECT_R_VAL) {
 			ERR(fp->handle, "role %s has wrong value %d",
 			    OBJECT_R, role->s.value);
-			role_destroy(key, role, NULL);
+			role_destroy(key, role, pool);
 			return -1;
 		}
-		role_destroy(key, role, NULL);
+		role_destroy(key, role, pool);
 		return 0;
 	}
 
@@ -2239,15 +2335,14 @@ static int role_read(policydb_t * p
 	return 0;
 
       bad:
-	role_destroy(key, role, NULL);
+	role_destroy(key, role, pool);
 	return -1;
 }
 
-static int type_read(policydb_t * p
-		     __attribute__ ((unused)), hashtab_t h,
-		     struct policy_file *fp)
+static int type_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 {
 	char *key = 0;
+	struct strpool *pool = symtab_pool(p, h);
 	type_datum_t *typdatum;
 	uint32_t buf[5];
 	size_t len;
@@ -2317,13 +2412,9 @@ static int type_read(policydb_t * p
 			goto bad;
 	}
 
-	key = malloc(len + 1);
+	key = symtab_name_read(pool, fp, len);
 	if (!key)
 		goto bad;
-	rc = next_entry(key, fp, len);
-	if (rc < 0)
-		goto bad;
-	key[len] = 0;
 
 	if (hashtab_insert(h, key, typdatum))
 		goto bad;
@@ -2331,7 +2422,7 @@ static int type_read(policydb_t * p
 	return 0;
 
       bad:
-	type_destroy(key, typdatum, NULL);
+	type_destroy(key, typdatum, pool);
 	return -1;
 }
 
@@ -2823,6 +2914,7 @@ static int mls_read_level(mls_level_t * lp, struct policy_file *fp)
 static int user_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 {
 	char *key = 0;
+	struct strpool *pool = symtab_pool(p, h);
 	user_datum_t *usrdatum;
 	uint32_t buf[3];
 	size_t len;
@@ -2844,13 +2936,9 @@ static int user_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 	if (policydb_has_boundary_feature(p))
 		usrdatum->bounds = le32_to_cpu(buf[2]);
 
-	key = malloc(len + 1);
+	key = symtab_name_read(pool, fp, len);
 	if (!key)
 		goto bad;
-	rc = next_entry(key, fp, len);
-	if (rc < 0)
-		goto bad;
-	key[len] = 0;
 
 	if (p->policy_type == POLICY_KERN) {
 		if (ebitmap_read(&usrdatum->roles.roles, fp))
@@ -2900,15 +2988,14 @@ static int user_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 	return 0;
 
       bad:
-	user_destroy(key, usrdatum, NULL);
+	user_destroy(key, usrdatum, pool);
 	return -1;
 }
 
-static int sens_read(policydb_t * p
-		     __attribute__ ((unused)), hashtab_t h,
-		     struct policy_file *fp)
+static int sens_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 {
 	char *key = 0;
+	struct strpool *pool = symtab_pool(p, h);
 	level_datum_t *levdatum;
 	uint32_t buf[2], len;
 	int rc;
@@ -2925,13 +3012,9 @@ static int sens_read(policydb_t * p
 	len = le32_to_cpu(buf[0]);
 	levdatum->isalias = le32_to_cpu(buf[1]);
 
-	key = malloc(len + 1);
+	key = symtab_name_read(pool, fp, len);
 	if (!key)
 		goto bad;
-	rc = next_entry(key, fp, len);
-	if (rc < 0)
-		goto bad;
-	key[len] = 0;
 
 	levdatum->level = malloc(sizeof(mls_level_t));
 	if (!levdatum->level || mls_read_level(levdatum->level, fp))
@@ -2943,15 +3026,14 @@ static int sens_read(policydb_t * p
 	return 0;
 
       bad:
-	sens_destroy(key, levdatum, NULL);
+	sens_destroy(key, levdatum, pool);
 	return -1;
 }
 
-static int cat_read(policydb_t * p
-		    __attribute__ ((unused)), hashtab_t h,
-		    struct policy_file *fp)
+static int cat_read(policydb_t * p, hashtab_t h, struct policy_file *fp)
 {
 	char *key = 0;
+	struct strpool *pool = symtab_pool(p, h);
 	cat_datum_t *catdatum;
 	uint32_t buf[3], len;
 	int rc;
@@ -2969,13 +3051,9 @@ static int cat_read(policydb_t * p
 	catdatum->s.value = le32_to_cpu(buf[1]);
 	catdatum->isalias = le32_to_cpu(buf[2]);
 
-	key = malloc(len + 1);
+	key = symtab_name_read(pool, fp, len);
 	if (!key)
 		goto bad;
-	rc = next_entry(key, fp, len);
-	if (rc < 0)
-		goto bad;
-	key[len] = 0;
 
 	if (hashtab_insert(h, key, catdatum))
 		goto bad;
@@ -2983,7 +3061,7 @@ static int cat_read(policydb_t * p
 	return 0;
 
       bad:
-	cat_destroy(key, catdatum, NULL);
+	cat_destroy(key, catdatum, pool);
 	return -1;
 }
 
@@ -3593,10 +3671,12 @@ static int scope_read(policydb_t * p, int symnum, struct policy_file *fp)
 }
 
 /*
- * Read the configuration data from a policy database binary
- * representation file into a policy database structure.
+ * With 'bools' set, only read a kernel policy up to the end of its
+ * symbol tables, and point *bools at the first entry of the boolean
+ * table if it has one.
  */
-int policydb_read(policydb_t * p, struct policy_file *fp, unsigned verbose)
+static int policydb_read_file(policydb_t * p, struct policy_file *fp,
+			      unsigned verbose, char **bools)
 {
 
 	unsigned int i, j, r_policyvers;
@@ -3797,12 +3877,18 @@ int policydb_read(policydb_t * p, struct policy_file *fp, unsigned verbose)
 			goto bad;
 	}
 
+	/* without a pool the names are malloc'ed one by one */
+	if (!p->strpool)
+		p->strpool = strpool_create();
+
 	for (i = 0; i < info->sym_num; i++) {
 		rc = next_entry(buf, fp, sizeof(uint32_t) * 2);
 		if (rc < 0)
 			goto bad;
 		nprim = le32_to_cpu(buf[0]);
 		nel = le32_to_cpu(buf[1]);
+		if (bools && i == SYM_BOOLS)
+			*bools = fp->data;
 		for (j = 0; j < nel; j++) {
 			if (read_f[i] (p, p->symtab[i].table, fp))
 				goto bad;
@@ -3811,6 +3897,10 @@ int policydb_read(policydb_t * p, struct policy_file *fp, unsigned verbose)
 		p->symtab[i].nprim = nprim;
 	}
 
+	if (bools)
+		return policy_type == POLICY_KERN ?
+		    POLICYDB_SUCCESS : POLICYDB_ERROR;
+
 	if (policy_type == POLICY_KERN) {
 		if (avtab_read(&p->te_avtab, fp, r_policyvers))
 			goto bad;
@@ -3884,10 +3974,9 @@ int policydb_read(policydb_t * p, struct policy_file *fp, unsigned verbose)
 			if (r_policyvers >= POLICYDB_VERSION_AVTAB) {
 				if (ebitmap_read(&p->type_attr_map[i], fp))
 					goto bad;
-				ebitmap_for_each_bit(&p->type_attr_map[i],
-						     tnode, j) {
-					if (!ebitmap_node_get_bit(tnode, j)
-					    || i == j)
+				ebitmap_for_each_positive_bit(&p->type_attr_map[i],
+							      tnode, j) {
+					if (i == j)
 						continue;
 					if (ebitmap_set_bit
 					    (&p->attr_type_map[j], i, 1))
@@ -3905,6 +3994,70 @@ int policydb_read(policydb_t * p, struct policy_file *fp, unsigned verbose)
 	return POLICYDB_ERROR;
 }
 
+/*
+ * Reading through stdio costs a locked fread() for every field.  When
+ * the stream is a regular file, map it and parse the mapping instead.
+ */
+static int policy_file_map(struct policy_file *fp, struct policy_file *mfp,
+			   void **map, size_t *maplen)
+{
+	struct stat sb;
+	off_t pos;
+	int fd;
+
+	if (fp->type != PF_USE_STDIO || !fp->fp)
+		return -1;
+	fd = fileno(fp->fp);
+	if (fd < 0 || fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode))
+		return -1;
+	pos = ftello(fp->fp);
+	if (pos < 0 || pos >= sb.st_size)
+		return -1;
+	*map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (*map == MAP_FAILED)
+		return -1;
+	*maplen = sb.st_size;
+
+	*mfp = *fp;
+	mfp->type = PF_USE_MEMORY;
+	mfp->fp = NULL;
+	mfp->data = (char *)*map + pos;
+	mfp->len = mfp->size = sb.st_size - pos;
+	return 0;
+}
+
+/*
+ * Read the configuration data from a policy database binary
+ * representation file into a policy database structure.
+ * A mapped stream is left positioned just past the data read,
+ * as it would be had it been read through stdio.
+ */
+int policydb_read(policydb_t * p, struct policy_file *fp, unsigned verbose)
+{
+	struct policy_file mfp;
+	void *map;
+	size_t maplen;
+	int rc;
+
+	if (policy_file_map(fp, &mfp, &map, &maplen) < 0)
+		return policydb_read_file(p, fp, verbose, NULL);
+
+	rc = policydb_read_file(p, &mfp, verbose, NULL);
+	if (fseeko(fp->fp, mfp.data - (char *)map, SEEK_SET) < 0)
+		rc = POLICYDB_ERROR;
+	munmap(map, maplen);
+	return rc;
+}
+
+int hidden policydb_read_symtabs(policydb_t * p, struct policy_file *fp,
+				 char **bools)
+{
+	*bools = NULL;
+	if (fp->type != PF_USE_MEMORY)
+		return POLICYDB_ERROR;
+	return policydb_read_file(p, fp, 0, bools);
+}
+
 int policydb_reindex_users(policydb_t * p)
 {
 	unsigned int i = SYM_USERS;
@@ -3927,8 +4080,10 @@ int policydb_reindex_users(policydb_t * p)
 	if (hashtab_map(p->symtab[i].table, index_f[i], p))
 		return -1;
 
-	/* Expand user roles for context validity checking */
-	if (hashtab_map(p->p_users.table, policydb_user_cache, p))
+	/* User roles are expanded again on demand */
+	ebitmap_destroy(&p->user_cached);
+
+	if (hashtab_map(p->p_users.table, policydb_user_mls_expand, p))
 		return -1;
 
 	return 0;
@@ -40,33 +40,25 @@ int policydb_to_image(sepol_handle_t * handle,
 	policy_file_t pf;
 	struct policydb tmp_policydb;
 
-	/* Compute the length for the new policy image. */
+	/* Write out the new policy image, growing the buffer as needed. */
 	policy_file_init(&pf);
-	pf.type = PF_LEN;
+	pf.type = PF_USE_GROWBUF;
 	pf.handle = handle;
 	if (policydb_write(policydb, &pf)) {
-		ERR(handle, "could not compute policy length");
+		ERR(handle, "could not write policy");
 		errno = EINVAL;
+		tmp_data = pf.data;
 		goto err;
 	}
 
-	/* Allocate the new policy image. */
-	pf.type = PF_USE_MEMORY;
-	pf.data = malloc(pf.len);
-	if (!pf.data) {
-		ERR(handle, "out of memory");
-		goto err;
-	}
-
-	/* Need to save len and data prior to modification by policydb_write. */
+	/* Need to save len and data prior to modification by policydb_read. */
 	tmp_len = pf.len;
 	tmp_data = pf.data;
-
-	/* Write out the new policy image. */
-	if (policydb_write(policydb, &pf)) {
-		ERR(handle, "could not write policy");
-		errno = EINVAL;
-		goto err;
+	if (tmp_len && tmp_len < pf.size) {
+		/* give back the slack, keeping the buffer if that fails */
+		void *shrunk = realloc(tmp_data, tmp_len);
+		if (shrunk)
+			tmp_data = shrunk;
 	}
 
 	/* Verify the new policy image. */
@@ -1,5 +1,6 @@
 #include <netinet/in.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "debug.h"
 #include "context.h"
@@ -7,6 +8,7 @@
 
 #include <sepol/policydb/policydb.h>
 #include "port_internal.h"
+#include "ocon_keys.h"
 
 static inline int sepol2ipproto(sepol_handle_t * handle, int proto)
 {
@@ -139,6 +141,21 @@ static int port_to_record(sepol_handle_t * handle,
 	return STATUS_ERR;
 }
 
+/* Find the first port with the given range; the key index is
+ * a cache, so it may be built even for a const policy. */
+static ocontext_t *port_find(const policydb_t * policydb,
+			     int low, int high, int proto)
+{
+
+	ocontext_t key;
+
+	memset(&key, 0, sizeof(key));
+	key.u.port.protocol = proto;
+	key.u.port.low_port = low;
+	key.u.port.high_port = high;
+	return ocon_keys_find((policydb_t *) policydb, OCON_PORT, &key);
+}
+
 /* Return the number of ports */
 extern int sepol_port_count(sepol_handle_t * handle __attribute__ ((unused)),
 			    const sepol_policydb_t * p, unsigned int *response)
@@ -165,7 +182,6 @@ int sepol_port_exists(sepol_handle_t * handle,
 {
 
 	const policydb_t *policydb = &p->p;
-	ocontext_t *c, *head;
 
 	int low, high, proto;
 	const char *proto_str;
@@ -175,19 +191,7 @@ int sepol_port_exists(sepol_handle_t * handle,
 	if (proto < 0)
 		goto err;
 
-	head = policydb->ocontexts[OCON_PORT];
-	for (c = head; c; c = c->next) {
-		int proto2 = c->u.port.protocol;
-		int low2 = c->u.port.low_port;
-		int high2 = c->u.port.high_port;
-
-		if (proto == proto2 && low2 == low && high2 == high) {
-			*response = 1;
-			return STATUS_SUCCESS;
-		}
-	}
-
-	*response = 0;
+	*response = port_find(policydb, low, high, proto) != NULL;
 	return STATUS_SUCCESS;
 
       err:
@@ -203,7 +207,7 @@ int sepol_port_query(sepol_handle_t * handle,
 {
 
 	const policydb_t *policydb = &p->p;
-	ocontext_t *c, *head;
+	ocontext_t *c;
 
 	int low, high, proto;
 	const char *proto_str;
@@ -213,17 +217,11 @@ int sepol_port_query(sepol_handle_t * handle,
 	if (proto < 0)
 		goto err;
 
-	head = policydb->ocontexts[OCON_PORT];
-	for (c = head; c; c = c->next) {
-		int proto2 = c->u.port.protocol;
-		int low2 = c->u.port.low_port;
-		int high2 = c->u.port.high_port;
-
-		if (proto == proto2 && low2 == low && high2 == high) {
-			if (port_to_record(handle, policydb, c, response) < 0)
-				goto err;
-			return STATUS_SUCCESS;
-		}
+	c = port_find(policydb, low, high, proto);
+	if (c) {
+		if (port_to_record(handle, policydb, c, response) < 0)
+			goto err;
+		return STATUS_SUCCESS;
 	}
 
 	*response = NULL;
@@ -258,8 +256,7 @@ int sepol_port_modify(sepol_handle_t * handle,
 		goto err;
 
 	/* Attach to context list */
-	port->next = policydb->ocontexts[OCON_PORT];
-	policydb->ocontexts[OCON_PORT] = port;
+	ocon_keys_prepend(policydb, OCON_PORT, port);
 
 	return STATUS_SUCCESS;
 
@@ -273,6 +270,50 @@ int sepol_port_modify(sepol_handle_t * handle,
 	return STATUS_ERR;
 }
 
+/* Load several ports into policy, as by sepol_port_modify
+ * on each in turn; either all of them are loaded or none */
+int sepol_port_modify_many(sepol_handle_t * handle,
+			   sepol_policydb_t * p,
+			   sepol_port_t * const *ports, unsigned int nports)
+{
+
+	policydb_t *policydb = &p->p;
+	ocontext_t **tmp;
+	unsigned int i, n = 0;
+
+	if (!nports)
+		return STATUS_SUCCESS;
+
+	tmp = calloc(nports, sizeof(ocontext_t *));
+	if (!tmp) {
+		ERR(handle, "out of memory");
+		goto err;
+	}
+
+	for (n = 0; n < nports; n++) {
+		if (port_from_record(handle, policydb, &tmp[n], ports[n]) < 0)
+			goto err;
+	}
+
+	/* Attach to context list */
+	for (i = 0; i < nports; i++)
+		ocon_keys_prepend(policydb, OCON_PORT, tmp[i]);
+
+	free(tmp);
+	return STATUS_SUCCESS;
+
+      err:
+	ERR(handle, "could not load %u ports", nports);
+	if (tmp != NULL) {
+		for (i = 0; i < n; i++) {
+			context_destroy(&tmp[i]->context[0]);
+			free(tmp[i]);
+		}
+		free(tmp);
+	}
+	return STATUS_ERR;
+}
+
 int sepol_port_iterate(sepol_handle_t * handle,
 		       const sepol_policydb_t * p,
 		       int (*fn) (const sepol_port_t * port,
@@ -58,7 +58,34 @@ extern struct policydb_compat_info *policydb_lookup_compat(unsigned int version,
 							   unsigned int type,
 						unsigned int target_platform);
 
+/* Number of times the conditional rules were switched on or off. */
+extern unsigned int cond_state_changes hidden;
+
 /* Reading from a policy "file". */
 extern int next_entry(void *buf, struct policy_file *fp, size_t bytes) hidden;
 extern size_t put_entry(const void *ptr, size_t size, size_t n,
 		        struct policy_file *fp) hidden;
+
+/* The expanded types of a role and roles of a user, built on first use
+ * (see policydb.c).  Return NULL if out of memory. */
+extern ebitmap_t *policydb_role_types(policydb_t * p,
+				      role_datum_t * role) hidden;
+extern ebitmap_t *policydb_user_roles(policydb_t * p,
+				      user_datum_t * user) hidden;
+/* Build all of them at once, for checks made from several threads, as
+ * when a policy is installed for the security services. */
+extern int policydb_fill_caches(policydb_t * p) hidden;
+
+/* The string pool for the names of symbol table 'h' of 'p', if any,
+ * and reading a name of 'len' bytes into it (see policydb.c). */
+struct strpool;
+extern struct strpool *symtab_pool(policydb_t * p, hashtab_t h) hidden;
+extern char *symtab_name_read(struct strpool *pool, struct policy_file *fp,
+			      size_t len) hidden;
+
+/* Read a kernel policy image in memory only up to the end of its symbol
+ * tables, leaving 'fp' at the rules that follow them.  *bools is set to
+ * the first entry of the boolean table, or NULL if there is none (see
+ * policydb.c). */
+extern int policydb_read_symtabs(policydb_t * p, struct policy_file *fp,
+				 char **bools) hidden;
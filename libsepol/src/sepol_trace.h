@@ -0,0 +1,23 @@
+/*
+ * Static user-space tracepoints (USDT) for SystemTap and bpftrace,
+ * under the provider name "libsepol".  The phase probes take a string
+ * naming the phase that starts.
+ *
+ * The probes are built in only when <sys/sdt.h> was found (the Makefile
+ * defines HAVE_SYS_SDT_H); an unattached probe is a single nop.  When
+ * they are left out the arguments are not evaluated.
+ */
+#ifndef _SEPOL_TRACE_H_
+#define _SEPOL_TRACE_H_
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define SEPOL_PROBE1(name, a) \
+	DTRACE_PROBE1(libsepol, name, a)
+#else
+#define SEPOL_PROBE1(name, a) \
+	do { (void)sizeof(a); } while (0)
+#endif
+
+#endif
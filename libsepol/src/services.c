@@ -49,6 +49,7 @@
 #define STACK_LEN 32
 
 #include <stdlib.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -67,68 +68,291 @@
 #include "av_permissions.h"
 #include "dso.h"
 #include "mls.h"
+#include "ocon_index.h"
+#include "trans_keys.h"
+#include "type_map.h"
 
 #define BUG() do { ERR(NULL, "Badness at %s:%d", __FILE__, __LINE__); } while (0)
 #define BUG_ON(x) do { if (x) ERR(NULL, "Badness at %s:%d", __FILE__, __LINE__); } while (0)
 
 static int selinux_enforcing = 1;
 
-static sidtab_t mysidtab, *sidtab = &mysidtab;
-static policydb_t mypolicydb, *policydb = &mypolicydb;
+/*
+ * Cache of the type enforcement part of access decisions.  Computing
+ * it means searching both avtabs for every pair of attributes of the
+ * source and target types, while the constraints, which depend on the
+ * whole contexts, are cheap in comparison.  The cache is direct
+ * mapped on (stype, ttype, tclass) and is flushed whenever another
+ * policy is installed or conditional rules are switched on or off.
+ */
+#define AVD_CACHE_BITS 12
+#define AVD_CACHE_SIZE (1 << AVD_CACHE_BITS)
+
+struct avd_cache_entry {
+	uint32_t stype;		/* 0 if the entry is unused */
+	uint32_t ttype;
+	uint32_t tclass;
+	sepol_access_vector_t allowed;
+	sepol_access_vector_t auditallow;
+	sepol_access_vector_t auditdeny;
+};
 
-/* Used by sepol_compute_av_reason_buffer() to keep track of entries */
-static int reason_buf_used;
-static int reason_buf_len;
+/*
+ * Everything the service functions keep between calls.  The classic
+ * interface works on default_services.  A program can create more
+ * instances with sepol_services_create() and pick one per thread with
+ * sepol_services_use(); threads that use different instances can then
+ * call the service functions concurrently.
+ */
+struct sepol_services {
+	policydb_t *policydb;
+	sidtab_t *sidtab;
+	policydb_t mypolicydb;	/* for sepol_set_policydb_from_file() */
+	sidtab_t mysidtab;
+
+	struct avd_cache_entry *avd_cache;
+	unsigned int avd_cache_cond_state;
+
+	/* The largest sequence number that has been used when providing
+	   an access decision to the access vector cache.  The sequence
+	   number only changes when a policy change occurs. */
+	uint32_t latest_granting;
+
+	/* Port, node, netif and fs lookup tables, built on first use. */
+	struct ocon_index *ocon_index;
+
+	/* Packed type_attr_map and attr_type_map, built on first use. */
+	struct type_map *type_map;
+
+	/* Per source type or attribute, the targets of the allow rules
+	   granting process transition, built on first use. */
+	ebitmap_t *trans_targets;
+	uint32_t trans_targets_nel;
+
+	/* Used by sepol_compute_av_reason_buffer() to keep track of entries */
+	int reason_buf_used;
+	int reason_buf_len;
+
+	/* Stack for RPN to infix conversion. */
+	char **stack;
+	int stack_len;
+	int next_stack_entry;
+
+	/* Expression text buffers, see cat_expr_buf(). */
+	int expr_counter;
+	char **expr_list;
+	int expr_buf_used;
+	int expr_buf_len;
+};
+
+static struct sepol_services default_services = {
+	.policydb = &default_services.mypolicydb,
+	.sidtab = &default_services.mysidtab,
+};
+
+static __thread struct sepol_services *services = &default_services;
 
-/* Stack services for RPN to infix conversion. */
-static char **stack;
-static int stack_len;
-static int next_stack_entry;
+/*
+ * Build the role and user caches and the lookup tables a policydb keeps
+ * for itself before it is installed for queries.  Several handles may
+ * share one policydb, and once all of these are current they only read
+ * it; the lock keeps two handles installing the same policydb from
+ * building them together.
+ */
+static pthread_mutex_t services_prepare_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int services_prepare(policydb_t * p)
+{
+	int rc;
+
+	pthread_mutex_lock(&services_prepare_lock);
+	rc = policydb_fill_caches(p) || trans_keys_build(p);
+	pthread_mutex_unlock(&services_prepare_lock);
+	return rc ? -ENOMEM : 0;
+}
 
+static void avd_cache_flush(void)
+{
+	if (services->avd_cache)
+		memset(services->avd_cache, 0,
+		       AVD_CACHE_SIZE * sizeof(*services->avd_cache));
+	services->avd_cache_cond_state =
+	    __atomic_load_n(&cond_state_changes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Return the cache entry for the key, or NULL if there is no cache.
+ * The caller checks whether the entry holds the key.
+ */
+static struct avd_cache_entry *avd_cache_slot(uint32_t stype, uint32_t ttype,
+					      uint32_t tclass)
+{
+	uint32_t hash;
+
+	if (!services->avd_cache) {
+		services->avd_cache = calloc(AVD_CACHE_SIZE,
+					     sizeof(*services->avd_cache));
+		if (!services->avd_cache)
+			return NULL;
+		services->avd_cache_cond_state =
+		    __atomic_load_n(&cond_state_changes, __ATOMIC_RELAXED);
+	} else if (services->avd_cache_cond_state !=
+		   __atomic_load_n(&cond_state_changes, __ATOMIC_RELAXED)) {
+		avd_cache_flush();
+	}
+
+	hash = (stype * 0x9e3779b1U) ^ (ttype * 0x85ebca77U) ^
+	       (tclass * 0xc2b2ae3dU);
+	return &services->avd_cache[hash >> (32 - AVD_CACHE_BITS)];
+}
+
+/* Stack services for RPN to infix conversion. */
 static void push(char *expr_ptr)
 {
-	if (next_stack_entry >= stack_len) {
-		char **new_stack = stack;
+	if (services->next_stack_entry >= services->stack_len) {
+		char **new_stack = services->stack;
 		int new_stack_len;
 
-		if (stack_len == 0)
+		if (services->stack_len == 0)
 			new_stack_len = STACK_LEN;
 		else
-			new_stack_len = stack_len * 2;
+			new_stack_len = services->stack_len * 2;
 
-		new_stack = realloc(stack, new_stack_len * sizeof(*stack));
+		new_stack = realloc(services->stack, new_stack_len * sizeof(*services->stack));
 		if (!new_stack) {
 			ERR(NULL, "unable to allocate stack space");
 			return;
 		}
-		stack_len = new_stack_len;
-		stack = new_stack;
+		services->stack_len = new_stack_len;
+		services->stack = new_stack;
 	}
-	stack[next_stack_entry] = expr_ptr;
-	next_stack_entry++;
+	services->stack[services->next_stack_entry] = expr_ptr;
+	services->next_stack_entry++;
 }
 
 static char *pop(void)
 {
-	next_stack_entry--;
-	if (next_stack_entry < 0) {
-		next_stack_entry = 0;
+	services->next_stack_entry--;
+	if (services->next_stack_entry < 0) {
+		services->next_stack_entry = 0;
 		ERR(NULL, "pop called with no stack entries");
 		return NULL;
 	}
-	return stack[next_stack_entry];
+	return services->stack[services->next_stack_entry];
 }
 /* End Stack services */
 
+static void ocon_index_flush(void)
+{
+	ocon_index_destroy(services->ocon_index);
+	services->ocon_index = NULL;
+}
+
+/* Returns NULL if the lists have to be walked instead. */
+static struct ocon_index *ocon_index_get(void)
+{
+	policydb_t *p = services->policydb;
+
+	if (p->target_platform != SEPOL_TARGET_SELINUX)
+		return NULL;
+	if (services->ocon_index && !ocon_index_current(services->ocon_index, p))
+		ocon_index_flush();
+	if (!services->ocon_index)
+		services->ocon_index = ocon_index_create(p);
+	return services->ocon_index;
+}
+
+static void type_map_flush(void)
+{
+	type_map_destroy(services->type_map);
+	services->type_map = NULL;
+}
+
+/* Returns NULL if the ebitmaps have to be walked instead. */
+static struct type_map *type_map_get(void)
+{
+	policydb_t *p = services->policydb;
+
+	if (services->type_map && !type_map_current(services->type_map, p))
+		type_map_flush();
+	if (!services->type_map)
+		services->type_map = type_map_create(p);
+	return services->type_map;
+}
+
+static void trans_targets_destroy(struct sepol_services *svc)
+{
+	uint32_t i;
+
+	for (i = 0; i < svc->trans_targets_nel; i++)
+		ebitmap_destroy(&svc->trans_targets[i]);
+	free(svc->trans_targets);
+	svc->trans_targets = NULL;
+	svc->trans_targets_nel = 0;
+}
+
+static void trans_targets_flush(void)
+{
+	trans_targets_destroy(services);
+}
+
+static int trans_targets_add(avtab_key_t * k, avtab_datum_t * d, void *args)
+{
+	ebitmap_t *targets = args;
+
+	if (k->target_class != SECCLASS_PROCESS ||
+	    !(k->specified & AVTAB_ALLOWED) ||
+	    !(d->data & PROCESS__TRANSITION))
+		return 0;
+	return ebitmap_set_bit(&targets[k->source_type - 1],
+			       k->target_type - 1, 1);
+}
+
+/*
+ * Conditional rules are included whatever the state of their booleans,
+ * so the index is a superset of what is allowed and stays valid until
+ * another policy is installed.
+ */
+static ebitmap_t *trans_targets_get(void)
+{
+	policydb_t *p = services->policydb;
+	ebitmap_t *targets;
+	uint32_t i;
+
+	if (services->trans_targets)
+		return services->trans_targets;
+
+	targets = malloc(p->p_types.nprim * sizeof(ebitmap_t));
+	if (!targets)
+		return NULL;
+	for (i = 0; i < p->p_types.nprim; i++)
+		ebitmap_init(&targets[i]);
+	services->trans_targets = targets;
+	services->trans_targets_nel = p->p_types.nprim;
+
+	if (avtab_map(&p->te_avtab, trans_targets_add, targets) ||
+	    avtab_map(&p->te_cond_avtab, trans_targets_add, targets)) {
+		trans_targets_flush();
+		return NULL;
+	}
+	return targets;
+}
+
 int hidden sepol_set_sidtab(sidtab_t * s)
 {
-	sidtab = s;
+	services->sidtab = s;
 	return 0;
 }
 
 int hidden sepol_set_policydb(policydb_t * p)
 {
-	policydb = p;
+	if (services_prepare(p))
+		return -ENOMEM;
+	services->policydb = p;
+	avd_cache_flush();
+	ocon_index_flush();
+	type_map_flush();
+	trans_targets_flush();
 	return 0;
 }
 
@@ -139,40 +363,83 @@ int sepol_set_policydb_from_file(FILE * fp)
 	policy_file_init(&pf);
 	pf.fp = fp;
 	pf.type = PF_USE_STDIO;
-	if (mypolicydb.policy_type)
-		policydb_destroy(&mypolicydb);
-	if (policydb_init(&mypolicydb)) {
+	if (services->mypolicydb.policy_type)
+		policydb_destroy(&services->mypolicydb);
+	if (policydb_init(&services->mypolicydb)) {
 		ERR(NULL, "Out of memory!");
 		return -1;
 	}
-	if (policydb_read(&mypolicydb, &pf, 0)) {
-		policydb_destroy(&mypolicydb);
+	if (policydb_read(&services->mypolicydb, &pf, 0)) {
+		policydb_destroy(&services->mypolicydb);
 		ERR(NULL, "can't read binary policy: %s", strerror(errno));
 		return -1;
 	}
-	policydb = &mypolicydb;
-	return sepol_sidtab_init(sidtab);
+	/* nothing changes the rules of a policy read for queries */
+	avtab_freeze(&services->mypolicydb.te_avtab);
+	/* without the merged table lookups just probe both avtabs */
+	cond_merge_avtab(&services->mypolicydb);
+	if (services_prepare(&services->mypolicydb)) {
+		policydb_destroy(&services->mypolicydb);
+		ERR(NULL, "Out of memory!");
+		return -1;
+	}
+	services->policydb = &services->mypolicydb;
+	avd_cache_flush();
+	ocon_index_flush();
+	type_map_flush();
+	trans_targets_flush();
+	return sepol_sidtab_init(services->sidtab);
 }
 
-/*
- * The largest sequence number that has been used when
- * providing an access decision to the access vector cache.
- * The sequence number only changes when a policy change
- * occurs.
- */
-static uint32_t latest_granting = 0;
+int hidden sepol_services_create(policydb_t * p, sidtab_t * s,
+				 sepol_services_t ** svcp)
+{
+	struct sepol_services *svc;
+
+	if (p && services_prepare(p))
+		return -ENOMEM;
+	svc = calloc(1, sizeof(*svc));
+	if (!svc)
+		return -ENOMEM;
+	svc->policydb = p ? p : &svc->mypolicydb;
+	svc->sidtab = s ? s : &svc->mysidtab;
+	*svcp = svc;
+	return 0;
+}
+
+void hidden sepol_services_destroy(sepol_services_t * svc)
+{
+	if (!svc || svc == &default_services)
+		return;
+	if (services == svc)
+		services = &default_services;
+
+	if (svc->mypolicydb.policy_type)
+		policydb_destroy(&svc->mypolicydb);
+	sepol_sidtab_destroy(&svc->mysidtab);
+	free(svc->avd_cache);
+	ocon_index_destroy(svc->ocon_index);
+	type_map_destroy(svc->type_map);
+	trans_targets_destroy(svc);
+	free(svc->stack);
+	free(svc);
+}
+
+sepol_services_t hidden *sepol_services_use(sepol_services_t * svc)
+{
+	sepol_services_t *old = services;
+
+	services = svc ? svc : &default_services;
+	return old;
+}
 
 /*
  * cat_expr_buf adds a string to an expression buffer and handles
  * realloc's if buffer is too small. The array of expression text
- * buffer pointers and its counter are globally defined here as
+ * buffer pointers and its counter are kept in the services state as
  * constraint_expr_eval_reason() sets them up and cat_expr_buf
  * updates the e_buf pointer.
  */
-static int expr_counter;
-static char **expr_list;
-static int expr_buf_used;
-static int expr_buf_len;
 
 static void cat_expr_buf(char *e_buf, char *string)
 {
@@ -180,21 +447,21 @@ static void cat_expr_buf(char *e_buf, char *string)
 	char *p, *new_buf = e_buf;
 
 	while (1) {
-		p = e_buf + expr_buf_used;
-		len = snprintf(p, expr_buf_len - expr_buf_used, "%s", string);
-		if (len < 0 || len >= expr_buf_len - expr_buf_used) {
-			new_buf_len = expr_buf_len + EXPR_BUF_SIZE;
+		p = e_buf + services->expr_buf_used;
+		len = snprintf(p, services->expr_buf_len - services->expr_buf_used, "%s", string);
+		if (len < 0 || len >= services->expr_buf_len - services->expr_buf_used) {
+			new_buf_len = services->expr_buf_len + EXPR_BUF_SIZE;
 			new_buf = realloc(e_buf, new_buf_len);
 			if (!new_buf) {
 				ERR(NULL, "failed to realloc expr buffer");
 				return;
 			}
 			/* Update new ptr in expr list and locally + new len */
-			expr_list[expr_counter] = new_buf;
+			services->expr_list[services->expr_counter] = new_buf;
 			e_buf = new_buf;
-			expr_buf_len = new_buf_len;
+			services->expr_buf_len = new_buf_len;
 		} else {
-			expr_buf_used += len;
+			services->expr_buf_used += len;
 			return;
 		}
 	}
@@ -217,8 +484,8 @@ static void get_name_list(constraint_expr_t *e, int type,
 	char tmp_buf[128];
 	int counter = 0;
 
-	if (policydb->policy_type == POLICY_KERN &&
-			policydb->policyvers >= POLICYDB_VERSION_CONSTRAINT_NAMES &&
+	if (services->policydb->policy_type == POLICY_KERN &&
+			services->policydb->policyvers >= POLICYDB_VERSION_CONSTRAINT_NAMES &&
 			type == CEXPR_TYPE)
 		types = &e->type_names->types;
 	else
@@ -233,12 +500,12 @@ static void get_name_list(constraint_expr_t *e, int type,
 			counter++;
 	}
 	snprintf(tmp_buf, sizeof(tmp_buf), "(%s%s", src, op);
-	cat_expr_buf(expr_list[expr_counter], tmp_buf);
+	cat_expr_buf(services->expr_list[services->expr_counter], tmp_buf);
 
 	if (counter == 0)
-		cat_expr_buf(expr_list[expr_counter], "<empty_set> ");
+		cat_expr_buf(services->expr_list[services->expr_counter], "<empty_set> ");
 	if (counter > 1)
-		cat_expr_buf(expr_list[expr_counter], " {");
+		cat_expr_buf(services->expr_list[services->expr_counter], " {");
 	if (counter >= 1) {
 		for (i = ebitmap_startbit(types); i < ebitmap_length(types); i++) {
 			rc = ebitmap_get_bit(types, i);
@@ -249,26 +516,26 @@ static void get_name_list(constraint_expr_t *e, int type,
 			switch (type) {
 			case CEXPR_USER:
 				snprintf(tmp_buf, sizeof(tmp_buf), " %s",
-							policydb->p_user_val_to_name[i]);
+							services->policydb->p_user_val_to_name[i]);
 				break;
 			case CEXPR_ROLE:
 				snprintf(tmp_buf, sizeof(tmp_buf), " %s",
-							policydb->p_role_val_to_name[i]);
+							services->policydb->p_role_val_to_name[i]);
 				break;
 			case CEXPR_TYPE:
 				snprintf(tmp_buf, sizeof(tmp_buf), " %s",
-							policydb->p_type_val_to_name[i]);
+							services->policydb->p_type_val_to_name[i]);
 				break;
 			}
-			cat_expr_buf(expr_list[expr_counter], tmp_buf);
+			cat_expr_buf(services->expr_list[services->expr_counter], tmp_buf);
 		}
 	}
 	if (counter > 1)
-		cat_expr_buf(expr_list[expr_counter], " }");
+		cat_expr_buf(services->expr_list[services->expr_counter], " }");
 	if (failed)
-		cat_expr_buf(expr_list[expr_counter], " -Fail-) ");
+		cat_expr_buf(services->expr_list[services->expr_counter], " -Fail-) ");
 	else
-		cat_expr_buf(expr_list[expr_counter], ") ");
+		cat_expr_buf(services->expr_list[services->expr_counter], ") ");
 
 	return;
 }
@@ -282,7 +549,7 @@ static void msgcat(char *src, char *tgt, char *op, int failed)
 	else
 		snprintf(tmp_buf, sizeof(tmp_buf), "(%s %s %s) ",
 				src, op, tgt);
-	cat_expr_buf(expr_list[expr_counter], tmp_buf);
+	cat_expr_buf(services->expr_list[services->expr_counter], tmp_buf);
 }
 
 /* Returns a buffer with class, statement type and permissions */
@@ -340,7 +607,7 @@ static char *get_class_info(sepol_security_class_t tclass,
 		p += len;
 		buf_used += len;
 		len = snprintf(p, class_buf_len - buf_used, "%s ",
-				policydb->p_class_val_to_name[tclass - 1]);
+				services->policydb->p_class_val_to_name[tclass - 1]);
 		if (len < 0 || len >= class_buf_len - buf_used)
 			continue;
 
@@ -349,7 +616,7 @@ static char *get_class_info(sepol_security_class_t tclass,
 		buf_used += len;
 		if (state_num < 2) {
 			len = snprintf(p, class_buf_len - buf_used, "{%s } (",
-			sepol_av_to_string(policydb, tclass,
+			sepol_av_to_string(services->policydb, tclass,
 				constraint->permissions));
 		} else {
 			len = snprintf(p, class_buf_len - buf_used, "(");
@@ -425,12 +692,12 @@ static int constraint_expr_eval_reason(context_struct_t *scontext,
 
 	/* Original function but with buffer support */
 	int expr_list_len = 0;
-	expr_counter = 0;
-	expr_list = NULL;
+	services->expr_counter = 0;
+	services->expr_list = NULL;
 	for (e = constraint->expr; e; e = e->next) {
 		/* Allocate a stack to hold expression buffer entries */
-		if (expr_counter >= expr_list_len) {
-			char **new_expr_list = expr_list;
+		if (services->expr_counter >= expr_list_len) {
+			char **new_expr_list = services->expr_list;
 			int new_expr_list_len;
 
 			if (expr_list_len == 0)
@@ -438,48 +705,48 @@ static int constraint_expr_eval_reason(context_struct_t *scontext,
 			else
 				new_expr_list_len = expr_list_len * 2;
 
-			new_expr_list = realloc(expr_list,
-					new_expr_list_len * sizeof(*expr_list));
+			new_expr_list = realloc(services->expr_list,
+					new_expr_list_len * sizeof(*services->expr_list));
 			if (!new_expr_list) {
 				ERR(NULL, "failed to allocate expr buffer stack");
 				rc = -ENOMEM;
 				goto out;
 			}
 			expr_list_len = new_expr_list_len;
-			expr_list = new_expr_list;
+			services->expr_list = new_expr_list;
 		}
 
 		/*
 		 * malloc a buffer to store each expression text component. If
 		 * buffer is too small cat_expr_buf() will realloc extra space.
 		 */
-		expr_buf_len = EXPR_BUF_SIZE;
-		expr_list[expr_counter] = malloc(expr_buf_len);
-		if (!expr_list[expr_counter]) {
+		services->expr_buf_len = EXPR_BUF_SIZE;
+		services->expr_list[services->expr_counter] = malloc(services->expr_buf_len);
+		if (!services->expr_list[services->expr_counter]) {
 			ERR(NULL, "failed to allocate expr buffer");
 			rc = -ENOMEM;
 			goto out;
 		}
-		expr_buf_used = 0;
+		services->expr_buf_used = 0;
 
 		/* Now process each expression of the constraint */
 		switch (e->expr_type) {
 		case CEXPR_NOT:
 			BUG_ON(sp < 0);
 			s[sp] = !s[sp];
-			cat_expr_buf(expr_list[expr_counter], "not");
+			cat_expr_buf(services->expr_list[services->expr_counter], "not");
 			break;
 		case CEXPR_AND:
 			BUG_ON(sp < 1);
 			sp--;
 			s[sp] &= s[sp + 1];
-			cat_expr_buf(expr_list[expr_counter], "and");
+			cat_expr_buf(services->expr_list[services->expr_counter], "and");
 			break;
 		case CEXPR_OR:
 			BUG_ON(sp < 1);
 			sp--;
 			s[sp] |= s[sp + 1];
-			cat_expr_buf(expr_list[expr_counter], "or");
+			cat_expr_buf(services->expr_list[services->expr_counter], "or");
 			break;
 		case CEXPR_ATTR:
 			if (sp == (CEXPR_MAXDEPTH - 1))
@@ -501,8 +768,8 @@ static int constraint_expr_eval_reason(context_struct_t *scontext,
 			case CEXPR_ROLE:
 				val1 = scontext->role;
 				val2 = tcontext->role;
-				r1 = policydb->role_val_to_struct[val1 - 1];
-				r2 = policydb->role_val_to_struct[val2 - 1];
+				r1 = services->policydb->role_val_to_struct[val1 - 1];
+				r2 = services->policydb->role_val_to_struct[val2 - 1];
 				free(src); src = strdup("r1");
 				free(tgt); tgt = strdup("r2");
 
@@ -510,18 +777,18 @@ static int constraint_expr_eval_reason(context_struct_t *scontext,
 				case CEXPR_DOM:
 					s[++sp] = ebitmap_get_bit(&r1->dominates, val2 - 1);
 					msgcat(src, tgt, "dom", s[sp] == 0);
-					expr_counter++;
+					services->expr_counter++;
 					continue;
 				case CEXPR_DOMBY:
 					s[++sp] = ebitmap_get_bit(&r2->dominates, val1 - 1);
 					msgcat(src, tgt, "domby", s[sp] == 0);
-					expr_counter++;
+					services->expr_counter++;
 					continue;
 				case CEXPR_INCOMP:
 					s[++sp] = (!ebitmap_get_bit(&r1->dominates, val2 - 1)
 						 && !ebitmap_get_bit(&r2->dominates, val1 - 1));
 					msgcat(src, tgt, "incomp", s[sp] == 0);
-					expr_counter++;
+					services->expr_counter++;
 					continue;
 				default:
 					break;
@@ -567,27 +834,27 @@ mls_ops:
 				case CEXPR_EQ:
 					s[++sp] = mls_level_eq(l1, l2);
 					msgcat(src, tgt, "eq", s[sp] == 0);
-					expr_counter++;
+					services->expr_counter++;
 					continue;
 				case CEXPR_NEQ:
 					s[++sp] = !mls_level_eq(l1, l2);
 					msgcat(src, tgt, "!=", s[sp] == 0);
-					expr_counter++;
+					services->expr_counter++;
 					continue;
 				case CEXPR_DOM:
 					s[++sp] = mls_level_dom(l1, l2);
 					msgcat(src, tgt, "dom", s[sp] == 0);
-					expr_counter++;
+					services->expr_counter++;
 					continue;
 				case CEXPR_DOMBY:
 					s[++sp] = mls_level_dom(l2, l1);
 					msgcat(src, tgt, "domby", s[sp] == 0);
-					expr_counter++;
+					services->expr_counter++;
 					continue;
 				case CEXPR_INCOMP:
 					s[++sp] = mls_level_incomp(l2, l1);
 					msgcat(src, tgt, "incomp", s[sp] == 0);
-					expr_counter++;
+					services->expr_counter++;
 					continue;
 				default:
 					BUG();
@@ -668,7 +935,7 @@ mls_ops:
 			BUG();
 			goto out;
 		}
-		expr_counter++;
+		services->expr_counter++;
 	}
 
 	/*
@@ -682,8 +949,8 @@ mls_ops:
 	 * expr_list malloc's. Normally they are released by the RPN to
 	 * infix code.
 	 */
-	int expr_count = expr_counter;
-	expr_counter = 0;
+	int expr_count = services->expr_counter;
+	services->expr_counter = 0;
 
 	/*
 	 * The array of expression answer buffer pointers and counter.
@@ -707,7 +974,7 @@ mls_ops:
 
 	/* Convert constraint from RPN to infix notation. */
 	for (x = 0; x != expr_count; x++) {
-		if (strncmp(expr_list[x], "and", 3) == 0 || strncmp(expr_list[x],
+		if (strncmp(services->expr_list[x], "and", 3) == 0 || strncmp(services->expr_list[x],
 					"or", 2) == 0) {
 			b = pop();
 			b_len = strlen(b);
@@ -724,12 +991,12 @@ mls_ops:
 			memset(answer_list[answer_counter], '\0', a_len + b_len + 8);
 
 			sprintf(answer_list[answer_counter], "%s %s %s", a,
-					expr_list[x], b);
+					services->expr_list[x], b);
 			push(answer_list[answer_counter++]);
 			free(a);
 			free(b);
-			free(expr_list[x]);
-		} else if (strncmp(expr_list[x], "not", 3) == 0) {
+			free(services->expr_list[x]);
+		} else if (strncmp(services->expr_list[x], "not", 3) == 0) {
 			b = pop();
 			b_len = strlen(b);
 
@@ -743,15 +1010,15 @@ mls_ops:
 
 			if (strncmp(b, "not", 3) == 0)
 				sprintf(answer_list[answer_counter], "%s (%s)",
-						expr_list[x], b);
+						services->expr_list[x], b);
 			else
 				sprintf(answer_list[answer_counter], "%s%s",
-						expr_list[x], b);
+						services->expr_list[x], b);
 			push(answer_list[answer_counter++]);
 			free(b);
-			free(expr_list[x]);
+			free(services->expr_list[x]);
 		} else {
-			push(expr_list[x]);
+			push(services->expr_list[x]);
 		}
 	}
 	/* Get the final answer from tos and build constraint text */
@@ -783,21 +1050,21 @@ mls_ops:
 				(flags & SHOW_GRANTED) == SHOW_GRANTED)))) {
 		for (x = 0; buffers[x] != NULL; x++) {
 			while (1) {
-				p = *r_buf + reason_buf_used;
-				len = snprintf(p, reason_buf_len - reason_buf_used,
+				p = *r_buf + services->reason_buf_used;
+				len = snprintf(p, services->reason_buf_len - services->reason_buf_used,
 						"%s", buffers[x]);
-				if (len < 0 || len >= reason_buf_len - reason_buf_used) {
-					new_buf_len = reason_buf_len + REASON_BUF_SIZE;
+				if (len < 0 || len >= services->reason_buf_len - services->reason_buf_used) {
+					new_buf_len = services->reason_buf_len + REASON_BUF_SIZE;
 					*new_buf = realloc(*r_buf, new_buf_len);
 					if (!new_buf) {
 						ERR(NULL, "failed to realloc reason buffer");
 						goto out1;
 					}
 					**r_buf = **new_buf;
-					reason_buf_len = new_buf_len;
+					services->reason_buf_len = new_buf_len;
 					continue;
 				} else {
-					reason_buf_used += len;
+					services->reason_buf_used += len;
 					break;
 				}
 			}
@@ -813,15 +1080,363 @@ out:
 	free(src);
 	free(tgt);
 
-	if (expr_counter) {
-		for (x = 0; expr_list[x] != NULL; x++)
-			free(expr_list[x]);
+	if (services->expr_counter) {
+		for (x = 0; services->expr_list[x] != NULL; x++)
+			free(services->expr_list[x]);
 	}
 	free(answer_list);
-	free(expr_list);
+	free(services->expr_list);
+	return rc;
+}
+
+/*
+ * Constraint expressions are compiled on first use into a flat program
+ * whose instructions refer directly to the context fields they test, so
+ * a decision that does not need the reason text neither walks the
+ * expression list nor allocates anything.  An expression the compiler
+ * does not accept gets an empty program and is always handed to
+ * constraint_expr_eval_reason(), which reports what is wrong with it.
+ */
+enum {
+	CI_NOT,
+	CI_AND,
+	CI_OR,
+	CI_EQ,			/* user, role or type */
+	CI_NEQ,
+	CI_ROLE_DOM,
+	CI_ROLE_DOMBY,
+	CI_ROLE_INCOMP,
+	CI_LEVEL_EQ,
+	CI_LEVEL_NEQ,
+	CI_LEVEL_DOM,
+	CI_LEVEL_DOMBY,
+	CI_LEVEL_INCOMP,
+	CI_NAMES,
+	CI_NOT_NAMES,
+};
+
+struct cexpr_insn {
+	unsigned char code;
+	unsigned char ctx1, ctx2;	/* 0 = source, 1 = target, 2 = xcontext */
+	unsigned char arg1, arg2;	/* field offset, or level index */
+	const ebitmap_t *names;
+};
+
+struct constraint_prog {
+	uint32_t len;
+	struct cexpr_insn insn[];
+};
+
+#define CEXPR_FIELD(c, off) (*(const uint32_t *)((const char *)(c) + (off)))
+
+static struct constraint_prog *constraint_compile(constraint_expr_t *expr)
+{
+	struct constraint_prog *prog;
+	struct cexpr_insn *in;
+	constraint_expr_t *e;
+	uint32_t n = 0;
+	int depth = 0;
+
+	for (e = expr; e; e = e->next)
+		n++;
+	prog = calloc(1, sizeof(*prog) + n * sizeof(prog->insn[0]));
+	if (!prog)
+		return NULL;
+
+	in = prog->insn;
+	for (e = expr; e; e = e->next, in++) {
+		switch (e->expr_type) {
+		case CEXPR_NOT:
+			if (depth < 1)
+				goto bad;
+			in->code = CI_NOT;
+			continue;
+		case CEXPR_AND:
+		case CEXPR_OR:
+			if (depth < 2)
+				goto bad;
+			in->code = e->expr_type == CEXPR_AND ? CI_AND : CI_OR;
+			depth--;
+			continue;
+		case CEXPR_ATTR:
+			if (depth == CEXPR_MAXDEPTH)
+				goto bad;
+			in->ctx1 = 0;
+			in->ctx2 = 1;
+			switch (e->attr) {
+			case CEXPR_USER:
+				in->arg1 = in->arg2 =
+				    offsetof(context_struct_t, user);
+				break;
+			case CEXPR_TYPE:
+				in->arg1 = in->arg2 =
+				    offsetof(context_struct_t, type);
+				break;
+			case CEXPR_ROLE:
+				in->arg1 = in->arg2 =
+				    offsetof(context_struct_t, role);
+				if (e->op == CEXPR_DOM)
+					in->code = CI_ROLE_DOM;
+				else if (e->op == CEXPR_DOMBY)
+					in->code = CI_ROLE_DOMBY;
+				else if (e->op == CEXPR_INCOMP)
+					in->code = CI_ROLE_INCOMP;
+				else
+					break;
+				depth++;
+				continue;
+			case CEXPR_L1L2:
+				in->arg1 = 0;
+				in->arg2 = 0;
+				goto mls_ops;
+			case CEXPR_L1H2:
+				in->arg1 = 0;
+				in->arg2 = 1;
+				goto mls_ops;
+			case CEXPR_H1L2:
+				in->arg1 = 1;
+				in->arg2 = 0;
+				goto mls_ops;
+			case CEXPR_H1H2:
+				in->arg1 = 1;
+				in->arg2 = 1;
+				goto mls_ops;
+			case CEXPR_L1H1:
+				in->ctx2 = 0;
+				in->arg1 = 0;
+				in->arg2 = 1;
+				goto mls_ops;
+			case CEXPR_L2H2:
+				in->ctx1 = 1;
+				in->arg1 = 0;
+				in->arg2 = 1;
+mls_ops:
+				switch (e->op) {
+				case CEXPR_EQ:
+					in->code = CI_LEVEL_EQ;
+					break;
+				case CEXPR_NEQ:
+					in->code = CI_LEVEL_NEQ;
+					break;
+				case CEXPR_DOM:
+					in->code = CI_LEVEL_DOM;
+					break;
+				case CEXPR_DOMBY:
+					in->code = CI_LEVEL_DOMBY;
+					break;
+				case CEXPR_INCOMP:
+					in->code = CI_LEVEL_INCOMP;
+					break;
+				default:
+					goto bad;
+				}
+				depth++;
+				continue;
+			default:
+				goto bad;
+			}
+			if (e->op == CEXPR_EQ)
+				in->code = CI_EQ;
+			else if (e->op == CEXPR_NEQ)
+				in->code = CI_NEQ;
+			else
+				goto bad;
+			depth++;
+			continue;
+		case CEXPR_NAMES:
+			if (depth == CEXPR_MAXDEPTH)
+				goto bad;
+			in->ctx1 = 0;
+			if (e->attr & CEXPR_TARGET)
+				in->ctx1 = 1;
+			else if (e->attr & CEXPR_XTARGET)
+				in->ctx1 = 2;
+			if (e->attr & CEXPR_USER)
+				in->arg1 = offsetof(context_struct_t, user);
+			else if (e->attr & CEXPR_ROLE)
+				in->arg1 = offsetof(context_struct_t, role);
+			else if (e->attr & CEXPR_TYPE)
+				in->arg1 = offsetof(context_struct_t, type);
+			else
+				goto bad;
+			if (e->op == CEXPR_EQ)
+				in->code = CI_NAMES;
+			else if (e->op == CEXPR_NEQ)
+				in->code = CI_NOT_NAMES;
+			else
+				goto bad;
+			in->names = &e->names;
+			depth++;
+			continue;
+		default:
+			goto bad;
+		}
+	}
+	if (depth != 1)
+		goto bad;
+	prog->len = n;
+	return prog;
+
+      bad:
+	prog->len = 0;
+	return prog;
+}
+
+/*
+ * Return the value of a compiled constraint for the given contexts,
+ * or -1 if it has to be evaluated by constraint_expr_eval_reason().
+ */
+static int constraint_prog_eval(const struct constraint_prog *prog,
+				context_struct_t *ctx[3])
+{
+	const struct cexpr_insn *in, *end = prog->insn + prog->len;
+	role_datum_t *r1, *r2;
+	mls_level_t *l1, *l2;
+	uint32_t val1, val2;
+	int s[CEXPR_MAXDEPTH];
+	int sp = -1;
+
+	if (!prog->len)
+		return -1;
+
+	for (in = prog->insn; in != end; in++) {
+		switch (in->code) {
+		case CI_NOT:
+			s[sp] = !s[sp];
+			break;
+		case CI_AND:
+			sp--;
+			s[sp] &= s[sp + 1];
+			break;
+		case CI_OR:
+			sp--;
+			s[sp] |= s[sp + 1];
+			break;
+		case CI_EQ:
+			s[++sp] = CEXPR_FIELD(ctx[0], in->arg1) ==
+			    CEXPR_FIELD(ctx[1], in->arg2);
+			break;
+		case CI_NEQ:
+			s[++sp] = CEXPR_FIELD(ctx[0], in->arg1) !=
+			    CEXPR_FIELD(ctx[1], in->arg2);
+			break;
+		case CI_ROLE_DOM:
+		case CI_ROLE_DOMBY:
+		case CI_ROLE_INCOMP:
+			val1 = ctx[0]->role;
+			val2 = ctx[1]->role;
+			r1 = services->policydb->role_val_to_struct[val1 - 1];
+			r2 = services->policydb->role_val_to_struct[val2 - 1];
+			if (in->code == CI_ROLE_DOM)
+				s[++sp] = ebitmap_get_bit(&r1->dominates,
+							  val2 - 1);
+			else if (in->code == CI_ROLE_DOMBY)
+				s[++sp] = ebitmap_get_bit(&r2->dominates,
+							  val1 - 1);
+			else
+				s[++sp] = (!ebitmap_get_bit(&r1->dominates,
+							    val2 - 1)
+					   && !ebitmap_get_bit(&r2->dominates,
+							       val1 - 1));
+			break;
+		case CI_LEVEL_EQ:
+		case CI_LEVEL_NEQ:
+		case CI_LEVEL_DOM:
+		case CI_LEVEL_DOMBY:
+		case CI_LEVEL_INCOMP:
+			l1 = &ctx[in->ctx1]->range.level[in->arg1];
+			l2 = &ctx[in->ctx2]->range.level[in->arg2];
+			if (in->code == CI_LEVEL_EQ)
+				s[++sp] = mls_level_eq(l1, l2);
+			else if (in->code == CI_LEVEL_NEQ)
+				s[++sp] = !mls_level_eq(l1, l2);
+			else if (in->code == CI_LEVEL_DOM)
+				s[++sp] = mls_level_dom(l1, l2);
+			else if (in->code == CI_LEVEL_DOMBY)
+				s[++sp] = mls_level_dom(l2, l1);
+			else
+				s[++sp] = mls_level_incomp(l2, l1);
+			break;
+		case CI_NAMES:
+		case CI_NOT_NAMES:
+			if (!ctx[in->ctx1])
+				return -1;
+			val1 = CEXPR_FIELD(ctx[in->ctx1], in->arg1);
+			s[++sp] = ebitmap_get_bit(in->names, val1 - 1);
+			if (in->code == CI_NOT_NAMES)
+				s[sp] = !s[sp];
+			break;
+		}
+	}
+
+	return s[0];
+}
+
+/*
+ * Evaluate a constraint, using its compiled form unless the caller
+ * wants reason text that this decision would produce.
+ */
+static int constraint_expr_eval(context_struct_t *scontext,
+				context_struct_t *tcontext,
+				context_struct_t *xcontext,
+				sepol_security_class_t tclass,
+				constraint_node_t *constraint,
+				char **r_buf,
+				unsigned int flags)
+{
+	context_struct_t *ctx[3] = { scontext, tcontext, xcontext };
+	struct constraint_prog *prog, *old = NULL;
+	int rc = -1;
+
+	prog = __atomic_load_n(&constraint->prog, __ATOMIC_ACQUIRE);
+	if (!prog) {
+		prog = constraint_compile(constraint->expr);
+		/* another thread may have compiled it meanwhile */
+		if (prog &&
+		    !__atomic_compare_exchange_n(&constraint->prog, &old, prog,
+						 0, __ATOMIC_ACQ_REL,
+						 __ATOMIC_ACQUIRE)) {
+			free(prog);
+			prog = old;
+		}
+	}
+	if (prog)
+		rc = constraint_prog_eval(prog, ctx);
+
+	if (rc < 0 ||
+	    (r_buf && (!rc || (flags & SHOW_GRANTED) == SHOW_GRANTED)))
+		return constraint_expr_eval_reason(scontext, tcontext,
+						   xcontext, tclass,
+						   constraint, r_buf, flags);
 	return rc;
 }
 
+/*
+ * Add the rules for one (source, target, class) key, unconditional
+ * and enabled conditional ones, to the access vectors.  With the
+ * merged table both are found in a single probe.
+ */
+static void te_compute_av(avtab_key_t * avkey, struct sepol_av_decision *avd)
+{
+	policydb_t *p = services->policydb;
+	avtab_t *te = p->te_merged_avtab ? p->te_merged_avtab : &p->te_avtab;
+	avtab_ptr_t node;
+
+	for (node = avtab_search_node(te, avkey);
+	     node != NULL; node = avtab_search_node_next(node, avkey->specified)) {
+		if (node->key.specified == AVTAB_ALLOWED)
+			avd->allowed |= node->datum.data;
+		else if (node->key.specified == AVTAB_AUDITALLOW)
+			avd->auditallow |= node->datum.data;
+		else if (node->key.specified == AVTAB_AUDITDENY)
+			avd->auditdeny &= node->datum.data;
+	}
+
+	/* Check conditional av table for additional permissions */
+	if (!p->te_merged_avtab)
+		cond_compute_av(&p->te_cond_avtab, avkey, avd);
+}
+
 /*
  * Compute access vectors based on a context structure pair for
  * the permissions in a particular class.
@@ -839,16 +1454,19 @@ static int context_struct_compute_av(context_struct_t * scontext,
 	struct role_allow *ra;
 	avtab_key_t avkey;
 	class_datum_t *tclass_datum;
-	avtab_ptr_t node;
-	ebitmap_t *sattr, *tattr;
+	struct type_map *map;
+	const uint32_t *sattr, *tattr;
+	uint32_t nsattr, ntattr;
+	ebitmap_t *smap, *tmap;
 	ebitmap_node_t *snode, *tnode;
+	struct avd_cache_entry *entry;
 	unsigned int i, j;
 
-	if (!tclass || tclass > policydb->p_classes.nprim) {
+	if (!tclass || tclass > services->policydb->p_classes.nprim) {
 		ERR(NULL, "unrecognized class %d", tclass);
 		return -EINVAL;
 	}
-	tclass_datum = policydb->class_val_to_struct[tclass - 1];
+	tclass_datum = services->policydb->class_val_to_struct[tclass - 1];
 
 	/* 
 	 * Initialize the access vectors to the default values.
@@ -857,45 +1475,57 @@ static int context_struct_compute_av(context_struct_t * scontext,
 	avd->decided = 0xffffffff;
 	avd->auditallow = 0;
 	avd->auditdeny = 0xffffffff;
-	avd->seqno = latest_granting;
+	avd->seqno = services->latest_granting;
 	*reason = 0;
 
 	/*
 	 * If a specific type enforcement rule was defined for
 	 * this permission check, then use it.
 	 */
+	entry = avd_cache_slot(scontext->type, tcontext->type, tclass);
+	if (entry && entry->stype == scontext->type &&
+	    entry->ttype == tcontext->type && entry->tclass == tclass) {
+		avd->allowed = entry->allowed;
+		avd->auditallow = entry->auditallow;
+		avd->auditdeny = entry->auditdeny;
+		goto te_done;
+	}
+
 	avkey.target_class = tclass;
 	avkey.specified = AVTAB_AV;
-	sattr = &policydb->type_attr_map[scontext->type - 1];
-	tattr = &policydb->type_attr_map[tcontext->type - 1];
-	ebitmap_for_each_bit(sattr, snode, i) {
-		if (!ebitmap_node_get_bit(snode, i))
-			continue;
-		ebitmap_for_each_bit(tattr, tnode, j) {
-			if (!ebitmap_node_get_bit(tnode, j))
-				continue;
+	map = type_map_get();
+	if (map) {
+		sattr = type_map_attrs(map, scontext->type - 1, &nsattr);
+		tattr = type_map_attrs(map, tcontext->type - 1, &ntattr);
+		for (i = 0; i < nsattr; i++) {
+			avkey.source_type = sattr[i] + 1;
+			for (j = 0; j < ntattr; j++) {
+				avkey.target_type = tattr[j] + 1;
+				te_compute_av(&avkey, avd);
+			}
+		}
+	} else {
+		smap = &services->policydb->type_attr_map[scontext->type - 1];
+		tmap = &services->policydb->type_attr_map[tcontext->type - 1];
+		ebitmap_for_each_positive_bit(smap, snode, i) {
 			avkey.source_type = i + 1;
-			avkey.target_type = j + 1;
-			for (node =
-			     avtab_search_node(&policydb->te_avtab, &avkey);
-			     node != NULL;
-			     node =
-			     avtab_search_node_next(node, avkey.specified)) {
-				if (node->key.specified == AVTAB_ALLOWED)
-					avd->allowed |= node->datum.data;
-				else if (node->key.specified ==
-					 AVTAB_AUDITALLOW)
-					avd->auditallow |= node->datum.data;
-				else if (node->key.specified == AVTAB_AUDITDENY)
-					avd->auditdeny &= node->datum.data;
+			ebitmap_for_each_positive_bit(tmap, tnode, j) {
+				avkey.target_type = j + 1;
+				te_compute_av(&avkey, avd);
 			}
-
-			/* Check conditional av table for additional permissions */
-			cond_compute_av(&policydb->te_cond_avtab, &avkey, avd);
-
 		}
 	}
 
+	if (entry) {
+		entry->stype = scontext->type;
+		entry->ttype = tcontext->type;
+		entry->tclass = tclass;
+		entry->allowed = avd->allowed;
+		entry->auditallow = avd->auditallow;
+		entry->auditdeny = avd->auditdeny;
+	}
+
+      te_done:
 	if (requested & ~avd->allowed) {
 		*reason |= SEPOL_COMPUTEAV_TE;
 		requested &= avd->allowed;
@@ -908,7 +1538,7 @@ static int context_struct_compute_av(context_struct_t * scontext,
 	constraint = tclass_datum->constraints;
 	while (constraint) {
 		if ((constraint->permissions & (avd->allowed)) &&
-		    !constraint_expr_eval_reason(scontext, tcontext, NULL,
+		    !constraint_expr_eval(scontext, tcontext, NULL,
 					  tclass, constraint, r_buf, flags)) {
 			avd->allowed =
 			    (avd->allowed) & ~(constraint->permissions);
@@ -929,7 +1559,7 @@ static int context_struct_compute_av(context_struct_t * scontext,
 	if (tclass == SECCLASS_PROCESS &&
 	    (avd->allowed & (PROCESS__TRANSITION | PROCESS__DYNTRANSITION)) &&
 	    scontext->role != tcontext->role) {
-		for (ra = policydb->role_allow; ra; ra = ra->next) {
+		for (ra = services->policydb->role_allow; ra; ra = ra->next) {
 			if (scontext->role == ra->role &&
 			    tcontext->role == ra->new_role)
 				break;
@@ -958,25 +1588,25 @@ int hidden sepol_validate_transition(sepol_security_id_t oldsid,
 	class_datum_t *tclass_datum;
 	constraint_node_t *constraint;
 
-	if (!tclass || tclass > policydb->p_classes.nprim) {
+	if (!tclass || tclass > services->policydb->p_classes.nprim) {
 		ERR(NULL, "unrecognized class %d", tclass);
 		return -EINVAL;
 	}
-	tclass_datum = policydb->class_val_to_struct[tclass - 1];
+	tclass_datum = services->policydb->class_val_to_struct[tclass - 1];
 
-	ocontext = sepol_sidtab_search(sidtab, oldsid);
+	ocontext = sepol_sidtab_search(services->sidtab, oldsid);
 	if (!ocontext) {
 		ERR(NULL, "unrecognized SID %d", oldsid);
 		return -EINVAL;
 	}
 
-	ncontext = sepol_sidtab_search(sidtab, newsid);
+	ncontext = sepol_sidtab_search(services->sidtab, newsid);
 	if (!ncontext) {
 		ERR(NULL, "unrecognized SID %d", newsid);
 		return -EINVAL;
 	}
 
-	tcontext = sepol_sidtab_search(sidtab, tasksid);
+	tcontext = sepol_sidtab_search(services->sidtab, tasksid);
 	if (!tcontext) {
 		ERR(NULL, "unrecognized SID %d", tasksid);
 		return -EINVAL;
@@ -984,8 +1614,8 @@ int hidden sepol_validate_transition(sepol_security_id_t oldsid,
 
 	constraint = tclass_datum->validatetrans;
 	while (constraint) {
-		if (!constraint_expr_eval_reason(ocontext, ncontext, tcontext,
-					  0, constraint, NULL, 0)) {
+		if (!constraint_expr_eval(ocontext, ncontext, tcontext,
+					  tclass, constraint, NULL, 0)) {
 			return -EPERM;
 		}
 		constraint = constraint->next;
@@ -1011,25 +1641,25 @@ int hidden sepol_validate_transition_reason_buffer(sepol_security_id_t oldsid,
 	class_datum_t *tclass_datum;
 	constraint_node_t *constraint;
 
-	if (!tclass || tclass > policydb->p_classes.nprim) {
+	if (!tclass || tclass > services->policydb->p_classes.nprim) {
 		ERR(NULL, "unrecognized class %d", tclass);
 		return -EINVAL;
 	}
-	tclass_datum = policydb->class_val_to_struct[tclass - 1];
+	tclass_datum = services->policydb->class_val_to_struct[tclass - 1];
 
-	ocontext = sepol_sidtab_search(sidtab, oldsid);
+	ocontext = sepol_sidtab_search(services->sidtab, oldsid);
 	if (!ocontext) {
 		ERR(NULL, "unrecognized SID %d", oldsid);
 		return -EINVAL;
 	}
 
-	ncontext = sepol_sidtab_search(sidtab, newsid);
+	ncontext = sepol_sidtab_search(services->sidtab, newsid);
 	if (!ncontext) {
 		ERR(NULL, "unrecognized SID %d", newsid);
 		return -EINVAL;
 	}
 
-	tcontext = sepol_sidtab_search(sidtab, tasksid);
+	tcontext = sepol_sidtab_search(services->sidtab, tasksid);
 	if (!tcontext) {
 		ERR(NULL, "unrecognized SID %d", tasksid);
 		return -EINVAL;
@@ -1043,11 +1673,11 @@ int hidden sepol_validate_transition_reason_buffer(sepol_security_id_t oldsid,
 	 * We just make sure these start from zero.
 	 */
 	*reason_buf = NULL;
-	reason_buf_used = 0;
-	reason_buf_len = 0;
+	services->reason_buf_used = 0;
+	services->reason_buf_len = 0;
 	constraint = tclass_datum->validatetrans;
 	while (constraint) {
-		if (!constraint_expr_eval_reason(ocontext, ncontext, tcontext,
+		if (!constraint_expr_eval(ocontext, ncontext, tcontext,
 				tclass, constraint, reason_buf, flags)) {
 			return -EPERM;
 		}
@@ -1066,13 +1696,13 @@ int hidden sepol_compute_av_reason(sepol_security_id_t ssid,
 	context_struct_t *scontext = 0, *tcontext = 0;
 	int rc = 0;
 
-	scontext = sepol_sidtab_search(sidtab, ssid);
+	scontext = sepol_sidtab_search(services->sidtab, ssid);
 	if (!scontext) {
 		ERR(NULL, "unrecognized SID %d", ssid);
 		rc = -EINVAL;
 		goto out;
 	}
-	tcontext = sepol_sidtab_search(sidtab, tsid);
+	tcontext = sepol_sidtab_search(services->sidtab, tsid);
 	if (!tcontext) {
 		ERR(NULL, "unrecognized SID %d", tsid);
 		rc = -EINVAL;
@@ -1102,13 +1732,13 @@ int hidden sepol_compute_av_reason_buffer(sepol_security_id_t ssid,
 	context_struct_t *scontext = 0, *tcontext = 0;
 	int rc = 0;
 
-	scontext = sepol_sidtab_search(sidtab, ssid);
+	scontext = sepol_sidtab_search(services->sidtab, ssid);
 	if (!scontext) {
 		ERR(NULL, "unrecognized SID %d", ssid);
 		rc = -EINVAL;
 		goto out;
 	}
-	tcontext = sepol_sidtab_search(sidtab, tsid);
+	tcontext = sepol_sidtab_search(services->sidtab, tsid);
 	if (!tcontext) {
 		ERR(NULL, "unrecognized SID %d", tsid);
 		rc = -EINVAL;
@@ -1123,8 +1753,8 @@ int hidden sepol_compute_av_reason_buffer(sepol_security_id_t ssid,
 	 * We just make sure these start from zero.
 	 */
 	*reason_buf = NULL;
-	reason_buf_used = 0;
-	reason_buf_len = 0;
+	services->reason_buf_used = 0;
+	services->reason_buf_len = 0;
 
 	rc = context_struct_compute_av(scontext, tcontext, tclass,
 					   requested, avd, reason, reason_buf, flags);
@@ -1154,7 +1784,7 @@ int hidden sepol_string_to_security_class(const char *class_name,
 	sepol_security_class_t id;
 
 	for (id = 1;; id++) {
-		class = policydb->p_class_val_to_name[id - 1];
+		class = services->policydb->p_class_val_to_name[id - 1];
 		if (class == NULL) {
 			ERR(NULL, "could not convert %s to class id", class_name);
 			return STATUS_ERR;
@@ -1177,11 +1807,11 @@ int hidden sepol_string_to_av_perm(sepol_security_class_t tclass,
 	class_datum_t *tclass_datum;
 	perm_datum_t *perm_datum;
 
-	if (!tclass || tclass > policydb->p_classes.nprim) {
+	if (!tclass || tclass > services->policydb->p_classes.nprim) {
 		ERR(NULL, "unrecognized class %d", tclass);
 		return -EINVAL;
 	}
-	tclass_datum = policydb->class_val_to_struct[tclass - 1];
+	tclass_datum = services->policydb->class_val_to_struct[tclass - 1];
 
 	/* Check for unique perms then the common ones (if any) */
 	perm_datum = (perm_datum_t *)
@@ -1222,13 +1852,13 @@ int hidden sepol_sid_to_context(sepol_security_id_t sid,
 	context_struct_t *context;
 	int rc = 0;
 
-	context = sepol_sidtab_search(sidtab, sid);
+	context = sepol_sidtab_search(services->sidtab, sid);
 	if (!context) {
 		ERR(NULL, "unrecognized SID %d", sid);
 		rc = -EINVAL;
 		goto out;
 	}
-	rc = context_to_string(NULL, policydb, context, scontext, scontext_len);
+	rc = context_to_string(NULL, services->policydb, context, scontext, scontext_len);
       out:
 	return rc;
 
@@ -1245,12 +1875,12 @@ int hidden sepol_context_to_sid(const sepol_security_context_t scontext,
 	context_struct_t *context = NULL;
 
 	/* First, create the context */
-	if (context_from_string(NULL, policydb, &context,
+	if (context_from_string(NULL, services->policydb, &context,
 				scontext, scontext_len) < 0)
 		goto err;
 
 	/* Obtain the new sid */
-	if (sid && (sepol_sidtab_context_to_sid(sidtab, context, sid) < 0))
+	if (sid && (sepol_sidtab_context_to_sid(services->sidtab, context, sid) < 0))
 		goto err;
 
 	context_destroy(context);
@@ -1281,12 +1911,12 @@ static inline int compute_sid_handle_invalid_context(context_struct_t *
 		sepol_security_context_t s, t, n;
 		size_t slen, tlen, nlen;
 
-		context_to_string(NULL, policydb, scontext, &s, &slen);
-		context_to_string(NULL, policydb, tcontext, &t, &tlen);
-		context_to_string(NULL, policydb, newcontext, &n, &nlen);
+		context_to_string(NULL, services->policydb, scontext, &s, &slen);
+		context_to_string(NULL, services->policydb, tcontext, &t, &tlen);
+		context_to_string(NULL, services->policydb, newcontext, &n, &nlen);
 		ERR(NULL, "invalid context %s for "
 		    "scontext=%s tcontext=%s tclass=%s",
-		    n, s, t, policydb->p_class_val_to_name[tclass - 1]);
+		    n, s, t, services->policydb->p_class_val_to_name[tclass - 1]);
 		free(s);
 		free(t);
 		free(n);
@@ -1306,13 +1936,13 @@ static int sepol_compute_sid(sepol_security_id_t ssid,
 	avtab_ptr_t node;
 	int rc = 0;
 
-	scontext = sepol_sidtab_search(sidtab, ssid);
+	scontext = sepol_sidtab_search(services->sidtab, ssid);
 	if (!scontext) {
 		ERR(NULL, "unrecognized SID %d", ssid);
 		rc = -EINVAL;
 		goto out;
 	}
-	tcontext = sepol_sidtab_search(sidtab, tsid);
+	tcontext = sepol_sidtab_search(services->sidtab, tsid);
 	if (!tcontext) {
 		ERR(NULL, "unrecognized SID %d", tsid);
 		rc = -EINVAL;
@@ -1353,11 +1983,11 @@ static int sepol_compute_sid(sepol_security_id_t ssid,
 	avkey.target_type = tcontext->type;
 	avkey.target_class = tclass;
 	avkey.specified = specified;
-	avdatum = avtab_search(&policydb->te_avtab, &avkey);
+	avdatum = avtab_search(&services->policydb->te_avtab, &avkey);
 
 	/* If no permanent rule, also check for enabled conditional rules */
 	if (!avdatum) {
-		node = avtab_search_node(&policydb->te_cond_avtab, &avkey);
+		node = avtab_search_node(&services->policydb->te_cond_avtab, &avkey);
 		for (; node != NULL;
 		     node = avtab_search_node_next(node, specified)) {
 			if (node->key.specified & AVTAB_ENABLED) {
@@ -1377,14 +2007,12 @@ static int sepol_compute_sid(sepol_security_id_t ssid,
 	case SECCLASS_PROCESS:
 		if (specified & AVTAB_TRANSITION) {
 			/* Look for a role transition rule. */
-			for (roletr = policydb->role_tr; roletr;
-			     roletr = roletr->next) {
-				if (roletr->role == scontext->role &&
-				    roletr->type == tcontext->type) {
-					/* Use the role transition rule. */
-					newcontext.role = roletr->new_role;
-					break;
-				}
+			roletr = trans_keys_find_role(services->policydb,
+						      scontext->role,
+						      tcontext->type, tclass);
+			if (roletr) {
+				/* Use the role transition rule. */
+				newcontext.role = roletr->new_role;
 			}
 		}
 		break;
@@ -1394,13 +2022,13 @@ static int sepol_compute_sid(sepol_security_id_t ssid,
 
 	/* Set the MLS attributes.
 	   This is done last because it may allocate memory. */
-	rc = mls_compute_sid(policydb, scontext, tcontext, tclass, specified,
+	rc = mls_compute_sid(services->policydb, scontext, tcontext, tclass, specified,
 			     &newcontext);
 	if (rc)
 		goto out;
 
 	/* Check the validity of the context. */
-	if (!policydb_context_isvalid(policydb, &newcontext)) {
+	if (!policydb_context_isvalid(services->policydb, &newcontext)) {
 		rc = compute_sid_handle_invalid_context(scontext,
 							tcontext,
 							tclass, &newcontext);
@@ -1408,7 +2036,7 @@ static int sepol_compute_sid(sepol_security_id_t ssid,
 			goto out;
 	}
 	/* Obtain the sid for the context. */
-	rc = sepol_sidtab_context_to_sid(sidtab, &newcontext, out_sid);
+	rc = sepol_sidtab_context_to_sid(services->sidtab, &newcontext, out_sid);
       out:
 	context_destroy(&newcontext);
 	return rc;
@@ -1523,31 +2151,6 @@ static int validate_class(hashtab_key_t key, hashtab_datum_t datum, void *p)
 	return 0;
 }
 
-/* Clone the SID into the new SID table. */
-static int clone_sid(sepol_security_id_t sid,
-		     context_struct_t * context, void *arg)
-{
-	sidtab_t *s = arg;
-
-	return sepol_sidtab_insert(s, sid, context);
-}
-
-static inline int convert_context_handle_invalid_context(context_struct_t *
-							 context)
-{
-	if (selinux_enforcing) {
-		return -EINVAL;
-	} else {
-		sepol_security_context_t s;
-		size_t len;
-
-		context_to_string(NULL, policydb, context, &s, &len);
-		ERR(NULL, "context %s is invalid", s);
-		free(s);
-		return 0;
-	}
-}
-
 typedef struct {
 	policydb_t *oldp;
 	policydb_t *newp;
@@ -1559,73 +2162,77 @@ typedef struct {
  * in the policy `p->oldp' to the values specified
  * in the policy `p->newp'.  Verify that the
  * context is valid under the new policy.
+ *
+ * This runs on several threads (see sepol_sidtab_convert()), so it
+ * only reads the policies and leaves the messages to
+ * convert_context_report(): it returns a negative error if the
+ * context is to be dropped, 1 if it is invalid but kept because
+ * the policy is not enforced, and 0 otherwise.
  */
 static int convert_context(sepol_security_id_t key __attribute__ ((unused)),
 			   context_struct_t * c, void *p)
 {
 	convert_context_args_t *args;
-	context_struct_t oldc;
 	role_datum_t *role;
 	type_datum_t *typdatum;
 	user_datum_t *usrdatum;
-	sepol_security_context_t s;
-	size_t len;
-	int rc = -EINVAL;
+	int rc;
 
 	args = (convert_context_args_t *) p;
 
-	if (context_cpy(&oldc, c))
-		return -ENOMEM;
-
 	/* Convert the user. */
 	usrdatum = (user_datum_t *) hashtab_search(args->newp->p_users.table,
 						   args->oldp->
 						   p_user_val_to_name[c->user -
 								      1]);
 
-	if (!usrdatum) {
-		goto bad;
-	}
+	if (!usrdatum)
+		return -EINVAL;
 	c->user = usrdatum->s.value;
 
 	/* Convert the role. */
 	role = (role_datum_t *) hashtab_search(args->newp->p_roles.table,
 					       args->oldp->
 					       p_role_val_to_name[c->role - 1]);
-	if (!role) {
-		goto bad;
-	}
+	if (!role)
+		return -EINVAL;
 	c->role = role->s.value;
 
 	/* Convert the type. */
 	typdatum = (type_datum_t *)
 	    hashtab_search(args->newp->p_types.table,
 			   args->oldp->p_type_val_to_name[c->type - 1]);
-	if (!typdatum) {
-		goto bad;
-	}
+	if (!typdatum)
+		return -EINVAL;
 	c->type = typdatum->s.value;
 
 	rc = mls_convert_context(args->oldp, args->newp, c);
 	if (rc)
-		goto bad;
+		return rc;
 
 	/* Check the validity of the new context. */
-	if (!policydb_context_isvalid(args->newp, c)) {
-		rc = convert_context_handle_invalid_context(&oldc);
-		if (rc)
-			goto bad;
-	}
+	if (!policydb_context_isvalid(args->newp, c))
+		return selinux_enforcing ? -EINVAL : 1;
 
-	context_destroy(&oldc);
 	return 0;
+}
 
-      bad:
-	context_to_string(NULL, policydb, &oldc, &s, &len);
-	context_destroy(&oldc);
-	ERR(NULL, "invalidating context %s", s);
+/* Report what convert_context() found wrong with the old context 'c'. */
+static void convert_context_report(sepol_security_id_t key
+				   __attribute__ ((unused)),
+				   context_struct_t * c, int status, void *p)
+{
+	convert_context_args_t *args = p;
+	sepol_security_context_t s;
+	size_t len;
+
+	if (context_to_string(NULL, args->oldp, c, &s, &len))
+		return;
+	if (status > 0)
+		ERR(NULL, "context %s is invalid", s);
+	else
+		ERR(NULL, "invalidating context %s", s);
 	free(s);
-	return rc;
 }
 
 /* Reading from a policy "file". */
@@ -1674,6 +2281,27 @@ size_t hidden put_entry(const void *ptr, size_t size, size_t n,
 	case PF_LEN:
 		fp->len += bytes;
 		return n;
+	case PF_USE_GROWBUF:
+		if (bytes > fp->size - fp->len) {
+			size_t newsize = fp->size ? fp->size : BUFSIZ;
+			char *newdata;
+
+			while (bytes > newsize - fp->len) {
+				if (newsize > SIZE_MAX / 2) {
+					errno = ENOMEM;
+					return 0;
+				}
+				newsize *= 2;
+			}
+			newdata = realloc(fp->data, newsize);
+			if (!newdata)
+				return 0;
+			fp->data = newdata;
+			fp->size = newsize;
+		}
+		memcpy(fp->data + fp->len, ptr, bytes);
+		fp->len += bytes;
+		return n;
 	default:
 		return 0;
 	}
@@ -1715,40 +2343,52 @@ int hidden sepol_load_policy(void *data, size_t len)
 		return -ENOMEM;
 
 	if (policydb_read(&newpolicydb, fp, 1)) {
-		policydb_destroy(&mypolicydb);
+		policydb_destroy(&services->mypolicydb);
 		return -EINVAL;
 	}
 
+	avtab_freeze(&newpolicydb.te_avtab);
+	cond_merge_avtab(&newpolicydb);
 	sepol_sidtab_init(&newsidtab);
 
 	/* Verify that the existing classes did not change. */
 	if (hashtab_map
-	    (policydb->p_classes.table, validate_class, &newpolicydb)) {
+	    (services->policydb->p_classes.table, validate_class, &newpolicydb)) {
 		ERR(NULL, "the definition of an existing class changed");
 		rc = -EINVAL;
 		goto err;
 	}
 
-	/* Clone the SID table. */
-	sepol_sidtab_shutdown(sidtab);
-	if (sepol_sidtab_map(sidtab, clone_sid, &newsidtab)) {
+	/* Build the caches the context checks would otherwise build on
+	   demand, as the conversion runs on several threads. */
+	if (services_prepare(&newpolicydb)) {
 		rc = -ENOMEM;
 		goto err;
 	}
 
-	/* Convert the internal representations of contexts 
-	   in the new SID table and remove invalid SIDs. */
-	args.oldp = policydb;
+	/* Convert the internal representations of contexts into
+	   the new SID table, leaving out invalid SIDs.  The old table
+	   stays as it was until the new one is installed. */
+	sepol_sidtab_shutdown(services->sidtab);
+	args.oldp = services->policydb;
 	args.newp = &newpolicydb;
-	sepol_sidtab_map_remove_on_error(&newsidtab, convert_context, &args);
+	if (sepol_sidtab_convert(services->sidtab, &newsidtab, convert_context,
+				 convert_context_report, &args)) {
+		rc = -ENOMEM;
+		goto err;
+	}
 
 	/* Save the old policydb and SID table to free later. */
-	memcpy(&oldpolicydb, policydb, sizeof *policydb);
-	sepol_sidtab_set(&oldsidtab, sidtab);
+	memcpy(&oldpolicydb, services->policydb, sizeof *services->policydb);
+	sepol_sidtab_set(&oldsidtab, services->sidtab);
 
 	/* Install the new policydb and SID table. */
-	memcpy(policydb, &newpolicydb, sizeof *policydb);
-	sepol_sidtab_set(sidtab, &newsidtab);
+	memcpy(services->policydb, &newpolicydb, sizeof *services->policydb);
+	sepol_sidtab_set(services->sidtab, &newsidtab);
+	avd_cache_flush();
+	ocon_index_flush();
+	type_map_flush();
+	trans_targets_flush();
 
 	/* Free the old policydb and SID table. */
 	policydb_destroy(&oldpolicydb);
@@ -1776,22 +2416,27 @@ int hidden sepol_fs_sid(char *name,
 {
 	int rc = 0;
 	ocontext_t *c;
+	struct ocon_index *idx = ocon_index_get();
 
-	c = policydb->ocontexts[OCON_FS];
-	while (c) {
-		if (strcmp(c->u.name, name) == 0)
-			break;
-		c = c->next;
+	if (idx) {
+		c = ocon_index_name(idx, OCON_FS, name);
+	} else {
+		c = services->policydb->ocontexts[OCON_FS];
+		while (c) {
+			if (strcmp(c->u.name, name) == 0)
+				break;
+			c = c->next;
+		}
 	}
 
 	if (c) {
 		if (!c->sid[0] || !c->sid[1]) {
-			rc = sepol_sidtab_context_to_sid(sidtab,
+			rc = sepol_sidtab_context_to_sid(services->sidtab,
 							 &c->context[0],
 							 &c->sid[0]);
 			if (rc)
 				goto out;
-			rc = sepol_sidtab_context_to_sid(sidtab,
+			rc = sepol_sidtab_context_to_sid(services->sidtab,
 							 &c->context[1],
 							 &c->sid[1]);
 			if (rc)
@@ -1818,19 +2463,25 @@ int hidden sepol_port_sid(uint16_t domain __attribute__ ((unused)),
 			  uint16_t port, sepol_security_id_t * out_sid)
 {
 	ocontext_t *c;
+	struct ocon_index *idx = ocon_index_get();
 	int rc = 0;
 
-	c = policydb->ocontexts[OCON_PORT];
-	while (c) {
-		if (c->u.port.protocol == protocol &&
-		    c->u.port.low_port <= port && c->u.port.high_port >= port)
-			break;
-		c = c->next;
+	if (idx) {
+		c = ocon_index_port(idx, protocol, port);
+	} else {
+		c = services->policydb->ocontexts[OCON_PORT];
+		while (c) {
+			if (c->u.port.protocol == protocol &&
+			    c->u.port.low_port <= port &&
+			    c->u.port.high_port >= port)
+				break;
+			c = c->next;
+		}
 	}
 
 	if (c) {
 		if (!c->sid[0]) {
-			rc = sepol_sidtab_context_to_sid(sidtab,
+			rc = sepol_sidtab_context_to_sid(services->sidtab,
 							 &c->context[0],
 							 &c->sid[0]);
 			if (rc)
@@ -1858,22 +2509,27 @@ int hidden sepol_netif_sid(char *name,
 {
 	int rc = 0;
 	ocontext_t *c;
+	struct ocon_index *idx = ocon_index_get();
 
-	c = policydb->ocontexts[OCON_NETIF];
-	while (c) {
-		if (strcmp(name, c->u.name) == 0)
-			break;
-		c = c->next;
+	if (idx) {
+		c = ocon_index_name(idx, OCON_NETIF, name);
+	} else {
+		c = services->policydb->ocontexts[OCON_NETIF];
+		while (c) {
+			if (strcmp(name, c->u.name) == 0)
+				break;
+			c = c->next;
+		}
 	}
 
 	if (c) {
 		if (!c->sid[0] || !c->sid[1]) {
-			rc = sepol_sidtab_context_to_sid(sidtab,
+			rc = sepol_sidtab_context_to_sid(services->sidtab,
 							 &c->context[0],
 							 &c->sid[0]);
 			if (rc)
 				goto out;
-			rc = sepol_sidtab_context_to_sid(sidtab,
+			rc = sepol_sidtab_context_to_sid(services->sidtab,
 							 &c->context[1],
 							 &c->sid[1]);
 			if (rc)
@@ -1916,6 +2572,7 @@ int hidden sepol_node_sid(uint16_t domain,
 {
 	int rc = 0;
 	ocontext_t *c;
+	struct ocon_index *idx = ocon_index_get();
 
 	switch (domain) {
 	case AF_INET:{
@@ -1928,7 +2585,11 @@ int hidden sepol_node_sid(uint16_t domain,
 
 			addr = *((uint32_t *) addrp);
 
-			c = policydb->ocontexts[OCON_NODE];
+			if (idx) {
+				c = ocon_index_node(idx, addr);
+				break;
+			}
+			c = services->policydb->ocontexts[OCON_NODE];
 			while (c) {
 				if (c->u.node.addr == (addr & c->u.node.mask))
 					break;
@@ -1943,7 +2604,11 @@ int hidden sepol_node_sid(uint16_t domain,
 			goto out;
 		}
 
-		c = policydb->ocontexts[OCON_NODE6];
+		if (idx) {
+			c = ocon_index_node6(idx, addrp);
+			break;
+		}
+		c = services->policydb->ocontexts[OCON_NODE6];
 		while (c) {
 			if (match_ipv6_addrmask(addrp, c->u.node6.addr,
 						c->u.node6.mask))
@@ -1959,7 +2624,7 @@ int hidden sepol_node_sid(uint16_t domain,
 
 	if (c) {
 		if (!c->sid[0]) {
-			rc = sepol_sidtab_context_to_sid(sidtab,
+			rc = sepol_sidtab_context_to_sid(services->sidtab,
 							 &c->context[0],
 							 &c->sid[0]);
 			if (rc)
@@ -1983,27 +2648,93 @@ int hidden sepol_node_sid(uint16_t domain,
  */
 #define SIDS_NEL 25
 
+/*
+ * Only types that some allow rule lets the caller's type transition to
+ * are worth a full access computation, and a role other than the
+ * caller's only if a role allow rule permits the change.  Both sets are
+ * found with bitmap operations before any context is built.
+ */
+static int user_sids_reachable(context_struct_t * fromcon, ebitmap_t * types)
+{
+	policydb_t *p = services->policydb;
+	ebitmap_t *targets, direct;
+	ebitmap_node_t *node;
+	struct type_map *map;
+	const uint32_t *attrs;
+	uint32_t nattrs;
+	unsigned int i;
+	int rc = -ENOMEM;
+
+	ebitmap_init(types);
+	ebitmap_init(&direct);
+	targets = trans_targets_get();
+	if (!targets)
+		return rc;
+
+	map = type_map_get();
+	if (map) {
+		attrs = type_map_attrs(map, fromcon->type - 1, &nattrs);
+		for (i = 0; i < nattrs; i++) {
+			if (ebitmap_union(&direct, &targets[attrs[i]]))
+				goto out;
+		}
+	} else {
+		ebitmap_for_each_positive_bit(&p->type_attr_map[fromcon->type - 1],
+					      node, i) {
+			if (ebitmap_union(&direct, &targets[i]))
+				goto out;
+		}
+	}
+	/* rules naming an attribute as target reach all of its types */
+	if (ebitmap_cpy(types, &direct))
+		goto out;
+	ebitmap_for_each_positive_bit(&direct, node, i) {
+		if (ebitmap_union(types, &p->attr_type_map[i]))
+			goto out;
+	}
+	rc = 0;
+
+      out:
+	ebitmap_destroy(&direct);
+	if (rc)
+		ebitmap_destroy(types);
+	return rc;
+}
+
+static int user_sids_role_allowed(uint32_t from, uint32_t to)
+{
+	struct role_allow *ra;
+
+	if (from == to)
+		return 1;
+	for (ra = services->policydb->role_allow; ra; ra = ra->next)
+		if (ra->role == from && ra->new_role == to)
+			return 1;
+	return 0;
+}
+
 int hidden sepol_get_user_sids(sepol_security_id_t fromsid,
 			       char *username,
 			       sepol_security_id_t ** sids, uint32_t * nel)
 {
 	context_struct_t *fromcon, usercon;
-	sepol_security_id_t *mysids, *mysids2, sid;
-	uint32_t mynel = 0, maxnel = SIDS_NEL;
+	sepol_security_id_t *mysids = NULL, *mysids2, sid;
+	uint32_t mynel = 0, maxnel = 0;
 	user_datum_t *user;
 	role_datum_t *role;
 	struct sepol_av_decision avd;
+	ebitmap_t reachable, candidates;
 	int rc = 0;
 	unsigned int i, j, reason;
 	ebitmap_node_t *rnode, *tnode;
 
-	fromcon = sepol_sidtab_search(sidtab, fromsid);
+	fromcon = sepol_sidtab_search(services->sidtab, fromsid);
 	if (!fromcon) {
 		rc = -EINVAL;
 		goto out;
 	}
 
-	user = (user_datum_t *) hashtab_search(policydb->p_users.table,
+	user = (user_datum_t *) hashtab_search(services->policydb->p_users.table,
 					       username);
 	if (!user) {
 		rc = -EINVAL;
@@ -2011,27 +2742,26 @@ int hidden sepol_get_user_sids(sepol_security_id_t fromsid,
 	}
 	usercon.user = user->s.value;
 
-	mysids = malloc(maxnel * sizeof(sepol_security_id_t));
-	if (!mysids) {
-		rc = -ENOMEM;
+	rc = user_sids_reachable(fromcon, &reachable);
+	if (rc)
 		goto out;
-	}
-	memset(mysids, 0, maxnel * sizeof(sepol_security_id_t));
 
-	ebitmap_for_each_bit(&user->roles.roles, rnode, i) {
-		if (!ebitmap_node_get_bit(rnode, i))
+	ebitmap_for_each_positive_bit(&user->roles.roles, rnode, i) {
+		if (!user_sids_role_allowed(fromcon->role, i + 1))
 			continue;
-		role = policydb->role_val_to_struct[i];
+		role = services->policydb->role_val_to_struct[i];
 		usercon.role = i + 1;
-		ebitmap_for_each_bit(&role->types.types, tnode, j) {
-			if (!ebitmap_node_get_bit(tnode, j))
-				continue;
+		if (ebitmap_and(&candidates, &role->types.types, &reachable)) {
+			rc = -ENOMEM;
+			goto err;
+		}
+		ebitmap_for_each_positive_bit(&candidates, tnode, j) {
 			usercon.type = j + 1;
 			if (usercon.type == fromcon->type)
 				continue;
 
 			if (mls_setup_user_range
-			    (fromcon, user, &usercon, policydb->mls))
+			    (fromcon, user, &usercon, services->policydb->mls))
 				continue;
 
 			rc = context_struct_compute_av(fromcon, &usercon,
@@ -2040,41 +2770,48 @@ int hidden sepol_get_user_sids(sepol_security_id_t fromsid,
 						       &avd, &reason, NULL, 0);
 			if (rc || !(avd.allowed & PROCESS__TRANSITION))
 				continue;
-			rc = sepol_sidtab_context_to_sid(sidtab, &usercon,
+			rc = sepol_sidtab_context_to_sid(services->sidtab, &usercon,
 							 &sid);
 			if (rc) {
-				free(mysids);
-				goto out;
+				ebitmap_destroy(&candidates);
+				goto err;
 			}
-			if (mynel < maxnel) {
-				mysids[mynel++] = sid;
-			} else {
-				maxnel += SIDS_NEL;
-				mysids2 =
-				    malloc(maxnel *
-					   sizeof(sepol_security_id_t));
-
+			if (mynel == maxnel) {
+				maxnel = maxnel ? maxnel * 2 : SIDS_NEL;
+				mysids2 = realloc(mysids, maxnel *
+						  sizeof(sepol_security_id_t));
 				if (!mysids2) {
 					rc = -ENOMEM;
-					free(mysids);
-					goto out;
+					ebitmap_destroy(&candidates);
+					goto err;
 				}
-				memset(mysids2, 0,
-				       maxnel * sizeof(sepol_security_id_t));
-				memcpy(mysids2, mysids,
-				       mynel * sizeof(sepol_security_id_t));
-				free(mysids);
 				mysids = mysids2;
-				mysids[mynel++] = sid;
 			}
+			mysids[mynel++] = sid;
 		}
+		ebitmap_destroy(&candidates);
 	}
+	ebitmap_destroy(&reachable);
 
+	if (!mysids) {
+		/* callers expect an allocation even for no SIDs */
+		mysids = calloc(SIDS_NEL, sizeof(sepol_security_id_t));
+		if (!mysids) {
+			rc = -ENOMEM;
+			goto out;
+		}
+	}
 	*sids = mysids;
 	*nel = mynel;
+	rc = 0;
 
       out:
 	return rc;
+
+      err:
+	ebitmap_destroy(&reachable);
+	free(mysids);
+	return rc;
 }
 
 /*
@@ -2092,7 +2829,7 @@ int hidden sepol_genfs_sid(const char *fstype,
 	ocontext_t *c;
 	int rc = 0, cmp = 0;
 
-	for (genfs = policydb->genfs; genfs; genfs = genfs->next) {
+	for (genfs = services->policydb->genfs; genfs; genfs = genfs->next) {
 		cmp = strcmp(fstype, genfs->fstype);
 		if (cmp <= 0)
 			break;
@@ -2118,7 +2855,7 @@ int hidden sepol_genfs_sid(const char *fstype,
 	}
 
 	if (!c->sid[0]) {
-		rc = sepol_sidtab_context_to_sid(sidtab,
+		rc = sepol_sidtab_context_to_sid(services->sidtab,
 						 &c->context[0], &c->sid[0]);
 		if (rc)
 			goto out;
@@ -2135,7 +2872,7 @@ int hidden sepol_fs_use(const char *fstype,
 	int rc = 0;
 	ocontext_t *c;
 
-	c = policydb->ocontexts[OCON_FSUSE];
+	c = services->policydb->ocontexts[OCON_FSUSE];
 	while (c) {
 		if (strcmp(fstype, c->u.name) == 0)
 			break;
@@ -2145,7 +2882,7 @@ int hidden sepol_fs_use(const char *fstype,
 	if (c) {
 		*behavior = c->v.behavior;
 		if (!c->sid[0]) {
-			rc = sepol_sidtab_context_to_sid(sidtab,
+			rc = sepol_sidtab_context_to_sid(services->sidtab,
 							 &c->context[0],
 							 &c->sid[0]);
 			if (rc)
@@ -11,27 +11,77 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <sepol/policydb/sidtab.h>
 
 #include <sepol/policydb/flask.h>
 
-#define SIDTAB_HASH(sid) \
-(sid & SIDTAB_HASH_MASK)
+#define SIDTAB_HASH(s, sid) \
+((sid) & ((s)->nslot - 1))
+
+#define SIDTAB_CHASH(s, hash) \
+((hash) & ((s)->nslot - 1))
+
+/*
+ * SIDs are looked up and allocated from several threads at once, so
+ * searching a table holds this lock shared, and adding or removing a
+ * SID or switching tables holds it exclusive.  A process has few SID
+ * tables, so they share the one lock.  Mapping, converting and
+ * destroying a table are left to a caller that has it to itself.
+ */
+static pthread_rwlock_t sidtab_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 #define INIT_SIDTAB_LOCK(s)
-#define SIDTAB_LOCK(s)
-#define SIDTAB_UNLOCK(s)
+#define SIDTAB_LOCK(s) pthread_rwlock_wrlock(&sidtab_lock)
+#define SIDTAB_READ_LOCK(s) pthread_rwlock_rdlock(&sidtab_lock)
+#define SIDTAB_UNLOCK(s) pthread_rwlock_unlock(&sidtab_lock)
 
-int sepol_sidtab_init(sidtab_t * s)
+static inline uint32_t sidtab_mix(uint32_t h, uint32_t v)
+{
+	return (h ^ v) * 0x9e3779b1;
+}
+
+static uint32_t sidtab_level_hash(uint32_t h, const mls_level_t * l)
 {
-	int i;
+	const ebitmap_node_t *n;
 
-	s->htable = malloc(sizeof(sidtab_ptr_t) * SIDTAB_SIZE);
+	h = sidtab_mix(h, l->sens);
+	for (n = l->cat.node; n; n = n->next) {
+		h = sidtab_mix(h, n->startbit);
+		h = sidtab_mix(h, (uint32_t) n->map);
+		h = sidtab_mix(h, (uint32_t) (n->map >> 32));
+	}
+	return h;
+}
+
+/* Hash every field that context_cmp() compares. */
+static uint32_t sidtab_context_hash(const context_struct_t * c)
+{
+	uint32_t h = 0;
+
+	h = sidtab_mix(h, c->user);
+	h = sidtab_mix(h, c->role);
+	h = sidtab_mix(h, c->type);
+	h = sidtab_level_hash(h, &c->range.level[0]);
+	h = sidtab_level_hash(h, &c->range.level[1]);
+	return h ^ (h >> 16);
+}
+
+int sepol_sidtab_init(sidtab_t * s)
+{
+	s->htable = calloc(SIDTAB_SIZE, sizeof(sidtab_ptr_t));
 	if (!s->htable)
 		return -ENOMEM;
-	for (i = 0; i < SIDTAB_SIZE; i++)
-		s->htable[i] = (sidtab_ptr_t) NULL;
+	s->ctable = calloc(SIDTAB_SIZE, sizeof(sidtab_ptr_t));
+	if (!s->ctable) {
+		free(s->htable);
+		s->htable = NULL;
+		return -ENOMEM;
+	}
+	s->nslot = SIDTAB_SIZE;
 	s->nel = 0;
 	s->next_sid = 1;
 	s->shutdown = 0;
@@ -39,8 +89,67 @@ int sepol_sidtab_init(sidtab_t * s)
 	return 0;
 }
 
-int sepol_sidtab_insert(sidtab_t * s, sepol_security_id_t sid,
-			context_struct_t * context)
+/*
+ * Double both tables.  A SID chain splits into the chains at i and
+ * i + nslot in its existing order, so the chains stay sorted.
+ * Failing to grow is harmless; the chains just get longer.
+ */
+static void sidtab_grow(sidtab_t * s)
+{
+	unsigned int i, n = s->nslot * 2;
+	sidtab_ptr_t *htable, *ctable, cur, next, *lo, *hi;
+
+	htable = calloc(n, sizeof(sidtab_ptr_t));
+	ctable = calloc(n, sizeof(sidtab_ptr_t));
+	if (!htable || !ctable) {
+		free(htable);
+		free(ctable);
+		return;
+	}
+
+	for (i = 0; i < s->nslot; i++) {
+		lo = &htable[i];
+		hi = &htable[i + s->nslot];
+		for (cur = s->htable[i]; cur; cur = next) {
+			next = cur->next;
+			cur->next = NULL;
+			if (cur->sid & s->nslot) {
+				*hi = cur;
+				hi = &cur->next;
+			} else {
+				*lo = cur;
+				lo = &cur->next;
+			}
+		}
+		for (cur = s->ctable[i]; cur; cur = next) {
+			next = cur->cnext;
+			cur->cnext = ctable[cur->hash & (n - 1)];
+			ctable[cur->hash & (n - 1)] = cur;
+		}
+	}
+
+	free(s->htable);
+	free(s->ctable);
+	s->htable = htable;
+	s->ctable = ctable;
+	s->nslot = n;
+}
+
+static void sidtab_unlink_context(sidtab_t * s, sidtab_node_t * node)
+{
+	sidtab_ptr_t *pprev;
+
+	for (pprev = &s->ctable[SIDTAB_CHASH(s, node->hash)]; *pprev;
+	     pprev = &(*pprev)->cnext) {
+		if (*pprev == node) {
+			*pprev = node->cnext;
+			return;
+		}
+	}
+}
+
+static int sidtab_insert(sidtab_t * s, sepol_security_id_t sid,
+			 context_struct_t * context)
 {
 	int hvalue;
 	sidtab_node_t *prev, *cur, *newnode;
@@ -48,7 +157,10 @@ int sepol_sidtab_insert(sidtab_t * s, sepol_security_id_t sid,
 	if (!s || !s->htable)
 		return -ENOMEM;
 
-	hvalue = SIDTAB_HASH(sid);
+	if (s->nel >= s->nslot && s->nslot < SIDTAB_MAX_SIZE)
+		sidtab_grow(s);
+
+	hvalue = SIDTAB_HASH(s, sid);
 	prev = NULL;
 	cur = s->htable[hvalue];
 	while (cur != NULL && sid > cur->sid) {
@@ -69,6 +181,9 @@ int sepol_sidtab_insert(sidtab_t * s, sepol_security_id_t sid,
 		free(newnode);
 		return -ENOMEM;
 	}
+	newnode->hash = sidtab_context_hash(&newnode->context);
+	newnode->cnext = s->ctable[SIDTAB_CHASH(s, newnode->hash)];
+	s->ctable[SIDTAB_CHASH(s, newnode->hash)] = newnode;
 
 	if (prev) {
 		newnode->next = prev->next;
@@ -84,7 +199,18 @@ int sepol_sidtab_insert(sidtab_t * s, sepol_security_id_t sid,
 	return 0;
 }
 
-int sepol_sidtab_remove(sidtab_t * s, sepol_security_id_t sid)
+int sepol_sidtab_insert(sidtab_t * s, sepol_security_id_t sid,
+			context_struct_t * context)
+{
+	int rc;
+
+	SIDTAB_LOCK(s);
+	rc = sidtab_insert(s, sid, context);
+	SIDTAB_UNLOCK(s);
+	return rc;
+}
+
+static int sidtab_remove(sidtab_t * s, sepol_security_id_t sid)
 {
 	int hvalue;
 	sidtab_node_t *cur, *last;
@@ -92,7 +218,7 @@ int sepol_sidtab_remove(sidtab_t * s, sepol_security_id_t sid)
 	if (!s || !s->htable)
 		return -ENOENT;
 
-	hvalue = SIDTAB_HASH(sid);
+	hvalue = SIDTAB_HASH(s, sid);
 	last = NULL;
 	cur = s->htable[hvalue];
 	while (cur != NULL && sid > cur->sid) {
@@ -107,6 +233,7 @@ int sepol_sidtab_remove(sidtab_t * s, sepol_security_id_t sid)
 		s->htable[hvalue] = cur->next;
 	else
 		last->next = cur->next;
+	sidtab_unlink_context(s, cur);
 
 	context_destroy(&cur->context);
 
@@ -115,7 +242,17 @@ int sepol_sidtab_remove(sidtab_t * s, sepol_security_id_t sid)
 	return 0;
 }
 
-context_struct_t *sepol_sidtab_search(sidtab_t * s, sepol_security_id_t sid)
+int sepol_sidtab_remove(sidtab_t * s, sepol_security_id_t sid)
+{
+	int rc;
+
+	SIDTAB_LOCK(s);
+	rc = sidtab_remove(s, sid);
+	SIDTAB_UNLOCK(s);
+	return rc;
+}
+
+static context_struct_t *sidtab_search(sidtab_t * s, sepol_security_id_t sid)
 {
 	int hvalue;
 	sidtab_node_t *cur;
@@ -123,7 +260,7 @@ context_struct_t *sepol_sidtab_search(sidtab_t * s, sepol_security_id_t sid)
 	if (!s || !s->htable)
 		return NULL;
 
-	hvalue = SIDTAB_HASH(sid);
+	hvalue = SIDTAB_HASH(s, sid);
 	cur = s->htable[hvalue];
 	while (cur != NULL && sid > cur->sid)
 		cur = cur->next;
@@ -131,7 +268,7 @@ context_struct_t *sepol_sidtab_search(sidtab_t * s, sepol_security_id_t sid)
 	if (cur == NULL || sid != cur->sid) {
 		/* Remap invalid SIDs to the unlabeled SID. */
 		sid = SECINITSID_UNLABELED;
-		hvalue = SIDTAB_HASH(sid);
+		hvalue = SIDTAB_HASH(s, sid);
 		cur = s->htable[hvalue];
 		while (cur != NULL && sid > cur->sid)
 			cur = cur->next;
@@ -142,18 +279,30 @@ context_struct_t *sepol_sidtab_search(sidtab_t * s, sepol_security_id_t sid)
 	return &cur->context;
 }
 
+/* The context stays put until its SID is removed or the table destroyed. */
+context_struct_t *sepol_sidtab_search(sidtab_t * s, sepol_security_id_t sid)
+{
+	context_struct_t *context;
+
+	SIDTAB_READ_LOCK(s);
+	context = sidtab_search(s, sid);
+	SIDTAB_UNLOCK(s);
+	return context;
+}
+
 int sepol_sidtab_map(sidtab_t * s,
 		     int (*apply) (sepol_security_id_t sid,
 				   context_struct_t * context,
 				   void *args), void *args)
 {
-	int i, ret;
+	unsigned int i;
+	int ret;
 	sidtab_node_t *cur;
 
 	if (!s || !s->htable)
 		return 0;
 
-	for (i = 0; i < SIDTAB_SIZE; i++) {
+	for (i = 0; i < s->nslot; i++) {
 		cur = s->htable[i];
 		while (cur != NULL) {
 			ret = apply(cur->sid, &cur->context, args);
@@ -170,13 +319,21 @@ void sepol_sidtab_map_remove_on_error(sidtab_t * s,
 						    context_struct_t * context,
 						    void *args), void *args)
 {
-	int i, ret;
+	unsigned int i;
+	int ret;
 	sidtab_node_t *last, *cur, *temp;
 
 	if (!s || !s->htable)
 		return;
 
-	for (i = 0; i < SIDTAB_SIZE; i++) {
+	/*
+	 * apply may rewrite the contexts it keeps, so the context
+	 * table is rebuilt from the surviving nodes as we go.
+	 */
+	for (i = 0; i < s->nslot; i++)
+		s->ctable[i] = NULL;
+
+	for (i = 0; i < s->nslot; i++) {
 		last = NULL;
 		cur = s->htable[i];
 		while (cur != NULL) {
@@ -194,6 +351,10 @@ void sepol_sidtab_map_remove_on_error(sidtab_t * s,
 				free(temp);
 				s->nel--;
 			} else {
+				cur->hash = sidtab_context_hash(&cur->context);
+				cur->cnext =
+				    s->ctable[SIDTAB_CHASH(s, cur->hash)];
+				s->ctable[SIDTAB_CHASH(s, cur->hash)] = cur;
 				last = cur;
 				cur = cur->next;
 			}
@@ -203,20 +364,241 @@ void sepol_sidtab_map_remove_on_error(sidtab_t * s,
 	return;
 }
 
+/*
+ * sepol_sidtab_convert() splits the SID slots into chunks of
+ * SIDTAB_CONVERT_CHUNK, taken in turn by up to SIDTAB_CONVERT_MAX_THREADS
+ * threads, one for every SIDTAB_CONVERT_SIDS_PER_THREAD SIDs.  A chunk
+ * fills the same slots of the new table, so the threads share nothing
+ * but the chunk counter; the context table is linked and the failures
+ * are reported afterwards, in slot order, by the calling thread.
+ */
+#define SIDTAB_CONVERT_CHUNK 64
+#define SIDTAB_CONVERT_MAX_THREADS 8
+#define SIDTAB_CONVERT_SIDS_PER_THREAD 1024
+
+struct sidtab_convert_report {
+	sepol_security_id_t sid;
+	int status;
+};
+
+struct sidtab_convert_chunk {
+	struct sidtab_convert_report *reports;
+	unsigned int nreports;
+	unsigned int nalloc;
+};
+
+struct sidtab_convert_work {
+	sidtab_t *src;
+	sidtab_t *dst;
+	int (*convert) (sepol_security_id_t sid, context_struct_t * context,
+			void *args);
+	void *args;
+	struct sidtab_convert_chunk *chunks;
+	unsigned int nchunks;
+	unsigned int next;
+	int failed;
+};
+
+static int sidtab_convert_note(struct sidtab_convert_chunk *c,
+			       sepol_security_id_t sid, int status)
+{
+	struct sidtab_convert_report *reports;
+
+	if (c->nreports == c->nalloc) {
+		c->nalloc = c->nalloc ? c->nalloc * 2 : 8;
+		reports = realloc(c->reports, c->nalloc * sizeof(*reports));
+		if (!reports)
+			return -ENOMEM;
+		c->reports = reports;
+	}
+	c->reports[c->nreports].sid = sid;
+	c->reports[c->nreports].status = status;
+	c->nreports++;
+	return 0;
+}
+
+static int sidtab_convert_chunk(struct sidtab_convert_work *w, unsigned int n)
+{
+	struct sidtab_convert_chunk *c = &w->chunks[n];
+	unsigned int i, end;
+	sidtab_node_t *cur, *node, **tail;
+	int rc;
+
+	end = (n + 1) * SIDTAB_CONVERT_CHUNK;
+	if (end > w->src->nslot)
+		end = w->src->nslot;
+
+	for (i = n * SIDTAB_CONVERT_CHUNK; i < end; i++) {
+		tail = &w->dst->htable[i];
+		for (cur = w->src->htable[i]; cur; cur = cur->next) {
+			node = malloc(sizeof(sidtab_node_t));
+			if (!node)
+				return -ENOMEM;
+			if (context_cpy(&node->context, &cur->context)) {
+				free(node);
+				return -ENOMEM;
+			}
+			rc = w->convert(cur->sid, &node->context, w->args);
+			if (rc && sidtab_convert_note(c, cur->sid, rc)) {
+				context_destroy(&node->context);
+				free(node);
+				return -ENOMEM;
+			}
+			if (rc < 0) {
+				context_destroy(&node->context);
+				free(node);
+				continue;
+			}
+			node->sid = cur->sid;
+			node->hash = sidtab_context_hash(&node->context);
+			node->next = NULL;
+			node->cnext = NULL;
+			*tail = node;
+			tail = &node->next;
+		}
+	}
+	return 0;
+}
+
+static void *sidtab_convert_worker(void *arg)
+{
+	struct sidtab_convert_work *w = arg;
+	unsigned int n;
+
+	for (;;) {
+		if (__atomic_load_n(&w->failed, __ATOMIC_RELAXED))
+			break;
+		n = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED);
+		if (n >= w->nchunks)
+			break;
+		if (sidtab_convert_chunk(w, n))
+			__atomic_store_n(&w->failed, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/*
+ * Fill the empty table 'dst' with the SIDs of 's', each with a copy of
+ * its context rewritten by 'convert'.  'convert' is called from several
+ * threads at once, so it must not change anything but the context it
+ * is given, nor report anything itself.  It returns 0 to keep the SID,
+ * a positive status to keep it and have it reported, or a negative
+ * one to drop it and have it reported.  'report' is then called on
+ * the calling thread with the SID, its unconverted context and the
+ * status.  's' is left as it was, so its lookups answer as before
+ * until the caller installs 'dst' with sepol_sidtab_set().  Returns 0
+ * on success, or -ENOMEM, in which case 'dst' still has to be
+ * destroyed.
+ */
+int sepol_sidtab_convert(sidtab_t * s, sidtab_t * dst,
+			 int (*convert) (sepol_security_id_t sid,
+					 context_struct_t * context,
+					 void *args),
+			 void (*report) (sepol_security_id_t sid,
+					 context_struct_t * context,
+					 int status, void *args), void *args)
+{
+	pthread_t threads[SIDTAB_CONVERT_MAX_THREADS];
+	struct sidtab_convert_work w;
+	struct sidtab_convert_report *r;
+	sidtab_ptr_t *htable, *ctable, cur;
+	unsigned int i, j, nthreads;
+	long ncpu;
+	int rc = -ENOMEM;
+
+	if (!s || !s->htable || !dst || !dst->htable)
+		return 0;
+
+	/* give 'dst' the slots of 's', so that SIDs keep their slot */
+	if (dst->nslot != s->nslot) {
+		htable = calloc(s->nslot, sizeof(sidtab_ptr_t));
+		ctable = calloc(s->nslot, sizeof(sidtab_ptr_t));
+		if (!htable || !ctable) {
+			free(htable);
+			free(ctable);
+			return -ENOMEM;
+		}
+		free(dst->htable);
+		free(dst->ctable);
+		dst->htable = htable;
+		dst->ctable = ctable;
+		dst->nslot = s->nslot;
+	}
+
+	memset(&w, 0, sizeof(w));
+	w.src = s;
+	w.dst = dst;
+	w.convert = convert;
+	w.args = args;
+	w.nchunks = (s->nslot + SIDTAB_CONVERT_CHUNK - 1) /
+	    SIDTAB_CONVERT_CHUNK;
+	w.chunks = calloc(w.nchunks, sizeof(*w.chunks));
+	if (!w.chunks)
+		return -ENOMEM;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = s->nel / SIDTAB_CONVERT_SIDS_PER_THREAD;
+	if (ncpu > 0 && nthreads > (unsigned long)ncpu)
+		nthreads = ncpu;
+	if (nthreads > SIDTAB_CONVERT_MAX_THREADS)
+		nthreads = SIDTAB_CONVERT_MAX_THREADS;
+	if (nthreads > w.nchunks)
+		nthreads = w.nchunks;
+
+	/* the calling thread always does its share */
+	for (i = 0; i + 1 < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, sidtab_convert_worker,
+				   &w))
+			break;
+	}
+	nthreads = i;
+	sidtab_convert_worker(&w);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (w.failed)
+		goto out;
+
+	dst->nel = 0;
+	for (i = 0; i < dst->nslot; i++) {
+		for (cur = dst->htable[i]; cur; cur = cur->next) {
+			cur->cnext = dst->ctable[SIDTAB_CHASH(dst, cur->hash)];
+			dst->ctable[SIDTAB_CHASH(dst, cur->hash)] = cur;
+			dst->nel++;
+		}
+	}
+	dst->next_sid = s->next_sid;
+
+	for (i = 0; report && i < w.nchunks; i++) {
+		for (j = 0; j < w.chunks[i].nreports; j++) {
+			r = &w.chunks[i].reports[j];
+			report(r->sid, sepol_sidtab_search(s, r->sid),
+			       r->status, args);
+		}
+	}
+	rc = 0;
+
+      out:
+	for (i = 0; i < w.nchunks; i++)
+		free(w.chunks[i].reports);
+	free(w.chunks);
+	return rc;
+}
+
 static inline sepol_security_id_t sepol_sidtab_search_context(sidtab_t * s,
 							      context_struct_t *
 							      context)
 {
-	int i;
+	uint32_t hash;
 	sidtab_node_t *cur;
 
-	for (i = 0; i < SIDTAB_SIZE; i++) {
-		cur = s->htable[i];
-		while (cur != NULL) {
-			if (context_cmp(&cur->context, context))
-				return cur->sid;
-			cur = cur->next;
-		}
+	if (!s->ctable)
+		return 0;
+
+	hash = sidtab_context_hash(context);
+	for (cur = s->ctable[SIDTAB_CHASH(s, hash)]; cur; cur = cur->cnext) {
+		if (cur->hash == hash && context_cmp(&cur->context, context))
+			return cur->sid;
 	}
 	return 0;
 }
@@ -230,7 +612,9 @@ int sepol_sidtab_context_to_sid(sidtab_t * s,
 
 	*out_sid = SEPOL_SECSID_NULL;
 
+	SIDTAB_READ_LOCK(s);
 	sid = sepol_sidtab_search_context(s, context);
+	SIDTAB_UNLOCK(s);
 	if (!sid) {
 		SIDTAB_LOCK(s);
 		/* Rescan now that we hold the lock. */
@@ -243,7 +627,7 @@ int sepol_sidtab_context_to_sid(sidtab_t * s,
 			goto unlock_out;
 		}
 		sid = s->next_sid++;
-		ret = sepol_sidtab_insert(s, sid, context);
+		ret = sidtab_insert(s, sid, context);
 		if (ret)
 			s->next_sid--;
 	      unlock_out:
@@ -259,12 +643,13 @@ int sepol_sidtab_context_to_sid(sidtab_t * s,
 
 void sepol_sidtab_hash_eval(sidtab_t * h, char *tag)
 {
-	int i, chain_len, slots_used, max_chain_len;
+	unsigned int i;
+	int chain_len, slots_used, max_chain_len;
 	sidtab_node_t *cur;
 
 	slots_used = 0;
 	max_chain_len = 0;
-	for (i = 0; i < SIDTAB_SIZE; i++) {
+	for (i = 0; i < h->nslot; i++) {
 		cur = h->htable[i];
 		if (cur) {
 			slots_used++;
@@ -281,18 +666,18 @@ void sepol_sidtab_hash_eval(sidtab_t * h, char *tag)
 
 	printf
 	    ("%s:  %d entries and %d/%d buckets used, longest chain length %d\n",
-	     tag, h->nel, slots_used, SIDTAB_SIZE, max_chain_len);
+	     tag, h->nel, slots_used, h->nslot, max_chain_len);
 }
 
 void sepol_sidtab_destroy(sidtab_t * s)
 {
-	int i;
+	unsigned int i;
 	sidtab_ptr_t cur, temp;
 
 	if (!s || !s->htable)
 		return;
 
-	for (i = 0; i < SIDTAB_SIZE; i++) {
+	for (i = 0; i < s->nslot; i++) {
 		cur = s->htable[i];
 		while (cur != NULL) {
 			temp = cur;
@@ -303,7 +688,10 @@ void sepol_sidtab_destroy(sidtab_t * s)
 		s->htable[i] = NULL;
 	}
 	free(s->htable);
+	free(s->ctable);
 	s->htable = NULL;
+	s->ctable = NULL;
+	s->nslot = 0;
 	s->nel = 0;
 	s->next_sid = 1;
 }
@@ -312,6 +700,8 @@ void sepol_sidtab_set(sidtab_t * dst, sidtab_t * src)
 {
 	SIDTAB_LOCK(src);
 	dst->htable = src->htable;
+	dst->ctable = src->ctable;
+	dst->nslot = src->nslot;
 	dst->nel = src->nel;
 	dst->next_sid = src->next_sid;
 	dst->shutdown = 0;
@@ -0,0 +1,228 @@
+/*
+ * String pool for symbol names.
+ *
+ * Names are copied into blocks that grow with the pool, and found
+ * again through an open-addressing hash of the pooled copies, so a
+ * name read or copied many times is stored once.  Blocks are only
+ * released with the pool.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strpool.h"
+
+#define STRPOOL_BLOCK_MIN	(16 * 1024)
+#define STRPOOL_BLOCK_MAX	(1024 * 1024)
+
+struct strpool_block {
+	struct strpool_block *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+struct strpool_slot {
+	char *s;		/* NULL if the slot is free */
+	uint32_t hash;
+	uint32_t len;
+};
+
+struct strpool {
+	unsigned int refs;
+	struct strpool_block *blocks;	/* newest first */
+	struct strpool_slot *slots;
+	uint32_t size;		/* power of two */
+	uint32_t count;
+};
+
+static uint32_t strpool_hash(const char *s, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+struct strpool hidden *strpool_create(void)
+{
+	struct strpool *pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	pool->size = 1024;
+	pool->slots = calloc(pool->size, sizeof(*pool->slots));
+	if (!pool->slots) {
+		free(pool);
+		return NULL;
+	}
+	pool->refs = 1;
+	return pool;
+}
+
+struct strpool hidden *strpool_get(struct strpool *pool)
+{
+	if (pool)
+		pool->refs++;
+	return pool;
+}
+
+void hidden strpool_put(struct strpool *pool)
+{
+	struct strpool_block *b, *next;
+
+	if (!pool || --pool->refs)
+		return;
+	for (b = pool->blocks; b; b = next) {
+		next = b->next;
+		free(b);
+	}
+	free(pool->slots);
+	free(pool);
+}
+
+static int strpool_grow(struct strpool *pool)
+{
+	struct strpool_slot *slots, *old = pool->slots;
+	uint32_t i, h, size = pool->size * 2;
+
+	slots = calloc(size, sizeof(*slots));
+	if (!slots)
+		return -1;
+	for (i = 0; i < pool->size; i++) {
+		if (!old[i].s)
+			continue;
+		for (h = old[i].hash & (size - 1); slots[h].s;
+		     h = (h + 1) & (size - 1)) ;
+		slots[h] = old[i];
+	}
+	free(old);
+	pool->slots = slots;
+	pool->size = size;
+	return 0;
+}
+
+static char *strpool_store(struct strpool *pool, const char *s, size_t len)
+{
+	struct strpool_block *b = pool->blocks;
+	size_t size;
+	char *copy;
+
+	if (!b || b->size - b->used < len + 1) {
+		size = b ? b->size * 2 : STRPOOL_BLOCK_MIN;
+		if (size > STRPOOL_BLOCK_MAX)
+			size = STRPOOL_BLOCK_MAX;
+		if (size < len + 1)
+			size = len + 1;
+		b = malloc(sizeof(*b) + size);
+		if (!b)
+			return NULL;
+		b->size = size;
+		b->used = 0;
+		b->next = pool->blocks;
+		pool->blocks = b;
+	}
+	copy = b->data + b->used;
+	memcpy(copy, s, len);
+	copy[len] = '\0';
+	b->used += len + 1;
+	return copy;
+}
+
+char hidden *strpool_intern(struct strpool *pool, const char *s, size_t len)
+{
+	struct strpool_slot *slot;
+	uint32_t hash, h;
+	char *copy;
+
+	if (!pool || len >= UINT32_MAX)
+		goto plain;
+	if ((pool->count + 1) * 2 > pool->size && strpool_grow(pool) < 0)
+		goto plain;
+
+	hash = strpool_hash(s, len);
+	for (h = hash & (pool->size - 1); pool->slots[h].s;
+	     h = (h + 1) & (pool->size - 1)) {
+		slot = &pool->slots[h];
+		if (slot->hash == hash && slot->len == len &&
+		    !memcmp(slot->s, s, len))
+			return slot->s;
+	}
+
+	copy = strpool_store(pool, s, len);
+	if (!copy)
+		goto plain;
+	slot = &pool->slots[h];
+	slot->s = copy;
+	slot->hash = hash;
+	slot->len = len;
+	pool->count++;
+	return copy;
+
+      plain:
+	copy = malloc(len + 1);
+	if (!copy)
+		return NULL;
+	memcpy(copy, s, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+char hidden *strpool_dup(struct strpool *pool, const char *s)
+{
+	return strpool_intern(pool, s, strlen(s));
+}
+
+int hidden strpool_contains(const struct strpool *pool, const char *s)
+{
+	const struct strpool_block *b;
+	uintptr_t p = (uintptr_t) s;
+
+	if (!pool || !s)
+		return 0;
+	for (b = pool->blocks; b; b = b->next)
+		if (p >= (uintptr_t) b->data && p < (uintptr_t) b->data + b->used)
+			return 1;
+	return 0;
+}
+
+void hidden strpool_free(struct strpool *pool, char *s)
+{
+	if (s && !strpool_contains(pool, s))
+		free(s);
+}
+
+void hidden strpool_stats(const struct strpool *pool, size_t * count,
+			  size_t * bytes)
+{
+	const struct strpool_block *b;
+
+	*count = 0;
+	*bytes = 0;
+	if (!pool)
+		return;
+	*count = pool->count;
+	*bytes = sizeof(*pool) + pool->size * sizeof(*pool->slots);
+	for (b = pool->blocks; b; b = b->next)
+		*bytes += sizeof(*b) + b->size;
+}
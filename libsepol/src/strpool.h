@@ -0,0 +1,43 @@
+#ifndef _SEPOL_INTERNAL_STRPOOL_H_
+#define _SEPOL_INTERNAL_STRPOOL_H_
+
+#include <stddef.h>
+#include "dso.h"
+
+/*
+ * A string pool holds each distinct symbol name once, in large blocks,
+ * for the global symbol tables of one or more policydbs.  Pooled names
+ * are never freed on their own: strpool_free() only frees a name that
+ * is not in the pool, so tables may mix pooled and malloc'ed keys.
+ * The pool is reference counted and goes away with its last user.
+ */
+struct strpool;
+
+/* Returns NULL if out of memory. */
+extern struct strpool *strpool_create(void);
+
+/* Take and drop a reference; both accept NULL. */
+extern struct strpool *strpool_get(struct strpool *pool);
+extern void strpool_put(struct strpool *pool);
+
+/*
+ * Return the pooled copy of the 'len' bytes at 's', adding it if
+ * needed.  Without a pool, or if it cannot grow, a malloc'ed copy is
+ * returned instead.  Returns NULL if out of memory.
+ */
+extern char *strpool_intern(struct strpool *pool, const char *s, size_t len);
+
+/* strpool_intern() of a NUL terminated string. */
+extern char *strpool_dup(struct strpool *pool, const char *s);
+
+/* Return 1 if 's' is stored in 'pool'. */
+extern int strpool_contains(const struct strpool *pool, const char *s);
+
+/* Free 's' unless it belongs to 'pool'. */
+extern void strpool_free(struct strpool *pool, char *s);
+
+/* The number of names in 'pool' and the bytes it holds. */
+extern void strpool_stats(const struct strpool *pool, size_t * count,
+			  size_t * bytes);
+
+#endif
@@ -0,0 +1,349 @@
+/*
+ * Exact-key tables for the role, range and name-based type transitions
+ * of a policydb.
+ *
+ * Each table is an open-addressing hash of the first entry for every
+ * key in a list, and remembers the head and tail of the list it was
+ * built for.  Entries added through the trans_keys_add_*() functions at
+ * either end keep the table current: one put at the head replaces the
+ * slot of its key, since it now comes first, and one put at the tail
+ * only fills an empty slot.  A table whose list changed some other way
+ * is rebuilt on the next lookup.  If a table cannot be built, the
+ * lookup walks the list instead.  A policy installed for queries has
+ * its tables built by trans_keys_build() beforehand, so that lookups
+ * from several services handles only ever read them.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "trans_keys.h"
+
+#define KEY_ROLE	0
+#define KEY_RANGE	1
+#define KEY_FILENAME	2
+#define KEY_NUM		3
+
+/* The key of any of the three kinds of entry */
+struct trans_key {
+	uint32_t v[3];
+	const char *name;
+};
+
+struct key_table {
+	void *head;		/* list head and tail the table was built for */
+	void *tail;
+	uint32_t size;		/* power of two, 0 if not built */
+	uint32_t count;
+	void **slots;
+};
+
+struct trans_keys {
+	struct key_table t[KEY_NUM];
+};
+
+static void *entry_next(int kind, const void *e)
+{
+	switch (kind) {
+	case KEY_ROLE:
+		return ((const role_trans_t *)e)->next;
+	case KEY_RANGE:
+		return ((const range_trans_t *)e)->next;
+	default:
+		return ((const filename_trans_t *)e)->next;
+	}
+}
+
+static void *list_head(const policydb_t * p, int kind)
+{
+	switch (kind) {
+	case KEY_ROLE:
+		return p->role_tr;
+	case KEY_RANGE:
+		return p->range_tr;
+	default:
+		return p->filename_trans;
+	}
+}
+
+static void entry_key(int kind, const void *e, struct trans_key *k)
+{
+	const role_trans_t *tr;
+	const range_trans_t *rt;
+	const filename_trans_t *ft;
+
+	switch (kind) {
+	case KEY_ROLE:
+		tr = e;
+		k->v[0] = tr->role;
+		k->v[1] = tr->type;
+		k->v[2] = tr->tclass;
+		k->name = NULL;
+		break;
+	case KEY_RANGE:
+		rt = e;
+		k->v[0] = rt->source_type;
+		k->v[1] = rt->target_type;
+		k->v[2] = rt->target_class;
+		k->name = NULL;
+		break;
+	default:
+		ft = e;
+		k->v[0] = ft->stype;
+		k->v[1] = ft->ttype;
+		k->v[2] = ft->tclass;
+		k->name = ft->name;
+		break;
+	}
+}
+
+static uint32_t key_hash(const struct trans_key *k)
+{
+	uint32_t h = 2166136261U;
+	const char *s;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		h ^= k->v[i];
+		h *= 16777619U;
+	}
+	if (k->name) {
+		for (s = k->name; *s; s++) {
+			h ^= (unsigned char)*s;
+			h *= 16777619U;
+		}
+	}
+	return h ^ (h >> 15);
+}
+
+static int key_equal(int kind, const void *e, const struct trans_key *k)
+{
+	struct trans_key ek;
+
+	entry_key(kind, e, &ek);
+	if (ek.v[0] != k->v[0] || ek.v[1] != k->v[1] || ek.v[2] != k->v[2])
+		return 0;
+	return !k->name || !strcmp(ek.name, k->name);
+}
+
+static void table_drop(struct key_table *t)
+{
+	free(t->slots);
+	t->slots = NULL;
+	t->size = 0;
+	t->count = 0;
+	t->head = NULL;
+	t->tail = NULL;
+}
+
+/* Place 'e' in its slot; an entry already there is replaced only
+ * if 'replace' is set.  The table must have a free slot. */
+static void table_put(struct key_table *t, int kind, void *e, int replace)
+{
+	struct trans_key k;
+	uint32_t h;
+
+	entry_key(kind, e, &k);
+	h = key_hash(&k) & (t->size - 1);
+	while (t->slots[h]) {
+		if (key_equal(kind, t->slots[h], &k)) {
+			if (replace)
+				t->slots[h] = e;
+			return;
+		}
+		h = (h + 1) & (t->size - 1);
+	}
+	t->slots[h] = e;
+	t->count++;
+}
+
+static int table_resize(struct key_table *t, int kind, uint32_t n)
+{
+	void **old = t->slots;
+	uint32_t i, oldsize = t->size, size = 16;
+
+	while (size < n * 2)
+		size <<= 1;
+	t->slots = calloc(size, sizeof(void *));
+	if (!t->slots) {
+		t->slots = old;
+		return -1;
+	}
+	t->size = size;
+	t->count = 0;
+	for (i = 0; i < oldsize; i++)
+		if (old[i])
+			table_put(t, kind, old[i], 0);
+	free(old);
+	return 0;
+}
+
+static int table_build(struct key_table *t, int kind, void *head)
+{
+	void *e, *tail = NULL;
+	uint32_t n = 0;
+
+	table_drop(t);
+	for (e = head; e; e = entry_next(kind, e))
+		n++;
+	if (table_resize(t, kind, n) < 0)
+		return -1;
+	for (e = head; e; e = entry_next(kind, e)) {
+		table_put(t, kind, e, 0);	/* an earlier entry wins */
+		tail = e;
+	}
+	t->head = head;
+	t->tail = tail;
+	return 0;
+}
+
+static int table_stale(const struct key_table *t, int kind, const void *head)
+{
+	return !t->size || t->head != head ||
+	    (t->tail && entry_next(kind, t->tail));
+}
+
+static void *keys_find(policydb_t * p, int kind, const struct trans_key *k)
+{
+	struct key_table *t;
+	void *e, *head = list_head(p, kind);
+	uint32_t h;
+
+	if (!p->trans_keys)
+		p->trans_keys = calloc(1, sizeof(struct trans_keys));
+	if (!p->trans_keys)
+		goto walk;
+	t = &p->trans_keys->t[kind];
+	if (table_stale(t, kind, head) && table_build(t, kind, head) < 0)
+		goto walk;
+
+	h = key_hash(k) & (t->size - 1);
+	while (t->slots[h]) {
+		if (key_equal(kind, t->slots[h], k))
+			return t->slots[h];
+		h = (h + 1) & (t->size - 1);
+	}
+	return NULL;
+
+      walk:
+	for (e = head; e; e = entry_next(kind, e))
+		if (key_equal(kind, e, k))
+			return e;
+	return NULL;
+}
+
+static void keys_add(policydb_t * p, int kind, void *e)
+{
+	struct key_table *t;
+	int at_head;
+
+	if (!p->trans_keys)
+		return;
+	t = &p->trans_keys->t[kind];
+	if (!t->size)
+		return;
+
+	at_head = list_head(p, kind) == e && entry_next(kind, e) == t->head;
+	if (!at_head && !(t->tail && entry_next(kind, t->tail) == e &&
+			  !entry_next(kind, e))) {
+		/* Already stale; rebuilt when next used */
+		table_drop(t);
+		return;
+	}
+	if ((t->count + 1) * 2 > t->size &&
+	    table_resize(t, kind, t->count + 1) < 0) {
+		table_drop(t);
+		return;
+	}
+	table_put(t, kind, e, at_head);
+	if (at_head)
+		t->head = e;
+	if (!at_head || !t->tail)
+		t->tail = e;
+}
+
+role_trans_t hidden *trans_keys_find_role(policydb_t * p, uint32_t role,
+					  uint32_t type, uint32_t tclass)
+{
+	struct trans_key k = { {role, type, tclass}, NULL };
+
+	return keys_find(p, KEY_ROLE, &k);
+}
+
+range_trans_t hidden *trans_keys_find_range(policydb_t * p, uint32_t stype,
+					    uint32_t ttype, uint32_t tclass)
+{
+	struct trans_key k = { {stype, ttype, tclass}, NULL };
+
+	return keys_find(p, KEY_RANGE, &k);
+}
+
+filename_trans_t hidden *trans_keys_find_filename(policydb_t * p,
+						  uint32_t stype,
+						  uint32_t ttype,
+						  uint32_t tclass,
+						  const char *name)
+{
+	struct trans_key k = { {stype, ttype, tclass}, name };
+
+	return keys_find(p, KEY_FILENAME, &k);
+}
+
+int hidden trans_keys_build(policydb_t * p)
+{
+	struct key_table *t;
+	void *head;
+	int kind;
+
+	if (!p->trans_keys)
+		p->trans_keys = calloc(1, sizeof(struct trans_keys));
+	if (!p->trans_keys)
+		return -1;
+	for (kind = 0; kind < KEY_NUM; kind++) {
+		t = &p->trans_keys->t[kind];
+		head = list_head(p, kind);
+		if (table_stale(t, kind, head) && table_build(t, kind, head) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+void hidden trans_keys_add_role(policydb_t * p, role_trans_t * tr)
+{
+	keys_add(p, KEY_ROLE, tr);
+}
+
+void hidden trans_keys_add_range(policydb_t * p, range_trans_t * rt)
+{
+	keys_add(p, KEY_RANGE, rt);
+}
+
+void hidden trans_keys_add_filename(policydb_t * p, filename_trans_t * ft)
+{
+	keys_add(p, KEY_FILENAME, ft);
+}
+
+void hidden trans_keys_destroy(struct trans_keys *keys)
+{
+	int i;
+
+	if (!keys)
+		return;
+	for (i = 0; i < KEY_NUM; i++)
+		free(keys->t[i].slots);
+	free(keys);
+}
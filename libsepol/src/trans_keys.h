@@ -0,0 +1,48 @@
+#ifndef _SEPOL_INTERNAL_TRANS_KEYS_H_
+#define _SEPOL_INTERNAL_TRANS_KEYS_H_
+
+#include <sepol/policydb/policydb.h>
+#include "dso.h"
+
+/*
+ * Exact-key lookups of role transitions (role, type, class), range
+ * transitions (source, target, class) and name-based type transitions
+ * (source, target, class, name), as done when computing a new context
+ * and when expanding rules.  The tables are kept in the policydb next to
+ * the lists, which stay the authority for the order written out, and are
+ * built on first use unless trans_keys_build() built them already.
+ * Every lookup returns the first entry with the key, as a walk of the
+ * list would.
+ */
+struct trans_keys;
+
+extern role_trans_t *trans_keys_find_role(policydb_t * p, uint32_t role,
+					  uint32_t type, uint32_t tclass);
+extern range_trans_t *trans_keys_find_range(policydb_t * p, uint32_t stype,
+					    uint32_t ttype, uint32_t tclass);
+extern filename_trans_t *trans_keys_find_filename(policydb_t * p,
+						  uint32_t stype,
+						  uint32_t ttype,
+						  uint32_t tclass,
+						  const char *name);
+
+/*
+ * Build any table not current with its list, as is done before a policy
+ * is installed for queries: lookups then never write to the policydb and
+ * may run on several threads.  Returns -1 if out of memory.
+ */
+extern int trans_keys_build(policydb_t * p);
+
+/*
+ * Tell the tables about an entry just put at the head or the tail of its
+ * list, after its key fields are set.  Any other change at either end of
+ * a list is noticed on the next lookup; entries inside a list must not
+ * be removed or rekeyed while it has a table.
+ */
+extern void trans_keys_add_role(policydb_t * p, role_trans_t * tr);
+extern void trans_keys_add_range(policydb_t * p, range_trans_t * rt);
+extern void trans_keys_add_filename(policydb_t * p, filename_trans_t * ft);
+
+extern void trans_keys_destroy(struct trans_keys *keys);
+
+#endif
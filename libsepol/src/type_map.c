@@ -0,0 +1,110 @@
+/*
+ * Packed type and attribute maps.
+ *
+ * type_attr_map and attr_type_map hold one ebitmap per type, a list of
+ * 64-bit nodes each.  Access vector computation walks two rows of
+ * type_attr_map per query, so the rows are copied here into one array
+ * of values, in the order the ebitmaps give them, with an offset array
+ * per map; a row is then a contiguous run of memory.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+
+#include "type_map.h"
+
+/* Fill 'off' for the rows of 'maps'; returns the number of values,
+ * or -1 if there are too many to index with 32 bits. */
+static int64_t rows_count(const ebitmap_t * maps, uint32_t nprim,
+			  uint32_t * off, uint64_t start)
+{
+	ebitmap_node_t *node;
+	unsigned int bit;
+	uint64_t n = start;
+	uint32_t i;
+
+	for (i = 0; i < nprim; i++) {
+		off[i] = n;
+		ebitmap_for_each_positive_bit(&maps[i], node, bit)
+			n++;
+		if (n > UINT32_MAX)
+			return -1;
+	}
+	off[nprim] = n;
+	return n - start;
+}
+
+static void rows_fill(const ebitmap_t * maps, uint32_t nprim,
+		      uint32_t * vals)
+{
+	ebitmap_node_t *node;
+	unsigned int bit;
+	uint32_t i;
+
+	for (i = 0; i < nprim; i++) {
+		ebitmap_for_each_positive_bit(&maps[i], node, bit)
+			*vals++ = bit;
+	}
+}
+
+struct type_map hidden *type_map_create(const policydb_t * p)
+{
+	struct type_map *m;
+	uint32_t nprim = p->p_types.nprim;
+	int64_t nattr, ntype;
+
+	if (!p->type_attr_map || !p->attr_type_map)
+		return NULL;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	m->src = p->type_attr_map;
+	m->nprim = nprim;
+	m->attr_off = malloc(((size_t)nprim + 1) * sizeof(uint32_t));
+	m->type_off = malloc(((size_t)nprim + 1) * sizeof(uint32_t));
+	if (!m->attr_off || !m->type_off)
+		goto err;
+
+	nattr = rows_count(p->type_attr_map, nprim, m->attr_off, 0);
+	if (nattr < 0)
+		goto err;
+	ntype = rows_count(p->attr_type_map, nprim, m->type_off, nattr);
+	if (ntype < 0)
+		goto err;
+
+	m->vals = malloc((nattr + ntype ? nattr + ntype : 1) *
+			 sizeof(uint32_t));
+	if (!m->vals)
+		goto err;
+	rows_fill(p->type_attr_map, nprim, m->vals);
+	rows_fill(p->attr_type_map, nprim, m->vals + nattr);
+	return m;
+
+      err:
+	type_map_destroy(m);
+	return NULL;
+}
+
+void hidden type_map_destroy(struct type_map *m)
+{
+	if (!m)
+		return;
+	free(m->attr_off);
+	free(m->type_off);
+	free(m->vals);
+	free(m);
+}
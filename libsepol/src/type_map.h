@@ -0,0 +1,51 @@
+#ifndef _SEPOL_INTERNAL_TYPE_MAP_H_
+#define _SEPOL_INTERNAL_TYPE_MAP_H_
+
+#include <stdint.h>
+#include <sepol/policydb/policydb.h>
+#include "dso.h"
+
+/*
+ * A packed copy of the type_attr_map and attr_type_map of a policy, for
+ * the query paths that walk them on every call.  Each row is a sorted
+ * run of 0-based values in one shared array, with 'off' giving where
+ * the rows start: row i is vals[off[i]] to vals[off[i + 1] - 1].  The
+ * ebitmaps stay the authority; a map must be rebuilt if they change.
+ */
+struct type_map {
+	const ebitmap_t *src;	/* type_attr_map it was built from */
+	uint32_t nprim;
+	uint32_t *attr_off;	/* nprim + 1 entries, for type_attr_map */
+	uint32_t *type_off;	/* nprim + 1 entries, for attr_type_map */
+	uint32_t *vals;
+};
+
+/* Build the map for 'p'.  Returns NULL if out of memory. */
+extern struct type_map *type_map_create(const policydb_t * p);
+
+extern void type_map_destroy(struct type_map *m);
+
+/* Return 1 if 'm' was built from the maps 'p' has now. */
+static inline int type_map_current(const struct type_map *m,
+				   const policydb_t * p)
+{
+	return m->src == p->type_attr_map && m->nprim == p->p_types.nprim;
+}
+
+/* The attributes of type value 'type' + 1, the type itself included. */
+static inline const uint32_t *type_map_attrs(const struct type_map *m,
+					     uint32_t type, uint32_t * n)
+{
+	*n = m->attr_off[type + 1] - m->attr_off[type];
+	return m->vals + m->attr_off[type];
+}
+
+/* The types of attribute value 'attr' + 1. */
+static inline const uint32_t *type_map_types(const struct type_map *m,
+					     uint32_t attr, uint32_t * n)
+{
+	*n = m->type_off[attr + 1] - m->type_off[attr];
+	return m->vals + m->type_off[attr];
+}
+
+#endif
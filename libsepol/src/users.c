@@ -98,15 +98,38 @@ static int user_to_record(sepol_handle_t * handle,
 	return STATUS_ERR;
 }
 
-int sepol_user_modify(sepol_handle_t * handle,
-		      sepol_policydb_t * p,
-		      const sepol_user_key_t * key, const sepol_user_t * user)
+/* Make room in the reverse lookup arrays for 'n' more users */
+static int user_reserve(policydb_t * policydb, unsigned int n)
 {
 
-	policydb_t *policydb = &p->p;
+	void *tmp_ptr;
+
+	tmp_ptr = realloc(policydb->user_val_to_struct,
+			  (policydb->p_users.nprim + n) *
+			  sizeof(user_datum_t *));
+	if (!tmp_ptr)
+		return STATUS_ERR;
+	policydb->user_val_to_struct = tmp_ptr;
+
+	tmp_ptr = realloc(policydb->sym_val_to_name[SYM_USERS],
+			  (policydb->p_users.nprim + n) * sizeof(char *));
+	if (!tmp_ptr)
+		return STATUS_ERR;
+	policydb->sym_val_to_name[SYM_USERS] = tmp_ptr;
+
+	return STATUS_SUCCESS;
+}
+
+/* Load the user 'cname'.  Unless 'reserved' is set, room
+ * is made in the reverse lookup arrays for a new user. */
+static int user_load(sepol_handle_t * handle,
+		     policydb_t * policydb,
+		     const char *cname, const sepol_user_t * user,
+		     int reserved)
+{
 
 	/* For user data */
-	const char *cname, *cmls_level, *cmls_range;
+	const char *cmls_level, *cmls_range;
 	char *name = NULL;
 
 	const char **roles = NULL;
@@ -124,8 +147,6 @@ int sepol_user_modify(sepol_handle_t * handle,
 	ebitmap_node_t *rnode;
 
 	/* First, extract all the data */
-	sepol_user_key_unpack(key, &cname);
-
 	cmls_level = sepol_user_get_mlslevel(user);
 	cmls_range = sepol_user_get_mlsrange(user);
 
@@ -225,22 +246,10 @@ int sepol_user_modify(sepol_handle_t * handle,
 
 	/* If there are no errors, and this is a new user, add the user to policy */
 	if (new) {
-		void *tmp_ptr;
 
 		/* Ensure reverse lookup array has enough space */
-		tmp_ptr = realloc(policydb->user_val_to_struct,
-				  (policydb->p_users.nprim +
-				   1) * sizeof(user_datum_t *));
-		if (!tmp_ptr)
-			goto omem;
-		policydb->user_val_to_struct = tmp_ptr;
-
-		tmp_ptr = realloc(policydb->sym_val_to_name[SYM_USERS],
-				  (policydb->p_users.nprim +
-				   1) * sizeof(char *));
-		if (!tmp_ptr)
+		if (!reserved && user_reserve(policydb, 1) < 0)
 			goto omem;
-		policydb->sym_val_to_name[SYM_USERS] = tmp_ptr;
 
 		/* Need to copy the user name */
 		name = strdup(cname);
@@ -273,7 +282,7 @@ int sepol_user_modify(sepol_handle_t * handle,
 	ERR(handle, "out of memory");
 
       err:
-	ERR(handle, "could not load %s into policy", name);
+	ERR(handle, "could not load %s into policy", cname);
 
 	free(name);
 	free(roles);
@@ -284,6 +293,45 @@ int sepol_user_modify(sepol_handle_t * handle,
 	return STATUS_ERR;
 }
 
+int sepol_user_modify(sepol_handle_t * handle,
+		      sepol_policydb_t * p,
+		      const sepol_user_key_t * key, const sepol_user_t * user)
+{
+
+	const char *cname;
+
+	sepol_user_key_unpack(key, &cname);
+	return user_load(handle, &p->p, cname, user, 0);
+}
+
+int sepol_user_modify_many(sepol_handle_t * handle,
+			   sepol_policydb_t * p,
+			   sepol_user_t * const *users, unsigned int nusers)
+{
+
+	policydb_t *policydb = &p->p;
+	unsigned int i;
+
+	/* Grow the reverse lookup arrays once, for the most
+	 * users this could add, rather than once per user */
+	if (nusers && user_reserve(policydb, nusers) < 0) {
+		ERR(handle, "out of memory");
+		goto err;
+	}
+
+	for (i = 0; i < nusers; i++) {
+		if (user_load(handle, policydb, sepol_user_get_name(users[i]),
+			      users[i], 1) < 0)
+			goto err;
+	}
+
+	return STATUS_SUCCESS;
+
+      err:
+	ERR(handle, "could not load %u users into policy", nusers);
+	return STATUS_ERR;
+}
+
 int sepol_user_exists(sepol_handle_t * handle __attribute__ ((unused)),
 		      const sepol_policydb_t * p,
 		      const sepol_user_key_t * key, int *response)
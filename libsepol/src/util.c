@@ -78,7 +78,7 @@ char *sepol_av_to_string(policydb_t * policydbp, uint32_t tclass,
 			 sepol_access_vector_t av)
 {
 	struct val_to_name v;
-	static char avbuf[1024];
+	static __thread char avbuf[1024];
 	class_datum_t *cladatum;
 	char *perm = NULL, *p;
 	unsigned int i;
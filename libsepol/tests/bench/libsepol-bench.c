@@ -0,0 +1,453 @@
+/*
+ * libsepol-bench - Time the main libsepol operations on a large
+ * synthetic policy.
+ *
+ * Generates a base policy and modules from the sizes given on the
+ * command line, then times, in order: parsing them, link_modules(),
+ * expand_module(), check_assertions(), policydb_write() to memory,
+ * policydb_read() of that image and sepol_compute_av() on random
+ * pairs of types.  Generation is deterministic for a given seed, so
+ * runs of different library versions see the same policy.
+ *
+ * The output is one line of parameters and one line per phase, as
+ * space separated key=value pairs, for scripts to compare.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <sepol/policydb/policydb.h>
+#include <sepol/policydb/link.h>
+#include <sepol/policydb/expand.h>
+#include <sepol/policydb/services.h>
+#include <sepol/debug.h>
+#include <sepol/handle.h>
+#include <sepol/sepol.h>
+
+#include "parse_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+static unsigned int ntypes = 4000;
+static unsigned int nattrs = 400;
+static unsigned int nmodules = 20;
+static unsigned int nrules = 100000;
+static unsigned int nconds = 200;
+static unsigned int nqueries = 1000000;
+static unsigned long seed = 1;
+
+/* types per module and attributes per type */
+#define MODULE_TYPES	20
+#define TYPE_ATTRS	4
+#define NEVERALLOWS	50
+
+/* class values follow the order of the class declarations below */
+#define CLASS_PROCESS	1
+#define CLASS_FILE	2
+#define CLASS_DIR	3
+
+static const char *file_perms[] = {
+	"ioctl", "read", "write", "create", "getattr", "setattr", "lock",
+	"append", "unlink", "link", "rename", "execute",
+};
+#define NFILE_PERMS (sizeof(file_perms) / sizeof(file_perms[0]))
+
+static unsigned long rnd(void)
+{
+	/* 64-bit LCG, high bits only */
+	seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (unsigned long)(seed >> 33);
+}
+
+static inline double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void quiet(void *arg __attribute__ ((unused)),
+		  sepol_handle_t * handle __attribute__ ((unused)),
+		  const char *fmt __attribute__ ((unused)), ...)
+{
+}
+
+/* A type or attribute name of the base: attributes one time in four. */
+static void print_subject(FILE * fp)
+{
+	if (rnd() % 4 == 0)
+		fprintf(fp, "a%lu", rnd() % nattrs);
+	else
+		fprintf(fp, "t%lu", rnd() % ntypes);
+}
+
+static void print_perms(FILE * fp)
+{
+	unsigned int i, n = 1 + rnd() % 4;
+
+	fprintf(fp, "{");
+	for (i = 0; i < n; i++)
+		fprintf(fp, " %s", file_perms[rnd() % NFILE_PERMS]);
+	fprintf(fp, " }");
+}
+
+static void print_rule(FILE * fp, const char *indent)
+{
+	fprintf(fp, "%sallow ", indent);
+	print_subject(fp);
+	fprintf(fp, " ");
+	print_subject(fp);
+	fprintf(fp, " : %s ", rnd() % 3 ? "file" : "dir");
+	print_perms(fp);
+	fprintf(fp, ";\n");
+}
+
+static int write_base(const char *filename)
+{
+	FILE *fp;
+	unsigned int i, j, rules;
+
+	if ((fp = fopen(filename, "w")) == NULL)
+		return -1;
+
+	fprintf(fp, "class process\nclass file\nclass dir\n");
+	fprintf(fp, "sid kernel\n");
+	fprintf(fp, "common file {");
+	for (i = 0; i < NFILE_PERMS; i++)
+		fprintf(fp, " %s", file_perms[i]);
+	fprintf(fp, " }\n");
+	fprintf(fp, "class process { transition signal fork sigchld }\n");
+	fprintf(fp, "class file inherits file\n");
+	fprintf(fp, "class dir inherits file { search add_name remove_name }\n");
+
+	for (i = 0; i < nattrs; i++)
+		fprintf(fp, "attribute a%u;\n", i);
+	/* every type is in attribute i % nattrs, which the role covers */
+	for (i = 0; i < ntypes; i++) {
+		fprintf(fp, "type t%u, a%u", i, i % nattrs);
+		for (j = 1; j < TYPE_ATTRS; j++)
+			fprintf(fp, ", a%lu", rnd() % nattrs);
+		fprintf(fp, ";\n");
+	}
+	fprintf(fp, "type bench_never_t;\n");
+
+	fprintf(fp, "role r types {");
+	for (i = 0; i < nattrs; i++)
+		fprintf(fp, " a%u", i);
+	fprintf(fp, " };\n");
+
+	/* a quarter of the rules are in conditionals */
+	rules = nrules - nrules / 4;
+	for (i = 0; i < rules; i++)
+		print_rule(fp, "");
+	for (i = 0; i < ntypes / 10; i++)
+		fprintf(fp, "type_transition t%lu t%lu : file t%lu;\n",
+			rnd() % ntypes, rnd() % ntypes, rnd() % ntypes);
+	for (i = 0; i < nconds; i++)
+		fprintf(fp, "bool b%u %s;\n", i, rnd() % 2 ? "true" : "false");
+	for (i = 0; nconds && i < nrules / 4; i++) {
+		if (i % 16 == 0)
+			fprintf(fp, "%sif (b%lu) {\n", i ? "}\n" : "",
+				rnd() % nconds);
+		print_rule(fp, "\t");
+	}
+	if (nconds && nrules / 4)
+		fprintf(fp, "}\n");
+	for (i = 0; i < NEVERALLOWS; i++)
+		fprintf(fp, "neverallow a%lu bench_never_t : file { write append };\n",
+			rnd() % nattrs);
+
+	fprintf(fp, "user u roles { r };\n");
+	fprintf(fp, "sid kernel u:r:t0\n");
+
+	if (fclose(fp) == EOF)
+		return -1;
+	return 0;
+}
+
+static int write_module(const char *filename, unsigned int m)
+{
+	FILE *fp;
+	unsigned int i;
+
+	if ((fp = fopen(filename, "w")) == NULL)
+		return -1;
+
+	fprintf(fp, "module bench_m%u 1.0;\n", m);
+	fprintf(fp, "require {\n\tclass file {");
+	for (i = 0; i < NFILE_PERMS; i++)
+		fprintf(fp, " %s", file_perms[i]);
+	fprintf(fp, " };\n\tclass dir {");
+	for (i = 0; i < NFILE_PERMS; i++)
+		fprintf(fp, " %s", file_perms[i]);
+	fprintf(fp, " };\n\trole r;\n");
+	for (i = 0; i < nattrs; i++)
+		fprintf(fp, "\tattribute a%u;\n", i);
+	fprintf(fp, "}\n");
+
+	for (i = 0; i < MODULE_TYPES; i++)
+		fprintf(fp, "type m%u_t%u, a%lu;\n", m, i, rnd() % nattrs);
+	fprintf(fp, "role r types {");
+	for (i = 0; i < MODULE_TYPES; i++)
+		fprintf(fp, " m%u_t%u", m, i);
+	fprintf(fp, " };\n");
+	for (i = 0; i < MODULE_TYPES * 10; i++) {
+		fprintf(fp, "allow m%u_t%lu a%lu : %s ", m,
+			rnd() % MODULE_TYPES, rnd() % nattrs,
+			rnd() % 3 ? "file" : "dir");
+		print_perms(fp);
+		fprintf(fp, ";\n");
+	}
+
+	if (fclose(fp) == EOF)
+		return -1;
+	return 0;
+}
+
+static int read_policy(policydb_t * p, int type, const char *filename)
+{
+	if (policydb_init(p))
+		return -1;
+	p->policy_type = type;
+	p->mls = 0;
+	if (read_source_policy(p, filename, "libsepol-bench")) {
+		policydb_destroy(p);
+		return -1;
+	}
+	return 0;
+}
+
+static void report(const char *phase, double start, const char *extra)
+{
+	printf("phase=%s seconds=%.6f%s%s\n", phase, now() - start,
+	       extra ? " " : "", extra ? extra : "");
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage:  %s [-t types] [-a attributes] [-m modules] [-r rules]\n"
+		"        [-c conditionals] [-q queries] [-s seed]\n", progname);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/libsepol-bench.XXXXXX";
+	char filename[PATH_MAX], extra[64];
+	sepol_handle_t *handle;
+	policydb_t base, out, in, **mods;
+	struct policy_file pf;
+	sepol_security_id_t *sids;
+	struct sepol_av_decision avd;
+	sepol_security_class_t tclass;
+	void *image;
+	size_t len;
+	FILE *fp;
+	unsigned int i, nsids;
+	double start;
+	int opt, rc = 1;
+
+	while ((opt = getopt(argc, argv, "t:a:m:r:c:q:s:")) > 0) {
+		switch (opt) {
+		case 't':
+			ntypes = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			nattrs = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			nmodules = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nrules = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			nconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			nqueries = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !ntypes || !nattrs)
+		usage(argv[0]);
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(filename, sizeof(filename), "%s/base.conf", dir);
+	if (write_base(filename) < 0) {
+		fprintf(stderr, "cannot write %s\n", filename);
+		goto out_dir;
+	}
+	for (i = 0; i < nmodules; i++) {
+		snprintf(filename, sizeof(filename), "%s/m%u.conf", dir, i);
+		if (write_module(filename, i) < 0) {
+			fprintf(stderr, "cannot write %s\n", filename);
+			goto out_dir;
+		}
+	}
+
+	handle = sepol_handle_create();
+	mods = calloc(nmodules ? nmodules : 1, sizeof(*mods));
+	if (!handle || !mods) {
+		fprintf(stderr, "out of memory\n");
+		goto out_dir;
+	}
+	sepol_msg_set_callback(handle, quiet, NULL);
+
+	printf("types=%u attributes=%u modules=%u rules=%u conditionals=%u "
+	       "queries=%u seed=%lu\n", ntypes, nattrs, nmodules, nrules,
+	       nconds, nqueries, seed);
+
+	start = now();
+	snprintf(filename, sizeof(filename), "%s/base.conf", dir);
+	if (read_policy(&base, POLICY_BASE, filename))
+		goto out_dir;
+	for (i = 0; i < nmodules; i++) {
+		mods[i] = malloc(sizeof(policydb_t));
+		snprintf(filename, sizeof(filename), "%s/m%u.conf", dir, i);
+		if (!mods[i] || read_policy(mods[i], POLICY_MOD, filename)) {
+			free(mods[i]);
+			nmodules = i;
+			goto out_base;
+		}
+	}
+	report("parse", start, NULL);
+
+	start = now();
+	if (link_modules(handle, &base, mods, nmodules, 0)) {
+		fprintf(stderr, "link_modules failed\n");
+		goto out_base;
+	}
+	report("link", start, NULL);
+
+	if (policydb_init(&out))
+		goto out_base;
+	start = now();
+	if (expand_module(handle, &base, &out, 0, 0)) {
+		fprintf(stderr, "expand_module failed\n");
+		goto out_out;
+	}
+	report("expand", start, NULL);
+
+	start = now();
+	if (check_assertions(handle, &out, base.global->branch_list->avrules)) {
+		fprintf(stderr, "check_assertions failed\n");
+		goto out_out;
+	}
+	report("check_assertions", start, NULL);
+
+	start = now();
+	policy_file_init(&pf);
+	pf.type = PF_LEN;
+	if (policydb_write(&out, &pf)) {
+		fprintf(stderr, "policydb_write failed\n");
+		goto out_out;
+	}
+	len = pf.len;
+	if ((image = malloc(len)) == NULL)
+		goto out_out;
+	policy_file_init(&pf);
+	pf.type = PF_USE_MEMORY;
+	pf.data = image;
+	pf.len = len;
+	if (policydb_write(&out, &pf)) {
+		fprintf(stderr, "policydb_write failed\n");
+		goto out_image;
+	}
+	snprintf(extra, sizeof(extra), "bytes=%zu", len);
+	report("write", start, extra);
+
+	start = now();
+	policy_file_init(&pf);
+	pf.type = PF_USE_MEMORY;
+	pf.data = image;
+	pf.len = len;
+	if (policydb_init(&in) || policydb_read(&in, &pf, 0)) {
+		fprintf(stderr, "policydb_read failed\n");
+		goto out_image;
+	}
+	report("read", start, NULL);
+	policydb_destroy(&in);
+
+	/* the security server reads its own copy, untimed */
+	if ((fp = fmemopen(image, len, "r")) == NULL ||
+	    sepol_set_policydb_from_file(fp)) {
+		fprintf(stderr, "cannot load the policy for queries\n");
+		if (fp)
+			fclose(fp);
+		goto out_image;
+	}
+	fclose(fp);
+
+	nsids = ntypes < 1024 ? ntypes : 1024;
+	if ((sids = malloc(nsids * sizeof(*sids))) == NULL)
+		goto out_image;
+	for (i = 0; i < nsids; i++) {
+		snprintf(filename, sizeof(filename), "u:r:t%lu",
+			 rnd() % ntypes);
+		if (sepol_context_to_sid(filename, strlen(filename) + 1,
+					 &sids[i]) < 0) {
+			fprintf(stderr, "invalid context %s\n", filename);
+			goto out_sids;
+		}
+	}
+	start = now();
+	for (i = 0; i < nqueries; i++) {
+		tclass = rnd() % 3 ? CLASS_FILE : CLASS_DIR;
+		if (i % 64 == 0)
+			tclass = CLASS_PROCESS;
+		if (sepol_compute_av(sids[rnd() % nsids], sids[rnd() % nsids],
+				     tclass, 0, &avd) < 0) {
+			fprintf(stderr, "sepol_compute_av failed\n");
+			goto out_sids;
+		}
+	}
+	snprintf(extra, sizeof(extra), "queries=%u", nqueries);
+	report("compute_av", start, extra);
+	rc = 0;
+
+      out_sids:
+	free(sids);
+      out_image:
+	free(image);
+      out_out:
+	policydb_destroy(&out);
+      out_base:
+	for (i = 0; i < nmodules; i++) {
+		policydb_destroy(mods[i]);
+		free(mods[i]);
+	}
+	policydb_destroy(&base);
+      out_dir:
+	snprintf(filename, sizeof(filename), "rm -rf %s", dir);
+	if (system(filename) != 0)
+		fprintf(stderr, "cannot remove %s\n", dir);
+	return rc;
+}
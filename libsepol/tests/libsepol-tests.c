@@ -23,6 +23,12 @@
 #include "test-expander.h"
 #include "test-deps.h"
 #include "test-downgrade.h"
+#include "test-ebitmap.h"
+#include "test-genbools.h"
+#include "test-neverallow.h"
+#include "test-sidtab.h"
+#include "test-strpool.h"
+#include "test-trans-keys.h"
 
 #include <CUnit/Basic.h>
 #include <CUnit/Console.h>
@@ -63,6 +69,12 @@ static int do_tests(int interactive, int verbose)
 	DECLARE_SUITE(expander);
 	DECLARE_SUITE(deps);
 	DECLARE_SUITE(downgrade);
+	DECLARE_SUITE(ebitmap);
+	DECLARE_SUITE(genbools);
+	DECLARE_SUITE(neverallow);
+	DECLARE_SUITE(sidtab);
+	DECLARE_SUITE(strpool);
+	DECLARE_SUITE(trans_keys);
 
 	if (verbose)
 		CU_basic_set_mode(CU_BRM_VERBOSE);
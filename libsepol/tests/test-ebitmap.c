@@ -0,0 +1,507 @@
+/*
+ * Tests for the ebitmap set operations and for building and reading
+ * ebitmaps a word at a time.
+ *
+ * Each set operation is run on every pair of a few fixed bitmaps and its
+ * result compared with one built bit by bit from ebitmap_get_bit() on
+ * the operands, so that a word-at-a-time operation must produce the
+ * same nodes and high bit as the naive one.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "test-ebitmap.h"
+
+#include <sepol/policydb/ebitmap.h>
+#include <sepol/policydb/policydb.h>
+
+#include <errno.h>
+#include <stdio.h>
+
+/* above every bit set in the bitmaps below */
+#define TEST_LIMIT 1152
+
+struct bit_range {
+	unsigned int lo, hi;	/* bits lo up to but not including hi */
+};
+
+/* The ranges of each bitmap, ending with an empty range. */
+static const struct bit_range bitmap_ranges[][6] = {
+	/* empty */
+	{{0, 0}},
+	/* a single node filled up to the MAPSIZE boundary */
+	{{0, 2}, {63, 64}, {0, 0}},
+	/* single bits with gaps between the nodes */
+	{{5, 6}, {64, 65}, {200, 201}, {1000, 1001}, {1023, 1024}, {0, 0}},
+	/* bits either side of two MAPSIZE boundaries */
+	{{63, 65}, {127, 129}, {0, 0}},
+	/* three full nodes */
+	{{0, 192}, {0, 0}},
+	/* one full node above all the others */
+	{{1024, 1088}, {0, 0}},
+};
+
+#define NUM_BITMAPS (sizeof(bitmap_ranges) / sizeof(bitmap_ranges[0]))
+
+static ebitmap_t bitmaps[NUM_BITMAPS];
+
+static const unsigned int maxbits[] = {
+	0, 1, 63, 64, 65, 127, 128, 129, 1024, TEST_LIMIT
+};
+
+#define NUM_MAXBITS (sizeof(maxbits) / sizeof(maxbits[0]))
+
+enum bit_op { OP_AND, OP_XOR, OP_NOT, OP_ANDNOT };
+
+int ebitmap_test_init(void)
+{
+	const struct bit_range *r;
+	unsigned int i, bit;
+
+	for (i = 0; i < NUM_BITMAPS; i++) {
+		ebitmap_init(&bitmaps[i]);
+		for (r = bitmap_ranges[i]; r->hi; r++) {
+			for (bit = r->lo; bit < r->hi; bit++) {
+				if (ebitmap_set_bit(&bitmaps[i], bit, 1)) {
+					fprintf(stderr, "out of memory!\n");
+					return -1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+int ebitmap_test_cleanup(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_BITMAPS; i++)
+		ebitmap_destroy(&bitmaps[i]);
+	return 0;
+}
+
+/* Build in expected the result of op on e1 and e2 one bit at a time. */
+static int expect_bits(ebitmap_t * expected, enum bit_op op,
+		       const ebitmap_t * e1, const ebitmap_t * e2,
+		       unsigned int maxbit)
+{
+	unsigned int bit;
+	int b1, b2, set;
+
+	ebitmap_init(expected);
+	for (bit = 0; bit < TEST_LIMIT; bit++) {
+		b1 = ebitmap_get_bit(e1, bit);
+		b2 = ebitmap_get_bit(e2, bit);
+		switch (op) {
+		case OP_AND:
+			set = b1 && b2;
+			break;
+		case OP_XOR:
+			set = b1 != b2;
+			break;
+		case OP_NOT:
+			set = !b1 && bit < maxbit;
+			break;
+		default:
+			set = b1 && !b2 && bit < maxbit;
+			break;
+		}
+		if (set && ebitmap_set_bit(expected, bit, 1))
+			return -1;
+	}
+	return 0;
+}
+
+static void check_op(enum bit_op op, ebitmap_t * e1, ebitmap_t * e2,
+		     unsigned int maxbit)
+{
+	ebitmap_t result, expected;
+	int rc;
+
+	switch (op) {
+	case OP_AND:
+		rc = ebitmap_and(&result, e1, e2);
+		break;
+	case OP_XOR:
+		rc = ebitmap_xor(&result, e1, e2);
+		break;
+	case OP_NOT:
+		rc = ebitmap_not(&result, e1, maxbit);
+		break;
+	default:
+		rc = ebitmap_andnot(&result, e1, e2, maxbit);
+		break;
+	}
+	CU_ASSERT_FATAL(rc == 0);
+	CU_ASSERT_FATAL(expect_bits(&expected, op, e1, e2, maxbit) == 0);
+
+	CU_ASSERT(ebitmap_cmp(&result, &expected));
+
+	ebitmap_destroy(&result);
+	ebitmap_destroy(&expected);
+}
+
+static void test_ebitmap_and(void)
+{
+	ebitmap_t result;
+	unsigned int i, j;
+
+	for (i = 0; i < NUM_BITMAPS; i++)
+		for (j = 0; j < NUM_BITMAPS; j++)
+			check_op(OP_AND, &bitmaps[i], &bitmaps[j], 0);
+
+	/* only bit 63 is common, so the result ends at the first boundary */
+	CU_ASSERT_FATAL(ebitmap_and(&result, &bitmaps[1], &bitmaps[3]) == 0);
+	CU_ASSERT(ebitmap_cardinality(&result) == 1);
+	CU_ASSERT(ebitmap_get_bit(&result, 63));
+	CU_ASSERT(ebitmap_length(&result) == MAPSIZE);
+	ebitmap_destroy(&result);
+
+	/* disjoint nodes leave nothing, not empty nodes */
+	CU_ASSERT_FATAL(ebitmap_and(&result, &bitmaps[4], &bitmaps[5]) == 0);
+	CU_ASSERT(result.node == NULL);
+	CU_ASSERT(ebitmap_length(&result) == 0);
+	ebitmap_destroy(&result);
+}
+
+static void test_ebitmap_xor(void)
+{
+	ebitmap_t result;
+	unsigned int i, j;
+
+	for (i = 0; i < NUM_BITMAPS; i++)
+		for (j = 0; j < NUM_BITMAPS; j++)
+			check_op(OP_XOR, &bitmaps[i], &bitmaps[j], 0);
+
+	/* a bitmap with itself cancels out entirely */
+	for (i = 0; i < NUM_BITMAPS; i++) {
+		CU_ASSERT_FATAL(ebitmap_xor(&result, &bitmaps[i],
+					    &bitmaps[i]) == 0);
+		CU_ASSERT(result.node == NULL);
+		CU_ASSERT(ebitmap_length(&result) == 0);
+		ebitmap_destroy(&result);
+	}
+}
+
+static void test_ebitmap_not(void)
+{
+	ebitmap_t result;
+	unsigned int i, j;
+
+	for (i = 0; i < NUM_BITMAPS; i++)
+		for (j = 0; j < NUM_MAXBITS; j++)
+			check_op(OP_NOT, &bitmaps[i], &bitmaps[0], maxbits[j]);
+
+	/* the complement of three full nodes is empty up to their end */
+	CU_ASSERT_FATAL(ebitmap_not(&result, &bitmaps[4], 3 * MAPSIZE) == 0);
+	CU_ASSERT(result.node == NULL);
+	ebitmap_destroy(&result);
+
+	/* and one node long just past it */
+	CU_ASSERT_FATAL(ebitmap_not(&result, &bitmaps[4],
+				    3 * MAPSIZE + 1) == 0);
+	CU_ASSERT(ebitmap_cardinality(&result) == 1);
+	CU_ASSERT(ebitmap_length(&result) == 4 * MAPSIZE);
+	ebitmap_destroy(&result);
+}
+
+static void test_ebitmap_andnot(void)
+{
+	unsigned int i, j, k;
+
+	for (i = 0; i < NUM_BITMAPS; i++)
+		for (j = 0; j < NUM_BITMAPS; j++)
+			for (k = 0; k < NUM_MAXBITS; k++)
+				check_op(OP_ANDNOT, &bitmaps[i], &bitmaps[j],
+					 maxbits[k]);
+}
+
+static void test_ebitmap_cardinality(void)
+{
+	const struct bit_range *r;
+	unsigned int i, count;
+
+	for (i = 0; i < NUM_BITMAPS; i++) {
+		count = 0;
+		for (r = bitmap_ranges[i]; r->hi; r++)
+			count += r->hi - r->lo;
+		CU_ASSERT(ebitmap_cardinality(&bitmaps[i]) == count);
+	}
+}
+
+static void test_ebitmap_hamming_distance(void)
+{
+	unsigned int i, j, bit;
+	int distance;
+
+	for (i = 0; i < NUM_BITMAPS; i++) {
+		for (j = 0; j < NUM_BITMAPS; j++) {
+			distance = 0;
+			for (bit = 0; bit < TEST_LIMIT; bit++)
+				if (ebitmap_get_bit(&bitmaps[i], bit) !=
+				    ebitmap_get_bit(&bitmaps[j], bit))
+					distance++;
+			CU_ASSERT(ebitmap_hamming_distance(&bitmaps[i],
+							   &bitmaps[j]) ==
+				  distance);
+		}
+	}
+}
+
+/* enough nodes for ebitmap_read() to take three chunks */
+#define MANY_NODES 70
+
+#define IMAGE_HEADER_SIZE (3 * sizeof(uint32_t))
+#define IMAGE_RECORD_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+
+static char image[IMAGE_HEADER_SIZE + MANY_NODES * IMAGE_RECORD_SIZE];
+
+static void put_le(char *p, uint64_t v, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++, v >>= 8)
+		p[i] = (char)(v & 0xff);
+}
+
+static size_t image_header(uint32_t mapsize, uint32_t highbit,
+			   uint32_t count)
+{
+	put_le(image, mapsize, sizeof(uint32_t));
+	put_le(image + sizeof(uint32_t), highbit, sizeof(uint32_t));
+	put_le(image + 2 * sizeof(uint32_t), count, sizeof(uint32_t));
+	return IMAGE_HEADER_SIZE;
+}
+
+static size_t image_record(unsigned int i, uint32_t startbit, uint64_t map)
+{
+	char *p = image + IMAGE_HEADER_SIZE + i * IMAGE_RECORD_SIZE;
+
+	put_le(p, startbit, sizeof(uint32_t));
+	put_le(p + sizeof(uint32_t), map, sizeof(uint64_t));
+	return IMAGE_RECORD_SIZE;
+}
+
+/* Write e to image in the binary policy format, returning its length. */
+static size_t image_write(const ebitmap_t * e)
+{
+	ebitmap_node_t *n;
+	size_t len;
+	uint32_t count = 0;
+
+	len = IMAGE_HEADER_SIZE;
+	for (n = e->node; n; n = n->next)
+		len += image_record(count++, n->startbit, n->map);
+	image_header(MAPSIZE, e->highbit, count);
+	return len;
+}
+
+static int image_read(ebitmap_t * e, size_t len)
+{
+	struct policy_file pf;
+
+	policy_file_init(&pf);
+	pf.type = PF_USE_MEMORY;
+	pf.data = image;
+	pf.len = len;
+	return ebitmap_read(e, &pf);
+}
+
+/* Set one bit in each of count nodes spaced two words apart. */
+static int build_many(ebitmap_t * e, unsigned int count)
+{
+	unsigned int i;
+
+	ebitmap_init(e);
+	for (i = 0; i < count; i++)
+		if (ebitmap_set_bit(e, i * 2 * MAPSIZE + i % MAPSIZE, 1))
+			return -1;
+	return 0;
+}
+
+static void check_round_trip(const ebitmap_t * e)
+{
+	ebitmap_t read;
+
+	CU_ASSERT_FATAL(image_read(&read, image_write(e)) == 0);
+	CU_ASSERT(ebitmap_cmp(&read, e));
+	ebitmap_destroy(&read);
+}
+
+static void test_ebitmap_read(void)
+{
+	ebitmap_t e;
+	unsigned int i;
+	/* node counts either side of the chunk size and over two chunks */
+	static const unsigned int counts[] = { 31, 32, 33, 64, MANY_NODES };
+
+	for (i = 0; i < NUM_BITMAPS; i++)
+		check_round_trip(&bitmaps[i]);
+
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		CU_ASSERT_FATAL(build_many(&e, counts[i]) == 0);
+		check_round_trip(&e);
+		ebitmap_destroy(&e);
+	}
+}
+
+enum bad_record { BAD_DUPLICATE, BAD_ORDER, BAD_ALIGN, BAD_NULL, BAD_HIGH };
+
+/*
+ * Write MANY_NODES records with the one at pos made bad, and check
+ * that the image is refused.
+ */
+static void check_bad_record(enum bad_record bad, unsigned int pos)
+{
+	ebitmap_t e;
+	size_t len;
+	uint32_t highbit = MANY_NODES * MAPSIZE;
+	unsigned int i;
+
+	len = image_header(MAPSIZE, highbit, MANY_NODES);
+	for (i = 0; i < MANY_NODES; i++)
+		len += image_record(i, i * MAPSIZE, MAPBIT);
+
+	switch (bad) {
+	case BAD_DUPLICATE:
+		image_record(pos, (pos - 1) * MAPSIZE, MAPBIT << 1);
+		break;
+	case BAD_ORDER:
+		image_record(pos - 1, pos * MAPSIZE, MAPBIT);
+		image_record(pos, (pos - 1) * MAPSIZE, MAPBIT);
+		break;
+	case BAD_ALIGN:
+		image_record(pos, pos * MAPSIZE + 1, MAPBIT);
+		break;
+	case BAD_NULL:
+		image_record(pos, pos * MAPSIZE, 0);
+		break;
+	default:
+		image_record(pos, highbit, MAPBIT);
+		break;
+	}
+
+	CU_ASSERT(image_read(&e, len) < 0);
+	CU_ASSERT(e.node == NULL);
+}
+
+static void test_ebitmap_read_bad(void)
+{
+	ebitmap_t e;
+	size_t len;
+	unsigned int bad, i;
+	/* in the first chunk, first of the second chunk and within it */
+	static const unsigned int positions[] = { 1, 32, 40 };
+
+	for (bad = BAD_DUPLICATE; bad <= BAD_HIGH; bad++)
+		for (i = 0; i < sizeof(positions) / sizeof(positions[0]); i++)
+			check_bad_record(bad, positions[i]);
+
+	/* more nodes than fit below the high bit */
+	len = image_header(MAPSIZE, 2 * MAPSIZE, 3);
+	for (i = 0; i < 3; i++)
+		len += image_record(i, i * MAPSIZE, MAPBIT);
+	CU_ASSERT(image_read(&e, len) < 0);
+
+	/* a map size other than ours */
+	len = image_header(32, MAPSIZE, 1);
+	len += image_record(0, 0, MAPBIT);
+	CU_ASSERT(image_read(&e, len) < 0);
+
+	/* a record cut short in the last chunk */
+	CU_ASSERT_FATAL(build_many(&e, MANY_NODES) == 0);
+	len = image_write(&e);
+	ebitmap_destroy(&e);
+	CU_ASSERT(image_read(&e, len - 1) < 0);
+	CU_ASSERT(e.node == NULL);
+}
+
+static void test_ebitmap_append(void)
+{
+	ebitmap_t e;
+	ebitmap_node_t *n, *tail;
+	unsigned int i;
+
+	/* rebuilding each bitmap a word at a time, after an empty word */
+	for (i = 0; i < NUM_BITMAPS; i++) {
+		ebitmap_init(&e);
+		tail = NULL;
+		CU_ASSERT(ebitmap_append(&e, &tail, 0, 0) == 0);
+		for (n = bitmaps[i].node; n; n = n->next)
+			CU_ASSERT(ebitmap_append(&e, &tail, n->startbit,
+						 n->map) == 0);
+		CU_ASSERT(ebitmap_cmp(&e, &bitmaps[i]));
+		ebitmap_destroy(&e);
+	}
+
+	/* out of order, overlapping and unaligned words are refused */
+	ebitmap_init(&e);
+	tail = NULL;
+	CU_ASSERT_FATAL(ebitmap_append(&e, &tail, 2 * MAPSIZE, MAPBIT) == 0);
+	CU_ASSERT(ebitmap_append(&e, &tail, MAPSIZE, MAPBIT) == -EINVAL);
+	CU_ASSERT(ebitmap_append(&e, &tail, 2 * MAPSIZE, MAPBIT << 1) ==
+		  -EINVAL);
+	CU_ASSERT(ebitmap_append(&e, &tail, 3 * MAPSIZE + 1, MAPBIT) ==
+		  -EINVAL);
+	CU_ASSERT(e.node == tail && !tail->next);
+	CU_ASSERT(ebitmap_cardinality(&e) == 1);
+	CU_ASSERT(ebitmap_length(&e) == 3 * MAPSIZE);
+	ebitmap_destroy(&e);
+}
+
+int ebitmap_add_tests(CU_pSuite suite)
+{
+	if (NULL == CU_add_test(suite, "ebitmap_and", test_ebitmap_and)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "ebitmap_xor", test_ebitmap_xor)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "ebitmap_not", test_ebitmap_not)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "ebitmap_andnot", test_ebitmap_andnot)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "ebitmap_cardinality",
+				test_ebitmap_cardinality)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "ebitmap_hamming_distance",
+				test_ebitmap_hamming_distance)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "ebitmap_read", test_ebitmap_read)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "ebitmap_read_bad",
+				test_ebitmap_read_bad)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "ebitmap_append", test_ebitmap_append)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	return 0;
+}
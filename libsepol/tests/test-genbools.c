@@ -0,0 +1,315 @@
+/*
+ * Tests for setting the booleans of a binary policy.
+ *
+ * sepol_genbools() and sepol_genbools_array() patch the states in the
+ * image itself.  Each is compared byte for byte with what the old way
+ * of doing it writes: decoding the whole image, setting the booleans,
+ * evaluating the conditionals and encoding it again.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "test-genbools.h"
+#include "helpers.h"
+
+#include <sepol/booleans.h>
+#include <sepol/policydb/policydb.h>
+#include <sepol/policydb/link.h>
+#include <sepol/policydb/expand.h>
+#include <sepol/policydb/conditional.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern int mls;
+
+#define NO_SUCH_BOOLEAN "no_such_boolean"
+
+static policydb_t basemod;
+static policydb_t base_expanded;
+
+/* the policy as a kernel image, written once and read back so that
+ * encoding it again gives the same bytes */
+static void *image;
+static size_t image_len;
+
+/*
+ * Set the named booleans the old way, on a copy of image, and return
+ * the copy.  Names the policy lacks are left out, as is any value other
+ * than 0 or 1.
+ */
+static void *old_genbools(char **names, int *values, int nel)
+{
+	policydb_t p;
+	cond_bool_datum_t *datum;
+	void *data;
+	size_t len;
+	int i;
+
+	if (policydb_init(&p))
+		return NULL;
+	if (policydb_from_image(NULL, image, image_len, &p) < 0)
+		return NULL;
+	for (i = 0; i < nel; i++) {
+		datum = hashtab_search(p.p_bools.table, names[i]);
+		if (datum && (values[i] == 0 || values[i] == 1))
+			datum->state = values[i];
+	}
+	data = NULL;
+	if (evaluate_conds(&p) < 0 ||
+	    policydb_to_image(NULL, &p, &data, &len) < 0 || len != image_len) {
+		free(data);
+		data = NULL;
+	}
+	policydb_destroy(&p);
+	return data;
+}
+
+static void *image_copy(void)
+{
+	void *data = malloc(image_len);
+
+	if (data)
+		memcpy(data, image, image_len);
+	return data;
+}
+
+int genbools_test_init(void)
+{
+	void *data;
+
+	if (policydb_init(&base_expanded)) {
+		fprintf(stderr, "out of memory!\n");
+		return -1;
+	}
+
+	if (test_load_policy(&basemod, POLICY_BASE, mls, "test-cond", "refpolicy-base.conf"))
+		goto cleanup;
+
+	if (link_modules(NULL, &basemod, NULL, 0, 0)) {
+		fprintf(stderr, "link modules failed\n");
+		goto cleanup;
+	}
+
+	if (expand_module(NULL, &basemod, &base_expanded, 0, 1)) {
+		fprintf(stderr, "expand module failed\n");
+		goto cleanup;
+	}
+
+	if (policydb_to_image(NULL, &base_expanded, &image, &image_len)) {
+		fprintf(stderr, "write policy failed\n");
+		goto cleanup;
+	}
+
+	data = old_genbools(NULL, NULL, 0);
+	if (!data) {
+		fprintf(stderr, "rewrite policy failed\n");
+		goto cleanup;
+	}
+	free(image);
+	image = data;
+
+	return 0;
+
+      cleanup:
+	policydb_destroy(&basemod);
+	policydb_destroy(&base_expanded);
+	free(image);
+	image = NULL;
+	return -1;
+}
+
+int genbools_test_cleanup(void)
+{
+	policydb_destroy(&basemod);
+	policydb_destroy(&base_expanded);
+	free(image);
+	image = NULL;
+
+	return 0;
+}
+
+/* Set the booleans both ways and compare the images. */
+static void check_genbools_array(char **names, int *values, int nel,
+				 int errors)
+{
+	void *data, *expected;
+
+	data = image_copy();
+	expected = old_genbools(names, values, nel);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+
+	errno = 0;
+	if (errors) {
+		CU_ASSERT(sepol_genbools_array(data, image_len, names, values,
+					       nel) == -1);
+		CU_ASSERT(errno == EINVAL);
+	} else {
+		CU_ASSERT(sepol_genbools_array(data, image_len, names, values,
+					       nel) == 0);
+	}
+	CU_ASSERT(memcmp(data, expected, image_len) == 0);
+
+	free(data);
+	free(expected);
+}
+
+static void test_genbools_array(void)
+{
+	char **names;
+	int *values;
+	uint32_t i, nel = base_expanded.p_bools.nprim;
+	unsigned int pattern, seed = 1;
+
+	CU_ASSERT_FATAL(nel > 0);
+	names = calloc(nel, sizeof(char *));
+	values = calloc(nel, sizeof(int));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(names);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(values);
+	for (i = 0; i < nel; i++)
+		names[i] = base_expanded.p_bool_val_to_name[i];
+
+	/* all off, all on, alternating and a few random settings */
+	for (pattern = 0; pattern < 8; pattern++) {
+		for (i = 0; i < nel; i++) {
+			seed = seed * 1103515245 + 12345;
+			switch (pattern) {
+			case 0:
+				values[i] = 0;
+				break;
+			case 1:
+				values[i] = 1;
+				break;
+			case 2:
+				values[i] = i & 1;
+				break;
+			default:
+				values[i] = (seed >> 16) & 1;
+				break;
+			}
+		}
+		check_genbools_array(names, values, nel, 0);
+	}
+
+	/* some of the booleans, and none at all */
+	check_genbools_array(names, values, nel / 2, 0);
+	check_genbools_array(names, values, 0, 0);
+
+	free(names);
+	free(values);
+}
+
+static void test_genbools_array_unknown(void)
+{
+	char *names[4];
+	int values[4];
+	int i;
+
+	CU_ASSERT_FATAL(base_expanded.p_bools.nprim >= 3);
+	for (i = 0; i < 3; i++) {
+		names[i] = base_expanded.p_bool_val_to_name[i];
+		values[i] = !base_expanded.bool_val_to_struct[i]->state;
+	}
+
+	/* the known booleans are still set, but the call fails */
+	names[3] = NO_SUCH_BOOLEAN;
+	values[3] = 1;
+	check_genbools_array(names, values, 4, 1);
+
+	names[3] = NO_SUCH_BOOLEAN;
+	check_genbools_array(&names[3], &values[3], 1, 1);
+
+	/* as it does for a value that is not a boolean one */
+	values[1] = 2;
+	check_genbools_array(names, values, 3, 1);
+}
+
+/* Write the settings to a booleans file and set them from it. */
+static void check_genbools_file(char **names, int *values, int nel)
+{
+	char path[] = "/tmp/test-genbools.XXXXXX";
+	void *data, *expected;
+	FILE *f;
+	int fd, i;
+
+	fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+	f = fdopen(fd, "w");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+	for (i = 0; i < nel; i++)
+		fprintf(f, i & 1 ? "%s = %s\n" : "%s=%s\n", names[i],
+			values[i] ? "true" : "0");
+	fclose(f);
+
+	data = image_copy();
+	expected = old_genbools(names, values, nel);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+
+	CU_ASSERT(sepol_genbools(data, image_len, path) == 0);
+	CU_ASSERT(memcmp(data, expected, image_len) == 0);
+
+	unlink(path);
+	free(data);
+	free(expected);
+}
+
+static void test_genbools_file(void)
+{
+	char *names[4];
+	int values[4];
+	int i;
+
+	CU_ASSERT_FATAL(base_expanded.p_bools.nprim >= 3);
+	for (i = 0; i < 3; i++) {
+		names[i] = base_expanded.p_bool_val_to_name[i];
+		values[i] = base_expanded.bool_val_to_struct[i]->state;
+	}
+
+	/* no change leaves the image as it was */
+	check_genbools_file(names, values, 3);
+
+	for (i = 0; i < 3; i++)
+		values[i] = !values[i];
+	check_genbools_file(names, values, 3);
+
+	/* an unknown boolean is skipped and the rest still set */
+	names[3] = NO_SUCH_BOOLEAN;
+	values[3] = 1;
+	values[0] = !values[0];
+	check_genbools_file(names, values, 4);
+}
+
+int genbools_add_tests(CU_pSuite suite)
+{
+	if (NULL == CU_add_test(suite, "genbools_array", test_genbools_array)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "genbools_array_unknown",
+				test_genbools_array_unknown)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "genbools_file", test_genbools_file)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	return 0;
+}
@@ -53,6 +53,7 @@ const char *policies[NUM_POLICIES] = {
 
 static policydb_t basenomods;
 static policydb_t linkedbase;
+static policydb_t incrlinkedbase;
 static policydb_t *modules[NUM_MODS];
 extern int mls;
 
@@ -66,6 +67,9 @@ int linker_test_init(void)
 	if (test_load_policy(&basenomods, POLICY_BASE, mls, "test-linker", policies[BASEMOD]))
 		return -1;
 
+	if (test_load_policy(&incrlinkedbase, POLICY_BASE, mls, "test-linker", policies[BASEMOD]))
+		return -1;
+
 	for (i = 0; i < NUM_MODS; i++) {
 
 		modules[i] = calloc(1, sizeof(*modules[i]));
@@ -89,6 +93,14 @@ int linker_test_init(void)
 		return -1;
 	}
 
+	/* link the same modules one at a time into an already linked base */
+	for (i = 0; i < NUM_MODS; i++) {
+		if (link_modules(NULL, &incrlinkedbase, &modules[i], 1, 0)) {
+			fprintf(stderr, "link modules failed\n");
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
@@ -98,6 +110,7 @@ int linker_test_cleanup(void)
 
 	policydb_destroy(&basenomods);
 	policydb_destroy(&linkedbase);
+	policydb_destroy(&incrlinkedbase);
 
 	for (i = 0; i < NUM_MODS; i++) {
 		policydb_destroy(modules[i]);
@@ -109,6 +122,7 @@ int linker_test_cleanup(void)
 static void test_linker_indexes(void)
 {
 	test_policydb_indexes(&linkedbase);
+	test_policydb_indexes(&incrlinkedbase);
 }
 
 static void test_linker_roles(void)
@@ -116,6 +130,8 @@ static void test_linker_roles(void)
 	base_role_tests(&basenomods);
 	base_role_tests(&linkedbase);
 	module_role_tests(&linkedbase);
+	base_role_tests(&incrlinkedbase);
+	module_role_tests(&incrlinkedbase);
 }
 
 static void test_linker_types(void)
@@ -123,6 +139,8 @@ static void test_linker_types(void)
 	base_type_tests(&basenomods);
 	base_type_tests(&linkedbase);
 	module_type_tests(&linkedbase);
+	base_type_tests(&incrlinkedbase);
+	module_type_tests(&incrlinkedbase);
 }
 
 static void test_linker_cond(void)
@@ -130,6 +148,14 @@ static void test_linker_cond(void)
 	base_cond_tests(&basenomods);
 	base_cond_tests(&linkedbase);
 	module_cond_tests(&linkedbase);
+	base_cond_tests(&incrlinkedbase);
+	module_cond_tests(&incrlinkedbase);
+}
+
+static void test_linker_relink(void)
+{
+	/* a module may not be linked twice into the same base */
+	CU_ASSERT(link_modules(NULL, &incrlinkedbase, &modules[0], 1, 0) != 0);
 }
 
 int linker_add_tests(CU_pSuite suite)
@@ -150,5 +176,9 @@ int linker_add_tests(CU_pSuite suite)
 		CU_cleanup_registry();
 		return CU_get_error();
 	}
+	if (NULL == CU_add_test(suite, "linker_relink", test_linker_relink)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
 	return 0;
 }
@@ -0,0 +1,114 @@
+/*
+ * Tests for the neverallow checks.
+ *
+ * Each policy in policies/test-neverallow is expanded and its
+ * neverallow rules checked against its allow rules: those named pass-*
+ * must pass, and each of those named fail-* holds one allow rule that
+ * violates a neverallow, with attributes on either side of either rule.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "test-neverallow.h"
+#include "helpers.h"
+
+#include <sepol/policydb/policydb.h>
+#include <sepol/policydb/link.h>
+#include <sepol/policydb/expand.h>
+
+#include <stdio.h>
+
+extern int mls;
+
+int neverallow_test_init(void)
+{
+	return 0;
+}
+
+int neverallow_test_cleanup(void)
+{
+	return 0;
+}
+
+/*
+ * Expand the policy without its checks, so that it is known to be
+ * otherwise sound, then check its neverallow rules as expand_module()
+ * does.
+ */
+static void check_neverallow(const char *policy, int violated)
+{
+	policydb_t basemod, out;
+	int rc;
+
+	if (test_load_policy(&basemod, POLICY_BASE, mls, "test-neverallow",
+			     policy)) {
+		fprintf(stderr, "could not load %s\n", policy);
+		CU_FAIL("could not load policy");
+		return;
+	}
+	CU_ASSERT_FATAL(link_modules(NULL, &basemod, NULL, 0, 0) == 0);
+	CU_ASSERT_FATAL(policydb_init(&out) == 0);
+	CU_ASSERT_FATAL(expand_module(NULL, &basemod, &out, 0, 0) == 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(out.global);
+
+	rc = check_assertions(NULL, &out, out.global->branch_list->avrules);
+	if (violated)
+		CU_ASSERT(rc < 0);
+	else
+		CU_ASSERT(rc == 0);
+
+	policydb_destroy(&basemod);
+	policydb_destroy(&out);
+}
+
+static void test_neverallow_pass(void)
+{
+	check_neverallow("pass-types.conf", 0);
+	check_neverallow("pass-attr.conf", 0);
+}
+
+static void test_neverallow_fail(void)
+{
+	check_neverallow("fail-types.conf", 1);
+	check_neverallow("fail-complement.conf", 1);
+	check_neverallow("fail-cond.conf", 1);
+}
+
+static void test_neverallow_fail_attr(void)
+{
+	check_neverallow("fail-attr-source.conf", 1);
+	check_neverallow("fail-attr-allow.conf", 1);
+	check_neverallow("fail-attr-both.conf", 1);
+	check_neverallow("fail-self.conf", 1);
+	check_neverallow("fail-self-attr.conf", 1);
+}
+
+int neverallow_add_tests(CU_pSuite suite)
+{
+	if (NULL == CU_add_test(suite, "neverallow_pass", test_neverallow_pass)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "neverallow_fail", test_neverallow_fail)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "neverallow_fail_attr",
+				test_neverallow_fail_attr)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Tests for looking up and allocating SIDs from several threads.
+ *
+ * The threads map the same contexts to SIDs, each in its own order, so
+ * that they race to allocate them while the table grows, and check
+ * every SID against the context it is looked up by.  All must agree on
+ * one distinct SID per context, which a second pass must find again.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "test-sidtab.h"
+
+#include <sepol/policydb/sidtab.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* well past the initial slots, so the table grows under the threads */
+#define NUM_CONTEXTS 4000
+#define NUM_THREADS 8
+/* contexts given SIDs up front, as the initial SIDs of a policy are */
+#define NUM_INITIAL 10
+
+static sidtab_t sidtab;
+static context_struct_t contexts[NUM_CONTEXTS];
+
+struct sidtab_thread {
+	pthread_t thread;
+	unsigned int start;
+	int backward;
+	sepol_security_id_t sids[NUM_CONTEXTS];
+	unsigned int errors;	/* failed or mismatched lookups */
+	unsigned int unstable;	/* SIDs not found again */
+};
+
+static struct sidtab_thread threads[NUM_THREADS];
+
+int sidtab_test_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_CONTEXTS; i++) {
+		context_init(&contexts[i]);
+		contexts[i].user = i % 7 + 1;
+		contexts[i].role = i / 7 % 5 + 1;
+		contexts[i].type = i / 35 + 1;
+		if (i % 3 && ebitmap_set_bit(&contexts[i].range.level[1].cat,
+					     i % 3, 1)) {
+			fprintf(stderr, "out of memory!\n");
+			return -1;
+		}
+	}
+	if (sepol_sidtab_init(&sidtab)) {
+		fprintf(stderr, "out of memory!\n");
+		return -1;
+	}
+	return 0;
+}
+
+int sidtab_test_cleanup(void)
+{
+	unsigned int i;
+
+	sepol_sidtab_destroy(&sidtab);
+	for (i = 0; i < NUM_CONTEXTS; i++)
+		context_destroy(&contexts[i]);
+	return 0;
+}
+
+static unsigned int thread_index(struct sidtab_thread *t, unsigned int j)
+{
+	if (t->backward)
+		j = NUM_CONTEXTS - 1 - j;
+	return (t->start + j) % NUM_CONTEXTS;
+}
+
+static void *sidtab_worker(void *arg)
+{
+	struct sidtab_thread *t = arg;
+	sepol_security_id_t sid;
+	context_struct_t *c;
+	unsigned int i, j;
+
+	for (j = 0; j < NUM_CONTEXTS; j++) {
+		i = thread_index(t, j);
+		if (sepol_sidtab_context_to_sid(&sidtab, &contexts[i], &sid) ||
+		    !sid) {
+			t->errors++;
+			continue;
+		}
+		t->sids[i] = sid;
+		c = sepol_sidtab_search(&sidtab, sid);
+		if (!c || !context_cmp(c, &contexts[i]))
+			t->errors++;
+	}
+
+	for (j = 0; j < NUM_CONTEXTS; j++) {
+		i = thread_index(t, j);
+		if (sepol_sidtab_context_to_sid(&sidtab, &contexts[i], &sid) ||
+		    sid != t->sids[i])
+			t->unstable++;
+	}
+	return NULL;
+}
+
+static void test_sidtab_threads(void)
+{
+	unsigned char *seen;
+	sepol_security_id_t sid;
+	unsigned int i, n;
+
+	for (i = 0; i < NUM_INITIAL; i++)
+		CU_ASSERT_FATAL(sepol_sidtab_insert(&sidtab, i + 1,
+						    &contexts[i]) == 0);
+
+	for (n = 0; n < NUM_THREADS; n++) {
+		threads[n].start = n * (NUM_CONTEXTS / NUM_THREADS);
+		threads[n].backward = n & 1;
+		CU_ASSERT_FATAL(pthread_create(&threads[n].thread, NULL,
+					       sidtab_worker,
+					       &threads[n]) == 0);
+	}
+	for (n = 0; n < NUM_THREADS; n++)
+		pthread_join(threads[n].thread, NULL);
+
+	for (n = 0; n < NUM_THREADS; n++) {
+		CU_ASSERT(threads[n].errors == 0);
+		CU_ASSERT(threads[n].unstable == 0);
+	}
+
+	/* every thread got the same SID for a context */
+	for (i = 0; i < NUM_CONTEXTS; i++)
+		for (n = 1; n < NUM_THREADS; n++)
+			CU_ASSERT(threads[n].sids[i] == threads[0].sids[i]);
+
+	/* the initial SIDs were kept, and no two contexts share a SID */
+	for (i = 0; i < NUM_INITIAL; i++)
+		CU_ASSERT(threads[0].sids[i] == i + 1);
+	CU_ASSERT(sidtab.nel == NUM_CONTEXTS);
+	CU_ASSERT(sidtab.next_sid == NUM_CONTEXTS + 1);
+	seen = calloc(NUM_CONTEXTS + 1, 1);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(seen);
+	for (i = 0; i < NUM_CONTEXTS; i++) {
+		sid = threads[0].sids[i];
+		CU_ASSERT_FATAL(sid > 0 && sid <= NUM_CONTEXTS);
+		CU_ASSERT(!seen[sid]);
+		seen[sid] = 1;
+	}
+	free(seen);
+
+	/* and the SIDs still name their contexts afterwards */
+	for (i = 0; i < NUM_CONTEXTS; i++) {
+		CU_ASSERT(sepol_sidtab_context_to_sid(&sidtab, &contexts[i],
+						      &sid) == 0);
+		CU_ASSERT(sid == threads[0].sids[i]);
+		CU_ASSERT(context_cmp(sepol_sidtab_search(&sidtab, sid),
+				      &contexts[i]));
+	}
+}
+
+int sidtab_add_tests(CU_pSuite suite)
+{
+	if (NULL == CU_add_test(suite, "sidtab_threads", test_sidtab_threads)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * Tests for the string pool of symbol names.
+ *
+ * Besides interning and lookup, these check who frees what: pooled
+ * names must only go with the pool and others must be freed with their
+ * symbols, so run under valgrind or AddressSanitizer a double free or a
+ * leak on policydb_destroy() shows up here.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "test-strpool.h"
+#include "private.h"
+#include "strpool.h"
+
+#include <sepol/policydb/policydb.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* enough names to grow both the hash and the blocks of a pool */
+#define NUM_NAMES 5000
+
+int strpool_test_init(void)
+{
+	return 0;
+}
+
+int strpool_test_cleanup(void)
+{
+	return 0;
+}
+
+static void test_strpool_intern(void)
+{
+	struct strpool *pool;
+	char *a, *b, *c;
+	size_t count, bytes;
+
+	pool = strpool_create();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+	a = strpool_dup(pool, "user_t");
+	b = strpool_dup(pool, "user_home_t");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(a);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+	CU_ASSERT(a != b);
+	CU_ASSERT_STRING_EQUAL(a, "user_t");
+	CU_ASSERT_STRING_EQUAL(b, "user_home_t");
+
+	/* the same name, however given, is the same copy */
+	CU_ASSERT(strpool_dup(pool, "user_t") == a);
+	CU_ASSERT(strpool_intern(pool, "user_home_t_x", 11) == b);
+	CU_ASSERT(strpool_intern(pool, "user_tty", 6) == a);
+
+	/* a name with a pooled name as prefix is not that name */
+	c = strpool_intern(pool, "user_t_x", 8);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(c);
+	CU_ASSERT(c != a);
+	CU_ASSERT_STRING_EQUAL(c, "user_t_x");
+
+	CU_ASSERT(strpool_dup(pool, "") == strpool_intern(pool, "x", 0));
+
+	strpool_stats(pool, &count, &bytes);
+	CU_ASSERT(count == 4);
+	CU_ASSERT(bytes > 0);
+
+	CU_ASSERT(strpool_contains(pool, a));
+	CU_ASSERT(strpool_contains(pool, c));
+	CU_ASSERT(!strpool_contains(pool, "user_t"));
+	CU_ASSERT(!strpool_contains(pool, NULL));
+
+	/* pooled names are not freed on their own */
+	strpool_free(pool, a);
+	CU_ASSERT(strpool_dup(pool, "user_t") == a);
+
+	strpool_put(pool);
+}
+
+static void test_strpool_nopool(void)
+{
+	char *a, *b;
+
+	/* without a pool every name is its own malloc'ed copy */
+	a = strpool_dup(NULL, "user_t");
+	b = strpool_dup(NULL, "user_t");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(a);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+	CU_ASSERT(a != b);
+	CU_ASSERT_STRING_EQUAL(a, b);
+	CU_ASSERT(!strpool_contains(NULL, a));
+	strpool_free(NULL, a);
+	strpool_free(NULL, b);
+
+	CU_ASSERT(strpool_get(NULL) == NULL);
+	strpool_put(NULL);
+}
+
+static void test_strpool_grow(void)
+{
+	struct strpool *pool;
+	char *names[NUM_NAMES], buf[32];
+	size_t count, bytes;
+	unsigned int i;
+
+	pool = strpool_create();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+	for (i = 0; i < NUM_NAMES; i++) {
+		snprintf(buf, sizeof(buf), "type_%u_t", i);
+		names[i] = strpool_dup(pool, buf);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(names[i]);
+	}
+
+	/* every name is found again after the pool grew around it */
+	for (i = 0; i < NUM_NAMES; i++) {
+		snprintf(buf, sizeof(buf), "type_%u_t", i);
+		CU_ASSERT(strpool_dup(pool, buf) == names[i]);
+		CU_ASSERT_STRING_EQUAL(names[i], buf);
+		CU_ASSERT(strpool_contains(pool, names[i]));
+	}
+
+	strpool_stats(pool, &count, &bytes);
+	CU_ASSERT(count == NUM_NAMES);
+
+	strpool_put(pool);
+}
+
+/* Read name from a policy image into the pool, as policydb_read() does. */
+static char *read_name(struct strpool *pool, const char *name)
+{
+	struct policy_file pf;
+
+	policy_file_init(&pf);
+	pf.type = PF_USE_MEMORY;
+	pf.data = (char *)name;
+	pf.len = strlen(name);
+	return symtab_name_read(pool, &pf, pf.len);
+}
+
+static type_datum_t *add_type(policydb_t * p, char *key)
+{
+	type_datum_t *type;
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(key);
+	type = calloc(1, sizeof(*type));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(type);
+	type_datum_init(type);
+	type->s.value = ++p->p_types.nprim;
+	CU_ASSERT_FATAL(hashtab_insert(p->p_types.table, key, type) == 0);
+	return type;
+}
+
+static void add_class(policydb_t * p, char *key, char *perm)
+{
+	class_datum_t *cladatum;
+	perm_datum_t *perdatum;
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(key);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(perm);
+	cladatum = calloc(1, sizeof(*cladatum));
+	perdatum = calloc(1, sizeof(*perdatum));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(cladatum);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(perdatum);
+	CU_ASSERT_FATAL(symtab_init(&cladatum->permissions,
+				    PERM_SYMTAB_SIZE) == 0);
+	cladatum->s.value = ++p->p_classes.nprim;
+	perdatum->s.value = ++cladatum->permissions.nprim;
+	CU_ASSERT_FATAL(hashtab_insert(cladatum->permissions.table, perm,
+				       perdatum) == 0);
+	CU_ASSERT_FATAL(hashtab_insert(p->p_classes.table, key,
+				       cladatum) == 0);
+}
+
+static void test_strpool_policydb(void)
+{
+	policydb_t p1, p2;
+	struct strpool *pool;
+	type_datum_t *type;
+	char *name;
+
+	CU_ASSERT_FATAL(policydb_init(&p1) == 0);
+	CU_ASSERT_FATAL(policydb_init(&p2) == 0);
+	p1.strpool = strpool_create();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(p1.strpool);
+	pool = p1.strpool;
+
+	/* only the global symbol tables use the pool */
+	CU_ASSERT(symtab_pool(&p1, p1.p_types.table) == pool);
+	CU_ASSERT(symtab_pool(&p1, NULL) == NULL);
+
+	/* names read into the pool, mixed with a malloc'ed one */
+	name = read_name(pool, "user_t");
+	type = add_type(&p1, name);
+	CU_ASSERT(strpool_contains(pool, name));
+	add_type(&p1, strdup("user_home_t"));
+	add_class(&p1, read_name(pool, "file"), read_name(pool, "read"));
+	add_class(&p1, strdup("dir"), read_name(pool, "read"));
+
+	/* a lookup by any copy of the name finds the symbol */
+	CU_ASSERT(hashtab_search(p1.p_types.table, "user_t") == type);
+	CU_ASSERT(read_name(pool, "user_t") == name);
+
+	/* a second policydb sharing the pool, as an expanded one does */
+	p2.strpool = strpool_get(pool);
+	add_type(&p2, read_name(p2.strpool, "user_t"));
+	add_type(&p2, read_name(NULL, "user_home_t"));
+	CU_ASSERT(hashtab_search(p2.p_types.table, name) != NULL);
+
+	/* the pool outlives the first policydb for the second */
+	policydb_destroy(&p1);
+	CU_ASSERT(p1.strpool == NULL);
+	CU_ASSERT(strpool_contains(pool, name));
+	CU_ASSERT_STRING_EQUAL(name, "user_t");
+	CU_ASSERT(hashtab_search(p2.p_types.table, "user_t") != NULL);
+
+	policydb_destroy(&p2);
+}
+
+int strpool_add_tests(CU_pSuite suite)
+{
+	if (NULL == CU_add_test(suite, "strpool_intern", test_strpool_intern)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "strpool_nopool", test_strpool_nopool)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "strpool_grow", test_strpool_grow)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "strpool_policydb",
+				test_strpool_policydb)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * Tests for the string pool of symbol names.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __TEST_STRPOOL_H__
+#define __TEST_STRPOOL_H__
+
+#include <CUnit/Basic.h>
+
+int strpool_test_init(void);
+int strpool_test_cleanup(void);
+int strpool_add_tests(CU_pSuite suite);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * Tests for the exact-key lookups of role, range and name-based type
+ * transitions.
+ *
+ * Lists with many entries sharing a key are built by hand, and every
+ * lookup is compared with a walk of the list, which must find the same
+ * first entry: when the tables are built on first use, when built
+ * beforehand, and after entries are put at either end of a list with
+ * or without telling the tables.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "test-trans-keys.h"
+#include "trans_keys.h"
+
+#include <sepol/policydb/policydb.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Keys are drawn from 1 to KEY_MAX of each field, so that most of the
+ * NUM_ENTRIES entries of a list share their key with others; lookups
+ * go from 0 to KEY_MAX + 1 to try keys with no entry as well. */
+#define KEY_MAX 6
+#define NUM_ENTRIES 300
+
+static const char *names[] = { "a", "b", "lib", "ld.so.cache" };
+
+#define NUM_NAMES (sizeof(names) / sizeof(names[0]))
+
+static policydb_t policydb;
+static unsigned int seed;
+
+int trans_keys_test_init(void)
+{
+	if (policydb_init(&policydb)) {
+		fprintf(stderr, "out of memory!\n");
+		return -1;
+	}
+	return 0;
+}
+
+int trans_keys_test_cleanup(void)
+{
+	policydb_destroy(&policydb);
+	return 0;
+}
+
+static uint32_t next_key(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % KEY_MAX + 1;
+}
+
+static role_trans_t *new_role_trans(void)
+{
+	role_trans_t *tr = calloc(1, sizeof(*tr));
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(tr);
+	tr->role = next_key();
+	tr->type = next_key();
+	tr->tclass = next_key();
+	tr->new_role = next_key();
+	return tr;
+}
+
+static range_trans_t *new_range_trans(void)
+{
+	range_trans_t *rt = calloc(1, sizeof(*rt));
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rt);
+	rt->source_type = next_key();
+	rt->target_type = next_key();
+	rt->target_class = next_key();
+	return rt;
+}
+
+static filename_trans_t *new_filename_trans(void)
+{
+	filename_trans_t *ft = calloc(1, sizeof(*ft));
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(ft);
+	ft->stype = next_key();
+	ft->ttype = next_key();
+	ft->tclass = next_key();
+	ft->name = strdup(names[next_key() % NUM_NAMES]);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(ft->name);
+	ft->otype = next_key();
+	return ft;
+}
+
+/* Put one new entry at the head of each list. */
+static void prepend_entries(int tell)
+{
+	role_trans_t *tr = new_role_trans();
+	range_trans_t *rt = new_range_trans();
+	filename_trans_t *ft = new_filename_trans();
+
+	tr->next = policydb.role_tr;
+	policydb.role_tr = tr;
+	rt->next = policydb.range_tr;
+	policydb.range_tr = rt;
+	ft->next = policydb.filename_trans;
+	policydb.filename_trans = ft;
+	if (tell) {
+		trans_keys_add_role(&policydb, tr);
+		trans_keys_add_range(&policydb, rt);
+		trans_keys_add_filename(&policydb, ft);
+	}
+}
+
+/* Put one new entry at the tail of each list. */
+static void append_entries(int tell)
+{
+	role_trans_t *tr = new_role_trans(), **ltr;
+	range_trans_t *rt = new_range_trans(), **lrt;
+	filename_trans_t *ft = new_filename_trans(), **lft;
+
+	for (ltr = &policydb.role_tr; *ltr; ltr = &(*ltr)->next) ;
+	*ltr = tr;
+	for (lrt = &policydb.range_tr; *lrt; lrt = &(*lrt)->next) ;
+	*lrt = rt;
+	for (lft = &policydb.filename_trans; *lft; lft = &(*lft)->next) ;
+	*lft = ft;
+	if (tell) {
+		trans_keys_add_role(&policydb, tr);
+		trans_keys_add_range(&policydb, rt);
+		trans_keys_add_filename(&policydb, ft);
+	}
+}
+
+/* Compare the lookup of every key with a walk of its list. */
+static void check_lookups(void)
+{
+	role_trans_t *tr;
+	range_trans_t *rt;
+	filename_trans_t *ft;
+	uint32_t a, b, c;
+	unsigned int i;
+
+	for (a = 0; a <= KEY_MAX + 1; a++) {
+		for (b = 0; b <= KEY_MAX + 1; b++) {
+			for (c = 0; c <= KEY_MAX + 1; c++) {
+				for (tr = policydb.role_tr; tr; tr = tr->next)
+					if (tr->role == a && tr->type == b &&
+					    tr->tclass == c)
+						break;
+				CU_ASSERT(trans_keys_find_role(&policydb, a, b,
+							       c) == tr);
+
+				for (rt = policydb.range_tr; rt; rt = rt->next)
+					if (rt->source_type == a &&
+					    rt->target_type == b &&
+					    rt->target_class == c)
+						break;
+				CU_ASSERT(trans_keys_find_range(&policydb, a, b,
+								c) == rt);
+
+				for (i = 0; i < NUM_NAMES; i++) {
+					for (ft = policydb.filename_trans; ft;
+					     ft = ft->next)
+						if (ft->stype == a &&
+						    ft->ttype == b &&
+						    ft->tclass == c &&
+						    !strcmp(ft->name, names[i]))
+							break;
+					CU_ASSERT(trans_keys_find_filename
+						  (&policydb, a, b, c,
+						   names[i]) == ft);
+				}
+				CU_ASSERT(trans_keys_find_filename
+					  (&policydb, a, b, c, "none") == NULL);
+			}
+		}
+	}
+}
+
+static void test_trans_keys_lookup(void)
+{
+	unsigned int i;
+
+	/* empty lists */
+	check_lookups();
+
+	seed = 1;
+	for (i = 0; i < NUM_ENTRIES; i++)
+		append_entries(0);
+
+	/* tables built on first use, then beforehand */
+	check_lookups();
+	CU_ASSERT(trans_keys_build(&policydb) == 0);
+	check_lookups();
+}
+
+static void test_trans_keys_add(void)
+{
+	unsigned int i;
+
+	/* entries the tables are told about, which the head replaces
+	 * for its key and the tail does not */
+	for (i = 0; i < NUM_ENTRIES / 4; i++) {
+		prepend_entries(1);
+		append_entries(1);
+	}
+	check_lookups();
+
+	/* entries put at either end behind the tables' back */
+	prepend_entries(0);
+	check_lookups();
+	append_entries(0);
+	check_lookups();
+
+	/* and put there while the tables are stale */
+	prepend_entries(0);
+	prepend_entries(1);
+	append_entries(0);
+	append_entries(1);
+	check_lookups();
+}
+
+int trans_keys_add_tests(CU_pSuite suite)
+{
+	if (NULL == CU_add_test(suite, "trans_keys_lookup",
+				test_trans_keys_lookup)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	if (NULL == CU_add_test(suite, "trans_keys_add", test_trans_keys_add)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+	return 0;
+}
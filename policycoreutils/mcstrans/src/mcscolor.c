@@ -46,8 +46,85 @@ static setab_t *clist[N_COLOR];
 static setab_t *cend[N_COLOR];
 static semnemonic_t *mnemonics;
 
+/* Colors already found for each component value.  Clients ask for
+ * the colors of the same few users, roles, types and ranges over and
+ * over, and a range lookup asks the kernel for every range rule.
+ * Emptied whenever the rules are reloaded. */
+#define N_CACHE_BUCKETS	251
+#define MAX_CACHE	4096	/* entries per component */
+
+typedef struct secache {
+	char *value;
+	const secolor_t *color;	/* NULL if no rule matches */
+	struct secache *next;
+} secache_t;
+
+static secache_t *ccache[N_COLOR][N_CACHE_BUCKETS];
+static unsigned int ccache_count[N_COLOR];
+
 static security_context_t my_context;
 
+static unsigned int cache_hash(const char *str) {
+	unsigned int hash = 5381;
+	int c;
+
+	while ((c = *(unsigned const char *)str++))
+		hash = ((hash << 5) + hash) + c;
+
+	return hash % N_CACHE_BUCKETS;
+}
+
+static void cache_flush(int idx) {
+	secache_t *cur, *next;
+	unsigned i;
+
+	for (i = 0; i < N_CACHE_BUCKETS; i++) {
+		cur = ccache[idx][i];
+		while (cur) {
+			next = cur->next;
+			free(cur->value);
+			free(cur);
+			cur = next;
+		}
+		ccache[idx][i] = NULL;
+	}
+	ccache_count[idx] = 0;
+}
+
+static const secache_t *cache_find(int idx, const char *value) {
+	secache_t *ptr = ccache[idx][cache_hash(value)];
+
+	while (ptr) {
+		if (!strcmp(ptr->value, value))
+			return ptr;
+		ptr = ptr->next;
+	}
+	return NULL;
+}
+
+static void cache_add(int idx, const char *value, const secolor_t *color) {
+	secache_t *ptr;
+	unsigned int bucket;
+
+	/* Do not let clients grow the cache without bound */
+	if (ccache_count[idx] >= MAX_CACHE)
+		cache_flush(idx);
+
+	ptr = malloc(sizeof(secache_t));
+	if (!ptr)
+		return;
+	ptr->value = strdup(value);
+	if (!ptr->value) {
+		free(ptr);
+		return;
+	}
+	ptr->color = color;
+	bucket = cache_hash(value);
+	ptr->next = ccache[idx][bucket];
+	ccache[idx][bucket] = ptr;
+	ccache_count[idx]++;
+}
+
 void finish_context_colors(void) {
 	setab_t *cur, *next;
 	semnemonic_t *ptr;
@@ -62,6 +139,7 @@ void finish_context_colors(void) {
 			cur = next;
 		}
 		clist[i] = cend[i] = NULL;
+		cache_flush(i);
 	}
 
 	ptr = mnemonics;
@@ -125,6 +203,8 @@ out:
 static const secolor_t *find_color(int idx, const char *component,
 				   const char *raw) {
 	setab_t *ptr = clist[idx];
+	const secache_t *cached;
+	int rc, failed = 0;
 
 	if (idx == COLOR_RANGE) {
 		if (!raw) {
@@ -134,18 +214,30 @@ static const secolor_t *find_color(int idx, const char *component,
 		return NULL;
 	}
 
+	/* A range's color only depends on the range of 'raw' */
+	cached = component ? cache_find(idx, component) : NULL;
+	if (cached)
+		return cached->color;
+
 	while (ptr) {
 		if (fnmatch(ptr->pattern, component, 0) == 0) {
 			if (idx == COLOR_RANGE) {
-			    if (check_dominance(ptr->pattern, raw) == 0)
-					return &ptr->color;
+			    rc = check_dominance(ptr->pattern, raw);
+			    if (rc == 0)
+					break;
+			    if (rc < 0)
+					failed = 1;
 			} else 
-				return &ptr->color;
+				break;
 		}
 		ptr = ptr->next;
 	}
 
-	return NULL;
+	/* Do not remember a miss that may be due to a failed check */
+	if (component && (ptr || !failed))
+		cache_add(idx, component, ptr ? &ptr->color : NULL);
+
+	return ptr ? &ptr->color : NULL;
 }
 
 static int add_secolor(int idx, char *pattern, uint32_t fg, uint32_t bg) {
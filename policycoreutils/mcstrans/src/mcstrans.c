@@ -7,6 +7,9 @@
 
  int init_translations(void);
  void finish_context_translations(void);
+ translations_t *build_translations(void);
+ int install_translations(translations_t *);
+ void destroy_translations(translations_t *);
  int trans_context(const security_context_t, security_context_t *);
  int untrans_context(const security_context_t, security_context_t *);
 
@@ -28,6 +31,7 @@
 #include <errno.h>
 #include <pcre.h>
 #include <ctype.h>
+#include <limits.h>
 #include <time.h>
 #include <sys/time.h>
 
@@ -46,8 +50,6 @@
 #define log_debug(fmt, ...) ;
 #endif
 
-static unsigned int maxbit=0;
-
 /* Define data structures */
 typedef struct context_map {
 	char *raw;
@@ -67,9 +69,10 @@ typedef struct affix {
 
 typedef struct word {
 	char *text;
-	ebitmap_t cat;
-	ebitmap_t normal;
-	ebitmap_t inverse;
+	catset_t cat;
+	catset_t normal;
+	catset_t inverse;
+	catset_t bits;		/* normal | inverse */
 	struct word *next;
 } word_t;
 
@@ -86,11 +89,17 @@ typedef struct word_group {
 	pcre *word_regexp;
 	pcre *suffix_regexp;
 
-	ebitmap_t def;
+	catset_t def;
 
 	word_t **sword;
 	int sword_len;
 
+	/* sword sorted by first character, keeping sword order for each;
+	 * the words starting with c are iword[iword_start[c]] up to
+	 * iword[iword_start[c + 1]] */
+	word_t **iword;
+	int iword_start[UCHAR_MAX + 2];
+
 	struct word_group *next;
 } word_group_t;
 
@@ -110,31 +119,58 @@ typedef struct domain {
 	word_group_t *groups;
 
 	pcre *base_classification_regexp;
+
+	/* hash of the configuration lines that define the domain */
+	unsigned int fingerprint;
 	struct domain *next;
 } domain_t;
 
-static domain_t *domains;
+/*
+ * The translation state is per thread, so that mcstransd can read a new
+ * configuration on another thread while it keeps answering requests
+ * from the current one; build_translations() then hands the new state
+ * over to install_translations().
+ */
+static __thread domain_t *domains;
 
 typedef struct sens_constraint {
 	char op;
 	char *text;
 	unsigned int sens;
-	ebitmap_t cat;
+	catset_t cat;
 	struct sens_constraint *next;
 } sens_constraint_t;
 
-static sens_constraint_t *sens_constraints;
+static __thread sens_constraint_t *sens_constraints;
 
 typedef struct cat_constraint {
 	char op;
 	char *text;
 	int nbits;
-	ebitmap_t mask;
-	ebitmap_t cat;
+	catset_t mask;
+	catset_t cat;
 	struct cat_constraint *next;
 } cat_constraint_t;
 
-static cat_constraint_t *cat_constraints;
+static __thread cat_constraint_t *cat_constraints;
+
+/* hash of the constraint lines, which apply to every domain */
+static __thread unsigned int constraints_fingerprint;
+
+struct translations {
+	domain_t *domains;
+	sens_constraint_t *sens_constraints;
+	cat_constraint_t *cat_constraints;
+	unsigned int constraints_fingerprint;
+};
+
+/* where process_trans() is in the configuration */
+static __thread struct {
+	domain_t *domain;
+	word_group_t *group;
+	int base_classification;
+	int lineno;
+} parse;
 
 unsigned int
 hash(const char *str) {
@@ -175,7 +211,7 @@ numdigits(unsigned int n)
 }
 
 static int
-parse_category(ebitmap_t *e, const char *raw, int allowinverse)
+parse_category(catset_t *e, const char *raw, int allowinverse)
 {
 	int inverse = 0;
 	unsigned int low, high;
@@ -196,11 +232,10 @@ parse_category(ebitmap_t *e, const char *raw, int allowinverse)
 		} else {
 			high = low;
 		}
+		if (high >= MAX_CATEGORIES)
+			return -1;
 		while (low <= high) {
-			if (low >= maxbit)
-				maxbit = low + 1;
-			if (ebitmap_set_bit(e, low, inverse ? 0 : 1) < 0)
-				return -1;
+			catset_set_bit(e, low, inverse ? 0 : 1);
 			low++;
 		}
 		if (*raw == ',') {
@@ -214,10 +249,9 @@ parse_category(ebitmap_t *e, const char *raw, int allowinverse)
 }
 
 int
-parse_ebitmap(ebitmap_t *e, ebitmap_t *def, const char *raw) {
-	int rc = ebitmap_cpy(e, def);
-	if (rc < 0)
-		return rc;
+parse_catset(catset_t *e, const catset_t *def, const char *raw) {
+	int rc;
+	*e = *def;
 	rc = parse_category(e, raw, 1);
 	if (rc < 0)
 		return rc;
@@ -243,7 +277,6 @@ parse_raw(const char *raw) {
 	return mls;
 
 err:
-	ebitmap_destroy(&mls->cat);
 	free(mls);
 	return NULL;
 }
@@ -260,9 +293,6 @@ destroy_word(word_t **list, word_t *word) {
 		}
 	}
 	free(word->text);
-	ebitmap_destroy(&word->cat);
-	ebitmap_destroy(&word->normal);
-	ebitmap_destroy(&word->inverse);
 	memset(word, 0, sizeof(word_t));
 	free(word);
 }
@@ -316,11 +346,11 @@ destroy_group(word_group_t **list, word_group_t *group) {
 	free(group->whitespace);
 	free(group->name);
 	free(group->sword);
+	free(group->iword);
 	free(group->join);
 	pcre_free(group->prefix_regexp);
 	pcre_free(group->word_regexp);
 	pcre_free(group->suffix_regexp);
-	ebitmap_destroy(&group->def);
 	free(group);
 }
 
@@ -387,7 +417,6 @@ destroy_domain(domain_t *domain) {
 	while (domain->base_classifications)  {
 		base_classification_t *next = domain->base_classifications->next;
 		free(domain->base_classifications->trans);
-		ebitmap_destroy(&domain->base_classifications->level->cat);
 		free(domain->base_classifications->level);
 		free(domain->base_classifications);
 		domain->base_classifications = next;
@@ -432,21 +461,18 @@ add_word(word_group_t *group, char *raw, char *trans) {
 		return -1;
 	}
 	word_t *word = create_word(&group->words, trans);
-	int rc = parse_ebitmap(&word->cat, &group->def, raw);
+	int rc = parse_catset(&word->cat, &group->def, raw);
 	if (rc < 0) {
 		log_error(" syntax error in %s\n", raw);
 		destroy_word(&group->words, word);
 		return -1;
 	}
-	if (ebitmap_andnot(&word->normal, &word->cat, &group->def, maxbit) < 0)
-		return -1;
+	catset_andnot(&word->normal, &word->cat, &group->def);
 
-	ebitmap_t temp;
-	if (ebitmap_xor(&temp, &word->cat, &group->def) < 0)
-		return -1;
-	if (ebitmap_and(&word->inverse, &temp, &group->def) < 0)
-		return -1;
-	ebitmap_destroy(&temp);
+	catset_t temp;
+	catset_xor(&temp, &word->cat, &group->def);
+	catset_and(&word->inverse, &temp, &group->def);
+	catset_or(&word->bits, &word->normal, &word->inverse);
 
 	return 0;
 }
@@ -454,8 +480,8 @@ add_word(word_group_t *group, char *raw, char *trans) {
 int
 add_constraint(char op, char *raw, char *tok) {
 	log_debug("%s\n", "add_constraint");
-	ebitmap_t empty;
-	ebitmap_init(&empty);
+	catset_t empty;
+	catset_init(&empty);
 	if (!raw || !*raw) {
 		syslog(LOG_ERR, "unable to parse line");
 		return -1;
@@ -471,7 +497,7 @@ add_constraint(char op, char *raw, char *tok) {
 			free(constraint);
 			return -1;
 		}
-		if (parse_ebitmap(&constraint->cat, &empty, tok) < 0) {
+		if (parse_catset(&constraint->cat, &empty, tok) < 0) {
 			syslog(LOG_ERR, "unable to parse cat");
 			free(constraint);
 			return -1;
@@ -492,14 +518,13 @@ add_constraint(char op, char *raw, char *tok) {
 			log_error("allocation error %s", strerror(errno));
 			return -1;
 		}
-		if (parse_ebitmap(&constraint->mask, &empty, raw) < 0) {
+		if (parse_catset(&constraint->mask, &empty, raw) < 0) {
 			syslog(LOG_ERR, "unable to parse mask");
 			free(constraint);
 			return -1;
 		}
-		if (parse_ebitmap(&constraint->cat, &empty, tok) < 0) {
+		if (parse_catset(&constraint->cat, &empty, tok) < 0) {
 			syslog(LOG_ERR, "unable to parse cat");
-			ebitmap_destroy(&constraint->mask);
 			free(constraint);
 			return -1;
 		}
@@ -507,7 +532,7 @@ add_constraint(char op, char *raw, char *tok) {
 			log_error("asprintf failed %s", strerror(errno));
 			return -1;
 		}
-		constraint->nbits = ebitmap_cardinality(&constraint->cat);
+		constraint->nbits = catset_count(&constraint->cat);
 		constraint->op = op;
 		cat_constraint_t **p;
 		for (p= &cat_constraints; *p; p = &(*p)->next)
@@ -527,11 +552,9 @@ violates_constraints(mls_level_t *l) {
 	sens_constraint_t *s;
 	for (s=sens_constraints; s; s=s->next) {
 		if (s->sens == l->sens) {
-			ebitmap_t common;
-			if (ebitmap_and(&common, &s->cat, &l->cat) < 0)
-				return 1;
-			nbits = ebitmap_cardinality(&common);
-			ebitmap_destroy(&common);
+			catset_t common;
+			catset_and(&common, &s->cat, &l->cat);
+			nbits = catset_count(&common);
 			if (nbits) {
 				char *text = mls_level_to_string(l);
 				syslog(LOG_WARNING, "%s violates %s", text, s->text);
@@ -542,17 +565,12 @@ violates_constraints(mls_level_t *l) {
 	}
 	cat_constraint_t *c;
 	for (c=cat_constraints; c; c=c->next) {
-		ebitmap_t common;
-		if (ebitmap_and(&common, &c->mask, &l->cat) < 0)
-			return 1;
-		nbits = ebitmap_cardinality(&common);
-		ebitmap_destroy(&common);
+		catset_t common;
+		catset_and(&common, &c->mask, &l->cat);
+		nbits = catset_count(&common);
 		if (nbits > 0) {
-			ebitmap_t common;
-			if (ebitmap_and(&common, &c->cat, &l->cat) < 0)
-				return 1;
-			nbits = ebitmap_cardinality(&common);
-			ebitmap_destroy(&common);
+			catset_and(&common, &c->cat, &l->cat);
+			nbits = catset_count(&common);
 			if ((c->op == '!' && nbits) ||
 			    (c->op == '>' && nbits != c->nbits)) {
 				char *text = mls_level_to_string(l);
@@ -576,7 +594,6 @@ destroy_sens_constraint(sens_constraint_t **list, sens_constraint_t *constraint)
 			break;
 		}
 	}
-	ebitmap_destroy(&constraint->cat);
 	free(constraint->text);
 	memset(constraint, 0, sizeof(sens_constraint_t));
 	free(constraint);
@@ -593,8 +610,6 @@ destroy_cat_constraint(cat_constraint_t **list, cat_constraint_t *constraint) {
 			break;
 		}
 	}
-	ebitmap_destroy(&constraint->mask);
-	ebitmap_destroy(&constraint->cat);
 	free(constraint->text);
 	memset(constraint, 0, sizeof(cat_constraint_t));
 	free(constraint);
@@ -721,14 +736,11 @@ static int read_translations(const char *filename);
  */
 static int
 process_trans(char *buffer) {
-	static domain_t *domain;
-	static word_group_t *group;
-	static int base_classification;
-	static int lineno = 0;
 	char op='\0';
+	unsigned int line_hash;
 
-	lineno++;
-	log_debug("%d: %s", lineno, buffer);
+	parse.lineno++;
+	log_debug("%d: %s", parse.lineno, buffer);
 
 	/* zap leading whitespace */
 	buffer = triml(buffer, "\t ");
@@ -745,9 +757,11 @@ process_trans(char *buffer) {
 
 	if (*buffer == 0) return 0;
 
+	line_hash = hash(buffer);
+
 	char *delim = strpbrk (buffer, "=!>");
 	if (! delim) {
-		syslog(LOG_ERR, "invalid line (no !, = or >) %d", lineno);
+		syslog(LOG_ERR, "invalid line (no !, = or >) %d", parse.lineno);
 		return -1;
 	}
 
@@ -761,38 +775,41 @@ process_trans(char *buffer) {
 	tok = triml(tok, "\t ");
 
 	if (! *raw) {
-		syslog(LOG_ERR, "invalid line %d", lineno);
+		syslog(LOG_ERR, "invalid line %d", parse.lineno);
 		return -1;
 	}
 
 	if (! *tok) {
-		syslog(LOG_ERR, "invalid line %d", lineno);
+		syslog(LOG_ERR, "invalid line %d", parse.lineno);
 		return -1;
 	}
 
 	/* constraints have different syntax */
 	if (op == '!' || op == '>') {
+		constraints_fingerprint = constraints_fingerprint * 31 + line_hash;
 		return add_constraint(op, raw, tok);
 	}
 
 	if (!strcmp(raw, "Domain")) {
-		domain = create_domain(tok);
-		group = NULL;
+		parse.domain = create_domain(tok);
+		parse.group = NULL;
 		return 0;
 	}
 
-	if (!domain) {
-		domain = create_domain("Default");
-		if (!domain)
+	if (!parse.domain) {
+		parse.domain = create_domain("Default");
+		if (!parse.domain)
 			return -1;
-		group = NULL;
+		parse.group = NULL;
 	}
 
-	if (!group &&
+	parse.domain->fingerprint = parse.domain->fingerprint * 31 + line_hash;
+
+	if (!parse.group &&
 	    (!strcmp(raw, "Whitespace") || !strcmp(raw, "Join") ||
 	     !strcmp(raw, "Prefix") || !strcmp(raw, "Suffix") ||
 		 !strcmp(raw, "Default"))) {
-		syslog(LOG_ERR, "expected  ModifierGroup declaration on line %d", lineno);
+		syslog(LOG_ERR, "expected  ModifierGroup declaration on line %d", parse.lineno);
 		return -1;
 	}
 
@@ -812,44 +829,44 @@ process_trans(char *buffer) {
 		}
 		globfree(&g);
 	} else if (!strcmp(raw, "Base")) {
-		base_classification = 1;
+		parse.base_classification = 1;
 	} else if (!strcmp(raw, "ModifierGroup")) {
-		group = create_group(&domain->groups, tok);
-		if (!group)
+		parse.group = create_group(&parse.domain->groups, tok);
+		if (!parse.group)
 			return -1;
-		base_classification = 0;
+		parse.base_classification = 0;
 	} else if (!strcmp(raw, "Whitespace")) {
-		if (update (&group->whitespace, tok) < 0)
+		if (update (&parse.group->whitespace, tok) < 0)
 			return -1;
 	} else if (!strcmp(raw, "Join")) {
-		if (update (&group->join, tok) < 0)
+		if (update (&parse.group->join, tok) < 0)
 			return -1;
 	} else if (!strcmp(raw, "Prefix")) {
-		if (append (&group->prefixes, tok) < 0)
+		if (append (&parse.group->prefixes, tok) < 0)
 			return -1;
 	} else if (!strcmp(raw, "Suffix")) {
-		if (append (&group->suffixes, tok) < 0)
+		if (append (&parse.group->suffixes, tok) < 0)
 			return -1;
 	} else if (!strcmp(raw, "Default")) {
-		ebitmap_t empty;
-		ebitmap_init(&empty);
-		if (parse_ebitmap(&group->def, &empty, tok) < 0) {
-			syslog(LOG_ERR, "unable to parse Default %d", lineno);
+		catset_t empty;
+		catset_init(&empty);
+		if (parse_catset(&parse.group->def, &empty, tok) < 0) {
+			syslog(LOG_ERR, "unable to parse Default %d", parse.lineno);
 			return -1;
 		}
-	} else if (group) {
-		if (add_word(group, raw, tok) < 0) {
-			syslog(LOG_ERR, "unable to add base_classification on line %d", lineno);
+	} else if (parse.group) {
+		if (add_word(parse.group, raw, tok) < 0) {
+			syslog(LOG_ERR, "unable to add base_classification on line %d", parse.lineno);
 			return -1;
 		}
 	} else {
-		if (base_classification) {
-			if (add_base_classification(domain, raw, tok) < 0) {
-				syslog(LOG_ERR, "unable to add base_classification on line %d", lineno);
+		if (parse.base_classification) {
+			if (add_base_classification(parse.domain, raw, tok) < 0) {
+				syslog(LOG_ERR, "unable to add base_classification on line %d", parse.lineno);
 				return -1;
 			}
 		}
-		if (add_cache(domain, raw, tok) < 0)
+		if (add_cache(parse.domain, raw, tok) < 0)
 			return -1;
 	}
 	return 0;
@@ -885,6 +902,8 @@ init_translations(void) {
 	if (is_selinux_mls_enabled() <= 0)
 		return -1;
 
+	memset(&parse, 0, sizeof(parse));
+
 	return(read_translations(selinux_translations_path()));
 }
 
@@ -969,6 +988,31 @@ word_size(const void *p1, const void *p2) {
 	return (w2_len - w1_len);
 }
 
+/* Index the sorted words by their first character. */
+static int
+index_words(word_group_t *g) {
+	int pos[UCHAR_MAX + 1];
+	int i, c;
+
+	free(g->iword);
+	g->iword = calloc(g->sword_len ? g->sword_len : 1, sizeof(word_t *));
+	if (!g->iword) {
+		log_error("allocation error %s", strerror(errno));
+		return -1;
+	}
+
+	memset(g->iword_start, 0, sizeof(g->iword_start));
+	for (i = 0; i < g->sword_len; i++)
+		g->iword_start[(unsigned char)g->sword[i]->text[0] + 1]++;
+	for (c = 0; c <= UCHAR_MAX; c++) {
+		g->iword_start[c + 1] += g->iword_start[c];
+		pos[c] = g->iword_start[c];
+	}
+	for (i = 0; i < g->sword_len; i++)
+		g->iword[pos[(unsigned char)g->sword[i]->text[0]]++] = g->sword[i];
+	return 0;
+}
+
 void
 build_regexp(pcre **r, char *buffer) {
 	const char *error;
@@ -1050,6 +1094,8 @@ build_regexps(domain_t *domain) {
 			g->sword[i++]=w;
 
 		qsort(g->sword, g->sword_len, sizeof(word_t *), word_size);
+		if (index_words(g) < 0)
+			return -1;
 
 		for (i=0; i < g->sword_len; i++) {
 			if (i) strcat(buffer,"|");
@@ -1101,11 +1147,7 @@ compute_raw_from_trans(const char *level, domain_t *domain) {
 	const char * match = NULL;
 	int work_len;
 	mls_level_t *mraw = NULL;
-	ebitmap_t set, clear, tmp;
-
-	ebitmap_init(&set);
-	ebitmap_init(&clear);
-	ebitmap_init(&tmp);
+	catset_t set, clear, tmp;
 
 	work = strdup(level);
 	if (!work) {
@@ -1134,8 +1176,7 @@ compute_raw_from_trans(const char *level, domain_t *domain) {
 					log_error("allocation error %s", strerror(errno));
 					goto err;
 				}
-				if (mls_level_cpy(mraw, bc->level) < 0)
-					goto err;
+				*mraw = *bc->level;
 				break;
 			}
 		}
@@ -1195,31 +1236,25 @@ compute_raw_from_trans(const char *level, domain_t *domain) {
 						char *p = triml((char *)match, g->whitespace);
 						while (p && *p) {
 							int plen = strlen(p);
+							int c = (unsigned char)*p;
 							int i;
-							for (i = 0; i < g->sword_len; i++) {
-								word_t *w = g->sword[i];
+							for (i = g->iword_start[c]; i < g->iword_start[c + 1]; i++) {
+								word_t *w = g->iword[i];
 								int wlen = strlen(w->text);
-								if (plen >= wlen && !strncmp(w->text, p, strlen(w->text))){
-									if (ebitmap_andnot(&set, &w->cat, &g->def, maxbit) < 0) goto err;
-
-									if (ebitmap_xor(&tmp, &w->cat, &g->def) < 0) goto err;
-									if (ebitmap_and(&clear, &tmp, &g->def) < 0) goto err;
-									if (ebitmap_union(&mraw->cat, &set) < 0) goto err;
+								if (plen >= wlen && !strncmp(w->text, p, wlen)){
+									catset_andnot(&set, &w->cat, &g->def);
 
-									ebitmap_destroy(&tmp);
-									if (ebitmap_cpy(&tmp, &mraw->cat) < 0) goto err;
-									ebitmap_destroy(&mraw->cat);
-									if (ebitmap_andnot(&mraw->cat, &tmp, &clear, maxbit) < 0) goto err;
+									catset_xor(&tmp, &w->cat, &g->def);
+									catset_and(&clear, &tmp, &g->def);
+									catset_or(&mraw->cat, &mraw->cat, &set);
+									catset_andnot(&mraw->cat, &mraw->cat, &clear);
 
-									ebitmap_destroy(&tmp);
-									ebitmap_destroy(&set);
-									ebitmap_destroy(&clear);
 									p += strlen(w->text);
 									change++;
 									break;
 								}
 							}
-							if (i == g->sword_len) {
+							if (i == g->iword_start[c + 1]) {
 								syslog(LOG_ERR, "conversion error");
 								break;
 							}
@@ -1250,7 +1285,6 @@ compute_raw_from_trans(const char *level, domain_t *domain) {
 	}
 	if (complete)
 		r = mls_level_to_string(mraw);
-	mls_level_destroy(mraw);
 	free(mraw);
 
 #ifdef DEBUG
@@ -1267,16 +1301,29 @@ compute_raw_from_trans(const char *level, domain_t *domain) {
 	return r;
 
 err:
-	mls_level_destroy(mraw);
 	free(mraw);
 	free(work);
 	pcre_free((void *)match);
-	ebitmap_destroy(&tmp);
-	ebitmap_destroy(&set);
-	ebitmap_destroy(&clear);
 	return NULL;
 }
 
+static int
+grow_candidates(word_t ***cand, word_group_t ***cand_group, int *alloc, int n) {
+	if (n < *alloc)
+		return 0;
+	int nalloc = *alloc ? *alloc * 2 : 32;
+	word_t **c = realloc(*cand, nalloc * sizeof(word_t *));
+	if (!c)
+		return -1;
+	*cand = c;
+	word_group_t **cg = realloc(*cand_group, nalloc * sizeof(word_group_t *));
+	if (!cg)
+		return -1;
+	*cand_group = cg;
+	*alloc = nalloc;
+	return 0;
+}
+
 char *
 compute_trans_from_raw(const char *level, domain_t *domain) {
 
@@ -1287,14 +1334,9 @@ compute_trans_from_raw(const char *level, domain_t *domain) {
 
 	mls_level_t *l = NULL;
 	char *rval = NULL;
-	ebitmap_t bit_diff, temp, handled, nothandled, unhandled, orig_unhandled;
-
-	ebitmap_init(&bit_diff);
-	ebitmap_init(&temp);
-	ebitmap_init(&handled);
-	ebitmap_init(&nothandled);
-	ebitmap_init(&unhandled);
-	ebitmap_init(&orig_unhandled);
+	word_t **cand = NULL;
+	word_group_t **cand_group = NULL;
+	int cand_alloc = 0;
 
 	if (!level)
 		goto err;
@@ -1321,15 +1363,13 @@ compute_trans_from_raw(const char *level, domain_t *domain) {
 			/* skip if alias of last bc */
 			if (last &&
 			    last->level->sens == bc->level->sens &&
-			    ebitmap_cmp(&last->level->cat, &bc->level->cat) == 0)
+			    catset_eq(&last->level->cat, &bc->level->cat))
 				continue;
 
 			/* compute bits not consumed by base classification */
-			ebitmap_t unhandled, orig_unhandled;
-			if (ebitmap_xor(&unhandled, &l->cat, &bc->level->cat) < 0)
-				goto err;
-			if (ebitmap_cpy(&orig_unhandled, &unhandled) < 0)
-				goto err;
+			catset_t unhandled, orig_unhandled;
+			catset_xor(&unhandled, &l->cat, &bc->level->cat);
+			orig_unhandled = unhandled;
 
 			/* prebuild groups */
 			word_group_t *g;
@@ -1353,66 +1393,52 @@ compute_trans_from_raw(const char *level, domain_t *domain) {
 				}
 			}
 
+			/*
+			 * A word can only be picked if all its bits are among
+			 * those the base classification left over, and then
+			 * its distance only depends on the bits still
+			 * unhandled, so find those words once.
+			 */
+			int ncand = 0;
+			for (g = domain->groups; g; g = g->next) {
+				word_t *w;
+				for (w = g->words; w; w = w->next) {
+					/* If the word is all inverse bits and the level does not have inverse bits - skip */
+					if (catset_count(&w->normal) && !doInverse)
+						continue;
+					catset_t temp;
+					catset_and(&temp, &w->bits, &orig_unhandled);
+					if (catset_eq(&temp, &w->bits)) {
+						if (grow_candidates(&cand, &cand_group, &cand_alloc, ncand) < 0)
+							goto err;
+						cand[ncand] = w;
+						cand_group[ncand++] = g;
+					}
+				}
+			}
+
 			int loops, hamming, change=1;
-			for (loops = 50; ebitmap_cardinality(&unhandled) && loops > 0 && change; loops--) {
+			for (loops = 50; catset_count(&unhandled) && loops > 0 && change; loops--) {
 				change = 0;
 				hamming = 10000;
-				ebitmap_t handled, nothandled;
-				if (ebitmap_xor(&handled, &unhandled, &orig_unhandled) < 0)
-					goto err;
-				if (ebitmap_not(&nothandled, &handled, maxbit) < 0)
-					goto err;
 				word_group_t *currentGroup = NULL;
 				word_t *currentWord = NULL;
-				for (g = domain->groups; g && hamming; g = g->next) {
-					word_t *w;
-					for (w = g->words; w && hamming; w = w->next) {
-						int cardinality = ebitmap_cardinality(&w->normal);
-						/* If the word is all inverse bits and the level does not have inverse bits - skip */
-						if (cardinality && !doInverse) {
-							continue;
-						}
-
-						/* if only unhandled bits are different */
-						ebitmap_t temp;
-						ebitmap_t bit_diff;
-						if (ebitmap_or(&temp, &w->normal, &w->inverse) < 0)
-							goto err;
-						if (ebitmap_and(&bit_diff, &temp, &nothandled) < 0)
-							goto err;
-						ebitmap_destroy(&temp);
-// xor bit_diff handled?
-						if (ebitmap_and(&temp, &bit_diff, &unhandled) < 0)
-							goto err;
-						if (ebitmap_cmp(&bit_diff, &temp)) {
-							int h = ebitmap_hamming_distance(&bit_diff, &unhandled);
-							if (h < hamming) {
-								hamming = h;
-								currentGroup = g;
-								currentWord = w;
-							}
-						}
-						ebitmap_destroy(&bit_diff);
-						ebitmap_destroy(&temp);
+				int i;
+				for (i = 0; i < ncand && hamming; i++) {
+					catset_t bit_diff;
+					catset_and(&bit_diff, &cand[i]->bits, &unhandled);
+					int h = catset_distance(&bit_diff, &unhandled);
+					if (h < hamming) {
+						hamming = h;
+						currentGroup = cand_group[i];
+						currentWord = cand[i];
 					}
 				}
-				ebitmap_destroy(&handled);
-				ebitmap_destroy(&nothandled);
 
 				if (currentWord) {
-					ebitmap_t bit_diff;
-					if (ebitmap_xor(&bit_diff, &currentWord->cat, &bc->level->cat) < 0)
-						goto err;
-
-					ebitmap_t temp;
-					if (ebitmap_cpy(&temp, &unhandled) < 0)
-						goto err;
-					ebitmap_destroy(&unhandled);
-					if (ebitmap_andnot(&unhandled, &temp, &bit_diff, maxbit) < 0)
-						goto err;
-
-					ebitmap_destroy(&bit_diff);
-					ebitmap_destroy(&temp);
+					catset_t bit_diff;
+					catset_xor(&bit_diff, &currentWord->cat, &bc->level->cat);
+					catset_andnot(&unhandled, &unhandled, &bit_diff);
 
 					word_group_t **t;
 					for (t = &groups; *t; t = &(*t)->next)
@@ -1423,9 +1449,7 @@ compute_trans_from_raw(const char *level, domain_t *domain) {
 				}
 			}
 
-			done = (ebitmap_cardinality(&unhandled) == 0);
-			ebitmap_destroy(&unhandled);
-			ebitmap_destroy(&orig_unhandled);
+			done = (catset_count(&unhandled) == 0);
 			if (done) {
 				char buffer[9999];
 				buffer[0] = 0;
@@ -1468,10 +1492,9 @@ compute_trans_from_raw(const char *level, domain_t *domain) {
 		}
 		last = bc;
 	}
-	if (l) {
-		mls_level_destroy(l);
-		free(l);
-	}
+	free(l);
+	free(cand);
+	free(cand_group);
 
 #ifdef DEBUG
 	struct timeval stopTime;
@@ -1490,8 +1513,9 @@ compute_trans_from_raw(const char *level, domain_t *domain) {
 err:
 	while (groups)
 		destroy_group(&groups, groups);
-	mls_level_destroy(l);
 	free(l);
+	free(cand);
+	free(cand_group);
 	return NULL;
 }
 
@@ -1741,22 +1765,133 @@ untrans_context(const security_context_t incon, security_context_t *rcon) {
 	return 0;
 }
 
+/* Move the calling thread's translations out into t. */
+static void
+detach_translations(translations_t *t) {
+	t->domains = domains;
+	t->sens_constraints = sens_constraints;
+	t->cat_constraints = cat_constraints;
+	t->constraints_fingerprint = constraints_fingerprint;
+	domains = NULL;
+	sens_constraints = NULL;
+	cat_constraints = NULL;
+	constraints_fingerprint = 0;
+}
+
+void
+destroy_translations(translations_t *t) {
+	if (!t)
+		return;
+	while(t->domains) {
+		domain_t *next = t->domains->next;
+		destroy_domain(t->domains);
+		t->domains = next;
+	}
+	while(t->sens_constraints) {
+		sens_constraint_t *next = t->sens_constraints->next;
+		destroy_sens_constraint(&t->sens_constraints, t->sens_constraints);
+		t->sens_constraints = next;
+	}
+	while(t->cat_constraints) {
+		cat_constraint_t *next = t->cat_constraints->next;
+		destroy_cat_constraint(&t->cat_constraints, t->cat_constraints);
+		t->cat_constraints = next;
+	}
+}
+
 void
 finish_context_translations(void) {
-	while(domains) {
-		domain_t *next = domains->next;
-		destroy_domain(domains);
-		domains = next;
+	translations_t t;
+
+	detach_translations(&t);
+	destroy_translations(&t);
+}
+
+/* Read the configuration into a new set of translations, leaving the
+   calling thread's own (which should be empty) untouched. */
+translations_t *
+build_translations(void) {
+	translations_t saved, *t;
+
+	t = calloc(1, sizeof(*t));
+	if (!t) {
+		log_error("allocation error %s", strerror(errno));
+		return NULL;
 	}
-	while(sens_constraints) {
-		sens_constraint_t *next = sens_constraints->next;
-		destroy_sens_constraint(&sens_constraints, sens_constraints);
-		sens_constraints = next;
+
+	detach_translations(&saved);
+	if (init_translations()) {
+		finish_context_translations();
+		free(t);
+		t = NULL;
+	} else {
+		detach_translations(t);
 	}
-	while(cat_constraints) {
-		cat_constraint_t *next = cat_constraints->next;
-		destroy_cat_constraint(&cat_constraints, cat_constraints);
-		cat_constraints = next;
+	domains = saved.domains;
+	sens_constraints = saved.sens_constraints;
+	cat_constraints = saved.cat_constraints;
+	constraints_fingerprint = saved.constraints_fingerprint;
+	return t;
+}
+
+/* Copy the answers cached by the old domain that the new one lacks. */
+static int
+carry_cache(domain_t *to, domain_t *from) {
+	context_map_node_t *n;
+	int i;
+
+	for (i = 0; i < N_BUCKETS; i++) {
+		for (n = from->raw_to_trans[i]; n; n = n->next) {
+			if (find_in_table(to->raw_to_trans, n->map->raw) ||
+			    find_in_table(to->trans_to_raw, n->map->trans))
+				continue;
+			if (add_cache(to, n->map->raw, n->map->trans) < 0)
+				return -1;
+		}
 	}
+	return 0;
 }
 
+/*
+ * Make t the calling thread's translations and free both t and the
+ * translations it replaces.  Cached answers of a domain are kept when
+ * neither its configuration nor the constraints changed.  Returns 1 if
+ * the whole configuration is unchanged, so that every answer given
+ * before is still valid, and 0 otherwise.
+ */
+int
+install_translations(translations_t *t) {
+	translations_t old;
+	domain_t *d, *o;
+	int same;
+
+	detach_translations(&old);
+	domains = t->domains;
+	sens_constraints = t->sens_constraints;
+	cat_constraints = t->cat_constraints;
+	constraints_fingerprint = t->constraints_fingerprint;
+	free(t);
+
+	same = old.constraints_fingerprint == constraints_fingerprint;
+	for (d = domains, o = old.domains; d || o;
+	     d = d ? d->next : NULL, o = o ? o->next : NULL) {
+		if (!d || !o || strcmp(d->name, o->name) ||
+		    d->fingerprint != o->fingerprint)
+			same = 0;
+	}
+
+	if (old.constraints_fingerprint == constraints_fingerprint) {
+		for (d = domains; d; d = d->next) {
+			for (o = old.domains; o; o = o->next)
+				if (!strcmp(d->name, o->name))
+					break;
+			if (!o || d->fingerprint != o->fingerprint)
+				continue;
+			if (carry_cache(d, o) < 0)
+				break;
+		}
+	}
+
+	destroy_translations(&old);
+	return same;
+}
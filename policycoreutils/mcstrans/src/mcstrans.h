@@ -7,3 +7,8 @@ extern void finish_context_translations(void);
 extern int trans_context(const security_context_t, security_context_t *);
 extern int untrans_context(const security_context_t, security_context_t *);
 
+typedef struct translations translations_t;
+extern translations_t *build_translations(void);
+extern int install_translations(translations_t *);
+extern void destroy_translations(translations_t *);
+
@@ -1,10 +1,13 @@
 /* Copyright (c) 2006 Trusted Computer Solutions, Inc. */
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -37,6 +40,24 @@
 #define MAX_DATA_BUF			4096
 #define MAX_DESCRIPTORS			8192
 
+/*
+ * Table of answered raw to translated ranges that clients map read-only
+ * so they need not ask again.  Must match libselinux setrans_internal.h.
+ */
+#define SETRANS_TABLE_FILE		"/var/run/setrans/.setrans-table"
+#define SETRANS_TABLE_MAGIC		0xf97c5e71
+#define SETRANS_TABLE_SLOTS		8192
+#define SETRANS_TABLE_SIZE		(1024 * 1024)
+
+struct setrans_table {
+	uint32_t magic;
+	uint32_t stale;
+	uint32_t nslots;
+	uint32_t size;
+	uint32_t used;
+	uint32_t slots[SETRANS_TABLE_SLOTS];
+};
+
 #ifdef DEBUG
 //#define log_debug(fmt, ...) syslog(LOG_DEBUG, fmt, __VA_ARGS__)
 #define log_debug(fmt, ...) fprintf(stderr, fmt, __VA_ARGS__)
@@ -60,13 +81,176 @@ extern int raw_color(const security_context_t, char **);
 
 static int sockfd = -1;	/* socket we are listening on */
 
+static struct setrans_table *table;	/* exported translations */
+static unsigned int table_entries;
+
 static volatile int restart_daemon = 0;
+
+/* translations built by reload_thread() arrive on reload_pipe[0] */
+static int reload_pipe[2] = { -1, -1 };
+static int reloading;
+
+/* Tell clients still mapping the table to look for a new one. */
+static void
+table_release(struct setrans_table *old)
+{
+	if (!old)
+		return;
+	old->stale = 1;
+	munmap(old, SETRANS_TABLE_SIZE);
+}
+
+/*
+ * Mark stale a table left behind by an earlier daemon that did not exit
+ * cleanly, which clients may still be mapping.
+ */
+static void
+table_release_file(void)
+{
+	struct stat sb;
+	void *map;
+	int fd;
+
+	fd = open(SETRANS_TABLE_FILE, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) &&
+	    sb.st_size == SETRANS_TABLE_SIZE) {
+		map = mmap(NULL, SETRANS_TABLE_SIZE, PROT_READ | PROT_WRITE,
+			   MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			if (((struct setrans_table *)map)->magic ==
+			    SETRANS_TABLE_MAGIC)
+				table_release(map);
+			else
+				munmap(map, SETRANS_TABLE_SIZE);
+		}
+	}
+	close(fd);
+}
+
+/* Export a new, empty table in place of the current one. */
+static void
+table_create(void)
+{
+	char path[] = SETRANS_TABLE_FILE "XXXXXX";
+	struct setrans_table *old = table;
+	void *map = MAP_FAILED;
+	int fd;
+
+	table = NULL;
+	table_entries = 0;
+	if (!old)
+		table_release_file();
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		goto err;
+	if (fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) ||
+	    ftruncate(fd, SETRANS_TABLE_SIZE))
+		goto err;
+	map = mmap(NULL, SETRANS_TABLE_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+
+	table = map;
+	table->magic = SETRANS_TABLE_MAGIC;
+	table->nslots = SETRANS_TABLE_SLOTS;
+	table->size = SETRANS_TABLE_SIZE;
+	table->used = sizeof(*table);
+	if (rename(path, SETRANS_TABLE_FILE))
+		goto err;
+	close(fd);
+	table_release(old);
+	return;
+
+err:
+	syslog(LOG_ERR, "Failed to export the translation table: %m");
+	if (map != MAP_FAILED)
+		munmap(map, SETRANS_TABLE_SIZE);
+	table = NULL;
+	if (fd >= 0) {
+		(void)unlink(path);
+		close(fd);
+	}
+	(void)unlink(SETRANS_TABLE_FILE);
+	table_release(old);
+}
+
+/* The MLS range is everything after the type. */
+static const char *
+context_range(const char *con)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		con = strchr(con, ':');
+		if (!con)
+			return NULL;
+		con++;
+	}
+	return con;
+}
+
+/* Add the translation of a raw context to the exported table. */
+static void
+table_add(const char *raw, const char *trans)
+{
+	const char *range = context_range(raw);
+	uint32_t hash = 2166136261U, i, off;
+	size_t range_len, trans_len, prefix;
+	const char *p;
+	char *data;
+
+	if (!table || !range)
+		return;
+	/* only the range is translated */
+	prefix = range - raw;
+	if (strncmp(raw, trans, prefix))
+		return;
+	trans += prefix;
+
+	range_len = strlen(range) + 1;
+	trans_len = strlen(trans) + 1;
+	if (table_entries >= SETRANS_TABLE_SLOTS / 4 * 3 ||
+	    table->used + range_len + trans_len > SETRANS_TABLE_SIZE)
+		return;
+
+	for (p = range; *p; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 16777619U;
+	}
+	for (i = hash; ; i++) {
+		off = table->slots[i & (SETRANS_TABLE_SLOTS - 1)];
+		if (!off)
+			break;
+		if (strcmp((char *)table + off, range) == 0)
+			return;
+	}
+
+	off = table->used;
+	data = (char *)table + off;
+	memcpy(data, range, range_len);
+	memcpy(data + range_len, trans, trans_len);
+	table->used += range_len + trans_len;
+	/* the strings must be visible before the slot pointing to them */
+	__sync_synchronize();
+	table->slots[i & (SETRANS_TABLE_SLOTS - 1)] = off;
+	table_entries++;
+}
+
 static void cleanup_exit(int ret) __attribute__ ((noreturn));
 static void
 cleanup_exit(int ret) 
 {
 	finish_context_colors();
 	finish_context_translations();
+	if (table) {
+		(void)unlink(SETRANS_TABLE_FILE);
+		table_release(table);
+		table = NULL;
+	}
 	if (sockfd >=0)
 		(void)unlink(SETRANS_UNIX_SOCKET);
 
@@ -117,7 +301,9 @@ send_response(int fd, uint32_t function, char *data, int32_t ret_val)
 		return -1;
 	}
 
-	return ret_val;
+	/* a failed translation is still a valid response; the client may
+	 * keep using the connection */
+	return 0;
 }
 
 static int
@@ -179,6 +365,8 @@ process_request(int fd, uint32_t function, char *data1, char *UNUSED(data2))
 		break;
 	case RAW_TO_TRANS_CONTEXT:
 		result = trans_context(data1, &out);
+		if (!result && out)
+			table_add(data1, out);
 		ret = send_response(fd, function, out, result);
 		break;
 	case TRANS_TO_RAW_CONTEXT:
@@ -281,121 +469,154 @@ service_request(int fd)
 	return ret;
 }
 
-static int
-add_pollfd(struct pollfd **ufds, int *nfds, int connfd)
+/* Make the translations read by reload_thread() current. */
+static void
+reload_finish(translations_t *t)
 {
-	int ii = 0;
-
-	/* First see if we can find an already invalidated ufd */
-	for (ii = 0; ii < *nfds; ii++) {
-		if ((*ufds)[ii].fd == -1)
-			break;
+	reloading = 0;
+	if (!t) {
+		syslog(LOG_ERR, "Failed to reload label translations, "
+		       "keeping the current ones");
+		return;
 	}
 
-	if (ii == *nfds) {
-		struct pollfd *tmp = (struct pollfd *)realloc(*ufds,
-					(*nfds+1)*sizeof(struct pollfd));
-		if (!tmp) {
-			syslog(LOG_ERR, "realloc failed for %d fds", *nfds+1);
-			return -1;
-		}
+	/* answers already exported stay valid if nothing changed */
+	if (!install_translations(t))
+		table_create();
 
-		*ufds = tmp;
-		(*nfds)++;
+	finish_context_colors();
+	if (init_colors()) {
+		syslog(LOG_ERR, "Failed to initialize color translations");
+		syslog(LOG_ERR, "No color information will be available");
 	}
+	syslog(LOG_NOTICE, "Translations reloaded");
+}
+
+static void *
+reload_thread(void *UNUSED(arg))
+{
+	translations_t *t = build_translations();
 
-	(*ufds)[ii].fd = connfd;
-	(*ufds)[ii].events = POLLIN|POLLPRI;
-	(*ufds)[ii].revents = 0;
+	while (write(reload_pipe[1], &t, sizeof(t)) < 0 && errno == EINTR)
+		;
+	return NULL;
+}
 
-	return 0;
+/* Read the translations again while requests are still answered from
+   the current ones; they are swapped in by reload_finish(). */
+static void
+reload_start(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all, old;
+	int rc = -1;
+
+	syslog(LOG_NOTICE, "Reload Translations");
+
+	if (reload_pipe[0] >= 0 && !pthread_attr_init(&attr)) {
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		/* signals are for the main thread */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		rc = pthread_create(&thread, &attr, reload_thread, NULL);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		pthread_attr_destroy(&attr);
+	}
+	if (rc) {
+		/* no thread, build them here */
+		reload_finish(build_translations());
+		return;
+	}
+	reloading = 1;
 }
 
 static void
-adj_pollfds(struct pollfd **ufds, int *nfds)
+reload_receive(void)
 {
-	int ii, jj;
-
-	jj = 0;
-	for (ii = 0; ii < *nfds; ii++) {
-		if ((*ufds)[ii].fd != -1) {
-			if (jj < ii)
-				(*ufds)[jj] = (*ufds)[ii];
-			jj++;
-		}
+	translations_t *t;
+	ssize_t count;
+
+	while ((count = read(reload_pipe[0], &t, sizeof(t))) < 0 &&
+	       errno == EINTR)
+		;
+	if (count != sizeof(t)) {
+		syslog(LOG_ERR, "Failed to read reloaded translations: %m");
+		return;
 	}
-	*nfds = jj;
+	reload_finish(t);
 }
 
+#define MAX_EVENTS			64
+
+/* Accept a connection and watch it for requests. */
 static int
-process_events(struct pollfd **ufds, int *nfds)
+add_connection(int epfd)
 {
-	int ii = 0;
-	int ret = 0;
-
-	for (ii = 0; ii < *nfds; ii++) {
-		short revents = (*ufds)[ii].revents;
-		int connfd = (*ufds)[ii].fd;
-
-		if (revents & (POLLIN | POLLPRI)) {
-			if (connfd == sockfd) {
-
-				/* Probably received a connection */
-				if ((connfd = accept(sockfd, NULL, NULL)) < 0) {
-					syslog(LOG_ERR, "accept() failed: %m");
-					return -1;
-				}
-
-				if (add_pollfd(ufds, nfds, connfd)) {
-					syslog(LOG_ERR,
-					  "Failed to add fd (%d) to poll list\n",
-						connfd);
-					return -1;
-				}
-			} else {
-				ret = service_request(connfd);
-				if (ret) {
-					if (ret < 0) {
-						syslog(LOG_ERR,
-							"Servicing of request "
-							"failed for fd (%d)\n",
-							connfd);
-					}
-					/* Setup pollfd for deletion later. */
-					(*ufds)[ii].fd = -1;
-					close(connfd);
-					/* So we don't get bothered later */
-					revents = revents & ~(POLLHUP);
-				}
-			}
-			revents = revents & ~(POLLIN | POLLPRI);
-		}
-		if (revents & POLLHUP) {
-			log_debug("The connection with fd (%d) hung up\n",
-				connfd);
+	struct epoll_event ev;
+	int connfd;
 
-			/* Set the pollfd up for deletion later. */
-			(*ufds)[ii].fd = -1;
-			close(connfd);
+	if ((connfd = accept(sockfd, NULL, NULL)) < 0) {
+		syslog(LOG_ERR, "accept() failed: %m");
+		return -1;
+	}
 
-			revents = revents & ~(POLLHUP);
-		}
-		if (revents) {
-			syslog(LOG_ERR, "Unknown/error events (%x) encountered"
-					" for fd (%d)\n", revents, connfd);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.fd = connfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+		syslog(LOG_ERR, "Failed to add fd (%d) to epoll set: %m",
+		       connfd);
+		close(connfd);
+	}
+	return 0;
+}
 
-			/* Set the pollfd up for deletion later. */
-			(*ufds)[ii].fd = -1;
-			close(connfd);
-		}
+static void
+process_event(int epfd, struct epoll_event *ev)
+{
+	uint32_t revents = ev->events;
+	int connfd = ev->data.fd;
+	int ret;
 
-		(*ufds)[ii].revents = 0;
+	if (connfd == sockfd) {
+		/* Probably received a connection */
+		if (add_connection(epfd))
+			cleanup_exit(1);
+		return;
 	}
 
-	/* Delete any invalidated ufds */
-	adj_pollfds(ufds, nfds);
+	if (connfd == reload_pipe[0]) {
+		reload_receive();
+		return;
+	}
 
-	return 0;
+	if (revents & (EPOLLIN | EPOLLPRI)) {
+		ret = service_request(connfd);
+		if (ret) {
+			if (ret < 0) {
+				syslog(LOG_ERR,
+					"Servicing of request "
+					"failed for fd (%d)\n",
+					connfd);
+			}
+			/* closing the fd also removes it from the set */
+			close(connfd);
+			return;
+		}
+		revents &= ~(EPOLLIN | EPOLLPRI);
+	}
+	if (revents & EPOLLHUP) {
+		log_debug("The connection with fd (%d) hung up\n",
+			connfd);
+		close(connfd);
+		return;
+	}
+	if (revents) {
+		syslog(LOG_ERR, "Unknown/error events (%x) encountered"
+				" for fd (%d)\n", revents, connfd);
+		close(connfd);
+	}
 }
 
 static void
@@ -404,48 +625,51 @@ process_connections(void) __attribute__ ((noreturn));
 static void
 process_connections(void)
 {
-	int ret = 0;
-	int nfds = 1;
+	struct epoll_event ev, events[MAX_EVENTS];
+	int epfd, nevents, ii;
 
-	struct pollfd *ufds = (struct pollfd *)malloc(sizeof(struct pollfd));
-	if (!ufds) {
-		syslog(LOG_ERR, "Failed to allocate a pollfd");
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		syslog(LOG_ERR, "epoll_create1() failed: %m");
+		cleanup_exit(1);
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.fd = sockfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+		syslog(LOG_ERR, "Failed to add the listening socket to epoll set: %m");
 		cleanup_exit(1);
 	}
-	ufds[0].fd = sockfd;
-	ufds[0].events = POLLIN|POLLPRI;
-	ufds[0].revents = 0;
+
+	if (pipe2(reload_pipe, O_CLOEXEC) == 0) {
+		ev.data.fd = reload_pipe[0];
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, reload_pipe[0], &ev) < 0) {
+			close(reload_pipe[0]);
+			close(reload_pipe[1]);
+			reload_pipe[0] = reload_pipe[1] = -1;
+		}
+	} else {
+		reload_pipe[0] = reload_pipe[1] = -1;
+	}
 
 	while (1) {
-		if (restart_daemon) {
-			syslog(LOG_NOTICE, "Reload Translations");
-			finish_context_colors();
-			finish_context_translations();
-			if (init_translations()) {
-				syslog(LOG_ERR, "Failed to initialize label translations");
-				cleanup_exit(1);
-			}
-			if (init_colors()) {
-				syslog(LOG_ERR, "Failed to initialize color translations");
-				syslog(LOG_ERR, "No color information will be available");
-			}
+		/* a SIGHUP during a reload starts another one after it */
+		if (restart_daemon && !reloading) {
 			restart_daemon = 0;
+			reload_start();
 		}
 
-		ret = poll(ufds, nfds, -1);
-		if (ret < 0) {
+		nevents = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if (nevents < 0) {
 			if (errno == EINTR) {
 				continue;
 			}
-			syslog(LOG_ERR, "poll() failed: %m");
+			syslog(LOG_ERR, "epoll_wait() failed: %m");
 			cleanup_exit(1);
 		}
 
-		ret = process_events(&ufds, &nfds);
-		if (ret) {
-			syslog(LOG_ERR, "Error processing events");
-			cleanup_exit(1);
-		}
+		for (ii = 0; ii < nevents; ii++)
+			process_event(epfd, &events[ii]);
 	}
 }
 
@@ -479,6 +703,7 @@ initialize(void)
 		syslog(LOG_ERR, "Failed to initialize color translations");
 		syslog(LOG_ERR, "No color information will be available");
 	}
+	table_create();
 
 	/* the socket will be unlinked when the daemon terminates */
 	act.sa_handler = sigterm_handler;
@@ -1,6 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "mls_level.h"
-#include <sepol/policydb/ebitmap.h>
 
 mls_level_t *mls_level_from_string(char *mls_context)
 {
@@ -46,7 +47,7 @@ mls_level_t *mls_level_from_string(char *mls_context)
 			if (*scontextp != 'c')
 				goto err;
 			int bit = atoi(scontextp + 1);
-			if (ebitmap_set_bit(&l->cat, bit, 1))
+			if (catset_set_bit(&l->cat, bit, 1))
 				goto err;
 
 			/* If level, set all categories in level */
@@ -56,8 +57,7 @@ mls_level_t *mls_level_from_string(char *mls_context)
 				int ubit = atoi(lptr + 1);
 				int i;
 				for (i = bit + 1; i <= ubit; i++) {
-					if (ebitmap_set_bit
-					    (&l->cat, i, 1))
+					if (catset_set_bit(&l->cat, i, 1))
 						goto err;
 				}
 			}
@@ -83,15 +83,14 @@ unsigned int mls_compute_string_len(mls_level_t *l)
 	unsigned int len = 0;
 	char temp[16];
 	unsigned int i, level = 0;
-	ebitmap_node_t *cnode;
 
 	if (!l)
 		return 0;
 
 	len += snprintf(temp, sizeof(temp), "s%d", l->sens);
 
-	ebitmap_for_each_bit(&l->cat, cnode, i) {
-		if (ebitmap_node_get_bit(cnode, i)) {
+	for (i = 0; i < CATSET_WORDS * 64; i++) {
+		if (catset_get_bit(&l->cat, i)) {
 			if (level) {
 				level++;
 				continue;
@@ -118,7 +117,6 @@ char *mls_level_to_string(mls_level_t *l)
 {
 	unsigned int wrote_sep, len = mls_compute_string_len(l);
 	unsigned int i, level = 0;
-	ebitmap_node_t *cnode;
 	wrote_sep = 0;
 
 	if (len == 0)
@@ -129,8 +127,8 @@ char *mls_level_to_string(mls_level_t *l)
 	p += sprintf(p, "s%d", l->sens);
 
 	/* categories */
-	ebitmap_for_each_bit(&l->cat, cnode, i) {
-		if (ebitmap_node_get_bit(cnode, i)) {
+	for (i = 0; i < CATSET_WORDS * 64; i++) {
+		if (catset_get_bit(&l->cat, i)) {
 			if (level) {
 				level++;
 				continue;
@@ -1,7 +1,109 @@
 #ifndef __mls_level_h__
 #define __mls_level_h__
 
-#include <sepol/policydb/mls_types.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Category sets are fixed-width bitmaps, so that the set operations
+ * done for every translation need no allocation.  Categories at or
+ * above MAX_CATEGORIES are rejected when the configuration or a
+ * context is parsed.
+ */
+#ifndef MAX_CATEGORIES
+#define MAX_CATEGORIES 1024
+#endif
+
+#define CATSET_WORDS ((MAX_CATEGORIES + 63) / 64)
+
+typedef struct catset {
+	uint64_t w[CATSET_WORDS];
+} catset_t;
+
+typedef struct mls_level {
+	unsigned int sens;
+	catset_t cat;
+} mls_level_t;
+
+static inline void catset_init(catset_t *c)
+{
+	memset(c, 0, sizeof(*c));
+}
+
+static inline int catset_set_bit(catset_t *c, unsigned int bit, int value)
+{
+	if (bit >= MAX_CATEGORIES)
+		return -1;
+	if (value)
+		c->w[bit / 64] |= (uint64_t)1 << (bit % 64);
+	else
+		c->w[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+	return 0;
+}
+
+static inline int catset_get_bit(const catset_t *c, unsigned int bit)
+{
+	return (c->w[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline void catset_and(catset_t *d, const catset_t *a, const catset_t *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < CATSET_WORDS; i++)
+		d->w[i] = a->w[i] & b->w[i];
+}
+
+static inline void catset_or(catset_t *d, const catset_t *a, const catset_t *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < CATSET_WORDS; i++)
+		d->w[i] = a->w[i] | b->w[i];
+}
+
+static inline void catset_xor(catset_t *d, const catset_t *a, const catset_t *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < CATSET_WORDS; i++)
+		d->w[i] = a->w[i] ^ b->w[i];
+}
+
+/* d = a & ~b */
+static inline void catset_andnot(catset_t *d, const catset_t *a,
+				 const catset_t *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < CATSET_WORDS; i++)
+		d->w[i] = a->w[i] & ~b->w[i];
+}
+
+static inline unsigned int catset_count(const catset_t *c)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < CATSET_WORDS; i++)
+		n += __builtin_popcountll(c->w[i]);
+	return n;
+}
+
+/* Number of categories in exactly one of the sets */
+static inline unsigned int catset_distance(const catset_t *a,
+					   const catset_t *b)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < CATSET_WORDS; i++)
+		n += __builtin_popcountll(a->w[i] ^ b->w[i]);
+	return n;
+}
+
+static inline int catset_eq(const catset_t *a, const catset_t *b)
+{
+	return !memcmp(a, b, sizeof(*a));
+}
 
 unsigned int mls_compute_string_len(mls_level_t *r);
 mls_level_t *mls_level_from_string(char *mls_context);
@@ -0,0 +1,332 @@
+/*
+ * setransbench - Replay translation requests against a running mcstransd.
+ *
+ * Reads one context (or translated string with -u) per line from a file
+ * or stdin and sends it to the daemon over the setrans socket, bypassing
+ * the libselinux caches so every request reaches mcstransd.  The list is
+ * replayed -n times from each of -c forked clients, each on its own
+ * connection, and the request rate and latency distribution are
+ * reported.  With -v the replies of the first pass are printed.
+ */
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define SETRANS_UNIX_SOCKET "/var/run/setrans/.setrans-unix"
+
+#define RAW_TO_TRANS_CONTEXT		2
+#define TRANS_TO_RAW_CONTEXT		3
+#define RAW_CONTEXT_TO_COLOR		4
+#define MAX_DATA_BUF			4096
+
+/* latency histogram buckets are powers of two nanoseconds */
+#define NBUCKETS 40
+
+struct result {
+	unsigned long requests;
+	unsigned long failures;
+	unsigned long errors;
+	unsigned long hist[NBUCKETS];
+	uint64_t max_ns;
+};
+
+static char **lines;
+static unsigned int nlines;
+static uint32_t function = RAW_TO_TRANS_CONTEXT;
+static unsigned long passes = 1000;
+static int verbose;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int connect_setrans(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, SETRANS_UNIX_SOCKET, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t count;
+
+	while (len) {
+		count = read(fd, p, len);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return -1;
+		p += count;
+		len -= count;
+	}
+	return 0;
+}
+
+/*
+ * Send one request and wait for its reply.  Returns -1 if the
+ * connection broke, otherwise the daemon's return value; the reply
+ * string is left in out.
+ */
+static int request(int fd, const char *data, char *out)
+{
+	struct iovec req[5];
+	uint32_t data1_size = strlen(data) + 1, data2_size = 1;
+	uint32_t hdr[3];
+	ssize_t count;
+
+	req[0].iov_base = &function;
+	req[0].iov_len = sizeof(function);
+	req[1].iov_base = &data1_size;
+	req[1].iov_len = sizeof(data1_size);
+	req[2].iov_base = &data2_size;
+	req[2].iov_len = sizeof(data2_size);
+	req[3].iov_base = (void *)data;
+	req[3].iov_len = data1_size;
+	req[4].iov_base = "";
+	req[4].iov_len = data2_size;
+
+	while ((count = writev(fd, req, 5)) < 0 && errno == EINTR) ;
+	if (count != (ssize_t)(3 * sizeof(uint32_t) + data1_size + data2_size))
+		return -1;
+
+	if (read_full(fd, hdr, sizeof(hdr)) < 0)
+		return -1;
+	if (hdr[0] != function || !hdr[1] || hdr[1] > MAX_DATA_BUF)
+		return -1;
+	if (read_full(fd, out, hdr[1]) < 0)
+		return -1;
+	out[hdr[1] - 1] = '\0';
+	return (int32_t)hdr[2];
+}
+
+static void run_client(struct result *r, int print)
+{
+	char out[MAX_DATA_BUF];
+	uint64_t start, elapsed;
+	unsigned long pass;
+	unsigned int i;
+	int fd, ret, b;
+
+	fd = connect_setrans();
+	if (fd < 0) {
+		r->errors++;
+		return;
+	}
+
+	for (pass = 0; pass < passes; pass++) {
+		for (i = 0; i < nlines; i++) {
+			start = now_ns();
+			ret = request(fd, lines[i], out);
+			elapsed = now_ns() - start;
+
+			if (ret < 0) {
+				/* older daemons close the connection
+				 * after every reply */
+				r->errors++;
+				close(fd);
+				fd = connect_setrans();
+				if (fd < 0)
+					return;
+			} else if (ret)
+				r->failures++;
+			if (print && pass == 0)
+				printf("%s\t%s\n", lines[i], ret ? "<failed>" : out);
+
+			for (b = 0; b < NBUCKETS - 1 && (elapsed >> b) > 1; b++) ;
+			r->hist[b]++;
+			if (elapsed > r->max_ns)
+				r->max_ns = elapsed;
+			r->requests++;
+		}
+	}
+	close(fd);
+}
+
+/* upper bound of the bucket holding the given fraction of all calls */
+static uint64_t percentile(const unsigned long *hist, unsigned long total,
+			   double fraction)
+{
+	unsigned long seen = 0, want = (unsigned long)(total * fraction);
+	int b;
+
+	for (b = 0; b < NBUCKETS; b++) {
+		seen += hist[b];
+		if (seen > want)
+			break;
+	}
+	return 1ULL << (b < NBUCKETS ? b + 1 : NBUCKETS);
+}
+
+static int read_lines(FILE *fp)
+{
+	char *line = NULL;
+	size_t len = 0, alloc = 0;
+	ssize_t n;
+
+	while ((n = getline(&line, &len, fp)) > 0) {
+		if (line[n - 1] == '\n')
+			line[--n] = '\0';
+		if (!n || line[0] == '#')
+			continue;
+		if (nlines == alloc) {
+			char **tmp;
+
+			alloc = alloc ? alloc * 2 : 64;
+			tmp = realloc(lines, alloc * sizeof(*lines));
+			if (!tmp)
+				return -1;
+			lines = tmp;
+		}
+		lines[nlines] = strdup(line);
+		if (!lines[nlines])
+			return -1;
+		nlines++;
+	}
+	free(line);
+	return 0;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage:  %s [-c clients] [-n passes] [-u | -C] [-v] [file]\n",
+		progname);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct result total, r;
+	uint64_t start, elapsed;
+	int nclients = 1, opt, i, b, status;
+	int pipefd[2];
+	FILE *fp = stdin;
+
+	while ((opt = getopt(argc, argv, "c:n:uCv")) > 0) {
+		switch (opt) {
+		case 'c':
+			nclients = atoi(optarg);
+			if (nclients < 1)
+				usage(argv[0]);
+			break;
+		case 'n':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			function = TRANS_TO_RAW_CONTEXT;
+			break;
+		case 'C':
+			function = RAW_CONTEXT_TO_COLOR;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind > 1)
+		usage(argv[0]);
+
+	if (optind < argc) {
+		fp = fopen(argv[optind], "r");
+		if (!fp) {
+			fprintf(stderr, "%s:  unable to open %s:  %s\n",
+				argv[0], argv[optind], strerror(errno));
+			exit(2);
+		}
+	}
+	if (read_lines(fp) < 0) {
+		fprintf(stderr, "%s:  out of memory\n", argv[0]);
+		exit(4);
+	}
+	if (fp != stdin)
+		fclose(fp);
+	if (!nlines) {
+		fprintf(stderr, "%s:  nothing to replay\n", argv[0]);
+		exit(2);
+	}
+
+	if (pipe(pipefd) < 0) {
+		fprintf(stderr, "%s:  pipe failed:  %s\n", argv[0],
+			strerror(errno));
+		exit(4);
+	}
+
+	fflush(stdout);
+	start = now_ns();
+	for (i = 0; i < nclients; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			fprintf(stderr, "%s:  fork failed:  %s\n", argv[0],
+				strerror(errno));
+			exit(4);
+		}
+		if (pid == 0) {
+			close(pipefd[0]);
+			memset(&r, 0, sizeof(r));
+			run_client(&r, verbose && i == 0);
+			fflush(stdout);
+			if (write(pipefd[1], &r, sizeof(r)) != sizeof(r))
+				_exit(1);
+			_exit(0);
+		}
+	}
+	close(pipefd[1]);
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nclients; i++) {
+		if (read_full(pipefd[0], &r, sizeof(r)) < 0)
+			break;
+		for (b = 0; b < NBUCKETS; b++)
+			total.hist[b] += r.hist[b];
+		total.requests += r.requests;
+		total.failures += r.failures;
+		total.errors += r.errors;
+		if (r.max_ns > total.max_ns)
+			total.max_ns = r.max_ns;
+	}
+	elapsed = now_ns() - start;
+	while (wait(&status) > 0) ;
+	close(pipefd[0]);
+
+	printf("clients=%d requests=%lu failed=%lu errors=%lu seconds=%.3f "
+	       "requests/sec=%.0f\n", nclients, total.requests,
+	       total.failures, total.errors, elapsed / 1e9,
+	       elapsed ? total.requests * 1e9 / elapsed : 0);
+	printf("latency (ns): p50<=%llu p99<=%llu p99.9<=%llu max=%llu\n",
+	       (unsigned long long)percentile(total.hist, total.requests, 0.50),
+	       (unsigned long long)percentile(total.hist, total.requests, 0.99),
+	       (unsigned long long)percentile(total.hist, total.requests, 0.999),
+	       (unsigned long long)total.max_ns);
+
+	exit(total.errors ? 3 : 0);
+}
@@ -9,6 +9,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "hashtab.h"
 
 hashtab_t hashtab_create(unsigned int (*hash_value) (hashtab_t h,
@@ -42,6 +43,41 @@ hashtab_t hashtab_create(unsigned int (*hash_value) (hashtab_t h,
 	return p;
 }
 
+/*
+ * Double the number of slots once there are as many entries as slots,
+ * keeping each chain sorted.  The table keeps working at its current
+ * size if this fails.
+ */
+static void hashtab_grow(hashtab_t h)
+{
+	hashtab_ptr_t *old = h->htable, cur, next, *pp;
+	unsigned int i, oldsize = h->size;
+	int hvalue;
+
+	if (h->nel < oldsize || oldsize > UINT_MAX / 2)
+		return;
+
+	h->htable = calloc(oldsize * 2, sizeof(hashtab_ptr_t));
+	if (h->htable == NULL) {
+		h->htable = old;
+		return;
+	}
+	h->size = oldsize * 2;
+
+	for (i = 0; i < oldsize; i++) {
+		for (cur = old[i]; cur != NULL; cur = next) {
+			next = cur->next;
+			hvalue = h->hash_value(h, cur->key);
+			pp = &h->htable[hvalue];
+			while (*pp && h->keycmp(h, cur->key, (*pp)->key) > 0)
+				pp = &(*pp)->next;
+			cur->next = *pp;
+			*pp = cur;
+		}
+	}
+	free(old);
+}
+
 int hashtab_insert(hashtab_t h, hashtab_key_t key, hashtab_datum_t datum)
 {
 	int hvalue;
@@ -50,6 +86,7 @@ int hashtab_insert(hashtab_t h, hashtab_key_t key, hashtab_datum_t datum)
 	if (!h)
 		return HASHTAB_OVERFLOW;
 
+	hashtab_grow(h);
 	hvalue = h->hash_value(h, key);
 	prev = NULL;
 	cur = h->htable[hvalue];
@@ -122,6 +159,7 @@ int hashtab_replace(hashtab_t h, hashtab_key_t key, hashtab_datum_t datum,
 	if (!h)
 		return HASHTAB_OVERFLOW;
 
+	hashtab_grow(h);
 	hvalue = h->hash_value(h, key);
 	prev = NULL;
 	cur = h->htable[hvalue];
@@ -149,6 +187,7 @@ int hashtab_replace(hashtab_t h, hashtab_key_t key, hashtab_datum_t datum,
 			newnode->next = h->htable[hvalue];
 			h->htable[hvalue] = newnode;
 		}
+		h->nel++;
 	}
 
 	return HASHTAB_SUCCESS;
@@ -47,6 +47,9 @@ typedef hashtab_val_t *hashtab_t;
 
 /*
    Creates a new hash table with the specified characteristics.
+   The table doubles its number of slots whenever it holds as many
+   entries as slots, so size is only the initial number of slots, and
+   hash_value must depend on the current h->size.
 
    Returns NULL if insufficent space is available or
    the new hash table otherwise.
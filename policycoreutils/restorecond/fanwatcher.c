@@ -0,0 +1,385 @@
+/*
+ * fanwatcher.c
+ *
+ * see file 'COPYING' for use and warranty information
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+.*
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+*/
+
+/*
+ * Whole file system watching with fanotify (-m).  Instead of one inotify
+ * watch per directory, every file system holding a watched pattern gets
+ * a single fanotify mark, and the events report the parent directory by
+ * file handle together with the name.  Each created path is matched
+ * against all patterns in-process, so patterns with '~' cover the home
+ * directory of every user, logged in or not, and need no utmp tracking.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/types.h>
+#include "../setfiles/restore.h"
+#include "restorecond.h"
+#include "stringslist.h"
+#include "fanwatcher.h"
+
+/* reasonable guess as to size of 256 events with their names */
+#define FAN_BUF_LEN	(256 * (sizeof(struct fanotify_event_metadata) + 64))
+#define HOME_HASH_SIZE	1024
+
+/* A marked file system and a directory on it for open_by_handle_at(). */
+struct fanFs {
+	struct fanFs *next;
+	fsid_t fsid;
+	int fd;
+};
+
+struct fanHome {
+	struct fanHome *next;
+	char *dir;
+	size_t len;
+};
+
+static int fan_fd = -1;
+static struct stringsList *patterns = NULL;
+static struct stringsList *home_patterns = NULL;	/* relative to a home */
+static struct stringsMatch match_patterns, match_home_patterns;
+static int compiled = 0;
+static struct fanFs *filesystems = NULL;
+static struct fanHome *homes[HOME_HASH_SIZE];
+static int homes_loaded = 0;
+
+static unsigned int home_hash(const char *dir, size_t len)
+{
+	unsigned int h = 5381;
+	while (len--)
+		h = h * 33 + (unsigned char)*dir++;
+	return h % HOME_HASH_SIZE;
+}
+
+static int is_home(const char *dir, size_t len)
+{
+	struct fanHome *ptr = homes[home_hash(dir, len)];
+	while (ptr) {
+		if (ptr->len == len && strncmp(ptr->dir, dir, len) == 0)
+			return 1;
+		ptr = ptr->next;
+	}
+	return 0;
+}
+
+int fanwatcher_init(void)
+{
+#ifdef FAN_REPORT_DFID_NAME
+	fan_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC |
+			       FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+#else
+	errno = ENOSYS;
+#endif
+	return fan_fd;
+}
+
+int fanwatcher_fd(void)
+{
+	return fan_fd;
+}
+
+/* Mark the file system holding 'path', or its closest existing parent. */
+static void mark_filesystem(const char *path)
+{
+	char dir[PATH_MAX];
+	struct fanFs *fs;
+	struct statfs sfs;
+	char *p;
+	int fd;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	/* Cut the pattern at its first wildcard and take the directory. */
+	dir[strcspn(dir, "*?[")] = 0;
+	while ((fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		p = strrchr(dir, '/');
+		if (!p)
+			return;
+		if (p == dir)
+			p[1] = 0;
+		else
+			*p = 0;
+	}
+
+	if (fstatfs(fd, &sfs) < 0) {
+		close(fd);
+		return;
+	}
+	for (fs = filesystems; fs; fs = fs->next) {
+		if (memcmp(&fs->fsid, &sfs.f_fsid, sizeof(fs->fsid)) == 0) {
+			close(fd);
+			return;
+		}
+	}
+
+#ifdef FAN_REPORT_DFID_NAME
+	if (fanotify_mark(fan_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+			  FAN_CREATE | FAN_MOVED_TO | FAN_ONDIR,
+			  fd, NULL) < 0) {
+		syslog(LOG_ERR, "Unable to watch file system of (%s) %s\n",
+		       path, strerror(errno));
+		close(fd);
+		return;
+	}
+#endif
+
+	fs = calloc(1, sizeof(struct fanFs));
+	if (!fs)
+		exitApp("Out of Memory");
+	fs->fsid = sfs.f_fsid;
+	fs->fd = fd;
+	fs->next = filesystems;
+	filesystems = fs;
+	if (debug_mode)
+		printf("Watching file system of %s\n", dir);
+}
+
+void fanwatcher_add(const char *pattern)
+{
+	if (exclude(pattern))
+		return;
+	/* Files that already exist are relabeled as with inotify. */
+	watch_list_restore(pattern);
+	strings_list_add(&patterns, pattern);
+	compiled = 0;
+	mark_filesystem(pattern);
+}
+
+static void load_homes(void)
+{
+	struct passwd *pwd;
+	struct fanHome *ptr;
+	size_t len;
+	unsigned int h;
+
+	setpwent();
+	while ((pwd = getpwent()) != NULL) {
+		len = strlen(pwd->pw_dir);
+		while (len > 1 && pwd->pw_dir[len - 1] == '/')
+			len--;
+		if (pwd->pw_dir[0] != '/' || len <= 1 ||
+		    is_home(pwd->pw_dir, len))
+			continue;
+		ptr = calloc(1, sizeof(struct fanHome));
+		if (!ptr)
+			exitApp("Out of Memory");
+		ptr->dir = strndup(pwd->pw_dir, len);
+		if (!ptr->dir)
+			exitApp("Out of Memory");
+		ptr->len = len;
+		h = home_hash(ptr->dir, len);
+		ptr->next = homes[h];
+		homes[h] = ptr;
+		mark_filesystem(ptr->dir);
+	}
+	endpwent();
+	homes_loaded = 1;
+}
+
+/*
+   'pattern' is the part of a "~" line after the "~".  Files that already
+   exist are left alone, as with inotify for users that are not logged in.
+*/
+void fanwatcher_add_home(const char *pattern)
+{
+	if (!homes_loaded)
+		load_homes();
+	strings_list_add(&home_patterns, pattern);
+	compiled = 0;
+}
+
+static int match(const char *path)
+{
+	const char *p;
+
+	if (!compiled) {
+		strings_match_free(&match_patterns);
+		strings_match_free(&match_home_patterns);
+		strings_list_compile(patterns, &match_patterns, FNM_PATHNAME);
+		strings_list_compile(home_patterns, &match_home_patterns,
+				     FNM_PATHNAME);
+		compiled = 1;
+	}
+
+	if (strings_match_find(&match_patterns, path) == 0)
+		return 1;
+	if (!home_patterns)
+		return 0;
+	/* Try every leading directory of the path as a home. */
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/'))
+		if (is_home(path, p - path) &&
+		    strings_match_find(&match_home_patterns, p) == 0)
+			return 1;
+	return 0;
+}
+
+static int mount_fd(const void *fsid)
+{
+	struct fanFs *fs;
+	for (fs = filesystems; fs; fs = fs->next)
+		if (memcmp(&fs->fsid, fsid, sizeof(fs->fsid)) == 0)
+			return fs->fd;
+	return -1;
+}
+
+/* Build the path of the entry an event reports into 'path'. */
+static int event_path(const struct fanotify_event_metadata *md, char *path,
+		      size_t size)
+{
+#ifdef FAN_REPORT_DFID_NAME
+	const struct fanotify_event_info_fid *fid;
+	struct file_handle *fh;
+	char proc[64];
+	const char *name;
+	ssize_t len;
+	int mfd, dfd;
+
+	fid = (const struct fanotify_event_info_fid *)(md + 1);
+	if ((const char *)(fid + 1) > (const char *)md + md->event_len ||
+	    fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+		return -1;
+	fh = (struct file_handle *)fid->handle;
+	name = (const char *)fh->f_handle + fh->handle_bytes;
+
+	mfd = mount_fd(&fid->fsid);
+	if (mfd < 0)
+		return -1;
+	dfd = open_by_handle_at(mfd, fh, O_PATH | O_CLOEXEC);
+	if (dfd < 0)
+		return -1;
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", dfd);
+	len = readlink(proc, path, size - 1);
+	close(dfd);
+	if (len <= 0)
+		return -1;
+	path[len] = 0;
+
+	if (strcmp(name, ".") == 0)
+		return 0;
+	if ((size_t)len + 1 + strlen(name) >= size)
+		return -1;
+	if (path[len - 1] != '/')
+		path[len++] = '/';
+	strcpy(path + len, name);
+	return 0;
+#else
+	(void)md;
+	(void)path;
+	(void)size;
+	return -1;
+#endif
+}
+
+/*
+   Read the pending fanotify events and queue the created paths that
+   match a pattern.  Returns -1 if the descriptor cannot be read.
+*/
+int fanwatcher_handle(void)
+{
+	char buf[FAN_BUF_LEN] __attribute__ ((aligned(8)));
+	char path[PATH_MAX];
+	const struct fanotify_event_metadata *md;
+	ssize_t len;
+	char *copy;
+
+	len = read(fan_fd, buf, sizeof(buf));
+	if (len < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		syslog(LOG_ERR, "Read error (%s)", strerror(errno));
+		return -1;
+	}
+
+	for (md = (struct fanotify_event_metadata *)buf;
+	     FAN_EVENT_OK(md, len); md = FAN_EVENT_NEXT(md, len)) {
+		if (md->vers != FANOTIFY_METADATA_VERSION)
+			exitApp("fanotify version mismatch");
+		if (md->mask & FAN_Q_OVERFLOW) {
+			syslog(LOG_WARNING, "fanotify queue overflow");
+			continue;
+		}
+		if (event_path(md, path, sizeof(path)) < 0)
+			continue;
+		if (debug_mode)
+			printf("mask=%llx File=%s\n",
+			       (unsigned long long)md->mask, path);
+		if (!match(path))
+			continue;
+		copy = strdup(path);
+		if (!copy)
+			exitApp("Out of Memory");
+		watch_list_queue(copy);
+	}
+	return 0;
+}
+
+void fanwatcher_free(void)
+{
+	struct fanFs *fs;
+	struct fanHome *home;
+	unsigned int h;
+
+	strings_list_free(patterns);
+	strings_list_free(home_patterns);
+	patterns = home_patterns = NULL;
+	strings_match_free(&match_patterns);
+	strings_match_free(&match_home_patterns);
+	compiled = 0;
+	while ((fs = filesystems) != NULL) {
+		filesystems = fs->next;
+		close(fs->fd);
+		free(fs);
+	}
+	for (h = 0; h < HOME_HASH_SIZE; h++) {
+		while ((home = homes[h]) != NULL) {
+			homes[h] = home->next;
+			free(home->dir);
+			free(home);
+		}
+	}
+	homes_loaded = 0;
+#ifdef FAN_REPORT_DFID_NAME
+	if (fan_fd >= 0)
+		fanotify_mark(fan_fd, FAN_MARK_FLUSH | FAN_MARK_FILESYSTEM,
+			      0, AT_FDCWD, NULL);
+#endif
+}
+
+void fanwatcher_close(void)
+{
+	fanwatcher_free();
+	if (fan_fd >= 0)
+		close(fan_fd);
+	fan_fd = -1;
+}
@@ -0,0 +1,29 @@
+/* fanwatcher.h -- 
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * 
+ */
+#ifndef FANWATCHER_H
+#define FANWATCHER_H
+
+int fanwatcher_init(void);
+int fanwatcher_fd(void);
+void fanwatcher_add(const char *pattern);
+void fanwatcher_add_home(const char *pattern);
+int fanwatcher_handle(void);
+void fanwatcher_free(void);
+void fanwatcher_close(void);
+
+#endif
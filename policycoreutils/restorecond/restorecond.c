@@ -30,10 +30,11 @@
  * and makes sure that there security context matches the systems defaults
  *
  * USAGE:
- * restorecond [-d] [-u] [-v] [-f restorecond_file ]
+ * restorecond [-d] [-m] [-u] [-v] [-f restorecond_file ]
  * 
  * -d   Run in debug mode
  * -f   Use alternative restorecond_file
+ * -m   Watch whole file systems with fanotify
  * -u   Run in user mode
  * -v   Run in verbose mode (Report missing files)
  *
@@ -61,6 +62,7 @@
 #include <fcntl.h>
 #include "restorecond.h"
 #include "utmpwatcher.h"
+#include "fanwatcher.h"
 
 const char *homedir;
 static int master_fd = -1;
@@ -81,6 +83,7 @@ static void done(void) {
 	watch_list_free(master_fd);
 	close(master_fd);
 	utmpwatcher_free();
+	fanwatcher_close();
 	matchpathcon_fini();
 }
 
@@ -120,7 +123,7 @@ static void term_handler()
 
 static void usage(char *program)
 {
-	printf("%s [-d] [-f restorecond_file ] [-u] [-v] \n", program);
+	printf("%s [-d] [-f restorecond_file ] [-m] [-u] [-v] \n", program);
 }
 
 void exitApp(const char *msg)
@@ -138,6 +141,7 @@ void exitApp(const char *msg)
 int main(int argc, char **argv)
 {
 	int opt;
+	int whole_fs = 0;
 	struct sigaction sa;
 
 	memset(&r_opts, 0, sizeof(r_opts));
@@ -175,7 +179,7 @@ int main(int argc, char **argv)
 
 	exclude_non_seclabel_mounts();
 	atexit( done );
-	while ((opt = getopt(argc, argv, "hdf:uv")) > 0) {
+	while ((opt = getopt(argc, argv, "hdf:muv")) > 0) {
 		switch (opt) {
 		case 'd':
 			debug_mode = 1;
@@ -183,6 +187,9 @@ int main(int argc, char **argv)
 		case 'f':
 			watch_file = optarg;
 			break;
+		case 'm':
+			whole_fs = 1;
+			break;
 		case 'u':
 			run_as_user = 1;
 			break;
@@ -217,6 +224,9 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	if (whole_fs && fanwatcher_init() < 0)
+		exitApp("fanotify_init");
+
 	watch_file = server_watch_file;
 	read_config(master_fd, watch_file);
 
@@ -39,6 +39,9 @@ extern void read_config(int fd,	const char *watch_file);
 extern int watch(int fd, const char *watch_file);
 extern void watch_list_add(int inotify_fd, const char *path);
 extern int watch_list_find(int wd, const char *file);
+extern void watch_list_flush(void);
+extern void watch_list_queue(char *path);
+extern void watch_list_restore(const char *path);
 extern void watch_list_free(int fd);
 extern int watch_list_isempty();
 
@@ -91,6 +91,92 @@ int strings_list_diff(struct stringsList *from, struct stringsList *to)
 	return 0;
 }
 
+static size_t strings_hash(const char *string)
+{
+	size_t h = 5381;
+	while (*string)
+		h = h * 33 + (unsigned char)*string++;
+	return h;
+}
+
+void strings_list_compile(struct stringsList *list, struct stringsMatch *match,
+			  int flags)
+{
+	struct stringsList *ptr;
+	struct stringsGlob *glob;
+	size_t n = 0, h;
+	const char *meta;
+
+	memset(match, 0, sizeof(*match));
+	match->flags = flags;
+	for (ptr = list; ptr; ptr = ptr->next)
+		n++;
+	match->size = 8;
+	while (match->size < 2 * n)
+		match->size *= 2;
+	match->literals = calloc(match->size, sizeof(*match->literals));
+	match->globs = calloc(n ? n : 1, sizeof(*match->globs));
+	if (!match->literals || !match->globs)
+		exitApp("Out of Memory");
+
+	for (ptr = list; ptr; ptr = ptr->next) {
+		meta = strpbrk(ptr->string, "*?[\\");
+		if (!meta) {
+			h = strings_hash(ptr->string);
+			while (match->literals[h & (match->size - 1)])
+				h++;
+			match->literals[h & (match->size - 1)] = ptr->string;
+			continue;
+		}
+		glob = &match->globs[match->nglobs++];
+		glob->pattern = ptr->string;
+		glob->prefix = meta - ptr->string;
+		/* Only a plain '*' or '?' can end the wildcard part. */
+		if (!strpbrk(ptr->string, "[\\")) {
+			glob->suffix = ptr->string + strlen(ptr->string);
+			while (glob->suffix[-1] != '*' && glob->suffix[-1] != '?')
+				glob->suffix--;
+			glob->suffix_len = strlen(glob->suffix);
+		}
+	}
+}
+
+int strings_match_find(const struct stringsMatch *match, const char *string)
+{
+	const struct stringsGlob *glob;
+	size_t h, i, len;
+	const char *lit;
+
+	h = strings_hash(string);
+	while ((lit = match->literals[h & (match->size - 1)]) != NULL) {
+		if (strcmp(lit, string) == 0)
+			return 0;	/* Match found */
+		h++;
+	}
+
+	len = strlen(string);
+	for (i = 0; i < match->nglobs; i++) {
+		glob = &match->globs[i];
+		if (strncmp(glob->pattern, string, glob->prefix) != 0)
+			continue;
+		if (glob->suffix &&
+		    (len < glob->prefix + glob->suffix_len ||
+		     memcmp(string + len - glob->suffix_len, glob->suffix,
+			    glob->suffix_len) != 0))
+			continue;
+		if (fnmatch(glob->pattern, string, match->flags) == 0)
+			return 0;	/* Match found */
+	}
+	return -1;
+}
+
+void strings_match_free(struct stringsMatch *match)
+{
+	free(match->literals);
+	free(match->globs);
+	memset(match, 0, sizeof(*match));
+}
+
 void strings_list_print(struct stringsList *ptr)
 {
 	while (ptr) {
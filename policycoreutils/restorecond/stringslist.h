@@ -28,10 +28,35 @@ struct stringsList {
 	char *string;
 };
 
+/* A glob pattern with the literal text it must start and end with. */
+struct stringsGlob {
+	const char *pattern;
+	size_t prefix;		/* leading bytes without wildcards */
+	const char *suffix;	/* trailing text without wildcards, or NULL */
+	size_t suffix_len;
+};
+
+/*
+ * A list compiled for matching: the patterns without wildcards go in
+ * an open addressing hash, the others are tried with fnmatch() once
+ * their literal prefix and suffix agree.  Points into the list's strings.
+ */
+struct stringsMatch {
+	const char **literals;
+	size_t size;		/* slots in literals, a power of two */
+	struct stringsGlob *globs;
+	size_t nglobs;
+	int flags;		/* for fnmatch() */
+};
+
 void strings_list_free(struct stringsList *list);
 void strings_list_add(struct stringsList **list, const char *string);
 void strings_list_print(struct stringsList *list);
 int strings_list_find(struct stringsList *list, const char *string, int *exact);
 int strings_list_diff(struct stringsList *from, struct stringsList *to);
+void strings_list_compile(struct stringsList *list, struct stringsMatch *match,
+			  int flags);
+int strings_match_find(const struct stringsMatch *match, const char *string);
+void strings_match_free(struct stringsMatch *match);
 
 #endif
@@ -141,6 +141,7 @@ io_channel_callback
 
 	    i += EVENT_SIZE + event->len;
     }
+    watch_list_flush();
   }
 
   /* An error happened while reading
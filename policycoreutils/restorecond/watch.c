@@ -15,42 +15,111 @@
 #include <string.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <selinux/selinux.h>
 #include "restorecond.h"
 #include "stringslist.h"
 #include "utmpwatcher.h"
+#include "fanwatcher.h"
 
 /* size of the event structure, not counting name */
 #define EVENT_SIZE  (sizeof (struct inotify_event))
 /* reasonable guess as to size of 1024 events */
 #define BUF_LEN        (1024 * (EVENT_SIZE + 16))
-
+/* how long to keep collecting events once one has arrived */
+#define COALESCE_MS    50
+/* most paths relabeled in one batch, and size of its duplicate set */
+#define BATCH_MAX      1024
+#define BATCH_SLOTS    (2 * BATCH_MAX)
+/* buckets of the wd to watched directory hash */
+#define WD_HASH_SIZE   256
 
 struct watchList {
 	struct watchList *next;
+	struct watchList *hnext;	/* next in wd hash bucket */
 	int wd;
 	char *dir;
 	struct stringsList *files;
+	struct stringsMatch match;	/* files, compiled */
+	int compiled;
 };
 struct watchList *firstDir = NULL;
+static struct watchList *wdHash[WD_HASH_SIZE];
+
+/*
+   Paths waiting to be relabeled.  Each path is queued only once per
+   batch however many events name it; batchSet is an open addressing
+   set of the queued paths.
+*/
+static char *batch[BATCH_MAX];
+static size_t batchLen;
+static char *batchSet[BATCH_SLOTS];
+
+static struct watchList *watch_list_lookup(int wd)
+{
+	struct watchList *ptr = wdHash[(unsigned int)wd % WD_HASH_SIZE];
+	while (ptr != NULL && ptr->wd != wd)
+		ptr = ptr->hnext;
+	return ptr;
+}
+
+static int batch_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Relabel the queued paths in order, so that siblings are done together. */
+void watch_list_flush(void)
+{
+	size_t i;
+
+	if (!batchLen)
+		return;
+	if (debug_mode)
+		printf("Relabel %zu queued files\n", batchLen);
+	qsort(batch, batchLen, sizeof(*batch), batch_cmp);
+	for (i = 0; i < batchLen; i++) {
+		process_one_realpath(batch[i], 0);
+		free(batch[i]);
+	}
+	batchLen = 0;
+	memset(batchSet, 0, sizeof(batchSet));
+}
+
+/* Queue a path for relabeling, taking ownership of it. */
+void watch_list_queue(char *path)
+{
+	unsigned int h = 5381;
+	const char *p;
+
+	for (p = path; *p; p++)
+		h = h * 33 + (unsigned char)*p;
+	for (;; h++) {
+		char **slot = &batchSet[h % BATCH_SLOTS];
+		if (*slot == NULL) {
+			*slot = path;
+			break;
+		}
+		if (strcmp(*slot, path) == 0) {
+			free(path);
+			return;
+		}
+	}
+	batch[batchLen++] = path;
+	if (batchLen == BATCH_MAX)
+		watch_list_flush();
+}
 
 int watch_list_isempty() {
 	return firstDir == NULL;
 }
 
-void watch_list_add(int fd, const char *path)
+/* Relabel the files that already match a watched path. */
+void watch_list_restore(const char *path)
 {
-	struct watchList *ptr = NULL;
 	size_t i = 0;
-	struct watchList *prev = NULL;
 	glob_t globbuf;
-	char *x = strdup(path);
-	if (!x) exitApp("Out of Memory");
-	char *file = basename(x);
-	char *dir = dirname(x);
-	ptr = firstDir;
-
-	if (exclude(path)) goto end;
 
 	globbuf.gl_offs = 1;
 	if (glob(path,
@@ -66,10 +135,26 @@ void watch_list_add(int fd, const char *path)
 		}
 		globfree(&globbuf);
 	}
+}
+
+void watch_list_add(int fd, const char *path)
+{
+	struct watchList *ptr = NULL;
+	struct watchList *prev = NULL;
+	char *x = strdup(path);
+	if (!x) exitApp("Out of Memory");
+	char *file = basename(x);
+	char *dir = dirname(x);
+	ptr = firstDir;
+
+	if (exclude(path)) goto end;
+
+	watch_list_restore(path);
 
 	while (ptr != NULL) {
 		if (strcmp(dir, ptr->dir) == 0) {
 			strings_list_add(&ptr->files, file);
+			ptr->compiled = 0;
 			goto end;
 		}
 		prev = ptr;
@@ -97,6 +182,8 @@ void watch_list_add(int fd, const char *path)
 		prev->next = ptr;
 	else
 		firstDir = ptr;
+	ptr->hnext = wdHash[(unsigned int)ptr->wd % WD_HASH_SIZE];
+	wdHash[(unsigned int)ptr->wd % WD_HASH_SIZE] = ptr;
 
 	if (debug_mode)
 		printf("%d: Dir=%s, File=%s\n", ptr->wd, ptr->dir, file);
@@ -108,38 +195,44 @@ end:
 
 /*
    A file was in a direcroty has been created. This function checks to
-   see if it is one that we are watching.
+   see if it is one that we are watching, and if so queues it to be
+   relabeled by the next watch_list_flush().
 */
 
+/* Compile the file patterns of a directory for watch_list_find(). */
+static void watch_list_compile(struct watchList *ptr)
+{
+	strings_match_free(&ptr->match);
+	strings_list_compile(ptr->files, &ptr->match, 0);
+	ptr->compiled = 1;
+}
+
 int watch_list_find(int wd, const char *file)
 {
 	struct watchList *ptr = NULL;
-	ptr = firstDir;
+	char *path = NULL;
+
 	if (debug_mode)
 		printf("%d: File=%s\n", wd, file);
-	while (ptr != NULL) {
-		if (ptr->wd == wd) {
-			int exact=0;
-			if (strings_list_find(ptr->files, file, &exact) == 0) {
-				char *path = NULL;
-				if (asprintf(&path, "%s/%s", ptr->dir, file) <
-				    0)
-					exitApp("Error allocating memory.");
+	ptr = watch_list_lookup(wd);
+	if (ptr == NULL)
+		/* Did not find a directory */
+		return -1;
 
-				process_one_realpath(path, 0);
-				free(path);
-				return 0;
-			}
-			if (debug_mode)
-				strings_list_print(ptr->files);
+	if (!ptr->compiled)
+		watch_list_compile(ptr);
+	if (strings_match_find(&ptr->match, file) != 0) {
+		if (debug_mode)
+			strings_list_print(ptr->files);
 
-			/* Not found in this directory */
-			return -1;
-		}
-		ptr = ptr->next;
+		/* Not found in this directory */
+		return -1;
 	}
-	/* Did not find a directory */
-	return -1;
+
+	if (asprintf(&path, "%s/%s", ptr->dir, file) < 0)
+		exitApp("Error allocating memory.");
+	watch_list_queue(path);
+	return 0;
 }
 
 void watch_list_free(int fd)
@@ -151,34 +244,21 @@ void watch_list_free(int fd)
 	while (ptr != NULL) {
 		inotify_rm_watch(fd, ptr->wd);
 		strings_list_free(ptr->files);
+		strings_match_free(&ptr->match);
 		free(ptr->dir);
 		prev = ptr;
 		ptr = ptr->next;
 		free(prev);
 	}
 	firstDir = NULL;
+	memset(wdHash, 0, sizeof(wdHash));
 }
 
-/*
-   Inotify watch loop
-*/
-int watch(int fd, const char *watch_file)
+static void watch_events(int fd, const char *watch_file, const char *buf,
+			 int len)
 {
-	char buf[BUF_LEN];
-	int len, i = 0;
-	if (firstDir == NULL) return 0;
+	int i = 0;
 
-	len = read(fd, buf, BUF_LEN);
-	if (len < 0) {
-		if (terminate == 0) {
-			syslog(LOG_ERR, "Read error (%s)", strerror(errno));
-			return 0;
-		}
-		syslog(LOG_ERR, "terminated");
-		return -1;
-	} else if (!len)
-		/* BUF_LEN too small? */
-		return -1;
 	while (i < len) {
 		struct inotify_event *event;
 		event = (struct inotify_event *)&buf[i];
@@ -207,7 +287,92 @@ int watch(int fd, const char *watch_file)
 
 		i += EVENT_SIZE + event->len;
 	}
-	return 0;
+}
+
+static int elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	    (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+   Read and handle the pending inotify events.  Returns -1 once the
+   daemon is to terminate, 0 if there were no events and 1 otherwise.
+*/
+static int watch_inotify(int fd, const char *watch_file, char *buf)
+{
+	int len;
+
+	len = read(fd, buf, BUF_LEN);
+	if (len < 0) {
+		if (terminate == 0) {
+			syslog(LOG_ERR, "Read error (%s)", strerror(errno));
+			return 0;
+		}
+		syslog(LOG_ERR, "terminated");
+		return -1;
+	} else if (!len)
+		/* BUF_LEN too small? */
+		return -1;
+	watch_events(fd, watch_file, buf, len);
+	return 1;
+}
+
+/*
+   Wait up to 'timeout' ms for events on the inotify descriptor and,
+   in whole file system mode, the fanotify one, and handle them.
+   Returns -1 once the daemon is to terminate, 0 if nothing arrived.
+*/
+static int watch_wait(int fd, const char *watch_file, char *buf,
+		      int timeout)
+{
+	struct pollfd pfd[2];
+	int nfds = 1, rc = 0;
+
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = fanwatcher_fd();
+	pfd[1].events = POLLIN;
+	if (pfd[1].fd >= 0)
+		nfds = 2;
+	/* Only inotify: a blocking read does the waiting. */
+	if (nfds == 1 && timeout < 0)
+		return watch_inotify(fd, watch_file, buf);
+
+	if (poll(pfd, nfds, timeout) <= 0)
+		return terminate ? -1 : 0;
+	if (nfds == 2 && (pfd[1].revents & POLLIN)) {
+		if (fanwatcher_handle() < 0)
+			return -1;
+		rc = 1;
+	}
+	if (pfd[0].revents)
+		rc = watch_inotify(fd, watch_file, buf);
+	return rc;
+}
+
+/*
+   Watch loop.  Once a watched file shows up, keep reading events for
+   up to COALESCE_MS so that a burst of creations is relabeled as one
+   batch, with each path done once.
+*/
+int watch(int fd, const char *watch_file)
+{
+	char buf[BUF_LEN];
+	struct timespec start;
+	int left, rc;
+	if (firstDir == NULL && fanwatcher_fd() < 0) return 0;
+
+	rc = watch_wait(fd, watch_file, buf, -1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (rc > 0 && batchLen &&
+	       (left = COALESCE_MS - elapsed_ms(&start)) > 0)
+		rc = watch_wait(fd, watch_file, buf, left);
+	watch_list_flush();
+	return rc < 0 ? -1 : 0;
 }
 
 static void process_config(int fd, FILE * cfg)
@@ -233,9 +398,13 @@ static void process_config(int fd, FILE * cfg)
 
 				watch_list_add(fd, ptr);
 				free(ptr);
+			} else if (fanwatcher_fd() >= 0) {
+				fanwatcher_add_home(&buffer[1]);
 			} else {
 				utmpwatcher_add(fd, &buffer[1]);
 			}
+		} else if (fanwatcher_fd() >= 0) {
+			fanwatcher_add(buffer);
 		} else {
 			watch_list_add(fd, buffer);
 		}
@@ -253,10 +422,12 @@ void read_config(int fd, const char *watch_file_path)
 {
 
 	FILE *cfg = NULL;
+	struct watchList *ptr;
 	if (debug_mode)
 		printf("Read Config\n");
 
 	watch_list_free(fd);
+	fanwatcher_free();
 
 	cfg = fopen(watch_file_path, "r");
 	if (!cfg){
@@ -266,6 +437,9 @@ void read_config(int fd, const char *watch_file_path)
 	process_config(fd, cfg);
 	fclose(cfg);
 
+	for (ptr = firstDir; ptr != NULL; ptr = ptr->next)
+		watch_list_compile(ptr);
+
 	inotify_rm_watch(fd, master_wd);
 	master_wd =
 	    inotify_add_watch(fd, watch_file_path, IN_MOVED_FROM | IN_MODIFY);
@@ -26,8 +26,11 @@
  * * arch-tag: a5583d39-72b9-4cdf-ba1b-5678ea4cbe20
  */
 
+#define _GNU_SOURCE		/* for splice */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
@@ -39,7 +42,9 @@
 #include <termios.h>
 #include <fcntl.h>
 
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
 
 static struct termios saved_termios;
 static int saved_fd = -1;
@@ -96,6 +101,179 @@ void tty_atexit(void)
 	return;
 }
 
+/*
+ * One direction of the relay.  Data goes from 'in' to 'out' through a
+ * pipe with splice(), so that it is not copied through user space.  An
+ * end that cannot be spliced (some ttys) makes the relay fall back to
+ * read() and write() through 'buf'.  At most 'size' bytes are pending;
+ * 'in' is not read while they are, which holds a fast writer back to
+ * the speed of the reader.
+ */
+#define RELAY_SIZE (1024 * 1024)
+
+struct relay {
+	int in;
+	int out;
+	int pipe[2];
+	char *buf;
+	size_t off;
+	size_t pending;
+	size_t size;
+	int in_block;		/* 'in' is a blocking descriptor */
+	int in_events;		/* registered with epoll, -1 if not pollable */
+	int out_events;
+	int eof;
+};
+
+static int relay_init(struct relay *r, int in, int out)
+{
+	int size;
+
+	memset(r, 0, sizeof(*r));
+	r->in = in;
+	r->out = out;
+	r->pipe[0] = r->pipe[1] = -1;
+	r->in_block = !(fcntl(in, F_GETFL) & O_NONBLOCK);
+
+	if (pipe2(r->pipe, O_CLOEXEC | O_NONBLOCK) == 0) {
+		/* a bigger pipe means fewer wakeups; the default will do */
+		(void)fcntl(r->pipe[1], F_SETPIPE_SZ, RELAY_SIZE);
+		size = fcntl(r->pipe[1], F_GETPIPE_SZ);
+		r->size = size > 0 ? (size_t)size : 65536;
+		return 0;
+	}
+
+	r->size = 65536;
+	r->buf = malloc(r->size);
+	return r->buf ? 0 : -1;
+}
+
+/* Leave the pipe for the buffer, keeping whatever is in the pipe. */
+static int relay_unsplice(struct relay *r)
+{
+	ssize_t n;
+
+	r->buf = malloc(r->size);
+	if (!r->buf)
+		return -1;
+	r->off = 0;
+	while (r->off < r->pending) {
+		n = read(r->pipe[0], r->buf + r->off, r->pending - r->off);
+		if (n <= 0)
+			return -1;
+		r->off += n;
+	}
+	r->off = 0;
+	close(r->pipe[0]);
+	close(r->pipe[1]);
+	r->pipe[0] = r->pipe[1] = -1;
+	return 0;
+}
+
+/* Read what 'in' has while there is room; -1 on a fatal error. */
+static int relay_fill(struct relay *r)
+{
+	ssize_t n;
+
+	while (!r->eof && r->pending < r->size) {
+		if (!r->buf) {
+			n = splice(r->in, NULL, r->pipe[1], NULL,
+				   r->size - r->pending,
+				   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0 && errno == EINVAL && !r->pending) {
+				if (relay_unsplice(r) < 0)
+					return -1;
+				continue;
+			}
+		} else {
+			if (!r->pending)
+				r->off = 0;
+			else if (r->off + r->pending == r->size) {
+				memmove(r->buf, r->buf + r->off, r->pending);
+				r->off = 0;
+			}
+			n = read(r->in, r->buf + r->off + r->pending,
+				 r->size - r->off - r->pending);
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+			/* EIO once the child side of the pty is closed */
+			r->eof = 1;
+			return 0;
+		}
+		if (n == 0) {
+			r->eof = 1;
+			return 0;
+		}
+		r->pending += n;
+		/* a blocking 'in' would stall the loop on the next read */
+		if (r->in_block && r->in_events >= 0)
+			return 0;
+	}
+	return 0;
+}
+
+/* Write what is pending while 'out' takes it; -1 on a fatal error. */
+static int relay_flush(struct relay *r)
+{
+	ssize_t n;
+
+	while (r->pending) {
+		if (!r->buf) {
+			n = splice(r->pipe[0], NULL, r->out, NULL, r->pending,
+				   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0 && errno == EINVAL) {
+				if (relay_unsplice(r) < 0)
+					return -1;
+				continue;
+			}
+		} else {
+			n = write(r->out, r->buf + r->off, r->pending);
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+			perror("write");
+			return -1;
+		}
+		r->pending -= n;
+		if (r->buf)
+			r->off += n;
+	}
+	return 0;
+}
+
+/* Change what epoll reports for fd; *cur holds what it reports now. */
+static int relay_watch(int epfd, int fd, int *cur, int events)
+{
+	struct epoll_event ev;
+	int op;
+
+	if (*cur < 0 || *cur == events)
+		return 0;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	op = events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+	if (!*cur)
+		op = EPOLL_CTL_ADD;
+	if (epoll_ctl(epfd, op, fd, &ev) < 0) {
+		/* regular files are always ready and cannot be polled */
+		if (errno == EPERM) {
+			*cur = -1;
+			return 0;
+		}
+		return -1;
+	}
+	*cur = events;
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	pid_t child_pid;
@@ -104,16 +282,10 @@ int main(int argc, char *argv[])
 	int pty_master;
 	int retval = 0;
 
-	/* for select */
-	fd_set readfds;
-	fd_set writefds;
-	fd_set exceptfds;
-
-	int err_count = 0;
-
-	/* for sigtimedwait() */
-	struct timespec timeout;
-	char buf[16384];
+	struct relay output, input;
+	struct epoll_event events[4];
+	int epfd, sigfd, pty_events = 0;
+	int i, n, done = 0;
 
 	if (argc == 1) {
 		printf("usage: %s PROGRAM [ARGS]...\n", argv[0]);
@@ -121,17 +293,12 @@ int main(int argc, char *argv[])
 	}
 
 	sigset_t signal_set;
-	siginfo_t signalinfo;
 
 	/* set up SIGCHLD */
 	sigemptyset(&signal_set);	/* no signals */
 	sigaddset(&signal_set, SIGCHLD);	/* Add sig child  */
 	sigprocmask(SIG_BLOCK, &signal_set, NULL);	/* Block the signal */
 
-	/* Set both to 0, so sigtimed wait just does a poll */
-	timeout.tv_sec = 0;
-	timeout.tv_nsec = 0;
-
 	if (isatty(fileno(stdin))) {
 		/* get terminal parameters associated with stdout */
 		if (tcgetattr(fileno(stdout), &tty_attr) < 0) {
@@ -197,9 +364,6 @@ int main(int argc, char *argv[])
 	 * OK. Prepare to handle IO from the child. We need to transfer
 	 * everything from the child's stdout to ours.
 	 */
-	FD_ZERO(&readfds);
-	FD_ZERO(&writefds);
-	FD_ZERO(&exceptfds);
 
 	/*
 	 * Read current file descriptor flags, preparing to do non blocking reads
@@ -220,9 +384,6 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	FD_SET(pty_master, &readfds);
-	FD_SET(pty_master, &writefds);
-	FD_SET(fileno(stdin), &readfds);
 	if (isatty(fileno(stdin))) {
 		if (tty_semi_raw(fileno(stdin)) < 0) {
 			perror("Error: settingraw mode:");
@@ -239,157 +400,98 @@ int main(int argc, char *argv[])
 	/* ignore return from nice, but lower our priority */
 	int ignore __attribute__ ((unused)) = nice(19);
 
-	/* while no signal, we loop around */
-	int done = 0;
-	while (!done) {
-		struct timeval interval;
-		fd_set t_readfds;
-		fd_set t_writefds;
-		fd_set t_exceptfds;
-		/*
-		 * We still use a blocked signal, and check for SIGCHLD every
-		 * loop, since waiting infinitely did not really help the load
-		 * when running, say, top. 
-		 */
-		interval.tv_sec = 0;
-		interval.tv_usec = 200000;	/* so, check for signals every 200 milli
-						   seconds */
+	/*
+	 * stdin and stdout are shared with whoever started us, so they
+	 * stay blocking; they are only used when epoll says they are ready.
+	 */
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	sigfd = signalfd(-1, &signal_set, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (epfd < 0 || sigfd < 0 ||
+	    relay_init(&output, pty_master, fileno(stdout)) < 0 ||
+	    relay_init(&input, fileno(stdin), pty_master) < 0) {
+		perror("relay setup");
+		fflush(stdout);
+		fflush(stderr);
+		exit(EX_OSERR);
+	}
+	memset(events, 0, sizeof(events));
+	events[0].events = EPOLLIN;
+	events[0].data.fd = sigfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &events[0]) < 0) {
+		perror("epoll_ctl");
+		exit(EX_OSERR);
+	}
 
-		t_readfds = readfds;
-		t_writefds = writefds;
-		t_exceptfds = exceptfds;
+	/* until the child exits or closes the pty */
+	while (!output.eof || output.pending) {
+		int pty_want = 0, timeout = -1, in_ready, out_ready;
 
-		/* check for the signal */
-		retval = sigtimedwait(&signal_set, &signalinfo, &timeout);
+		/*
+		 * Watch each end only for what it can do now: no input
+		 * while a relay is full, no output while it is empty.
+		 */
+		if (!output.eof && output.pending < output.size)
+			pty_want |= EPOLLIN;
+		if (input.pending)
+			pty_want |= EPOLLOUT;
+		if (relay_watch(epfd, pty_master, &pty_events, pty_want) ||
+		    relay_watch(epfd, output.out, &output.out_events,
+				output.pending ? EPOLLOUT : 0) ||
+		    relay_watch(epfd, input.in, &input.in_events,
+				!input.eof && input.pending < input.size ?
+				EPOLLIN : 0)) {
+			perror("epoll_ctl");
+			exit(EX_IOERR);
+		}
+		/* unpollable ends are always ready */
+		if ((output.out_events < 0 && output.pending) ||
+		    (input.in_events < 0 && !input.eof &&
+		     input.pending < input.size))
+			timeout = 0;
+
+		n = epoll_wait(epfd, events, 4, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			fflush(stdout);
+			fflush(stderr);
+			exit(EX_IOERR);
+		}
 
-		if (retval == SIGCHLD) {
-			/* child terminated */
-			done = 1;	/* in case they do not close off their
-					   file descriptors */
-		} else {
-			if (retval < 0) {
-				if (errno != EAGAIN) {
-					perror("sigtimedwait");
-					fflush(stdout);
-					fflush(stderr);
-					exit(EX_IOERR);
-				} else {
-					/* No signal in set was delivered within the timeout period specified */
-				}
+		/* the pty is non-blocking and may always be tried */
+		in_ready = input.in_events < 0;
+		out_ready = output.out_events < 0;
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == input.in)
+				in_ready = 1;
+			else if (events[i].data.fd == output.out)
+				out_ready = 1;
+			else if (events[i].data.fd == sigfd) {
+				struct signalfd_siginfo info;
+
+				while (read(sigfd, &info, sizeof(info)) > 0)
+					;
+				/* child terminated: pass on what it left */
+				done = 1;
 			}
-		}		/* end of else */
+		}
 
-		if (select
-		    (pty_master + 1, &t_readfds, &t_writefds, &t_exceptfds,
-		     &interval) < 0) {
-			perror("Select:");
+		if (relay_fill(&output) < 0 ||
+		    (out_ready && relay_flush(&output) < 0) ||
+		    (in_ready && relay_fill(&input) < 0) ||
+		    relay_flush(&input) < 0) {
 			fflush(stdout);
 			fflush(stderr);
-			exit(EX_IOERR);
+			exit(EXIT_SUCCESS);
 		}
 
-		if (FD_ISSET(pty_master, &t_readfds)) {
-			retval = read(pty_master, buf, (unsigned int)16384);
-			if (retval < 0) {
-				if (errno != EINTR && errno != EAGAIN) {	/* Nothing left to read?  */
-					fflush(stdout);
-					fflush(stderr);
-					/* fprintf(stderr, "DEBUG: %d: Nothing left to read?\n", __LINE__); */
-					exit(EXIT_SUCCESS);
-				}	/* end of else */
-			} /* end of if(retval < 0) */
-			else {
-				if (retval == 0) {
-					if (++err_count > 5) {	/* child closed connection */
-						fflush(stdout);
-						fflush(stderr);
-						/*fprintf(stderr, "DEBUG: %d: child closed connection?\n", __LINE__); */
-						exit(EXIT_SUCCESS);
-					}
-				} /* end of if(retval == 0) */
-				else {
-					ssize_t nleft = retval;
-					ssize_t nwritten = 0;
-					char *ptr = buf;
-					while (nleft > 0) {
-						if ((nwritten =
-						     write(fileno(stdout), ptr,
-							   (unsigned int)nleft))
-						    <= 0) {
-							if (errno == EINTR) {
-								nwritten = 0;
-							} /* end of if(errno == EINTR) */
-							else {
-								perror("write");
-								fflush(stdout);
-								fflush(stderr);
-								exit(EXIT_SUCCESS);
-							}	/* end of else */
-						}	/* end of if((nwritten = write(sockfd, ptr, nleft)) <= 0) */
-						nleft -= nwritten;
-						ptr += nwritten;
-					}	/* end of while(nleft > 0) */
-
-					/* fprintf(stderr, "DEBUG: %d: wrote %d\n", __LINE__, retval); */
-					fflush(stdout);
-				}	/* end of else */
-			}	/* end of else */
+		/* after SIGCHLD, stop once the pty has nothing more */
+		if (done && !output.pending) {
+			relay_fill(&output);
+			if (!output.pending)
+				break;
 		}
-		if (FD_ISSET(fileno(stdin), &t_readfds)) {
-			if (FD_ISSET(pty_master, &t_writefds)) {
-				retval =
-				    read(fileno(stdin), buf,
-					 (unsigned int)16384);
-				if (retval < 0) {
-					if (errno != EINTR && errno != EAGAIN) {	/* Nothing left to read?  */
-						fflush(stdout);
-						fflush(stderr);
-						exit(EXIT_SUCCESS);
-					}	/* end of else */
-				} /* end of if(retval < 0) */
-				else {
-					if (retval == 0) {
-						if (++err_count > 5) {	/* lost controlling tty */
-							fflush(stdout);
-							fflush(stderr);
-							exit(EXIT_SUCCESS);
-						}
-					} /* end of if(retval == 0) */
-					else {
-						ssize_t nleft = retval;
-						ssize_t nwritten = 0;
-						char *ptr = buf;
-						while (nleft > 0) {
-							if ((nwritten =
-							     write(pty_master,
-								   ptr,
-								   (unsigned
-								    int)nleft))
-							    <= 0) {
-								if (errno ==
-								    EINTR) {
-									nwritten
-									    = 0;
-								} /* end of if(errno == EINTR) */
-								else {
-									perror
-									    ("write");
-									fflush
-									    (stdout);
-									fflush
-									    (stderr);
-									exit(EXIT_SUCCESS);
-								}	/* end of else */
-							}	/* end of if((nwritten = write(sockfd, ptr, nleft)) <= 0) */
-							nleft -= nwritten;
-							ptr += nwritten;
-						}	/* end of while(nleft > 0) */
-
-						fflush(stdout);
-					}	/* end of else */
-				}	/* end of else */
-			}	/* end of if(FD_ISSET(pty_master, &writefds)) */
-		}		/* something to read on stdin */
 	}			/* Loop */
 
 	fflush(stdout);
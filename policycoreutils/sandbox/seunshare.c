@@ -11,7 +11,6 @@
 #include <sys/wait.h>
 #include <syslog.h>
 #include <sys/mount.h>
-#include <glob.h>
 #include <pwd.h>
 #include <sched.h>
 #include <libcgroup.h>
@@ -26,6 +25,9 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>		/* for FICLONE */
 
 #include <selinux/selinux.h>
 #include <selinux/context.h>	/* for context-mangling functions */
@@ -53,10 +55,12 @@
 
 #define BUF_SIZE 1024
 #define DEFAULT_PATH "/usr/bin:/bin"
-#define USAGE_STRING _("USAGE: seunshare [ -v ] [ -C ] [ -c ] [ -k ] [ -t tmpdir ] [ -h homedir ] [ -Z CONTEXT ] -- executable [args] ")
+#define USAGE_STRING _("USAGE: seunshare [ -v ] [ -C ] [ -c ] [ -k ] [ -o ] [ -t tmpdir ] [ -h homedir ] [ -Z CONTEXT ] -- executable [args] ")
 
 static int verbose = 0;
 static int child = 0;
+static int overlay = 0;
+static char *cgroup_name = NULL;	/* sandbox cgroup made by setup_cgroups() */
 
 static capng_select_t cap_set = CAPNG_SELECT_CAPS;
 
@@ -134,36 +138,6 @@ static int set_signal_handles(void)
 		retval = -1; \
 	} while(0)
 
-/**
- * Spawn external command using system() with dropped privileges.
- * TODO: avoid system() and use exec*() instead
- */
-static int spawn_command(const char *cmd, uid_t uid){
-	int child;
-	int status = -1;
-
-	if (verbose > 1)
-		printf("spawn_command: %s\n", cmd);
-
-	child = fork();
-	if (child == -1) {
-		perror(_("Unable to fork"));
-		return status;
-	}
-
-	if (child == 0) {
-		if (drop_privs(uid) != 0) exit(-1);
-
-		status = system(cmd);
-		status_to_retval(status, status);
-		exit(status);
-	}
-
-	waitpid(child, &status, 0);
-	status_to_retval(status, status);
-	return status;
-}
-
 /**
  * Check file/directory ownership, struct stat * must be passed to the
  * functions.
@@ -290,6 +264,79 @@ static int seunshare_mount(const char *src, const char *dst, struct stat *src_st
 
 }
 
+/**
+ * Open a directory checked earlier, and check that it is still the same.
+ */
+static int open_verified(const char *dir, struct stat *st_in)
+{
+	struct stat st;
+	int fd;
+
+	if ((fd = open(dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0) {
+		fprintf(stderr, _("Failed to open directory %s: %s\n"), dir, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) == -1 || !equal_stats(st_in, &st)) {
+		fprintf(stderr, _("Error: %s was replaced by a different directory\n"), dir);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Mount an overlay of the directory open on lower_fd on target.  Its
+ * upper and work directories are in tmpdir.
+ */
+static int overlay_mount(int lower_fd, const char *tmpdir, const char *target,
+			 unsigned long flags)
+{
+	char *opts = NULL;
+	int rc;
+
+	if (asprintf(&opts, "lowerdir=/proc/self/fd/%d,upperdir=%s/upper,workdir=%s/work",
+		     lower_fd, tmpdir, tmpdir) == -1) {
+		fprintf(stderr, _("Out of memory\n"));
+		return -1;
+	}
+	rc = mount("overlay", target, "overlay", flags, opts);
+	free(opts);
+	return rc;
+}
+
+/**
+ * Mount an overlay of tmpdir_s, open on lower_fd, on /tmp, instead of
+ * the copy of it.  Nothing is copied in; what the sandbox changes ends
+ * up in tmpdir/upper.
+ */
+static int seunshare_mount_overlay(int lower_fd, const char *tmpdir, uid_t uid)
+{
+	int flags = MS_NODEV | MS_NOSUID | MS_NOEXEC;
+	int rc;
+
+	if (verbose)
+		printf(_("Mounting an overlay on /tmp\n"));
+
+	/* the layers are looked up as root, like the bind mounts */
+	if ((uid_t)setfsuid(0) != uid) return -1;
+	rc = overlay_mount(lower_fd, tmpdir, "/tmp", flags);
+	if ((uid_t)setfsuid(uid) != 0) return -1;
+	if (rc < 0) {
+		fprintf(stderr, _("Failed to mount an overlay on /tmp: %s\n"), strerror(errno));
+		return -1;
+	}
+
+	if (verbose)
+		printf(_("Mounting /tmp on /var/tmp\n"));
+
+	if (mount("/tmp", "/var/tmp",  NULL, MS_BIND | flags, NULL) < 0) {
+		fprintf(stderr, _("Failed to mount /tmp on /var/tmp: %s\n"), strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
 /**
  * Error logging used by cgroups code.
  */
@@ -487,6 +534,9 @@ static int setup_cgroups()
 
 	cgroup_attach_task(sandbox_group);
 
+	/* keep the name to find the sandbox processes at exit */
+	cgroup_name = cgroupname;
+	cgroupname = NULL;
 	rc = 0;
 err:
 	fclose(fp);
@@ -498,123 +548,576 @@ err:
 }
 
 /*
-   If path is empy or ends with  "/." or "/.. return -1 else return 0;
+ * Copying the runtime temporary directory in and out.  This does what
+ * "rsync -trlHD" used to: directories are copied recursively, symbolic
+ * and hard links as links, special files are recreated and modification
+ * times are kept.  SELinux labels are kept too, where the policy allows
+ * it.  Regular files are copied by a pool of threads, cloning their data
+ * where the file system can and using copy_file_range() otherwise.
  */
-static int bad_path(const char *path) {
-	const char *ptr;
-	ptr = path;
-	while (*ptr) ptr++;
-	if (ptr == path) return -1; // ptr null
-	ptr--;
-	if (ptr != path && *ptr  == '.') {
-		ptr--;
-		if (*ptr  == '/') return -1; // path ends in /.
-		if (*ptr  == '.') {
-			if (ptr != path) {
-				ptr--;
-				if (*ptr  == '/') return -1; // path ends in /..
+
+#define COPY_UPDATE	1	/* as rsync -u --delete --exclude=.X11-unix */
+#define COPY_OVERLAY	2	/* from an overlay upper directory: only whiteouts delete */
+#define COPY_THREADS	8
+
+struct copy_job {
+	char *src;
+	char *dst;
+	struct stat st;
+	struct copy_job *next;
+};
+
+/* directory whose time is set once everything in it is copied */
+struct copy_dir {
+	char *path;
+	struct timespec mtime;
+	struct copy_dir *next;
+};
+
+/* first copy of a file with several hard links */
+struct copy_link {
+	dev_t dev;
+	ino_t ino;
+	char *dst;
+	struct copy_link *next;
+};
+
+struct copy_state {
+	int flags;
+	int labels;
+	int errors;
+	int done;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct copy_job *head, *tail;
+	struct copy_dir *dirs;
+	struct copy_link *links;
+};
+
+static void copy_failed(struct copy_state *cs, const char *path)
+{
+	int err = errno;
+
+	pthread_mutex_lock(&cs->lock);
+	fprintf(stderr, _("Failed to copy %s: %s\n"), path, strerror(err));
+	cs->errors++;
+	pthread_mutex_unlock(&cs->lock);
+}
+
+static void copy_label(struct copy_state *cs, const char *src, const char *dst)
+{
+	security_context_t con = NULL;
+
+	/* best effort: the policy may not allow keeping the label */
+	if (!cs->labels || lgetfilecon(src, &con) < 0)
+		return;
+	(void)lsetfilecon(dst, con);
+	freecon(con);
+}
+
+static void copy_times(const char *dst, const struct timespec *mtime)
+{
+	struct timespec times[2];
+
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_OMIT;
+	times[1] = *mtime;
+	(void)utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static int copy_data(int in, int out, off_t size)
+{
+	char buf[65536];
+	ssize_t n = 0, w;
+
+#ifdef FICLONE
+	if (ioctl(out, FICLONE, in) == 0)
+		return 0;
+#endif
+	while (size > 0) {
+		n = copy_file_range(in, NULL, out, NULL, size, 0);
+		if (n <= 0)
+			break;
+		size -= n;
+	}
+	if (n < 0 && errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+	    errno != EOPNOTSUPP)
+		return -1;
+
+	/* copy_file_range() is not supported here, or the file grew */
+	while ((n = read(in, buf, sizeof(buf))) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		for (w = 0; w < n; ) {
+			ssize_t r = write(out, buf + w, n - w);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				return -1;
 			}
+			w += r;
 		}
 	}
 	return 0;
 }
 
-static int rsynccmd(const char * src, const char *dst, char **cmdbuf)
+static void copy_file(struct copy_state *cs, const char *src, const char *dst,
+		      const struct stat *st)
 {
-	char *buf = NULL;
-	char *newbuf = NULL;
-	glob_t fglob;
-	fglob.gl_offs = 0;
-	int flags = GLOB_PERIOD;
-	unsigned int i = 0;
-	int rc = -1;
+	struct timespec times[2];
+	int in, out;
+
+	in = open(src, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (in < 0) {
+		copy_failed(cs, src);
+		return;
+	}
+	out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+		   st->st_mode & 0777);
+	if (out < 0) {
+		copy_failed(cs, dst);
+		close(in);
+		return;
+	}
+	if (copy_data(in, out, st->st_size) < 0)
+		copy_failed(cs, dst);
+
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_OMIT;
+	times[1] = st->st_mtim;
+	(void)futimens(out, times);
+	close(out);
+	close(in);
+	copy_label(cs, src, dst);
+}
 
-	/* match glob for all files in src dir */
-	if (asprintf(&buf, "%s/*", src) == -1) {
-		fprintf(stderr, "Out of memory\n");
-		return -1;
+static void *copy_worker(void *arg)
+{
+	struct copy_state *cs = arg;
+	struct copy_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&cs->lock);
+		while (!cs->head && !cs->done)
+			pthread_cond_wait(&cs->cond, &cs->lock);
+		job = cs->head;
+		if (job) {
+			cs->head = job->next;
+			if (!cs->head)
+				cs->tail = NULL;
+		}
+		pthread_mutex_unlock(&cs->lock);
+		if (!job)
+			return NULL;
+
+		copy_file(cs, job->src, job->dst, &job->st);
+		free(job->src);
+		free(job->dst);
+		free(job);
 	}
+}
+
+/* Hand a regular file to the pool, or copy it here if that fails */
+static void copy_queue(struct copy_state *cs, const char *src, const char *dst,
+		       const struct stat *st, int nthreads)
+{
+	struct copy_job *job;
+
+	job = calloc(1, sizeof(*job));
+	if (!nthreads || !job || !(job->src = strdup(src)) ||
+	    !(job->dst = strdup(dst))) {
+		if (job) {
+			free(job->src);
+			free(job);
+		}
+		copy_file(cs, src, dst, st);
+		return;
+	}
+	job->st = *st;
+
+	pthread_mutex_lock(&cs->lock);
+	if (cs->tail)
+		cs->tail->next = job;
+	else
+		cs->head = job;
+	cs->tail = job;
+	pthread_cond_signal(&cs->cond);
+	pthread_mutex_unlock(&cs->lock);
+}
+
+static int remove_tree(const char *path)
+{
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	char *sub;
+	int rc = 0;
 
-	if (glob(buf, flags, NULL, &fglob) != 0) {
-		free(buf); buf = NULL;
+	if (lstat(path, &st) < 0)
+		return errno == ENOENT ? 0 : -1;
+	if (!S_ISDIR(st.st_mode))
+		return unlink(path);
+
+	if (!(dir = opendir(path)))
 		return -1;
+	while ((de = readdir(dir)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		if (asprintf(&sub, "%s/%s", path, de->d_name) == -1) {
+			rc = -1;
+			continue;
+		}
+		if (remove_tree(sub) < 0)
+			rc = -1;
+		free(sub);
 	}
+	closedir(dir);
+	if (rmdir(path) < 0)
+		rc = -1;
+	return rc;
+}
 
-	free(buf); buf = NULL;
+static int copy_skip(struct copy_state *cs, const char *name, int top)
+{
+	if (!strcmp(name, ".") || !strcmp(name, ".."))
+		return 1;
+	return top && (cs->flags & COPY_UPDATE) && !strcmp(name, ".X11-unix");
+}
 
-	for ( i=0; i < fglob.gl_pathc; i++) {
-		const char *path = fglob.gl_pathv[i];
+static void copy_contents(struct copy_state *cs, const char *src,
+			  const char *dst, int top, int nthreads);
 
-		if (bad_path(path)) continue;
+static void copy_entry(struct copy_state *cs, const char *src, const char *dst,
+		       int nthreads)
+{
+	struct stat st, dst_st;
+	struct copy_link *l;
+	struct copy_dir *d;
+	char *target = NULL, *cur = NULL;
+	int have;
+
+	if (lstat(src, &st) < 0) {
+		copy_failed(cs, src);
+		return;
+	}
+	/* a whiteout stands for a file the sandbox removed */
+	if ((cs->flags & COPY_OVERLAY) && S_ISCHR(st.st_mode) && !st.st_rdev) {
+		if (remove_tree(dst) < 0)
+			copy_failed(cs, dst);
+		return;
+	}
+	have = lstat(dst, &dst_st) == 0;
+	if (have && (dst_st.st_mode & S_IFMT) != (st.st_mode & S_IFMT)) {
+		if (remove_tree(dst) < 0) {
+			copy_failed(cs, dst);
+			return;
+		}
+		have = 0;
+	}
 
-		if (!buf) {
-			if (asprintf(&newbuf, "\'%s\'", path) == -1) {
-				fprintf(stderr, "Out of memory\n");
-				goto err;
+	if (S_ISDIR(st.st_mode)) {
+		if (!have) {
+			if (mkdir(dst, (st.st_mode & 0777) | S_IRWXU) < 0) {
+				copy_failed(cs, dst);
+				return;
 			}
+			copy_label(cs, src, dst);
+		}
+		copy_contents(cs, src, dst, 0, nthreads);
+		d = calloc(1, sizeof(*d));
+		if (d && (d->path = strdup(dst))) {
+			d->mtime = st.st_mtim;
+			d->next = cs->dirs;
+			cs->dirs = d;
 		} else {
-			if (asprintf(&newbuf, "%s  \'%s\'", buf, path) == -1) {
-				fprintf(stderr, "Out of memory\n");
-				goto err;
+			free(d);
+		}
+	} else if (S_ISLNK(st.st_mode)) {
+		target = calloc(1, st.st_size + 1);
+		if (!target || readlink(src, target, st.st_size) != st.st_size) {
+			copy_failed(cs, src);
+			goto out;
+		}
+		if (have) {
+			cur = calloc(1, st.st_size + 2);
+			if (cur && readlink(dst, cur, st.st_size + 1) == st.st_size &&
+			    !strcmp(cur, target))
+				goto out;
+			unlink(dst);
+		}
+		if (symlink(target, dst) < 0) {
+			copy_failed(cs, dst);
+			goto out;
+		}
+		copy_label(cs, src, dst);
+		copy_times(dst, &st.st_mtim);
+	} else if (S_ISREG(st.st_mode)) {
+		if (have && (cs->flags & COPY_UPDATE)) {
+			/* newer on the receiving side, or unchanged */
+			if (dst_st.st_mtim.tv_sec > st.st_mtim.tv_sec ||
+			    (dst_st.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+			     dst_st.st_mtim.tv_nsec > st.st_mtim.tv_nsec))
+				return;
+			if (dst_st.st_size == st.st_size &&
+			    dst_st.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+			    dst_st.st_mtim.tv_nsec == st.st_mtim.tv_nsec)
+				return;
+		}
+		if (st.st_nlink > 1) {
+			for (l = cs->links; l; l = l->next) {
+				if (l->dev == st.st_dev && l->ino == st.st_ino)
+					break;
+			}
+			if (l) {
+				if (have)
+					unlink(dst);
+				if (link(l->dst, dst) < 0)
+					copy_failed(cs, dst);
+				return;
+			}
+			l = calloc(1, sizeof(*l));
+			if (l && (l->dst = strdup(dst))) {
+				l->dev = st.st_dev;
+				l->ino = st.st_ino;
+				l->next = cs->links;
+				cs->links = l;
+			} else {
+				free(l);
 			}
+			/* must exist before the other links are made */
+			copy_file(cs, src, dst, &st);
+			return;
 		}
+		copy_queue(cs, src, dst, &st, nthreads);
+	} else {
+		if (have)
+			return;
+		if (mknod(dst, st.st_mode & (S_IFMT | 0777), st.st_rdev) < 0) {
+			copy_failed(cs, dst);
+			return;
+		}
+		copy_label(cs, src, dst);
+		copy_times(dst, &st.st_mtim);
+	}
+out:
+	free(target);
+	free(cur);
+}
 
-		free(buf); buf = newbuf;
-		newbuf = NULL;
+static void copy_contents(struct copy_state *cs, const char *src,
+			  const char *dst, int top, int nthreads)
+{
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	char *s, *d;
+
+	if (!(dir = opendir(src))) {
+		copy_failed(cs, src);
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (copy_skip(cs, de->d_name, top))
+			continue;
+		if (asprintf(&s, "%s/%s", src, de->d_name) == -1)
+			continue;
+		if (asprintf(&d, "%s/%s", dst, de->d_name) == -1) {
+			free(s);
+			continue;
+		}
+		copy_entry(cs, s, d, nthreads);
+		free(s);
+		free(d);
 	}
+	closedir(dir);
 
-	if (buf) {
-		if (asprintf(&newbuf, "/usr/bin/rsync -trlHDq %s '%s'", buf, dst) == -1) {
-			fprintf(stderr, "Out of memory\n");
-			goto err;
+	/* an upper directory only holds what changed */
+	if (!(cs->flags & COPY_UPDATE) || (cs->flags & COPY_OVERLAY))
+		return;
+
+	/* delete what is no longer there */
+	if (!(dir = opendir(dst))) {
+		copy_failed(cs, dst);
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (copy_skip(cs, de->d_name, top))
+			continue;
+		if (asprintf(&s, "%s/%s", src, de->d_name) == -1)
+			continue;
+		if (asprintf(&d, "%s/%s", dst, de->d_name) == -1) {
+			free(s);
+			continue;
 		}
-		*cmdbuf=newbuf;
+		if (lstat(s, &st) < 0 && errno == ENOENT && remove_tree(d) < 0)
+			copy_failed(cs, d);
+		free(s);
+		free(d);
 	}
-	else {
-		*cmdbuf=NULL;
+	closedir(dir);
+}
+
+/**
+ * Copy the contents of directory src into directory dst.  Returns the
+ * number of files that could not be copied.
+ */
+static int copy_tree(const char *src, const char *dst, int flags)
+{
+	struct copy_state cs;
+	pthread_t threads[COPY_THREADS];
+	struct copy_dir *d;
+	struct copy_link *l;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, nthreads = 0;
+
+	memset(&cs, 0, sizeof(cs));
+	cs.flags = flags;
+	cs.labels = is_selinux_enabled() == 1;
+	pthread_mutex_init(&cs.lock, NULL);
+	pthread_cond_init(&cs.cond, NULL);
+
+	if (ncpu < 1)
+		ncpu = 1;
+	for (i = 0; i < ncpu && i < COPY_THREADS; i++) {
+		if (pthread_create(&threads[nthreads], NULL, copy_worker, &cs) != 0)
+			break;
+		nthreads++;
 	}
-	rc = 0;
 
-err:
-	free(buf); buf = NULL;
-	globfree(&fglob);
-	return rc;
+	copy_contents(&cs, src, dst, 1, nthreads);
+
+	pthread_mutex_lock(&cs.lock);
+	cs.done = 1;
+	pthread_cond_broadcast(&cs.cond);
+	pthread_mutex_unlock(&cs.lock);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	while ((d = cs.dirs) != NULL) {
+		cs.dirs = d->next;
+		copy_times(d->path, &d->mtime);
+		free(d->path);
+		free(d);
+	}
+	while ((l = cs.links) != NULL) {
+		cs.links = l->next;
+		free(l->dst);
+		free(l);
+	}
+	pthread_cond_destroy(&cs.cond);
+	pthread_mutex_destroy(&cs.lock);
+
+	if (verbose > 1)
+		printf(_("Copied %s to %s, %d errors\n"), src, dst, cs.errors);
+	return cs.errors;
+}
+
+/**
+ * Copy a directory with the user's privileges only.
+ */
+static int copy_as_user(const char *src, const char *dst, int flags, uid_t uid)
+{
+	int child;
+	int status = -1;
+
+	child = fork();
+	if (child == -1) {
+		perror(_("Unable to fork"));
+		return status;
+	}
+
+	if (child == 0) {
+		if (drop_privs(uid) != 0) exit(-1);
+		exit(copy_tree(src, dst, flags) ? 1 : 0);
+	}
+
+	waitpid(child, &status, 0);
+	status_to_retval(status, status);
+	return status;
+}
+
+/**
+ * Remove the contents of a directory with the user's privileges only.
+ */
+static int clear_as_user(const char *dir, uid_t uid)
+{
+	int child;
+	int status = -1;
+
+	child = fork();
+	if (child == -1) {
+		perror(_("Unable to fork"));
+		return status;
+	}
+
+	if (child == 0) {
+		struct dirent *de;
+		DIR *d;
+		char *sub;
+		int rc = 0;
+
+		if (drop_privs(uid) != 0) exit(-1);
+		if (!(d = opendir(dir))) exit(1);
+		while ((de = readdir(d)) != NULL) {
+			if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+				continue;
+			if (asprintf(&sub, "%s/%s", dir, de->d_name) == -1) {
+				rc = 1;
+				continue;
+			}
+			if (remove_tree(sub) < 0)
+				rc = 1;
+			free(sub);
+		}
+		closedir(d);
+		exit(rc);
+	}
+
+	waitpid(child, &status, 0);
+	status_to_retval(status, status);
+	return status;
 }
 
 /**
  * Clean up runtime temporary directory.  Returns 0 if no problem was detected,
  * >0 if some error was detected, but errors here are treated as non-fatal and
- * left to tmpwatch to finish incomplete cleanup.
+ * left to tmpwatch to finish incomplete cleanup.  With keep_upper, the upper
+ * directory of an overlay holds changes that were not copied back, and it is
+ * left in place with the directory.
  */
 static int cleanup_tmpdir(const char *tmpdir, const char *src,
-	struct passwd *pwd, int copy_content)
+	struct passwd *pwd, int copy_content, int keep_upper)
 {
-	char *cmdbuf = NULL;
+	char *upper = NULL, *work = NULL;
 	int rc = 0;
 
-	/* rsync files back */
-	if (copy_content) {
-		if (asprintf(&cmdbuf, "/usr/bin/rsync --exclude=.X11-unix -utrlHDq --delete '%s/' '%s/'", tmpdir, src) == -1) {
-			fprintf(stderr, _("Out of memory\n"));
-			cmdbuf = NULL;
-			rc++;
-		}
-		if (cmdbuf && spawn_command(cmdbuf, pwd->pw_uid) != 0) {
-			fprintf(stderr, _("Failed to copy files from the runtime temporary directory\n"));
-			rc++;
-		}
-		free(cmdbuf); cmdbuf = NULL;
+	/* copy files back */
+	if (copy_content && copy_as_user(tmpdir, src, COPY_UPDATE, pwd->pw_uid) != 0) {
+		fprintf(stderr, _("Failed to copy files from the runtime temporary directory\n"));
+		rc++;
 	}
 
-	/* remove files from the runtime temporary directory */
-	if (asprintf(&cmdbuf, "/bin/rm -r '%s/' 2>/dev/null", tmpdir) == -1) {
+	/* with an overlay, the files are in its upper directory */
+	if (overlay && (asprintf(&upper, "%s/upper", tmpdir) == -1 ||
+			asprintf(&work, "%s/work", tmpdir) == -1)) {
 		fprintf(stderr, _("Out of memory\n"));
-		cmdbuf = NULL;
-		rc++;
+		free(upper);
+		return ++rc;
 	}
+
+	if (keep_upper) {
+		fprintf(stderr, _("The changes to /tmp are kept in %s\n"), upper);
+		free(upper);
+		free(work);
+		return ++rc;
+	}
+
+	/* remove files from the runtime temporary directory */
 	/* this may fail if there's root-owned file left in the runtime tmpdir */
-	if (cmdbuf && spawn_command(cmdbuf, pwd->pw_uid) != 0) rc++;
-	free(cmdbuf); cmdbuf = NULL;
+	if (clear_as_user(overlay ? upper : tmpdir, pwd->pw_uid) != 0) rc++;
 
 	/* remove runtime temporary directory */
 	if ((uid_t)setfsuid(0) != 0) {
@@ -622,6 +1125,14 @@ static int cleanup_tmpdir(const char *tmpdir, const char *src,
 		rc++;
 	}
 
+	/* the overlay directories belong to root */
+	if (overlay) {
+		if (remove_tree(work) < 0) rc++;
+		if (rmdir(upper) == -1) rc++;
+		free(upper);
+		free(work);
+	}
+
 	if (rmdir(tmpdir) == -1)
 		fprintf(stderr, _("Failed to remove directory %s: %s\n"), tmpdir, strerror(errno));
 	if ((uid_t)setfsuid(pwd->pw_uid) != 0) {
@@ -632,6 +1143,118 @@ static int cleanup_tmpdir(const char *tmpdir, const char *src,
 	return rc;
 }
 
+/**
+ * Create the upper and work directories of an overlay of src in tmpdir,
+ * and check that the overlay can be mounted.  Called with fsuid 0.
+ */
+static int overlay_setup(const char *tmpdir, const char *src, struct stat *src_st,
+	uid_t uid, security_context_t con)
+{
+	char *upper = NULL, *work = NULL;
+	int child, status = -1;
+
+	/* these would be taken as separators in the mount options */
+	if (strpbrk(tmpdir, ",:\\") || strpbrk(src, ",:\\"))
+		return -1;
+
+	if (asprintf(&upper, "%s/upper", tmpdir) == -1 ||
+	    asprintf(&work, "%s/work", tmpdir) == -1) {
+		fprintf(stderr, _("Out of memory\n"));
+		goto out;
+	}
+	if (mkdir(upper, 0700) == -1)
+		goto out;
+	if (mkdir(work, 0700) == -1) {
+		rmdir(upper);
+		goto out;
+	}
+	if (chmod(upper, 01770) == -1 || (con && setfilecon(upper, con) == -1))
+		goto clean;
+
+	/* try it in a namespace of its own */
+	child = fork();
+	if (child == -1) {
+		perror(_("Unable to fork"));
+		goto clean;
+	}
+	if (child == 0) {
+		int fd;
+
+		if (unshare(CLONE_NEWNS) < 0 ||
+		    mount("none", "/", NULL, MS_SLAVE | MS_REC, NULL) < 0)
+			exit(1);
+		if ((uid_t)setfsuid(uid) != 0) exit(1);
+		if ((fd = open_verified(src, src_st)) < 0) exit(1);
+		if ((uid_t)setfsuid(0) != uid) exit(1);
+		exit(overlay_mount(fd, tmpdir, tmpdir, MS_RDONLY) < 0 ? 1 : 0);
+	}
+	waitpid(child, &status, 0);
+	status_to_retval(status, status);
+	if (status == 0)
+		goto out;
+
+clean:
+	status = -1;
+	rmdir(work);
+	rmdir(upper);
+out:
+	free(upper);
+	free(work);
+	return status;
+}
+
+/**
+ * Fork the sandbox.  This process stays behind: once the sandbox exits,
+ * it unmounts the overlay on /tmp, copies what changed in its upper
+ * directory in tmpdir back to the directory open on lower_fd, and exits
+ * with the status of the sandbox.  If the changes could not all be
+ * copied, it exits non-zero instead; otherwise it writes a byte to
+ * report_fd so that the upper directory can be removed.  Only returns
+ * in the sandbox, or on error.
+ */
+static int overlay_fork(int lower_fd, const char *tmpdir, uid_t uid,
+			int report_fd)
+{
+	char *upper = NULL;
+	int pid, status = -1, rc = -1;
+
+	/* outlive a hangup of the sandbox */
+	signal(SIGHUP, SIG_IGN);
+
+	pid = fork();
+	if (pid == -1) {
+		perror(_("Unable to fork"));
+		return -1;
+	}
+	if (pid == 0) {
+		signal(SIGHUP, SIG_DFL);
+		close(lower_fd);
+		close(report_fd);
+		return 0;
+	}
+
+	waitpid(pid, &status, 0);
+	status_to_retval(status, status);
+
+	/* the lower directory must not change under a mounted overlay */
+	if (umount("/var/tmp") == -1 || umount("/tmp") == -1)
+		fprintf(stderr, _("Failed to unmount the overlay on /tmp: %s\n"), strerror(errno));
+	else if (asprintf(&upper, "%s/upper", tmpdir) == -1)
+		fprintf(stderr, _("Out of memory\n"));
+	else if (fchdir(lower_fd) == -1 ||
+		 copy_as_user(upper, ".", COPY_UPDATE | COPY_OVERLAY, uid) != 0)
+		fprintf(stderr, _("Failed to copy files from the runtime temporary directory\n"));
+	else
+		rc = 0;
+	free(upper);
+
+	if (rc == 0 && write(report_fd, "", 1) != 1)
+		rc = -1;
+	if (rc < 0 && status == 0)
+		status = 1;
+	exit(status);
+}
+
 /**
  * seunshare will create a tmpdir in /tmp, with root ownership.  The parent
  * process waits for it child to exit to attempt to remove the directory.  If
@@ -642,7 +1265,6 @@ static char *create_tmpdir(const char *src, struct stat *src_st,
 	struct stat *out_st, struct passwd *pwd, security_context_t execcon)
 {
 	char *tmpdir = NULL;
-	char *cmdbuf = NULL;
 	int fd_t = -1, fd_s = -1;
 	struct stat tmp_st;
 	security_context_t con = NULL;
@@ -726,20 +1348,16 @@ static char *create_tmpdir(const char *src, struct stat *src_st,
 		}
 	}
 
-	if ((uid_t)setfsuid(pwd->pw_uid) != 0)
-		goto err;
-
-	if (rsynccmd(src, tmpdir, &cmdbuf) < 0) {
-		goto err;
+	/* an overlay needs no copy; fall back to one if it cannot be used */
+	if (overlay && overlay_setup(tmpdir, src, src_st, pwd->pw_uid, con) != 0) {
+		if (verbose)
+			printf(_("Cannot mount an overlay, copying %s instead\n"), src);
+		overlay = 0;
 	}
 
-	/* ok to not reach this if there is an error */
-	if ((uid_t)setfsuid(0) != pwd->pw_uid)
-		goto err;
-
-	if (cmdbuf && spawn_command(cmdbuf, pwd->pw_uid) != 0) {
+	if (!overlay && copy_as_user(src, tmpdir, 0, pwd->pw_uid) != 0) {
 		fprintf(stderr, _("Failed to populate runtime temporary directory\n"));
-		cleanup_tmpdir(tmpdir, src, pwd, 0);
+		cleanup_tmpdir(tmpdir, src, pwd, 0, 0);
 		goto err;
 	}
 
@@ -747,13 +1365,55 @@ static char *create_tmpdir(const char *src, struct stat *src_st,
 err:
 	free(tmpdir); tmpdir = NULL;
 good:
-	free(cmdbuf); cmdbuf = NULL;
 	freecon(con); con = NULL;
 	if (fd_t >= 0) close(fd_t);
 	if (fd_s >= 0) close(fd_s);
 	return tmpdir;
 }
 
+/**
+ * Kill every process in the sandbox cgroup that runs with the MCS range
+ * of execcon, but this one.  The cgroup is shared by all the sandboxes
+ * of the user, so the range, which is unique to this sandbox, picks its
+ * processes out as killall() does.  Returns the number of processes
+ * killed, or -1 if the group could not be read.
+ */
+static int kill_cgroup(security_context_t execcon)
+{
+	void *handle = NULL;
+	security_context_t scon;
+	context_view_t pidcon;
+	context_t con;
+	const char *mcs;
+	pid_t pid, self = getpid();
+	int rc, killed = 0;
+
+	con = context_new(execcon);
+	if (!con)
+		return -1;
+	mcs = context_range_get(con);
+	if (!mcs) {
+		context_free(con);
+		return -1;
+	}
+
+	rc = cgroup_get_task_begin(cgroup_name, "memory", &handle, &pid);
+	while (rc == 0) {
+		if (pid != self && getpidcon(pid, &scon) == 0) {
+			if (context_view_parse(scon, &pidcon) == 0 &&
+			    context_span_eq(&pidcon.range, mcs) &&
+			    kill(pid, SIGKILL) == 0)
+				killed++;
+			freecon(scon);
+		}
+		rc = cgroup_get_task_next(&handle, &pid);
+	}
+	cgroup_get_task_end(&handle);
+	context_free(con);
+
+	return rc == ECGEOF ? killed : -1;
+}
+
 #define PROC_BASE "/proc"
 
 static int
@@ -805,12 +1465,12 @@ killall (security_context_t execcon)
 
 		if (getpidcon(id, &scon) == 0) {
 
-			context_t pidcon = context_new(scon);
+			context_view_t pidcon;
 			/* Attempt to kill remaining processes */
-			if (strcmp(context_range_get(pidcon), mcs) == 0)
+			if (mcs && context_view_parse(scon, &pidcon) == 0 &&
+			    context_span_eq(&pidcon.range, mcs))
 				kill(id, SIGKILL);
 
-			context_free(pidcon);
 			freecon(scon);
 		}
 		running++;
@@ -832,6 +1492,7 @@ int main(int argc, char **argv) {
 	char *homedir_s = NULL;	/* homedir spec'd by user in argv[] */
 	char *tmpdir_s = NULL;	/* tmpdir spec'd by user in argv[] */
 	char *tmpdir_r = NULL;	/* tmpdir created by seunshare */
+	int report[2] = { -1, -1 };	/* overlay changes copied back */
 
 	struct stat st_curhomedir;
 	struct stat st_homedir;
@@ -846,6 +1507,7 @@ int main(int argc, char **argv) {
 		{"cgroups", 1, 0, 'c'},
 		{"context", 1, 0, 'Z'},
 		{"capabilities", 1, 0, 'C'},
+		{"overlay", 0, 0, 'o'},
 		{NULL, 0, 0, 0}
 	};
 
@@ -875,7 +1537,7 @@ int main(int argc, char **argv) {
 	}
 
 	while (1) {
-		clflag = getopt_long(argc, argv, "Ccvh:t:Z:", long_options, NULL);
+		clflag = getopt_long(argc, argv, "Ccovh:t:Z:", long_options, NULL);
 		if (clflag == -1)
 			break;
 
@@ -898,6 +1560,9 @@ int main(int argc, char **argv) {
 		case 'C':
 			cap_set = CAPNG_SELECT_CAPS;
 			break;
+		case 'o':
+			overlay = 1;
+			break;
 		case 'Z':
 			execcon = optarg;
 			break;
@@ -953,6 +1618,10 @@ int main(int argc, char **argv) {
 		fprintf(stderr, _("Failed to create runtime temporary directory\n"));
 		return -1;
 	}
+	if (tmpdir_r && overlay && pipe2(report, O_CLOEXEC) == -1) {
+		perror(_("Unable to create pipe"));
+		goto err;
+	}
 
 	/* spawn child process */
 	child = fork();
@@ -966,6 +1635,10 @@ int main(int argc, char **argv) {
 		char *LANG = NULL;
 		int rc = -1;
 		char *resolved_path = NULL;
+		int lower_fd = -1;
+
+		if (report[0] >= 0)
+			close(report[0]);
 
 		if (unshare(CLONE_NEWNS) < 0) {
 			perror(_("Failed to unshare"));
@@ -982,6 +1655,11 @@ int main(int argc, char **argv) {
 		/* assume fsuid==ruid after this point */
 		if ((uid_t)setfsuid(uid) != 0) goto childerr;
 
+		/* the overlay is of tmpdir, which homedir may hide */
+		if (tmpdir_s && overlay &&
+		    (lower_fd = open_verified(tmpdir_s, &st_tmpdir_s)) < 0)
+			goto childerr;
+
 		resolved_path = realpath(pwd->pw_dir,NULL);
 		if (! resolved_path) goto childerr;
 
@@ -993,8 +1671,18 @@ int main(int argc, char **argv) {
 		/* mount homedir and tmpdir, in this order */
 		if (homedir_s && seunshare_mount(homedir_s, resolved_path,
 			&st_homedir) != 0) goto childerr;
-		if (tmpdir_s &&	seunshare_mount(tmpdir_r, "/tmp",
+		if (tmpdir_s && !overlay && seunshare_mount(tmpdir_r, "/tmp",
 			&st_tmpdir_r) != 0) goto childerr;
+		if (tmpdir_s && overlay && seunshare_mount_overlay(lower_fd,
+			tmpdir_r, uid) != 0) goto childerr;
+
+		/* the sandbox session includes the process copying back,
+		   which keeps the privileges to unmount the overlay */
+		if (lower_fd >= 0) {
+			setsid();
+			if (overlay_fork(lower_fd, tmpdir_r, uid, report[1]) != 0)
+				goto childerr;
+		}
 
 		if (drop_privs(uid) != 0) goto childerr;
 
@@ -1042,7 +1730,8 @@ int main(int argc, char **argv) {
 			perror(_("Failed to change dir to homedir"));
 			goto childerr;
 		}
-		setsid();
+		if (lower_fd < 0)
+			setsid();
 		execv(argv[optind], argv + optind);
 		fprintf(stderr, _("Failed to execute command %s: %s\n"), argv[optind], strerror(errno));
 childerr:
@@ -1053,6 +1742,10 @@ childerr:
 	}
 
 	drop_caps();
+	if (report[1] >= 0) {
+		close(report[1]);
+		report[1] = -1;
+	}
 
 	/* parent waits for child exit to do the cleanup */
 	waitpid(child, &status, 0);
@@ -1061,12 +1754,33 @@ childerr:
 	/* Make sure all child processes exit */
 	kill(-child,SIGTERM);
 
-	if (execcon && kill_all)
-		killall(execcon);
+	/* The cgroup lists the sandbox processes directly, among those of
+	 * the user's other sandboxes; repeat in case some were forked while
+	 * it was being read.  Scan /proc otherwise. */
+	if (execcon && kill_all) {
+		int i, killed = -1;
 
-	if (tmpdir_r) cleanup_tmpdir(tmpdir_r, tmpdir_s, pwd, 1);
+		for (i = 0; cgroup_name && i < 10; i++)
+			if ((killed = kill_cgroup(execcon)) <= 0)
+				break;
+		if (killed < 0)
+			killall(execcon);
+	}
+
+	if (tmpdir_r) {
+		char c;
+		int copied = report[0] >= 0 && read(report[0], &c, 1) == 1;
+
+		cleanup_tmpdir(tmpdir_r, tmpdir_s, pwd, !overlay,
+			       overlay && !copied);
+	}
 
 err:
+	if (report[0] >= 0)
+		close(report[0]);
+	if (report[1] >= 0)
+		close(report[1]);
 	free(tmpdir_r);
+	free(cgroup_name);
 	return status;
 }
@@ -113,6 +113,8 @@ static void usage(char *progname)
  	printf("  -r,--remove=MODULE_NAME   remove existing module\n");
 	printf
 	    ("  -l,--list-modules         display list of installed modules\n");
+	printf
+	    ("  -F,--file=FILE            read more modes from FILE (- for stdin)\n");
 	printf("Other options:\n");
 	printf("  -s,--store	   name of the store to operate on\n");
 	printf("  -N,-n,--noreload do not reload policy after commit\n");
@@ -148,6 +150,84 @@ static void set_mode(enum client_modes new_mode, char *arg)
 	}
 }
 
+/* Modes that may be given in a file read with -F. */
+static const struct file_mode {
+	const char *short_opt;
+	const char *long_opt;
+	enum client_modes mode;
+} file_modes[] = {
+	{"-i", "--install", INSTALL_M},
+	{"-u", "--upgrade", UPGRADE_M},
+	{"-b", "--base", BASE_M},
+	{"-e", "--enable", ENABLE_M},
+	{"-d", "--disable", DISABLE_M},
+	{"-r", "--remove", REMOVE_M},
+	{"-l", "--list-modules", LIST_M},
+	{NULL, NULL, NO_MODE}
+};
+
+/* Reads modes from path ("-" for stdin), one per line, written as
+ * on the command line: "-i foo.pp", "--remove bar" or "--remove=bar".
+ * Blank lines and lines starting with '#' are skipped.  All of them
+ * are done in the same transaction as the command line modes, so
+ * that many operations collected by a script are committed, and the
+ * policy rebuilt, once. */
+static void read_command_file(const char *path, char *progname)
+{
+	FILE *fp;
+	char *line = NULL, *opt, *arg;
+	size_t len = 0;
+	unsigned int lineno = 0;
+	const struct file_mode *m;
+
+	if (!strcmp(path, "-"))
+		fp = stdin;
+	else if ((fp = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "%s:  Could not open %s:  %s\n", progname,
+			path, strerror(errno));
+		cleanup();
+		exit(1);
+	}
+
+	while (getline(&line, &len, fp) != -1) {
+		lineno++;
+		opt = line + strspn(line, " \t");
+		opt[strcspn(opt, "\r\n")] = '\0';
+		if (*opt == '\0' || *opt == '#')
+			continue;
+
+		arg = opt + strlen(opt);
+		while (arg > opt && (arg[-1] == ' ' || arg[-1] == '\t'))
+			*--arg = '\0';
+		arg = opt + strcspn(opt, " \t=");
+		if (*arg != '\0') {
+			*arg++ = '\0';
+			arg += strspn(arg, " \t");
+		}
+
+		for (m = file_modes; m->short_opt; m++)
+			if (!strcmp(opt, m->short_opt) ||
+			    !strcmp(opt, m->long_opt))
+				break;
+		if (!m->short_opt ||
+		    ((m->mode == LIST_M) != (*arg == '\0'))) {
+			fprintf(stderr, "%s:  %s:%u: invalid mode %s\n",
+				progname, path, lineno, opt);
+			free(line);
+			cleanup();
+			exit(1);
+		}
+
+		set_mode(m->mode, m->mode == LIST_M ? NULL : arg);
+		if (m->mode == BASE_M)
+			create_store = 1;
+	}
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+}
+
 /* Parse command line and set global options. */
 static void parse_command_line(int argc, char **argv)
 {
@@ -168,6 +248,7 @@ static void parse_command_line(int argc, char **argv)
 		{"disable_dontaudit", 0, NULL, 'D'},
 		{"preserve_tunables", 0, NULL, 'P'},
 		{"path", required_argument, NULL, 'p'},
+		{"file", required_argument, NULL, 'F'},
 		{NULL, 0, NULL, 0}
 	};
 	int i;
@@ -176,7 +257,7 @@ static void parse_command_line(int argc, char **argv)
 	no_reload = 0;
 	create_store = 0;
 	while ((i =
-		getopt_long(argc, argv, "p:s:b:hi:lvqe:d:r:u:RnNBDP", opts,
+		getopt_long(argc, argv, "p:s:b:hi:lvqe:d:r:u:RnNBDPF:", opts,
 			    NULL)) != -1) {
 		switch (i) {
 		case 'b':
@@ -231,6 +312,9 @@ static void parse_command_line(int argc, char **argv)
 		case 'P':
 			preserve_tunables = 1;
 			break;
+		case 'F':
+			read_command_file(optarg, argv[0]);
+			break;
 		case '?':
 		default:{
 				usage(argv[0]);
@@ -19,8 +19,13 @@
 #include <sepol/errcodes.h>
 #include <sepol/policydb/policydb.h>
 
+#include <sepol/handle.h>
+#include <sepol/debug.h>
+#include <sepol/policydb/ebitmap.h>
+
 #include <getopt.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <errno.h>
 #include <sys/mman.h>
@@ -29,6 +34,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
 /* for getopt */
@@ -78,54 +84,215 @@ static int reqsymcmp(hashtab_t h
 	return strcmp(keyp1, keyp2);
 }
 
-/* Load a policy package from the given filename. Progname is used for
- * error reporting.
+/* Load a policy package from the given filename, through the given
+ * handle (NULL for the default one). Progname is used for error
+ * reporting unless report is 0. The file is mapped and read from
+ * memory when possible.
  */
-static sepol_module_package_t *load_module(char *filename, char *progname)
+static sepol_module_package_t *load_module(char *filename, char *progname,
+					   sepol_handle_t * handle, int report)
 {
-	int ret;
+	int ret, fd = -1;
 	FILE *fp = NULL;
+	struct stat sb;
+	void *data = MAP_FAILED;
 	struct sepol_policy_file *pf = NULL;
 	sepol_module_package_t *p = NULL;
 
 	if (sepol_module_package_create(&p)) {
-		fprintf(stderr, "%s:  Out of memory\n", progname);
+		if (report)
+			fprintf(stderr, "%s:  Out of memory\n", progname);
 		goto bad;
 	}
 	if (sepol_policy_file_create(&pf)) {
-		fprintf(stderr, "%s:  Out of memory\n", progname);
+		if (report)
+			fprintf(stderr, "%s:  Out of memory\n", progname);
 		goto bad;
 	}
-	fp = fopen(filename, "r");
-	if (!fp) {
-		fprintf(stderr, "%s:  Could not open package %s:  %s", progname,
-			filename, strerror(errno));
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (report)
+			fprintf(stderr, "%s:  Could not open package %s:  %s\n",
+				progname, filename, strerror(errno));
 		goto bad;
 	}
-	sepol_policy_file_set_fp(pf, fp);
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0)
+		data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data != MAP_FAILED) {
+		sepol_policy_file_set_mem(pf, data, sb.st_size);
+	} else {
+		fp = fdopen(fd, "r");
+		if (!fp) {
+			if (report)
+				fprintf(stderr, "%s:  Out of memory\n",
+					progname);
+			goto bad;
+		}
+		fd = -1;
+		sepol_policy_file_set_fp(pf, fp);
+	}
+	if (handle)
+		sepol_policy_file_set_handle(pf, handle);
 
 	ret = sepol_module_package_read(p, pf, 0);
 	if (ret) {
-		fprintf(stderr, "%s:  Error while reading package from %s\n",
-			progname, filename);
+		if (report)
+			fprintf(stderr,
+				"%s:  Error while reading package from %s\n",
+				progname, filename);
 		goto bad;
 	}
-	fclose(fp);
+	if (data != MAP_FAILED)
+		munmap(data, sb.st_size);
+	if (fp)
+		fclose(fp);
+	if (fd >= 0)
+		close(fd);
 	sepol_policy_file_free(pf);
 	return p;
       bad:
 	sepol_module_package_free(p);
 	sepol_policy_file_free(pf);
+	if (data != MAP_FAILED)
+		munmap(data, sb.st_size);
 	if (fp)
 		fclose(fp);
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+/* Upper bound on the threads load_modules() starts, and the number of
+ * modules that make starting another one worthwhile. */
+#define LOAD_MAX_THREADS 8
+#define MODULES_PER_THREAD 8
+
+struct load_work {
+	char **filenames;
+	sepol_module_package_t **mods;
+	int num_mods;
+	int next;		/* next module to load, taken atomically */
+};
+
+static void *load_worker(void *arg)
+{
+	struct load_work *work = arg;
+	sepol_handle_t *handle;
+	int i;
+
+	/* a module that fails is loaded again by the main thread, which
+	 * reports the error */
+	handle = sepol_handle_create();
+	if (!handle)
+		return NULL;
+	sepol_msg_set_callback(handle, NULL, NULL);
+
+	while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) <
+	       work->num_mods)
+		work->mods[i] = load_module(work->filenames[i], NULL, handle, 0);
+
+	sepol_handle_destroy(handle);
 	return NULL;
 }
 
-/* This function generates the requirements graph and stores it in
- * a set of nested hashtables. The top level hash table stores modules
- * keyed by name. The value of that module is a hashtable storing all
- * of the requirements keyed by name. There is no value for the requirements
- * hashtable.
+/* Load the packages named by filenames into mods, on several threads
+ * if there are enough of them. Returns the index of the first package
+ * that could not be loaded, or -1 if all were.
+ */
+static int load_modules(char **filenames, sepol_module_package_t ** mods,
+			int num_mods, char *progname)
+{
+	struct load_work work;
+	pthread_t threads[LOAD_MAX_THREADS];
+	long ncpus;
+	int i, nthreads = 0, started = 0;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > 1) {
+		nthreads = num_mods / MODULES_PER_THREAD;
+		if (nthreads > ncpus)
+			nthreads = ncpus;
+		if (nthreads > LOAD_MAX_THREADS)
+			nthreads = LOAD_MAX_THREADS;
+	}
+
+	if (nthreads > 1) {
+		work.filenames = filenames;
+		work.mods = mods;
+		work.num_mods = num_mods;
+		work.next = 0;
+		for (started = 0; started < nthreads; started++) {
+			if (pthread_create(&threads[started], NULL,
+					   load_worker, &work))
+				break;
+		}
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < num_mods; i++) {
+		if (started && mods[i])
+			continue;
+		mods[i] = load_module(filenames[i], progname, NULL, 1);
+		if (!mods[i])
+			return i;
+	}
+	return -1;
+}
+
+/* The requirements graph: the modules of the linked policy, numbered
+ * in the order their blocks appear, and for each the set of modules
+ * whose symbols it requires.
+ */
+struct mod_deps {
+	char **names;
+	ebitmap_t *reqs;
+	uint32_t num_mods;
+};
+
+/* Number the modules of p by name, storing each decl's module number
+ * in decl_mod (indexed by decl_id). */
+static int number_modules(policydb_t * p, struct mod_deps *deps,
+			  uint32_t * decl_mod, uint32_t num_decls)
+{
+	avrule_block_t *block;
+	avrule_decl_t *decl;
+	hashtab_t names;
+	unsigned int size = 1;
+	char *mod_name;
+	void *val;
+	int ret = -1;
+
+	while (size < num_decls)
+		size <<= 1;
+	names = hashtab_create(reqsymhash, reqsymcmp, size);
+	deps->names = calloc(num_decls, sizeof(*deps->names));
+	if (names == NULL || deps->names == NULL)
+		goto out;
+
+	for (block = p->global; block != NULL; block = block->next) {
+		for (decl = block->branch_list; decl != NULL; decl = decl->next) {
+			mod_name =
+			    decl->module_name ? decl->module_name : BASE_NAME;
+			val = hashtab_search(names, mod_name);
+			if (!val) {
+				deps->names[deps->num_mods++] = mod_name;
+				val = (void *)(uintptr_t) deps->num_mods;
+				if (hashtab_insert(names, mod_name, val))
+					goto out;
+			}
+			decl_mod[decl->decl_id] = (uintptr_t) val - 1;
+		}
+	}
+	ret = 0;
+      out:
+	if (names)
+		hashtab_destroy(names);
+	return ret;
+}
+
+/* This function generates the requirements graph. For every module it
+ * holds the set of modules declaring the symbols the module requires.
  *
  * This only tracks symbols that are _required_ - optional symbols
  * are completely ignored. A future version might look at this.
@@ -138,173 +305,157 @@ static sepol_module_package_t *load_module(char *filename, char *progname)
  *  - users: same problem as roles plus they are usually defined outside
  *           of the policy.
  *  - levels / cats: can't be required or used in modules.
+ *
+ * Rather than looking up the scope of each required symbol, the owner
+ * of every type and boolean is first taken from the declared bitmaps
+ * of the decls, so the graph is a walk over the required bitmaps.
  */
-static hashtab_t generate_requires(policydb_t * p)
+static int generate_requires(policydb_t * p, struct mod_deps *deps)
 {
+	static const uint32_t syms[] = { SYM_TYPES, SYM_BOOLS };
 	avrule_block_t *block;
 	avrule_decl_t *decl;
-	char *mod_name, *req_name, *id;
+	uint32_t *owner[2] = { NULL, NULL }, *decl_mod = NULL;
+	uint32_t num_decls = 0, i, j, m, req;
 	ebitmap_t *b;
 	ebitmap_node_t *node;
-	uint32_t i, j;
-	int ret;
 	scope_datum_t *scope;
-	hashtab_t mods;
-	hashtab_t reqs;
-
-	mods = hashtab_create(reqsymhash, reqsymcmp, 64);
-	if (mods == NULL)
-		return NULL;
+	int ret = -1;
+
+	memset(deps, 0, sizeof(*deps));
+	for (block = p->global; block != NULL; block = block->next)
+		for (decl = block->branch_list; decl != NULL; decl = decl->next)
+			if (decl->decl_id >= num_decls)
+				num_decls = decl->decl_id + 1;
+
+	decl_mod = calloc(num_decls ? num_decls : 1, sizeof(*decl_mod));
+	if (decl_mod == NULL ||
+	    number_modules(p, deps, decl_mod, num_decls ? num_decls : 1))
+		goto out;
+	deps->reqs = calloc(deps->num_mods ? deps->num_mods : 1,
+			    sizeof(*deps->reqs));
+	if (deps->reqs == NULL)
+		goto out;
+
+	/* owner[s][v] is one more than the number of the module
+	 * declaring value v, or 0 if none does */
+	for (i = 0; i < 2; i++) {
+		owner[i] = calloc(p->symtab[syms[i]].nprim + 1,
+				  sizeof(*owner[i]));
+		if (owner[i] == NULL)
+			goto out;
+	}
+	for (block = p->global; block != NULL; block = block->next) {
+		for (decl = block->branch_list; decl != NULL; decl = decl->next) {
+			for (i = 0; i < 2; i++) {
+				b = &decl->declared.scope[syms[i]];
+				ebitmap_for_each_positive_bit(b, node, j) {
+					if (j < p->symtab[syms[i]].nprim &&
+					    !owner[i][j])
+						owner[i][j] =
+						    decl_mod[decl->decl_id] + 1;
+				}
+			}
+		}
+	}
 
 	for (block = p->global; block != NULL; block = block->next) {
 		if (block->flags & AVRULE_OPTIONAL)
 			continue;
 		for (decl = block->branch_list; decl != NULL; decl = decl->next) {
-			mod_name =
-			    decl->module_name ? decl->module_name : BASE_NAME;
-			for (i = 0; i < SYM_NUM; i++) {
-				if (!(i == SYM_TYPES || i == SYM_BOOLS))
-					continue;
-				b = &decl->required.scope[i];
-				ebitmap_for_each_bit(b, node, j) {
-					if (!ebitmap_node_get_bit(node, j))
-						continue;
-					id = p->sym_val_to_name[i][j];
-					scope =
-					    (scope_datum_t *) hashtab_search(p->
-									     scope
-									     [i].
-									     table,
-									     id);
-					/* since this is only called after a successful link,
-					 * this should never happen */
-					assert(scope->scope == SCOPE_DECL);
-					req_name =
-					    p->decl_val_to_struct[scope->
-								  decl_ids[0]]->
-					    module_name ? p->
-					    decl_val_to_struct[scope->
-							       decl_ids[0]]->
-					    module_name : BASE_NAME;
-
-					reqs =
-					    (hashtab_t) hashtab_search(mods,
-								       mod_name);
-					if (!reqs) {
-						reqs =
-						    hashtab_create(reqsymhash,
-								   reqsymcmp,
-								   64);
-						if (reqs == NULL) {
-							return NULL;
-						}
-						ret =
-						    hashtab_insert(mods,
-								   mod_name,
-								   reqs);
-						if (ret != SEPOL_OK)
-							return NULL;
+			m = decl_mod[decl->decl_id];
+			for (i = 0; i < 2; i++) {
+				b = &decl->required.scope[syms[i]];
+				ebitmap_for_each_positive_bit(b, node, j) {
+					if (j < p->symtab[syms[i]].nprim &&
+					    owner[i][j]) {
+						req = owner[i][j] - 1;
+					} else {
+						scope = (scope_datum_t *)
+						    hashtab_search(p->scope
+								   [syms[i]].
+								   table,
+								   p->sym_val_to_name
+								   [syms[i]][j]);
+						/* since this is only called after
+						 * a successful link, this should
+						 * never happen */
+						assert(scope->scope ==
+						       SCOPE_DECL);
+						req = decl_mod[scope->
+							       decl_ids[0]];
 					}
-					ret =
-					    hashtab_insert(reqs, req_name,
-							   NULL);
-					if (!
-					    (ret == SEPOL_EEXIST
-					     || ret == SEPOL_OK))
-						return NULL;
+					if (ebitmap_set_bit(&deps->reqs[m], req,
+							    1))
+						goto out;
 				}
 			}
-
 		}
 	}
+	ret = 0;
 
-	return mods;
+      out:
+	free(owner[0]);
+	free(owner[1]);
+	free(decl_mod);
+	return ret;
 }
 
-static void free_requires(hashtab_t req)
+static void free_requires(struct mod_deps *deps)
 {
-	unsigned int i;
-	hashtab_ptr_t cur;
+	uint32_t i;
 
-	/* We steal memory for everything stored in the hash tables
-	 * from the policydb, so this only looks like it leaks.
+	/* The module names are the policydb's, so only the tables
+	 * are freed here.
 	 */
-	for (i = 0; i < req->size; i++) {
-		cur = req->htable[i];
-		while (cur != NULL) {
-			hashtab_destroy((hashtab_t) cur->datum);
-			cur = cur->next;
-		}
-	}
-	hashtab_destroy(req);
+	for (i = 0; deps->reqs && i < deps->num_mods; i++)
+		ebitmap_destroy(&deps->reqs[i]);
+	free(deps->reqs);
+	free(deps->names);
 }
 
-static void output_graphviz(hashtab_t mods, int exclude_base, FILE * f)
+static void output_graphviz(struct mod_deps *deps, int exclude_base, FILE * f)
 {
-	unsigned int i, j;
-	hashtab_ptr_t cur, cur2;
-	hashtab_t reqs;
+	uint32_t i, j;
+	ebitmap_node_t *node;
 
 	fprintf(f, "digraph mod_deps {\n");
 	fprintf(f, "\toverlap=false\n");
 
-	for (i = 0; i < mods->size; i++) {
-		cur = mods->htable[i];
-		while (cur != NULL) {
-			reqs = (hashtab_t) cur->datum;
-			assert(reqs);
-			for (j = 0; j < reqs->size; j++) {
-				cur2 = reqs->htable[j];
-				while (cur2 != NULL) {
-					if (exclude_base
-					    && strcmp(cur2->key,
-						      BASE_NAME) == 0) {
-						cur2 = cur2->next;
-						continue;
-					}
-					fprintf(f, "\t%s -> %s\n", cur->key,
-						cur2->key);
-					cur2 = cur2->next;
-				}
-			}
-			cur = cur->next;
+	for (i = 0; i < deps->num_mods; i++) {
+		ebitmap_for_each_positive_bit(&deps->reqs[i], node, j) {
+			if (exclude_base
+			    && strcmp(deps->names[j], BASE_NAME) == 0)
+				continue;
+			fprintf(f, "\t%s -> %s\n", deps->names[i],
+				deps->names[j]);
 		}
 	}
 	fprintf(f, "}\n");
 }
 
-static void output_requirements(hashtab_t mods, int exclude_base, FILE * f)
+static void output_requirements(struct mod_deps *deps, int exclude_base,
+				FILE * f)
 {
-	unsigned int i, j;
-	hashtab_ptr_t cur, cur2;
-	hashtab_t reqs;
+	uint32_t i, j;
+	ebitmap_node_t *node;
 	int found_req;
 
-	for (i = 0; i < mods->size; i++) {
-		cur = mods->htable[i];
-		while (cur != NULL) {
-			reqs = (hashtab_t) cur->datum;
-			assert(reqs);
-			fprintf(f, "module: %s\n", cur->key);
-			found_req = 0;
-			for (j = 0; j < reqs->size; j++) {
-				cur2 = reqs->htable[j];
-				while (cur2 != NULL) {
-					if (exclude_base
-					    && strcmp(cur2->key,
-						      BASE_NAME) == 0) {
-						cur2 = cur2->next;
-						continue;
-					}
-					found_req = 1;
-					fprintf(f, "\t%s\n", cur2->key);
-					cur2 = cur2->next;
-				}
-			}
-			if (!found_req)
-				fprintf(f, "\t[no dependencies]\n");
-			cur = cur->next;
+	for (i = 0; i < deps->num_mods; i++) {
+		/* modules requiring nothing are left out */
+		if (ebitmap_length(&deps->reqs[i]) == 0)
+			continue;
+		fprintf(f, "module: %s\n", deps->names[i]);
+		found_req = 0;
+		ebitmap_for_each_positive_bit(&deps->reqs[i], node, j) {
+			if (exclude_base
+			    && strcmp(deps->names[j], BASE_NAME) == 0)
+				continue;
+			found_req = 1;
+			fprintf(f, "\t%s\n", deps->names[j]);
 		}
+		if (!found_req)
+			fprintf(f, "\t[no dependencies]\n");
 	}
 	fprintf(f, "}\n");
 }
@@ -322,7 +473,7 @@ int main(int argc, char **argv)
 	char *basename;
 	sepol_module_package_t *base, **mods;
 	policydb_t *p;
-	hashtab_t req;
+	struct mod_deps deps;
 
 	while ((ch = getopt(argc, argv, "vgb")) != EOF) {
 		switch (ch) {
@@ -349,7 +500,7 @@ int main(int argc, char **argv)
 	}
 
 	basename = argv[optind++];
-	base = load_module(basename, argv[0]);
+	base = load_module(basename, argv[0], NULL, 1);
 	if (!base) {
 		fprintf(stderr,
 			"%s:  Could not load base module from file %s\n",
@@ -367,14 +518,11 @@ int main(int argc, char **argv)
 	}
 	memset(mods, 0, sizeof(sepol_module_package_t *) * num_mods);
 
-	for (i = 0; optind < argc; optind++, i++) {
-		mods[i] = load_module(argv[optind], argv[0]);
-		if (!mods[i]) {
-			fprintf(stderr,
-				"%s:  Could not load module from file %s\n",
-				argv[0], argv[optind]);
-			exit(1);
-		}
+	i = load_modules(argv + optind, mods, num_mods, argv[0]);
+	if (i >= 0) {
+		fprintf(stderr, "%s:  Could not load module from file %s\n",
+			argv[0], argv[optind + i]);
+		exit(1);
 	}
 
 	if (sepol_link_packages(NULL, base, mods, num_mods, verbose)) {
@@ -386,20 +534,19 @@ int main(int argc, char **argv)
 	if (p == NULL)
 		exit(1);
 
-	req = generate_requires(p);
-	if (req == NULL)
+	if (generate_requires(p, &deps))
 		exit(1);
 
 	if (command == SHOW_DEPS)
-		output_requirements(req, exclude_base, stdout);
+		output_requirements(&deps, exclude_base, stdout);
 	else
-		output_graphviz(req, exclude_base, stdout);
+		output_graphviz(&deps, exclude_base, stdout);
 
 	sepol_module_package_free(base);
 	for (i = 0; i < num_mods; i++)
 		sepol_module_package_free(mods[i]);
 
-	free_requires(req);
+	free_requires(&deps);
 
 	exit(0);
 }
@@ -43,6 +43,8 @@ int main(int argc, char **argv)
 	sepol_module_package_t *base;
 	sepol_policydb_t *out, *p;
 	FILE *fp, *outfile;
+	struct stat sb;
+	void *data = MAP_FAILED;
 	int check_assertions = 1;
 	sepol_handle_t *handle;
 
@@ -126,13 +128,23 @@ int main(int argc, char **argv)
 			argv[0], basename, strerror(errno));
 		exit(1);
 	}
-	sepol_policy_file_set_fp(pf, fp);
+	/* read a regular file from memory rather than through stdio */
+	if (fstat(fileno(fp), &sb) == 0 && S_ISREG(sb.st_mode) &&
+	    sb.st_size > 0)
+		data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE,
+			    fileno(fp), 0);
+	if (data != MAP_FAILED)
+		sepol_policy_file_set_mem(pf, data, sb.st_size);
+	else
+		sepol_policy_file_set_fp(pf, fp);
 	ret = sepol_module_package_read(base, pf, 0);
 	if (ret) {
 		fprintf(stderr, "%s:  Error in reading package from %s\n",
 			argv[0], basename);
 		exit(1);
 	}
+	if (data != MAP_FAILED)
+		munmap(data, sb.st_size);
 	fclose(fp);
 
 	/* linking the base takes care of enabling optional avrules */
@@ -7,9 +7,12 @@
  */
 
 #include <sepol/module.h>
+#include <sepol/handle.h>
+#include <sepol/debug.h>
 
 #include <getopt.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <errno.h>
 #include <sys/mman.h>
@@ -32,48 +35,165 @@ static void usage(char *program_name)
 	exit(1);
 }
 
-static sepol_module_package_t *load_module(char *filename)
+/* Load a policy package from the given file, through the given handle
+ * (NULL for the default one), reporting errors unless report is 0. The
+ * file is mapped and read from memory when possible.
+ */
+static sepol_module_package_t *load_module(char *filename,
+					   sepol_handle_t * handle, int report)
 {
-	int ret;
+	int ret, fd = -1;
 	FILE *fp = NULL;
+	struct stat sb;
+	void *data = MAP_FAILED;
 	struct sepol_policy_file *pf = NULL;
 	sepol_module_package_t *p = NULL;
 
 	if (sepol_module_package_create(&p)) {
-		fprintf(stderr, "%s:  Out of memory\n", progname);
+		if (report)
+			fprintf(stderr, "%s:  Out of memory\n", progname);
 		goto bad;
 	}
 	if (sepol_policy_file_create(&pf)) {
-		fprintf(stderr, "%s:  Out of memory\n", progname);
+		if (report)
+			fprintf(stderr, "%s:  Out of memory\n", progname);
 		goto bad;
 	}
-	fp = fopen(filename, "r");
-	if (!fp) {
-		fprintf(stderr, "%s:  Could not open package %s:  %s", progname,
-			filename, strerror(errno));
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (report)
+			fprintf(stderr, "%s:  Could not open package %s:  %s\n",
+				progname, filename, strerror(errno));
 		goto bad;
 	}
-	sepol_policy_file_set_fp(pf, fp);
-
-	printf("%s:  loading package from file %s\n", progname, filename);
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0)
+		data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data != MAP_FAILED) {
+		sepol_policy_file_set_mem(pf, data, sb.st_size);
+	} else {
+		fp = fdopen(fd, "r");
+		if (!fp) {
+			if (report)
+				fprintf(stderr, "%s:  Out of memory\n",
+					progname);
+			goto bad;
+		}
+		fd = -1;
+		sepol_policy_file_set_fp(pf, fp);
+	}
+	if (handle)
+		sepol_policy_file_set_handle(pf, handle);
 
 	ret = sepol_module_package_read(p, pf, 0);
 	if (ret) {
-		fprintf(stderr, "%s:  Error while reading package from %s\n",
-			progname, filename);
+		if (report)
+			fprintf(stderr,
+				"%s:  Error while reading package from %s\n",
+				progname, filename);
 		goto bad;
 	}
-	fclose(fp);
+	if (data != MAP_FAILED)
+		munmap(data, sb.st_size);
+	if (fp)
+		fclose(fp);
+	if (fd >= 0)
+		close(fd);
 	sepol_policy_file_free(pf);
 	return p;
       bad:
 	sepol_module_package_free(p);
 	sepol_policy_file_free(pf);
+	if (data != MAP_FAILED)
+		munmap(data, sb.st_size);
 	if (fp)
 		fclose(fp);
+	if (fd >= 0)
+		close(fd);
 	return NULL;
 }
 
+/* Upper bound on the threads load_modules() starts, and the number of
+ * modules that make starting another one worthwhile. */
+#define LOAD_MAX_THREADS 8
+#define MODULES_PER_THREAD 8
+
+struct load_work {
+	char **filenames;
+	sepol_module_package_t **mods;
+	int num_mods;
+	int next;		/* next module to load, taken atomically */
+};
+
+static void *load_worker(void *arg)
+{
+	struct load_work *work = arg;
+	sepol_handle_t *handle;
+	int i;
+
+	/* a module that fails is loaded again by the main thread, which
+	 * reports the error */
+	handle = sepol_handle_create();
+	if (!handle)
+		return NULL;
+	sepol_msg_set_callback(handle, NULL, NULL);
+
+	while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) <
+	       work->num_mods)
+		work->mods[i] = load_module(work->filenames[i], handle, 0);
+
+	sepol_handle_destroy(handle);
+	return NULL;
+}
+
+/* Load the packages named by filenames into mods, on several threads
+ * if there are enough of them. Returns the index of the first package
+ * that could not be loaded, or -1 if all were.
+ */
+static int load_modules(char **filenames, sepol_module_package_t ** mods,
+			int num_mods)
+{
+	struct load_work work;
+	pthread_t threads[LOAD_MAX_THREADS];
+	long ncpus;
+	int i, nthreads = 0, started = 0;
+
+	for (i = 0; i < num_mods; i++)
+		printf("%s:  loading package from file %s\n", progname,
+		       filenames[i]);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > 1) {
+		nthreads = num_mods / MODULES_PER_THREAD;
+		if (nthreads > ncpus)
+			nthreads = ncpus;
+		if (nthreads > LOAD_MAX_THREADS)
+			nthreads = LOAD_MAX_THREADS;
+	}
+
+	if (nthreads > 1) {
+		work.filenames = filenames;
+		work.mods = mods;
+		work.num_mods = num_mods;
+		work.next = 0;
+		for (started = 0; started < nthreads; started++) {
+			if (pthread_create(&threads[started], NULL,
+					   load_worker, &work))
+				break;
+		}
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < num_mods; i++) {
+		if (started && mods[i])
+			continue;
+		mods[i] = load_module(filenames[i], NULL, 1);
+		if (!mods[i])
+			return i;
+	}
+	return -1;
+}
+
 int main(int argc, char **argv)
 {
 	int ch, i, show_version = 0, verbose = 0, num_mods;
@@ -114,7 +234,8 @@ int main(int argc, char **argv)
 	}
 
 	basename = argv[optind++];
-	base = load_module(basename);
+	printf("%s:  loading package from file %s\n", progname, basename);
+	base = load_module(basename, NULL, 1);
 	if (!base) {
 		fprintf(stderr,
 			"%s:  Could not load base module from file %s\n",
@@ -132,14 +253,11 @@ int main(int argc, char **argv)
 	}
 	memset(mods, 0, sizeof(sepol_module_package_t *) * num_mods);
 
-	for (i = 0; optind < argc; optind++, i++) {
-		mods[i] = load_module(argv[optind]);
-		if (!mods[i]) {
-			fprintf(stderr,
-				"%s:  Could not load module from file %s\n",
-				argv[0], argv[optind]);
-			exit(1);
-		}
+	i = load_modules(argv + optind, mods, num_mods);
+	if (i >= 0) {
+		fprintf(stderr, "%s:  Could not load module from file %s\n",
+			argv[0], argv[optind + i]);
+		exit(1);
 	}
 
 	if (sepol_link_packages(NULL, base, mods, num_mods, verbose)) {
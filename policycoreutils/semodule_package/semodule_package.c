@@ -16,6 +16,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <errno.h>
 
@@ -26,6 +27,7 @@ static void usage(char *prog)
 {
 	printf("usage: %s -o <output file> -m <module> [-f <file contexts>]\n",
 	       prog);
+	printf("       %s -b <batch file> [-j <jobs>]\n", prog);
 	printf("Options:\n");
 	printf("  -o --outfile		Output file (required)\n");
 	printf("  -m --module		Module file (required)\n");
@@ -34,6 +36,8 @@ static void usage(char *prog)
 	printf
 	    ("  -u --user_extra	user_extra file (only valid in base)\n");
 	printf("  -n --nc		Netfilter contexts file\n");
+	printf("  -b --batch		File of \"output module [file contexts]\" lines\n");
+	printf("  -j --jobs		Number of packages to build at a time\n");
 	exit(1);
 }
 
@@ -87,17 +91,164 @@ static int file_to_data(const char *path, char **data, size_t * len)
 	return -1;
 }
 
-int main(int argc, char **argv)
+/* Write one package; errors exit, which also ends a batch child. */
+static int package(char *module, char *outfile, char *file_contexts,
+		   char *seusers, char *user_extra, char *netfilter_contexts)
 {
 	struct sepol_module_package *pkg;
 	struct sepol_policy_file *mod, *out;
+	char *fcdata = NULL, *seusersdata = NULL, *user_extradata = NULL;
+	char *ncdata = NULL;
+	size_t fclen = 0, seuserslen = 0, user_extralen = 0, nclen = 0;
+
+	if (file_contexts) {
+		if (file_to_data(file_contexts, &fcdata, &fclen))
+			exit(1);
+	}
+
+	if (seusers) {
+		if (file_to_data(seusers, &seusersdata, &seuserslen))
+			exit(1);
+	}
+
+	if (user_extra) {
+		if (file_to_data(user_extra, &user_extradata, &user_extralen))
+			exit(1);
+	}
+
+	if (netfilter_contexts) {
+		if (file_to_data(netfilter_contexts, &ncdata, &nclen))
+			exit(1);
+	}
+
+	if (file_to_policy_file(module, &mod, "r"))
+		exit(1);
+
+	if (sepol_module_package_create(&pkg)) {
+		fprintf(stderr, "%s:  Out of memory\n", progname);
+		exit(1);
+	}
+
+	if (sepol_policydb_read(sepol_module_package_get_policy(pkg), mod)) {
+		fprintf(stderr,
+			"%s:  Error while reading policy module from %s\n",
+			progname, module);
+		exit(1);
+	}
+
+	if (fclen)
+		sepol_module_package_set_file_contexts(pkg, fcdata, fclen);
+
+	if (seuserslen)
+		sepol_module_package_set_seusers(pkg, seusersdata, seuserslen);
+
+	if (user_extra)
+		sepol_module_package_set_user_extra(pkg, user_extradata,
+						    user_extralen);
+
+	if (nclen)
+		sepol_module_package_set_netfilter_contexts(pkg, ncdata, nclen);
+
+	if (file_to_policy_file(outfile, &out, "w"))
+		exit(1);
+
+	if (sepol_module_package_write(pkg, out)) {
+		fprintf(stderr,
+			"%s:  Error while writing module package to %s\n",
+			progname, outfile);
+		exit(1);
+	}
+
+	if (fclen)
+		munmap(fcdata, fclen);
+	if (nclen)
+		munmap(ncdata, nclen);
+	sepol_policy_file_free(mod);
+	sepol_policy_file_free(out);
+	sepol_module_package_free(pkg);
+	return 0;
+}
+
+/*
+ * Build the packages listed in 'batch', one per line as "output module
+ * [file contexts]", each in its own child process and up to 'jobs' at
+ * a time.
+ */
+static int package_batch(const char *batch, long jobs)
+{
+	FILE *f;
+	char *line = NULL, *outfile, *module, *fc, *save;
+	size_t size = 0;
+	int running = 0, failed = 0, total = 0, status, eof = 0;
+	pid_t pid;
+
+	f = fopen(batch, "r");
+	if (!f) {
+		fprintf(stderr, "%s:  Could not open file %s:  %s\n", progname,
+			batch, strerror(errno));
+		return 1;
+	}
+
+	while (!eof || running) {
+		if (!eof && running < jobs) {
+			if (getline(&line, &size, f) < 0) {
+				eof = 1;
+				continue;
+			}
+			outfile = strtok_r(line, " \t\n", &save);
+			if (!outfile || outfile[0] == '#')
+				continue;
+			module = strtok_r(NULL, " \t\n", &save);
+			fc = strtok_r(NULL, " \t\n", &save);
+			if (!module || strtok_r(NULL, " \t\n", &save)) {
+				fprintf(stderr, "%s:  Bad line for %s in %s\n",
+					progname, outfile, batch);
+				failed++;
+				total++;
+				continue;
+			}
+			fflush(NULL);
+			pid = fork();
+			if (pid < 0) {
+				fprintf(stderr, "%s:  fork failed:  %s\n",
+					progname, strerror(errno));
+				failed++;
+				eof = 1;
+				continue;
+			}
+			if (pid == 0)
+				exit(package(module, outfile, fc, NULL, NULL,
+					     NULL) ? 1 : 0);
+			running++;
+			total++;
+			continue;
+		}
+		if (wait(&status) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed++;
+	}
+
+	free(line);
+	fclose(f);
+	if (failed)
+		fprintf(stderr, "%s:  %d of %d packages failed\n", progname,
+			failed, total);
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
 	char *module = NULL, *file_contexts = NULL, *seusers =
 	    NULL, *user_extra = NULL;
-	char *fcdata = NULL, *outfile = NULL, *seusersdata =
-	    NULL, *user_extradata = NULL;
-	char *netfilter_contexts = NULL, *ncdata = NULL;
-	size_t fclen = 0, seuserslen = 0, user_extralen = 0, nclen = 0;
-	int i;
+	char *outfile = NULL, *netfilter_contexts = NULL, *batch = NULL;
+	char *end;
+	long jobs = 1;
+	int i, rc;
 
 	static struct option opts[] = {
 		{"module", required_argument, NULL, 'm'},
@@ -106,11 +257,13 @@ int main(int argc, char **argv)
 		{"user_extra", required_argument, NULL, 'u'},
 		{"nc", required_argument, NULL, 'n'},
 		{"outfile", required_argument, NULL, 'o'},
+		{"batch", required_argument, NULL, 'b'},
+		{"jobs", required_argument, NULL, 'j'},
 		{"help", 0, NULL, 'h'},
 		{NULL, 0, NULL, 0}
 	};
 
-	while ((i = getopt_long(argc, argv, "m:f:s:u:o:n:h", opts, NULL)) != -1) {
+	while ((i = getopt_long(argc, argv, "m:f:s:u:o:n:b:j:h", opts, NULL)) != -1) {
 		switch (i) {
 		case 'h':
 			usage(argv[0]);
@@ -175,83 +328,36 @@ int main(int argc, char **argv)
 			if (!netfilter_contexts)
 				exit(1);
 			break;
+		case 'b':
+			batch = optarg;
+			break;
+		case 'j':
+			errno = 0;
+			jobs = strtol(optarg, &end, 10);
+			if (errno || *end || jobs < 1)
+				usage(argv[0]);
+			break;
 		}
 	}
 
 	progname = argv[0];
 
+	if (batch) {
+		if (module || outfile || file_contexts || seusers ||
+		    user_extra || netfilter_contexts)
+			usage(argv[0]);
+		exit(package_batch(batch, jobs));
+	}
+
 	if (!module || !outfile) {
 		usage(argv[0]);
 		exit(0);
 	}
 
-	if (file_contexts) {
-		if (file_to_data(file_contexts, &fcdata, &fclen))
-			exit(1);
-	}
-
-	if (seusers) {
-		if (file_to_data(seusers, &seusersdata, &seuserslen))
-			exit(1);
-	}
-
-	if (user_extra) {
-		if (file_to_data(user_extra, &user_extradata, &user_extralen))
-			exit(1);
-	}
-
-	if (netfilter_contexts) {
-		if (file_to_data(netfilter_contexts, &ncdata, &nclen))
-			exit(1);
-	}
-
-	if (file_to_policy_file(module, &mod, "r"))
-		exit(1);
-
-	if (sepol_module_package_create(&pkg)) {
-		fprintf(stderr, "%s:  Out of memory\n", argv[0]);
-		exit(1);
-	}
-
-	if (sepol_policydb_read(sepol_module_package_get_policy(pkg), mod)) {
-		fprintf(stderr,
-			"%s:  Error while reading policy module from %s\n",
-			argv[0], module);
-		exit(1);
-	}
-
-	if (fclen)
-		sepol_module_package_set_file_contexts(pkg, fcdata, fclen);
-
-	if (seuserslen)
-		sepol_module_package_set_seusers(pkg, seusersdata, seuserslen);
-
-	if (user_extra)
-		sepol_module_package_set_user_extra(pkg, user_extradata,
-						    user_extralen);
-
-	if (nclen)
-		sepol_module_package_set_netfilter_contexts(pkg, ncdata, nclen);
-
-	if (file_to_policy_file(outfile, &out, "w"))
-		exit(1);
-
-	if (sepol_module_package_write(pkg, out)) {
-		fprintf(stderr,
-			"%s:  Error while writing module package to %s\n",
-			argv[0], argv[1]);
-		exit(1);
-	}
-
-	if (fclen)
-		munmap(fcdata, fclen);
-	if (nclen)
-		munmap(ncdata, nclen);
-	sepol_policy_file_free(mod);
-	sepol_policy_file_free(out);
-	sepol_module_package_free(pkg);
+	rc = package(module, outfile, file_contexts, seusers, user_extra,
+		     netfilter_contexts);
 	free(file_contexts);
 	free(outfile);
 	free(module);
-	exit(0);
+	exit(rc ? 1 : 0);
 }
@@ -20,11 +20,14 @@
  *   sandbox_x_domain,samba_var_t,dir,getattr,search,open
  *   sandbox_x_domain,initrc_var_run_t,file,ioctl,read,getattr,lock,open
  *
+ * With -i the input is a policy index as written by libsemanage when
+ * policy-index is set, which is mapped instead of read and expanded.
  */
 
 #include <sepol/policydb/policydb.h>
 #include <sepol/policydb/avtab.h>
 #include <sepol/policydb/util.h>
+#include <sepol/policy_index.h>
 
 #include <stdio.h>
 #include <sys/types.h>
@@ -142,37 +145,115 @@ static int attribute_callback(hashtab_key_t key, hashtab_datum_t datum, void *da
 	return 0;
 }
 
+struct index_data
+{
+	const sepol_policy_index_t *idx;
+	FILE *fp;
+};
+
+static int output_index_rule(const struct sepol_index_rule *r, void *args)
+{
+	struct index_data *d = args;
+	const char *perm;
+	unsigned int i;
+
+	if (!(r->specified & SEPOL_INDEX_ALLOWED))
+		return 0;
+
+	fprintf(d->fp, "%s,%s,%s",
+		sepol_policy_index_name(d->idx, SEPOL_INDEX_TYPE, r->source),
+		sepol_policy_index_name(d->idx, SEPOL_INDEX_TYPE, r->target),
+		sepol_policy_index_name(d->idx, SEPOL_INDEX_CLASS, r->tclass));
+	for (i = 0; i < 32; i++) {
+		if (!(r->data & (1U << i)))
+			continue;
+		perm = sepol_policy_index_perm(d->idx, r->tclass, i + 1);
+		if (perm)
+			fprintf(d->fp, ",%s", perm);
+	}
+	fprintf(d->fp, "\n");
+
+	return 0;
+}
+
+static int output_index(const char *filename, FILE *fp)
+{
+	sepol_policy_index_t *idx;
+	struct index_data d;
+	uint32_t i, ntypes;
+
+	if (sepol_policy_index_open(filename, &idx) < 0) {
+		fprintf(stderr, "Can't open policy index '%s':  %s\n",
+			filename, strerror(errno));
+		return -1;
+	}
+
+	d.idx = idx;
+	d.fp = fp;
+	ntypes = sepol_policy_index_count(idx, SEPOL_INDEX_TYPE);
+	for (i = 1; i <= ntypes; i++) {
+		if (!sepol_policy_index_is_attribute(idx, i))
+			continue;
+		fprintf(fp, "[Attribute %s]\n",
+			sepol_policy_index_name(idx, SEPOL_INDEX_TYPE, i));
+		sepol_policy_index_rules(idx, i, 0, 0, output_index_rule, &d);
+	}
+
+	sepol_policy_index_close(idx);
+	return 0;
+}
+
 static policydb_t *load_policy(const char *filename)
 {
 	policydb_t *policydb;
 	struct policy_file pf;
-	FILE *fp;
+	struct stat sb;
+	void *map;
+	int fd;
 	int ret;
 
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
+	/* Map the policy rather than reading it through stdio. */
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
 		fprintf(stderr, "Can't open '%s':  %s\n",
 			filename, strerror(errno));
 		return NULL;
 	}
+	if (fstat(fd, &sb) < 0) {
+		fprintf(stderr, "Can't stat '%s':  %s\n",
+			filename, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Can't map '%s':  %s\n",
+			filename, strerror(errno));
+		return NULL;
+	}
 
 	policy_file_init(&pf);
-	pf.type = PF_USE_STDIO;
-	pf.fp = fp;
+	pf.type = PF_USE_MEMORY;
+	pf.data = map;
+	pf.len = sb.st_size;
 
 	policydb = malloc(sizeof(policydb_t));
 	if (policydb == NULL) {
 		fprintf(stderr, "Out of memory!\n");
+		munmap(map, sb.st_size);
 		return NULL;
 	}
 
 	if (policydb_init(policydb)) {
 		fprintf(stderr, "Out of memory!\n");
 		free(policydb);
+		munmap(map, sb.st_size);
 		return NULL;
 	}
 
 	ret = policydb_read(policydb, &pf, 1);
+	munmap(map, sb.st_size);
 	if (ret) {
 		fprintf(stderr,
 			"error(s) encountered while parsing configuration\n");
@@ -180,15 +261,14 @@ static policydb_t *load_policy(const char *filename)
 		return NULL;
 	}
 
-	fclose(fp);
-
 	return policydb;
 
 }
 
 void usage(char *progname)
 {
-	printf("usage: %s policy_file out_file\n", progname);
+	printf("usage: %s [-i] policy_file out_file\n", progname);
+	printf("  -i  policy_file is a policy index\n");
 }
 
 int main(int argc, char **argv)
@@ -196,6 +276,18 @@ int main(int argc, char **argv)
 	policydb_t *p;
 	struct callback_data cb_data;
 	FILE *fp;
+	int rc;
+
+	if (argc == 4 && strcmp(argv[1], "-i") == 0) {
+		fp = fopen(argv[3], "w");
+		if (fp == NULL) {
+			fprintf(stderr, "error opening output file\n");
+			return -1;
+		}
+		rc = output_index(argv[2], fp);
+		fclose(fp);
+		return rc;
+	}
 
 	if (argc != 3) {
 		usage(argv[0]);
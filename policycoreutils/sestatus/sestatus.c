@@ -5,11 +5,15 @@
  * Patch provided by Steve Grubb
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <getopt.h>
 #include <selinux/selinux.h>
+#include <selinux/avc.h>
 #include <selinux/get_default_type.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -26,63 +30,66 @@
 #define PROCS "[process]"
 #define FILES "[files]"
 
-/* buffer size for cmp_cmdline */
+/* buffer size for find_pids */
 #define BUFSIZE 255
 
 /* column to put the output (must be a multiple of 8) */
 static unsigned int COL = 32;
 
-extern char *selinux_mnt;
-
-int cmp_cmdline(const char *command, int pid)
-{
-
-	char buf[BUFSIZE];
-	char filename[BUFSIZE];
-
-	memset(buf, '\0', BUFSIZE);
-
-	/* first read the proc entry */
-	sprintf(filename, "%s/%d/exe", PROC_BASE, pid);
-
-	if (readlink(filename, buf, BUFSIZE) < 0)
-		return 0;
-
-	if (buf[BUFSIZE - 1] != '\0')
-		buf[BUFSIZE - 1] = '\0';
+/*
+ * With --json, the same fields are printed as one JSON object: each
+ * section becomes a nested object, and each field a string member
+ * named by its key.
+ */
+static int json = 0;
+static int json_first = 1;
 
-	/* check if this is the command we're looking for. */
-	if (strcmp(command, buf) == 0)
-		return 1;
-	else
-		return 0;
-}
+extern char *selinux_mnt;
 
-int pidof(const char *command)
+/* Find the first process running each command, reading /proc once.
+ * pids[i] is left at -1 for a command that is not running. */
+void find_pids(char *command[], int ncommand, int pids[])
 {
 /* inspired by killall5.c from psmisc */
 	DIR *dir;
 	struct dirent *de;
-	int pid, ret = -1, self = getpid();
+	char buf[BUFSIZE];
+	char filename[BUFSIZE];
+	int pid, i, left = ncommand, self = getpid();
+	ssize_t len;
+
+	for (i = 0; i < ncommand; i++)
+		pids[i] = -1;
+	if (!ncommand)
+		return;
 
 	if (!(dir = opendir(PROC_BASE))) {
 		perror(PROC_BASE);
-		return -1;
+		return;
 	}
 
-	while ((de = readdir(dir)) != NULL) {
+	while (left && (de = readdir(dir)) != NULL) {
 		errno = 0;
 		pid = (int)strtol(de->d_name, (char **)NULL, 10);
 		if (errno || pid == 0 || pid == self)
 			continue;
-		if (cmp_cmdline(command, pid)) {
-			ret = pid;
-			break;
+
+		/* check if this is one of the commands we're looking for */
+		snprintf(filename, sizeof(filename), "%d/exe", pid);
+		len = readlinkat(dirfd(dir), filename, buf, BUFSIZE - 1);
+		if (len < 0)
+			continue;
+		buf[len] = '\0';
+
+		for (i = 0; i < ncommand; i++) {
+			if (pids[i] < 0 && strcmp(command[i], buf) == 0) {
+				pids[i] = pid;
+				left--;
+			}
 		}
 	}
 
 	closedir(dir);
-	return ret;
 }
 
 void load_checks(char *pc[], int *npc, char *fc[], int *nfc)
@@ -95,7 +102,7 @@ void load_checks(char *pc[], int *npc, char *fc[], int *nfc)
 	int filelen = strlen(FILES);
 
 	if (fp == NULL) {
-		printf("\nUnable to open %s.\n", CONF);
+		fprintf(json ? stderr : stdout, "\nUnable to open %s.\n", CONF);
 		return;
 	}
 
@@ -149,8 +156,9 @@ void load_checks(char *pc[], int *npc, char *fc[], int *nfc)
 					break;
 				default:
 					/* ignore lines before a section */
-					printf("Line not in a section: %s.\n",
-					       buf);
+					fprintf(json ? stderr : stdout,
+						"Line not in a section: %s.\n",
+						buf);
 					break;
 				}
 			}
@@ -169,11 +177,153 @@ void printf_tab(const char *outp)
 
 }
 
+static void json_string(const char *str)
+{
+	const unsigned char *p;
+
+	putchar('"');
+	for (p = (const unsigned char *)str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			printf("\\%c", *p);
+		else if (*p < 0x20)
+			printf("\\u%04x", *p);
+		else
+			putchar(*p);
+	}
+	putchar('"');
+}
+
+static void json_key(const char *key)
+{
+	printf(json_first ? "\n" : ",\n");
+	json_first = 0;
+	json_string(key);
+	printf(": ");
+}
+
+void print_field(const char *label, const char *key, const char *fmt, ...)
+{
+	va_list ap;
+	char *value = NULL;
+
+	va_start(ap, fmt);
+	if (!json) {
+		printf_tab(label);
+		vprintf(fmt, ap);
+		printf("\n");
+	} else if (vasprintf(&value, fmt, ap) >= 0) {
+		json_key(key);
+		json_string(value);
+		free(value);
+	}
+	va_end(ap);
+}
+
+void section_begin(const char *title, const char *key)
+{
+	if (!json) {
+		printf("\n%s\n", title);
+		return;
+	}
+	json_key(key);
+	printf("{");
+	json_first = 1;
+}
+
+void section_end(void)
+{
+	if (json) {
+		printf("}");
+		json_first = 0;
+	}
+}
+
+static int finish(int rc)
+{
+	if (json)
+		printf("\n}\n");
+	return rc;
+}
+
+static const char *mode_name(int mode)
+{
+	switch (mode) {
+	case 1:
+		return "enforcing";
+	case 0:
+		return "permissive";
+	default:
+		return "disabled";
+	}
+}
+
+void print_bools(void)
+{
+	char **bools;
+	int *active, *pending;
+	int nbool, i;
+
+	if (security_get_boolean_names(&bools, &nbool) < 0)
+		return;
+
+	/* read the active and pending values of each boolean at once */
+	active = calloc(nbool ? nbool : 1, sizeof(int));
+	pending = calloc(nbool ? nbool : 1, sizeof(int));
+	if (active && pending)
+		security_get_boolean_values((const char *const *)bools, nbool,
+					    active, pending);
+
+	section_begin("Policy booleans:", "booleans");
+
+	for (i = 0; i < nbool; i++) {
+		if (strlen(bools[i]) + 1 > COL)
+			COL = strlen(bools[i]) + 1;
+	}
+	for (i = 0; active && pending && i < nbool; i++) {
+		if (json) {
+			json_key(bools[i]);
+			if (active[i] < 0)
+				printf("null");
+			else
+				printf("{\"active\": %s, \"pending\": %s}",
+				       active[i] ? "true" : "false",
+				       pending[i] ? "true" : "false");
+			continue;
+		}
+
+		printf_tab(bools[i]);
+		switch (active[i]) {
+		case 1:
+			printf("on");
+			break;
+		case 0:
+			printf("off");
+			break;
+		default:
+			printf("unknown");
+			break;
+		}
+		if (active[i] >= 0 && pending[i] != active[i])
+			printf(pending[i] ? " (activate pending)" :
+			       " (inactivate pending)");
+		printf("\n");
+	}
+
+	section_end();
+
+	/* free up the booleans */
+	for (i = 0; i < nbool; i++)
+		free(bools[i]);
+	free(bools);
+	free(active);
+	free(pending);
+}
+
 int main(int argc, char **argv)
 {
 	/* these vars are reused several times */
-	int rc, opt, i, c;
-	char *context, *root_path;
+	int rc, opt, i;
+	char *context, *target, *root_path;
 
 	/* files that need context checks */
 	char *fc[MAX_CHECK];
@@ -183,12 +333,9 @@ int main(int argc, char **argv)
 
 	/* processes that need context checks */
 	char *pc[MAX_CHECK];
+	int pids[MAX_CHECK];
 	int npc = 0;
 
-	/* booleans */
-	char **bools;
-	int nbool;
-
 	int verbose = 0;
 	int show_bools = 0;
 
@@ -196,9 +343,13 @@ int main(int argc, char **argv)
 	const char *pol_name, *root_dir;
 	char *pol_path;
 
+	const struct option long_options[] = {
+		{"json", 0, 0, 'j'},
+		{NULL, 0, 0, 0}
+	};
 
 	while (1) {
-		opt = getopt(argc, argv, "vb");
+		opt = getopt_long(argc, argv, "vbj", long_options, NULL);
 		if (opt == -1)
 			break;
 		switch (opt) {
@@ -208,257 +359,218 @@ int main(int argc, char **argv)
 		case 'b':
 			show_bools = 1;
 			break;
+		case 'j':
+			json = 1;
+			break;
 		default:
 			/* invalid option */
 			printf("\nUsage: %s [OPTION]\n\n", basename(argv[0]));
 			printf("  -v  Verbose check of process and file contexts.\n");
 			printf("  -b  Display current state of booleans.\n");
+			printf("  -j, --json  Print the status as a JSON object.\n");
 			printf("\nWithout options, show SELinux status.\n");
 			return -1;
 		}
 	}
-	printf_tab("SELinux status:");
+
+	if (json)
+		printf("{");
+
 	rc = is_selinux_enabled();
 
 	switch (rc) {
 	case 1:
-		printf("enabled\n");
+		print_field("SELinux status:", "status", "enabled");
 		break;
 	case 0:
-		printf("disabled\n");
-		return 0;
+		print_field("SELinux status:", "status", "disabled");
+		return finish(0);
 		break;
 	default:
-		printf("unknown (%s)\n", strerror(errno));
-		return 0;
+		print_field("SELinux status:", "status", "unknown (%s)",
+			    strerror(errno));
+		return finish(0);
 		break;
 	}
 
-	printf_tab("SELinuxfs mount:");
 	if (selinux_mnt != NULL) {
-		printf("%s\n", selinux_mnt);
+		print_field("SELinuxfs mount:", "selinuxfs_mount", "%s",
+			    selinux_mnt);
 	} else {
-		printf("not mounted\n\n");
-		printf("Please mount selinuxfs for proper results.\n");
-		return -1;
+		print_field("SELinuxfs mount:", "selinuxfs_mount",
+			    "not mounted");
+		if (!json)
+			printf("\nPlease mount selinuxfs for proper results.\n");
+		return finish(-1);
 	}
 
-	printf_tab("SELinux root directory:");
 	root_dir = selinux_path();
 	if (root_dir == NULL) {
-		printf("error (%s)\n", strerror(errno));
-		return -1;
+		print_field("SELinux root directory:", "root_directory",
+			    "error (%s)", strerror(errno));
+		return finish(-1);
 	}
 	/* The path has a trailing '/' so duplicate to edit */
 	root_path = strdup(root_dir);
 	if (!root_path) {
-		printf("malloc error (%s)\n", strerror(errno));
-		return -1;
+		print_field("SELinux root directory:", "root_directory",
+			    "malloc error (%s)", strerror(errno));
+		return finish(-1);
 	}
 	/* actually blank the '/' */
 	root_path[strlen(root_path) - 1] = '\0';
-	printf("%s\n", root_path);
+	print_field("SELinux root directory:", "root_directory", "%s",
+		    root_path);
 	free(root_path);
 
 	/* Dump all the path information */
-	printf_tab("Loaded policy name:");
 	pol_path = strdup(selinux_policy_root());
 	if (pol_path) {
 		pol_name = basename(pol_path);
-		puts(pol_name);
+		print_field("Loaded policy name:", "policy_name", "%s",
+			    pol_name);
 		free(pol_path);
 	} else {
-		printf("error (%s)\n", strerror(errno));
-	}
-
-	printf_tab("Current mode:");
-	rc = security_getenforce();
-	switch (rc) {
-	case 1:
-		printf("enforcing\n");
-		break;
-	case 0:
-		printf("permissive\n");
-		break;
-	default:
-		printf("unknown (%s)\n", strerror(errno));
-		break;
+		print_field("Loaded policy name:", "policy_name", "error (%s)",
+			    strerror(errno));
 	}
 
-	printf_tab("Mode from config file:");
-	if (selinux_getenforcemode(&rc) == 0) {
-		switch (rc) {
-		case 1:
-			printf("enforcing\n");
-			break;
-		case 0:
-			printf("permissive\n");
-			break;
-		case -1:
-			printf("disabled\n");
-			break;
-		}
+	/* the kernel status page answers without reading selinuxfs */
+	if (selinux_status_open(0) == 0) {
+		rc = selinux_status_getenforce();
+		i = selinux_status_deny_unknown();
+		selinux_status_close();
 	} else {
-		printf("error (%s)\n", strerror(errno));
+		rc = security_getenforce();
+		i = security_deny_unknown();
 	}
 
-	printf_tab("Policy MLS status:");
+	if (rc < 0)
+		print_field("Current mode:", "current_mode", "unknown (%s)",
+			    strerror(errno));
+	else
+		print_field("Current mode:", "current_mode", "%s",
+			    mode_name(rc));
+
+	if (selinux_getenforcemode(&rc) == 0)
+		print_field("Mode from config file:", "config_mode", "%s",
+			    mode_name(rc));
+	else
+		print_field("Mode from config file:", "config_mode",
+			    "error (%s)", strerror(errno));
+
 	rc = is_selinux_mls_enabled();
 	switch (rc) {
 		case 0:
-			printf("disabled\n");
+			print_field("Policy MLS status:", "mls", "disabled");
 			break;
 		case 1:
-			printf("enabled\n");
+			print_field("Policy MLS status:", "mls", "enabled");
 			break;
 		default:
-			printf("error (%s)\n", strerror(errno));
+			print_field("Policy MLS status:", "mls", "error (%s)",
+				    strerror(errno));
 			break;
 	}
 
-	printf_tab("Policy deny_unknown status:");
-	rc = security_deny_unknown();
-	switch (rc) {
+	switch (i) {
 		case 0:
-			printf("allowed\n");
+			print_field("Policy deny_unknown status:",
+				    "deny_unknown", "allowed");
 			break;
 		case 1:
-			printf("denied\n");
+			print_field("Policy deny_unknown status:",
+				    "deny_unknown", "denied");
 			break;
 		default:
-			printf("error (%s)\n", strerror(errno));
+			print_field("Policy deny_unknown status:",
+				    "deny_unknown", "error (%s)",
+				    strerror(errno));
 			break;
 	}
 
 	rc = security_policyvers();
-	printf_tab("Max kernel policy version:");
 	if (rc < 0)
-		printf("unknown (%s)\n", strerror(errno));
+		print_field("Max kernel policy version:", "max_policy_version",
+			    "unknown (%s)", strerror(errno));
 	else
-		printf("%d\n", rc);
-
+		print_field("Max kernel policy version:", "max_policy_version",
+			    "%d", rc);
 
-	if (show_bools) {
-		/* show booleans */
-		if (security_get_boolean_names(&bools, &nbool) >= 0) {
-			printf("\nPolicy booleans:\n");
 
-			for (i = 0; i < nbool; i++) {
-				if (strlen(bools[i]) + 1 > COL)
-					COL = strlen(bools[i]) + 1;
-			}
-			for (i = 0; i < nbool; i++) {
-				printf_tab(bools[i]);
+	if (show_bools)
+		print_bools();
 
-				rc = security_get_boolean_active(bools[i]);
-				switch (rc) {
-				case 1:
-					printf("on");
-					break;
-				case 0:
-					printf("off");
-					break;
-				default:
-					printf("unknown (%s)", strerror(errno));
-					break;
-				}
-				c = security_get_boolean_pending(bools[i]);
-				if (c != rc)
-					switch (c) {
-					case 1:
-						printf(" (activate pending)");
-						break;
-					case 0:
-						printf(" (inactivate pending)");
-						break;
-					default:
-						printf(" (pending error: %s)",
-						       strerror(errno));
-						break;
-					}
-				printf("\n");
-
-				/* free up the booleans */
-				free(bools[i]);
-			}
-			free(bools);
-		}
-	}
 	/* only show contexts if -v is given */
 	if (!verbose)
-		return 0;
+		return finish(0);
 
 	load_checks(pc, &npc, fc, &nfc);
 
-	printf("\nProcess contexts:\n");
+	section_begin("Process contexts:", "processes");
 
-	printf_tab("Current context:");
 	if (getcon(&context) >= 0) {
-		printf("%s\n", context);
+		print_field("Current context:", "current", "%s", context);
 		freecon(context);
 	} else
-		printf("unknown (%s)\n", strerror(errno));
+		print_field("Current context:", "current", "unknown (%s)",
+			    strerror(errno));
 
-	printf_tab("Init context:");
 	if (getpidcon(1, &context) >= 0) {
-		printf("%s\n", context);
+		print_field("Init context:", "init", "%s", context);
 		freecon(context);
 	} else
-		printf("unknown (%s)\n", strerror(errno));
+		print_field("Init context:", "init", "unknown (%s)",
+			    strerror(errno));
 
+	find_pids(pc, npc, pids);
 	for (i = 0; i < npc; i++) {
-		rc = pidof(pc[i]);
-		if (rc > 0) {
-			if (getpidcon(rc, &context) < 0)
+		if (pids[i] > 0) {
+			if (getpidcon(pids[i], &context) < 0)
 				continue;
 
-			printf_tab(pc[i]);
-			printf("%s\n", context);
+			print_field(pc[i], pc[i], "%s", context);
 			freecon(context);
 		}
 	}
 
-	printf("\nFile contexts:\n");
+	section_end();
+	section_begin("File contexts:", "files");
 
 	/* controlling term */
-	printf_tab("Controlling terminal:");
-	if (lgetfilecon(cterm, &context) >= 0) {
-		printf("%s\n", context);
+	if (cterm && lgetfilecon(cterm, &context) >= 0) {
+		print_field("Controlling terminal:", "terminal", "%s", context);
 		freecon(context);
 	} else {
-		printf("unknown (%s)\n", strerror(errno));
+		print_field("Controlling terminal:", "terminal", "unknown (%s)",
+			    cterm ? strerror(errno) : strerror(ENOTTY));
 	}
 
 	for (i = 0; i < nfc; i++) {
-		if (lgetfilecon(fc[i], &context) >= 0) {
-			printf_tab(fc[i]);
-
-			/* check if this is a symlink */
-			if (lstat(fc[i], &m)) {
-				printf
-				    ("%s (could not check link status (%s)!)\n",
-				     context, strerror(errno));
-				freecon(context);
-				continue;
-			}
-			if (S_ISLNK(m.st_mode)) {
-				/* print link target context */
-				printf("%s -> ", context);
-				freecon(context);
-
-				if (getfilecon(fc[i], &context) >= 0) {
-					printf("%s\n", context);
-					freecon(context);
-				} else {
-					printf("unknown (%s)\n",
-					       strerror(errno));
-				}
+		if (lgetfilecon(fc[i], &context) < 0)
+			continue;
+
+		/* check if this is a symlink */
+		if (lstat(fc[i], &m)) {
+			print_field(fc[i], fc[i],
+				    "%s (could not check link status (%s)!)",
+				    context, strerror(errno));
+		} else if (S_ISLNK(m.st_mode)) {
+			/* print link target context */
+			if (getfilecon(fc[i], &target) >= 0) {
+				print_field(fc[i], fc[i], "%s -> %s", context,
+					    target);
+				freecon(target);
 			} else {
-				printf("%s\n", context);
-				freecon(context);
+				print_field(fc[i], fc[i], "%s -> unknown (%s)",
+					    context, strerror(errno));
 			}
+		} else {
+			print_field(fc[i], fc[i], "%s", context);
 		}
+		freecon(context);
 	}
 
-	return 0;
+	section_end();
+	return finish(0);
 }
@@ -1,58 +1,453 @@
 #include "restore.h"
 #include <glob.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
 #include <selinux/context.h>
 
 #define SKIP -2
 #define ERR -1
-#define MAX_EXCLUDES 1000
 
 /*
- * The hash table of associations, hashed by inode number.
- * Chaining is used for collisions, with elements ordered
- * by inode number in each bucket.  Each hash bucket has a dummy 
- * header.
+ * The table of associations between hard linked inodes and the
+ * context their first pathname matched, keyed by device and inode
+ * number.  It uses open addressing with linear probing and doubles
+ * when half full.  Pathnames and contexts live in one arena and are
+ * referred to by offset; contexts are interned, as the files of a
+ * tree share few of them.  Offset 0 is never handed out, so a slot
+ * whose file is 0 is empty.
  */
-#define HASH_BITS 16
-#define HASH_BUCKETS (1 << HASH_BITS)
-#define HASH_MASK (HASH_BUCKETS-1)
+#define ASSOC_MIN_SLOTS 1024
+
+struct assoc {
+	dev_t dev;
+	ino_t ino;
+	size_t con;		/* arena offset of the matched context */
+	size_t file;		/* arena offset of the full pathname */
+};
+
+static struct {
+	struct assoc *slots;
+	size_t nslots, nel;
+	size_t *cons;		/* arena offsets of the interned contexts */
+	size_t ncons_slots, ncons;
+	char *arena;
+	size_t len, alloc;
+} assoc;
 
 /*
- * An association between an inode and a context.
+ * The excluded paths, without trailing slashes, and every directory
+ * above them, in a table keyed by path.  Like the association table it
+ * uses open addressing with linear probing and doubles when half full.
+ * A path is looked up one directory boundary at a time, so checking it
+ * costs its depth rather than the number of exclusions, which can be
+ * one per mount.  Entries stay when their path is no longer excluded.
  */
-typedef struct file_spec {
-	ino_t ino;		/* inode number */
-	char *con;		/* matched context */
-	char *file;		/* full pathname */
-	struct file_spec *next;	/* next association in hash bucket chain */
-} file_spec_t;
+#define EXCLUDE_MIN_SLOTS 64
 
 struct edir {
-	char *directory;
+	char *directory;	/* NULL if the slot is empty */
 	size_t size;
+	size_t hash;
+	unsigned int excluded;	/* times the path itself was excluded */
+	unsigned int below;	/* exclusions strictly below the path */
 };
 
+static struct {
+	struct edir *slots;
+	size_t nslots, nel;
+} excludes;
+
 
-static file_spec_t *fl_head;
-static int filespec_add(ino_t ino, const security_context_t con, const char *file);
+static int filespec_add(const struct stat *sb, const security_context_t con,
+			const char *file);
 struct restore_opts *r_opts = NULL;
 static void filespec_destroy(void);
 static void filespec_eval(void);
+static int exclude_below(const char *dir, size_t len);
+static void label_io_start(unsigned int inflight);
+static void label_io_stop(void);
 static int excludeCtr = 0;
-static struct edir excludeArray[MAX_EXCLUDES];
 
-void remove_exclude(const char *directory)
+/*
+ * Serializes everything restore() shares between the threads of a
+ * parallel walk: the label handle (its lookups keep per-handle state),
+ * the association table, the progress counter and the output file.
+ * Reading and setting the file labels happens outside of it.
+ */
+static pthread_mutex_t restore_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * With -D, a directory whose tree was relabeled without errors is
+ * tagged with a digest of the file contexts configuration (and of the
+ * options that change the result); later walks that reach a directory
+ * carrying the current digest skip its whole subtree.  A walk that left
+ * anything out, through an exclusion or by staying on one file system,
+ * tags nothing, as a later walk may not leave out the same.
+ */
+#define RESTORE_DIGEST_XATTR "security.restorecon_last"
+static char restore_digest[32];
+static unsigned int restore_errors;	/* entries that failed to relabel */
+static unsigned int restore_skipped;	/* entries left out of the walk */
+
+static void count_error(void)
 {
-	int i = 0;
-	for (i = 0; i < excludeCtr; i++) {
-		if (strcmp(directory, excludeArray[i].directory) == 0) {
-			free(excludeArray[i].directory);
-			if (i != excludeCtr-1)
-				excludeArray[i] = excludeArray[excludeCtr-1];
-			excludeCtr--;
+	pthread_mutex_lock(&restore_lock);
+	restore_errors++;
+	pthread_mutex_unlock(&restore_lock);
+}
+
+static void count_skipped(void)
+{
+	pthread_mutex_lock(&restore_lock);
+	restore_skipped++;
+	pthread_mutex_unlock(&restore_lock);
+}
+
+/*
+ * Statistics for -S, collected only when r_opts->statsfile is set.
+ * The time charged to a device is the time spent labeling its files,
+ * summed over all threads.
+ */
+struct stats_dev {
+	dev_t dev;
+	uint64_t files;
+	double secs;
+};
+
+static struct {
+	pthread_mutex_t lock;	/* protects devs */
+	struct timespec start;
+	uint64_t files, lookups, xattr_reads, xattr_writes, relabeled;
+	struct stats_dev *devs;
+	unsigned int ndevs;
+} stats = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void stats_add(uint64_t *counter)
+{
+	if (r_opts->statsfile)
+		__atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+static double timespec_secs(const struct timespec *from,
+			    const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) +
+	    (to->tv_nsec - from->tv_nsec) / 1000000000.0;
+}
+
+static double stats_elapsed(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_secs(&stats.start, &now);
+}
+
+static void stats_begin(struct timespec *ts)
+{
+	if (r_opts->statsfile)
+		clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+/* Charge the time since 'ts' and 'nfiles' files to device 'dev'. */
+static void stats_charge(dev_t dev, const struct timespec *ts,
+			 unsigned int nfiles)
+{
+	struct stats_dev *devs;
+	struct timespec now;
+	unsigned int i;
+
+	if (!r_opts->statsfile)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&stats.lock);
+	for (i = 0; i < stats.ndevs; i++)
+		if (stats.devs[i].dev == dev)
+			break;
+	if (i == stats.ndevs) {
+		devs = realloc(stats.devs, (i + 1) * sizeof(*devs));
+		if (!devs) {
+			pthread_mutex_unlock(&stats.lock);
 			return;
 		}
+		stats.devs = devs;
+		memset(&devs[i], 0, sizeof(*devs));
+		devs[i].dev = dev;
+		stats.ndevs++;
+	}
+	stats.devs[i].files += nfiles;
+	stats.devs[i].secs += timespec_secs(ts, &now);
+	pthread_mutex_unlock(&stats.lock);
+}
+
+static void json_string(FILE *fp, const char *str)
+{
+	const unsigned char *p;
+
+	fputc('"', fp);
+	for (p = (const unsigned char *)str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			fprintf(fp, "\\%c", *p);
+		else if (*p < 0x20)
+			fprintf(fp, "\\u%04x", *p);
+		else
+			fputc(*p, fp);
+	}
+	fputc('"', fp);
+}
+
+/* Find the mount point of 'dev' in 'buf' from /proc/self/mountinfo. */
+static int stats_mount_point(dev_t dev, char *buf, size_t size)
+{
+	unsigned int maj, min;
+	char *line = NULL, *mnt;
+	size_t len = 0;
+	int found = 0;
+	FILE *fp;
+
+	fp = fopen("/proc/self/mountinfo", "r");
+	if (!fp)
+		return 0;
+	/* The last mount of a device is the one that is visible. */
+	while (getline(&line, &len, fp) > 0) {
+		if (sscanf(line, "%*s %*s %u:%u %*s %ms", &maj, &min, &mnt) != 3)
+			continue;
+		if (makedev(maj, min) == dev) {
+			snprintf(buf, size, "%s", mnt);
+			found = 1;
+		}
+		free(mnt);
+	}
+	free(line);
+	fclose(fp);
+	return found;
+}
+
+static void stats_report(FILE *fp)
+{
+	double elapsed = stats_elapsed();
+	char mnt[PATH_MAX];
+	unsigned int i;
+
+	fprintf(fp, "{\n"
+		"  \"elapsed_seconds\": %.3f,\n"
+		"  \"files\": %llu,\n"
+		"  \"files_per_second\": %.1f,\n"
+		"  \"lookups\": %llu,\n"
+		"  \"lookups_per_second\": %.1f,\n"
+		"  \"xattr_reads\": %llu,\n"
+		"  \"xattr_writes\": %llu,\n"
+		"  \"relabeled\": %llu,\n"
+		"  \"errors\": %u,\n"
+		"  \"mounts\": [",
+		elapsed, (unsigned long long)stats.files,
+		elapsed > 0 ? stats.files / elapsed : 0.0,
+		(unsigned long long)stats.lookups,
+		elapsed > 0 ? stats.lookups / elapsed : 0.0,
+		(unsigned long long)stats.xattr_reads,
+		(unsigned long long)stats.xattr_writes,
+		(unsigned long long)stats.relabeled, restore_errors);
+	for (i = 0; i < stats.ndevs; i++) {
+		fprintf(fp, "%s\n    { \"mount\": ", i ? "," : "");
+		if (stats_mount_point(stats.devs[i].dev, mnt, sizeof(mnt)))
+			json_string(fp, mnt);
+		else
+			fputs("null", fp);
+		fprintf(fp, ", \"device\": \"%u:%u\", \"files\": %llu, "
+			"\"seconds\": %.3f }",
+			major(stats.devs[i].dev), minor(stats.devs[i].dev),
+			(unsigned long long)stats.devs[i].files,
+			stats.devs[i].secs);
+	}
+	fprintf(fp, "%s]\n}\n", stats.ndevs ? "\n  " : "");
+	fflush(fp);
+}
+
+#define FNV1A64_INIT 0xcbf29ce484222325ULL
+#define FNV1A64_PRIME 0x100000001b3ULL
+
+static uint64_t fnv1a64(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= FNV1A64_PRIME;
+	}
+	return h;
+}
+
+/* Hash the name and contents of a file, or its name alone if absent. */
+static uint64_t digest_file(uint64_t h, const char *path)
+{
+	char buf[BUFSIZ];
+	size_t len;
+	FILE *fp;
+
+	h = fnv1a64(h, path, strlen(path) + 1);
+	fp = fopen(path, "r");
+	if (!fp)
+		return h;
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+		h = fnv1a64(h, buf, len);
+	fclose(fp);
+	return fnv1a64(h, "", 1);
+}
+
+static void digest_init(void)
+{
+	static const char *const suffixes[] = {
+		"", ".bin", ".homedirs", ".homedirs.bin", ".local",
+		".local.bin", ".subs", ".subs_dist", NULL
+	};
+	const char *path = r_opts->selabel_opt_path;
+	char fname[PATH_MAX];
+	uint64_t h = FNV1A64_INIT;
+	int i;
+
+	if (!path)
+		path = selinux_file_context_path();
+	for (i = 0; suffixes[i]; i++) {
+		snprintf(fname, sizeof(fname), "%s%s", path, suffixes[i]);
+		h = digest_file(h, fname);
+	}
+	h = fnv1a64(h, &r_opts->force, sizeof(r_opts->force));
+	if (r_opts->rootpath)
+		h = fnv1a64(h, r_opts->rootpath, r_opts->rootpathlen);
+
+	snprintf(restore_digest, sizeof(restore_digest), "%016llx",
+		 (unsigned long long)h);
+}
+
+static int digest_current(const char *path)
+{
+	char buf[sizeof(restore_digest)];
+	ssize_t len;
+
+	len = lgetxattr(path, RESTORE_DIGEST_XATTR, buf, sizeof(buf));
+	return len == (ssize_t)strlen(restore_digest) &&
+	    !memcmp(buf, restore_digest, len);
+}
+
+/* Whether the tree at 'path' was relabeled with the current digest. */
+static int digest_matches(const char *path)
+{
+	if (!digest_current(path))
+		return 0;
+
+	if (r_opts->verbose > 1)
+		printf("%s:  skipping %s, relabeled with digest %s\n",
+		       r_opts->progname, path, restore_digest);
+	return 1;
+}
+
+static void digest_record(const char *path)
+{
+	if (digest_current(path))
+		return;
+	if (lsetxattr(path, RESTORE_DIGEST_XATTR, restore_digest,
+		      strlen(restore_digest), 0) < 0 && r_opts->verbose)
+		fprintf(stderr, "%s:  unable to record digest on %s:  %s\n",
+			r_opts->progname, path, strerror(errno));
+}
+
+/* FNV-1a */
+static size_t exclude_hash(const char *path, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		h ^= (unsigned char)*path++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static struct edir *exclude_find(const char *path, size_t len)
+{
+	size_t h, mask = excludes.nslots - 1;
+	struct edir *e;
+
+	if (!excludes.nslots)
+		return NULL;
+	for (h = exclude_hash(path, len);; h++) {
+		e = &excludes.slots[h & mask];
+		if (!e->directory)
+			return NULL;
+		if (e->size == len && !memcmp(e->directory, path, len))
+			return e;
+	}
+}
+
+static int exclude_grow(void)
+{
+	size_t i, h, nslots = excludes.nslots ? 2 * excludes.nslots :
+	    EXCLUDE_MIN_SLOTS;
+	struct edir *slots;
+
+	slots = calloc(nslots, sizeof(*slots));
+	if (!slots)
+		return -1;
+	for (i = 0; i < excludes.nslots; i++) {
+		if (!excludes.slots[i].directory)
+			continue;
+		for (h = excludes.slots[i].hash;; h++) {
+			if (!slots[h & (nslots - 1)].directory)
+				break;
+		}
+		slots[h & (nslots - 1)] = excludes.slots[i];
+	}
+	free(excludes.slots);
+	excludes.slots = slots;
+	excludes.nslots = nslots;
+	return 0;
+}
+
+/* Return the entry for the path, adding an empty one if there is none. */
+static struct edir *exclude_insert(const char *path, size_t len)
+{
+	struct edir *e = exclude_find(path, len);
+	size_t h;
+
+	if (e)
+		return e;
+	if (2 * (excludes.nel + 1) > excludes.nslots && exclude_grow() < 0)
+		return NULL;
+	for (h = exclude_hash(path, len);; h++) {
+		e = &excludes.slots[h & (excludes.nslots - 1)];
+		if (!e->directory)
+			break;
 	}
-	return;
+	e->directory = strndup(path, len);
+	if (!e->directory)
+		return NULL;
+	e->size = len;
+	e->hash = exclude_hash(path, len);
+	excludes.nel++;
+	return e;
+}
+
+void remove_exclude(const char *directory)
+{
+	size_t i, len = strlen(directory);
+	struct edir *e = exclude_find(directory, len);
+
+	if (!e || !e->excluded)
+		return;
+	e->excluded--;
+	for (i = 0; i < len; i++) {
+		if (directory[i] == '/' && (e = exclude_find(directory, i)))
+			e->below--;
+	}
+	excludeCtr--;
 }
 
 void restore_init(struct restore_opts *opts)
@@ -67,14 +462,29 @@ void restore_init(struct restore_opts *opts)
 		perror(r_opts->selabel_opt_path);
 		exit(1);
 	}	
+	if (r_opts->digest)
+		digest_init();
+	if (r_opts->inflight)
+		label_io_start(r_opts->inflight);
+	if (r_opts->statsfile)
+		clock_gettime(CLOCK_MONOTONIC, &stats.start);
 }
 
 void restore_finish()
 {
-	int i;
-	for (i = 0; i < excludeCtr; i++) {
-		free(excludeArray[i].directory);
-	}
+	size_t i;
+
+	label_io_stop();
+	if (r_opts->statsfile)
+		stats_report(r_opts->statsfile);
+	free(stats.devs);
+	stats.devs = NULL;
+	stats.ndevs = 0;
+	for (i = 0; i < excludes.nslots; i++)
+		free(excludes.slots[i].directory);
+	free(excludes.slots);
+	memset(&excludes, 0, sizeof(excludes));
+	excludeCtr = 0;
 }
 
 static int match(const char *name, struct stat *sb, char **con)
@@ -94,19 +504,226 @@ static int match(const char *name, struct stat *sb, char **con)
 		name += r_opts->rootpathlen;
 	}
 
+	stats_add(&stats.lookups);
 	if (r_opts->rootpath != NULL && name[0] == '\0')
 		/* this is actually the root dir of the alt root */
 		return selabel_lookup_raw(r_opts->hnd, con, "/", sb->st_mode);
 	else
 		return selabel_lookup_raw(r_opts->hnd, con, name, sb->st_mode);
 }
-static int restore(FTSENT *ftsent, int recurse)
+/*
+ * Compare the type fields of two contexts in place.  Contexts that
+ * are too short to have a type compare equal, as they cannot be
+ * parsed into one either.
+ */
+static int context_types_equal(const char *a, const char *b)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		a = strchr(a, ':');
+		b = strchr(b, ':');
+		if (!a || !b)
+			return 1;
+		a++;
+		b++;
+	}
+	while (*a && *a != ':' && *a == *b) {
+		a++;
+		b++;
+	}
+	return (*a == '\0' || *a == ':') && (*b == '\0' || *b == ':');
+}
+
+/*
+ * Asynchronous label I/O.  With -A, restore() hands each file whose
+ * specification has been looked up to a pool of threads that read and
+ * set its label, so that up to r_opts->inflight reads and writes are
+ * outstanding while the walk goes on; this hides the round trip of
+ * every getxattr and setxattr on network file systems.  The walk only
+ * blocks when that many operations are already queued.
+ *
+ * A file whose label cannot be set is still descended into, and with
+ * abort_on_error the walk stops at the next submission after a failure
+ * instead of at the failing file.  The walk must use paths valid from
+ * the current directory, so fts runs with FTS_NOCHDIR.
+ */
+struct label_op {
+	char *path;
+	security_context_t con;
+	dev_t dev;		/* for the -S statistics */
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* an operation was queued, or stop */
+	pthread_cond_t space;	/* an operation was taken off the queue */
+	pthread_cond_t idle;	/* the queue ran empty with nothing active */
+	struct label_op *ops;	/* ring of 'alloc' queued operations */
+	size_t head, count, alloc;
+	pthread_t *threads;
+	unsigned int nthreads, active;
+	int stop;
+	int failed;		/* an operation failed with abort_on_error */
+} label_io = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.space = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+};
+
+static int restore_label(const char *my_file, const char *accpath,
+			 security_context_t newcon);
+
+static void *label_io_worker(void *arg __attribute__ ((unused)))
+{
+	struct label_op op;
+	struct timespec ts;
+	int rc, drop;
+
+	pthread_mutex_lock(&label_io.lock);
+	for (;;) {
+		while (!label_io.count && !label_io.stop)
+			pthread_cond_wait(&label_io.work, &label_io.lock);
+		if (!label_io.count)
+			break;
+		op = label_io.ops[label_io.head];
+		label_io.head = (label_io.head + 1) % label_io.alloc;
+		label_io.count--;
+		label_io.active++;
+		drop = label_io.failed;
+		pthread_cond_signal(&label_io.space);
+		pthread_mutex_unlock(&label_io.lock);
+
+		/* Once the walk is being given up, only drain the queue. */
+		if (drop) {
+			freecon(op.con);
+			rc = 0;
+		} else {
+			stats_begin(&ts);
+			rc = restore_label(op.path, op.path, op.con);
+			stats_charge(op.dev, &ts, 0);
+			if (rc < 0)
+				count_error();
+		}
+		free(op.path);
+
+		pthread_mutex_lock(&label_io.lock);
+		if (rc == ERR && r_opts->abort_on_error)
+			label_io.failed = 1;
+		if (--label_io.active == 0 && !label_io.count)
+			pthread_cond_broadcast(&label_io.idle);
+	}
+	pthread_mutex_unlock(&label_io.lock);
+	return NULL;
+}
+
+static void label_io_start(unsigned int inflight)
+{
+	unsigned int i;
+
+	label_io.ops = calloc(inflight, sizeof(*label_io.ops));
+	label_io.threads = calloc(inflight, sizeof(*label_io.threads));
+	if (!label_io.ops || !label_io.threads)
+		goto fail;
+	label_io.alloc = inflight;
+
+	for (i = 0; i < inflight; i++) {
+		if (pthread_create(&label_io.threads[i], NULL,
+				   label_io_worker, NULL))
+			break;
+		label_io.nthreads++;
+	}
+	/* Run with whatever started, or synchronously if nothing did. */
+	if (label_io.nthreads)
+		return;
+fail:
+	free(label_io.ops);
+	free(label_io.threads);
+	label_io.ops = NULL;
+	label_io.threads = NULL;
+}
+
+static void label_io_stop(void)
+{
+	unsigned int i;
+
+	if (!label_io.nthreads)
+		return;
+
+	pthread_mutex_lock(&label_io.lock);
+	label_io.stop = 1;
+	pthread_cond_broadcast(&label_io.work);
+	pthread_mutex_unlock(&label_io.lock);
+	for (i = 0; i < label_io.nthreads; i++)
+		pthread_join(label_io.threads[i], NULL);
+
+	free(label_io.ops);
+	free(label_io.threads);
+	label_io.ops = NULL;
+	label_io.threads = NULL;
+	label_io.nthreads = 0;
+}
+
+/* Queue the label of 'path' to be checked against 'con'; consumes 'con'. */
+static int label_io_submit(const char *path, dev_t dev,
+			   security_context_t con)
+{
+	char *copy = strdup(path);
+
+	if (!copy) {
+		fprintf(stderr, "%s:  Out of memory!\n", r_opts->progname);
+		freecon(con);
+		return ERR;
+	}
+
+	pthread_mutex_lock(&label_io.lock);
+	while (label_io.count == label_io.alloc && !label_io.failed)
+		pthread_cond_wait(&label_io.space, &label_io.lock);
+	if (label_io.failed) {
+		pthread_mutex_unlock(&label_io.lock);
+		free(copy);
+		freecon(con);
+		return ERR;
+	}
+	label_io.ops[(label_io.head + label_io.count) % label_io.alloc] =
+	    (struct label_op) { copy, con, dev };
+	label_io.count++;
+	pthread_cond_signal(&label_io.work);
+	pthread_mutex_unlock(&label_io.lock);
+	return 0;
+}
+
+/*
+ * Wait for every queued operation to complete.  Returns -1 if one of
+ * them failed in a way that gives up the walk.
+ */
+static int label_io_drain(void)
+{
+	int rc;
+
+	if (!label_io.nthreads)
+		return 0;
+
+	pthread_mutex_lock(&label_io.lock);
+	while (label_io.count || label_io.active)
+		pthread_cond_wait(&label_io.idle, &label_io.lock);
+	rc = label_io.failed ? -1 : 0;
+	label_io.failed = 0;
+	pthread_mutex_unlock(&label_io.lock);
+	return rc;
+}
+
+static int restore(const char *my_file, const char *accpath, struct stat *sb,
+		   int recurse)
 {
-	char *my_file = strdupa(ftsent->fts_path);
 	int ret = -1;
-	security_context_t curcon = NULL, newcon = NULL;
+	security_context_t newcon = NULL;
 	float progress;
-	if (match(my_file, ftsent->fts_statp, &newcon) < 0) {
+
+	pthread_mutex_lock(&restore_lock);
+	if (match(my_file, sb, &newcon) < 0) {
+		pthread_mutex_unlock(&restore_lock);
 		if ((errno == ENOENT) && ((!recurse) || (r_opts->verbose)))
 			fprintf(stderr, "%s:  Warning no default label for %s\n", r_opts->progname, my_file);
 
@@ -114,6 +731,7 @@ static int restore(FTSENT *ftsent, int recurse)
 		return (errno == ENOENT) ? 0 : -1;
 	}
 
+	stats_add(&stats.files);
 	if (r_opts->progress) {
 		r_opts->count++;
 		if (r_opts->count % STAR_COUNT == 0) {
@@ -125,6 +743,9 @@ static int restore(FTSENT *ftsent, int recurse)
 					fprintf(stdout, "\r%-.1f%%", progress);
 				}
 			}
+			if (r_opts->statsfile)
+				fprintf(stdout, "  %.0f files/s ",
+					r_opts->count / stats_elapsed());
 			fflush(stdout);
 		}
 	}
@@ -135,15 +756,20 @@ static int restore(FTSENT *ftsent, int recurse)
 	 * for this inode and it conflicts with this specification,
 	 * then use the last matching specification.
 	 */
-	if (r_opts->add_assoc) {
-		ret = filespec_add(ftsent->fts_statp->st_ino, newcon, my_file);
-		if (ret < 0)
+	if (r_opts->add_assoc && !S_ISDIR(sb->st_mode) && sb->st_nlink > 1) {
+		ret = filespec_add(sb, newcon, my_file);
+		if (ret < 0) {
+			pthread_mutex_unlock(&restore_lock);
 			goto err;
+		}
 
-		if (ret > 0)
+		if (ret > 0) {
 			/* There was already an association and it took precedence. */
+			pthread_mutex_unlock(&restore_lock);
 			goto out;
+		}
 	}
+	pthread_mutex_unlock(&restore_lock);
 
 	if (r_opts->debug) {
 		printf("%s:  %s matched by %s\n", r_opts->progname, my_file, newcon);
@@ -157,8 +783,30 @@ static int restore(FTSENT *ftsent, int recurse)
 		goto out;
 	}
 
+	if (label_io.nthreads)
+		return label_io_submit(my_file, sb->st_dev, newcon);
+	return restore_label(my_file, accpath, newcon);
+out:
+	freecon(newcon);
+	return ret;
+err:
+	freecon(newcon);
+	return ERR;
+}
+
+/*
+ * Read the current label of a file and set it to 'newcon' where the
+ * specification calls for it.  Consumes 'newcon'.
+ */
+static int restore_label(const char *my_file, const char *accpath,
+			 security_context_t newcon)
+{
+	int ret, customizable;
+	security_context_t curcon = NULL;
+
 	/* Get the current context of the file. */
-	ret = lgetfilecon_raw(ftsent->fts_accpath, &curcon);
+	stats_add(&stats.xattr_reads);
+	ret = lgetfilecon_raw(accpath, &curcon);
 	if (ret < 0) {
 		if (errno == ENODATA) {
 			curcon = NULL;
@@ -182,7 +830,13 @@ static int restore(FTSENT *ftsent, int recurse)
 		goto out;
 	}
 
-	if (!r_opts->force && curcon && (is_context_customizable(curcon) > 0)) {
+	customizable = 0;
+	if (!r_opts->force && curcon) {
+		pthread_mutex_lock(&restore_lock);
+		customizable = is_context_customizable(curcon) > 0;
+		pthread_mutex_unlock(&restore_lock);
+	}
+	if (customizable) {
 		if (r_opts->verbose > 1) {
 			fprintf(stderr,
 				"%s: %s not reset customized by admin to %s\n",
@@ -195,10 +849,15 @@ static int restore(FTSENT *ftsent, int recurse)
 	 *  Do not change label unless this is a force or the type is different
 	 */
 	if (!r_opts->force && curcon) {
-		int types_differ = 0;
 		context_t cona;
 		context_t conb;
 		int err = 0;
+
+		/* Files that only differ in user, role or range are common
+		 * and need no parsing. */
+		if (context_types_equal(curcon, newcon))
+			goto out;
+
 		cona = context_new(curcon);
 		if (! cona) {
 			goto out;
@@ -209,24 +868,22 @@ static int restore(FTSENT *ftsent, int recurse)
 			goto out;
 		}
 
-		types_differ = strcmp(context_type_get(cona), context_type_get(conb));
-		if (types_differ) {
-			err |= context_user_set(conb, context_user_get(cona));
-			err |= context_role_set(conb, context_role_get(cona));
-			err |= context_range_set(conb, context_range_get(cona));
-			if (!err) {
-				freecon(newcon);
-				newcon = strdup(context_str(conb));
-			}
+		err |= context_user_set(conb, context_user_get(cona));
+		err |= context_role_set(conb, context_role_get(cona));
+		err |= context_range_set(conb, context_range_get(cona));
+		if (!err) {
+			freecon(newcon);
+			newcon = strdup(context_str(conb));
 		}
 		context_free(cona);
 		context_free(conb);
 
-		if (!types_differ || err) {
+		if (err) {
 			goto out;
 		}
 	}
 
+	stats_add(&stats.relabeled);
 	if (r_opts->verbose) {
 		printf("%s reset %s context %s->%s\n",
 		       r_opts->progname, my_file, curcon ?: "", newcon);
@@ -241,8 +898,11 @@ static int restore(FTSENT *ftsent, int recurse)
 			       my_file, newcon);
 	}
 
-	if (r_opts->outfile)
+	if (r_opts->outfile) {
+		pthread_mutex_lock(&restore_lock);
 		fprintf(r_opts->outfile, "%s\n", my_file);
+		pthread_mutex_unlock(&restore_lock);
+	}
 
 	/*
 	 * Do not relabel the file if -n was used.
@@ -253,12 +913,13 @@ static int restore(FTSENT *ftsent, int recurse)
 	/*
 	 * Relabel the file to the specified context.
 	 */
-	ret = lsetfilecon(ftsent->fts_accpath, newcon);
+	ret = lsetfilecon(accpath, newcon);
 	if (ret) {
 		fprintf(stderr, "%s set context %s->%s failed:'%s'\n",
 			r_opts->progname, my_file, newcon, strerror(errno));
 		goto skip;
 	}
+	stats_add(&stats.xattr_writes);
 	ret = 0;
 out:
 	freecon(curcon);
@@ -280,13 +941,22 @@ err:
  */
 static int apply_spec(FTSENT *ftsent, int recurse)
 {
+	struct timespec ts;
+	int rc;
+
 	if (ftsent->fts_info == FTS_DNR) {
 		fprintf(stderr, "%s:  unable to read directory %s\n",
 			r_opts->progname, ftsent->fts_path);
+		count_error();
 		return SKIP;
 	}
-	
-	int rc = restore(ftsent, recurse);
+
+	stats_begin(&ts);
+	rc = restore(ftsent->fts_path, ftsent->fts_accpath,
+		     ftsent->fts_statp, recurse);
+	stats_charge(ftsent->fts_statp->st_dev, &ts, 1);
+	if (rc < 0)
+		count_error();
 	if (rc == ERR) {
 		if (!r_opts->abort_on_error)
 			return SKIP;
@@ -296,6 +966,321 @@ static int apply_spec(FTSENT *ftsent, int recurse)
 
 #include <sys/statvfs.h>
 
+/*
+ * Parallel tree walk.  Each worker keeps its own deque of directories
+ * still to be read: it pushes the subdirectories it finds and pops
+ * the most recent one, so that it descends depth first, while idle
+ * workers steal the oldest directory of another worker, which is the
+ * one closest to the root and so likely the largest remaining subtree.
+ */
+struct walk_deque {
+	pthread_mutex_t lock;
+	char **dirs;
+	size_t head, tail, alloc;
+};
+
+struct walk {
+	struct walk_deque *deques;
+	unsigned int nthreads;
+	dev_t dev;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	size_t queued;		/* directories sitting in a deque */
+	size_t pending;		/* directories queued or being read */
+	int abort;
+	int rc;
+};
+
+struct walk_worker {
+	struct walk *walk;
+	unsigned int id;
+};
+
+static int walk_push(struct walk *walk, unsigned int id, char *dir)
+{
+	struct walk_deque *dq = &walk->deques[id];
+	char **dirs;
+	size_t alloc;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->head == dq->tail)
+		dq->head = dq->tail = 0;
+	if (dq->tail == dq->alloc) {
+		alloc = dq->alloc ? dq->alloc * 2 : 64;
+		dirs = realloc(dq->dirs, alloc * sizeof(*dirs));
+		if (!dirs) {
+			pthread_mutex_unlock(&dq->lock);
+			return -1;
+		}
+		dq->dirs = dirs;
+		dq->alloc = alloc;
+	}
+	dq->dirs[dq->tail++] = dir;
+	pthread_mutex_unlock(&dq->lock);
+
+	pthread_mutex_lock(&walk->lock);
+	walk->queued++;
+	walk->pending++;
+	pthread_cond_signal(&walk->cond);
+	pthread_mutex_unlock(&walk->lock);
+	return 0;
+}
+
+/* Take a directory from our own deque, or steal one from another. */
+static char *walk_take(struct walk *walk, unsigned int id)
+{
+	struct walk_deque *dq;
+	char *dir = NULL;
+	unsigned int i;
+
+	for (i = 0; i < walk->nthreads && !dir; i++) {
+		dq = &walk->deques[(id + i) % walk->nthreads];
+		pthread_mutex_lock(&dq->lock);
+		if (dq->head != dq->tail) {
+			if (i == 0)
+				dir = dq->dirs[--dq->tail];
+			else
+				dir = dq->dirs[dq->head++];
+		}
+		pthread_mutex_unlock(&dq->lock);
+	}
+
+	if (dir) {
+		pthread_mutex_lock(&walk->lock);
+		walk->queued--;
+		pthread_mutex_unlock(&walk->lock);
+	}
+	return dir;
+}
+
+static void walk_fail(struct walk *walk)
+{
+	pthread_mutex_lock(&walk->lock);
+	walk->rc = -1;
+	if (r_opts->abort_on_error) {
+		walk->abort = 1;
+		pthread_cond_broadcast(&walk->cond);
+	}
+	pthread_mutex_unlock(&walk->lock);
+}
+
+/*
+ * Apply the specification to one entry the way the fts loop does:
+ * returns 1 if it is a directory to descend into, 0 if not, and
+ * ERR if the walk has to be given up.
+ */
+static int walk_entry(struct walk *walk, const char *path, struct stat *sb,
+		      int check_exclude)
+{
+	struct timespec ts;
+	int rc;
+
+	if ((sb->st_dev != walk->dev &&
+	     FTS_XDEV == (r_opts->fts_flags & FTS_XDEV)) ||
+	    (check_exclude && exclude(path))) {
+		count_skipped();
+		return 0;
+	}
+	if (r_opts->digest && S_ISDIR(sb->st_mode) && digest_matches(path))
+		return 0;
+
+	stats_begin(&ts);
+	rc = restore(path, path, sb, 1);
+	stats_charge(sb->st_dev, &ts, 1);
+	if (rc < 0)
+		count_error();
+	if (rc == ERR) {
+		if (r_opts->abort_on_error)
+			return ERR;
+		rc = SKIP;
+	}
+	return rc != SKIP && S_ISDIR(sb->st_mode);
+}
+
+static void walk_dir(struct walk *walk, unsigned int id, const char *dir)
+{
+	size_t dirlen = strlen(dir);
+	char path[PATH_MAX], *subdir;
+	struct dirent *dent;
+	struct stat sb;
+	DIR *dirp;
+	int fd, rc, check_exclude;
+
+	if (dirlen && dir[dirlen - 1] == '/')
+		dirlen--;
+	check_exclude = excludeCtr > 0 && exclude_below(dir, dirlen);
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 || !(dirp = fdopendir(fd))) {
+		if (fd >= 0)
+			close(fd);
+		fprintf(stderr, "%s:  unable to read directory %s\n",
+			r_opts->progname, dir);
+		count_error();
+		return;
+	}
+
+	while ((dent = readdir(dirp)) != NULL) {
+		if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+			continue;
+		if (walk->abort)
+			break;
+
+		if (snprintf(path, sizeof(path), "%.*s/%s", (int)dirlen, dir,
+			     dent->d_name) >= (int)sizeof(path)) {
+			fprintf(stderr, "%s:  path too long under %s\n",
+				r_opts->progname, dir);
+			count_error();
+			walk_fail(walk);
+			continue;
+		}
+
+		if (fstatat(fd, dent->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+			if (errno != ENOENT) {
+				fprintf(stderr, "%s:  unable to stat %s:  %s\n",
+					r_opts->progname, path,
+					strerror(errno));
+				count_error();
+				walk_fail(walk);
+			}
+			continue;
+		}
+
+		rc = walk_entry(walk, path, &sb, check_exclude);
+		if (rc == ERR) {
+			walk_fail(walk);
+			break;
+		}
+		if (rc != 1)
+			continue;
+
+		/* Only the directories still to be read need their own copy. */
+		subdir = strdup(path);
+		if (!subdir || walk_push(walk, id, subdir) < 0) {
+			fprintf(stderr, "%s:  Out of memory!\n",
+				r_opts->progname);
+			free(subdir);
+			walk_fail(walk);
+		}
+	}
+
+	closedir(dirp);
+}
+
+static void *walk_worker(void *arg)
+{
+	struct walk_worker *worker = arg;
+	struct walk *walk = worker->walk;
+	char *dir;
+
+	for (;;) {
+		dir = walk_take(walk, worker->id);
+		if (!dir) {
+			pthread_mutex_lock(&walk->lock);
+			while (!walk->queued && walk->pending && !walk->abort)
+				pthread_cond_wait(&walk->cond, &walk->lock);
+			if (!walk->pending || walk->abort) {
+				pthread_mutex_unlock(&walk->lock);
+				break;
+			}
+			pthread_mutex_unlock(&walk->lock);
+			continue;
+		}
+
+		walk_dir(walk, worker->id, dir);
+		free(dir);
+
+		pthread_mutex_lock(&walk->lock);
+		if (--walk->pending == 0)
+			pthread_cond_broadcast(&walk->cond);
+		pthread_mutex_unlock(&walk->lock);
+	}
+	return NULL;
+}
+
+/*
+ * Relabel the tree rooted at 'name' with r_opts->nthreads threads.
+ * The order in which files are visited, and so the order of any
+ * messages, is not defined.
+ */
+static int process_one_parallel(const char *name)
+{
+	struct walk walk;
+	struct walk_worker *workers;
+	pthread_t *threads;
+	struct stat sb;
+	unsigned int i, started = 0;
+	char *root;
+	size_t j;
+	int rc;
+
+	if (lstat(name, &sb) < 0) {
+		fprintf(stderr,
+			"%s: error while labeling %s:  %s\n",
+			r_opts->progname, name, strerror(errno));
+		return -1;
+	}
+
+	memset(&walk, 0, sizeof(walk));
+	walk.nthreads = r_opts->nthreads;
+	walk.dev = sb.st_dev;
+	pthread_mutex_init(&walk.lock, NULL);
+	pthread_cond_init(&walk.cond, NULL);
+
+	rc = walk_entry(&walk, name, &sb, excludeCtr > 0);
+	if (rc != 1)
+		return rc == ERR ? -1 : 0;
+
+	walk.deques = calloc(walk.nthreads, sizeof(*walk.deques));
+	workers = calloc(walk.nthreads, sizeof(*workers));
+	threads = calloc(walk.nthreads, sizeof(*threads));
+	root = strdup(name);
+	if (!walk.deques || !workers || !threads || !root) {
+		fprintf(stderr, "%s:  Out of memory!\n", r_opts->progname);
+		walk.rc = -1;
+		goto out;
+	}
+	for (i = 0; i < walk.nthreads; i++)
+		pthread_mutex_init(&walk.deques[i].lock, NULL);
+
+	if (walk_push(&walk, 0, root) < 0) {
+		fprintf(stderr, "%s:  Out of memory!\n", r_opts->progname);
+		walk.rc = -1;
+		goto out;
+	}
+	root = NULL;
+
+	for (i = 0; i < walk.nthreads; i++) {
+		workers[i].walk = &walk;
+		workers[i].id = i;
+		if (i && pthread_create(&threads[i], NULL, walk_worker,
+					&workers[i]))
+			break;
+		started++;
+	}
+	/* The calling thread is worker 0; run with whatever started. */
+	walk_worker(&workers[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+out:
+	if (walk.deques) {
+		for (i = 0; i < walk.nthreads; i++) {
+			for (j = walk.deques[i].head; j < walk.deques[i].tail; j++)
+				free(walk.deques[i].dirs[j]);
+			free(walk.deques[i].dirs);
+			pthread_mutex_destroy(&walk.deques[i].lock);
+		}
+	}
+	free(walk.deques);
+	free(workers);
+	free(threads);
+	free(root);
+	pthread_mutex_destroy(&walk.lock);
+	pthread_cond_destroy(&walk.cond);
+	return walk.rc;
+}
+
 static int process_one(char *name, int recurse_this_path)
 {
 	int rc = 0;
@@ -303,6 +1288,8 @@ static int process_one(char *name, int recurse_this_path)
 	dev_t dev_num = 0;
 	FTS *fts_handle = NULL;
 	FTSENT *ftsent = NULL;
+	unsigned int errors = restore_errors, skipped = restore_skipped;
+	struct stat sb;
 
 	if (r_opts == NULL){
 		fprintf(stderr,
@@ -310,7 +1297,14 @@ static int process_one(char *name, int recurse_this_path)
 		goto err;
 	}
 
-	fts_handle = fts_open((char **)namelist, r_opts->fts_flags, NULL);
+	if (recurse_this_path && r_opts->nthreads > 1 &&
+	    !(r_opts->fts_flags & (FTS_LOGICAL | FTS_COMFOLLOW))) {
+		rc = process_one_parallel(name);
+		goto done;
+	}
+
+	fts_handle = fts_open((char **)namelist, r_opts->fts_flags |
+			      (label_io.nthreads ? FTS_NOCHDIR : 0), NULL);
 	if (fts_handle  == NULL) {
 		fprintf(stderr,
 			"%s: error while labeling %s:  %s\n",
@@ -337,14 +1331,30 @@ static int process_one(char *name, int recurse_this_path)
 			continue;
 		/* If the XDEV flag is set and the device is different */
 		if (ftsent->fts_statp->st_dev != dev_num &&
-		    FTS_XDEV == (r_opts->fts_flags & FTS_XDEV))
+		    FTS_XDEV == (r_opts->fts_flags & FTS_XDEV)) {
+			count_skipped();
 			continue;
-		if (excludeCtr > 0) {
+		}
+		/* fts_number of a directory tells whether any exclusion
+		 * lies below it, so its entries need checking at all. */
+		if (excludeCtr > 0 && (ftsent->fts_level == FTS_ROOTLEVEL ||
+				       ftsent->fts_parent->fts_number)) {
 			if (exclude(ftsent->fts_path)) {
 				fts_set(fts_handle, ftsent, FTS_SKIP);
+				count_skipped();
 				continue;
 			}
 		}
+		if (ftsent->fts_info == FTS_D)
+			ftsent->fts_number = excludeCtr > 0 &&
+			    exclude_below(ftsent->fts_path,
+					  ftsent->fts_pathlen);
+		if (r_opts->digest && recurse_this_path &&
+		    ftsent->fts_info == FTS_D &&
+		    digest_matches(ftsent->fts_accpath)) {
+			fts_set(fts_handle, ftsent, FTS_SKIP);
+			continue;
+		}
 
 		rc = apply_spec(ftsent, recurse_this_path);
 		if (rc == SKIP)
@@ -355,7 +1365,18 @@ static int process_one(char *name, int recurse_this_path)
 			break;
 	} while ((ftsent = fts_read(fts_handle)) != NULL);
 
+done:
+	if (label_io_drain() < 0)
+		rc = -1;
+	/* Tag the tree only once every entry in it has the right label. */
+	if (r_opts->digest && recurse_this_path && r_opts->change &&
+	    rc >= 0 && restore_errors == errors &&
+	    restore_skipped == skipped &&
+	    lstat(name, &sb) == 0 && S_ISDIR(sb.st_mode))
+		digest_record(name);
+
 out:
+	label_io_drain();
 	if (r_opts->add_assoc) {
 		if (!r_opts->quiet)
 			filespec_eval();
@@ -447,176 +1468,263 @@ int process_one_realpath(char *name, int recurse)
 	}
 }
 
+/*
+ * Whether the file is an excluded path or lies below one.  Its leading
+ * directories are looked up in turn; once one has no exclusion below
+ * it, neither has anything deeper.
+ */
 int exclude(const char *file)
 {
-	int i = 0;
-	for (i = 0; i < excludeCtr; i++) {
-		if (strncmp
-		    (file, excludeArray[i].directory,
-		     excludeArray[i].size) == 0) {
-			if (file[excludeArray[i].size] == 0
-			    || file[excludeArray[i].size] == '/') {
-				return 1;
-			}
-		}
+	struct edir *e;
+	size_t i;
+
+	if (!excludeCtr || !*file)
+		return 0;
+	for (i = 1;; i++) {
+		if (file[i] != '/' && file[i])
+			continue;
+		e = exclude_find(file, i);
+		if (e && e->excluded)
+			return 1;
+		if (!e || !e->below || !file[i])
+			return 0;
 	}
-	return 0;
+}
+
+/*
+ * Whether any excluded path lies strictly below the directory whose
+ * path is the first 'len' bytes of 'dir', ignoring a trailing slash.
+ * Entries of a directory for which this is false cannot be excluded.
+ */
+static int exclude_below(const char *dir, size_t len)
+{
+	struct edir *e;
+
+	if (len && dir[len - 1] == '/')
+		len--;
+	e = exclude_find(dir, len);
+	return e && e->below;
 }
 
 int add_exclude(const char *directory)
 {
-	size_t len = 0;
+	struct edir *e;
+	size_t i, len = 0;
 
 	if (directory == NULL || directory[0] != '/') {
 		fprintf(stderr, "Full path required for exclude: %s.\n",
 			directory);
 		return 1;
 	}
-	if (excludeCtr == MAX_EXCLUDES) {
-		fprintf(stderr, "Maximum excludes %d exceeded.\n",
-			MAX_EXCLUDES);
-		return 1;
-	}
-
 	len = strlen(directory);
 	while (len > 1 && directory[len - 1] == '/') {
 		len--;
 	}
-	excludeArray[excludeCtr].directory = strndup(directory, len);
 
-	if (excludeArray[excludeCtr].directory == NULL) {
-		fprintf(stderr, "Out of memory.\n");
-		return 1;
+	/* add all the entries before counting, so that failing leaves
+	   only empty ones behind */
+	for (i = 0; i < len; i++) {
+		if (directory[i] == '/' && !exclude_insert(directory, i))
+			goto oom;
+	}
+	e = exclude_insert(directory, len);
+	if (!e)
+		goto oom;
+	e->excluded++;
+	for (i = 0; i < len; i++) {
+		if (directory[i] == '/')
+			exclude_find(directory, i)->below++;
 	}
-	excludeArray[excludeCtr++].size = len;
+	excludeCtr++;
+	return 0;
+
+oom:
+	fprintf(stderr, "Out of memory.\n");
+	return 1;
+}
 
+static size_t assoc_hash(dev_t dev, ino_t ino)
+{
+	uint64_t h = ((uint64_t)ino ^ ((uint64_t)dev << 32)) *
+	    0x9e3779b97f4a7c15ULL;
+
+	return h ^ (h >> 29);
+}
+
+/* Copy 'len' bytes and a NUL into the arena; returns 0 if out of memory. */
+static size_t assoc_store(const char *str, size_t len)
+{
+	size_t alloc, off;
+	char *arena;
+
+	if (assoc.len + len + 1 > assoc.alloc) {
+		alloc = assoc.alloc ? assoc.alloc : 65536;
+		while (assoc.len + len + 1 > alloc)
+			alloc *= 2;
+		arena = realloc(assoc.arena, alloc);
+		if (!arena)
+			return 0;
+		if (!assoc.alloc)
+			arena[assoc.len++] = '\0';	/* reserve offset 0 */
+		assoc.arena = arena;
+		assoc.alloc = alloc;
+	}
+	off = assoc.len;
+	memcpy(assoc.arena + off, str, len);
+	assoc.arena[off + len] = '\0';
+	assoc.len += len + 1;
+	return off;
+}
+
+/* Return the arena offset of 'con', storing it on first use. */
+static size_t assoc_intern(const char *con)
+{
+	size_t len = strlen(con), h, i, off, *cons;
+
+	if (2 * (assoc.ncons + 1) > assoc.ncons_slots) {
+		size_t nslots = assoc.ncons_slots ? 2 * assoc.ncons_slots : 64;
+
+		cons = calloc(nslots, sizeof(*cons));
+		if (!cons)
+			return 0;
+		for (i = 0; i < assoc.ncons_slots; i++) {
+			off = assoc.cons[i];
+			if (!off)
+				continue;
+			h = fnv1a64(FNV1A64_INIT, assoc.arena + off,
+				    strlen(assoc.arena + off));
+			while (cons[h & (nslots - 1)])
+				h++;
+			cons[h & (nslots - 1)] = off;
+		}
+		free(assoc.cons);
+		assoc.cons = cons;
+		assoc.ncons_slots = nslots;
+	}
+
+	h = fnv1a64(FNV1A64_INIT, con, len);
+	for (;; h++) {
+		i = h & (assoc.ncons_slots - 1);
+		off = assoc.cons[i];
+		if (!off)
+			break;
+		if (!strcmp(assoc.arena + off, con))
+			return off;
+	}
+	off = assoc_store(con, len);
+	if (off) {
+		assoc.cons[i] = off;
+		assoc.ncons++;
+	}
+	return off;
+}
+
+static int assoc_grow(void)
+{
+	size_t nslots = assoc.nslots ? 2 * assoc.nslots : ASSOC_MIN_SLOTS;
+	struct assoc *slots;
+	size_t i, h;
+
+	slots = calloc(nslots, sizeof(*slots));
+	if (!slots)
+		return -1;
+	for (i = 0; i < assoc.nslots; i++) {
+		if (!assoc.slots[i].file)
+			continue;
+		h = assoc_hash(assoc.slots[i].dev, assoc.slots[i].ino);
+		while (slots[h & (nslots - 1)].file)
+			h++;
+		slots[h & (nslots - 1)] = assoc.slots[i];
+	}
+	free(assoc.slots);
+	assoc.slots = slots;
+	assoc.nslots = nslots;
 	return 0;
 }
 
 /*
- * Evaluate the association hash table distribution.
+ * Evaluate the association table distribution.
  */
 static void filespec_eval(void)
 {
-	file_spec_t *fl;
-	int h, used, nel, len, longest;
+	size_t i, h, dist, longest = 0;
 
-	if (!fl_head)
+	if (!assoc.nel)
 		return;
 
-	used = 0;
-	longest = 0;
-	nel = 0;
-	for (h = 0; h < HASH_BUCKETS; h++) {
-		len = 0;
-		for (fl = fl_head[h].next; fl; fl = fl->next) {
-			len++;
-		}
-		if (len)
-			used++;
-		if (len > longest)
-			longest = len;
-		nel += len;
+	for (i = 0; i < assoc.nslots; i++) {
+		if (!assoc.slots[i].file)
+			continue;
+		h = assoc_hash(assoc.slots[i].dev, assoc.slots[i].ino);
+		dist = (i - h) & (assoc.nslots - 1);
+		if (dist + 1 > longest)
+			longest = dist + 1;
 	}
 
 	if (r_opts->verbose > 1)
 		printf
-		    ("%s:  hash table stats: %d elements, %d/%d buckets used, longest chain length %d\n",
-		     __FUNCTION__, nel, used, HASH_BUCKETS, longest);
+		    ("%s:  hash table stats: %zu elements, %zu slots, %zu contexts, %zu bytes of names, longest probe length %zu\n",
+		     __FUNCTION__, assoc.nel, assoc.nslots, assoc.ncons,
+		     assoc.len, longest);
 }
 
 /*
- * Destroy the association hash table.
+ * Destroy the association table.
  */
 static void filespec_destroy(void)
 {
-	file_spec_t *fl, *tmp;
-	int h;
-
-	if (!fl_head)
-		return;
-
-	for (h = 0; h < HASH_BUCKETS; h++) {
-		fl = fl_head[h].next;
-		while (fl) {
-			tmp = fl;
-			fl = fl->next;
-			freecon(tmp->con);
-			free(tmp->file);
-			free(tmp);
-		}
-		fl_head[h].next = NULL;
-	}
-	free(fl_head);
-	fl_head = NULL;
+	free(assoc.slots);
+	free(assoc.cons);
+	free(assoc.arena);
+	memset(&assoc, 0, sizeof(assoc));
 }
 /*
- * Try to add an association between an inode and a context.
- * If there is a different context that matched the inode,
+ * Try to add an association between a hard linked inode and a
+ * context.  If there is a different context that matched the inode,
  * then use the first context that matched.
  */
-static int filespec_add(ino_t ino, const security_context_t con, const char *file)
+static int filespec_add(const struct stat *sb, const security_context_t con,
+			const char *file)
 {
-	file_spec_t *prevfl, *fl;
-	int h, ret;
-	struct stat64 sb;
+	struct assoc *fl;
+	size_t h;
 
-	if (!fl_head) {
-		fl_head = malloc(sizeof(file_spec_t) * HASH_BUCKETS);
-		if (!fl_head)
-			goto oom;
-		memset(fl_head, 0, sizeof(file_spec_t) * HASH_BUCKETS);
-	}
-
-	h = (ino + (ino >> HASH_BITS)) & HASH_MASK;
-	for (prevfl = &fl_head[h], fl = fl_head[h].next; fl;
-	     prevfl = fl, fl = fl->next) {
-		if (ino == fl->ino) {
-			ret = lstat64(fl->file, &sb);
-			if (ret < 0 || sb.st_ino != ino) {
-				freecon(fl->con);
-				free(fl->file);
-				fl->file = strdup(file);
-				if (!fl->file)
-					goto oom;
-				fl->con = strdup(con);
-				if (!fl->con)
-					goto oom;
-				return 1;
-			}
+	if (2 * (assoc.nel + 1) > assoc.nslots && assoc_grow() < 0)
+		goto oom;
 
-			if (strcmp(fl->con, con) == 0)
-				return 1;
+	for (h = assoc_hash(sb->st_dev, sb->st_ino);; h++) {
+		fl = &assoc.slots[h & (assoc.nslots - 1)];
+		if (!fl->file)
+			break;
+		if (fl->dev != sb->st_dev || fl->ino != sb->st_ino)
+			continue;
 
-			fprintf(stderr,
-				"%s:  conflicting specifications for %s and %s, using %s.\n",
-				__FUNCTION__, file, fl->file, fl->con);
-			free(fl->file);
-			fl->file = strdup(file);
-			if (!fl->file)
-				goto oom;
+		if (strcmp(assoc.arena + fl->con, con) == 0)
 			return 1;
-		}
 
-		if (ino > fl->ino)
-			break;
+		fprintf(stderr,
+			"%s:  conflicting specifications for %s and %s, using %s.\n",
+			__FUNCTION__, file, assoc.arena + fl->file,
+			assoc.arena + fl->con);
+		fl->file = assoc_store(file, strlen(file));
+		if (!fl->file) {
+			/* Keep the slot occupied for the probes behind it. */
+			fl->file = fl->con;
+			goto oom;
+		}
+		return 1;
 	}
 
-	fl = malloc(sizeof(file_spec_t));
-	if (!fl)
-		goto oom;
-	fl->ino = ino;
-	fl->con = strdup(con);
+	fl->con = assoc_intern(con);
 	if (!fl->con)
-		goto oom_freefl;
-	fl->file = strdup(file);
+		goto oom;
+	fl->file = assoc_store(file, strlen(file));
 	if (!fl->file)
-		goto oom_freefl;
-	fl->next = prevfl->next;
-	prevfl->next = fl;
+		goto oom;
+	fl->dev = sb->st_dev;
+	fl->ino = sb->st_ino;
+	assoc.nel++;
 	return 0;
-      oom_freefl:
-	free(fl);
       oom:
 	fprintf(stderr,
 		"%s:  insufficient memory for file label entry for %s\n",
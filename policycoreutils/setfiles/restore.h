@@ -34,12 +34,16 @@ struct restore_opts {
 	int rootpathlen;
 	char *progname;
 	FILE *outfile;
+	FILE *statsfile; /* Where -S writes the final statistics. */
 	int force;
 	struct selabel_handle *hnd;
 	int expand_realpath;  /* Expand paths via realpath. */
 	int abort_on_error; /* Abort the file tree walk upon an error. */
 	int quiet;
 	int fts_flags; /* Flags to fts, e.g. follow links, follow mounts */
+	unsigned int nthreads; /* Threads walking a recursive relabel. */
+	unsigned int inflight; /* Label reads and writes kept in flight. */
+	int digest; /* Skip trees tagged with the current spec digest. */
 	const char *selabel_opt_validate;
 	const char *selabel_opt_path;
 };
@@ -45,13 +45,13 @@ void usage(const char *const name)
 {
 	if (iamrestorecon) {
 		fprintf(stderr,
-			"usage:  %s [-iFnprRv0] [-e excludedir] pathname...\n"
-			"usage:  %s [-iFnprRv0] [-e excludedir] -f filename\n",
+			"usage:  %s [-iDFnprRv0] [-e excludedir] [-T nthreads] [-A inflight] [-S statsfile] pathname...\n"
+			"usage:  %s [-iDFnprRv0] [-e excludedir] [-T nthreads] [-A inflight] [-S statsfile] -f filename\n",
 			name, name);
 	} else {
 		fprintf(stderr,
-			"usage:  %s [-dilnpqvFW] [-e excludedir] [-r alt_root_path] spec_file pathname...\n"
-			"usage:  %s [-dilnpqvFW] [-e excludedir] [-r alt_root_path] spec_file -f filename\n"
+			"usage:  %s [-dilnpqvDFW] [-e excludedir] [-r alt_root_path] [-T nthreads] [-A inflight] [-S statsfile] spec_file pathname...\n"
+			"usage:  %s [-dilnpqvDFW] [-e excludedir] [-r alt_root_path] [-T nthreads] [-A inflight] [-S statsfile] spec_file -f filename\n"
 			"usage:  %s -s [-dilnpqvFW] spec_file\n"
 			"usage:  %s -c policyfile spec_file\n",
 			name, name, name, name);
@@ -169,6 +169,7 @@ int main(int argc, char **argv)
 	r_opts.outfile = NULL;
 	r_opts.force = 0;
 	r_opts.hard_links = 1;
+	r_opts.nthreads = 1;
 
 	altpath = NULL;
 
@@ -226,7 +227,7 @@ int main(int argc, char **argv)
 	r_opts.nfile = exclude_non_seclabel_mounts();
 
 	/* Process any options. */
-	while ((opt = getopt(argc, argv, "c:de:f:hilno:pqrsvFRW0")) > 0) {
+	while ((opt = getopt(argc, argv, "A:c:de:f:hilno:pqrsvDFRS:T:W0")) > 0) {
 		switch (opt) {
 		case 'c':
 			{
@@ -260,6 +261,9 @@ int main(int argc, char **argv)
 
 				break;
 			}
+		case 'D':
+			r_opts.digest = 1;
+			break;
 		case 'e':
 			remove_exclude(optarg);
 			if (lstat(optarg, &sb) < 0 && errno != EACCES) {
@@ -349,6 +353,56 @@ int main(int argc, char **argv)
 			}
 			r_opts.progress++;
 			break;
+		case 'S':
+			if (strcmp(optarg, "-") == 0) {
+				r_opts.statsfile = stdout;
+				break;
+			}
+
+			r_opts.statsfile = fopen(optarg, "w");
+			if (!r_opts.statsfile) {
+				fprintf(stderr, "Error opening %s: %s\n",
+					optarg, strerror(errno));
+
+				usage(argv[0]);
+			}
+			break;
+		case 'T':
+			{
+				char *end;
+				long n;
+
+				errno = 0;
+				n = strtol(optarg, &end, 10);
+				if (errno || end == optarg || *end || n < 0 ||
+				    n > 1024) {
+					fprintf(stderr,
+						"Invalid number of threads %s\n",
+						optarg);
+					usage(argv[0]);
+				}
+				if (n == 0)
+					n = sysconf(_SC_NPROCESSORS_ONLN);
+				r_opts.nthreads = n > 0 ? n : 1;
+				break;
+			}
+		case 'A':
+			{
+				char *end;
+				long n;
+
+				errno = 0;
+				n = strtol(optarg, &end, 10);
+				if (errno || end == optarg || *end || n < 0 ||
+				    n > 1024) {
+					fprintf(stderr,
+						"Invalid number of operations in flight %s\n",
+						optarg);
+					usage(argv[0]);
+				}
+				r_opts.inflight = n;
+				break;
+			}
 		case 'W':
 			warn_no_match = 1;
 			break;
@@ -449,6 +503,8 @@ int main(int argc, char **argv)
 
 	if (r_opts.outfile)
 		fclose(r_opts.outfile);
+	if (r_opts.statsfile && r_opts.statsfile != stdout)
+		fclose(r_opts.statsfile);
 
 	if (r_opts.progress && r_opts.count >= STAR_COUNT)
 		printf("\n");
@@ -119,6 +119,58 @@ static int selinux_set_boolean_list(size_t boolcnt,
 	return 0;
 }
 
+/* Return 1 if every boolean in the list already has its value, both
+   as a local modification and in the kernel, so that committing would
+   only rebuild the same policy. */
+static int semanage_booleans_unchanged(semanage_handle_t * handle,
+				       size_t boolcnt, SELboolean * boollist)
+{
+	const char **names = NULL;
+	int *active = NULL;
+	semanage_bool_key_t *bool_key = NULL;
+	semanage_bool_t *boolean = NULL;
+	int exists, unchanged = 0;
+	size_t j;
+
+	names = calloc(boolcnt ? boolcnt : 1, sizeof(char *));
+	active = calloc(boolcnt ? boolcnt : 1, sizeof(int));
+	if (!names || !active)
+		goto out;
+	for (j = 0; j < boolcnt; j++)
+		names[j] = boollist[j].name;
+
+	if (security_get_boolean_values(names, boolcnt, active, NULL) < 0)
+		goto out;
+
+	for (j = 0; j < boolcnt; j++) {
+		if (active[j] != boollist[j].value)
+			goto out;
+
+		if (semanage_bool_key_create(handle, boollist[j].name,
+					     &bool_key) < 0)
+			goto out;
+		if (semanage_bool_exists_local(handle, bool_key, &exists) < 0 ||
+		    !exists)
+			goto out;
+		if (semanage_bool_query_local(handle, bool_key, &boolean) < 0)
+			goto out;
+		if (semanage_bool_get_value(boolean) != boollist[j].value)
+			goto out;
+		semanage_bool_key_free(bool_key);
+		semanage_bool_free(boolean);
+		bool_key = NULL;
+		boolean = NULL;
+	}
+	unchanged = 1;
+
+      out:
+	semanage_bool_key_free(bool_key);
+	semanage_bool_free(boolean);
+	free(names);
+	free(active);
+	return unchanged;
+}
+
 /* Apply permanent boolean changes to policy via libsemanage */
 static int semanage_set_boolean_list(size_t boolcnt,
 				     SELboolean * boollist)
@@ -161,6 +213,13 @@ static int semanage_set_boolean_list(size_t boolcnt,
 	if (semanage_connect(handle) < 0)
 		goto err;
 
+	/* nothing to rebuild if the values are all in place already */
+	if (semanage_booleans_unchanged(handle, boolcnt, boollist)) {
+		semanage_disconnect(handle);
+		semanage_handle_destroy(handle);
+		return 0;
+	}
+
 	if (semanage_begin_transaction(handle) < 0)
 		goto err;
 
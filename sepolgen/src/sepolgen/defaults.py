@@ -64,6 +64,9 @@ def perm_map():
 def interface_info():
     return data_dir() + "/interface_info"
 
+def interface_cache():
+    return data_dir() + "/interface_cache"
+
 def attribute_info():
     return data_dir() + "/attribute_info"
 
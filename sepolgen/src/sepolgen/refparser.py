@@ -1030,8 +1030,90 @@ def list_headers(root):
     return (modules, support_macros)
 
 
-def parse_headers(root, output=None, expand=True, debug=False):
+def _parse_header_file(f, module, spt=None, debug=False):
+    global parse_file
+    try:
+        fd = open(f)
+        txt = fd.read()
+        fd.close()
+        parse_file = f
+        parse(txt, module, spt, debug)
+    except IOError, e:
+        return
+    except ValueError, e:
+        raise ValueError("error parsing file %s: %s" % (f, str(e)))
+
+# Support macros for the worker processes of parse_headers; they are
+# inherited when the workers are forked.
+_header_spt = None
+
+def _parse_header_module(args):
+    name, filename, debug = args
+    m = refpolicy.Module()
+    m.name = name
+    try:
+        _parse_header_file(filename, m, _header_spt, debug)
+    except ValueError, e:
+        return (None, str(e))
+    return (m, None)
+
+def _file_stamp(filename):
+    try:
+        st = os.stat(filename)
+    except OSError:
+        return None
+    return (st.st_mtime, st.st_size)
+
+CACHE_VERSION = 1
+
+def _load_cache(cache, spt_stamp, expand):
+    try:
+        import cPickle as pickle
+    except ImportError:
+        import pickle
+    try:
+        fd = open(cache, "rb")
+        data = pickle.load(fd)
+        fd.close()
+    except Exception:
+        return {}
+    if not isinstance(data, dict) or data.get("version") != CACHE_VERSION:
+        return {}
+    # Expansion depends on the support macros, so a change to them
+    # invalidates every module.
+    if data.get("expand") != expand or data.get("spt") != spt_stamp:
+        return {}
+    return data.get("modules", {})
+
+def _save_cache(cache, spt_stamp, expand, modules):
+    try:
+        import cPickle as pickle
+    except ImportError:
+        import pickle
+    data = { "version" : CACHE_VERSION, "expand" : expand,
+             "spt" : spt_stamp, "modules" : modules }
+    tmp = "%s.%d" % (cache, os.getpid())
+    try:
+        fd = open(tmp, "wb")
+        pickle.dump(data, fd, pickle.HIGHEST_PROTOCOL)
+        fd.close()
+        os.rename(tmp, cache)
+    except Exception:
+        try:
+            os.unlink(tmp)
+        except OSError:
+            pass
+
+def parse_headers(root, output=None, expand=True, debug=False, jobs=1, cache=None):
+    """Parse the reference policy interface files below root.
+
+    The files are parsed by up to jobs processes (all processors if
+    jobs is 0).  If cache names a file, the parsed modules are kept
+    there and reused while the modification time and size of their
+    file, and of the support macros, are unchanged.
+    """
     import util
+    global _header_spt
 
     headers = refpolicy.Headers()
 
@@ -1056,19 +1138,9 @@ def parse_headers(root, output=None, expand=True, debug=False):
             output.write(msg)
 
     def parse_file(f, module, spt=None):
-        global parse_file
         if debug:
             o("parsing file %s\n" % f)
-        try:
-            fd = open(f)
-            txt = fd.read()
-            fd.close()
-            parse_file = f
-            parse(txt, module, spt, debug)
-        except IOError, e:
-            return
-        except ValueError, e:
-            raise ValueError("error parsing file %s: %s" % (f, str(e)))
+        _parse_header_file(f, module, spt, debug)
 
     spt = None
     if support_macros:
@@ -1094,23 +1166,74 @@ def parse_headers(root, output=None, expand=True, debug=False):
         status = util.ConsoleProgressBar(sys.stdout, steps=len(modules))
         status.start("Parsing interface files")
 
-    failures = []
-    for x in modules:
-        m = refpolicy.Module()
-        m.name = x[0]
+    spt_stamp = None
+    if support_macros:
+        spt_stamp = (support_macros, _file_stamp(support_macros))
+    cached = {}
+    if cache:
+        cached = _load_cache(cache, spt_stamp, expand)
+
+    # Modules whose file is unchanged come from the cache, the others
+    # are parsed, in parallel if there is more than one to do.
+    results = [None] * len(modules)
+    stamps = [None] * len(modules)
+    todo = []
+    for i, x in enumerate(modules):
+        stamps[i] = _file_stamp(x[1])
+        entry = cached.get(x[1])
+        if entry and stamps[i] is not None and entry[0] == stamps[i]:
+            results[i] = (entry[1], None)
+            if output and not debug:
+                status.step()
+        else:
+            todo.append(i)
+
+    def done(i, result):
+        results[i] = result
+        if output and not debug:
+            status.step()
+
+    if expand:
+        _header_spt = spt
+    else:
+        _header_spt = None
+    work = [(modules[i][0], modules[i][1], debug) for i in todo]
+    if jobs == 0:
         try:
-            if expand:
-                parse_file(x[1], m, spt)
-            else:
-                parse_file(x[1], m)
-        except ValueError, e:
-            o(str(e) + "\n")
+            import multiprocessing
+            jobs = multiprocessing.cpu_count()
+        except (ImportError, NotImplementedError):
+            jobs = 1
+    if jobs > 1 and len(work) > 1:
+        import multiprocessing
+        pool = multiprocessing.Pool(min(jobs, len(work)))
+        try:
+            for n, result in enumerate(pool.imap(_parse_header_module, work, 8)):
+                done(todo[n], result)
+        finally:
+            pool.close()
+            pool.join()
+    else:
+        for i, args in zip(todo, work):
+            if debug:
+                o("parsing file %s\n" % args[1])
+            done(i, _parse_header_module(args))
+    _header_spt = None
+
+    failures = []
+    keep = {}
+    for i, x in enumerate(modules):
+        m, err = results[i]
+        if err is not None:
+            o(err + "\n")
             failures.append(x[1])
             continue
-
         headers.children.append(m)
-        if output and not debug:
-            status.step()
+        if stamps[i] is not None:
+            keep[x[1]] = (stamps[i], m)
+
+    if cache:
+        _save_cache(cache, spt_stamp, expand, keep)
 
     if len(failures):
         o("failed to parse some headers: %s" % ", ".join(failures))